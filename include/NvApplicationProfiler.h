@@ -37,10 +37,15 @@
 #define __NV_PROFILER_H__
 
 #include <iostream>
+#include <map>
 #include <pthread.h>
 #include <stdint.h>
+#include <string>
 #include <sys/time.h>
 #include <time.h>
+#include <vector>
+
+class NvElement;
 
 /**
  *
@@ -55,10 +60,14 @@
  * Only one instance of NvApplicationProfiler object gets created for the application.
  * It can be accessed using getProfilerInstance().
  *
- * NvApplicationProfiler currently samples CPU usage and provides peak and average CPU
- * usage during the profiling duration. It requires that the CPU frequency be
- * constant over the entire duration. To force this, NvApplicationProfiler will start only
- * when the CPU governor is set to @b performance.
+ * NvApplicationProfiler samples CPU usage and provides peak and average CPU
+ * usage during the profiling duration. CPU usage is only comparable between
+ * runs when the CPU frequency is constant, i.e. when the CPU governor is set
+ * to @b performance; with other governors a warning is printed.
+ *
+ * It can also export periodic metrics snapshots: CPU usage of the process and
+ * of each of its threads, process memory, and the throughput and latency
+ * percentiles of every registered element. See setMetricsExport().
  *
  * @defgroup l4t_mm_nvapplicationprofiler_group  Application Resource Profiler API
  * @ingroup aa_framework_api_group
@@ -84,6 +93,17 @@ public:
         uint32_t cpu_freq_mhz;
     } NvAppProfilerData;
 
+    /**
+     * Specifies the format of exported metrics snapshots.
+     */
+    typedef enum
+    {
+        /** One JSON object per line and snapshot. */
+        METRICS_FORMAT_JSON_LINES,
+        /** Prometheus text exposition format. */
+        METRICS_FORMAT_PROMETHEUS,
+    } MetricsFormat;
+
     static const uint64_t DefaultSamplingInterval = 100;
 
     /**
@@ -124,6 +144,66 @@ public:
      */
     void getProfilerData(NvAppProfilerData &data);
 
+    /**
+     * Registers an element whose profiling data is exported with the metrics.
+     *
+     * Enables profiling on the element if it is not enabled yet. The element
+     * must be unregistered before it is destroyed.
+     *
+     * @param[in] element Element to register.
+     * @param[in] stream Label of the stream the element processes, or NULL.
+     * @return 0 on success, -1 if the element is already registered.
+     */
+    int registerElement(NvElement *element, const char *stream = NULL);
+
+    /**
+     * Unregisters an element registered with registerElement().
+     *
+     * @param[in] element Element to unregister.
+     */
+    void unregisterElement(NvElement *element);
+
+    /**
+     * Configures the periodic export of metrics snapshots.
+     *
+     * Snapshots are written by the profiling thread, so the profiler must be
+     * started, and the export interval is rounded up to the sampling interval.
+     * A last snapshot is written when the profiler is stopped.
+     *
+     * @a destination is either
+     * - @b "-" for the standard output,
+     * - @b "unix:<path>" for a unix stream socket, where each Prometheus
+     *   snapshot ends with a "# EOF" line. Snapshots that cannot be written
+     *   without blocking are dropped and the socket is reconnected, or
+     * - the path of a file. JSON lines are appended to it, while each
+     *   Prometheus snapshot replaces its content atomically.
+     *
+     * Window values such as @c window_fps cover the time since the previous
+     * snapshot.
+     *
+     * @param[in] destination Where to write snapshots, or NULL to disable the export.
+     * @param[in] format Format of the snapshots.
+     * @param[in] interval_ms Interval between snapshots, in milliseconds.
+     * @return 0 on success, -1 if @a destination cannot be opened.
+     */
+    int setMetricsExport(const char *destination, MetricsFormat format,
+            uint32_t interval_ms);
+
+    /**
+     * Writes a metrics snapshot to the configured destination now.
+     *
+     * @return 0 on success, -1 if the export is disabled or failed.
+     */
+    int exportMetrics();
+
+    /**
+     * Writes a metrics snapshot to an output stream.
+     *
+     * @param[in] outstream A reference to an output stream of type std::ostream.
+     * @param[in] format Format of the snapshot.
+     */
+    void writeMetrics(std::ostream &outstream, MetricsFormat format);
+
 private:
     /**
      * Method run by the background profiling thread.
@@ -146,7 +226,55 @@ private:
 
     uint32_t num_cpu_cores; /**< Number of CPU cores. */
     uint32_t cpu_freq; /**< Operating frequency of CPU cores in MHz. */
-    bool check_cpu_usage; /**< Flag indicating if cpu usage should be checked. */
+    bool fixed_cpu_freq; /**< Flag indicating if the CPU governor is
+                              @b performance. */
+    long clock_ticks; /**< Clock ticks per second of /proc statistics. */
+    long page_size; /**< Page size of /proc/self/statm, in bytes. */
+
+    /**
+     * Holds an element registered for the metrics export (internal use only).
+     */
+    struct MetricsElement
+    {
+        NvElement *element;
+        std::string stream;
+        /** Units processed at the previous snapshot. */
+        uint64_t last_units;
+        /** Latency histogram at the previous snapshot. */
+        std::vector<uint64_t> last_histogram;
+    };
+
+    pthread_mutex_t metrics_lock; /**< Lock for the metrics members below. */
+    std::vector<MetricsElement> metrics_elements; /**< Registered elements. */
+    std::string metrics_destination; /**< Destination of the export, empty
+                                          if disabled. */
+    MetricsFormat metrics_format; /**< Format of the export. */
+    uint64_t metrics_interval_nsec; /**< Interval between snapshots. */
+    uint64_t next_metrics_nsec; /**< Monotonic time of the next snapshot. */
+    int metrics_fd; /**< Open file or socket of the export, or -1. */
+    bool metrics_error; /**< Indicates the last write failed, to log once. */
+    uint64_t last_metrics_nsec; /**< Monotonic time of the previous snapshot. */
+    struct timespec last_metrics_proc_cpu; /**< Process CPU clock at the
+                                                previous snapshot. */
+    std::map<int, uint64_t> last_thread_ticks; /**< CPU ticks of each thread
+                                                    at the previous snapshot. */
+    std::vector<uint64_t> histogram_bounds; /**< Upper bound of each
+                                                 latency bucket. */
+
+    /**
+     * Writes a snapshot to the destination if the export interval elapsed.
+     */
+    void exportMetricsIfDue(uint64_t now_nsec);
+
+    /**
+     * Writes a snapshot in @a format to @a out, metrics_lock held.
+     */
+    void collectMetrics(std::ostream &out, MetricsFormat format);
+
+    /**
+     * Writes a formatted snapshot to the destination, metrics_lock held.
+     */
+    int writeSnapshot(const std::string &snapshot);
 
     /**
      * Holds resource usage readings (internal use only).
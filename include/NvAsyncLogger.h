@@ -0,0 +1,310 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Asynchronous Logger</b>
+ *
+ * @b Description: This file declares the logger behind NvLogging and ZzLog.
+ */
+
+/**
+ * @defgroup l4t_mm_nvasynclogger_group Asynchronous Logger
+ * @ingroup l4t_mm_nvlogging_group
+ *
+ * Writing a log line to a terminal or pipe can block for milliseconds. A
+ * decode thread that logs with @c printf or @c std::cerr stalls for that
+ * long. With the asynchronous logger the calling thread only copies the
+ * message into its own ring buffer, without locks and system calls. A
+ * background thread formats and writes the messages.
+ *
+ * - printf-style messages are stored in binary form: the format string
+ *   pointer and the arguments. They are formatted on the writer thread. The
+ *   format, prefix and suffix strings are not copied and must stay valid,
+ *   e.g. literals. @c %s arguments are copied.
+ * - Text messages, e.g. the ones NvLogging builds with @c <<, are copied.
+ * - Each call site may log a burst of messages per interval. Further
+ *   messages are suppressed and counted, see #NvAsyncLogger::setRateLimit.
+ * - When a ring is full, messages are dropped and counted, the caller never
+ *   waits.
+ *
+ * Messages still buffered are written when the process exits normally, or
+ * by #NvAsyncLogger::flush. When the process crashes they are lost; set
+ * @c NV_LOG_SYNC=1 in the environment to write every message on the calling
+ * thread.
+ *
+ * @{
+ */
+
+#ifndef __NV_ASYNC_LOGGER_H_
+#define __NV_ASYNC_LOGGER_H_
+
+#include <atomic>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Size in bytes of the ring of each thread, a power of 2.
+ */
+#define ASYNC_LOGGER_RING_SIZE 65536
+
+/**
+ * Largest record in a ring. Longer messages are truncated.
+ */
+#define ASYNC_LOGGER_MAX_RECORD 4096
+
+/**
+ * Number of call sites each thread tracks for rate limiting, a power of 2.
+ */
+#define ASYNC_LOGGER_RATE_SLOTS 64
+
+/**
+ * Default burst of messages per call site and interval.
+ */
+#define ASYNC_LOGGER_DEFAULT_BURST 100
+
+/**
+ * Default rate limiting interval in milliseconds.
+ */
+#define ASYNC_LOGGER_DEFAULT_INTERVAL_MS 1000
+
+/**
+ * Default time in milliseconds the writer thread sleeps between writes.
+ */
+#define ASYNC_LOGGER_DEFAULT_FLUSH_MS 20
+
+/**
+ * @brief Buffers log messages per thread and writes them on a background
+ * thread.
+ *
+ * All methods are thread safe. Only one logger exists in a process, see
+ * #NvAsyncLogger::getLoggerInstance.
+ */
+class NvAsyncLogger
+{
+public:
+    /**
+     * Specifies where a message goes.
+     */
+    typedef enum
+    {
+        LOG_STREAM_STDOUT = 1,
+        LOG_STREAM_STDERR = 2,
+    } LogStream;
+
+    /**
+     * Prefixes the message with the time since the first such message, as
+     * [h:mm:ss:mmm].
+     */
+    static const uint32_t LOG_FLAG_ELAPSED_TIME = 1;
+    /**
+     * Wakes the writer thread right away, e.g. for errors.
+     */
+    static const uint32_t LOG_FLAG_URGENT = 2;
+
+    /**
+     * Gets the logger of the process.
+     *
+     * The logger is never destroyed, so static destructors may still log.
+     *
+     * @return A reference to the logger.
+     */
+    static NvAsyncLogger& getLoggerInstance();
+
+    /**
+     * Logs a printf-style message.
+     *
+     * The message is written as @a prefix, the formatted message, then
+     * @a suffix. @a fmt identifies the call site for rate limiting.
+     *
+     * @param[in] stream Where the message goes.
+     * @param[in] flags LOG_FLAG_* values.
+     * @param[in] prefix Literal written before the message, or NULL.
+     * @param[in] suffix Literal written after the message, or NULL.
+     * @param[in] fmt printf format, a literal.
+     * @param[in] args Arguments of @a fmt.
+     */
+    void vlog(LogStream stream, uint32_t flags, const char *prefix,
+            const char *suffix, const char *fmt, va_list args);
+
+    /**
+     * Logs a message that is already formatted.
+     *
+     * @param[in] stream Where the message goes.
+     * @param[in] flags LOG_FLAG_* values.
+     * @param[in] site Identifies the call site for rate limiting, e.g.
+     *                 a literal of the file and line, or NULL.
+     * @param[in] text The message, copied.
+     * @param[in] length Length of @a text.
+     */
+    void write(LogStream stream, uint32_t flags, const char *site,
+            const char *text, size_t length);
+
+    /**
+     * Writes the messages buffered so far, on the calling thread.
+     */
+    void flush();
+
+    /**
+     * Switches between buffering messages and writing each message on the
+     * calling thread. Messages buffered before are flushed.
+     *
+     * @param[in] async false to write on the calling thread.
+     */
+    void setAsync(bool async);
+
+    /**
+     * Checks whether messages are buffered.
+     *
+     * @return true if messages are written by the writer thread.
+     */
+    bool isAsync()
+    {
+        return async.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets how many messages each call site of each thread may log per
+     * interval. When the site logs again after the interval, a line tells
+     * how many messages were suppressed.
+     *
+     * @param[in] burst Messages per interval, or 0 to disable rate limiting.
+     * @param[in] interval_ms Length of the interval in milliseconds.
+     */
+    void setRateLimit(uint32_t burst, uint32_t interval_ms);
+
+    /**
+     * Sets how long the writer thread sleeps between writes.
+     *
+     * @param[in] interval_ms Time in milliseconds, at least 1.
+     */
+    void setFlushInterval(uint32_t interval_ms);
+
+    /**
+     * Gets the number of messages dropped because a ring was full.
+     */
+    uint64_t getDroppedCount()
+    {
+        return dropped_total.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages suppressed by rate limiting.
+     */
+    uint64_t getSuppressedCount()
+    {
+        return suppressed_total.load(std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * Holds the rate limiting state of one call site.
+     */
+    struct RateSlot
+    {
+        const void *site;
+        uint64_t window_start;      /**< CLOCK_MONOTONIC nsec. */
+        uint32_t count;             /**< Messages in the window. */
+        uint32_t suppressed;        /**< Messages not logged in the window. */
+    };
+
+    /**
+     * Holds the ring of one thread. Only the thread writes records, only
+     * the drain reads them.
+     */
+    struct ThreadRing
+    {
+        char *data;
+        std::atomic<uint64_t> head;     /**< Bytes written. */
+        std::atomic<uint64_t> tail;     /**< Bytes read. */
+        std::atomic<uint64_t> dropped;  /**< Messages not reported yet. */
+        std::atomic<bool> orphaned;     /**< The thread exited. */
+        RateSlot rate[ASYNC_LOGGER_RATE_SLOTS];
+    };
+
+    std::atomic<bool> async;
+    std::atomic<uint32_t> rate_burst;
+    std::atomic<uint64_t> rate_interval_nsec;
+    std::atomic<uint32_t> flush_interval_ms;
+    std::atomic<uint64_t> start_nsec;   /**< Origin of LOG_FLAG_ELAPSED_TIME,
+                                             0 until the first message. */
+    std::atomic<uint64_t> dropped_total;
+    std::atomic<uint64_t> suppressed_total;
+
+    pthread_key_t ring_key;         /**< ThreadRing of the calling thread. */
+    pthread_mutex_t rings_lock;     /**< Lock for @a rings and @a free_rings. */
+    std::vector<ThreadRing *> rings;
+    std::vector<ThreadRing *> free_rings; /**< Rings of exited threads. */
+
+    pthread_mutex_t drain_lock;     /**< Serializes drains and writes. */
+    std::vector<char> drain_records; /**< Records copied by the drain. */
+
+    pthread_once_t writer_once;
+    pthread_t writer_thread;
+    pthread_mutex_t writer_lock;
+    pthread_cond_t writer_cond;
+
+    /**
+     * Default constructor used by getLoggerInstance.
+     */
+    NvAsyncLogger();
+
+    /**
+     * Gets the ring of the calling thread, allocating or reusing one on
+     * first use.
+     */
+    ThreadRing *getThreadRing();
+
+    /**
+     * Applies rate limiting to a message of a call site.
+     *
+     * @param[in] rate Rate limiting state of the calling thread.
+     * @param[in] site The call site.
+     * @param[in] nsec Time of the message.
+     * @param[out] suppressed Messages suppressed before this one.
+     * @return false if the message is suppressed.
+     */
+    bool admit(RateSlot *rate, const void *site, uint64_t nsec,
+            uint32_t *suppressed);
+
+    /**
+     * Builds a record in @a buffer from @a fmt and @a args, or from
+     * @a text, and returns its size.
+     */
+    size_t buildRecord(char *buffer, LogStream stream, uint32_t flags,
+            uint32_t suppressed, const char *prefix, const char *suffix,
+            const char *fmt, va_list *args, const char *text, size_t length,
+            uint64_t nsec);
+
+    /**
+     * Copies a record into the ring of the calling thread, or writes it
+     * right away when messages are not buffered.
+     */
+    void submit(const char *record, size_t size, uint32_t flags);
+
+    /**
+     * Writes the records of all rings. Called with drain_lock held.
+     */
+    void drain();
+
+    /**
+     * Formats a record and appends it to @a out.
+     */
+    void formatRecord(const char *record, std::vector<char> &out);
+
+    static void *writerThread(void *arg);
+    static void startWriter();
+    static void releaseThreadRing(void *ring);
+    static void flushAtExit();
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvAsyncLogger(const NvAsyncLogger& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvAsyncLogger const&);
+};
+/** @} */
+#endif
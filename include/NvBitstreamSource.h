@@ -0,0 +1,207 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Bitstream Source</b>
+ *
+ * @b Description: This file declares a memory-mapped reader for the
+ * elementary stream files of the decode samples.
+ */
+
+/**
+ * @defgroup l4t_mm_nvbitstreamsource_group Bitstream Source
+ * @ingroup l4t_mm_nvvideo_group
+ *
+ * The samples read their input through @c std::ifstream: a chunk into a
+ * parse buffer, the first NAL unit copied out, then a seek back to its end.
+ * Each byte is read several times. A bitstream source maps the whole file
+ * instead. It finds NAL units and access units in the mapping with the
+ * start code scanner and hands out pointers into it, so the caller copies
+ * each unit once, into the decoder buffer.
+ *
+ * The mapping is read sequentially. The pages ahead of the read position
+ * are prefetched with @c madvise, and the pages far behind it are released
+ * so that long files do not stay resident.
+ *
+ * @{
+ */
+
+#ifndef __NV_BITSTREAM_SOURCE_H_
+#define __NV_BITSTREAM_SOURCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NvNalScanner.h"
+
+/**
+ * Default number of bytes prefetched ahead of the read position.
+ */
+#define BITSTREAM_SOURCE_DEFAULT_PREFETCH (8 * 1024 * 1024)
+
+/**
+ * @brief Reads an elementary stream file through a read-only mapping.
+ *
+ * Not thread safe, each thread or stream uses its own source.
+ */
+class NvBitstreamSource
+{
+public:
+    /**
+     * Maps a file.
+     *
+     * @param[in] path The file. It must be a regular file, pipes cannot be
+     *                 mapped.
+     * @param[in] prefetch_size Bytes prefetched ahead of the read position,
+     *                          or 0 to leave the paging to the kernel.
+     * @return A source, or NULL if the file cannot be opened or mapped.
+     */
+    static NvBitstreamSource *createBitstreamSource(const char *path,
+            size_t prefetch_size = BITSTREAM_SOURCE_DEFAULT_PREFETCH);
+
+    /**
+     * Unmaps the file. Pointers handed out become invalid.
+     */
+    ~NvBitstreamSource();
+
+    /**
+     * Gets the next NAL unit and moves the read position past it.
+     *
+     * Bytes in front of its start code are skipped. The unit extends to the
+     * next start code or to the end of the file.
+     *
+     * @param[in] codec Codec used to decode NvNalUnit::type.
+     * @param[out] unit The NAL unit, NvNalUnit::offset counted from the
+     *                  start of the file.
+     * @return Pointer to the start code of the unit, valid until the
+     *         source is deleted, or NULL at the end of the file.
+     */
+    const uint8_t *nextNalu(NvNalCodec codec, NvNalUnit *unit);
+
+    /**
+     * Gets the NAL units of the next access unit and moves the read
+     * position past them.
+     *
+     * An access unit ends in front of the parameter sets, SEI or access
+     * unit delimiter that follow a coded slice, or in front of the first
+     * slice of the next picture.
+     *
+     * @param[in] codec Codec of the stream.
+     * @param[out] unit The access unit. NvNalUnit::type is the type of its
+     *                  first coded slice, or of its first NAL unit if it
+     *                  has no slice.
+     * @return Pointer to the first start code of the access unit, or NULL
+     *         at the end of the file.
+     */
+    const uint8_t *nextAccessUnit(NvNalCodec codec, NvNalUnit *unit);
+
+    /**
+     * Copies bytes from the read position and moves the position past them.
+     *
+     * @param[out] dst Where to copy the bytes.
+     * @param[in] len Number of bytes to copy.
+     * @return Number of bytes copied, less than @a len at the end of the
+     *         file.
+     */
+    size_t read(void *dst, size_t len);
+
+    /**
+     * Gets bytes at the read position without copying them or moving the
+     * position.
+     *
+     * @param[in] len Number of bytes wanted.
+     * @return Pointer to the bytes, valid until the source is deleted, or
+     *         NULL if fewer than @a len bytes are left.
+     */
+    const uint8_t *peek(size_t len)
+    {
+        return data && len <= size - position ? data + position : NULL;
+    }
+
+    /**
+     * Moves the read position forward.
+     *
+     * @param[in] len Number of bytes to skip, the position stops at the end
+     *                of the file.
+     */
+    void skip(size_t len)
+    {
+        seek(len < size - position ? position + len : size);
+    }
+
+    /**
+     * Moves the read position.
+     *
+     * @param[in] position Offset from the start of the file, clamped to
+     *                     its size.
+     */
+    void seek(size_t position);
+
+    /**
+     * Moves the read position to the start of the file.
+     */
+    void rewind()
+    {
+        seek(0);
+    }
+
+    /**
+     * Gets the read position.
+     */
+    size_t getPosition()
+    {
+        return position;
+    }
+
+    /**
+     * Gets the size of the file.
+     */
+    size_t getSize()
+    {
+        return size;
+    }
+
+    /**
+     * Checks whether the read position is at the end of the file.
+     */
+    bool isEof()
+    {
+        return position >= size;
+    }
+
+private:
+    const uint8_t *data;        /**< The mapping, NULL for an empty file. */
+    size_t size;
+    size_t position;            /**< Read position. */
+    size_t prefetch_size;
+    size_t prefetched_end;      /**< End of the bytes prefetched so far. */
+    size_t released_end;        /**< End of the pages released so far. */
+    size_t page_size;
+
+    /**
+     * Constructor used by createBitstreamSource.
+     */
+    NvBitstreamSource(const uint8_t *data, size_t size, size_t prefetch_size);
+
+    /**
+     * Finds the NAL unit at or after @a from, without moving the read
+     * position.
+     *
+     * @return false if there is none.
+     */
+    bool findNalu(NvNalCodec codec, size_t from, NvNalUnit *unit);
+
+    /**
+     * Moves the read position forward, prefetching and releasing pages.
+     */
+    void advance(size_t new_position);
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvBitstreamSource(const NvBitstreamSource& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvBitstreamSource const&);
+};
+/** @} */
+#endif
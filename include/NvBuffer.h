@@ -57,6 +57,8 @@
  */
 #define MAX_PLANES 3
 
+class NvBufferPool;
+
 /**
  * @brief Class representing a buffer.
  *
@@ -208,6 +210,16 @@ public:
      * @return 0 for success, -1 otherwise.
      */
     int allocateMemory();
+    /**
+     * Allocates software memory for the buffer from a pool.
+     *
+     * Like NvBuffer::allocateMemory, but takes the memory of each plane from
+     * @a pool. NvBuffer::deallocateMemory returns it to the pool.
+     *
+     * @param[in] pool Pool to allocate from, or NULL to allocate directly.
+     * @return 0 for success, -1 otherwise.
+     */
+    int allocateMemory(NvBufferPool *pool);
     /**
      * Deallocates buffer memory.
      *
@@ -274,6 +286,8 @@ private:
                                          memory. */
     bool allocated;                 /**< Indicates if the buffer is allocated
                                          memory. */
+    NvBufferPool *memory_pool;      /**< Pool the allocated memory came from,
+                                         or NULL. */
     NvBuffer *shared_buffer; /**< If this is a DMABUF buffer, @c shared_buffer
                                 points to the MMAP @c NvBuffer whose FD was
                                 sent when this buffer was queued. */
@@ -0,0 +1,215 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Buffer Pool</b>
+ *
+ * @b Description: This file declares a pool that recycles buffer memory
+ * between the setups of planes and decoders.
+ */
+
+/**
+ * @defgroup l4t_mm_nvbufferpool_group Buffer Pool
+ * @ingroup l4t_mm_nvelement_group
+ *
+ * Planes and applications allocate their buffers on every setup and free
+ * them on every teardown, which includes each resolution change of a
+ * decoder. A pool keeps the released buffers and hands them out again to
+ * the next request with the same format and geometry.
+ *
+ * A pool holds two kinds of memory:
+ * - CPU memory, as used by @c V4L2_MEMORY_USERPTR planes.
+ * - Hardware buffers created with \c NvBufferCreateEx, identified by their
+ *   DMABUF FD.
+ *
+ * Buffers are allocated lazily, when no idle buffer of the requested key is
+ * left. The pool records, per key, the most buffers in use at the same
+ * time. Idle buffers stay in the pool until #NvBufferPool::trim, or until
+ * a key holds more than the idle limit.
+ *
+ * Builds defining \c NVBUFFERPOOL_CPU_ONLY do not link against the
+ * \c nvbuf_utils library and support only CPU memory.
+ *
+ * @{
+ */
+
+#ifndef __NV_BUFFER_POOL_H_
+#define __NV_BUFFER_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "nvbuf_utils.h"
+
+/**
+ * @brief Statistics of the buffers of one key.
+ */
+typedef struct
+{
+    /** Whether the buffers are DMABUFs. Otherwise they are CPU memory. */
+    bool dmabuf;
+    uint32_t width;
+    uint32_t height;
+    /** \c NvBufferColorFormat of DMABUFs, bytes per pixel of CPU memory. */
+    uint32_t format;
+    /** \c NvBufferLayout of DMABUFs, 0 for CPU memory. */
+    uint32_t layout;
+    /** Bytes per buffer, all planes of a DMABUF. */
+    uint64_t size;
+    uint32_t in_use;
+    uint32_t idle;
+    /** Most buffers in use at the same time since the last trim. */
+    uint32_t high_water;
+    /** Buffers allocated because no idle one was left. */
+    uint64_t allocations;
+    /** Buffers handed out again from the idle ones. */
+    uint64_t reuses;
+} NvBufferPoolStats;
+
+/**
+ * @brief Recycles CPU memory and DMABUFs keyed by format and geometry.
+ *
+ * All methods are thread safe. The allocations themselves run without the
+ * pool lock held.
+ */
+class NvBufferPool
+{
+public:
+    /**
+     * Creates an empty pool.
+     *
+     * @param[in] name Name of the pool, used for logs.
+     * @return Reference to the new pool, or NULL on failure.
+     */
+    static NvBufferPool *createBufferPool(const char *name);
+
+    /**
+     * Gets the pool shared by the whole process. It is created on the first
+     * call and never deleted.
+     */
+    static NvBufferPool *getProcessPool();
+
+    /**
+     * Frees all buffers of the pool, including the ones still in use.
+     */
+    ~NvBufferPool();
+
+    /**
+     * Gets CPU memory for one plane of a buffer.
+     *
+     * @param[in] width Width of the plane in pixels.
+     * @param[in] height Height of the plane in pixels.
+     * @param[in] bytesperpixel Bytes per pixel of the plane.
+     * @param[in] size Bytes to allocate.
+     * @param[out] data Start of the memory.
+     * @return 0 for success, -1 otherwise.
+     */
+    int acquireMemory(uint32_t width, uint32_t height, uint32_t bytesperpixel,
+            uint32_t size, unsigned char **data);
+    /**
+     * Returns memory got from #acquireMemory to the pool.
+     *
+     * @return 0 for success, -1 if the memory is not from this pool.
+     */
+    int releaseMemory(unsigned char *data);
+
+    /**
+     * Gets a hardware buffer, like \c NvBufferCreateEx does.
+     *
+     * The key of the buffer is made of @a width, @a height, @a colorFormat,
+     * @a layout and @a payloadType of @a params.
+     *
+     * @param[in] params Parameters of the buffer.
+     * @param[out] fd DMABUF FD of the buffer.
+     * @return 0 for success, -1 otherwise.
+     */
+    int acquireDmabuf(NvBufferCreateParams *params, int *fd);
+    /**
+     * Returns a DMABUF got from #acquireDmabuf to the pool.
+     *
+     * @return 0 for success, -1 if the FD is not from this pool.
+     */
+    int releaseDmabuf(int fd);
+
+    /**
+     * Sets how many idle buffers a key keeps at most. Buffers released
+     * beyond the limit are freed at once. The default keeps all of them.
+     */
+    void setIdleLimit(uint32_t max_idle);
+
+    /**
+     * Frees all idle buffers and resets the high-water marks to the buffers
+     * in use.
+     */
+    void trim();
+
+    /**
+     * Gets the statistics of the keys of the pool.
+     *
+     * @param[out] stats Array of @a max_stats entries to fill.
+     * @param[in] max_stats Size of @a stats.
+     * @return Number of keys in the pool, which may exceed @a max_stats.
+     */
+    uint32_t getStats(NvBufferPoolStats *stats, uint32_t max_stats);
+
+    /**
+     * Gets the bytes held by the pool, in use and idle.
+     */
+    uint64_t getTotalBytes();
+
+private:
+    struct Key
+    {
+        bool dmabuf;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t layout;
+        uint32_t payload;
+        uint64_t size;      /**< Requested bytes for CPU memory and
+                                 MemHandle DMABUFs, 0 for surfaces. */
+
+        bool operator<(const Key &o) const;
+    };
+
+    struct Entry
+    {
+        std::vector<uintptr_t> idle;   /**< CPU addresses or DMABUF FDs. */
+        uint32_t in_use;
+        uint32_t high_water;
+        uint64_t allocations;
+        uint64_t reuses;
+        uint64_t buffer_size;
+    };
+
+    const char *comp_name;
+    pthread_mutex_t pool_lock;
+    std::map<Key, Entry> entries;
+    std::map<uintptr_t, Key> busy_memory;
+    std::map<int, Key> busy_dmabufs;
+    uint32_t idle_limit;
+
+    NvBufferPool(const char *name);
+    NvBufferPool(const NvBufferPool& that);
+    void operator=(NvBufferPool const&);
+
+    /**
+     * Takes an idle buffer of @a key, if any. Called with #pool_lock held.
+     */
+    bool takeIdle(const Key &key, uintptr_t *handle);
+    /**
+     * Records a buffer handed out. Called with #pool_lock held.
+     */
+    Entry &markInUse(const Key &key);
+    /**
+     * Moves a released buffer to the idle ones of its key, or tells the
+     * caller to free it. Called with #pool_lock held.
+     *
+     * @return true if the caller frees the buffer.
+     */
+    bool putIdle(const Key &key, uintptr_t handle);
+    static void freeBuffer(const Key &key, uintptr_t handle);
+};
+
+/** @} */
+#endif
@@ -0,0 +1,187 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Shared DQ Worker Pool</b>
+ *
+ * @b Description: This file declares a pool of threads that runs the DQ
+ * callbacks of many V4L2 element planes.
+ */
+
+/**
+ * @defgroup l4t_mm_nvdqworkerpool_group DQ Worker Pool
+ * @ingroup l4t_mm_nvelement_group
+ *
+ * Without a pool, every plane started with
+ * NvV4l2ElementPlane::startDQThread gets a thread of its own that spends
+ * most of its time blocked in \c VIDIOC_DQBUF. An application running many
+ * decoders and converters ends up with hundreds of such threads.
+ *
+ * A pool waits for all its planes with one epoll instance and dequeues
+ * from a plane only once its FD reports a finished buffer. A fixed number
+ * of workers call the DQ callbacks. A plane is handed to one worker at a
+ * time and is re-armed only after its callback returns. The callbacks of
+ * one plane therefore never overlap and see the buffers in dequeue order.
+ * Callbacks of different planes run in parallel.
+ *
+ * A plane that is not streaming or has no buffer queued is parked instead
+ * of polled. Queuing a buffer or turning the stream on wakes it up again.
+ * Turning the stream off detaches the plane, like a DQ Thread exits.
+ *
+ * @{
+ */
+
+#ifndef __NV_DQ_WORKER_POOL_H_
+#define __NV_DQ_WORKER_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include "NvThreadPolicy.h"
+
+/**
+ * Maximum number of planes attached to one pool at the same time.
+ */
+#define MAX_DQ_POOL_PLANES 512
+
+class NvV4l2ElementPlane;
+
+/**
+ * @brief Runs the DQ callbacks of many planes on a fixed set of threads.
+ *
+ * Attach a plane with NvV4l2ElementPlane::setDQWorkerPool before calling
+ * NvV4l2ElementPlane::startDQThread. From then on the plane behaves as if it
+ * had its own DQ Thread: #NvV4l2ElementPlane::waitForDQThread returns once
+ * the callback returned false or the stream was turned off, and
+ * #NvV4l2ElementPlane::stopDQThread detaches it.
+ *
+ * The element FD must support \c poll(). A plane whose FD cannot be added
+ * to the epoll instance falls back to a DQ Thread of its own.
+ *
+ * Delete the pool only after stopping the DQ callbacks of its planes.
+ */
+class NvDQWorkerPool
+{
+public:
+    /**
+     * Creates a pool and starts its workers.
+     *
+     * @param[in] name Name of the pool, used for logs and, unless @a policy
+     *                 names them, for the worker threads.
+     * @param[in] num_workers Number of worker threads, at least 1.
+     * @param[in] policy Scheduling policy the workers apply to themselves, or
+     *                   NULL to keep what they inherit.
+     * @return Reference to the new pool, or NULL on failure.
+     */
+    static NvDQWorkerPool *createDQWorkerPool(const char *name,
+            uint32_t num_workers, const NvThreadPolicy *policy = NULL);
+
+    /**
+     * Stops the workers and frees the pool.
+     *
+     * Planes still attached are detached as if their DQ Thread had exited;
+     * their DQ callbacks are not called again.
+     */
+    ~NvDQWorkerPool();
+
+    /**
+     * Gets the number of planes currently attached.
+     */
+    uint32_t getNumPlanes();
+
+    /**
+     * Indicates whether the pool failed to initialize.
+     */
+    int isInError()
+    {
+        return is_in_error;
+    }
+
+private:
+    /**
+     * State of a plane slot. A slot is ARMED while its FD waits in epoll,
+     * PARKED while the plane has no buffer queued, PENDING while it waits
+     * for a worker without an FD event and BUSY while a worker services it.
+     */
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_ARMED,
+        SLOT_PARKED,
+        SLOT_PENDING,
+        SLOT_BUSY
+    };
+
+    struct Slot
+    {
+        NvV4l2ElementPlane *plane;
+        int fd;                 /**< Duplicate of the element FD, one per plane. */
+        uint32_t events;        /**< EPOLLIN for capture, EPOLLOUT for output planes. */
+        uint32_t generation;    /**< Bumped on release, rejects stale events. */
+        SlotState state;
+        bool kicked;            /**< Woken up while BUSY, re-check when done. */
+        bool remove;            /**< Detached from its own callback. */
+        bool streamoff;         /**< The stream was turned off, detach. */
+        pthread_t worker;       /**< Worker servicing the slot while BUSY. */
+    };
+
+    const char *comp_name;
+    int is_in_error;
+    int epoll_fd;
+    int wake_fd;            /**< eventfd that hands PENDING slots to the workers. */
+    bool stopping;
+    NvThreadPolicy worker_policy;
+
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_cond;   /**< Signaled when a slot stops being BUSY. */
+    std::vector<Slot> slots;
+    std::vector<uint64_t> pending;
+    uint32_t num_planes;
+    std::vector<pthread_t> workers;
+
+    NvDQWorkerPool(const char *name, uint32_t num_workers,
+            const NvThreadPolicy *policy);
+    NvDQWorkerPool(const NvDQWorkerPool& that);
+    void operator=(NvDQWorkerPool const&);
+
+    /**
+     * Attaches a plane. Called by NvV4l2ElementPlane::startDQThread with
+     * the plane lock held.
+     *
+     * @return 0 for success, -1 if the plane FD cannot be polled or the
+     *         pool is full.
+     */
+    int addPlane(NvV4l2ElementPlane *plane);
+    /**
+     * Detaches a plane and waits for its callback to return, unless called
+     * from that callback.
+     */
+    int removePlane(NvV4l2ElementPlane *plane);
+    /**
+     * Makes a worker look at a parked or armed plane without an FD event.
+     * Called with the plane lock held when a buffer is queued on a parked
+     * plane or the stream is turned on or off.
+     *
+     * @param[in] streamoff Whether the stream was turned off, which ends
+     *                      the DQ callbacks of the plane.
+     */
+    void kickPlane(NvV4l2ElementPlane *plane, bool streamoff);
+
+    static void *workerThread(void *data);
+    void service(uint64_t id, uint32_t events);
+    /**
+     * Dequeues and calls the plane callback.
+     * @return false once the callback asked to stop.
+     */
+    bool dispatch(NvV4l2ElementPlane *plane, uint32_t events);
+    /** Frees a slot. Called with #pool_lock held. */
+    void releaseSlot(uint32_t index);
+    /** Queues a slot for the workers. Called with #pool_lock held. */
+    void queuePending(uint32_t index);
+    /** Marks the plane as no longer running its DQ callbacks. */
+    static void finishPlane(NvV4l2ElementPlane *plane);
+
+    friend class NvV4l2ElementPlane;
+};
+
+/** @} */
+#endif
@@ -0,0 +1,225 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Container Demuxer</b>
+ *
+ * @b Description: This file declares the MP4, Matroska and MPEG-TS demuxers
+ * that feed the video decoder of the samples.
+ */
+
+/**
+ * @defgroup l4t_mm_nvdemuxer_group Container Demuxer
+ * @ingroup l4t_mm_nvvideo_group
+ *
+ * A demuxer reads the video track of a container file through a
+ * NvBitstreamSource and writes one frame at a time into a buffer, usually
+ * an output plane buffer of NvVideoDecoder. H.264 and H.265 frames are
+ * written in Annex-B form. For MP4 and Matroska the NAL unit length
+ * prefixes are replaced by start codes and the parameter sets of the avcC
+ * or hvcC record are written in front of the first frame and of the first
+ * frame after a seek.
+ *
+ * Seeking uses the index of the container: the sample tables of MP4, the
+ * cues of Matroska (or the clusters when there are none), and for MPEG-TS
+ * a table of the random access points built on the first seek.
+ *
+ * @{
+ */
+
+#ifndef __NV_DEMUXER_H_
+#define __NV_DEMUXER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "NvBitstreamSource.h"
+
+/**
+ * Codec of the video track.
+ */
+typedef enum
+{
+    NV_DEMUXER_CODEC_UNKNOWN,
+    NV_DEMUXER_CODEC_H264,
+    NV_DEMUXER_CODEC_H265,
+    NV_DEMUXER_CODEC_VP8,
+    NV_DEMUXER_CODEC_VP9,
+    NV_DEMUXER_CODEC_MPEG2,
+} NvDemuxerCodec;
+
+/**
+ * Describes a frame written by NvDemuxer::readSample.
+ */
+typedef struct
+{
+    size_t size;                /**< Bytes written to the buffer. */
+    uint64_t pts;               /**< Presentation time in microseconds. */
+    bool key_frame;             /**< The frame can be decoded on its own. */
+} NvDemuxerSample;
+
+/**
+ * @brief Reads the video frames of a container file.
+ *
+ * Not thread safe, each thread or stream uses its own demuxer.
+ */
+class NvDemuxer
+{
+public:
+    /**
+     * Opens a container file. The format is found from the first bytes of
+     * the file, not from its name.
+     *
+     * @param[in] path The file.
+     * @return A demuxer for the first video track, or NULL if the file
+     *         cannot be read, is not MP4, Matroska or MPEG-TS, or has no
+     *         supported video track.
+     */
+    static NvDemuxer *createDemuxer(const char *path);
+
+    /**
+     * Closes the file.
+     */
+    virtual ~NvDemuxer();
+
+    /**
+     * Writes the next frame of the video track.
+     *
+     * @param[out] dst Where to write the frame.
+     * @param[in] dst_size Size of @a dst in bytes.
+     * @param[out] sample The frame written.
+     * @return 1 if a frame was written, 0 at the end of the track, -1 on
+     *         error, also if the frame does not fit @a dst.
+     */
+    virtual int readSample(uint8_t *dst, size_t dst_size,
+            NvDemuxerSample *sample) = 0;
+
+    /**
+     * Moves to the last key frame at or before a time.
+     *
+     * @param[in] pts Presentation time in microseconds. 0 starts over.
+     * @return 0 on success, -1 on error.
+     */
+    virtual int seek(uint64_t pts) = 0;
+
+    /**
+     * Gets the name of the container format.
+     */
+    virtual const char *getFormatName() = 0;
+
+    /**
+     * Gets the codec of the video track.
+     */
+    NvDemuxerCodec getCodec()
+    {
+        return codec;
+    }
+
+    /**
+     * Gets the frame width in pixels, or 0 if the container does not tell.
+     */
+    uint32_t getWidth()
+    {
+        return width;
+    }
+
+    /**
+     * Gets the frame height in pixels, or 0 if the container does not tell.
+     */
+    uint32_t getHeight()
+    {
+        return height;
+    }
+
+    /**
+     * Gets the duration of the track in microseconds, or 0 if the
+     * container does not tell.
+     */
+    uint64_t getDuration()
+    {
+        return duration;
+    }
+
+    /**
+     * Reads a big-endian unsigned integer of up to 8 bytes.
+     */
+    static uint64_t readBigEndian(const uint8_t *data, size_t len);
+
+protected:
+    NvBitstreamSource *source;  /**< The file, owned by the demuxer. */
+    NvDemuxerCodec codec;
+    uint32_t width;
+    uint32_t height;
+    uint64_t duration;
+
+    /**
+     * Parameter sets in Annex-B form, written in front of the first frame
+     * and of the first frame after a seek.
+     */
+    std::vector<uint8_t> codec_config;
+    bool config_pending;        /**< Write codec_config with the next frame. */
+    /**
+     * Size of the length prefix of the NAL units in a frame, 1, 2 or 4, or
+     * 0 if the frames are in Annex-B form already.
+     */
+    uint32_t nal_length_size;
+
+    /**
+     * Constructor used by the demuxers, takes ownership of @a source.
+     */
+    NvDemuxer(NvBitstreamSource *source);
+
+    /**
+     * Takes the parameter sets and the NAL length size from an
+     * AVCDecoderConfigurationRecord (ISO/IEC 14496-15 5.3.3.1).
+     *
+     * @return false if the record is malformed.
+     */
+    bool parseAvcConfig(const uint8_t *data, size_t size);
+
+    /**
+     * Takes the parameter sets and the NAL length size from an
+     * HEVCDecoderConfigurationRecord (ISO/IEC 14496-15 8.3.3.1).
+     *
+     * @return false if the record is malformed.
+     */
+    bool parseHevcConfig(const uint8_t *data, size_t size);
+
+    /**
+     * Writes a frame, with the pending codec config in front of it and its
+     * NAL unit length prefixes replaced by start codes.
+     *
+     * @return Bytes written, or -1 if the frame does not fit @a dst or its
+     *         length prefixes overrun it.
+     */
+    ssize_t writeSample(const uint8_t *data, size_t size, uint8_t *dst,
+            size_t dst_size);
+
+    /**
+     * Scales a time to microseconds.
+     *
+     * @param[in] time The time in units of 1/@a timescale seconds.
+     * @param[in] timescale Units per second.
+     */
+    static uint64_t toMicroseconds(uint64_t time, uint64_t timescale);
+
+private:
+    /**
+     * Creates the demuxer of each format, taking ownership of @a source.
+     * They return NULL after deleting @a source if the file cannot be used.
+     */
+    static NvDemuxer *createMp4Demuxer(NvBitstreamSource *source);
+    static NvDemuxer *createMkvDemuxer(NvBitstreamSource *source);
+    static NvDemuxer *createTsDemuxer(NvBitstreamSource *source);
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvDemuxer(const NvDemuxer& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvDemuxer const&);
+};
+/** @} */
+#endif
@@ -104,6 +104,24 @@ public:
      */
     bool isProfilingEnabled();
 
+    /**
+     * Gets the latency histogram of the element.
+     *
+     * @sa NvElementProfiler::getLatencyHistogram
+     */
+    uint32_t getLatencyHistogram(uint64_t *counts, uint64_t *upper_bounds_usec,
+            uint32_t max_buckets);
+
+    /**
+     * Gets the name of the element.
+     *
+     * @return The name given when the element was created.
+     */
+    const char *getName()
+    {
+        return comp_name;
+    }
+
 protected:
 
     /**
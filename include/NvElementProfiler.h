@@ -31,7 +31,7 @@
 
 #include <iostream>
 #include <pthread.h>
-#include <map>
+#include <atomic>
 #include <stdint.h>
 #include <sys/time.h>
 
@@ -42,6 +42,24 @@
  * @b Description: This file profiles the performance of individual elements.
  */
 
+/**
+ * Number of units whose start time the profiler remembers. A unit started
+ * more than this many units before it finishes gets no latency sample.
+ */
+#define PROFILER_RING_SIZE 1024
+
+/**
+ * Number of counter sets the threads of an element spread their updates
+ * over. Threads beyond this number share sets.
+ */
+#define PROFILER_SHARDS 8
+
+/**
+ * Number of latency histogram buckets. Values below 8 usec get a bucket
+ * each, every power of two above is split into 8 buckets, which keeps the
+ * relative error of a bucket under 12.5%, up to 2^40 usec.
+ */
+#define PROFILER_HISTOGRAM_BUCKETS 304
 
 /**
  *
@@ -65,6 +83,13 @@
  * type [ProfilerField](@ref NvElementProfiler::ProfilerField), which is also
  * included in the structure.
  *
+ * startProcessing() and finishProcessing() take no lock and are meant to stay
+ * enabled in production. Start times go to a fixed ring of
+ * #PROFILER_RING_SIZE monotonic timestamps. Each thread counts into one of
+ * #PROFILER_SHARDS counter sets, and the sets are summed when the data is
+ * read. Latencies are also recorded in a histogram, from which percentiles
+ * are computed.
+ *
  * @defgroup l4t_mm_nvelementprofiler_group  Element Profiler API
  * @ingroup aa_framework_api_group
  * @{
@@ -101,11 +126,20 @@ public:
         uint64_t min_latency_usec;
         /** Maximum of latencies for each processed units, in microseconds. */
         uint64_t max_latency_usec;
+        /** Latency percentiles, in microseconds. Upper bound of the histogram
+         *  bucket holding the percentile, at most @a max_latency_usec. */
+        uint64_t p50_latency_usec;
+        uint64_t p90_latency_usec;
+        uint64_t p99_latency_usec;
+        uint64_t p999_latency_usec;
 
         /** Total units processed. */
         uint64_t total_processed_units;
         /** Number of units which arrived late at the element. */
         uint64_t num_late_units;
+        /** Units finished without a latency sample, because their start
+         *  time was overwritten in the ring. */
+        uint64_t num_dropped_samples;
 
         /** Average rate at which the units were processed. */
         float average_fps;
@@ -121,6 +155,21 @@ public:
      */
     void getProfilerData(NvElementProfilerData &data);
 
+    /**
+     * Gets the latency histogram of the element.
+     *
+     * Bucket @a i counts the latencies from the upper bound of bucket
+     * @a i - 1, exclusive, to @a upper_bounds_usec[i], inclusive.
+     *
+     * @param[out] counts Latencies in each bucket.
+     * @param[out] upper_bounds_usec Upper bound of each bucket, or NULL.
+     * @param[in] max_buckets Size of the arrays.
+     * @return Number of buckets up to the last non-empty one, at most
+     *         @a max_buckets.
+     */
+    uint32_t getLatencyHistogram(uint64_t *counts, uint64_t *upper_bounds_usec,
+            uint32_t max_buckets);
+
     /**
      * Prints the element's profiling data to an output stream.
      *
@@ -163,38 +212,58 @@ public:
     void disableProfiling();
 private:
     /**
-     * Resets the profiler data.
+     * Resets the profiler data. Called with #profiler_lock held.
      */
     void reset();
 
-    pthread_mutex_t profiler_lock; /**< Mutex to synchronize multithreaded access to profiler data. */
+    /**
+     * Start time of a unit. @a id is written last and cleared by whoever
+     * finishes the unit, so a slot reused by a later unit is detected.
+     */
+    struct UnitSlot {
+        std::atomic<uint64_t> id;
+        std::atomic<uint64_t> start_nsec;
+    };
 
-    bool enabled; /**< Flag indicating if profiler is enabled. */
+    /**
+     * Counters updated by the threads mapped to the set. Summed on read.
+     */
+    struct Shard {
+        std::atomic<uint64_t> units;
+        std::atomic<uint64_t> late_units;
+        std::atomic<uint64_t> dropped_samples;
+        std::atomic<uint64_t> total_latency_usec;
+        std::atomic<uint64_t> min_latency_usec;
+        std::atomic<uint64_t> max_latency_usec;
+        /** Monotonic time at which the set saw its first and latest unit. */
+        std::atomic<uint64_t> first_nsec;
+        std::atomic<uint64_t> last_nsec;
+        std::atomic<uint64_t> histogram[PROFILER_HISTOGRAM_BUCKETS];
+        /** Keeps the hot counters of two sets out of one cache line. */
+        char pad[64];
+    };
 
-    const ProfilerField valid_fields; /**< Valid fields for the element. */
+    pthread_mutex_t profiler_lock; /**< Serializes enable, disable, reset and reads. */
+
+    std::atomic<bool> enabled; /**< Flag indicating if profiler is enabled. */
 
-    struct NvElementProfilerDataInternal : NvElementProfilerData {
-        /** Wall-clock time at which the first unit was processed. */
-        struct timeval start_time;
+    const ProfilerField valid_fields; /**< Valid fields for the element. */
 
-        /** Wall-clock time at which the latest unit was processed. */
-        struct timeval stop_time;
+    /** Profiling time of the earlier enabled periods, in nanoseconds. */
+    uint64_t accumulated_nsec;
 
-        /** Total accumulated time.
-         *  When performance measurement is restarted @a start_time and @a stop_time
-         *  are reset. This field is used to accumulate time before
-         *  resetting. */
-        struct timeval accumulated_time;
+    Shard shards[PROFILER_SHARDS];
 
-        /** Total accumulated latency for all units, in microseconds. */
-        uint64_t total_latency;
-    } data_int;
+    /** Start times of the recent units, indexed by ID. */
+    UnitSlot unit_ring[PROFILER_RING_SIZE];
 
-    /** Queue used to maintain the timestamps of when the unit
-     *  processing started. Required to calculate latency. */
-    std::map<uint64_t, struct timeval> unit_start_time_queue;
+    std::atomic<uint64_t> unit_id_counter; /**< Unique ID of the last unit. */
+    std::atomic<uint64_t> finished_id; /**< Last ID picked by finishProcessing(0). */
 
-    uint64_t unit_id_counter; /**< Unique ID of the last unit. */
+    /**
+     * Records a finished unit in the set of the calling thread.
+     */
+    void recordUnit(uint64_t now_nsec, int64_t latency_usec, bool is_late);
 
     /**
      * Constructor for NvElementProfiler.
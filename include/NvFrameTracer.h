@@ -0,0 +1,198 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Frame Tracer</b>
+ *
+ * @b Description: This file declares a tracer that follows frames through
+ * the stages of a pipeline.
+ */
+
+/**
+ * @defgroup l4t_mm_nvframetracer_group Frame Tracer
+ * @ingroup l4t_mm_nvelement_group
+ *
+ * NvElementProfiler measures the latency of each element on its own. The
+ * frame tracer records when each frame enters and leaves each stage, from
+ * bitstream ingest through decode, transform and encode to the renderer,
+ * so the time of one frame can be followed across elements and threads.
+ *
+ * A frame is identified by its V4L2 timestamp within a trace stream. The
+ * stages only pass the timestamp on, as V4L2 elements copy it from the
+ * output to the capture plane. A side table maps (stream, timestamp) to a
+ * frame ID, unique over the whole trace.
+ *
+ * Each thread records its events in its own ring buffer, without locks.
+ * When a ring is full its oldest events are overwritten. The rings are
+ * written to a file as Chrome trace-event JSON, which chrome://tracing and
+ * ui.perfetto.dev open. Each frame is one async track whose slices are the
+ * stages.
+ *
+ * @{
+ */
+
+#ifndef __NV_FRAME_TRACER_H_
+#define __NV_FRAME_TRACER_H_
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Number of (stream, timestamp) entries of the side table, a power of 2.
+ * An entry is reused by a later frame whose key maps to the same entry.
+ */
+#define FRAME_TRACER_TABLE_SIZE 4096
+
+/**
+ * Default number of events of the ring of each thread.
+ */
+#define FRAME_TRACER_DEFAULT_EVENTS 16384
+
+/**
+ * @brief Records the stages of frames and dumps them as Chrome trace JSON.
+ *
+ * All methods are thread safe. Only one tracer exists in a process, see
+ * #NvFrameTracer::getTracerInstance.
+ */
+class NvFrameTracer
+{
+public:
+    /**
+     * Specifies the kind of a trace event.
+     */
+    typedef enum
+    {
+        TRACE_BEGIN,    /**< The frame enters the stage. */
+        TRACE_END,      /**< The frame leaves the stage. */
+        TRACE_INSTANT,  /**< Something happens to the frame. */
+    } TracePhase;
+
+    /**
+     * Gets the tracer of the process.
+     *
+     * @return A reference to the tracer.
+     */
+    static NvFrameTracer& getTracerInstance();
+
+    /**
+     * Enables or disables tracing.
+     *
+     * Rings are allocated when a thread records its first event. Rings
+     * allocated before keep their size.
+     *
+     * @param[in] events_per_thread Size of the ring of each thread, or 0 to
+     *                              disable tracing.
+     */
+    void enable(uint32_t events_per_thread = FRAME_TRACER_DEFAULT_EVENTS);
+
+    /**
+     * Checks whether tracing is enabled.
+     *
+     * @return true if tracing is enabled.
+     */
+    bool isEnabled()
+    {
+        return events_per_thread.load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Gets the ID of a frame, creating it if the key is not known yet.
+     *
+     * @param[in] stream Trace stream of the frame, lower 15 bits.
+     * @param[in] timestamp Timestamp of the frame, lower 48 bits.
+     * @return ID of the frame, starting from 1.
+     */
+    uint64_t getFrameId(uint32_t stream, int64_t timestamp);
+
+    /**
+     * Records an event of a frame in the ring of the calling thread.
+     *
+     * Does nothing while tracing is disabled.
+     *
+     * @param[in] stream Trace stream of the frame.
+     * @param[in] timestamp Timestamp of the frame.
+     * @param[in] stage Name of the stage. The string is not copied and must
+     *                  stay valid until the trace is dumped, e.g. a literal.
+     * @param[in] phase Kind of the event.
+     */
+    void trace(uint32_t stream, int64_t timestamp, const char *stage,
+            TracePhase phase);
+
+    /**
+     * Writes the events of all threads as Chrome trace-event JSON.
+     *
+     * Threads may keep recording meanwhile. Events they overwrite during
+     * the dump are left out.
+     *
+     * @param[in] path File to write.
+     * @return Number of events written, or -1 if the file cannot be written.
+     */
+    int dumpChromeTrace(const char *path);
+
+private:
+    /**
+     * Holds one entry of the side table.
+     */
+    struct FrameSlot
+    {
+        std::atomic<uint64_t> key;      /**< Stream and timestamp, 0 if unused. */
+        std::atomic<uint64_t> frame_id;
+    };
+
+    /**
+     * Holds one event. The fields are atomics because a dump may read an
+     * event while its thread overwrites it.
+     */
+    struct Event
+    {
+        std::atomic<uint64_t> nsec;     /**< CLOCK_MONOTONIC time. */
+        std::atomic<uint64_t> frame_id;
+        std::atomic<int64_t> timestamp;
+        std::atomic<const char *> stage;
+        std::atomic<uint32_t> stream_phase; /**< Stream << 8 | phase. */
+    };
+
+    /**
+     * Holds the ring of one thread, kept after the thread exits.
+     */
+    struct ThreadBuffer
+    {
+        int tid;
+        char name[16];
+        uint32_t mask;                  /**< Number of events - 1. */
+        Event *events;
+        /** Index of the event being written, ahead of @a head while the
+         *  thread writes it. */
+        std::atomic<uint64_t> claimed;
+        std::atomic<uint64_t> head;     /**< Number of events written. */
+    };
+
+    std::atomic<uint32_t> events_per_thread; /**< Size of new rings, 0 if
+                                                  disabled. */
+    std::atomic<uint64_t> frame_id_counter; /**< Last frame ID handed out. */
+    FrameSlot table[FRAME_TRACER_TABLE_SIZE]; /**< Side table. */
+
+    pthread_mutex_t buffers_lock;   /**< Lock for @a buffers. */
+    std::vector<ThreadBuffer *> buffers; /**< Rings of all threads. */
+
+    /**
+     * Gets the ring of the calling thread, allocating it on first use.
+     */
+    ThreadBuffer *getThreadBuffer();
+
+    /**
+     * Default constructor used by getTracerInstance.
+     */
+    NvFrameTracer();
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvFrameTracer(const NvFrameTracer& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvFrameTracer const&);
+};
+/** @} */
+#endif
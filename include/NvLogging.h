@@ -39,6 +39,8 @@
 #include <iostream>
 #include <sstream>
 
+#include "NvAsyncLogger.h"
+
 /**
  *
  * @defgroup l4t_mm_nvlogging_group Logging API
@@ -79,6 +81,15 @@ extern int log_level;
  */
 #define DEFAULT_LOG_LEVEL LOG_LEVEL_ERROR
 
+/**
+ * Specifies the highest log level compiled in. Messages of higher levels are
+ * removed at compile time, e.g. build with
+ * @c -DNV_LOG_MAX_LEVEL=LOG_LEVEL_WARN to drop the debug messages.
+ */
+#ifndef NV_LOG_MAX_LEVEL
+#define NV_LOG_MAX_LEVEL LOG_LEVEL_DEBUG
+#endif
+
 /**
  * @cond
  */
@@ -101,15 +112,24 @@ extern const char *log_level_name[];
  * Messages are in the following form:
  * [LEVEL] (FILE: LINE_NUM) Message
  *
+ * The message is formatted on the calling thread and written to stderr
+ * by NvAsyncLogger. Each call site is rate limited.
+ *
  * @param[in] level The Log level of the message.
  * @param[in] str1 The NULL-terminated char array to print.
  */
-#define PRINT_MSG(level, str1) if(level <= log_level) { \
+#define PRINT_MSG(level, str1) if(level <= NV_LOG_MAX_LEVEL && level <= log_level) { \
                                   std::ostringstream ostr; \
                                   ostr << "[" << log_level_name[level] << "] ("  << \
                                   __FILE__ << ":" __LINE_NUM_STR__ ") " << \
                                   str1 << std::endl; \
-                                  std::cerr << ostr.str(); \
+                                  const std::string &msg = ostr.str(); \
+                                  NvAsyncLogger::getLoggerInstance().write( \
+                                      NvAsyncLogger::LOG_STREAM_STDERR, \
+                                      level == LOG_LEVEL_ERROR ? \
+                                          NvAsyncLogger::LOG_FLAG_URGENT : 0, \
+                                      __FILE__ ":" __LINE_NUM_STR__, \
+                                      msg.data(), msg.size()); \
                               }
 
 /**
@@ -0,0 +1,115 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Annex-B Start Code Scanner</b>
+ *
+ * @b Description: This file declares the start code scanner shared by the
+ * H.264/H.265 elementary stream parsers of the samples.
+ */
+
+/**
+ * @defgroup l4t_mm_nvnalscanner_group Start Code Scanner
+ * @ingroup l4t_mm_nvvideo_group
+ *
+ * Locates Annex-B start codes (00 00 01 / 00 00 00 01) with SSE2, AVX2 or
+ * NEON where available and a scalar fallback otherwise. The fastest
+ * implementation supported by the CPU is selected on first use.
+ *
+ * @{
+ */
+
+#ifndef __NV_NAL_SCANNER_H_
+#define __NV_NAL_SCANNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Instruction set used by the scanner.
+ */
+typedef enum
+{
+    NV_NAL_SCANNER_ISA_SCALAR,  /**< Portable byte-wise scanner. */
+    NV_NAL_SCANNER_ISA_SSE2,    /**< 16 bytes per step, x86/x86_64. */
+    NV_NAL_SCANNER_ISA_AVX2,    /**< 32 bytes per step, x86_64 with AVX2. */
+    NV_NAL_SCANNER_ISA_NEON,    /**< 16 bytes per step, ARMv7 NEON/AArch64. */
+    NV_NAL_SCANNER_ISA_COUNT
+} NvNalScannerIsa;
+
+/**
+ * Codec used to decode the NAL unit type from the NAL header.
+ */
+typedef enum
+{
+    NV_NAL_CODEC_H264,          /**< nal_unit_type = header[0] & 0x1F */
+    NV_NAL_CODEC_H265,          /**< nal_unit_type = (header[0] >> 1) & 0x3F */
+} NvNalCodec;
+
+/**
+ * Describes one NAL unit found in a buffer.
+ */
+typedef struct
+{
+    /** Offset of the first start code byte from the start of the buffer. */
+    size_t offset;
+    /** Size of the NAL unit including its start code, up to the next start
+     *  code or to the end of the buffer. */
+    size_t size;
+    /** Length of the start code, 3 or 4. */
+    uint32_t start_code_len;
+    /** NAL unit type for the requested codec. */
+    uint32_t type;
+} NvNalUnit;
+
+/**
+ * @brief Finds the next start code in a buffer.
+ *
+ * A zero byte directly in front of a 00 00 01 sequence is reported as part
+ * of a 4-byte start code.
+ *
+ * @param[in] buf Pointer to the data.
+ * @param[in] len Number of bytes in @a buf.
+ * @param[out] start_code_len Length of the start code found, 3 or 4. May be NULL.
+ * @return Offset of the start code, or @a len if there is none.
+ */
+size_t nv_nal_find_start_code(const uint8_t *buf, size_t len, uint32_t *start_code_len);
+
+/**
+ * @brief Splits a buffer into NAL units in one pass.
+ *
+ * Bytes in front of the first start code are skipped. The last unit
+ * reported always extends to the next start code, so when @a max_units are
+ * returned the caller resumes at <tt>units[n-1].offset + units[n-1].size</tt>.
+ * A unit that ends at @a len was not terminated by a start code.
+ *
+ * @param[in] buf Pointer to the data.
+ * @param[in] len Number of bytes in @a buf.
+ * @param[in] codec Codec used to decode NvNalUnit::type.
+ * @param[out] units Array receiving the NAL units.
+ * @param[in] max_units Number of entries in @a units.
+ * @return Number of NAL units stored in @a units.
+ */
+int nv_nal_scan_units(const uint8_t *buf, size_t len, NvNalCodec codec,
+        NvNalUnit *units, int max_units);
+
+/**
+ * @brief Forces the scanner to use a given instruction set.
+ *
+ * Meant for benchmarks and tests; the default is the fastest supported one.
+ *
+ * @param[in] isa Instruction set to use.
+ * @return 0 for success, -1 if the CPU or the build does not support @a isa.
+ */
+int nv_nal_scanner_set_isa(NvNalScannerIsa isa);
+
+/**
+ * @brief Gets the instruction set currently used by the scanner.
+ */
+NvNalScannerIsa nv_nal_scanner_get_isa();
+
+/**
+ * @brief Gets a printable name for an instruction set.
+ */
+const char *nv_nal_scanner_isa_name(NvNalScannerIsa isa);
+
+/** @} */
+#endif
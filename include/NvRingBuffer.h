@@ -0,0 +1,438 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Bounded Lock-free Ring Buffers</b>
+ *
+ * @b Description: This file defines the bounded queues used to hand
+ * buffers between the capture, inference, render and encoder threads of
+ * the samples.
+ */
+
+/**
+ * @defgroup l4t_mm_nvringbuffer_group Ring Buffers
+ * @ingroup l4t_mm_nvvideo_group
+ *
+ * NvSpscRing is a single-producer/single-consumer ring, NvMpmcRing allows
+ * any number of producers and consumers. Both have a fixed power-of-two
+ * capacity, keep producer and consumer indices on separate cache lines and
+ * never take a lock while there is room or data. The blocking variants spin
+ * briefly and then sleep on a condition variable that is only touched when
+ * a thread is actually waiting.
+ *
+ * @{
+ */
+
+#ifndef __NV_RING_BUFFER_H_
+#define __NV_RING_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/** Size the indices are padded to, to keep them off each other's cache line. */
+#define NV_RING_CACHE_LINE 64
+
+/**
+ * @brief Parks threads that wait for a ring to change.
+ *
+ * A waiter registers itself before re-checking its condition and the
+ * notifier publishes its change before looking for waiters, both separated
+ * by a full fence, so a wakeup cannot be lost while the fast path stays a
+ * single relaxed load when nobody waits.
+ */
+class NvRingWaiter
+{
+public:
+    NvRingWaiter() : m_waiters(0)
+    {
+    }
+
+    /**
+     * @brief Blocks until @a ready returns true.
+     */
+    template<typename Pred>
+    void wait(Pred ready)
+    {
+        for (int i = 0; i < SPIN_COUNT; i++)
+        {
+            if (ready())
+                return;
+            if (i >= SPIN_COUNT / 2)
+                std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready())
+            m_cond.wait(lock);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Wakes the waiters, if any. Call after publishing a change.
+     */
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    static const int SPIN_COUNT = 64;
+
+    std::atomic<int> m_waiters;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/**
+ * @brief Bounded single-producer/single-consumer ring.
+ *
+ * Exactly one thread may push and one thread may pop at a time. Handing
+ * either role to another thread is fine as long as the handover itself
+ * synchronizes (thread creation, join, a mutex).
+ *
+ * @tparam T Element type, copy-assignable.
+ * @tparam N Capacity, a power of two.
+ */
+template<typename T, size_t N>
+class NvSpscRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    NvSpscRing() : m_head(0), m_tailCache(0), m_tail(0), m_headCache(0)
+    {
+    }
+
+    /**
+     * @brief Appends @a obj if there is room.
+     * @return true if it was queued, false if the ring is full.
+     */
+    bool try_push(const T& obj)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tailCache == N)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head - m_tailCache == N)
+                return false;
+        }
+        m_cells[head & (N - 1)] = obj;
+        m_head.store(head + 1, std::memory_order_release);
+        m_notEmpty.notify();
+        return true;
+    }
+
+    /**
+     * @brief Takes the oldest element if there is one.
+     * @return true if @a obj was filled in, false if the ring is empty.
+     */
+    bool try_pop(T& obj)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_headCache)
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail == m_headCache)
+                return false;
+        }
+        obj = m_cells[tail & (N - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_notFull.notify();
+        return true;
+    }
+
+    /**
+     * @brief Appends @a obj, waiting for room if the ring is full.
+     */
+    void push(const T& obj)
+    {
+        while (!try_push(obj))
+            m_notFull.wait([this] { return !full(); });
+    }
+
+    /**
+     * @brief Takes the oldest element, waiting for one if the ring is empty.
+     */
+    void pop(T& obj)
+    {
+        while (!try_pop(obj))
+            m_notEmpty.wait([this] { return size() != 0; });
+    }
+
+    /**
+     * @brief Appends up to @a count elements with one index update.
+     * @return Number of elements queued, 0 if the ring is full.
+     */
+    size_t push_batch(const T *objs, size_t count)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t room = N - (head - m_tailCache);
+        if (room < count)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            room = N - (head - m_tailCache);
+        }
+        if (count > room)
+            count = room;
+        if (count == 0)
+            return 0;
+        for (size_t i = 0; i < count; i++)
+            m_cells[(head + i) & (N - 1)] = objs[i];
+        m_head.store(head + count, std::memory_order_release);
+        m_notEmpty.notify();
+        return count;
+    }
+
+    /**
+     * @brief Takes up to @a count elements with one index update.
+     * @return Number of elements stored in @a objs, 0 if the ring is empty.
+     */
+    size_t pop_batch(T *objs, size_t count)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t avail = m_headCache - tail;
+        if (avail < count)
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            avail = m_headCache - tail;
+        }
+        if (count > avail)
+            count = avail;
+        if (count == 0)
+            return 0;
+        for (size_t i = 0; i < count; i++)
+            objs[i] = m_cells[(tail + i) & (N - 1)];
+        m_tail.store(tail + count, std::memory_order_release);
+        m_notFull.notify();
+        return count;
+    }
+
+    /**
+     * @brief Gets the number of queued elements. Exact only when called
+     * by the producer or the consumer while the other one is idle.
+     */
+    size_t size() const
+    {
+        return m_head.load(std::memory_order_acquire) -
+            m_tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const
+    {
+        return size() >= N;
+    }
+
+    static size_t capacity()
+    {
+        return N;
+    }
+
+private:
+    NvSpscRing(const NvSpscRing&);
+    NvSpscRing& operator=(const NvSpscRing&);
+
+    /* Written by the producer only. */
+    std::atomic<size_t> m_head;
+    size_t m_tailCache;
+    char m_pad0[NV_RING_CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    /* Written by the consumer only. */
+    std::atomic<size_t> m_tail;
+    size_t m_headCache;
+    char m_pad1[NV_RING_CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+    T m_cells[N];
+    NvRingWaiter m_notEmpty;
+    NvRingWaiter m_notFull;
+};
+
+/**
+ * @brief Bounded multi-producer/multi-consumer ring.
+ *
+ * Every cell carries a sequence number that tells whether it is free for
+ * the producer or filled for the consumer of a given lap, so producers and
+ * consumers only contend on their own index.
+ *
+ * @tparam T Element type, copy-assignable.
+ * @tparam N Capacity, a power of two.
+ */
+template<typename T, size_t N>
+class NvMpmcRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    NvMpmcRing() : m_head(0), m_tail(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Appends @a obj if there is room.
+     * @return true if it was queued, false if the ring is full.
+     */
+    bool try_push(const T& obj)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[head & (N - 1)];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) head;
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(head, head + 1,
+                            std::memory_order_relaxed))
+                {
+                    cell.obj = obj;
+                    cell.seq.store(head + 1, std::memory_order_release);
+                    m_notEmpty.notify();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                head = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Takes the oldest element if there is one.
+     * @return true if @a obj was filled in, false if the ring is empty.
+     */
+    bool try_pop(T& obj)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[tail & (N - 1)];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (tail + 1);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(tail, tail + 1,
+                            std::memory_order_relaxed))
+                {
+                    obj = cell.obj;
+                    cell.seq.store(tail + N, std::memory_order_release);
+                    m_notFull.notify();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                tail = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Appends @a obj, waiting for room if the ring is full.
+     */
+    void push(const T& obj)
+    {
+        while (!try_push(obj))
+            m_notFull.wait([this] { return !full(); });
+    }
+
+    /**
+     * @brief Takes the oldest element, waiting for one if the ring is empty.
+     */
+    void pop(T& obj)
+    {
+        while (!try_pop(obj))
+            m_notEmpty.wait([this] { return ready(); });
+    }
+
+    /**
+     * @brief Appends up to @a count elements, in order for this producer.
+     * @return Number of elements queued; stops at the first full slot.
+     */
+    size_t push_batch(const T *objs, size_t count)
+    {
+        size_t i = 0;
+        while (i < count && try_push(objs[i]))
+            i++;
+        return i;
+    }
+
+    /**
+     * @brief Takes up to @a count elements.
+     * @return Number of elements stored in @a objs; stops when the ring is empty.
+     */
+    size_t pop_batch(T *objs, size_t count)
+    {
+        size_t i = 0;
+        while (i < count && try_pop(objs[i]))
+            i++;
+        return i;
+    }
+
+    /**
+     * @brief Gets an estimate of the number of queued elements.
+     */
+    size_t size() const
+    {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t head = m_head.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool full() const
+    {
+        return size() >= N;
+    }
+
+    static size_t capacity()
+    {
+        return N;
+    }
+
+private:
+    NvMpmcRing(const NvMpmcRing&);
+    NvMpmcRing& operator=(const NvMpmcRing&);
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T obj;
+    };
+
+    /* The cell at the tail holds a finished element. */
+    bool ready() const
+    {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return m_cells[tail & (N - 1)].seq.load(std::memory_order_acquire) == tail + 1;
+    }
+
+    std::atomic<size_t> m_head;
+    char m_pad0[NV_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;
+    char m_pad1[NV_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+    Cell m_cells[N];
+    NvRingWaiter m_notEmpty;
+    NvRingWaiter m_notFull;
+};
+
+/** @} */
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file
+ * <b>NVIDIA Multimedia API: Thread Scheduling Policy</b>
+ *
+ * @b Description: This file declares the scheduling policy that the DQ
+ * threads and the media threads of the samples apply to themselves.
+ */
+
+/**
+ * @defgroup l4t_mm_nvthreadpolicy_group Thread Scheduling Policy
+ * @ingroup l4t_mm_nvelement_group
+ *
+ * Describes CPU affinity, scheduling class, real-time priority, nice value
+ * and name of a thread, and applies them to the calling thread. Lets
+ * applications with many elements keep the media threads on dedicated
+ * cores instead of migrating between the application threads.
+ *
+ * @{
+ */
+
+#ifndef __NV_THREAD_POLICY_H_
+#define __NV_THREAD_POLICY_H_
+
+#include <stdint.h>
+
+/**
+ * Value of NvThreadPolicy::nice that leaves the nice value alone.
+ */
+#define NV_THREAD_NICE_KEEP (-128)
+
+/**
+ * Describes how a thread is scheduled. Fields left at the values set by
+ * #nv_thread_policy_init keep what the thread inherited.
+ */
+typedef struct
+{
+    /** CPUs the thread may run on, bit n for CPU n. 0 keeps the affinity. */
+    uint64_t cpu_mask;
+    /** SCHED_OTHER or SCHED_FIFO, -1 keeps the scheduling class. */
+    int sched_policy;
+    /** SCHED_FIFO priority, 1 to 99. Ignored for SCHED_OTHER. */
+    int sched_priority;
+    /** Nice value, -20 to 19, or #NV_THREAD_NICE_KEEP. Only meaningful
+     *  under SCHED_OTHER. */
+    int nice;
+    /** Thread name, at most 15 characters. Empty keeps the name. */
+    char name[16];
+} NvThreadPolicy;
+
+/**
+ * @brief Sets a policy that keeps everything the thread inherits.
+ *
+ * @param[out] policy Policy to initialize.
+ */
+void nv_thread_policy_init(NvThreadPolicy *policy);
+
+/**
+ * @brief Checks whether a policy changes anything.
+ *
+ * @param[in] policy Policy to check.
+ * @return true if applying @a policy is a no-op.
+ */
+bool nv_thread_policy_is_default(const NvThreadPolicy *policy);
+
+/**
+ * @brief Applies a policy to the calling thread.
+ *
+ * Every field is applied even if an earlier one fails. SCHED_FIFO and
+ * negative nice values need CAP_SYS_NICE or a matching RLIMIT_RTPRIO /
+ * RLIMIT_NICE.
+ *
+ * @param[in] policy Policy to apply.
+ * @return 0 for success, -1 if a field could not be applied; errno is
+ *         set by the first failure.
+ */
+int nv_thread_policy_apply(const NvThreadPolicy *policy);
+
+/**
+ * @brief Parses a CPU list such as "2-3,6" into NvThreadPolicy::cpu_mask.
+ *
+ * @param[in] list CPU numbers and ranges separated by commas, CPUs 0 to 63.
+ * @param[out] cpu_mask Parsed mask.
+ * @return 0 for success, -1 if @a list is malformed.
+ */
+int nv_thread_policy_parse_cpus(const char *list, uint64_t *cpu_mask);
+
+/**
+ * @brief Parses "other" or "fifo:<priority>" into the scheduling fields.
+ *
+ * @param[in] str Scheduling class and, for "fifo", its priority.
+ * @param[in,out] policy Policy whose @c sched_policy and @c sched_priority
+ *                       are set.
+ * @return 0 for success, -1 if @a str is malformed.
+ */
+int nv_thread_policy_parse_sched(const char *str, NvThreadPolicy *policy);
+
+/** @} */
+#endif
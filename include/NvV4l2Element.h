@@ -133,6 +133,36 @@ public:
      */
     int getExtControls(struct v4l2_ext_controls &ctl);
 
+    /**
+     * Sets the scheduling policy of the DQ Threads of both planes.
+     *
+     * @sa NvV4l2ElementPlane::setDQThreadPolicy
+     *
+     * @param[in] policy Policy the DQ Threads apply when they start.
+     * @return 0 for success, -1 if a DQ Thread is already running.
+     */
+    int setDQThreadPolicy(const NvThreadPolicy &policy);
+
+    /**
+     * Runs the DQ callbacks of both planes on a shared worker pool.
+     *
+     * @sa NvV4l2ElementPlane::setDQWorkerPool
+     *
+     * @param[in] pool Pool to attach to, or NULL for a DQ Thread per plane.
+     * @return 0 for success, -1 if a DQ Thread is already running.
+     */
+    int setDQWorkerPool(NvDQWorkerPool *pool);
+
+    /**
+     * Takes the USERPTR memory of both planes from a pool.
+     *
+     * @sa NvV4l2ElementPlane::setBufferPool
+     *
+     * @param[in] pool Pool to allocate from, or NULL to allocate directly.
+     * @return 0 for success, -1 if a plane already has buffers.
+     */
+    int setBufferPool(NvBufferPool *pool);
+
     virtual int isInError();
 
     /**
@@ -51,6 +51,9 @@
 #include "NvElement.h"
 #include "NvLogging.h"
 #include "NvBuffer.h"
+#include "NvThreadPolicy.h"
+#include "NvBufferPool.h"
+#include "NvDQWorkerPool.h"
 
 /**
  * Prints a plane-specific message of level LOG_LEVEL_DEBUG.
@@ -78,6 +81,12 @@
  */
 #define PLANE_SYS_ERROR_MSG(str) COMP_SYS_ERROR_MSG(plane_name << ":" << str);
 
+/**
+ * Maximum number of buffers the DQ Thread hands to a
+ * #NvV4l2ElementPlane::dqThreadBatchCallback at once.
+ */
+#define MAX_DQ_BATCH 32
+
 /**
  * @brief Defines a helper class for operations performed on a V4L2 Element plane.
  *
@@ -250,6 +259,20 @@ public:
      * @return 0 for success, -1 otherwise.
      */
     int setupPlane(enum v4l2_memory mem_type, uint32_t num_buffers, bool map, bool allocate);
+
+    /**
+     * Takes the memory allocated by #setupPlane from a pool.
+     *
+     * With a pool, the memory of @c V4L2_MEMORY_USERPTR buffers comes from
+     * @a pool and goes back to it in #deinitPlane. A plane set up again with
+     * the same format, for example after a resolution change back and forth,
+     * reuses it instead of allocating.
+     *
+     * @param[in] pool Pool to allocate from, or NULL to allocate directly.
+     *                 Must outlive the buffers of the plane.
+     * @return 0 for success, -1 if the plane already has buffers.
+     */
+    int setBufferPool(NvBufferPool *pool);
     /**
      * Helper method that encapsulates all the method calls required to
      * deinitialize the plane for streaming.
@@ -313,6 +336,46 @@ public:
      */
     int qBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buffer);
 
+    /**
+     * Dequeues all buffers that are ready, up to \a max_count.
+     *
+     * The bookkeeping of the whole batch is done under one acquisition of
+     * #plane_lock with one broadcast of #plane_cond. The first buffer is
+     * waited for like in #dqBuffer. Further buffers are only taken if the
+     * device is opened in non-blocking mode and has them ready, so in
+     * blocking mode at most one buffer is returned. A buffer flagged
+     * \c V4L2_BUF_FLAG_LAST ends the batch.
+     *
+     * @param[in] v4l2_bufs An array of \a max_count \c v4l2_buffer structures.
+     *                      \c m.planes of each must point to #MAX_PLANES
+     *                      \c v4l2_plane structures.
+     * @param[out] nvbuffers Returns the \c %NvBuffer objects of the dequeued
+     *                       buffers, at the same positions. Can be NULL.
+     * @param[out] shared_buffers Returns the shared \c %NvBuffer objects, see
+     *                            #dqBuffer. Can be NULL.
+     * @param[in] max_count Maximum number of buffers to dequeue.
+     * @param[in] num_retries Same as in #dqBuffer, for the first buffer.
+     * @return Number of buffers dequeued, -1 if none could be dequeued.
+     */
+    int dqBuffers(struct v4l2_buffer *v4l2_bufs, NvBuffer ** nvbuffers,
+                  NvBuffer ** shared_buffers, uint32_t max_count,
+                  uint32_t num_retries);
+    /**
+     * Queues several buffers on the plane.
+     *
+     * Same as calling #qBuffer for each buffer, with one acquisition of
+     * #plane_lock and one broadcast of #plane_cond for the batch. Stops at
+     * the first buffer that fails to queue.
+     *
+     * @param[in] v4l2_bufs An array of \a count \c v4l2_buffer structures.
+     * @param[in] shared_buffers The shared \c %NvBuffer objects, at the same
+     *                           positions. Can be NULL.
+     * @param[in] count Number of buffers to queue.
+     * @return Number of buffers queued, -1 if the first one failed.
+     */
+    int qBuffers(struct v4l2_buffer *v4l2_bufs, NvBuffer ** shared_buffers,
+                 uint32_t count);
+
     /**
      * Gets the number of buffers allocated/requested on the plane.
      *
@@ -433,6 +496,64 @@ public:
      * @returns TRUE for success, FALSE for failure.
      */
     bool setDQThreadCallback(dqThreadCallback callback);
+
+    /**
+     * This is a callback function type that is called by the DQ Thread with
+     * every buffer dequeued in one #dqBuffers call, up to #MAX_DQ_BATCH.
+     *
+     * The arrays are valid only during the call. On a dequeue error the
+     * callback is called with NULL arrays and \a count 0, like
+     * #dqThreadCallback is called with a NULL \a v4l2_buf.
+     *
+     * @param v4l2_bufs A pointer to the dequeued \c v4l2_buffer structures.
+     * @param buffers A pointer to the NvBuffer objects of the dequeued buffers.
+     * @param shared_buffers A pointer to the shared NvBuffer objects, NULL
+     *         entries if the plane does not share buffers.
+     * @param count Number of dequeued buffers.
+     * @param data A pointer to application specific data that is set with
+     *             #startDQThread.
+     * @returns If the application implementing this call returns FALSE,
+     *          the DQThread is stopped; else, the DQ Thread continues running.
+     */
+    typedef bool(*dqThreadBatchCallback) (struct v4l2_buffer * v4l2_bufs,
+            NvBuffer ** buffers, NvBuffer ** shared_buffers, uint32_t count,
+            void *data);
+
+    /**
+     * Sets the batched DQ Thread callback method.
+     *
+     * When set, it is used instead of the #dqThreadCallback and the DQ Thread
+     * drains every ready buffer with #dqBuffers before calling it.
+     *
+     * @param[in] callback Method to be called upon succesful dequeue.
+     * @returns TRUE for success, FALSE for failure.
+     */
+    bool setDQThreadBatchCallback(dqThreadBatchCallback callback);
+
+    /**
+     * Sets the scheduling policy of the DQ Thread.
+     *
+     * The DQ Thread applies it to itself when it starts: CPU affinity,
+     * SCHED_FIFO/SCHED_OTHER priority, nice value and name. A policy that
+     * cannot be applied, for example SCHED_FIFO without CAP_SYS_NICE, is
+     * reported as a warning and the thread runs with what it got.
+     *
+     * @param[in] policy Policy to apply, copied.
+     * @return 0 for success, -1 if the DQ Thread is already running.
+     */
+    int setDQThreadPolicy(const NvThreadPolicy &policy);
+    /**
+     * Runs the DQ callbacks on a shared worker pool instead of a DQ Thread.
+     *
+     * #startDQThread then attaches the plane to @a pool. The callbacks are
+     * called the same way as from a DQ Thread, one at a time and in dequeue
+     * order, but the plane policy set with #setDQThreadPolicy is not used.
+     * #stopDQThread also works in blocking mode.
+     *
+     * @param[in] pool Pool to attach to, or NULL for a DQ Thread.
+     * @return 0 for success, -1 if the DQ Thread is already running.
+     */
+    int setDQWorkerPool(NvDQWorkerPool *pool);
     /**
      * Starts DQ Thread.
      *
@@ -515,10 +636,23 @@ private:
     pthread_t dq_thread; /**< Speciifes the pthread ID of the DQ Thread. */
 
     dqThreadCallback callback; /**< Specifies the callback method used by the DQ Thread. */
+    dqThreadBatchCallback batch_callback; /**< Specifies the batched callback method
+                                               used by the DQ Thread, if set. */
 
     void *dqThread_data;    /**< Application supplied pointer provided as an
                                 argument in #dqThreadCallback. */
 
+    NvThreadPolicy dq_policy; /**< Scheduling policy applied by the DQ Thread. */
+
+    NvBufferPool *buffer_pool; /**< Pool of the USERPTR memory, NULL to allocate
+                                    directly. */
+
+    NvDQWorkerPool *dq_pool; /**< Pool running the DQ callbacks, NULL for a DQ Thread. */
+    int dq_pool_slot;       /**< Slot of the plane in #dq_pool, -1 if not attached.
+                                 Guarded by the pool lock. */
+    bool dq_parked;         /**< Set by the pool while nothing is queued; the next
+                                 queued buffer wakes the pool. */
+
     /**
      * The DQ thread method.
      *
@@ -532,6 +666,21 @@ private:
      */
     static void *dqThread(void *v4l2_element_plane);
 
+    /**
+     * Calls \c VIDIOC_DQBUF, retrying as described in #dqBuffer.
+     */
+    int dqBufferIoctl(struct v4l2_buffer &v4l2_buf, uint32_t num_retries);
+    /**
+     * Updates the plane state for a dequeued buffer. Called with
+     * #plane_lock held.
+     */
+    void completeDqBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer ** buffer,
+            NvBuffer ** shared_buffer);
+    /**
+     * Queues a buffer. Called with #plane_lock held.
+     */
+    int qBufferLocked(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buffer);
+
     NvElementProfiler &v4l2elem_profiler; /**< A reference to the profiler belonging
                                             to the plane's parent element. */
 
@@ -581,6 +730,7 @@ private:
                                for debugging. */
 
     friend class NvV4l2Element;
+    friend class NvDQWorkerPool;
 };
 /** @} */
 #endif
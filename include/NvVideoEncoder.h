@@ -171,11 +171,14 @@ public:
      * Set the encoder level.
      *
      * Calls the VIDIOC_S_EXT_CTRLS IOCTL internally with Control ID
-     * \c V4L2_CID_MPEG_VIDEO_H264_LEVEL. Must be called after setFormat on both
-     * the planes and before \c requestBuffers on any of the planes.
+     * \c V4L2_CID_MPEG_VIDEO_H264_LEVEL, or \c V4L2_CID_MPEG_VIDEO_HEVC_LEVEL
+     * for H.265 where the kernel headers define it. Must be called after
+     * setFormat on both the planes and before \c requestBuffers on any of the
+     * planes.
      *
      * @param[in] level Level to be used for encoding, one of enum
-     *                  v4l2_mpeg_video_h264_level
+     *                  v4l2_mpeg_video_h264_level, or of enum
+     *                  v4l2_mpeg_video_hevc_level for H.265
      *
      * @return 0 for success, -1 otherwise.
      */
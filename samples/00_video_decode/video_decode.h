@@ -29,6 +29,9 @@
 #include "NvVideoDecoder.h"
 #include "NvVideoConverter.h"
 #include "NvEglRenderer.h"
+#include "NvThreadPolicy.h"
+#include "NvBitstreamSource.h"
+#include "NvDemuxer.h"
 #include <queue>
 #include <fstream>
 #include <pthread.h>
@@ -47,7 +50,9 @@ typedef struct
     NvEglRenderer *renderer;
 
     char **in_file_path;
-    std::ifstream **in_file;
+    NvBitstreamSource **in_file;
+    bool demux;
+    NvDemuxer **demuxer;
 
     char *out_file_path;
     std::ofstream *out_file;
@@ -78,6 +83,7 @@ typedef struct
     uint64_t timestampincr;
 
     bool stats;
+    char *trace_file; // Chrome trace-event JSON of the frame stages
 
     int  stress_test;
     bool enable_metadata;
@@ -111,6 +117,7 @@ typedef struct
     int max_perf;
     int extra_cap_plane_buffer;
     int blocking_mode; // Set to true if running in blocking mode
+    NvThreadPolicy dq_policy; // Decoder capture and converter DQ threads
 } context_t;
 
 int parse_csv_args(context_t * ctx, int argc, char *argv[]);
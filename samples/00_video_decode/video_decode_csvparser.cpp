@@ -60,8 +60,13 @@ print_help(void)
             "OPTIONS:\n"
             "\t-h,--help            Prints this text\n"
             "\t--dbg-level <level>  Sets the debug level [Values 0-3]\n\n"
+            "\t--dq-cpus <list>     Run the DQ threads on these CPUs, e.g. 2-3,6\n"
+            "\t--dq-sched <policy>  DQ thread scheduling, other or fifo:<priority 1-99>\n"
+            "\t--dq-nice <value>    DQ thread nice value [-20 to 19]\n\n"
             "\t--stats              Report profiling data for the app\n\n"
             "\tNOTE: this should not be used alongside -o option as it decreases the FPS value shown in --stats\n"
+            "\t--trace <file>       Write the decode, transform and render times of every frame as Chrome trace JSON\n"
+            "\tNOTE: needs --input-nalu and --copy-timestamp, frames are followed by their timestamp\n"
             "\t--disable-rendering  Disable rendering\n"
             "\t--max-perf           Enable maximum Performance \n"
             "\tNOTE: this should be set only for platform T194 or above\n"
@@ -84,6 +89,8 @@ print_help(void)
             "\t2 = Decode only key frames\n\n"
             "\t--input-nalu         Input to the decoder will be nal units\n"
             "\t--input-chunks       Input to the decoder will be a chunk of bytes [Default]\n\n"
+            "\t--demux              Read frames and their timestamps from an MP4, Matroska or MPEG-TS file\n"
+            "\tNOTE: implies --input-nalu and --copy-timestamp, the container timestamps are used\n\n"
             "\t--copy-timestamp <st> <fps> Enable copy timestamp with start timestamp(st) in seconds for decode fps(fps) (for input-nalu mode)\n"
             "\tNOTE: copy-timestamp used to demonstrate how timestamp can be associated with an individual H264/H265 frame to achieve video-synchronization.\n"
             "\t      currenly only supported for H264 & H265 video encode using MM APIs and is only for demonstration purpose.\n"
@@ -178,6 +185,12 @@ parse_csv_args(context_t * ctx, int argc, char *argv[])
         {
             ctx->stats = true;
         }
+        else if (!strcmp(arg, "--trace"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            ctx->trace_file = strdup(*argp);
+        }
         else if (!strcmp(arg, "--disable-rendering"))
         {
             ctx->disable_rendering = true;
@@ -233,6 +246,12 @@ parse_csv_args(context_t * ctx, int argc, char *argv[])
         {
             ctx->input_nalu = false;
         }
+        else if (!strcmp(arg, "--demux"))
+        {
+            ctx->demux = true;
+            ctx->input_nalu = true;
+            ctx->copy_timestamp = true;
+        }
         else if (!strcmp(arg, "--copy-timestamp"))
         {
             argp++;
@@ -293,6 +312,29 @@ parse_csv_args(context_t * ctx, int argc, char *argv[])
                      ctx->skip_frames < V4L2_SKIP_FRAMES_TYPE_NONE),
                     "Unsupported values for skip frames: " << *argp);
         }
+        else if (!strcmp(arg, "--dq-cpus"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_cpus(*argp, &ctx->dq_policy.cpu_mask) < 0,
+                    "Invalid CPU list: " << *argp);
+        }
+        else if (!strcmp(arg, "--dq-sched"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_sched(*argp, &ctx->dq_policy) < 0,
+                    "Invalid scheduling policy: " << *argp);
+        }
+        else if (!strcmp(arg, "--dq-nice"))
+        {
+            argp++;
+            /* Negative values start with '-', CHECK_OPTION_VALUE would reject them */
+            CSV_PARSE_CHECK_ERROR(!*argp, "value not specified for option " << arg);
+            ctx->dq_policy.nice = atoi(*argp);
+            CSV_PARSE_CHECK_ERROR(ctx->dq_policy.nice < -20 || ctx->dq_policy.nice > 19,
+                    "nice value should be in [-20, 19]");
+        }
         else if (!strcmp(arg, "--dbg-level"))
         {
             argp++;
@@ -27,7 +27,10 @@
  */
 
 #include "NvApplicationProfiler.h"
+#include "NvFrameTracer.h"
 #include "NvUtils.h"
+#include "NvBitstreamSource.h"
+#include "NvBufferPool.h"
 #include <errno.h>
 #include <fstream>
 #include <iostream>
@@ -52,12 +55,6 @@
 #define CHUNK_SIZE 4000000
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
-
 #define H264_NAL_UNIT_CODED_SLICE  1
 #define H264_NAL_UNIT_CODED_SLICE_IDR  5
 
@@ -69,70 +66,44 @@
 #define IVF_FILE_HDR_SIZE   32
 #define IVF_FRAME_HDR_SIZE  12
 
-#define IS_H264_NAL_CODED_SLICE(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE)
-#define IS_H264_NAL_CODED_SLICE_IDR(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE_IDR)
-
-#define GET_H265_NAL_UNIT_TYPE(buffer_ptr) ((buffer_ptr[0] & 0x7E) >> 1)
 
 using namespace std;
 
 static int
-read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
-        char *parse_buffer, streamsize parse_buffer_size, context_t * ctx)
+read_decoder_input_nalu(NvBitstreamSource * source, NvBuffer * buffer,
+        context_t * ctx)
 {
-    // Length is the size of the buffer in bytes
-    char *buffer_ptr = (char *) buffer->planes[0].data;
+    NvNalUnit nalu;
+    NvNalCodec codec = (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) ?
+        NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
     int h265_nal_unit_type;
-    char *stream_ptr;
-    bool nalu_found = false;
-
-    streamsize bytes_read;
-    streamsize stream_initial_pos = stream->tellg();
+    const uint8_t *data = source->nextNalu(codec, &nalu);
 
-    stream->read(parse_buffer, parse_buffer_size);
-    bytes_read = stream->gcount();
-
-    if (bytes_read == 0)
+    if (!data)
     {
+        // Start over for --loop, like read_decoder_input_chunk
+        source->rewind();
         return buffer->planes[0].bytesused = 0;
     }
 
-    // Find the first NAL unit in the buffer
-    stream_ptr = parse_buffer;
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
+    if (nalu.size > buffer->planes[0].length)
     {
-        nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-                    IS_NAL_UNIT_START1(stream_ptr);
-        if (nalu_found)
-        {
-            break;
-        }
-        stream_ptr++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    if (!nalu_found)
-    {
-        cerr << "Could not read nal unit from file. EOF or file corrupted"
+        cerr << "NAL unit of " << nalu.size << " bytes does not fit the buffer"
             << endl;
+        buffer->planes[0].bytesused = 0;
         return -1;
     }
 
-    memcpy(buffer_ptr, stream_ptr, 4);
-    buffer_ptr += 4;
-    buffer->planes[0].bytesused = 4;
-    stream_ptr += 4;
-
     if (ctx->copy_timestamp)
     {
       if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H264) {
-        if ((IS_H264_NAL_CODED_SLICE(stream_ptr)) ||
-            (IS_H264_NAL_CODED_SLICE_IDR(stream_ptr)))
+        if ((nalu.type == H264_NAL_UNIT_CODED_SLICE) ||
+            (nalu.type == H264_NAL_UNIT_CODED_SLICE_IDR))
           ctx->flag_copyts = true;
         else
           ctx->flag_copyts = false;
       } else if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) {
-        h265_nal_unit_type = GET_H265_NAL_UNIT_TYPE(stream_ptr);
+        h265_nal_unit_type = nalu.type;
         if ((h265_nal_unit_type >= HEVC_NUT_TRAIL_N && h265_nal_unit_type <= HEVC_NUT_RASL_R) ||
             (h265_nal_unit_type >= HEVC_NUT_BLA_W_LP && h265_nal_unit_type <= HEVC_NUT_CRA_NUT))
           ctx->flag_copyts = true;
@@ -141,46 +112,72 @@ read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
       }
     }
 
-    // Copy bytes till the next NAL unit is found
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-        {
-            streamsize seekto = stream_initial_pos +
-                    (stream_ptr - parse_buffer);
-            if(stream->eof())
-            {
-                stream->clear();
-            }
-            stream->seekg(seekto, stream->beg);
+    // The only copy of the NAL unit, straight from the mapped file
+    memcpy(buffer->planes[0].data, data, nalu.size);
+    buffer->planes[0].bytesused = nalu.size;
+    return 0;
+}
+
+static uint32_t
+demuxer_pixfmt(NvDemuxer * demuxer)
+{
+    switch (demuxer->getCodec())
+    {
+        case NV_DEMUXER_CODEC_H264:
+            return V4L2_PIX_FMT_H264;
+        case NV_DEMUXER_CODEC_H265:
+            return V4L2_PIX_FMT_H265;
+        case NV_DEMUXER_CODEC_VP8:
+            return V4L2_PIX_FMT_VP8;
+        case NV_DEMUXER_CODEC_VP9:
+            return V4L2_PIX_FMT_VP9;
+        case NV_DEMUXER_CODEC_MPEG2:
+            return V4L2_PIX_FMT_MPEG2;
+        default:
             return 0;
-        }
-        *buffer_ptr = *stream_ptr;
-        buffer_ptr++;
-        stream_ptr++;
-        buffer->planes[0].bytesused++;
     }
+}
 
-    // Reached end of buffer but could not find NAL unit
-    cerr << "Could not read nal unit from file. EOF or file corrupted"
-            << endl;
-    return -1;
+static int
+read_decoder_input_sample(NvDemuxer * demuxer, NvBuffer * buffer,
+        context_t * ctx)
+{
+    NvDemuxerSample sample;
+    int ret = demuxer->readSample(buffer->planes[0].data,
+            buffer->planes[0].length, &sample);
+
+    if (ret == 0)
+    {
+        // Start over for --loop, like read_decoder_input_nalu
+        demuxer->seek(0);
+        return buffer->planes[0].bytesused = 0;
+    }
+    if (ret < 0)
+    {
+        buffer->planes[0].bytesused = 0;
+        return -1;
+    }
+
+    // Every sample is a whole frame with its presentation time
+    ctx->timestamp = ctx->start_ts * MICROSECOND_UNIT + sample.pts;
+    ctx->flag_copyts = true;
+    buffer->planes[0].bytesused = sample.size;
+    return 0;
 }
 
 static int
-read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
+read_decoder_input_chunk(NvBitstreamSource * source, NvBuffer * buffer)
 {
     // Length is the size of the buffer in bytes
-    streamsize bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
+    size_t bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
 
-    stream->read((char *) buffer->planes[0].data, bytes_to_read);
     // It is necessary to set bytesused properly, so that decoder knows how
     // many bytes in the buffer are valid
-    buffer->planes[0].bytesused = stream->gcount();
+    buffer->planes[0].bytesused = source->read(buffer->planes[0].data,
+            bytes_to_read);
     if(buffer->planes[0].bytesused == 0)
     {
-        stream->clear();
-        stream->seekg(0,stream->beg);
+        source->rewind();
     }
     return 0;
 }
@@ -188,13 +185,14 @@ read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
 static int
 read_vpx_decoder_input_chunk(context_t *ctx, NvBuffer * buffer)
 {
-    ifstream *stream = ctx->in_file[0];
-    int Framesize;
+    NvBitstreamSource *source = ctx->in_file[0];
+    size_t bytes_read;
+    uint32_t Framesize;
     unsigned char *bitstreambuffer = (unsigned char *)buffer->planes[0].data;
     if (ctx->vp9_file_header_flag == 0)
     {
-        stream->read((char *) buffer->planes[0].data, IVF_FILE_HDR_SIZE);
-        if (stream->gcount() !=  IVF_FILE_HDR_SIZE)
+        bytes_read = source->read(buffer->planes[0].data, IVF_FILE_HDR_SIZE);
+        if (bytes_read != IVF_FILE_HDR_SIZE)
         {
             cerr << "Couldn't read IVF FILE HEADER" << endl;
             return -1;
@@ -208,24 +206,29 @@ read_vpx_decoder_input_chunk(context_t *ctx, NvBuffer * buffer)
         cout << "It's a valid IVF file" << endl;
         ctx->vp9_file_header_flag = 1;
     }
-    stream->read((char *) buffer->planes[0].data, IVF_FRAME_HDR_SIZE);
+    bytes_read = source->read(buffer->planes[0].data, IVF_FRAME_HDR_SIZE);
 
-    if (!stream->gcount())
+    if (!bytes_read)
     {
         cout << "End of stream" << endl;
         return 0;
     }
 
-    if (stream->gcount() != IVF_FRAME_HDR_SIZE)
+    if (bytes_read != IVF_FRAME_HDR_SIZE)
     {
         cerr << "Couldn't read IVF FRAME HEADER" << endl;
         return -1;
     }
     Framesize = (bitstreambuffer[3]<<24) + (bitstreambuffer[2]<<16) +
         (bitstreambuffer[1]<<8) + bitstreambuffer[0];
+    if (Framesize > buffer->planes[0].length)
+    {
+        cerr << "Frame of " << Framesize << " bytes does not fit the buffer"
+            << endl;
+        return -1;
+    }
     buffer->planes[0].bytesused = Framesize;
-    stream->read((char *) buffer->planes[0].data, Framesize);
-    if (stream->gcount() != Framesize)
+    if (source->read(buffer->planes[0].data, Framesize) != Framesize)
     {
         cerr << "Couldn't read Framesize" << endl;
         return -1;
@@ -233,6 +236,19 @@ read_vpx_decoder_input_chunk(context_t *ctx, NvBuffer * buffer)
     return 0;
 }
 
+/**
+ * Records a stage of the frame of a V4L2 timestamp, with --trace.
+ */
+static void
+trace_frame(context_t *ctx, const struct timeval &timestamp, const char *stage,
+        NvFrameTracer::TracePhase phase)
+{
+    if (ctx->trace_file)
+        NvFrameTracer::getTracerInstance().trace(0,
+                timestamp.tv_sec * (int64_t) MICROSECOND_UNIT + timestamp.tv_usec,
+                stage, phase);
+}
+
 static void
 abort(context_t *ctx)
 {
@@ -575,8 +591,10 @@ query_and_set_capture(context_t * ctx)
         {
             if(ctx->dmabuff_fd[index] != 0)
             {
-                ret = NvBufferDestroy (ctx->dmabuff_fd[index]);
+                ret = NvBufferPool::getProcessPool()->releaseDmabuf(
+                        ctx->dmabuff_fd[index]);
                 TEST_ERROR(ret < 0, "Failed to Destroy NvBuffer", error);
+                ctx->dmabuff_fd[index] = 0;
             }
         }
     }
@@ -663,7 +681,10 @@ query_and_set_capture(context_t * ctx)
             cParams.layout = NvBufferLayout_BlockLinear;
             cParams.payloadType = NvBufferPayload_SurfArray;
             cParams.nvbuf_tag = NvBufferTag_VIDEO_DEC;
-            ret = NvBufferCreateEx(&ctx->dmabuff_fd[index], &cParams);
+            // Buffers of an earlier setup with the same format come back
+            // from the process pool instead of being created again
+            ret = NvBufferPool::getProcessPool()->acquireDmabuf(&cParams,
+                    &ctx->dmabuff_fd[index]);
             TEST_ERROR(ret < 0, "Failed to create buffers", error);
         }
         ret = dec->capture_plane.reqbufs(V4L2_MEMORY_DMABUF,ctx->numCapBuffers);
@@ -737,6 +758,12 @@ query_and_set_capture(context_t * ctx)
             TEST_ERROR(ret < 0, "Error Qing buffer at converter capture plane",
                        error);
         }
+        if (!nv_thread_policy_is_default(&ctx->dq_policy))
+        {
+            ret = ctx->conv->setDQThreadPolicy(ctx->dq_policy);
+            TEST_ERROR(ret < 0, "Error setting converter DQ thread policy",
+                       error);
+        }
         ctx->conv->output_plane.startDQThread(ctx);
         ctx->conv->capture_plane.startDQThread(ctx);
 
@@ -821,6 +848,9 @@ dec_capture_loop_fcn(void *arg)
     int ret;
 
     cout << "Starting decoder capture loop thread" << endl;
+    if (!nv_thread_policy_is_default(&ctx->dq_policy) &&
+            nv_thread_policy_apply(&ctx->dq_policy) < 0)
+        cerr << "Warning: could not apply DQ thread policy: " << strerror(errno) << endl;
     // Need to wait for the first Resolution change event, so that
     // the decoder knows the stream resolution and can allocate appropriate
     // buffers when we call REQBUFS
@@ -902,6 +932,8 @@ dec_capture_loop_fcn(void *arg)
                 }
             }
 
+            trace_frame(ctx, v4l2_buf.timestamp, "decode", NvFrameTracer::TRACE_END);
+
             if (ctx->copy_timestamp && ctx->input_nalu && ctx->stats)
             {
               cout << "[" << v4l2_buf.index << "]" "dec capture plane dqB timestamp [" <<
@@ -977,7 +1009,9 @@ dec_capture_loop_fcn(void *arg)
                 if(ctx->capture_plane_mem_type == V4L2_MEMORY_DMABUF)
                     dec_buffer->planes[0].fd = ctx->dmabuff_fd[v4l2_buf.index];
                 // Convert Blocklinear to PitchLinear
+                trace_frame(ctx, v4l2_buf.timestamp, "transform", NvFrameTracer::TRACE_BEGIN);
                 ret = NvBufferTransform(dec_buffer->planes[0].fd, ctx->dst_dma_fd, &transform_params);
+                trace_frame(ctx, v4l2_buf.timestamp, "transform", NvFrameTracer::TRACE_END);
                 if (ret == -1)
                 {
                     cerr << "Transform failed" << endl;
@@ -998,7 +1032,9 @@ dec_capture_loop_fcn(void *arg)
 
                 if (!ctx->stats && !ctx->disable_rendering)
                 {
+                    trace_frame(ctx, v4l2_buf.timestamp, "render", NvFrameTracer::TRACE_BEGIN);
                     ctx->renderer->render(ctx->dst_dma_fd);
+                    trace_frame(ctx, v4l2_buf.timestamp, "render", NvFrameTracer::TRACE_END);
                 }
 
                 // Not writing to file
@@ -1075,6 +1111,7 @@ set_defaults(context_t * ctx)
     ctx->max_perf = 0;
     ctx->extra_cap_plane_buffer = 1;
     ctx->blocking_mode = 1;
+    nv_thread_policy_init(&ctx->dq_policy);
 #ifndef USE_NVBUF_TRANSFORM_API
     ctx->conv_output_plane_buf_queue = new queue < NvBuffer * >;
     ctx->rescale_method = V4L2_YUV_RESCALE_NONE;
@@ -1084,7 +1121,7 @@ set_defaults(context_t * ctx)
 }
 
 static bool decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_file,
-                    int current_loop, char *nalu_parse_buffer)
+                    int current_loop)
 {
     // In non-blocking mode, we will have this function do below things:
     // Issue signal to PollThread so it starts Poll and wait until we are signalled.
@@ -1194,22 +1231,26 @@ static bool decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_
                 goto check_capture_buffers;
             }
 
-            if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
+            if (ctx.demuxer)
+            {
+                if (read_decoder_input_sample(ctx.demuxer[current_file], output_buffer, &ctx) < 0)
+                    cerr << "Couldn't read sample" << endl;
+            }
+            else if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
                     (ctx.decoder_pixfmt == V4L2_PIX_FMT_H265) ||
                     (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG2) ||
                     (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG4))
             {
                 if (ctx.input_nalu)
                 {
-                    read_decoder_input_nalu(ctx.in_file[current_file], output_buffer, nalu_parse_buffer,
-                            CHUNK_SIZE, &ctx);
+                    read_decoder_input_nalu(ctx.in_file[current_file], output_buffer, &ctx);
                 }
                 else
                 {
                     read_decoder_input_chunk(ctx.in_file[current_file], output_buffer);
                 }
             }
-            if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
+            else if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
             {
                 ret = read_vpx_decoder_input_chunk(&ctx, output_buffer);
                 if (ret != 0)
@@ -1220,9 +1261,11 @@ static bool decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_
             if (ctx.input_nalu && ctx.copy_timestamp && ctx.flag_copyts)
             {
                 v4l2_output_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
-                ctx.timestamp += ctx.timestampincr;
+                if (!ctx.demuxer)
+                    ctx.timestamp += ctx.timestampincr;
                 v4l2_output_buf.timestamp.tv_sec = ctx.timestamp / (MICROSECOND_UNIT);
                 v4l2_output_buf.timestamp.tv_usec = ctx.timestamp % (MICROSECOND_UNIT);
+                trace_frame(&ctx, v4l2_output_buf.timestamp, "decode", NvFrameTracer::TRACE_BEGIN);
             }
 
             if (v4l2_output_buf.m.planes[0].bytesused == 0)
@@ -1304,6 +1347,8 @@ check_capture_buffers:
                 }
             }
 
+            trace_frame(&ctx, v4l2_capture_buf.timestamp, "decode", NvFrameTracer::TRACE_END);
+
             if (ctx.copy_timestamp && ctx.input_nalu && ctx.stats)
             {
               cout << "[" << v4l2_capture_buf.index << "]" "dec capture plane dqB timestamp [" <<
@@ -1350,7 +1395,9 @@ check_capture_buffers:
                 if(ctx.capture_plane_mem_type == V4L2_MEMORY_DMABUF)
                     capture_buffer->planes[0].fd = ctx.dmabuff_fd[v4l2_capture_buf.index];
                 // Convert Blocklinear to PitchLinear
+                trace_frame(&ctx, v4l2_capture_buf.timestamp, "transform", NvFrameTracer::TRACE_BEGIN);
                 ret = NvBufferTransform(capture_buffer->planes[0].fd, ctx.dst_dma_fd, &transform_params);
+                trace_frame(&ctx, v4l2_capture_buf.timestamp, "transform", NvFrameTracer::TRACE_END);
                 if (ret == -1)
                 {
                     cerr << "Transform failed" << endl;
@@ -1370,7 +1417,9 @@ check_capture_buffers:
                 }
                 if (!ctx.stats && !ctx.disable_rendering)
                 {
+                    trace_frame(&ctx, v4l2_capture_buf.timestamp, "render", NvFrameTracer::TRACE_BEGIN);
                     ctx.renderer->render(ctx.dst_dma_fd);
+                    trace_frame(&ctx, v4l2_capture_buf.timestamp, "render", NvFrameTracer::TRACE_END);
                 }
                 // Queue the buffer back once it has been used.
                 // If we are not rendering, queue the buffer back here immediately.
@@ -1390,7 +1439,7 @@ check_capture_buffers:
 }
 
 static bool decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_file,
-                                int current_loop, char *nalu_parse_buffer)
+                                int current_loop)
 {
     // Since all the output plane buffers have been queued, we first need to
     // dequeue a buffer from output plane before we can read new data into it
@@ -1442,22 +1491,26 @@ static bool decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_fil
             }
         }
 
-        if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
+        if (ctx.demuxer)
+        {
+            if (read_decoder_input_sample(ctx.demuxer[current_file], buffer, &ctx) < 0)
+                cerr << "Couldn't read sample" << endl;
+        }
+        else if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_H265) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG2) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG4))
         {
             if (ctx.input_nalu)
             {
-                read_decoder_input_nalu(ctx.in_file[current_file], buffer, nalu_parse_buffer,
-                        CHUNK_SIZE, &ctx);
+                read_decoder_input_nalu(ctx.in_file[current_file], buffer, &ctx);
             }
             else
             {
                 read_decoder_input_chunk(ctx.in_file[current_file], buffer);
             }
         }
-        if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
+        else if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
         {
             ret = read_vpx_decoder_input_chunk(&ctx, buffer);
             if (ret != 0)
@@ -1468,9 +1521,11 @@ static bool decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_fil
         if (ctx.input_nalu && ctx.copy_timestamp && ctx.flag_copyts)
         {
           v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
-          ctx.timestamp += ctx.timestampincr;
+          if (!ctx.demuxer)
+              ctx.timestamp += ctx.timestampincr;
           v4l2_buf.timestamp.tv_sec = ctx.timestamp / (MICROSECOND_UNIT);
           v4l2_buf.timestamp.tv_usec = ctx.timestamp % (MICROSECOND_UNIT);
+          trace_frame(&ctx, v4l2_buf.timestamp, "decode", NvFrameTracer::TRACE_BEGIN);
         }
 
         if (v4l2_buf.m.planes[0].bytesused == 0)
@@ -1518,7 +1573,6 @@ decode_proc(context_t& ctx, int argc, char *argv[])
     uint32_t i;
     bool eos = false;
     int current_loop = 0;
-    char *nalu_parse_buffer = NULL;
     NvApplicationProfiler &profiler = NvApplicationProfiler::getProfilerInstance();
 
     set_defaults(&ctx);
@@ -1530,6 +1584,16 @@ decode_proc(context_t& ctx, int argc, char *argv[])
         fprintf(stderr, "Error parsing commandline arguments\n");
         return -1;
     }
+    if (ctx.trace_file)
+    {
+        // Frames are told apart by the timestamps of --copy-timestamp
+        if (!ctx.copy_timestamp || !ctx.input_nalu)
+        {
+            fprintf(stderr, "--trace needs --input-nalu and --copy-timestamp\n");
+            return -1;
+        }
+        NvFrameTracer::getTracerInstance().enable();
+    }
     if (ctx.blocking_mode)
     {
         cout << "Creating decoder in blocking mode \n";
@@ -1542,11 +1606,27 @@ decode_proc(context_t& ctx, int argc, char *argv[])
     }
     TEST_ERROR(!ctx.dec, "Could not create decoder", cleanup);
 
-    ctx.in_file = (std::ifstream **)malloc(sizeof(std::ifstream *)*ctx.file_count);
-    for (uint32_t i = 0 ; i < ctx.file_count ; i++)
+    if (ctx.demux)
     {
-        ctx.in_file[i] = new ifstream(ctx.in_file_path[i]);
-        TEST_ERROR(!ctx.in_file[i]->is_open(), "Error opening input file", cleanup);
+        ctx.demuxer = (NvDemuxer **)calloc(ctx.file_count, sizeof(NvDemuxer *));
+        for (uint32_t i = 0 ; i < ctx.file_count ; i++)
+        {
+            ctx.demuxer[i] = NvDemuxer::createDemuxer(ctx.in_file_path[i]);
+            TEST_ERROR(!ctx.demuxer[i], "Error opening input file", cleanup);
+            TEST_ERROR(demuxer_pixfmt(ctx.demuxer[i]) != ctx.decoder_pixfmt,
+                    "Input file does not match the decoder type", cleanup);
+            cout << "Demuxing " << ctx.demuxer[i]->getFormatName() << " file " <<
+                ctx.in_file_path[i] << endl;
+        }
+    }
+    else
+    {
+        ctx.in_file = (NvBitstreamSource **)calloc(ctx.file_count, sizeof(NvBitstreamSource *));
+        for (uint32_t i = 0 ; i < ctx.file_count ; i++)
+        {
+            ctx.in_file[i] = NvBitstreamSource::createBitstreamSource(ctx.in_file_path[i]);
+            TEST_ERROR(!ctx.in_file[i], "Error opening input file", cleanup);
+        }
     }
 
     if (ctx.out_file_path)
@@ -1574,7 +1654,6 @@ decode_proc(context_t& ctx, int argc, char *argv[])
 
     if (ctx.input_nalu)
     {
-        nalu_parse_buffer = new char[CHUNK_SIZE];
         printf("Setting frame input mode to 0 \n");
         ret = ctx.dec->setFrameInputMode(0);
         TEST_ERROR(ret < 0,
@@ -1683,22 +1762,26 @@ decode_proc(context_t& ctx, int argc, char *argv[])
         memset(planes, 0, sizeof(planes));
 
         buffer = ctx.dec->output_plane.getNthBuffer(i);
-        if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
+        if (ctx.demuxer)
+        {
+            if (read_decoder_input_sample(ctx.demuxer[current_file], buffer, &ctx) < 0)
+                cerr << "Couldn't read sample" << endl;
+        }
+        else if ((ctx.decoder_pixfmt == V4L2_PIX_FMT_H264) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_H265) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG2) ||
                 (ctx.decoder_pixfmt == V4L2_PIX_FMT_MPEG4))
         {
             if (ctx.input_nalu)
             {
-                read_decoder_input_nalu(ctx.in_file[current_file], buffer, nalu_parse_buffer,
-                        CHUNK_SIZE, &ctx);
+                read_decoder_input_nalu(ctx.in_file[current_file], buffer, &ctx);
             }
             else
             {
                 read_decoder_input_chunk(ctx.in_file[current_file], buffer);
             }
         }
-        if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
+        else if (ctx.decoder_pixfmt == V4L2_PIX_FMT_VP9 || ctx.decoder_pixfmt == V4L2_PIX_FMT_VP8)
         {
             ret = read_vpx_decoder_input_chunk(&ctx, buffer);
             if (ret != 0)
@@ -1712,9 +1795,11 @@ decode_proc(context_t& ctx, int argc, char *argv[])
         if (ctx.input_nalu && ctx.copy_timestamp && ctx.flag_copyts)
         {
           v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
-          ctx.timestamp += ctx.timestampincr;
+          if (!ctx.demuxer)
+              ctx.timestamp += ctx.timestampincr;
           v4l2_buf.timestamp.tv_sec = ctx.timestamp / (MICROSECOND_UNIT);
           v4l2_buf.timestamp.tv_usec = ctx.timestamp % (MICROSECOND_UNIT);
+          trace_frame(&ctx, v4l2_buf.timestamp, "decode", NvFrameTracer::TRACE_BEGIN);
         }
 
         if (v4l2_buf.m.planes[0].bytesused == 0)
@@ -1755,9 +1840,9 @@ decode_proc(context_t& ctx, int argc, char *argv[])
         i++;
     }
     if (ctx.blocking_mode)
-        eos = decoder_proc_blocking(ctx, eos, current_file, current_loop, nalu_parse_buffer);
+        eos = decoder_proc_blocking(ctx, eos, current_file, current_loop);
     else
-        eos = decoder_proc_nonblocking(ctx, eos, current_file, current_loop, nalu_parse_buffer);
+        eos = decoder_proc_nonblocking(ctx, eos, current_file, current_loop);
     // After sending EOS, all the buffers from output plane should be dequeued.
     // and after that capture plane loop should be signalled to stop.
     if (ctx.blocking_mode)
@@ -1825,6 +1910,15 @@ decode_proc(context_t& ctx, int argc, char *argv[])
         profiler.printProfilerData(cout);
     }
 
+    if (ctx.trace_file)
+    {
+        if (NvFrameTracer::getTracerInstance().dumpChromeTrace(ctx.trace_file) < 0)
+        {
+            cerr << "Could not write trace " << ctx.trace_file << endl;
+            error = 1;
+        }
+    }
+
 cleanup:
     if (ctx.blocking_mode && ctx.dec_capture_loop)
     {
@@ -1844,13 +1938,15 @@ cleanup:
         {
             if(ctx.dmabuff_fd[index] != 0)
             {
-                ret = NvBufferDestroy (ctx.dmabuff_fd[index]);
+                ret = NvBufferPool::getProcessPool()->releaseDmabuf(
+                        ctx.dmabuff_fd[index]);
                 if(ret < 0)
                 {
                     cerr << "Failed to Destroy NvBuffer" << endl;
                 }
             }
         }
+        NvBufferPool::getProcessPool()->trim();
     }
 #ifndef USE_NVBUF_TRANSFORM_API
     if (ctx.conv && ctx.conv->isInError())
@@ -1879,8 +1975,10 @@ cleanup:
 #endif
     // Similarly, EglRenderer destructor does all the cleanup
     delete ctx.renderer;
-    for (uint32_t i = 0 ; i < ctx.file_count ; i++)
+    for (uint32_t i = 0 ; ctx.in_file && i < ctx.file_count ; i++)
       delete ctx.in_file[i];
+    for (uint32_t i = 0 ; ctx.demuxer && i < ctx.file_count ; i++)
+      delete ctx.demuxer[i];
     delete ctx.out_file;
 #ifndef USE_NVBUF_TRANSFORM_API
     delete ctx.conv_output_plane_buf_queue;
@@ -1891,13 +1989,14 @@ cleanup:
         ctx.dst_dma_fd = -1;
     }
 #endif
-    delete[] nalu_parse_buffer;
 
     free (ctx.in_file);
+    free (ctx.demuxer);
     for (uint32_t i = 0 ; i < ctx.file_count ; i++)
       free (ctx.in_file_path[i]);
     free (ctx.in_file_path);
     free(ctx.out_file_path);
+    free(ctx.trace_file);
     if (!ctx.blocking_mode)
     {
         sem_destroy(&ctx.pollthread_sema);
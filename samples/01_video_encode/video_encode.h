@@ -28,6 +28,7 @@
 
 #include <fstream>
 #include "NvVideoEncoder.h"
+#include "NvThreadPolicy.h"
 #include <sstream>
 #include <stdint.h>
 #include <semaphore.h>
@@ -148,6 +149,7 @@ typedef struct
     sem_t encoderthread_sema; // Encoder thread waits on this to be signalled to continue q/dq loop
     pthread_t   enc_pollthread; // Polling thread, created if running in non-blocking mode.
     pthread_t enc_capture_loop; // Encoder capture thread
+    NvThreadPolicy dq_policy; // Encoder capture plane DQ thread
 } context_t;
 
 int parse_csv_args(context_t * ctx, int argc, char *argv[]);
@@ -58,6 +58,9 @@ print_help(void)
             "OPTIONS:\n"
             "\t-h,--help             Prints this text\n"
             "\t--dbg-level <level>   Sets the debug level [Values 0-3]\n\n"
+            "\t--dq-cpus <list>      Run the DQ threads on these CPUs, e.g. 2-3,6\n"
+            "\t--dq-sched <policy>   DQ thread scheduling, other or fifo:<priority 1-99>\n"
+            "\t--dq-nice <value>     DQ thread nice value [-20 to 19]\n\n"
             "\t-br <bitrate>         Bitrate [Default = 4000000]\n"
             "\t-pbr <peak_bitrate>   Peak bitrate [Default = 1.2*bitrate]\n\n"
             "NOTE: Peak bitrate takes effect in VBR more; must be >= bitrate\n\n"
@@ -309,6 +312,29 @@ parse_csv_args(context_t * ctx, int argc, char *argv[])
             print_help();
             exit(EXIT_SUCCESS);
         }
+        else if (!strcmp(arg, "--dq-cpus"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_cpus(*argp, &ctx->dq_policy.cpu_mask) < 0,
+                    "Invalid CPU list: " << *argp);
+        }
+        else if (!strcmp(arg, "--dq-sched"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_sched(*argp, &ctx->dq_policy) < 0,
+                    "Invalid scheduling policy: " << *argp);
+        }
+        else if (!strcmp(arg, "--dq-nice"))
+        {
+            argp++;
+            /* Negative values start with '-', CHECK_OPTION_VALUE would reject them */
+            CSV_PARSE_CHECK_ERROR(!*argp, "value not specified for option " << arg);
+            ctx->dq_policy.nice = atoi(*argp);
+            CSV_PARSE_CHECK_ERROR(ctx->dq_policy.nice < -20 || ctx->dq_policy.nice > 19,
+                    "nice value should be in [-20, 19]");
+        }
         else if (!strcmp(arg, "--dbg-level"))
         {
             argp++;
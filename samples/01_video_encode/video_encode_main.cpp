@@ -436,6 +436,7 @@ static void
 set_defaults(context_t * ctx)
 {
     memset(ctx, 0, sizeof(context_t));
+    nv_thread_policy_init(&ctx->dq_policy);
 
     ctx->raw_pixfmt = V4L2_PIX_FMT_YUV420M;
     ctx->bitrate = 4 * 1024 * 1024;
@@ -1440,6 +1441,11 @@ encode_proc(context_t& ctx, int argc, char *argv[])
         // startDQThread starts a thread internally which calls the
         // encoder_capture_plane_dq_callback whenever a buffer is dequeued
         // on the plane
+        if (!nv_thread_policy_is_default(&ctx.dq_policy))
+        {
+            ret = ctx.enc->setDQThreadPolicy(ctx.dq_policy);
+            TEST_ERROR(ret < 0, "Error setting encoder DQ thread policy", cleanup);
+        }
         ctx.enc->capture_plane.startDQThread(&ctx);
     }
     else
@@ -29,6 +29,7 @@
 #include "NvVideoDecoder.h"
 #include "NvVideoConverter.h"
 #include "NvEglRenderer.h"
+#include "NvBitstreamSource.h"
 #include "EGL/egl.h"
 #include "EGL/eglext.h"
 #include <queue>
@@ -48,7 +49,7 @@ typedef struct
     NvEglRenderer *renderer;
 
     char *in_file_path;
-    std::ifstream *in_file;
+    NvBitstreamSource *in_file;
 
     char *out_file_path;
     std::ofstream *out_file;
@@ -27,6 +27,7 @@
  */
 
 #include "NvUtils.h"
+#include "NvBitstreamSource.h"
 #include "NvCudaProc.h"
 #include "nvbuf_utils.h"
 #include <errno.h>
@@ -53,12 +54,6 @@
 #define CHUNK_SIZE 4000000
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
-
 #define BORDER_WIDTH 5
 
 #define FIRST_CLASS_CNT 1
@@ -66,88 +61,40 @@
 using namespace std;
 
 static int
-read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
-        char *parse_buffer, streamsize parse_buffer_size)
+read_decoder_input_nalu(NvBitstreamSource * source, NvBuffer * buffer)
 {
-    // Length is the size of the buffer in bytes
-    char *buffer_ptr = (char *) buffer->planes[0].data;
-
-    char *stream_ptr;
-    bool nalu_found = false;
+    NvNalUnit nalu;
+    const uint8_t *data = source->nextNalu(NV_NAL_CODEC_H264, &nalu);
 
-    streamsize bytes_read;
-    streamsize stream_initial_pos = stream->tellg();
-
-    stream->read(parse_buffer, parse_buffer_size);
-    bytes_read = stream->gcount();
-
-    if (bytes_read == 0)
+    if (!data)
     {
         return buffer->planes[0].bytesused = 0;
     }
 
-    // Find the first NAL unit in the buffer
-    stream_ptr = parse_buffer;
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-                    IS_NAL_UNIT_START1(stream_ptr);
-        if (nalu_found)
-        {
-            break;
-        }
-        stream_ptr++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    if (!nalu_found)
+    if (nalu.size > buffer->planes[0].length)
     {
-        cerr << "Could not read nal unit from file. EOF or file corrupted"
+        cerr << "NAL unit of " << nalu.size << " bytes does not fit the buffer"
             << endl;
+        buffer->planes[0].bytesused = 0;
         return -1;
     }
 
-    memcpy(buffer_ptr, stream_ptr, 4);
-    buffer_ptr += 4;
-    buffer->planes[0].bytesused = 4;
-    stream_ptr += 4;
-
-    // Copy bytes till the next NAL unit is found
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-        {
-            streamsize seekto = stream_initial_pos +
-                    (stream_ptr - parse_buffer);
-            if(stream->eof())
-            {
-                stream->clear();
-            }
-            stream->seekg(seekto, stream->beg);
-            return 0;
-        }
-        *buffer_ptr = *stream_ptr;
-        buffer_ptr++;
-        stream_ptr++;
-        buffer->planes[0].bytesused++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    cerr << "Could not read nal unit from file. EOF or file corrupted"
-            << endl;
-    return -1;
+    // The only copy of the NAL unit, straight from the mapped file
+    memcpy(buffer->planes[0].data, data, nalu.size);
+    buffer->planes[0].bytesused = nalu.size;
+    return 0;
 }
 
 static int
-read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
+read_decoder_input_chunk(NvBitstreamSource * source, NvBuffer * buffer)
 {
     //length is the size of the buffer in bytes
-    streamsize bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
+    size_t bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
 
-    stream->read((char *) buffer->planes[0].data, bytes_to_read);
     // It is necessary to set bytesused properly, so that decoder knows how
     // many bytes in the buffer are valid
-    buffer->planes[0].bytesused = stream->gcount();
+    buffer->planes[0].bytesused = source->read(buffer->planes[0].data,
+            bytes_to_read);
     return 0;
 }
 
@@ -815,7 +762,6 @@ main(int argc, char *argv[])
     int error = 0;
     uint32_t i;
     bool eos = false;
-    char *nalu_parse_buffer = NULL;
 
     set_defaults(&ctx);
 
@@ -866,7 +812,6 @@ main(int argc, char *argv[])
 
     if (ctx.input_nalu)
     {
-        nalu_parse_buffer = new char[CHUNK_SIZE];
         ret = ctx.dec->setFrameInputMode(0);
         TEST_ERROR(ret < 0,
                 "Error in decoder setFrameInputMode", cleanup);
@@ -887,8 +832,8 @@ main(int argc, char *argv[])
     ret = ctx.dec->output_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
     TEST_ERROR(ret < 0, "Error while setting up output plane", cleanup);
 
-    ctx.in_file = new ifstream(ctx.in_file_path);
-    TEST_ERROR(!ctx.in_file->is_open(), "Error opening input file", cleanup);
+    ctx.in_file = NvBitstreamSource::createBitstreamSource(ctx.in_file_path);
+    TEST_ERROR(!ctx.in_file, "Error opening input file", cleanup);
 
     if (ctx.out_file_path)
     {
@@ -932,8 +877,7 @@ main(int argc, char *argv[])
         buffer = ctx.dec->output_plane.getNthBuffer(i);
         if (ctx.input_nalu)
         {
-            read_decoder_input_nalu(ctx.in_file, buffer, nalu_parse_buffer,
-                    CHUNK_SIZE);
+            read_decoder_input_nalu(ctx.in_file, buffer);
         }
         else
         {
@@ -986,8 +930,7 @@ main(int argc, char *argv[])
 
         if (ctx.input_nalu)
         {
-            read_decoder_input_nalu(ctx.in_file, buffer, nalu_parse_buffer,
-                    CHUNK_SIZE);
+            read_decoder_input_nalu(ctx.in_file, buffer);
         }
         else
         {
@@ -1065,7 +1008,6 @@ cleanup:
     delete ctx.in_file;
     delete ctx.out_file;
     delete ctx.conv_output_plane_buf_queue;
-    delete []nalu_parse_buffer;
 
     free(ctx.in_file_path);
     free(ctx.out_file_path);
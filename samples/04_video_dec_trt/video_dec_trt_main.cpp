@@ -57,10 +57,6 @@
 
 #define CHUNK_SIZE 4000000
 
-#define IS_NAL_UNIT_START(buffer_ptr) \
-            (!buffer_ptr[0] && !buffer_ptr[1] && \
-             !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
 const char *GOOGLE_NET_DEPLOY_NAME =
              "../../data/Model/GoogleNet_one_class/GoogleNet_modified_oneClass_halfHD.prototxt";
 const char *GOOGLE_NET_MODEL_NAME =
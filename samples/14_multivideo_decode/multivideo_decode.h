@@ -29,6 +29,9 @@
 #include "NvVideoDecoder.h"
 #include "NvVideoConverter.h"
 #include "NvEglRenderer.h"
+#include "NvThreadPolicy.h"
+#include "NvDQWorkerPool.h"
+#include "NvBitstreamSource.h"
 #include <queue>
 #include <fstream>
 #include <pthread.h>
@@ -47,7 +50,7 @@ typedef struct
     NvEglRenderer *renderer;
 
     char *in_file_path;
-    std::ifstream *in_file;
+    NvBitstreamSource *in_file;
 
     char *out_file_path;
     std::ofstream *out_file;
@@ -109,6 +112,11 @@ typedef struct
     int numCapBuffers;
     int loop_count;
     int blocking_mode; // Set to true if running in blocking mode
+    NvThreadPolicy dq_policy; // Decoder capture and converter DQ threads
+    uint32_t dq_workers; // Converter DQ worker pool size, 0 for a thread per plane
+    char *metrics_dest; // Metrics export destination, NULL if disabled
+    bool metrics_prometheus; // Export Prometheus text instead of JSON lines
+    uint32_t metrics_interval; // Metrics export interval in milliseconds
 } context_t;
 
 typedef struct
@@ -69,7 +69,16 @@ print_help(void)
             "\tNOTE: Currently multivideo_decode to be only run with --disable-rendering Mandatory\n"
             "\t-h,--help            Prints this text\n"
             "\t--dbg-level <level>  Sets the debug level [Values 0-3]\n\n"
+            "\t--dq-cpus <list>     Run the DQ threads on these CPUs, e.g. 2-3,6\n"
+            "\t--dq-sched <policy>  DQ thread scheduling, other or fifo:<priority 1-99>\n"
+            "\t--dq-nice <value>    DQ thread nice value [-20 to 19]\n"
+            "\t--dq-workers <num>   Run the converter DQ callbacks of all instances on <num>\n"
+            "\t                     shared threads, taken from the first instance [Default = 0, one thread per plane]\n\n"
             "\t--stats              Report profiling data for the app\n\n"
+            "\t--metrics <dest>     Export metrics of all instances to <dest>, taken from the first instance:\n"
+            "\t                     a file, unix:<socket path> or - for stdout\n"
+            "\t--metrics-format <f> Metrics format, json or prom [Default = json]\n"
+            "\t--metrics-interval <ms> Metrics export interval [Default = 1000]\n\n"
             "\tNOTE: this should not be used alongside -o option as it decreases the FPS value shown in --stats\n"
             "\t--disable-rendering  Disable rendering\n"
             "\tNOTE: this should be set only for platform T194 or above\n"
@@ -349,6 +358,67 @@ parse_csv_args(context_t ** ctx, int argc, char *argv[], int num_files)
                         "Unsupported values for skip frames: " << *argp);
                 CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
             }
+            else if (!strcmp(arg, "--dq-cpus"))
+            {
+                argp++;
+                CHECK_OPTION_VALUE(argp);
+                CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_cpus(*argp, &ctx[i]->dq_policy.cpu_mask) < 0,
+                        "Invalid CPU list: " << *argp);
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--dq-sched"))
+            {
+                argp++;
+                CHECK_OPTION_VALUE(argp);
+                CSV_PARSE_CHECK_ERROR(nv_thread_policy_parse_sched(*argp, &ctx[i]->dq_policy) < 0,
+                        "Invalid scheduling policy: " << *argp);
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--dq-nice"))
+            {
+                argp++;
+                /* Negative values start with '-', CHECK_OPTION_VALUE would reject them */
+                CSV_PARSE_CHECK_ERROR(!*argp, "value not specified for option " << arg);
+                ctx[i]->dq_policy.nice = atoi(*argp);
+                CSV_PARSE_CHECK_ERROR(ctx[i]->dq_policy.nice < -20 || ctx[i]->dq_policy.nice > 19,
+                        "nice value should be in [-20, 19]");
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--dq-workers"))
+            {
+                argp++;
+                CHECK_OPTION_VALUE(argp);
+                ctx[i]->dq_workers = atoi(*argp);
+                CSV_PARSE_CHECK_ERROR(ctx[i]->dq_workers > 64,
+                        "DQ workers should be 0 to 64");
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--metrics"))
+            {
+                argp++;
+                /* "-" is stdout, CHECK_OPTION_VALUE would reject it */
+                CSV_PARSE_CHECK_ERROR(!*argp, "value not specified for option " << arg);
+                ctx[i]->metrics_dest = strdup(*argp);
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--metrics-format"))
+            {
+                argp++;
+                CHECK_OPTION_VALUE(argp);
+                CSV_PARSE_CHECK_ERROR(strcmp(*argp, "json") && strcmp(*argp, "prom"),
+                        "Metrics format should be json or prom");
+                ctx[i]->metrics_prometheus = !strcmp(*argp, "prom");
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
+            else if (!strcmp(arg, "--metrics-interval"))
+            {
+                argp++;
+                CHECK_OPTION_VALUE(argp);
+                ctx[i]->metrics_interval = atoi(*argp);
+                CSV_PARSE_CHECK_ERROR(ctx[i]->metrics_interval == 0,
+                        "Metrics interval should be above 0");
+                CHECK_IF_LAST_LOOP(i, num_files, argp, 1);
+            }
             else if (!strcmp(arg, "--dbg-level"))
             {
                 argp++;
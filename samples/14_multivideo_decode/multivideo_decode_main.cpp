@@ -28,6 +28,8 @@
 
 #include "NvApplicationProfiler.h"
 #include "NvUtils.h"
+#include "NvBitstreamSource.h"
+#include "NvBufferPool.h"
 #include <errno.h>
 #include <fstream>
 #include <iostream>
@@ -51,12 +53,6 @@
 #define CHUNK_SIZE 4000000
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
-
 #define H264_NAL_UNIT_CODED_SLICE  1
 #define H264_NAL_UNIT_CODED_SLICE_IDR  5
 
@@ -70,13 +66,6 @@
 
 #define MAX_STREAM 32
 
-#define IS_H264_NAL_CODED_SLICE(buffer_ptr) \
-        ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE)
-#define IS_H264_NAL_CODED_SLICE_IDR(buffer_ptr) \
-        ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE_IDR)
-
-#define GET_H265_NAL_UNIT_TYPE(buffer_ptr) ((buffer_ptr[0] & 0x7E) >> 1)
-
 #define IS_SEMIPLANAR_FMT(pixel_format) ((pixel_format == NvBufferColorFormat_NV12) || \
         (pixel_format == NvBufferColorFormat_NV12_ER) || \
         (pixel_format == NvBufferColorFormat_NV12_709) || \
@@ -85,6 +74,7 @@
 
 int num_files;
 fps_stats **stream_stats;
+static NvDQWorkerPool *dq_pool; // Shared by the converters of all instances, if set
 
 using namespace std;
 
@@ -111,112 +101,66 @@ print_stats()
 }
 
 static int
-read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
-        char *parse_buffer, streamsize parse_buffer_size, context_t * ctx)
+read_decoder_input_nalu(NvBitstreamSource * source, NvBuffer * buffer, context_t * ctx)
 {
-    // Length is the size of the buffer in bytes
-    char *buffer_ptr = (char *) buffer->planes[0].data;
+    NvNalUnit nalu;
+    NvNalCodec codec = (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) ?
+        NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
     int h265_nal_unit_type;
-    char *stream_ptr;
-    bool nalu_found = false;
-
-    streamsize bytes_read;
-    streamsize stream_initial_pos = stream->tellg();
+    const uint8_t *data = source->nextNalu(codec, &nalu);
 
-    stream->read(parse_buffer, parse_buffer_size);
-    bytes_read = stream->gcount();
-
-    if (bytes_read == 0)
+    if (!data)
     {
+        // Start over for --loop, like read_decoder_input_chunk
+        source->rewind();
         return buffer->planes[0].bytesused = 0;
     }
 
-    // Find the first NAL unit in the buffer
-    stream_ptr = parse_buffer;
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-                    IS_NAL_UNIT_START1(stream_ptr);
-        if (nalu_found)
-        {
-            break;
-        }
-        stream_ptr++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    if (!nalu_found)
+    if (nalu.size > buffer->planes[0].length)
     {
-        cerr << "Could not read nal unit from file. EOF or file corrupted"
+        cerr << "NAL unit of " << nalu.size << " bytes does not fit the buffer"
             << endl;
+        buffer->planes[0].bytesused = 0;
         return -1;
     }
 
-    memcpy(buffer_ptr, stream_ptr, 4);
-    buffer_ptr += 4;
-    buffer->planes[0].bytesused = 4;
-    stream_ptr += 4;
-
     if (ctx->copy_timestamp)
     {
       if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H264) {
-        if ((IS_H264_NAL_CODED_SLICE(stream_ptr)) ||
-            (IS_H264_NAL_CODED_SLICE_IDR(stream_ptr)))
+        if ((nalu.type == H264_NAL_UNIT_CODED_SLICE) ||
+            (nalu.type == H264_NAL_UNIT_CODED_SLICE_IDR))
           ctx->flag_copyts = true;
         else
           ctx->flag_copyts = false;
       } else if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) {
-        h265_nal_unit_type = GET_H265_NAL_UNIT_TYPE(stream_ptr);
-        if ((h265_nal_unit_type >= HEVC_NUT_TRAIL_N &&
-                h265_nal_unit_type <= HEVC_NUT_RASL_R) ||
-            (h265_nal_unit_type >= HEVC_NUT_BLA_W_LP &&
-             h265_nal_unit_type <= HEVC_NUT_CRA_NUT))
+        h265_nal_unit_type = nalu.type;
+        if ((h265_nal_unit_type >= HEVC_NUT_TRAIL_N && h265_nal_unit_type <= HEVC_NUT_RASL_R) ||
+            (h265_nal_unit_type >= HEVC_NUT_BLA_W_LP && h265_nal_unit_type <= HEVC_NUT_CRA_NUT))
           ctx->flag_copyts = true;
         else
           ctx->flag_copyts = false;
       }
     }
 
-    // Copy bytes till the next NAL unit is found
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-        {
-            streamsize seekto = stream_initial_pos +
-                    (stream_ptr - parse_buffer);
-            if(stream->eof())
-            {
-                stream->clear();
-            }
-            stream->seekg(seekto, stream->beg);
-            return 0;
-        }
-        *buffer_ptr = *stream_ptr;
-        buffer_ptr++;
-        stream_ptr++;
-        buffer->planes[0].bytesused++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    cerr << "Could not read nal unit from file. EOF or file corrupted"
-            << endl;
-    return -1;
+    // The only copy of the NAL unit, straight from the mapped file
+    memcpy(buffer->planes[0].data, data, nalu.size);
+    buffer->planes[0].bytesused = nalu.size;
+    return 0;
 }
 
 static int
-read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
+read_decoder_input_chunk(NvBitstreamSource * source, NvBuffer * buffer)
 {
     // Length is the size of the buffer in bytes
-    streamsize bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
+    size_t bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
 
-    stream->read((char *) buffer->planes[0].data, bytes_to_read);
     // It is necessary to set bytesused properly, so that decoder knows how
     // many bytes in the buffer are valid
-    buffer->planes[0].bytesused = stream->gcount();
+    buffer->planes[0].bytesused = source->read(buffer->planes[0].data,
+            bytes_to_read);
     if(buffer->planes[0].bytesused == 0)
     {
-        stream->clear();
-        stream->seekg(0,stream->beg);
+        source->rewind();
     }
     return 0;
 }
@@ -224,13 +168,14 @@ read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
 static int
 read_vpx_decoder_input_chunk(context_t *ctx, NvBuffer * buffer)
 {
-    ifstream *stream = ctx->in_file;
-    int Framesize;
+    NvBitstreamSource *source = ctx->in_file;
+    size_t bytes_read;
+    uint32_t Framesize;
     unsigned char *bitstreambuffer = (unsigned char *)buffer->planes[0].data;
     if (ctx->vp9_file_header_flag == 0)
     {
-        stream->read((char *) buffer->planes[0].data, IVF_FILE_HDR_SIZE);
-        if (stream->gcount() !=  IVF_FILE_HDR_SIZE)
+        bytes_read = source->read(buffer->planes[0].data, IVF_FILE_HDR_SIZE);
+        if (bytes_read != IVF_FILE_HDR_SIZE)
         {
             cerr << "Couldn't read IVF FILE HEADER" << endl;
             return -1;
@@ -244,22 +189,27 @@ read_vpx_decoder_input_chunk(context_t *ctx, NvBuffer * buffer)
         cout << "It's a valid IVF file" << endl;
         ctx->vp9_file_header_flag = 1;
     }
-    stream->read((char *) buffer->planes[0].data, IVF_FRAME_HDR_SIZE);
-    if (!stream->gcount())
+    bytes_read = source->read(buffer->planes[0].data, IVF_FRAME_HDR_SIZE);
+    if (!bytes_read)
     {
         cout << "End of stream" << endl;
         return 0;
     }
-    if (stream->gcount() != IVF_FRAME_HDR_SIZE)
+    if (bytes_read != IVF_FRAME_HDR_SIZE)
     {
         cerr << "Couldn't read IVF FRAME HEADER" << endl;
         return -1;
     }
     Framesize = (bitstreambuffer[3]<<24) + (bitstreambuffer[2]<<16) +
         (bitstreambuffer[1]<<8) + bitstreambuffer[0];
+    if (Framesize > buffer->planes[0].length)
+    {
+        cerr << "Frame of " << Framesize << " bytes does not fit the buffer"
+            << endl;
+        return -1;
+    }
     buffer->planes[0].bytesused = Framesize;
-    stream->read((char *) buffer->planes[0].data, Framesize);
-    if (stream->gcount() != Framesize)
+    if (source->read(buffer->planes[0].data, Framesize) != Framesize)
     {
         cerr << "Couldn't read Framesize" << endl;
         return -1;
@@ -613,8 +563,10 @@ query_and_set_capture(context_t * ctx)
         {
             if(ctx->dmabuff_fd[index] != 0)
             {
-                ret = NvBufferDestroy (ctx->dmabuff_fd[index]);
+                ret = NvBufferPool::getProcessPool()->releaseDmabuf(
+                        ctx->dmabuff_fd[index]);
                 TEST_ERROR(ret < 0, "Failed to Destroy NvBuffer", error);
+                ctx->dmabuff_fd[index] = 0;
             }
         }
     }
@@ -706,7 +658,10 @@ query_and_set_capture(context_t * ctx)
             cParams.layout = NvBufferLayout_BlockLinear;
             cParams.payloadType = NvBufferPayload_SurfArray;
             cParams.nvbuf_tag = NvBufferTag_VIDEO_DEC;
-            ret = NvBufferCreateEx(&ctx->dmabuff_fd[index], &cParams);
+            // Buffers of an earlier setup with the same format come back
+            // from the process pool instead of being created again
+            ret = NvBufferPool::getProcessPool()->acquireDmabuf(&cParams,
+                    &ctx->dmabuff_fd[index]);
             TEST_ERROR(ret < 0, "Failed to create buffers", error);
         }
         ret = dec->capture_plane.reqbufs(V4L2_MEMORY_DMABUF,ctx->numCapBuffers);
@@ -780,6 +735,12 @@ query_and_set_capture(context_t * ctx)
             TEST_ERROR(ret < 0, "Error Qing buffer at converter capture plane",
                        error);
         }
+        if (!nv_thread_policy_is_default(&ctx->dq_policy))
+        {
+            ret = ctx->conv->setDQThreadPolicy(ctx->dq_policy);
+            TEST_ERROR(ret < 0, "Error setting converter DQ thread policy",
+                       error);
+        }
         ctx->conv->output_plane.startDQThread(ctx);
         ctx->conv->capture_plane.startDQThread(ctx);
 
@@ -865,6 +826,9 @@ dec_capture_loop_fcn(void *arg)
     int ret;
 
     cout << "Starting decoder capture loop thread" << endl;
+    if (!nv_thread_policy_is_default(&ctx->dq_policy) &&
+            nv_thread_policy_apply(&ctx->dq_policy) < 0)
+        cerr << "Warning: could not apply DQ thread policy: " << strerror(errno) << endl;
     // Need to wait for the first Resolution change event, so that
     // the decoder knows the stream resolution and can allocate appropriate
     // buffers when we call REQBUFS
@@ -1104,6 +1068,7 @@ set_defaults(context_t ** ctx,fps_stats **stream_stats)
         memset(ctx[i], 0, sizeof(context_t));
         memset(stream_stats[i], 0 , sizeof(stream_stats));
         ctx[i]->thread_num = i;
+        nv_thread_policy_init(&ctx[i]->dq_policy);
         ctx[i]->fullscreen = false;
         ctx[i]->window_height = 0;
         ctx[i]->window_width = 0;
@@ -1125,6 +1090,7 @@ set_defaults(context_t ** ctx,fps_stats **stream_stats)
         ctx[i]->dst_dma_fd = -1;
         ctx[i]->loop_count = 0;
         ctx[i]->blocking_mode = 1;
+        ctx[i]->metrics_interval = 1000;
 #ifndef USE_NVBUF_TRANSFORM_API
         ctx[i]->conv_output_plane_buf_queue = new queue < NvBuffer * >;
         ctx[i]->rescale_method = V4L2_YUV_RESCALE_NONE;
@@ -1135,8 +1101,7 @@ set_defaults(context_t ** ctx,fps_stats **stream_stats)
 }
 
 static bool
-decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_file,
-                    char *nalu_parse_buffer)
+decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_file)
 {
     // In non-blocking mode, we will have this function do below things:
     // Issue signal to PollThread so it starts Poll and wait until we are signalled.
@@ -1248,8 +1213,7 @@ decoder_proc_nonblocking(context_t &ctx, bool eos, uint32_t current_file,
             {
                 if (ctx.input_nalu)
                 {
-                    read_decoder_input_nalu(ctx.in_file, output_buffer, nalu_parse_buffer,
-                            CHUNK_SIZE, &ctx);
+                    read_decoder_input_nalu(ctx.in_file, output_buffer, &ctx);
                 }
                 else
                 {
@@ -1416,8 +1380,7 @@ check_capture_buffers:
 }
 
 static bool
-decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_file,
-                        char *nalu_parse_buffer)
+decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_file)
 {
     // Since all the output plane buffers have been queued, we first need to
     // dequeue a buffer from output plane before we can read new data into it
@@ -1476,8 +1439,7 @@ decoder_proc_blocking(context_t &ctx, bool eos, uint32_t current_file,
         {
             if (ctx.input_nalu)
             {
-                read_decoder_input_nalu(ctx.in_file, buffer, nalu_parse_buffer,
-                        CHUNK_SIZE, &ctx);
+                read_decoder_input_nalu(ctx.in_file, buffer, &ctx);
             }
             else
             {
@@ -1526,7 +1488,6 @@ decode_proc(void * p_ctx)
     uint32_t current_file = 0;
     uint32_t i;
     bool eos = false;
-    char *nalu_parse_buffer = NULL;
     int * perror = (int *)malloc(sizeof(int));
     NvApplicationProfiler &profiler = NvApplicationProfiler::getProfilerInstance();
     NvElementProfiler::NvElementProfilerData data;
@@ -1548,6 +1509,10 @@ decode_proc(void * p_ctx)
         profiler.start(NvApplicationProfiler::DefaultSamplingInterval);
         ctx.dec->enableProfiling();
     }
+    if (ctx.metrics_dest)
+    {
+        profiler.registerElement(ctx.dec, ctx.in_file_path);
+    }
 
     // Subscribe to Resolution change event
     ret = ctx.dec->subscribeEvent(V4L2_EVENT_RESOLUTION_CHANGE, 0, 0);
@@ -1560,7 +1525,6 @@ decode_proc(void * p_ctx)
 
     if (ctx.input_nalu)
     {
-        nalu_parse_buffer = new char[CHUNK_SIZE];
         printf("Setting frame input mode to 0 \n");
         ret = ctx.dec->setFrameInputMode(0);
         TEST_ERROR(ret < 0,
@@ -1606,8 +1570,8 @@ decode_proc(void * p_ctx)
 
     TEST_ERROR(ret < 0, "Error while setting up output plane", cleanup);
 
-    ctx.in_file = new ifstream(ctx.in_file_path);
-    TEST_ERROR(!ctx.in_file->is_open(), "Error opening input file", cleanup);
+    ctx.in_file = NvBitstreamSource::createBitstreamSource(ctx.in_file_path);
+    TEST_ERROR(!ctx.in_file, "Error opening input file", cleanup);
 
     if (ctx.out_file_path)
     {
@@ -1627,11 +1591,17 @@ decode_proc(void * p_ctx)
             setDQThreadCallback(conv0_output_dqbuf_thread_callback);
         ctx.conv->capture_plane.
             setDQThreadCallback(conv0_capture_dqbuf_thread_callback);
+        if (dq_pool)
+            ctx.conv->setDQWorkerPool(dq_pool);
 
         if (ctx.stats)
         {
             ctx.conv->enableProfiling();
         }
+        if (ctx.metrics_dest)
+        {
+            profiler.registerElement(ctx.conv, ctx.in_file_path);
+        }
     }
 #endif
 
@@ -1685,8 +1655,7 @@ decode_proc(void * p_ctx)
         {
             if (ctx.input_nalu)
             {
-                read_decoder_input_nalu(ctx.in_file, buffer, nalu_parse_buffer,
-                        CHUNK_SIZE, &ctx);
+                read_decoder_input_nalu(ctx.in_file, buffer, &ctx);
             }
             else
             {
@@ -1730,9 +1699,9 @@ decode_proc(void * p_ctx)
         i++;
     }
     if (ctx.blocking_mode)
-        eos = decoder_proc_blocking(ctx, eos, current_file, nalu_parse_buffer);
+        eos = decoder_proc_blocking(ctx, eos, current_file);
     else
-        eos = decoder_proc_nonblocking(ctx, eos, current_file, nalu_parse_buffer);
+        eos = decoder_proc_nonblocking(ctx, eos, current_file);
 
     // After sending EOS, all the buffers from output plane should be dequeued.
     // and after that capture plane loop should be signalled to stop.
@@ -1787,7 +1756,9 @@ decode_proc(void * p_ctx)
 
     if (ctx.stats)
     {
-        profiler.stop();
+        // With metrics, main stops the profiler once all instances are done
+        if (!ctx.metrics_dest)
+            profiler.stop();
         ctx.dec->getProfilingData(data);
         stream_stats[ctx.thread_num]->filename = strdup(ctx.in_file_path);
         stream_stats[ctx.thread_num]->data = data;
@@ -1824,7 +1795,8 @@ cleanup:
         {
             if(ctx.dmabuff_fd[index] != 0)
             {
-                ret = NvBufferDestroy (ctx.dmabuff_fd[index]);
+                ret = NvBufferPool::getProcessPool()->releaseDmabuf(
+                        ctx.dmabuff_fd[index]);
                 if(ret < 0)
                 {
                     cerr << "Failed to Destroy NvBuffer" << endl;
@@ -1855,6 +1827,13 @@ cleanup:
     // unmap buffers, tell decoder to deallocate
     // buffer (reqbufs ioctl with counnt = 0),
     // and finally call v4l2_close on the fd.
+    if (ctx.metrics_dest)
+    {
+        profiler.unregisterElement(ctx.dec);
+#ifndef USE_NVBUF_TRANSFORM_API
+        profiler.unregisterElement(ctx.conv);
+#endif
+    }
     delete ctx.dec;
 #ifndef USE_NVBUF_TRANSFORM_API
     delete ctx.conv;
@@ -1872,9 +1851,9 @@ cleanup:
         ctx.dst_dma_fd = -1;
     }
 #endif
-    delete[] nalu_parse_buffer;
     free (ctx.in_file_path);
     free (ctx.out_file_path);
+    free (ctx.metrics_dest);
     if (!ctx.blocking_mode)
     {
         sem_destroy(&ctx.pollthread_sema);
@@ -1903,6 +1882,7 @@ main(int argc, char *argv[])
     int iterator_num = 0; //save decode iterator number
     int stress;
     int stats;
+    bool metrics = false;
     void * error;
 
     num_files = get_num_files(argc, argv);
@@ -1929,6 +1909,34 @@ main(int argc, char *argv[])
 
         stress = ctx[0]->stress_test;
         stats = ctx[0]->stats;
+        if (ctx[0]->dq_workers && !dq_pool)
+        {
+            dq_pool = NvDQWorkerPool::createDQWorkerPool("DQPool",
+                    ctx[0]->dq_workers, &ctx[0]->dq_policy);
+            if (!dq_pool)
+            {
+                fprintf(stderr, "Could not create DQ worker pool\n");
+                return -1;
+            }
+        }
+        if (ctx[0]->metrics_dest && !metrics)
+        {
+            NvApplicationProfiler &profiler =
+                NvApplicationProfiler::getProfilerInstance();
+
+            if (profiler.setMetricsExport(ctx[0]->metrics_dest,
+                    ctx[0]->metrics_prometheus ?
+                    NvApplicationProfiler::METRICS_FORMAT_PROMETHEUS :
+                    NvApplicationProfiler::METRICS_FORMAT_JSON_LINES,
+                    ctx[0]->metrics_interval) < 0)
+            {
+                fprintf(stderr, "Could not export metrics to %s\n",
+                        ctx[0]->metrics_dest);
+                return -1;
+            }
+            profiler.start(NvApplicationProfiler::DefaultSamplingInterval);
+            metrics = true;
+        }
         for (int i = 0 ; i < num_files ; i++)
         {
             pthread_create(&(ctx[i]->decode_thread), NULL, decode_proc, ctx[i]);
@@ -1959,6 +1967,14 @@ main(int argc, char *argv[])
         }
     } while ((stress != iterator_num));
 
+    if (metrics)
+    {
+        // Writes the last snapshot
+        NvApplicationProfiler::getProfilerInstance().stop();
+    }
+    delete dq_pool;
+    // The decoders of all iterations are gone, free what they left idle
+    NvBufferPool::getProcessPool()->trim();
     free (ctx);
     free (stream_stats);
     if (ret)
@@ -0,0 +1,215 @@
+# Software backend only, for hosts without Tegra hardware or the L4T rootfs. nvbuf_utils_sw.cpp
+# stands in for libnvbuf_utils, its NvBuffers are memfds:
+#   make -f Makefile.sw && LD_LIBRARY_PATH=. ./test_zzswcodec
+#   LD_LIBRARY_PATH=. ./test_zzswdmabuf
+#   ./test_zzyuv
+#   LD_LIBRARY_PATH=. ./bench_zznvcodec sw json=-
+#   ./test_nvbufferpool
+#   ./test_nvapplicationprofiler
+#   ./test_nvframetracer
+#   ./test_nvasynclogger
+#   ./test_nvbitstreamsource
+#   ./test_nvdemuxer
+#   ./bench_element_profiler
+#   ./bench_capture_wakeup
+
+CPP := g++
+CLASS_DIR := ../common/classes
+CPPFLAGS += -std=c++11 -O2 -DZZNVCODEC_SW_ONLY -I../../include
+
+ZZNVCODEC_SW_SRCS := \
+	ZzLog.cpp \
+	zznvcodec.cpp \
+	zzswdec.cpp \
+	zzswenc.cpp \
+	zzh264pcm.cpp \
+	zzyuv.cpp \
+	zznvsession.cpp \
+	nvbuf_utils_sw.cpp \
+	$(CLASS_DIR)/NvBufferPool.cpp \
+	$(CLASS_DIR)/NvNalScanner.cpp \
+	$(CLASS_DIR)/NvFrameTracer.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp \
+	$(CLASS_DIR)/NvThreadPolicy.cpp
+ZZNVCODEC_SW_OBJS := $(ZZNVCODEC_SW_SRCS:.cpp=.sw.o)
+ZZNVCODEC_SW_LIB := zznvcodec_sw
+
+TEST_ZZSWCODEC_SRCS := \
+	ZzLog.cpp \
+	test_zzswcodec.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+TEST_ZZSWCODEC_OBJS := $(TEST_ZZSWCODEC_SRCS:.cpp=.sw.o)
+TEST_ZZSWCODEC_APP := test_zzswcodec
+
+TEST_ZZSWDMABUF_SRCS := \
+	ZzLog.cpp \
+	test_zzswdmabuf.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+TEST_ZZSWDMABUF_OBJS := $(TEST_ZZSWDMABUF_SRCS:.cpp=.sw.o)
+TEST_ZZSWDMABUF_APP := test_zzswdmabuf
+
+TEST_ZZYUV_SRCS := \
+	ZzLog.cpp \
+	test_zzyuv.cpp \
+	zzyuv.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+TEST_ZZYUV_OBJS := $(TEST_ZZYUV_SRCS:.cpp=.sw.o)
+TEST_ZZYUV_APP := test_zzyuv
+
+TEST_NVBUFFERPOOL_SRCS := \
+	ZzLog.cpp \
+	test_nvbufferpool.cpp \
+	nvbuf_utils_sw.cpp \
+	$(CLASS_DIR)/NvBufferPool.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp
+TEST_NVBUFFERPOOL_OBJS := $(TEST_NVBUFFERPOOL_SRCS:.cpp=.sw.o)
+TEST_NVBUFFERPOOL_APP := test_nvbufferpool
+
+TEST_NVAPPLICATIONPROFILER_SRCS := \
+	ZzLog.cpp \
+	test_nvapplicationprofiler.cpp \
+	$(CLASS_DIR)/NvApplicationProfiler.cpp \
+	$(CLASS_DIR)/NvElement.cpp \
+	$(CLASS_DIR)/NvElementProfiler.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+TEST_NVAPPLICATIONPROFILER_OBJS := $(TEST_NVAPPLICATIONPROFILER_SRCS:.cpp=.sw.o)
+TEST_NVAPPLICATIONPROFILER_APP := test_nvapplicationprofiler
+
+TEST_NVFRAMETRACER_SRCS := \
+	ZzLog.cpp \
+	test_nvframetracer.cpp \
+	$(CLASS_DIR)/NvFrameTracer.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp
+TEST_NVFRAMETRACER_OBJS := $(TEST_NVFRAMETRACER_SRCS:.cpp=.sw.o)
+TEST_NVFRAMETRACER_APP := test_nvframetracer
+
+TEST_NVASYNCLOGGER_SRCS := \
+	ZzLog.cpp \
+	test_nvasynclogger.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp
+TEST_NVASYNCLOGGER_OBJS := $(TEST_NVASYNCLOGGER_SRCS:.cpp=.sw.o)
+TEST_NVASYNCLOGGER_APP := test_nvasynclogger
+
+TEST_NVBITSTREAMSOURCE_SRCS := \
+	ZzLog.cpp \
+	test_nvbitstreamsource.cpp \
+	$(CLASS_DIR)/NvBitstreamSource.cpp \
+	$(CLASS_DIR)/NvNalScanner.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp
+TEST_NVBITSTREAMSOURCE_OBJS := $(TEST_NVBITSTREAMSOURCE_SRCS:.cpp=.sw.o)
+TEST_NVBITSTREAMSOURCE_APP := test_nvbitstreamsource
+
+TEST_NVDEMUXER_SRCS := \
+	ZzLog.cpp \
+	test_nvdemuxer.cpp \
+	$(CLASS_DIR)/NvDemuxer.cpp \
+	$(CLASS_DIR)/NvMp4Demuxer.cpp \
+	$(CLASS_DIR)/NvMkvDemuxer.cpp \
+	$(CLASS_DIR)/NvTsDemuxer.cpp \
+	$(CLASS_DIR)/NvBitstreamSource.cpp \
+	$(CLASS_DIR)/NvNalScanner.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp \
+	$(CLASS_DIR)/NvLogging.cpp
+TEST_NVDEMUXER_OBJS := $(TEST_NVDEMUXER_SRCS:.cpp=.sw.o)
+TEST_NVDEMUXER_APP := test_nvdemuxer
+
+BENCH_ELEMENT_PROFILER_SRCS := \
+	ZzLog.cpp \
+	bench_element_profiler.cpp \
+	$(CLASS_DIR)/NvElement.cpp \
+	$(CLASS_DIR)/NvElementProfiler.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+BENCH_ELEMENT_PROFILER_OBJS := $(BENCH_ELEMENT_PROFILER_SRCS:.cpp=.sw.o)
+BENCH_ELEMENT_PROFILER_APP := bench_element_profiler
+
+BENCH_CAPTURE_WAKEUP_SRCS := \
+	ZzLog.cpp \
+	bench_capture_wakeup.cpp \
+	zznvdec_poll.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+BENCH_CAPTURE_WAKEUP_OBJS := $(BENCH_CAPTURE_WAKEUP_SRCS:.cpp=.sw.o)
+BENCH_CAPTURE_WAKEUP_APP := bench_capture_wakeup
+
+BENCH_ZZNVCODEC_SRCS := \
+	ZzLog.cpp \
+	bench_zznvcodec.cpp \
+	$(CLASS_DIR)/NvAsyncLogger.cpp
+BENCH_ZZNVCODEC_OBJS := $(BENCH_ZZNVCODEC_SRCS:.cpp=.sw.o)
+BENCH_ZZNVCODEC_APP := bench_zznvcodec
+
+all: $(ZZNVCODEC_SW_LIB) $(TEST_ZZSWCODEC_APP) $(TEST_ZZSWDMABUF_APP) $(TEST_ZZYUV_APP) $(TEST_NVBUFFERPOOL_APP) $(TEST_NVAPPLICATIONPROFILER_APP) $(TEST_NVFRAMETRACER_APP) $(TEST_NVASYNCLOGGER_APP) $(TEST_NVBITSTREAMSOURCE_APP) $(TEST_NVDEMUXER_APP) $(BENCH_ELEMENT_PROFILER_APP) $(BENCH_CAPTURE_WAKEUP_APP) $(BENCH_ZZNVCODEC_APP)
+
+clean:
+	rm -f $(ZZNVCODEC_SW_OBJS) $(TEST_ZZSWCODEC_OBJS) $(TEST_ZZSWCODEC_APP) \
+		$(TEST_ZZSWDMABUF_OBJS) $(TEST_ZZSWDMABUF_APP) \
+		$(TEST_ZZYUV_OBJS) $(TEST_ZZYUV_APP) \
+		$(TEST_NVBUFFERPOOL_OBJS) $(TEST_NVBUFFERPOOL_APP) \
+		$(TEST_NVAPPLICATIONPROFILER_OBJS) $(TEST_NVAPPLICATIONPROFILER_APP) \
+		$(TEST_NVFRAMETRACER_OBJS) $(TEST_NVFRAMETRACER_APP) \
+		$(TEST_NVASYNCLOGGER_OBJS) $(TEST_NVASYNCLOGGER_APP) \
+		$(TEST_NVBITSTREAMSOURCE_OBJS) $(TEST_NVBITSTREAMSOURCE_APP) \
+		$(TEST_NVDEMUXER_OBJS) $(TEST_NVDEMUXER_APP) \
+		$(BENCH_ELEMENT_PROFILER_OBJS) $(BENCH_ELEMENT_PROFILER_APP) \
+		$(BENCH_CAPTURE_WAKEUP_OBJS) $(BENCH_CAPTURE_WAKEUP_APP) \
+		$(BENCH_ZZNVCODEC_OBJS) $(BENCH_ZZNVCODEC_APP) lib$(ZZNVCODEC_SW_LIB).so
+
+%.sw.o: %.cpp
+	@echo "Compiling: $<"
+	$(CPP) $(CPPFLAGS) -fPIC -fvisibility=hidden -fvisibility-inlines-hidden -c $< -o $@
+
+$(ZZNVCODEC_SW_LIB): $(ZZNVCODEC_SW_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -shared -o lib$(ZZNVCODEC_SW_LIB).so $(ZZNVCODEC_SW_OBJS) -Wl,--version-script=zznvcodec.map -lpthread
+
+$(TEST_ZZSWCODEC_APP): $(ZZNVCODEC_SW_LIB) $(TEST_ZZSWCODEC_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_ZZSWCODEC_OBJS) -L. -l$(ZZNVCODEC_SW_LIB) -lpthread
+
+$(TEST_ZZSWDMABUF_APP): $(ZZNVCODEC_SW_LIB) $(TEST_ZZSWDMABUF_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_ZZSWDMABUF_OBJS) -L. -l$(ZZNVCODEC_SW_LIB) -lpthread
+
+$(TEST_ZZYUV_APP): $(TEST_ZZYUV_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_ZZYUV_OBJS) -lpthread
+
+$(TEST_NVBUFFERPOOL_APP): $(TEST_NVBUFFERPOOL_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVBUFFERPOOL_OBJS) -lpthread
+
+$(TEST_NVAPPLICATIONPROFILER_APP): $(TEST_NVAPPLICATIONPROFILER_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVAPPLICATIONPROFILER_OBJS) -lpthread
+
+$(TEST_NVFRAMETRACER_APP): $(TEST_NVFRAMETRACER_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVFRAMETRACER_OBJS) -lpthread
+
+$(TEST_NVASYNCLOGGER_APP): $(TEST_NVASYNCLOGGER_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVASYNCLOGGER_OBJS) -lpthread
+
+$(TEST_NVBITSTREAMSOURCE_APP): $(TEST_NVBITSTREAMSOURCE_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVBITSTREAMSOURCE_OBJS) -lpthread
+
+$(TEST_NVDEMUXER_APP): $(TEST_NVDEMUXER_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(TEST_NVDEMUXER_OBJS) -lpthread
+
+$(BENCH_ELEMENT_PROFILER_APP): $(BENCH_ELEMENT_PROFILER_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(BENCH_ELEMENT_PROFILER_OBJS) -lpthread
+
+$(BENCH_CAPTURE_WAKEUP_APP): $(BENCH_CAPTURE_WAKEUP_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(BENCH_CAPTURE_WAKEUP_OBJS) -lpthread
+
+$(BENCH_ZZNVCODEC_APP): $(ZZNVCODEC_SW_LIB) $(BENCH_ZZNVCODEC_OBJS)
+	@echo "Linking: $@"
+	$(CPP) -o $@ $(BENCH_ZZNVCODEC_OBJS) -L. -l$(ZZNVCODEC_SW_LIB) -lpthread
@@ -1,10 +1,11 @@
 #include "ZzLog.h"
+#include "NvAsyncLogger.h"
 
 #include <stdio.h>
 #include <stdarg.h> 
+#include <string.h>
 
 int QCAP_LOG_LEVEL = 0;
-int64_t QCAP_LOG_START_TIME = -1;
 
 ZzLog::ZzLog(int level, const char* tag) : level(level), tag(tag) {
 }
@@ -12,8 +13,34 @@ ZzLog::ZzLog(int level, const char* tag) : level(level), tag(tag) {
 void ZzLog::operator() (const char* fmt, ...) {
 #if ! ZZLOG_HIDE
 	if(QCAP_LOG_LEVEL > level) return;
-	__ZZ_LOG_TIMESTAMP__();
-	printf("\033%s: ", tag);
-	__ZZ_LOG_POST__();
+
+	// fmt may not be a literal here, format it now
+	char oText[1024];
+	const char* pSuffix = "\n\033[0m";
+	int nMax = sizeof(oText) - strlen(pSuffix) - 1;
+	int nLen = snprintf(oText, nMax, "\033%s: ", tag);
+	va_list marker;
+	va_start(marker, fmt);
+	if(nLen >= 0 && nLen < nMax)
+		nLen += vsnprintf(oText + nLen, nMax - nLen, fmt, marker);
+	va_end(marker);
+	if(nLen < 0)
+		return;
+	if(nLen > nMax - 1)
+		nLen = nMax - 1;
+	strcpy(oText + nLen, pSuffix);
+	nLen += strlen(pSuffix);
+
+	NvAsyncLogger::getLoggerInstance().write(NvAsyncLogger::LOG_STREAM_STDOUT,
+		NvAsyncLogger::LOG_FLAG_ELAPSED_TIME | (level >= 6 ? NvAsyncLogger::LOG_FLAG_URGENT : 0),
+		tag, oText, nLen);
+#endif
+}
+
+#if ! ZZLOG_HIDE
+void zz_log_vprint(int level, const char* prefix, const char* fmt, va_list args) {
+	NvAsyncLogger::getLoggerInstance().vlog(NvAsyncLogger::LOG_STREAM_STDOUT,
+		NvAsyncLogger::LOG_FLAG_ELAPSED_TIME | (level >= 6 ? NvAsyncLogger::LOG_FLAG_URGENT : 0),
+		prefix, "\n\033[0m", fmt, args);
+}
 #endif
-}
\ No newline at end of file
@@ -7,14 +7,13 @@
 #include <time.h>
 
 extern int QCAP_LOG_LEVEL;
-extern int64_t QCAP_LOG_START_TIME;
 
 struct ZzLog {
 	const char* tag;
 	int level;
 
 	ZzLog(int level, const char* tag);
-	void operator() (const char* fmt, ...);
+	void operator() (const char* fmt, ...) __attribute__((format(printf, 2, 3)));
 };
 
 #define ZZ_DECL_LOG_CLASS(TAG) \
@@ -45,6 +44,11 @@ struct ZzLog {
 	ZZ_DECL_LOG_CLASS(TAG); \
 	ZZ_DEFINE_LOG_VAR()
 
+// Messages below ZZLOG_MIN_LEVEL are compiled out, e.g. -DZZLOG_MIN_LEVEL=4 drops LOGV and LOGD
+#ifndef ZZLOG_MIN_LEVEL
+#define ZZLOG_MIN_LEVEL 0
+#endif
+
 #if ZZLOG_HIDE
 
 #define ZZ_LOG_DEFINE(name, level, prefix, tag) \
@@ -52,30 +56,19 @@ struct ZzLog {
 
 #else
 
-#define __ZZ_LOG_TIMESTAMP__() \
-		struct timespec ts = { 0, 0 }; \
-		clock_gettime(CLOCK_MONOTONIC, &ts); \
-		int64_t curTimeMsec = ts.tv_sec*1000LL + ts.tv_nsec/1000000LL; \
-		if (-1 == QCAP_LOG_START_TIME) \
-			QCAP_LOG_START_TIME = curTimeMsec; \
-		int64_t elapsedMsec = curTimeMsec - QCAP_LOG_START_TIME; \
-		printf ("[%d:%02d:%02d:%03d] ", (int)(elapsedMsec/3600000LL), (int)((elapsedMsec/60000LL)%60LL), (int)((elapsedMsec/1000LL)%60LL), (int)(elapsedMsec%1000LL))
-
-#define __ZZ_LOG_POST__() \
-		va_list marker; \
-		va_start(marker, fmt); \
-		vprintf(fmt, marker); \
-		va_end(marker); \
-		printf("\n\033[0m")
+// Formatted and written by the NvAsyncLogger thread, fmt must be a literal
+void zz_log_vprint(int level, const char* prefix, const char* fmt, va_list args);
 
 #define ZZ_LOG_DEFINE(name, level, prefix, tag) \
+	static void __log_print_ ## name (const char* fmt, ...) __attribute__((format(printf, 1, 2))); \
 	static void __log_print_ ## name (const char* fmt, ...) { \
 		if(QCAP_LOG_LEVEL > level) return; \
-		__ZZ_LOG_TIMESTAMP__(); \
-		printf(prefix tag "]: "); \
-		__ZZ_LOG_POST__(); \
+		va_list marker; \
+		va_start(marker, fmt); \
+		zz_log_vprint(level, prefix tag "]: ", fmt, marker); \
+		va_end(marker); \
 	}
-	
+
 #endif
 
 #define ZZ_INIT_LOG(TAG) \
@@ -86,12 +79,14 @@ struct ZzLog {
 	ZZ_LOG_DEFINE(error, 6,		"\033[1;31mERROR[", TAG); \
 	ZZ_LOG_DEFINE(notice, 8,	"\033[1;32m[", TAG);
 
-#define LOGV(...) __log_print_verbose(__VA_ARGS__)
-#define LOGD(...) __log_print_debug(__VA_ARGS__)
-#define LOGI(...) __log_print_info(__VA_ARGS__)
-#define LOGW(...) __log_print_warn(__VA_ARGS__)
-#define LOGE(...) __log_print_error(__VA_ARGS__)
-#define LOGN(...) __log_print_notice(__VA_ARGS__)
+#define __ZZ_LOG__(level, name, ...) do { if((level) >= ZZLOG_MIN_LEVEL) __log_print_ ## name(__VA_ARGS__); } while(0)
+
+#define LOGV(...) __ZZ_LOG__(2, verbose, __VA_ARGS__)
+#define LOGD(...) __ZZ_LOG__(3, debug, __VA_ARGS__)
+#define LOGI(...) __ZZ_LOG__(4, info, __VA_ARGS__)
+#define LOGW(...) __ZZ_LOG__(5, warn, __VA_ARGS__)
+#define LOGE(...) __ZZ_LOG__(6, error, __VA_ARGS__)
+#define LOGN(...) __ZZ_LOG__(8, notice, __VA_ARGS__)
 
 #define TRACE_TAG() LOGI("\033[1;33m**** %s(%d)\033[0m", __FILE__, __LINE__)
 
@@ -0,0 +1,267 @@
+#include "ZzLog.h"
+#include "zznvdec_poll.h"
+#include <algorithm>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("bench_capture_wakeup");
+
+// The mock device is a pipe: the "hardware" thread writes the monotonic time at which a frame
+// became ready, the capture loop reads it back and measures ready-to-callback latency, the
+// same path zznvdec takes between a frame landing on the capture plane and mOnVideoFrame().
+// The poll mode runs zznvdec_poll_loop(), the DecoderMain() loop of zznvdec, on the mock device;
+// only the DQBUF of HandleCapture() is replaced by reads from the pipe.
+
+#define DEFAULT_FRAMES 2000
+#define DEFAULT_INTERVAL_USEC 4000
+
+enum {
+	MODE_USLEEP,	// dqBuffer(..., 0) + usleep(1000) on EAGAIN, the old DecoderMain
+	MODE_POLL,		// zznvdec_poll_loop(), DevicePoll/SetPollInterrupt on the device and an interrupt fd
+	MODE_COUNT
+};
+
+static const char* _mode_name(int nMode) {
+	return nMode == MODE_POLL ? "poll" : "usleep";
+}
+
+static int64_t _now_usec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t _thread_cpu_usec() {
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+struct bench_ctx_t {
+	int nMode;
+	int nFrames;
+	int nIntervalUsec;
+	int nDeviceFD[2];
+	int nInterruptFD[2];
+	volatile int bStop;
+
+	std::vector<int64_t> oLatency;
+	int64_t nCPUUsec;
+	int64_t nStopUsec;
+};
+
+static void* _device_main(void* arg) {
+	bench_ctx_t* pCtx = (bench_ctx_t*)arg;
+	unsigned int seed = 1;
+
+	for(int i = 0;i < pCtx->nFrames;++i) {
+		// +-25% jitter so frames do not line up with the 1ms sleep grid
+		int nJitter = pCtx->nIntervalUsec / 4;
+		usleep(pCtx->nIntervalUsec - nJitter + rand_r(&seed) % (2 * nJitter + 1));
+
+		int64_t nReady = _now_usec();
+		if(write(pCtx->nDeviceFD[1], &nReady, sizeof(nReady)) != sizeof(nReady)) {
+			LOGE("%s(%d): write failed, errno=%d", __FUNCTION__, __LINE__, errno);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+// returns 1 when a frame was dequeued, 0 on EAGAIN, -1 on errors
+static int _dq_frame(bench_ctx_t* pCtx) {
+	int64_t nReady;
+	ssize_t n = read(pCtx->nDeviceFD[0], &nReady, sizeof(nReady));
+
+	if(n == sizeof(nReady)) {
+		// the callback
+		pCtx->oLatency.push_back(_now_usec() - nReady);
+		return 1;
+	}
+
+	if(n < 0 && errno == EAGAIN)
+		return 0;
+
+	return -1;
+}
+
+// NvVideoDecoder as zznvdec_poll_loop() sees it: the interrupt fd stands in for SetPollInterrupt(),
+// which keeps DevicePoll() returning until ClearPollInterrupt()
+struct mock_decoder_t : public zznvdec_poll_ops_t {
+	bench_ctx_t* mCtx;
+
+	explicit mock_decoder_t(bench_ctx_t* pCtx) : mCtx(pCtx) {}
+
+	void ClearPollInterrupt() {
+		char c[64];
+		while(read(mCtx->nInterruptFD[0], c, sizeof(c)) > 0) {
+		}
+	}
+
+	int DevicePoll(uint16_t nReqEvents, uint16_t* pRespEvents) {
+		struct pollfd fds[2];
+
+		fds[0].fd = mCtx->nDeviceFD[0];
+		fds[0].events = nReqEvents & POLLIN;
+		fds[1].fd = mCtx->nInterruptFD[0];
+		fds[1].events = POLLIN;
+		*pRespEvents = 0;
+		if(poll(fds, 2, -1) < 0)
+			return errno == EINTR ? 0 : -1;
+
+		*pRespEvents = fds[0].revents & (nReqEvents | POLLERR);
+		return 0;
+	}
+
+	bool IsInError() {
+		return false;
+	}
+
+	bool IsCaptureSetUp() {
+		return true;
+	}
+
+	bool IsOutputPlaneWanted() {
+		return false;
+	}
+
+	void HandleEvents() {
+	}
+
+	void SignalOutputPlane() {
+	}
+
+	// DQBUF until EAGAIN, as zznvdec_t::HandleCapture() with dqBuffers()
+	int HandleCapture() {
+		int ret;
+
+		while((ret = _dq_frame(mCtx)) > 0) {
+		}
+
+		return ret < 0 ? -1 : 0;
+	}
+};
+
+static void* _capture_main(void* arg) {
+	bench_ctx_t* pCtx = (bench_ctx_t*)arg;
+	int64_t nCPUStart = _thread_cpu_usec();
+
+	if(pCtx->nMode == MODE_USLEEP) {
+		while(! pCtx->bStop) {
+			int ret = _dq_frame(pCtx);
+			if(ret == 0) {
+				usleep(1000);
+				continue;
+			}
+			if(ret < 0)
+				break;
+		}
+	} else {
+		mock_decoder_t oDecoder(pCtx);
+		int nGotError = 0;
+
+		zznvdec_poll_loop(&oDecoder, &pCtx->bStop, &nGotError);
+		if(nGotError) {
+			LOGE("%s(%d): zznvdec_poll_loop() failed", __FUNCTION__, __LINE__);
+		}
+	}
+
+	pCtx->nCPUUsec = _thread_cpu_usec() - nCPUStart;
+
+	return NULL;
+}
+
+static int64_t _percentile(const std::vector<int64_t>& oSorted, double fPercent) {
+	if(oSorted.empty())
+		return 0;
+
+	size_t nIndex = (size_t)(fPercent / 100.0 * (oSorted.size() - 1) + 0.5);
+	return oSorted[nIndex];
+}
+
+static int _run(int nMode, int nFrames, int nIntervalUsec) {
+	bench_ctx_t oCtx;
+	pthread_t oDevice, oCapture;
+
+	oCtx.nMode = nMode;
+	oCtx.nFrames = nFrames;
+	oCtx.nIntervalUsec = nIntervalUsec;
+	oCtx.bStop = 0;
+	oCtx.nCPUUsec = 0;
+	oCtx.nStopUsec = 0;
+	oCtx.oLatency.reserve(nFrames);
+
+	if(pipe2(oCtx.nDeviceFD, O_NONBLOCK) != 0 || pipe2(oCtx.nInterruptFD, O_NONBLOCK) != 0) {
+		LOGE("%s(%d): pipe2 failed, errno=%d", __FUNCTION__, __LINE__, errno);
+		return -1;
+	}
+
+	pthread_create(&oCapture, NULL, _capture_main, &oCtx);
+	pthread_create(&oDevice, NULL, _device_main, &oCtx);
+	pthread_join(oDevice, NULL);
+
+	// let the last frame drain, then measure how long stop takes to be noticed
+	usleep(nIntervalUsec);
+	int64_t nStop = _now_usec();
+	oCtx.bStop = 1;
+	if(nMode == MODE_POLL) {
+		char c = 0;
+		if(write(oCtx.nInterruptFD[1], &c, 1) != 1) {
+			LOGE("%s(%d): write failed, errno=%d", __FUNCTION__, __LINE__, errno);
+		}
+	}
+	pthread_join(oCapture, NULL);
+	oCtx.nStopUsec = _now_usec() - nStop;
+
+	close(oCtx.nDeviceFD[0]);
+	close(oCtx.nDeviceFD[1]);
+	close(oCtx.nInterruptFD[0]);
+	close(oCtx.nInterruptFD[1]);
+
+	std::vector<int64_t>& oLatency = oCtx.oLatency;
+	std::sort(oLatency.begin(), oLatency.end());
+
+	LOGI("%-6s: %d/%d frames, latency p50=%lldus p99=%lldus max=%lldus, stop=%lldus, cpu=%.2fus/frame",
+		_mode_name(nMode), (int)oLatency.size(), nFrames,
+		(long long)_percentile(oLatency, 50), (long long)_percentile(oLatency, 99),
+		(long long)(oLatency.empty() ? 0 : oLatency.back()), (long long)oCtx.nStopUsec,
+		oLatency.empty() ? 0.0 : (double)oCtx.nCPUUsec / oLatency.size());
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nFrames = DEFAULT_FRAMES;
+	int nIntervalUsec = DEFAULT_INTERVAL_USEC;
+
+	if(argc > 1) {
+		nFrames = atoi(argv[1]);
+	}
+	if(argc > 2) {
+		nIntervalUsec = atoi(argv[2]);
+	}
+	if(nFrames <= 0 || nIntervalUsec < 4) {
+		LOGE("usage: %s [frames] [frame interval in usec]", argv[0]);
+		return 1;
+	}
+
+	LOGI("%d frames, %dus frame interval", nFrames, nIntervalUsec);
+
+	for(int nMode = 0;nMode < MODE_COUNT;++nMode) {
+		if(_run(nMode, nFrames, nIntervalUsec) != 0)
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include "NvElement.h"
+#include "ZzLog.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+ZZ_INIT_LOG("bench_element_profiler");
+
+#define DEFAULT_UNITS 2000000
+#define MAX_THREADS 16
+#define IN_FLIGHT 8	// like the buffers queued on a V4L2 plane
+
+static int64_t _now_usec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// the profiler belongs to its element, the bench is an element doing nothing else
+class BenchElement : public NvElement {
+public:
+	BenchElement() : NvElement("bench", NvElementProfiler::PROFILER_FIELD_ALL) {
+		profiler.enableProfiling(true);
+	}
+
+	NvElementProfiler& Profiler() {
+		return profiler;
+	}
+};
+
+struct bench_thread_t {
+	BenchElement* pElement;
+	int nUnits;
+	bool bFifo;
+};
+
+// keeps IN_FLIGHT units started, finishes the oldest one before starting the next
+static void* _bench_proc(void* pArg) {
+	bench_thread_t* pThread = (bench_thread_t*)pArg;
+	NvElementProfiler& oProfiler = pThread->pElement->Profiler();
+	uint64_t oIDs[IN_FLIGHT];
+
+	for(int i = 0;i < IN_FLIGHT;++i)
+		oIDs[i] = oProfiler.startProcessing();
+	for(int i = 0;i < pThread->nUnits;++i) {
+		oProfiler.finishProcessing(pThread->bFifo ? 0 : oIDs[i % IN_FLIGHT], false);
+		oIDs[i % IN_FLIGHT] = oProfiler.startProcessing();
+	}
+	for(int i = 0;i < IN_FLIGHT;++i)
+		oProfiler.finishProcessing(pThread->bFifo ? 0 : oIDs[i], false);
+
+	return NULL;
+}
+
+static void _bench(int nThreads, int nUnits, bool bFifo) {
+	BenchElement oElement;
+	pthread_t oThreads[MAX_THREADS];
+	bench_thread_t oContexts[MAX_THREADS];
+
+	int64_t nStart = _now_usec();
+	for(int i = 0;i < nThreads;++i) {
+		oContexts[i].pElement = &oElement;
+		oContexts[i].nUnits = nUnits / nThreads;
+		oContexts[i].bFifo = bFifo;
+		pthread_create(&oThreads[i], NULL, _bench_proc, &oContexts[i]);
+	}
+	for(int i = 0;i < nThreads;++i)
+		pthread_join(oThreads[i], NULL);
+	int64_t nElapsed = _now_usec() - nStart;
+
+	NvElementProfiler::NvElementProfilerData oData;
+	oElement.getProfilingData(oData);
+
+	uint64_t nExpected = (uint64_t)(nUnits / nThreads + IN_FLIGHT) * nThreads;
+	LOGI("%2d thread(s), %s: %6.1f ns/unit, %5.2f M units/s, latency avg %llu p50 %llu p99 %llu max %llu usec%s",
+		nThreads, bFifo ? "fifo" : "id  ", nElapsed * 1000.0 / nExpected, nExpected / (double)nElapsed,
+		(unsigned long long)oData.average_latency_usec, (unsigned long long)oData.p50_latency_usec,
+		(unsigned long long)oData.p99_latency_usec, (unsigned long long)oData.max_latency_usec,
+		oData.total_processed_units != nExpected ? " MISMATCH" : "");
+}
+
+int main(int argc, char *argv[])
+{
+	int nUnits = DEFAULT_UNITS;
+	int nMaxThreads = 4;
+
+	if(argc > 1)
+		nUnits = atoi(argv[1]);
+	if(argc > 2)
+		nMaxThreads = atoi(argv[2]);
+	if(nMaxThreads < 1 || nMaxThreads > MAX_THREADS) {
+		LOGE("%s(%d): 1 to %d threads", __FUNCTION__, __LINE__, MAX_THREADS);
+		return 1;
+	}
+
+	LOGI("%d units, %d units in flight per thread", nUnits, IN_FLIGHT);
+	for(int nThreads = 1;nThreads <= nMaxThreads;nThreads *= 2) {
+		_bench(nThreads, nUnits, false);
+		_bench(nThreads, nUnits, true);
+	}
+
+	return 0;
+}
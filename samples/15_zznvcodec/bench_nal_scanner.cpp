@@ -0,0 +1,118 @@
+#include "NvNalScanner.h"
+#include "ZzLog.h"
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+ZZ_INIT_LOG("bench_nal_scanner");
+
+#define DEFAULT_STREAM_SIZE (64 * 1024 * 1024)
+#define MAX_NAL_UNITS_PER_SCAN 256
+
+static int64_t _now_usec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Annex-B H.264 look-alike: SPS/PPS/SEI in front of every IDR, one big slice per frame,
+// emulation prevention keeps the payload free of start codes.
+static void _make_stream(std::vector<uint8_t>& oStream, size_t nSize) {
+	static const uint8_t nal_types[] = { 7, 8, 6, 5, 1, 1, 1, 1, 1, 1, 1, 1 };
+	unsigned int seed = 1;
+	int nFrame = 0;
+
+	oStream.clear();
+	oStream.reserve(nSize + 1024 * 1024);
+	while(oStream.size() < nSize) {
+		uint8_t nal_type = nal_types[nFrame++ % sizeof(nal_types)];
+		size_t nPayload = (nal_type == 5 || nal_type == 1) ? 64 * 1024 + rand_r(&seed) % (256 * 1024) : 8 + rand_r(&seed) % 32;
+
+		if(rand_r(&seed) & 1)
+			oStream.push_back(0);
+		oStream.push_back(0);
+		oStream.push_back(0);
+		oStream.push_back(1);
+		oStream.push_back(0x60 | nal_type);
+
+		int nZeros = 0;
+		for(size_t i = 0;i < nPayload;++i) {
+			uint8_t b = (rand_r(&seed) % 8) ? (uint8_t)rand_r(&seed) : 0;
+			if(nZeros >= 2 && b <= 3) {
+				oStream.push_back(3);
+				nZeros = 0;
+			}
+			oStream.push_back(b);
+			nZeros = (b == 0) ? nZeros + 1 : 0;
+		}
+		oStream.push_back(0x80);
+	}
+}
+
+static int _scan_all(const uint8_t* pBuffer, size_t nSize) {
+	NvNalUnit oUnits[MAX_NAL_UNITS_PER_SCAN];
+	int nTotal = 0;
+
+	while(nSize > 0) {
+		int nUnits = nv_nal_scan_units(pBuffer, nSize, NV_NAL_CODEC_H264, oUnits, MAX_NAL_UNITS_PER_SCAN);
+		if(nUnits == 0)
+			break;
+
+		nTotal += nUnits;
+		size_t nConsumed = oUnits[nUnits - 1].offset + oUnits[nUnits - 1].size;
+		pBuffer += nConsumed;
+		nSize -= nConsumed;
+	}
+
+	return nTotal;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<uint8_t> oStream;
+	int nIterations = 10;
+
+	if(argc > 1) {
+		std::ifstream oFile(argv[1], std::ios::binary);
+		if(! oFile) {
+			LOGE("%s(%d): can not open %s", __FUNCTION__, __LINE__, argv[1]);
+			return 1;
+		}
+		oStream.assign(std::istreambuf_iterator<char>(oFile), std::istreambuf_iterator<char>());
+	} else {
+		_make_stream(oStream, DEFAULT_STREAM_SIZE);
+	}
+	if(argc > 2) {
+		nIterations = atoi(argv[2]);
+	}
+
+	LOGI("stream: %.2f MB, %d iterations, default isa: %s", oStream.size() / 1048576.0, nIterations,
+		nv_nal_scanner_isa_name(nv_nal_scanner_get_isa()));
+
+	int nReference = -1;
+	for(int isa = 0;isa < NV_NAL_SCANNER_ISA_COUNT;++isa) {
+		if(nv_nal_scanner_set_isa((NvNalScannerIsa)isa) != 0) {
+			LOGI("%-8s: not supported", nv_nal_scanner_isa_name((NvNalScannerIsa)isa));
+			continue;
+		}
+
+		int nUnits = _scan_all(&oStream[0], oStream.size()); // warm up
+		int64_t nStart = _now_usec();
+		for(int i = 0;i < nIterations;++i) {
+			_scan_all(&oStream[0], oStream.size());
+		}
+		int64_t nElapsed = _now_usec() - nStart;
+		double fMBps = (double)oStream.size() * nIterations / 1048576.0 / (nElapsed / 1000000.0);
+
+		LOGI("%-8s: %8.1f MB/s, %d NAL units%s", nv_nal_scanner_isa_name((NvNalScannerIsa)isa), fMBps, nUnits,
+			(nReference != -1 && nReference != nUnits) ? " MISMATCH" : "");
+		if(nReference == -1)
+			nReference = nUnits;
+	}
+
+	return 0;
+}
@@ -0,0 +1,424 @@
+#include "zznvcodec.h"
+#include "ZzLog.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("bench_zznvcodec");
+
+// Encodes synthetic I420 frames, then decodes the packets the encoder produced, both with the
+// backend given on the command line. Every run creates, starts, stops and deletes a fresh instance
+// so start/stop time and RSS growth across runs show up next to throughput and latency.
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_RUNS 5
+#define SOURCE_FRAMES 8
+#define FRAME_INTERVAL_USEC 16667
+#define DRAIN_TIMEOUT_USEC 2000000
+
+static int64_t _now_usec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// user + system time of all threads, the codec threads included
+static int64_t _process_cpu_usec() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int64_t _rss_kb() {
+	long nPages = 0;
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if(fp) {
+		if(fscanf(fp, "%*d %ld", &nPages) != 1)
+			nPages = 0;
+		fclose(fp);
+	}
+	return (int64_t)nPages * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static int64_t _percentile(const std::vector<int64_t>& oSorted, double fPercent) {
+	if(oSorted.empty())
+		return 0;
+
+	size_t nIndex = (size_t)(fPercent / 100.0 * (oSorted.size() - 1) + 0.5);
+	return oSorted[nIndex];
+}
+
+struct bench_result_t {
+	std::vector<int64_t> oLatency;	// submit to callback, usec
+	std::vector<int64_t> oStart;	// zznvcodec_*_start(), usec
+	std::vector<int64_t> oStop;
+	int64_t nFrames;				// frames out of the codec
+	int64_t nStreamUsec;			// first submit to last callback, summed over runs
+	int64_t nCPUUsec;
+	int64_t nRSSFirstRun;			// KB after the first and the last run, the difference is what the runs leak
+	int64_t nRSSLastRun;
+
+	bench_result_t() : nFrames(0), nStreamUsec(0), nCPUUsec(0), nRSSFirstRun(0), nRSSLastRun(0) {
+	}
+
+	double FPS() const {
+		return nStreamUsec ? nFrames * 1000000.0 / nStreamUsec : 0.0;
+	}
+
+	double CPUPerFrame() const {
+		return nFrames ? (double)nCPUUsec / nFrames : 0.0;
+	}
+
+	void Sort() {
+		std::sort(oLatency.begin(), oLatency.end());
+		std::sort(oStart.begin(), oStart.end());
+		std::sort(oStop.begin(), oStop.end());
+	}
+
+	void Log(const char* pName) const {
+		LOGI("%s: %.1f fps, latency p50=%lldus p99=%lldus p99.9=%lldus max=%lldus, start p50=%lldus max=%lldus, stop p50=%lldus max=%lldus, cpu=%.1fus/frame, rss +%lldKB",
+			pName, FPS(),
+			(long long)_percentile(oLatency, 50), (long long)_percentile(oLatency, 99), (long long)_percentile(oLatency, 99.9),
+			(long long)(oLatency.empty() ? 0 : oLatency.back()),
+			(long long)_percentile(oStart, 50), (long long)(oStart.empty() ? 0 : oStart.back()),
+			(long long)_percentile(oStop, 50), (long long)(oStop.empty() ? 0 : oStop.back()),
+			CPUPerFrame(), (long long)(nRSSLastRun - nRSSFirstRun));
+	}
+
+	void WriteJSON(FILE* fp, const char* pName) const {
+		fprintf(fp, "\"%s\":{\"frames\":%lld,\"fps\":%.2f,"
+			"\"latency_us\":{\"p50\":%lld,\"p99\":%lld,\"p99_9\":%lld,\"max\":%lld},"
+			"\"start_us\":{\"p50\":%lld,\"max\":%lld},\"stop_us\":{\"p50\":%lld,\"max\":%lld},"
+			"\"cpu_us_per_frame\":%.2f,\"rss_growth_kb\":%lld}",
+			pName, (long long)nFrames, FPS(),
+			(long long)_percentile(oLatency, 50), (long long)_percentile(oLatency, 99), (long long)_percentile(oLatency, 99.9),
+			(long long)(oLatency.empty() ? 0 : oLatency.back()),
+			(long long)_percentile(oStart, 50), (long long)(oStart.empty() ? 0 : oStart.back()),
+			(long long)_percentile(oStop, 50), (long long)(oStop.empty() ? 0 : oStop.back()),
+			CPUPerFrame(), (long long)(nRSSLastRun - nRSSFirstRun));
+	}
+};
+
+struct bench_ctx_t {
+	int nBackend;
+	int nWidth;
+	int nHeight;
+	int nFrames;
+	int nRuns;
+
+	// per run, indexed by frame number
+	std::vector<int64_t> oSubmitTime;
+	std::vector<int64_t> oDoneTime;
+	pthread_mutex_t mLock;
+	pthread_cond_t mCond;
+	int nDone;
+	int64_t nLastDone;
+
+	// first run's packets, the input of the decoder runs
+	bool bCollect;
+	std::vector<std::vector<uint8_t> > oPackets;
+	std::vector<int64_t> oPacketTimestamps;
+};
+
+static int _frame_index(bench_ctx_t* pCtx, int64_t nTimestamp) {
+	int nIndex = (int)((nTimestamp + FRAME_INTERVAL_USEC / 2) / FRAME_INTERVAL_USEC);
+	return (nIndex >= 0 && nIndex < pCtx->nFrames) ? nIndex : -1;
+}
+
+static void _on_done(bench_ctx_t* pCtx, int64_t nTimestamp) {
+	int64_t nNow = _now_usec();
+	int nIndex = _frame_index(pCtx, nTimestamp);
+
+	pthread_mutex_lock(&pCtx->mLock);
+	if(nIndex != -1 && pCtx->oDoneTime[nIndex] == 0) {
+		pCtx->oDoneTime[nIndex] = nNow;
+		pCtx->nDone++;
+		pCtx->nLastDone = nNow;
+		pthread_cond_broadcast(&pCtx->mCond);
+	}
+	pthread_mutex_unlock(&pCtx->mLock);
+}
+
+static void _on_video_packet(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp, intptr_t pUser) {
+	bench_ctx_t* pCtx = (bench_ctx_t*)pUser;
+
+	if(pCtx->bCollect) {
+		pCtx->oPackets.push_back(std::vector<uint8_t>(pBuffer, pBuffer + nSize));
+		pCtx->oPacketTimestamps.push_back(nTimestamp);
+	}
+	_on_done(pCtx, nTimestamp);
+}
+
+static void _on_video_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	_on_done((bench_ctx_t*)pUser, nTimestamp);
+}
+
+static void _reset_run(bench_ctx_t* pCtx) {
+	pCtx->oSubmitTime.assign(pCtx->nFrames, 0);
+	pCtx->oDoneTime.assign(pCtx->nFrames, 0);
+	pCtx->nDone = 0;
+	pCtx->nLastDone = 0;
+}
+
+// wait for the frames still in the codec, a decoder may keep the last ones until more input comes
+static void _drain_run(bench_ctx_t* pCtx, int nExpected) {
+	struct timespec oDeadline;
+	clock_gettime(CLOCK_REALTIME, &oDeadline);
+	oDeadline.tv_sec += DRAIN_TIMEOUT_USEC / 1000000;
+
+	pthread_mutex_lock(&pCtx->mLock);
+	while(pCtx->nDone < nExpected) {
+		if(pthread_cond_timedwait(&pCtx->mCond, &pCtx->mLock, &oDeadline) != 0)
+			break;
+	}
+	pthread_mutex_unlock(&pCtx->mLock);
+}
+
+static void _collect_run(bench_ctx_t* pCtx, bench_result_t* pResult, int64_t nFirstSubmit, int64_t nCPUUsec) {
+	pthread_mutex_lock(&pCtx->mLock);
+	for(int i = 0;i < pCtx->nFrames;++i) {
+		if(pCtx->oSubmitTime[i] && pCtx->oDoneTime[i])
+			pResult->oLatency.push_back(pCtx->oDoneTime[i] - pCtx->oSubmitTime[i]);
+	}
+	pResult->nFrames += pCtx->nDone;
+	if(pCtx->nDone)
+		pResult->nStreamUsec += pCtx->nLastDone - nFirstSubmit;
+	pResult->nCPUUsec += nCPUUsec;
+	pthread_mutex_unlock(&pCtx->mLock);
+
+	pResult->nRSSLastRun = _rss_kb();
+	if(pResult->nRSSFirstRun == 0)
+		pResult->nRSSFirstRun = pResult->nRSSLastRun;
+}
+
+static int _bench_encoder(bench_ctx_t* pCtx, bench_result_t* pResult) {
+	int nWidth = pCtx->nWidth;
+	int nHeight = pCtx->nHeight;
+
+	// a few distinct frames, generated up front so the pattern does not count as encoder CPU
+	std::vector<uint8_t> oSource[SOURCE_FRAMES];
+	zznvcodec_video_frame_t oFrames[SOURCE_FRAMES];
+	for(int f = 0;f < SOURCE_FRAMES;++f) {
+		oSource[f].resize(nWidth * nHeight * 3 / 2);
+		uint8_t* p = &oSource[f][0];
+		for(int y = 0;y < nHeight;++y)
+			for(int x = 0;x < nWidth;++x)
+				*p++ = (uint8_t)(x + y * 2 + f * 9);
+		for(int i = 0;i < nWidth * nHeight / 2;++i)
+			*p++ = (uint8_t)(128 + (i % nWidth) / 8 + f);
+
+		memset(&oFrames[f], 0, sizeof(oFrames[f]));
+		oFrames[f].num_planes = 3;
+		for(int i = 0;i < 3;++i) {
+			zznvcodec_video_plane_t& plane = oFrames[f].planes[i];
+			plane.width = i ? nWidth / 2 : nWidth;
+			plane.height = i ? nHeight / 2 : nHeight;
+			plane.stride = plane.width;
+		}
+		oFrames[f].planes[0].ptr = &oSource[f][0];
+		oFrames[f].planes[1].ptr = &oSource[f][nWidth * nHeight];
+		oFrames[f].planes[2].ptr = &oSource[f][nWidth * nHeight * 5 / 4];
+	}
+
+	for(int nRun = 0;nRun < pCtx->nRuns;++nRun) {
+		int nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
+		int nBitRate = 8 * 1000000;
+		zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new_with_backend(pCtx->nBackend);
+		if(! pEnc) {
+			LOGE("%s(%d): backend %d is not available", __FUNCTION__, __LINE__, pCtx->nBackend);
+			return -1;
+		}
+
+		zznvcodec_encoder_set_video_property(pEnc, nWidth, nHeight, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+		zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_ENCODER_PIX_FMT, (intptr_t)&nEncoderPixFmt);
+		zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_BITRATE, (intptr_t)&nBitRate);
+		zznvcodec_encoder_register_callbacks(pEnc, _on_video_packet, (intptr_t)pCtx);
+
+		_reset_run(pCtx);
+		pCtx->bCollect = (nRun == 0);
+
+		int64_t nStart = _now_usec();
+		zznvcodec_encoder_start(pEnc);
+		pResult->oStart.push_back(_now_usec() - nStart);
+
+		int64_t nCPUStart = _process_cpu_usec();
+		int64_t nFirstSubmit = _now_usec();
+		for(int i = 0;i < pCtx->nFrames;++i) {
+			pCtx->oSubmitTime[i] = _now_usec();
+			if(zznvcodec_encoder_set_video_uncompression_buffer(pEnc, &oFrames[i % SOURCE_FRAMES], i * (int64_t)FRAME_INTERVAL_USEC) != ZZNVCODEC_RESULT_OK) {
+				LOGE("%s(%d): submitting frame %d failed", __FUNCTION__, __LINE__, i);
+				pCtx->oSubmitTime[i] = 0;
+				break;
+			}
+		}
+		_drain_run(pCtx, pCtx->nFrames);
+		int64_t nCPUUsec = _process_cpu_usec() - nCPUStart;
+
+		int64_t nStop = _now_usec();
+		zznvcodec_encoder_stop(pEnc);
+		pResult->oStop.push_back(_now_usec() - nStop);
+		pCtx->bCollect = false;
+
+		zznvcodec_encoder_delete(pEnc);
+
+		_collect_run(pCtx, pResult, nFirstSubmit, nCPUUsec);
+		LOGD("encoder run %d: %d/%d packets", nRun, pCtx->nDone, pCtx->nFrames);
+	}
+
+	return 0;
+}
+
+static int _bench_decoder(bench_ctx_t* pCtx, bench_result_t* pResult) {
+	if(pCtx->oPackets.empty()) {
+		LOGE("%s(%d): no packets to decode", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	for(int nRun = 0;nRun < pCtx->nRuns;++nRun) {
+		int nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
+		zznvcodec_decoder_t* pDec = zznvcodec_decoder_new_with_backend(pCtx->nBackend);
+		if(! pDec) {
+			LOGE("%s(%d): backend %d is not available", __FUNCTION__, __LINE__, pCtx->nBackend);
+			return -1;
+		}
+
+		zznvcodec_decoder_set_video_property(pDec, pCtx->nWidth, pCtx->nHeight, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+		zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_ENCODER_PIX_FMT, (intptr_t)&nEncoderPixFmt);
+		zznvcodec_decoder_register_callbacks(pDec, _on_video_frame, (intptr_t)pCtx);
+
+		_reset_run(pCtx);
+
+		int64_t nStart = _now_usec();
+		zznvcodec_decoder_start(pDec);
+		pResult->oStart.push_back(_now_usec() - nStart);
+
+		int64_t nCPUStart = _process_cpu_usec();
+		int64_t nFirstSubmit = _now_usec();
+		for(size_t i = 0;i < pCtx->oPackets.size();++i) {
+			int64_t nTimestamp = pCtx->oPacketTimestamps[i];
+			int nIndex = _frame_index(pCtx, nTimestamp);
+			if(nIndex != -1 && pCtx->oSubmitTime[nIndex] == 0)
+				pCtx->oSubmitTime[nIndex] = _now_usec();
+
+			std::vector<uint8_t>& oPacket = pCtx->oPackets[i];
+			if(zznvcodec_decoder_set_video_compression_buffer(pDec, &oPacket[0], (int)oPacket.size(), 0, nTimestamp) != ZZNVCODEC_RESULT_OK) {
+				LOGE("%s(%d): submitting packet %d failed", __FUNCTION__, __LINE__, (int)i);
+				break;
+			}
+		}
+		_drain_run(pCtx, (int)pCtx->oPackets.size());
+		int64_t nCPUUsec = _process_cpu_usec() - nCPUStart;
+
+		int64_t nStop = _now_usec();
+		zznvcodec_decoder_stop(pDec);
+		pResult->oStop.push_back(_now_usec() - nStop);
+
+		zznvcodec_decoder_delete(pDec);
+
+		_collect_run(pCtx, pResult, nFirstSubmit, nCPUUsec);
+		LOGD("decoder run %d: %d/%d frames", nRun, pCtx->nDone, (int)pCtx->oPackets.size());
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	// bench_zznvcodec [nv|sw] [frames=N] [runs=N] [size=WxH] [json=<file>|-] [trace=<file>]
+	bench_ctx_t oCtx;
+	const char* pBackendName = "default";
+	std::string oJSON;
+	std::string oTrace;
+
+	oCtx.nBackend = ZZNVCODEC_BACKEND_DEFAULT;
+	oCtx.nWidth = 1920;
+	oCtx.nHeight = 1080;
+	oCtx.nFrames = DEFAULT_FRAMES;
+	oCtx.nRuns = DEFAULT_RUNS;
+	oCtx.bCollect = false;
+	pthread_mutex_init(&oCtx.mLock, NULL);
+	pthread_cond_init(&oCtx.mCond, NULL);
+
+	for(int i = 1;i < argc;++i) {
+		if(strcmp(argv[i], "nv") == 0) {
+			oCtx.nBackend = ZZNVCODEC_BACKEND_NV;
+			pBackendName = argv[i];
+		} else if(strcmp(argv[i], "sw") == 0) {
+			oCtx.nBackend = ZZNVCODEC_BACKEND_SW;
+			pBackendName = argv[i];
+		} else if(strncmp(argv[i], "frames=", 7) == 0) {
+			oCtx.nFrames = atoi(argv[i] + 7);
+		} else if(strncmp(argv[i], "runs=", 5) == 0) {
+			oCtx.nRuns = atoi(argv[i] + 5);
+		} else if(strncmp(argv[i], "size=", 5) == 0) {
+			if(sscanf(argv[i] + 5, "%dx%d", &oCtx.nWidth, &oCtx.nHeight) != 2)
+				oCtx.nWidth = 0;
+		} else if(strncmp(argv[i], "json=", 5) == 0) {
+			oJSON = argv[i] + 5;
+		} else if(strncmp(argv[i], "trace=", 6) == 0) {
+			oTrace = argv[i] + 6;
+		} else {
+			LOGW("unknown option %s", argv[i]);
+		}
+	}
+	if(oCtx.nFrames <= 0 || oCtx.nRuns <= 0 || oCtx.nWidth <= 0 || oCtx.nHeight <= 0 || (oCtx.nWidth & 1) || (oCtx.nHeight & 1)) {
+		LOGE("usage: %s [nv|sw] [frames=N] [runs=N] [size=WxH] [json=<file>|-] [trace=<file>]", argv[0]);
+		return 1;
+	}
+
+	LOGI("backend %s, %dx%d, %d frames x %d runs", pBackendName, oCtx.nWidth, oCtx.nHeight, oCtx.nFrames, oCtx.nRuns);
+
+	// the stages of the frames of the last run, mostly
+	if(! oTrace.empty())
+		zznvcodec_trace_enable(65536);
+
+	bench_result_t oEncode, oDecode;
+	int64_t nRSSStart = _rss_kb();
+	if(_bench_encoder(&oCtx, &oEncode) != 0)
+		return 1;
+	int64_t nRSSEncode = _rss_kb();
+	if(_bench_decoder(&oCtx, &oDecode) != 0)
+		return 1;
+	int64_t nRSSEnd = _rss_kb();
+
+	oEncode.Sort();
+	oDecode.Sort();
+	oEncode.Log("encode");
+	oDecode.Log("decode");
+	LOGI("rss: %lldKB at start, %lldKB after encoding, %lldKB at the end",
+		(long long)nRSSStart, (long long)nRSSEncode, (long long)nRSSEnd);
+
+	if(! oJSON.empty()) {
+		FILE* fp = (oJSON == "-") ? stdout : fopen(oJSON.c_str(), "w");
+		if(! fp) {
+			LOGE("%s(%d): can not open %s", __FUNCTION__, __LINE__, oJSON.c_str());
+			return 1;
+		}
+
+		fprintf(fp, "{\"backend\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,\"runs\":%d,",
+			pBackendName, oCtx.nWidth, oCtx.nHeight, oCtx.nFrames, oCtx.nRuns);
+		oEncode.WriteJSON(fp, "encode");
+		fprintf(fp, ",");
+		oDecode.WriteJSON(fp, "decode");
+		fprintf(fp, ",\"rss_kb\":{\"start\":%lld,\"after_encode\":%lld,\"end\":%lld,\"growth\":%lld}}\n",
+			(long long)nRSSStart, (long long)nRSSEncode, (long long)nRSSEnd, (long long)(nRSSEnd - nRSSStart));
+
+		if(fp != stdout)
+			fclose(fp);
+	}
+
+	if(! oTrace.empty() && zznvcodec_trace_dump(oTrace.c_str()) < 0)
+		return 1;
+
+	pthread_cond_destroy(&oCtx.mCond);
+	pthread_mutex_destroy(&oCtx.mLock);
+
+	return 0;
+}
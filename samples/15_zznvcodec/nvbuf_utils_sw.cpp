@@ -0,0 +1,214 @@
+#include "nvbuf_utils.h"
+#include "ZzLog.h"
+
+#include <map>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Software stand-in for the NvBuffer calls of nvbuf_utils, linked by Makefile.sw instead of
+// libnvbuf_utils. Every buffer is a memfd, a real fd that can be mmap'ed, dup'ed and passed on
+// like a DMABUF. Block-linear buffers report their layout but are stored pitch-linear.
+
+ZZ_INIT_LOG("nvbuf_utils_sw");
+
+#define PITCH_ALIGN 256
+
+struct nvbuf_sw_t {
+	NvBufferParams mParams;
+	size_t mSize;
+	uint8_t* mBase;		// mapped on the first NvBufferMemMap() until NvBufferDestroy()
+};
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<int, nvbuf_sw_t> _buffers;
+
+// planes, bytes per pixel of plane 0 and the chroma subsampling of the other planes
+static bool _format_layout(NvBufferColorFormat nFormat, int* pPlanes, int* pBytesPerPixel, int* pChromaBytesPerPixel,
+	int* pShiftX, int* pShiftY) {
+	*pChromaBytesPerPixel = 1;
+	*pShiftX = 1;
+	*pShiftY = 1;
+	switch(nFormat) {
+	case NvBufferColorFormat_YUV420:
+	case NvBufferColorFormat_YVU420:
+	case NvBufferColorFormat_YUV420_ER:
+	case NvBufferColorFormat_YVU420_ER:
+	case NvBufferColorFormat_YUV420_709:
+	case NvBufferColorFormat_YUV420_709_ER:
+	case NvBufferColorFormat_YUV420_2020:
+		*pPlanes = 3;
+		*pBytesPerPixel = 1;
+		return true;
+
+	case NvBufferColorFormat_NV12:
+	case NvBufferColorFormat_NV12_ER:
+	case NvBufferColorFormat_NV21:
+	case NvBufferColorFormat_NV21_ER:
+	case NvBufferColorFormat_NV12_709:
+	case NvBufferColorFormat_NV12_709_ER:
+	case NvBufferColorFormat_NV12_2020:
+		*pPlanes = 2;
+		*pBytesPerPixel = 1;
+		*pChromaBytesPerPixel = 2;
+		return true;
+
+	case NvBufferColorFormat_UYVY:
+	case NvBufferColorFormat_UYVY_ER:
+	case NvBufferColorFormat_VYUY:
+	case NvBufferColorFormat_VYUY_ER:
+	case NvBufferColorFormat_YUYV:
+	case NvBufferColorFormat_YUYV_ER:
+	case NvBufferColorFormat_YVYU:
+	case NvBufferColorFormat_YVYU_ER:
+		*pPlanes = 1;
+		*pBytesPerPixel = 2;
+		return true;
+
+	case NvBufferColorFormat_ABGR32:
+	case NvBufferColorFormat_XRGB32:
+	case NvBufferColorFormat_ARGB32:
+		*pPlanes = 1;
+		*pBytesPerPixel = 4;
+		return true;
+
+	case NvBufferColorFormat_GRAY8:
+		*pPlanes = 1;
+		*pBytesPerPixel = 1;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+int NvBufferCreateEx(int* dmabuf_fd, NvBufferCreateParams* input_params) {
+	nvbuf_sw_t oBuffer;
+	NvBufferParams& oParams = oBuffer.mParams;
+	int nPlanes, nBytesPerPixel, nChromaBytesPerPixel, nShiftX, nShiftY;
+
+	memset(&oBuffer, 0, sizeof(oBuffer));
+	if(input_params->width <= 0 || input_params->height <= 0) {
+		LOGE("%s(%d): unexpected size %dx%d", __FUNCTION__, __LINE__, input_params->width, input_params->height);
+		return -1;
+	}
+
+	oParams.payloadType = input_params->payloadType;
+	if(input_params->payloadType == NvBufferPayload_MemHandle) {
+		oParams.memsize = input_params->memsize;
+		oBuffer.mSize = input_params->memsize;
+	} else {
+		if(! _format_layout(input_params->colorFormat, &nPlanes, &nBytesPerPixel, &nChromaBytesPerPixel, &nShiftX, &nShiftY)) {
+			LOGE("%s(%d): unsupported colorFormat %d", __FUNCTION__, __LINE__, input_params->colorFormat);
+			return -1;
+		}
+
+		oParams.pixel_format = input_params->colorFormat;
+		oParams.num_planes = nPlanes;
+		for(int i = 0;i < nPlanes;++i) {
+			int nBpp = i ? nChromaBytesPerPixel : nBytesPerPixel;
+
+			oParams.width[i] = i ? (input_params->width + (1 << nShiftX) - 1) >> nShiftX : input_params->width;
+			oParams.height[i] = i ? (input_params->height + (1 << nShiftY) - 1) >> nShiftY : input_params->height;
+			oParams.pitch[i] = (oParams.width[i] * nBpp + PITCH_ALIGN - 1) & ~(PITCH_ALIGN - 1);
+			oParams.offset[i] = oBuffer.mSize;
+			oParams.psize[i] = oParams.pitch[i] * oParams.height[i];
+			oParams.layout[i] = input_params->layout;
+			oBuffer.mSize += oParams.psize[i];
+		}
+	}
+	oParams.nv_buffer_size = oBuffer.mSize;
+
+	int nFD = memfd_create("nvbuf_sw", MFD_CLOEXEC);
+	if(nFD < 0) {
+		LOGE("%s(%d): memfd_create failed, errno=%d", __FUNCTION__, __LINE__, errno);
+		return -1;
+	}
+	if(ftruncate(nFD, oBuffer.mSize) != 0) {
+		LOGE("%s(%d): ftruncate failed, errno=%d", __FUNCTION__, __LINE__, errno);
+		close(nFD);
+		return -1;
+	}
+	oParams.dmabuf_fd = nFD;
+
+	pthread_mutex_lock(&_lock);
+	_buffers[nFD] = oBuffer;
+	pthread_mutex_unlock(&_lock);
+
+	*dmabuf_fd = nFD;
+	return 0;
+}
+
+int NvBufferGetParams(int dmabuf_fd, NvBufferParams* params) {
+	pthread_mutex_lock(&_lock);
+	std::map<int, nvbuf_sw_t>::iterator it = _buffers.find(dmabuf_fd);
+	if(it == _buffers.end()) {
+		pthread_mutex_unlock(&_lock);
+		return -1;
+	}
+	*params = it->second.mParams;
+	pthread_mutex_unlock(&_lock);
+
+	return 0;
+}
+
+int NvBufferDestroy(int dmabuf_fd) {
+	nvbuf_sw_t oBuffer;
+
+	pthread_mutex_lock(&_lock);
+	std::map<int, nvbuf_sw_t>::iterator it = _buffers.find(dmabuf_fd);
+	if(it == _buffers.end()) {
+		pthread_mutex_unlock(&_lock);
+		LOGE("%s(%d): fd %d is not an NvBuffer", __FUNCTION__, __LINE__, dmabuf_fd);
+		return -1;
+	}
+	oBuffer = it->second;
+	_buffers.erase(it);
+	pthread_mutex_unlock(&_lock);
+
+	if(oBuffer.mBase)
+		munmap(oBuffer.mBase, oBuffer.mSize);
+	close(dmabuf_fd);
+	return 0;
+}
+
+int NvBufferMemMap(int dmabuf_fd, unsigned int plane, NvBufferMemFlags memflag, void** pVirtAddr) {
+	pthread_mutex_lock(&_lock);
+	std::map<int, nvbuf_sw_t>::iterator it = _buffers.find(dmabuf_fd);
+	if(it == _buffers.end() || (it->second.mParams.num_planes && plane >= it->second.mParams.num_planes)) {
+		pthread_mutex_unlock(&_lock);
+		LOGE("%s(%d): fd %d plane %u is not an NvBuffer plane", __FUNCTION__, __LINE__, dmabuf_fd, plane);
+		return -1;
+	}
+
+	nvbuf_sw_t& oBuffer = it->second;
+	if(! oBuffer.mBase) {
+		void* p = mmap(NULL, oBuffer.mSize, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+		if(p == MAP_FAILED) {
+			pthread_mutex_unlock(&_lock);
+			LOGE("%s(%d): mmap failed, errno=%d", __FUNCTION__, __LINE__, errno);
+			return -1;
+		}
+		oBuffer.mBase = (uint8_t*)p;
+	}
+	*pVirtAddr = oBuffer.mBase + oBuffer.mParams.offset[plane];
+	pthread_mutex_unlock(&_lock);
+
+	return 0;
+}
+
+// the mapping is kept for the next NvBufferMemMap(), NvBufferDestroy() drops it
+int NvBufferMemUnMap(int dmabuf_fd, unsigned int plane, void** pVirtAddr) {
+	*pVirtAddr = NULL;
+	return 0;
+}
+
+// CPU memory only, there are no caches to maintain
+int NvBufferMemSyncForCpu(int dmabuf_fd, unsigned int plane, void** pVirtAddr) {
+	return 0;
+}
+
+int NvBufferMemSyncForDevice(int dmabuf_fd, unsigned int plane, void** pVirtAddr) {
+	return 0;
+}
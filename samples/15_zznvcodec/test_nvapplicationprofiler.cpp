@@ -0,0 +1,212 @@
+#include "NvApplicationProfiler.h"
+#include "NvElement.h"
+#include "zztest.h"
+#include <atomic>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("test_nvapplicationprofiler");
+
+class TestElement : public NvElement {
+public:
+	TestElement(const char* pName) : NvElement(pName, NvElementProfiler::PROFILER_FIELD_ALL) {
+	}
+
+	// units taking about nLatencyUs each
+	void Process(int nUnits, int nLatencyUs) {
+		for(int i = 0;i < nUnits;++i) {
+			uint64_t nID = profiler.startProcessing();
+			usleep(nLatencyUs);
+			profiler.finishProcessing(nID, false);
+		}
+	}
+};
+
+static std::string _snapshot(NvApplicationProfiler::MetricsFormat nFormat) {
+	std::ostringstream oOut;
+
+	NvApplicationProfiler::getProfilerInstance().writeMetrics(oOut, nFormat);
+	return oOut.str();
+}
+
+static std::string _read_file(const char* pPath) {
+	std::string oContent;
+	char oBuf[4096];
+	FILE* pFile = fopen(pPath, "r");
+	size_t nRead;
+
+	if(! pFile)
+		return oContent;
+	while((nRead = fread(oBuf, 1, sizeof(oBuf), pFile)) > 0)
+		oContent.append(oBuf, nRead);
+	fclose(pFile);
+	return oContent;
+}
+
+static int _count(const std::string& oStr, const char* pNeedle) {
+	int nCount = 0;
+
+	for(size_t nPos = oStr.find(pNeedle);nPos != std::string::npos;nPos = oStr.find(pNeedle, nPos + 1))
+		nCount++;
+	return nCount;
+}
+
+static void* _busy_proc(void* pArg) {
+	std::atomic<bool>* pStop = (std::atomic<bool>*)pArg;
+	volatile uint64_t nSpin = 0;
+
+	pthread_setname_np(pthread_self(), "busy \"worker\"");
+	while(! *pStop)
+		nSpin++;
+	return NULL;
+}
+
+static void _test_snapshots() {
+	NvApplicationProfiler& oProfiler = NvApplicationProfiler::getProfilerInstance();
+	TestElement oDec("dec0");
+	TestElement oConv("conv0");
+
+	CHECK(oProfiler.registerElement(&oDec, "cam\"1\"") == 0);
+	CHECK(oDec.isProfilingEnabled());
+	CHECK(oProfiler.registerElement(&oDec) != 0);
+	CHECK(oProfiler.registerElement(&oConv, "cam2") == 0);
+
+	// the window only holds the units since the previous snapshot
+	oDec.Process(20, 20000);
+	_snapshot(NvApplicationProfiler::METRICS_FORMAT_JSON_LINES);
+	oDec.Process(20, 1000);
+
+	std::atomic<bool> bStop(false);
+	pthread_t oThread;
+	pthread_create(&oThread, NULL, _busy_proc, &bStop);
+	usleep(200000);
+	std::string oJson = _snapshot(NvApplicationProfiler::METRICS_FORMAT_JSON_LINES);
+	bStop = true;
+	pthread_join(oThread, NULL);
+
+	LOGI("%s", oJson.c_str());
+	CHECK(_count(oJson, "\n") == 1);
+	CHECK(oJson.find("\"element\":\"dec0\",\"stream\":\"cam\\\"1\\\"\",\"units\":40") != std::string::npos);
+	CHECK(oJson.find("\"element\":\"conv0\",\"stream\":\"cam2\",\"units\":0") != std::string::npos);
+	CHECK(oJson.find("\"window_latency_usec\":{\"samples\":20,") != std::string::npos);
+	CHECK(oJson.find("\"name\":\"busy \\\"worker\\\"\"") != std::string::npos);
+	CHECK(oJson.find("\"resident_bytes\":0,") == std::string::npos);
+
+	// the cumulative p99 has the 20 ms units, the window p99 not
+	size_t nWindow = oJson.find("\"window_latency_usec\"");
+	size_t nP99 = oJson.find("\"p99\":", nWindow);
+	CHECK(nP99 != std::string::npos && atoi(oJson.c_str() + nP99 + 6) < 15000);
+	nP99 = oJson.find("\"p99\":");
+	CHECK(nP99 < nWindow && atoi(oJson.c_str() + nP99 + 6) >= 20000);
+
+	std::string oProm = _snapshot(NvApplicationProfiler::METRICS_FORMAT_PROMETHEUS);
+	CHECK(oProm.find("nvmm_element_units_total{element=\"dec0\",stream=\"cam\\\"1\\\"\"} 40\n") != std::string::npos);
+	CHECK(oProm.find("nvmm_element_latency_usec_count{element=\"dec0\",stream=\"cam\\\"1\\\"\"} 40\n") != std::string::npos);
+	CHECK(oProm.find("nvmm_element_latency_usec{element=\"conv0\",stream=\"cam2\",quantile=\"0.99\"} 0\n") != std::string::npos);
+	CHECK(oProm.find("nvmm_process_resident_bytes ") != std::string::npos);
+	CHECK(_count(oProm, "# TYPE nvmm_element_fps gauge\n") == 1);
+
+	oProfiler.unregisterElement(&oConv);
+	oProfiler.unregisterElement(&oDec);
+	CHECK(_snapshot(NvApplicationProfiler::METRICS_FORMAT_JSON_LINES).find("\"elements\":[]}") != std::string::npos);
+}
+
+static void _test_file_export() {
+	NvApplicationProfiler& oProfiler = NvApplicationProfiler::getProfilerInstance();
+	char oPath[] = "/tmp/nvappprofilerXXXXXX";
+	int nFD = mkstemp(oPath);
+	close(nFD);
+
+	CHECK(oProfiler.exportMetrics() != 0);
+
+	// JSON lines are appended, by the profiling thread and on stop
+	CHECK(oProfiler.setMetricsExport(oPath, NvApplicationProfiler::METRICS_FORMAT_JSON_LINES, 50) == 0);
+	oProfiler.start(10);
+	usleep(300000);
+	oProfiler.stop();
+	oProfiler.stop();
+	int nLines = _count(_read_file(oPath), "\n");
+	LOGI("%d snapshots in 300 ms", nLines);
+	CHECK(nLines >= 3 && nLines <= 8);
+
+	// Prometheus snapshots replace the file
+	CHECK(oProfiler.setMetricsExport(oPath, NvApplicationProfiler::METRICS_FORMAT_PROMETHEUS, 1000) == 0);
+	CHECK(oProfiler.exportMetrics() == 0);
+	CHECK(oProfiler.exportMetrics() == 0);
+	std::string oProm = _read_file(oPath);
+	CHECK(_count(oProm, "# TYPE nvmm_process_cpu_percent gauge\n") == 1);
+	CHECK(access((std::string(oPath) + ".tmp").c_str(), F_OK) != 0);
+
+	CHECK(oProfiler.setMetricsExport("/nonexistent/dir/metrics", NvApplicationProfiler::METRICS_FORMAT_JSON_LINES, 1000) != 0);
+	CHECK(oProfiler.setMetricsExport(NULL, NvApplicationProfiler::METRICS_FORMAT_JSON_LINES, 0) == 0);
+	unlink(oPath);
+}
+
+static void _test_socket_export() {
+	NvApplicationProfiler& oProfiler = NvApplicationProfiler::getProfilerInstance();
+	struct sockaddr_un oAddr;
+	std::string oDestination;
+	char oBuf[65536];
+
+	memset(&oAddr, 0, sizeof(oAddr));
+	oAddr.sun_family = AF_UNIX;
+	snprintf(oAddr.sun_path, sizeof(oAddr.sun_path), "/tmp/nvappprofiler.%d.sock", (int)getpid());
+	unlink(oAddr.sun_path);
+	oDestination = std::string("unix:") + oAddr.sun_path;
+
+	// nobody listens yet, the snapshot is dropped
+	CHECK(oProfiler.setMetricsExport(oDestination.c_str(), NvApplicationProfiler::METRICS_FORMAT_PROMETHEUS, 1000) == 0);
+	CHECK(oProfiler.exportMetrics() != 0);
+
+	int nServer = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK(bind(nServer, (struct sockaddr*)&oAddr, sizeof(oAddr)) == 0);
+	CHECK(listen(nServer, 1) == 0);
+
+	CHECK(oProfiler.exportMetrics() == 0);
+	CHECK(oProfiler.exportMetrics() == 0);
+	int nClient = accept(nServer, NULL, NULL);
+	std::string oReceived;
+	while(_count(oReceived, "# EOF\n") < 2) {
+		ssize_t nRead = read(nClient, oBuf, sizeof(oBuf));
+		if(nRead <= 0)
+			break;
+		oReceived.append(oBuf, nRead);
+	}
+	CHECK(_count(oReceived, "# EOF\n") == 2);
+	CHECK(_count(oReceived, "# TYPE nvmm_process_resident_bytes gauge\n") == 2);
+
+	// the reader went away, the next snapshot reconnects
+	close(nClient);
+	oProfiler.exportMetrics();
+	oProfiler.exportMetrics();
+	nClient = accept(nServer, NULL, NULL);
+	CHECK(nClient >= 0);
+	CHECK(oProfiler.exportMetrics() == 0);
+	CHECK(read(nClient, oBuf, sizeof(oBuf)) > 0);
+
+	CHECK(oProfiler.setMetricsExport(NULL, NvApplicationProfiler::METRICS_FORMAT_JSON_LINES, 0) == 0);
+	close(nClient);
+	close(nServer);
+	unlink(oAddr.sun_path);
+}
+
+int main(int argc, char *argv[]) {
+	_test_snapshots();
+	_test_file_export();
+	_test_socket_export();
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
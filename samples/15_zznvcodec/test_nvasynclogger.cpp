@@ -0,0 +1,272 @@
+#include "NvAsyncLogger.h"
+#include "NvLogging.h"
+#include "zztest.h"
+#include <pthread.h>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("test_nvasynclogger");
+
+#define BUSY_THREADS 4
+#define BUSY_MESSAGES 20000
+
+static const char *comp_name = "test_nvasynclogger";
+
+// Sends fd to a file until _end_capture
+struct Capture {
+	int nFD;
+	int nSaved;
+	char oPath[32];
+};
+
+static void _begin_capture(Capture* pCapture, int nFD) {
+	NvAsyncLogger::getLoggerInstance().flush();
+	strcpy(pCapture->oPath, "/tmp/nvasyncloggerXXXXXX");
+	int nFile = mkstemp(pCapture->oPath);
+	pCapture->nFD = nFD;
+	pCapture->nSaved = dup(nFD);
+	dup2(nFile, nFD);
+	close(nFile);
+}
+
+static std::string _end_capture(Capture* pCapture, bool bFlush = true) {
+	std::string oContent;
+	char oBuf[4096];
+	size_t nRead;
+
+	if(bFlush)
+		NvAsyncLogger::getLoggerInstance().flush();
+	dup2(pCapture->nSaved, pCapture->nFD);
+	close(pCapture->nSaved);
+
+	FILE* pFile = fopen(pCapture->oPath, "r");
+	if(pFile) {
+		while((nRead = fread(oBuf, 1, sizeof(oBuf), pFile)) > 0)
+			oContent.append(oBuf, nRead);
+		fclose(pFile);
+	}
+	unlink(pCapture->oPath);
+	return oContent;
+}
+
+static int _count(const std::string& oStr, const char* pNeedle) {
+	int nCount = 0;
+
+	for(size_t nPos = oStr.find(pNeedle);nPos != std::string::npos;nPos = oStr.find(pNeedle, nPos + 1))
+		nCount++;
+	return nCount;
+}
+
+static void _log(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void _log(const char* fmt, ...) {
+	va_list marker;
+	va_start(marker, fmt);
+	NvAsyncLogger::getLoggerInstance().vlog(NvAsyncLogger::LOG_STREAM_STDERR, 0, "<", ">\n", fmt, marker);
+	va_end(marker);
+}
+
+// Logs the message and appends what printf makes of it to oExpected
+static std::string _expected;
+
+static void _format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void _format(const char* fmt, ...) {
+	char oBuf[1024];
+	va_list marker;
+
+	va_start(marker, fmt);
+	vsnprintf(oBuf, sizeof(oBuf), fmt, marker);
+	va_end(marker);
+	_expected += std::string("<") + oBuf + ">\n";
+
+	va_start(marker, fmt);
+	NvAsyncLogger::getLoggerInstance().vlog(NvAsyncLogger::LOG_STREAM_STDERR, 0, "<", ">\n", fmt, marker);
+	va_end(marker);
+}
+
+static void _test_deferred_format() {
+	Capture oCapture;
+	const char* pNull = NULL;
+	char oShort[4] = { 'a', 'b', 'c', 'd' };
+	int nCount;
+
+	_expected.clear();
+	_begin_capture(&oCapture, 2);
+	_format("plain text");
+	_format("%d %i %u %x %X %o %%", -42, 7, 3000000000U, 0xbeef, 0xbeef, 8);
+	_format("%hhd %hhu %hd %hu", (signed char)-5, (unsigned char)250, (short)-300, (unsigned short)65000);
+	_format("%ld %lu %lld %llx", -1234567890123L, 1234567890123UL, -9000000000000000000LL, 0xfedcba9876543210ULL);
+	_format("%zu %zd %jd %td", (size_t)12345, (ssize_t)-12345, (intmax_t)-1, (ptrdiff_t)-77);
+	_format("%5.2f|%-10.3e|%g|%a|%Lf|%+08.3f", 3.14159, 12345.678, 0.0001, 1.5, (long double)2.5, -1.25);
+	_format("%-10s|%10s|%.3s|%s|%.2s", "left", "right", "truncate", pNull, oShort);
+	_format("%*d|%-*d|%.*f|%*.*s|%*d", 6, 42, 6, 42, 2, 1.23456, 8, 3, "abcdef", -4, 7);
+	_format("%c%c%c|%#x|%#o|% d|%05d", 'a', 'b', 'c', 255, 8, 5, -3);
+	_format("%p %p", (void*)0x1234, (void*)NULL);
+	_format("%d%n after", 5, &nCount);
+	std::string oOutput = _end_capture(&oCapture);
+
+	CHECK(oOutput == _expected);
+	if(oOutput != _expected) {
+		LOGE("%s(%d): got\n%s\nexpected\n%s", __FUNCTION__, __LINE__, oOutput.c_str(), _expected.c_str());
+	}
+}
+
+static void _test_long_message() {
+	Capture oCapture;
+	std::string oLong(10000, 'x');
+
+	// strings are cut to fit the record, the arguments after them are lost
+	_begin_capture(&oCapture, 2);
+	_log("%s|%d", oLong.c_str(), 1);
+	std::string oOutput = _end_capture(&oCapture);
+
+	CHECK(oOutput.size() > 3000 && oOutput.size() < ASYNC_LOGGER_MAX_RECORD);
+	CHECK(oOutput.compare(0, 101, "<" + std::string(100, 'x')) == 0);
+	CHECK(oOutput.find("|...>\n") != std::string::npos);
+}
+
+static void _repeat(int nTimes) {
+	for(int i = 0;i < nTimes;++i) {
+		_log("repeated %d", i);
+	}
+}
+
+static void _test_rate_limit() {
+	NvAsyncLogger& oLogger = NvAsyncLogger::getLoggerInstance();
+	uint64_t nSuppressed = oLogger.getSuppressedCount();
+	Capture oCapture;
+
+	oLogger.setRateLimit(5, 60000);
+	_begin_capture(&oCapture, 2);
+	_repeat(20);
+	std::string oOutput = _end_capture(&oCapture);
+	CHECK(_count(oOutput, "<repeated ") == 5);
+	CHECK(oOutput.find("<repeated 4>") != std::string::npos);
+	CHECK(oLogger.getSuppressedCount() == nSuppressed + 15);
+
+	// the next message after the interval tells how many were left out
+	oLogger.setRateLimit(5, 1);
+	usleep(5000);
+	_begin_capture(&oCapture, 2);
+	_repeat(20);
+	oOutput = _end_capture(&oCapture);
+	CHECK(oOutput.find("<15 similar messages suppressed>\n<repeated 0>\n") == 0);
+
+	oLogger.setRateLimit(0, 0);
+	_begin_capture(&oCapture, 2);
+	for(int i = 0;i < 200;++i) {
+		_log("unlimited %d", i);
+	}
+	oOutput = _end_capture(&oCapture);
+	CHECK(_count(oOutput, "<unlimited ") == 200);
+}
+
+static void* _busy_proc(void* pArg) {
+	long nThread = (long)pArg;
+
+	for(int i = 0;i < BUSY_MESSAGES;++i) {
+		_log("thread %ld message %06d %s", nThread, i, "padding padding padding padding padding padding");
+	}
+	return NULL;
+}
+
+static void _test_threads() {
+	NvAsyncLogger& oLogger = NvAsyncLogger::getLoggerInstance();
+	pthread_t oThreads[BUSY_THREADS];
+	Capture oCapture;
+
+	// rings of exited threads are reused, messages of a full ring are dropped
+	for(int nRound = 0;nRound < 2;++nRound) {
+		uint64_t nDropped = oLogger.getDroppedCount();
+
+		_begin_capture(&oCapture, 2);
+		for(long i = 0;i < BUSY_THREADS;++i) {
+			pthread_create(&oThreads[i], NULL, _busy_proc, (void*)i);
+		}
+		for(int i = 0;i < BUSY_THREADS;++i) {
+			pthread_join(oThreads[i], NULL);
+		}
+		std::string oOutput = _end_capture(&oCapture);
+
+		int nLines = _count(oOutput, "<thread ");
+		nDropped = oLogger.getDroppedCount() - nDropped;
+		CHECK(nLines + nDropped == BUSY_THREADS * BUSY_MESSAGES);
+		CHECK(nDropped == 0 || oOutput.find(" messages dropped, ring full\n") != std::string::npos);
+
+		// each thread's messages stay in order
+		for(long t = 0;t < BUSY_THREADS;++t) {
+			char oNeedle[32];
+			int nLast = -1;
+			bool bOrdered = true;
+
+			snprintf(oNeedle, sizeof(oNeedle), "<thread %ld message ", t);
+			for(size_t nPos = oOutput.find(oNeedle);nPos != std::string::npos;nPos = oOutput.find(oNeedle, nPos + 1)) {
+				int nMessage = atoi(oOutput.c_str() + nPos + strlen(oNeedle));
+				bOrdered = bOrdered && nMessage > nLast;
+				nLast = nMessage;
+			}
+			CHECK(bOrdered);
+		}
+	}
+}
+
+static void _test_sync() {
+	NvAsyncLogger& oLogger = NvAsyncLogger::getLoggerInstance();
+	Capture oCapture;
+
+	_begin_capture(&oCapture, 2);
+	_log("buffered");
+	oLogger.setAsync(false);
+	CHECK(! oLogger.isAsync());
+	_log("sync %d", 1);
+	std::string oOutput = _end_capture(&oCapture, false);
+	CHECK(oOutput == "<buffered>\n<sync 1>\n");
+	oLogger.setAsync(true);
+}
+
+static void _test_frontends() {
+	Capture oCapture;
+
+	// NvLogging writes to stderr
+	log_level = LOG_LEVEL_DEBUG;
+	_begin_capture(&oCapture, 2);
+	COMP_ERROR_MSG("error " << 42);
+	COMP_DEBUG_MSG("debug " << 1.5);
+	std::string oOutput = _end_capture(&oCapture);
+	CHECK(oOutput.find("[ERROR] (test_nvasynclogger.cpp:") == 0);
+	CHECK(oOutput.find(") <test_nvasynclogger> error 42\n") != std::string::npos);
+	CHECK(oOutput.find("[DEBUG] (test_nvasynclogger.cpp:") != std::string::npos);
+	log_level = DEFAULT_LOG_LEVEL;
+
+	// ZzLog writes to stdout with the elapsed time
+	fflush(stdout);
+	_begin_capture(&oCapture, 1);
+	LOGN("notice %d %s", 7, "seven");
+	QCAP_LOG_LEVEL = 5;
+	LOGI("hidden");
+	QCAP_LOG_LEVEL = 0;
+	oOutput = _end_capture(&oCapture);
+	CHECK(oOutput.compare(0, 3, "[0:") == 0);
+	CHECK(oOutput.find("] \033[1;32m[test_nvasynclogger]: notice 7 seven\n\033[0m") != std::string::npos);
+	CHECK(oOutput.find("hidden") == std::string::npos);
+}
+
+int main(int argc, char *argv[]) {
+	_test_deferred_format();
+	_test_long_message();
+	_test_rate_limit();
+	_test_threads();
+	_test_sync();
+	_test_frontends();
+
+	NvAsyncLogger::getLoggerInstance().flush();
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
@@ -0,0 +1,215 @@
+#include "NvBitstreamSource.h"
+#include "zztest.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("test_nvbitstreamsource");
+
+static std::string _write_file(const std::vector<uint8_t>& oData) {
+	char oPath[] = "/tmp/nvbitstreamsourceXXXXXX";
+	int nFD = mkstemp(oPath);
+
+	if(! oData.empty() && write(nFD, &oData[0], oData.size()) != (ssize_t)oData.size()) {
+		LOGE("%s(%d): could not write %s", __FUNCTION__, __LINE__, oPath);
+	}
+	close(nFD);
+	return oPath;
+}
+
+static void _add_nal(std::vector<uint8_t>& oStream, int nStartCodeLen, const uint8_t* pBytes, size_t nSize) {
+	if(nStartCodeLen == 4)
+		oStream.push_back(0);
+	oStream.push_back(0);
+	oStream.push_back(0);
+	oStream.push_back(1);
+	oStream.insert(oStream.end(), pBytes, pBytes + nSize);
+}
+
+static void _test_h264() {
+	static const uint8_t aud[] = { 0x09, 0xf0 };
+	static const uint8_t sps[] = { 0x67, 0x42, 0x00, 0x1e };
+	static const uint8_t pps[] = { 0x68, 0xce, 0x38, 0x80 };
+	static const uint8_t idr0[] = { 0x65, 0x88, 0x84, 0x00, 0x33 };	// first_mb_in_slice 0
+	static const uint8_t idr1[] = { 0x65, 0x40, 0x22, 0x11 };		// first_mb_in_slice != 0
+	static const uint8_t p0[] = { 0x41, 0x9a, 0x02, 0x80 };
+	static const uint8_t sei[] = { 0x06, 0x05, 0x01, 0x80 };
+	static const uint8_t p1[] = { 0x41, 0x9a, 0x04 };
+	std::vector<uint8_t> oStream;
+
+	oStream.push_back('x');
+	oStream.push_back('y');
+	_add_nal(oStream, 4, aud, sizeof(aud));
+	_add_nal(oStream, 4, sps, sizeof(sps));
+	_add_nal(oStream, 3, pps, sizeof(pps));
+	_add_nal(oStream, 3, idr0, sizeof(idr0));
+	_add_nal(oStream, 3, idr1, sizeof(idr1));
+	_add_nal(oStream, 4, p0, sizeof(p0));
+	_add_nal(oStream, 3, sei, sizeof(sei));
+	_add_nal(oStream, 3, p1, sizeof(p1));
+	std::string oPath = _write_file(oStream);
+
+	NvBitstreamSource* pSource = NvBitstreamSource::createBitstreamSource(oPath.c_str());
+	CHECK(pSource != NULL);
+	if(! pSource) {
+		unlink(oPath.c_str());
+		return;
+	}
+	CHECK(pSource->getSize() == oStream.size());
+
+	// NAL units, the bytes in front of the first one are skipped
+	static const uint32_t types[] = { 9, 7, 8, 5, 5, 1, 6, 1 };
+	NvNalUnit oUnit;
+	size_t nEnd = 2;
+	for(int i = 0;i < 8;++i) {
+		const uint8_t* pNalu = pSource->nextNalu(NV_NAL_CODEC_H264, &oUnit);
+		CHECK(pNalu != NULL);
+		if(! pNalu)
+			break;
+		CHECK(oUnit.offset == nEnd);
+		CHECK(oUnit.type == types[i]);
+		CHECK(memcmp(pNalu, &oStream[oUnit.offset], oUnit.size) == 0);
+		nEnd = oUnit.offset + oUnit.size;
+	}
+	CHECK(nEnd == oStream.size());
+	CHECK(pSource->isEof());
+	CHECK(pSource->nextNalu(NV_NAL_CODEC_H264, &oUnit) == NULL);
+
+	// access units: AUD SPS PPS IDR IDR | P | SEI P
+	pSource->rewind();
+	CHECK(pSource->getPosition() == 0);
+	const uint8_t* pAU = pSource->nextAccessUnit(NV_NAL_CODEC_H264, &oUnit);
+	size_t nAU1 = 2 + 6 + 8 + 7 + 8 + 7;
+	CHECK(pAU != NULL && oUnit.offset == 2 && oUnit.size == nAU1 - 2 && oUnit.type == 5);
+	pAU = pSource->nextAccessUnit(NV_NAL_CODEC_H264, &oUnit);
+	CHECK(pAU != NULL && oUnit.offset == nAU1 && oUnit.size == 8 && oUnit.type == 1);
+	pAU = pSource->nextAccessUnit(NV_NAL_CODEC_H264, &oUnit);
+	CHECK(pAU != NULL && oUnit.offset == nAU1 + 8 && oUnit.size == 7 + 6 && oUnit.type == 1);
+	CHECK(pSource->nextAccessUnit(NV_NAL_CODEC_H264, &oUnit) == NULL);
+
+	// raw reads stop at the end of the file
+	uint8_t oBuf[16];
+	pSource->seek(oStream.size() - 4);
+	CHECK(pSource->read(oBuf, sizeof(oBuf)) == 4);
+	CHECK(memcmp(oBuf, &oStream[oStream.size() - 4], 4) == 0);
+	CHECK(pSource->read(oBuf, sizeof(oBuf)) == 0);
+	pSource->seek(oStream.size() + 100);
+	CHECK(pSource->getPosition() == oStream.size());
+
+	delete pSource;
+	unlink(oPath.c_str());
+}
+
+static void _test_h265() {
+	static const uint8_t vps[] = { 0x40, 0x01, 0x0c };
+	static const uint8_t sps[] = { 0x42, 0x01, 0x01 };
+	static const uint8_t pps[] = { 0x44, 0x01, 0xc1 };
+	static const uint8_t idr[] = { 0x26, 0x01, 0xaf, 0x80 };		// IDR_W_RADL, first slice segment
+	static const uint8_t trail0[] = { 0x02, 0x01, 0xd0, 0x11 };	// TRAIL_R, first slice segment
+	static const uint8_t trail1[] = { 0x02, 0x01, 0x20, 0x22 };	// TRAIL_R, next slice segment
+	std::vector<uint8_t> oStream;
+
+	_add_nal(oStream, 4, vps, sizeof(vps));
+	_add_nal(oStream, 4, sps, sizeof(sps));
+	_add_nal(oStream, 4, pps, sizeof(pps));
+	_add_nal(oStream, 4, idr, sizeof(idr));
+	_add_nal(oStream, 4, trail0, sizeof(trail0));
+	_add_nal(oStream, 4, trail1, sizeof(trail1));
+	std::string oPath = _write_file(oStream);
+
+	NvBitstreamSource* pSource = NvBitstreamSource::createBitstreamSource(oPath.c_str(), 0);
+	CHECK(pSource != NULL);
+	if(! pSource) {
+		unlink(oPath.c_str());
+		return;
+	}
+
+	NvNalUnit oUnit;
+	CHECK(pSource->nextNalu(NV_NAL_CODEC_H265, &oUnit) != NULL && oUnit.type == 32);
+	pSource->rewind();
+	CHECK(pSource->nextAccessUnit(NV_NAL_CODEC_H265, &oUnit) != NULL);
+	CHECK(oUnit.offset == 0 && oUnit.size == 7 * 3 + 8 && oUnit.type == 19);
+	CHECK(pSource->nextAccessUnit(NV_NAL_CODEC_H265, &oUnit) != NULL);
+	CHECK(oUnit.offset == 7 * 3 + 8 && oUnit.size == 16 && oUnit.type == 1);
+	CHECK(pSource->nextAccessUnit(NV_NAL_CODEC_H265, &oUnit) == NULL);
+
+	delete pSource;
+	unlink(oPath.c_str());
+}
+
+static void _test_large() {
+	std::vector<uint8_t> oStream;
+	std::vector<uint8_t> oCopy;
+	unsigned int seed = 1;
+
+	// many pages with a small prefetch window, pages behind are released meanwhile
+	while(oStream.size() < 4 * 1024 * 1024) {
+		uint8_t oNal[1 + 3000];
+		size_t nSize = 1 + rand_r(&seed) % 3000;
+
+		oNal[0] = 0x41;
+		for(size_t i = 1;i < nSize;++i)
+			oNal[i] = 0x80 | rand_r(&seed);
+		_add_nal(oStream, 3 + (rand_r(&seed) & 1), oNal, nSize);
+	}
+	std::string oPath = _write_file(oStream);
+
+	for(int nPass = 0;nPass < 2;++nPass) {
+		NvBitstreamSource* pSource = NvBitstreamSource::createBitstreamSource(oPath.c_str(), nPass ? 64 * 1024 : 0);
+		NvNalUnit oUnit;
+		const uint8_t* pNalu;
+
+		CHECK(pSource != NULL);
+		if(! pSource)
+			break;
+		for(int nLoop = 0;nLoop < 2;++nLoop) {
+			oCopy.clear();
+			while((pNalu = pSource->nextNalu(NV_NAL_CODEC_H264, &oUnit)) != NULL) {
+				oCopy.insert(oCopy.end(), pNalu, pNalu + oUnit.size);
+			}
+			CHECK(oCopy == oStream);
+			pSource->rewind();
+		}
+		delete pSource;
+	}
+	unlink(oPath.c_str());
+}
+
+static void _test_errors() {
+	std::vector<uint8_t> oEmpty;
+	std::string oPath = _write_file(oEmpty);
+	NvBitstreamSource* pSource = NvBitstreamSource::createBitstreamSource(oPath.c_str());
+	NvNalUnit oUnit;
+	uint8_t oBuf[4];
+
+	CHECK(pSource != NULL);
+	if(pSource) {
+		CHECK(pSource->isEof());
+		CHECK(pSource->nextNalu(NV_NAL_CODEC_H264, &oUnit) == NULL);
+		CHECK(pSource->nextAccessUnit(NV_NAL_CODEC_H264, &oUnit) == NULL);
+		CHECK(pSource->read(oBuf, sizeof(oBuf)) == 0);
+		delete pSource;
+	}
+	unlink(oPath.c_str());
+
+	CHECK(NvBitstreamSource::createBitstreamSource("/nonexistent/file.h264") == NULL);
+	CHECK(NvBitstreamSource::createBitstreamSource("/tmp") == NULL);
+}
+
+int main(int argc, char *argv[]) {
+	_test_h264();
+	_test_h265();
+	_test_large();
+	_test_errors();
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
@@ -0,0 +1,277 @@
+#include "NvBufferPool.h"
+#include "zztest.h"
+#include <pthread.h>
+#include <set>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+ZZ_INIT_LOG("test_nvbufferpool");
+
+#define THREADS 4
+#define ROUNDS 2000
+
+static NvBufferPoolStats _stats_of(NvBufferPool* pPool, uint32_t nWidth, uint32_t nHeight) {
+	NvBufferPoolStats oStats[8];
+	NvBufferPoolStats oNone;
+	uint32_t nKeys = pPool->getStats(oStats, 8);
+
+	for(uint32_t i = 0;i < nKeys && i < 8;++i) {
+		if(oStats[i].width == nWidth && oStats[i].height == nHeight)
+			return oStats[i];
+	}
+
+	memset(&oNone, 0, sizeof(oNone));
+	return oNone;
+}
+
+// a resolution change back and forth reuses the memory of the first setup
+static void _test_reuse() {
+	NvBufferPool* pPool = NvBufferPool::createBufferPool("reuse");
+	unsigned char* pFirst[4];
+	unsigned char* pOther[4];
+	std::set<unsigned char*> oFirst;
+
+	for(int i = 0;i < 4;++i) {
+		CHECK(pPool->acquireMemory(1920, 1080, 1, 1920 * 1080, &pFirst[i]) == 0);
+		memset(pFirst[i], i, 1920 * 1080);
+		oFirst.insert(pFirst[i]);
+	}
+	for(int i = 0;i < 4;++i)
+		CHECK(pPool->releaseMemory(pFirst[i]) == 0);
+
+	for(int i = 0;i < 4;++i)
+		CHECK(pPool->acquireMemory(1280, 720, 1, 1280 * 720, &pOther[i]) == 0);
+	for(int i = 0;i < 4;++i)
+		CHECK(pPool->releaseMemory(pOther[i]) == 0);
+
+	for(int i = 0;i < 4;++i) {
+		CHECK(pPool->acquireMemory(1920, 1080, 1, 1920 * 1080, &pFirst[i]) == 0);
+		CHECK(oFirst.count(pFirst[i]) == 1);
+	}
+
+	NvBufferPoolStats oStats = _stats_of(pPool, 1920, 1080);
+	CHECK(oStats.allocations == 4);
+	CHECK(oStats.reuses == 4);
+	CHECK(oStats.in_use == 4);
+	CHECK(oStats.idle == 0);
+	CHECK(oStats.high_water == 4);
+	CHECK(oStats.size == 1920 * 1080);
+	CHECK(_stats_of(pPool, 1280, 720).idle == 4);
+	CHECK(pPool->getTotalBytes() == 4 * 1920 * 1080 + 4 * 1280 * 720);
+
+	// other bytes per pixel is another key
+	unsigned char* pPacked;
+	CHECK(pPool->acquireMemory(1920, 1080, 2, 1920 * 1080 * 2, &pPacked) == 0);
+	CHECK(oFirst.count(pPacked) == 0);
+	CHECK(pPool->releaseMemory(pPacked) == 0);
+
+	for(int i = 0;i < 4;++i)
+		CHECK(pPool->releaseMemory(pFirst[i]) == 0);
+
+	delete pPool;
+}
+
+static void _test_trim_and_limit() {
+	NvBufferPool* pPool = NvBufferPool::createBufferPool("trim");
+	unsigned char* pMem[6];
+	unsigned char* pForeign = new unsigned char[16];
+
+	for(int i = 0;i < 6;++i)
+		CHECK(pPool->acquireMemory(64, 64, 1, 4096, &pMem[i]) == 0);
+	for(int i = 0;i < 5;++i)
+		CHECK(pPool->releaseMemory(pMem[i]) == 0);
+	CHECK(pPool->releaseMemory(pMem[0]) != 0);
+	CHECK(pPool->releaseMemory(pForeign) != 0);
+	delete[] pForeign;
+
+	NvBufferPoolStats oStats = _stats_of(pPool, 64, 64);
+	CHECK(oStats.in_use == 1);
+	CHECK(oStats.idle == 5);
+	CHECK(oStats.high_water == 6);
+
+	pPool->setIdleLimit(2);
+	CHECK(_stats_of(pPool, 64, 64).idle == 2);
+
+	// released beyond the limit is freed at once
+	CHECK(pPool->acquireMemory(64, 64, 1, 4096, &pMem[0]) == 0);
+	CHECK(pPool->acquireMemory(64, 64, 1, 4096, &pMem[1]) == 0);
+	CHECK(pPool->acquireMemory(64, 64, 1, 4096, &pMem[2]) == 0);
+	for(int i = 0;i < 3;++i)
+		CHECK(pPool->releaseMemory(pMem[i]) == 0);
+	oStats = _stats_of(pPool, 64, 64);
+	CHECK(oStats.idle == 2);
+	CHECK(oStats.allocations == 7);
+
+	// the key in use stays, with its high-water mark lowered
+	pPool->trim();
+	oStats = _stats_of(pPool, 64, 64);
+	CHECK(oStats.idle == 0);
+	CHECK(oStats.in_use == 1);
+	CHECK(oStats.high_water == 1);
+	CHECK(pPool->getTotalBytes() == 4096);
+
+	CHECK(pPool->releaseMemory(pMem[5]) == 0);
+	pPool->trim();
+	CHECK(pPool->getStats(NULL, 0) == 0);
+	CHECK(pPool->getTotalBytes() == 0);
+
+	delete pPool;
+}
+
+static void _test_dmabuf() {
+	NvBufferPool* pPool = NvBufferPool::createBufferPool("dmabuf");
+	NvBufferCreateParams oParams;
+	int nFD = -1;
+
+	memset(&oParams, 0, sizeof(oParams));
+	oParams.width = 640;
+	oParams.height = 480;
+	oParams.colorFormat = NvBufferColorFormat_NV12;
+	oParams.layout = NvBufferLayout_Pitch;
+	oParams.payloadType = NvBufferPayload_SurfArray;
+#ifdef NVBUFFERPOOL_CPU_ONLY
+	CHECK(pPool->acquireDmabuf(&oParams, &nFD) != 0);
+#else
+	CHECK(pPool->acquireDmabuf(&oParams, &nFD) == 0);
+	CHECK(pPool->releaseDmabuf(nFD) == 0);
+#endif
+	CHECK(pPool->releaseDmabuf(12345) != 0);
+
+	delete pPool;
+}
+
+#ifndef NVBUFFERPOOL_CPU_ONLY
+// fields the surface does not use differ between setups, the buffer is reused anyway
+static void _test_dmabuf_reuse() {
+	NvBufferPool* pPool = NvBufferPool::createBufferPool("dmabuf_reuse");
+	NvBufferCreateParams oParams;
+	int nFirst = -1;
+	int nSecond = -1;
+
+	memset(&oParams, 0x5A, sizeof(oParams));
+	oParams.width = 640;
+	oParams.height = 480;
+	oParams.colorFormat = NvBufferColorFormat_NV12;
+	oParams.layout = NvBufferLayout_Pitch;
+	oParams.payloadType = NvBufferPayload_SurfArray;
+	CHECK(pPool->acquireDmabuf(&oParams, &nFirst) == 0);
+	CHECK(pPool->releaseDmabuf(nFirst) == 0);
+
+	oParams.memsize = 12345678;
+	oParams.nvbuf_tag = NvBufferTag_VIDEO_ENC;
+	CHECK(pPool->acquireDmabuf(&oParams, &nSecond) == 0);
+	CHECK(nSecond == nFirst);
+
+	NvBufferPoolStats oStats = _stats_of(pPool, 640, 480);
+	CHECK(oStats.allocations == 1);
+	CHECK(oStats.reuses == 1);
+	CHECK(oStats.in_use == 1);
+	CHECK(pPool->releaseDmabuf(nSecond) == 0);
+
+	// the size of a MemHandle payload is part of its key
+	memset(&oParams, 0, sizeof(oParams));
+	oParams.width = 1;
+	oParams.height = 1;
+	oParams.payloadType = NvBufferPayload_MemHandle;
+	oParams.memsize = 4096;
+	CHECK(pPool->acquireDmabuf(&oParams, &nFirst) == 0);
+	CHECK(pPool->releaseDmabuf(nFirst) == 0);
+	oParams.memsize = 8192;
+	CHECK(pPool->acquireDmabuf(&oParams, &nSecond) == 0);
+	CHECK(nSecond != nFirst);
+	CHECK(pPool->releaseDmabuf(nSecond) == 0);
+
+	delete pPool;
+}
+#endif
+
+struct thread_context_t {
+	NvBufferPool* pPool;
+	int nIndex;
+	int nErrors;
+};
+
+static void* _thread_proc(void* pArg) {
+	thread_context_t* pContext = (thread_context_t*)pArg;
+	unsigned char* pMem[3];
+
+	for(int r = 0;r < ROUNDS;++r) {
+		uint32_t nWidth = 32 << (r % 3);
+
+		for(int i = 0;i < 3;++i) {
+			if(pContext->pPool->acquireMemory(nWidth, nWidth, 1, nWidth * nWidth, &pMem[i]) != 0) {
+				pContext->nErrors++;
+				return NULL;
+			}
+			memset(pMem[i], pContext->nIndex, nWidth * nWidth);
+		}
+		for(int i = 0;i < 3;++i) {
+			for(uint32_t j = 0;j < nWidth * nWidth;j += 97) {
+				if(pMem[i][j] != pContext->nIndex) {
+					pContext->nErrors++;
+					break;
+				}
+			}
+			pContext->pPool->releaseMemory(pMem[i]);
+		}
+	}
+
+	return NULL;
+}
+
+// buffers are never handed to two threads at once
+static void _test_threads() {
+	NvBufferPool* pPool = NvBufferPool::createBufferPool("threads");
+	pthread_t oThreads[THREADS];
+	thread_context_t oContexts[THREADS];
+
+	for(int i = 0;i < THREADS;++i) {
+		oContexts[i].pPool = pPool;
+		oContexts[i].nIndex = i + 1;
+		oContexts[i].nErrors = 0;
+		pthread_create(&oThreads[i], NULL, _thread_proc, &oContexts[i]);
+	}
+	for(int i = 0;i < THREADS;++i) {
+		pthread_join(oThreads[i], NULL);
+		CHECK(oContexts[i].nErrors == 0);
+	}
+
+	NvBufferPoolStats oStats[8];
+	uint32_t nKeys = pPool->getStats(oStats, 8);
+	uint64_t nAcquired = 0;
+
+	CHECK(nKeys == 3);
+	for(uint32_t i = 0;i < nKeys && i < 8;++i) {
+		CHECK(oStats[i].in_use == 0);
+		CHECK(oStats[i].high_water <= 3 * THREADS);
+		CHECK(oStats[i].allocations == oStats[i].idle);
+		nAcquired += oStats[i].allocations + oStats[i].reuses;
+		LOGI("%ux%u: high water %u, allocations %llu, reuses %llu", oStats[i].width, oStats[i].height,
+			oStats[i].high_water, (unsigned long long)oStats[i].allocations, (unsigned long long)oStats[i].reuses);
+	}
+	CHECK(nAcquired == (uint64_t)THREADS * ROUNDS * 3);
+
+	delete pPool;
+}
+
+int main(int argc, char *argv[]) {
+	CHECK(NvBufferPool::getProcessPool() != NULL);
+	CHECK(NvBufferPool::getProcessPool() == NvBufferPool::getProcessPool());
+
+	_test_reuse();
+	_test_trim_and_limit();
+	_test_dmabuf();
+#ifndef NVBUFFERPOOL_CPU_ONLY
+	_test_dmabuf_reuse();
+#endif
+	_test_threads();
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
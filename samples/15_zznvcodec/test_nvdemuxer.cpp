@@ -0,0 +1,593 @@
+#include "NvDemuxer.h"
+#include "zztest.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("test_nvdemuxer");
+
+#define FRAME_COUNT 5
+#define BUFFER_SIZE (64 * 1024)
+
+typedef std::vector<uint8_t> Bytes;
+
+static const uint8_t _sps[] = { 0x67, 0x42, 0x00, 0x1e, 0x95 };
+static const uint8_t _pps[] = { 0x68, 0xce, 0x38, 0x80 };
+static const uint8_t _sei[] = { 0x06, 0x05, 0x01, 0x80 };
+
+// key frames 0 and 3, frame 1 has two NAL units, frame 2 spans several TS packets
+static bool _key(int i) {
+	return i == 0 || i == 3;
+}
+
+static std::vector<Bytes> _frame_nalus(int i) {
+	std::vector<Bytes> oNalus;
+	Bytes oSlice;
+
+	if(i == 1)
+		oNalus.push_back(Bytes(_sei, _sei + sizeof(_sei)));
+	oSlice.push_back(_key(i) ? 0x65 : 0x41);
+	oSlice.push_back(0x88);
+	oSlice.push_back(i);
+	for(int j = 0;j < (i == 2 ? 700 : 20 + i);++j)
+		oSlice.push_back(0x80 | (j * 7 + i));
+	oNalus.push_back(oSlice);
+	return oNalus;
+}
+
+static void _append(Bytes& oOut, const Bytes& oIn) {
+	oOut.insert(oOut.end(), oIn.begin(), oIn.end());
+}
+
+static void _append(Bytes& oOut, const uint8_t* pIn, size_t nSize) {
+	oOut.insert(oOut.end(), pIn, pIn + nSize);
+}
+
+static void _put_be(Bytes& oOut, uint64_t nValue, int nBytes) {
+	for(int i = nBytes - 1;i >= 0;--i)
+		oOut.push_back(nValue >> (i * 8));
+}
+
+static void _annexb(Bytes& oOut, const uint8_t* pNalu, size_t nSize) {
+	_put_be(oOut, 1, 4);
+	_append(oOut, pNalu, nSize);
+}
+
+static Bytes _frame_annexb(int i) {
+	std::vector<Bytes> oNalus = _frame_nalus(i);
+	Bytes oOut;
+
+	for(size_t n = 0;n < oNalus.size();++n)
+		_annexb(oOut, &oNalus[n][0], oNalus[n].size());
+	return oOut;
+}
+
+static Bytes _frame_length_prefixed(int i) {
+	std::vector<Bytes> oNalus = _frame_nalus(i);
+	Bytes oOut;
+
+	for(size_t n = 0;n < oNalus.size();++n) {
+		_put_be(oOut, oNalus[n].size(), 4);
+		_append(oOut, oNalus[n]);
+	}
+	return oOut;
+}
+
+// what the demuxer writes for frame i, with the parameter sets of avcC in front
+static Bytes _expected(int i, bool bConfig) {
+	Bytes oOut;
+
+	if(bConfig) {
+		_annexb(oOut, _sps, sizeof(_sps));
+		_annexb(oOut, _pps, sizeof(_pps));
+	}
+	_append(oOut, _frame_annexb(i));
+	return oOut;
+}
+
+static Bytes _avcc() {
+	Bytes oOut;
+
+	oOut.push_back(1);
+	_append(oOut, _sps + 1, 3);
+	oOut.push_back(0xff);
+	oOut.push_back(0xe1);
+	_put_be(oOut, sizeof(_sps), 2);
+	_append(oOut, _sps, sizeof(_sps));
+	oOut.push_back(1);
+	_put_be(oOut, sizeof(_pps), 2);
+	_append(oOut, _pps, sizeof(_pps));
+	return oOut;
+}
+
+static std::string _write_file(const Bytes& oData) {
+	char oPath[] = "/tmp/nvdemuxerXXXXXX";
+	int nFD = mkstemp(oPath);
+
+	if(! oData.empty() && write(nFD, &oData[0], oData.size()) != (ssize_t)oData.size()) {
+		LOGE("%s(%d): could not write %s", __FUNCTION__, __LINE__, oPath);
+	}
+	close(nFD);
+	return oPath;
+}
+
+// Reads all frames and checks them against the expected ones, nFirst is the first frame expected
+static void _check_frames(NvDemuxer* pDemuxer, int nFirst, const uint64_t* pPts, bool bConfig) {
+	static uint8_t oBuf[BUFFER_SIZE];
+	NvDemuxerSample oSample;
+
+	for(int i = nFirst;i < FRAME_COUNT;++i) {
+		Bytes oExpected = _expected(i, bConfig && i == nFirst);
+
+		memset(&oSample, 0, sizeof(oSample));
+		CHECK(pDemuxer->readSample(oBuf, sizeof(oBuf), &oSample) == 1);
+		CHECK(oSample.size == oExpected.size());
+		CHECK(oSample.size == oExpected.size() && memcmp(oBuf, &oExpected[0], oSample.size) == 0);
+		CHECK(oSample.pts == pPts[i]);
+		CHECK(oSample.key_frame == _key(i));
+		if(oSample.pts != pPts[i]) {
+			LOGE("%s(%d): frame %d pts %llu", __FUNCTION__, __LINE__, i, (unsigned long long)oSample.pts);
+		}
+	}
+	CHECK(pDemuxer->readSample(oBuf, sizeof(oBuf), &oSample) == 0);
+}
+
+static void _check_demuxer(const Bytes& oFile, const char* pFormat, const uint64_t* pPts, uint64_t nDuration,
+	uint64_t nSeekPts, bool bConfig) {
+	std::string oPath = _write_file(oFile);
+	NvDemuxer* pDemuxer = NvDemuxer::createDemuxer(oPath.c_str());
+	uint8_t oSmall[16];
+	NvDemuxerSample oSample;
+
+	CHECK(pDemuxer != NULL);
+	if(! pDemuxer) {
+		unlink(oPath.c_str());
+		return;
+	}
+	CHECK(strcmp(pDemuxer->getFormatName(), pFormat) == 0);
+	CHECK(pDemuxer->getCodec() == NV_DEMUXER_CODEC_H264);
+	CHECK(pDemuxer->getDuration() == nDuration);
+
+	_check_frames(pDemuxer, 0, pPts, bConfig);
+
+	// the last key frame at or before the time, with the parameter sets again
+	CHECK(pDemuxer->seek(nSeekPts) == 0);
+	_check_frames(pDemuxer, 3, pPts, bConfig);
+	CHECK(pDemuxer->seek(pPts[3] - 1) == 0);
+	_check_frames(pDemuxer, 0, pPts, bConfig);
+	CHECK(pDemuxer->seek(0) == 0);
+	_check_frames(pDemuxer, 0, pPts, bConfig);
+
+	// frames that do not fit the buffer are errors
+	CHECK(pDemuxer->seek(0) == 0);
+	CHECK(pDemuxer->readSample(oSmall, sizeof(oSmall), &oSample) == -1);
+
+	delete pDemuxer;
+	unlink(oPath.c_str());
+}
+
+//
+// MP4
+//
+static Bytes _box(const char* pType, const Bytes& oPayload) {
+	Bytes oOut;
+
+	_put_be(oOut, 8 + oPayload.size(), 4);
+	_append(oOut, (const uint8_t*)pType, 4);
+	_append(oOut, oPayload);
+	return oOut;
+}
+
+static Bytes _full_box(const char* pType, const Bytes& oPayload) {
+	Bytes oOut(4, 0);
+
+	_append(oOut, oPayload);
+	return _box(pType, oOut);
+}
+
+static Bytes _mp4_track(const char* pHandler, const Bytes& oStbl, int nTimescale, uint32_t nDuration) {
+	Bytes oMdhd;
+	Bytes oHdlr(4, 0);
+	Bytes oMinf;
+	Bytes oMdia;
+
+	_put_be(oMdhd, 0, 8);
+	_put_be(oMdhd, nTimescale, 4);
+	_put_be(oMdhd, nDuration, 4);
+	_put_be(oMdhd, 0, 4);
+	_append(oHdlr, (const uint8_t*)pHandler, 4);
+	oHdlr.insert(oHdlr.end(), 13, 0);
+	oMinf = _box("minf", _box("stbl", oStbl));
+	_append(oMdia, _full_box("mdhd", oMdhd));
+	_append(oMdia, _full_box("hdlr", oHdlr));
+	_append(oMdia, oMinf);
+	return _box("trak", _box("mdia", oMdia));
+}
+
+static Bytes _mp4_file() {
+	Bytes oFile = _box("ftyp", Bytes((const uint8_t*)"isom\0\0\0\0isomavc1", (const uint8_t*)"isom\0\0\0\0isomavc1" + 16));
+	Bytes oMdat;
+	uint64_t nChunks[2];
+	Bytes oStsz, oStco, oStsc, oStts, oCtts, oStss, oStsd, oEntry, oStbl;
+
+	// frames 0-2 in one chunk, audio data, frames 3-4 in another chunk
+	size_t nMdat = oFile.size() + 8;
+	for(int i = 0;i < FRAME_COUNT;++i) {
+		if(i == 0 || i == 3)
+			nChunks[i / 3] = nMdat + oMdat.size();
+		_append(oMdat, _frame_length_prefixed(i));
+		if(i == 2)
+			oMdat.insert(oMdat.end(), 100, 0xaa);
+	}
+	_append(oFile, _box("mdat", oMdat));
+
+	_put_be(oStsz, 0, 4);
+	_put_be(oStsz, FRAME_COUNT, 4);
+	for(int i = 0;i < FRAME_COUNT;++i)
+		_put_be(oStsz, _frame_length_prefixed(i).size(), 4);
+	_put_be(oStco, 2, 4);
+	_put_be(oStco, nChunks[0], 4);
+	_put_be(oStco, nChunks[1], 4);
+	_put_be(oStsc, 2, 4);
+	_put_be(oStsc, 1, 4); _put_be(oStsc, 3, 4); _put_be(oStsc, 1, 4);
+	_put_be(oStsc, 2, 4); _put_be(oStsc, 2, 4); _put_be(oStsc, 1, 4);
+	_put_be(oStts, 1, 4);
+	_put_be(oStts, FRAME_COUNT, 4); _put_be(oStts, 3000, 4);
+	// composition offsets put the first frame one frame late
+	_put_be(oCtts, 1, 4);
+	_put_be(oCtts, FRAME_COUNT, 4); _put_be(oCtts, 3000, 4);
+	_put_be(oStss, 2, 4);
+	_put_be(oStss, 1, 4); _put_be(oStss, 4, 4);
+
+	oEntry.insert(oEntry.end(), 24, 0);
+	_put_be(oEntry, 320, 2);
+	_put_be(oEntry, 240, 2);
+	oEntry.insert(oEntry.end(), 78 - 28, 0);
+	_append(oEntry, _box("avcC", _avcc()));
+	_put_be(oStsd, 1, 4);
+	_append(oStsd, _box("avc1", oEntry));
+
+	_append(oStbl, _full_box("stsd", oStsd));
+	_append(oStbl, _full_box("stts", oStts));
+	_append(oStbl, _full_box("ctts", oCtts));
+	_append(oStbl, _full_box("stss", oStss));
+	_append(oStbl, _full_box("stsc", oStsc));
+	_append(oStbl, _full_box("stsz", oStsz));
+	_append(oStbl, _full_box("stco", oStco));
+
+	// an audio track in front of the video track
+	Bytes oMoov;
+	Bytes oAudio;
+	_append(oAudio, _full_box("stsd", Bytes(4, 0)));
+	_append(oMoov, _mp4_track("soun", oAudio, 48000, 0));
+	_append(oMoov, _mp4_track("vide", oStbl, 90000, FRAME_COUNT * 3000));
+	_append(oFile, _box("moov", oMoov));
+	return oFile;
+}
+
+static void _test_mp4() {
+	uint64_t oPts[FRAME_COUNT];
+
+	for(int i = 0;i < FRAME_COUNT;++i)
+		oPts[i] = (i + 1) * 3000 * 1000000ULL / 90000;
+	_check_demuxer(_mp4_file(), "MP4", oPts, 166666, oPts[4], true);
+
+	// the dimensions are those of the sample entry
+	std::string oPath = _write_file(_mp4_file());
+	NvDemuxer* pDemuxer = NvDemuxer::createDemuxer(oPath.c_str());
+	CHECK(pDemuxer && pDemuxer->getWidth() == 320 && pDemuxer->getHeight() == 240);
+	delete pDemuxer;
+	unlink(oPath.c_str());
+}
+
+//
+// Matroska
+//
+static Bytes _ebml(uint32_t nID, const Bytes& oPayload, bool bUnknownSize = false) {
+	Bytes oOut;
+
+	for(int i = 3;i >= 0;--i) {
+		if((nID >> (i * 8)) || i == 0)
+			oOut.push_back(nID >> (i * 8));
+	}
+	if(bUnknownSize) {
+		oOut.push_back(0x01);
+		oOut.insert(oOut.end(), 7, 0xff);
+	} else {
+		oOut.push_back(0x01);
+		_put_be(oOut, oPayload.size(), 7);
+	}
+	_append(oOut, oPayload);
+	return oOut;
+}
+
+static Bytes _ebml_uint(uint32_t nID, uint64_t nValue) {
+	Bytes oValue;
+
+	_put_be(oValue, nValue, 8);
+	return _ebml(nID, oValue);
+}
+
+static Bytes _ebml_string(uint32_t nID, const char* pValue) {
+	return _ebml(nID, Bytes((const uint8_t*)pValue, (const uint8_t*)pValue + strlen(pValue)));
+}
+
+static Bytes _mkv_block(int nTrack, int nTime, bool bKey, const Bytes& oFrame) {
+	Bytes oOut;
+
+	oOut.push_back(0x80 | nTrack);
+	_put_be(oOut, nTime, 2);
+	oOut.push_back(bKey ? 0x80 : 0);
+	_append(oOut, oFrame);
+	return oOut;
+}
+
+static Bytes _mkv_seek_head(uint64_t nCues) {
+	Bytes oSeek;
+	Bytes oID;
+
+	_put_be(oID, 0x1c53bb6b, 4);
+	_append(oSeek, _ebml(0x53ab, oID));
+	_append(oSeek, _ebml_uint(0x53ac, nCues));
+	return _ebml(0x114d9b74, _ebml(0x4dbb, oSeek));
+}
+
+static Bytes _mkv_file(bool bSeekHead) {
+	Bytes oHeader, oInfo, oTracks, oVideoTrack, oAudioTrack, oVideo;
+	Bytes oCluster1, oCluster2, oGroup, oSegment, oCues;
+	double fDuration = 166.0;
+	uint64_t nBits;
+
+	_append(oHeader, _ebml_string(0x4282, "matroska"));
+
+	_append(oInfo, _ebml_uint(0x2ad7b1, 1000000));
+	memcpy(&nBits, &fDuration, sizeof(nBits));
+	Bytes oDuration;
+	_put_be(oDuration, nBits, 8);
+	_append(oInfo, _ebml(0x4489, oDuration));
+
+	_append(oAudioTrack, _ebml_uint(0xd7, 2));
+	_append(oAudioTrack, _ebml_uint(0x83, 2));
+	_append(oAudioTrack, _ebml_string(0x86, "A_AAC"));
+	_append(oVideoTrack, _ebml_uint(0xd7, 1));
+	_append(oVideoTrack, _ebml_uint(0x83, 1));
+	_append(oVideoTrack, _ebml_string(0x86, "V_MPEG4/ISO/AVC"));
+	_append(oVideoTrack, _ebml(0x63a2, _avcc()));
+	_append(oVideo, _ebml_uint(0xb0, 320));
+	_append(oVideo, _ebml_uint(0xba, 240));
+	_append(oVideoTrack, _ebml(0xe0, oVideo));
+	_append(oTracks, _ebml(0xae, oAudioTrack));
+	_append(oTracks, _ebml(0xae, oVideoTrack));
+
+	// a cluster of known size with a block group, then one of unknown size
+	_append(oCluster1, _ebml_uint(0xe7, 0));
+	_append(oCluster1, _ebml(0xa3, _mkv_block(1, 0, true, _frame_length_prefixed(0))));
+	_append(oCluster1, _ebml(0xa3, _mkv_block(2, 0, true, Bytes(50, 0x11))));
+	_append(oCluster1, _ebml(0xa3, _mkv_block(1, 33, false, _frame_length_prefixed(1))));
+	_append(oGroup, _ebml(0xa1, _mkv_block(1, 66, false, _frame_length_prefixed(2))));
+	_append(oGroup, _ebml_uint(0xfb, 33));
+	_append(oCluster1, _ebml(0xa0, oGroup));
+	_append(oCluster2, _ebml_uint(0xe7, 100));
+	_append(oCluster2, _ebml(0xa3, _mkv_block(1, 0, true, _frame_length_prefixed(3))));
+	_append(oCluster2, _ebml(0xa3, _mkv_block(1, 33, false, _frame_length_prefixed(4))));
+
+	// positions are relative to the segment payload, sizes here do not depend on values
+	Bytes oHead;
+	size_t nSeekHead = bSeekHead ? _mkv_seek_head(0).size() : 0;
+	_append(oHead, _ebml(0x1549a966, oInfo));
+	_append(oHead, _ebml(0x1654ae6b, oTracks));
+	size_t nCluster1 = nSeekHead + oHead.size();
+	Bytes oC1 = _ebml(0x1f43b675, oCluster1);
+	Bytes oC2 = _ebml(0x1f43b675, oCluster2, true);
+	size_t nCluster2 = nCluster1 + oC1.size();
+	for(int i = 0;i < 2;++i) {
+		Bytes oPositions, oPoint;
+		_append(oPositions, _ebml_uint(0xf7, 1));
+		_append(oPositions, _ebml_uint(0xf1, i ? nCluster2 : nCluster1));
+		_append(oPoint, _ebml_uint(0xb3, i ? 100 : 0));
+		_append(oPoint, _ebml(0xb7, oPositions));
+		_append(oCues, _ebml(0xbb, oPoint));
+	}
+	size_t nCues = nCluster2 + oC2.size();
+	if(bSeekHead)
+		_append(oSegment, _mkv_seek_head(nCues));
+	_append(oSegment, oHead);
+	_append(oSegment, oC1);
+	_append(oSegment, oC2);
+	_append(oSegment, _ebml(0x1c53bb6b, oCues));
+
+	Bytes oFile = _ebml(0x1a45dfa3, oHeader);
+	_append(oFile, _ebml(0x18538067, oSegment));
+	return oFile;
+}
+
+static void _test_mkv() {
+	static const uint64_t oPts[FRAME_COUNT] = { 0, 33000, 66000, 100000, 133000 };
+
+	// cues from the seek head, and cues found after the clusters
+	_check_demuxer(_mkv_file(true), "Matroska", oPts, 166000, 140000, true);
+	_check_demuxer(_mkv_file(false), "Matroska", oPts, 166000, 140000, true);
+}
+
+//
+// MPEG-TS
+//
+static void _ts_packet(Bytes& oOut, int nPrefix, int nPID, bool bStart, bool bRandomAccess,
+	const uint8_t* pPayload, size_t nSize, size_t* pUsed, int* pCounter) {
+	size_t nAdaptation = bRandomAccess ? 2 : 0;
+	size_t nPayload = nSize;
+
+	if(nPayload > 184 - nAdaptation)
+		nPayload = 184 - nAdaptation;
+	else
+		nAdaptation = 184 - nPayload;
+
+	oOut.insert(oOut.end(), nPrefix, 0x00);
+	oOut.push_back(0x47);
+	oOut.push_back((bStart ? 0x40 : 0) | (nPID >> 8));
+	oOut.push_back(nPID & 0xff);
+	oOut.push_back((nAdaptation ? 0x30 : 0x10) | ((*pCounter)++ & 0x0f));
+	if(nAdaptation) {
+		oOut.push_back(nAdaptation - 1);
+		if(nAdaptation > 1) {
+			oOut.push_back(bRandomAccess ? 0x40 : 0);
+			oOut.insert(oOut.end(), nAdaptation - 2, 0xff);
+		}
+	}
+	_append(oOut, pPayload, nPayload);
+	*pUsed = nPayload;
+}
+
+static void _ts_pes(Bytes& oOut, int nPrefix, int nPID, uint64_t nPts, bool bRandomAccess, const Bytes& oData, int* pCounter) {
+	Bytes oPes;
+	size_t nPos = 0;
+
+	_put_be(oPes, 0x000001e0, 4);
+	_put_be(oPes, 0, 2);
+	oPes.push_back(0x80);
+	oPes.push_back(0x80);
+	oPes.push_back(5);
+	oPes.push_back(0x21 | ((nPts >> 29) & 0x0e));
+	oPes.push_back(nPts >> 22);
+	oPes.push_back(0x01 | ((nPts >> 14) & 0xfe));
+	oPes.push_back(nPts >> 7);
+	oPes.push_back(0x01 | ((nPts << 1) & 0xfe));
+	_append(oPes, oData);
+
+	while(nPos < oPes.size()) {
+		size_t nUsed;
+
+		_ts_packet(oOut, nPrefix, nPID, nPos == 0, nPos == 0 && bRandomAccess, &oPes[nPos], oPes.size() - nPos, &nUsed, pCounter);
+		nPos += nUsed;
+	}
+}
+
+static Bytes _ts_file(int nPrefix) {
+	static const uint8_t pat[] = { 0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+		0x00, 0x01, 0xf0, 0x00, 0, 0, 0, 0 };
+	static const uint8_t pmt[] = { 0x00, 0x02, 0xb0, 0x17, 0x00, 0x01, 0xc1, 0x00, 0x00,
+		0xe1, 0x00, 0xf0, 0x00,
+		0x0f, 0xe1, 0x01, 0xf0, 0x00,
+		0x1b, 0xe1, 0x00, 0xf0, 0x00, 0, 0, 0, 0 };
+	int nCounters[3] = { 0, 0, 0 };
+	size_t nUsed;
+	Bytes oFile;
+
+	_ts_packet(oFile, nPrefix, 0x0000, true, false, pat, sizeof(pat), &nUsed, &nCounters[0]);
+	_ts_packet(oFile, nPrefix, 0x1000, true, false, pmt, sizeof(pmt), &nUsed, &nCounters[0]);
+	for(int i = 0;i < FRAME_COUNT;++i) {
+		Bytes oFrame;
+
+		// frame 3 is only told apart as a key frame by its parameter sets
+		if(_key(i)) {
+			_annexb(oFrame, _sps, sizeof(_sps));
+			_annexb(oFrame, _pps, sizeof(_pps));
+		}
+		_append(oFrame, _frame_annexb(i));
+		_ts_pes(oFile, nPrefix, 0x100, 900000 + i * 3000, i == 0, oFrame, &nCounters[1]);
+		_ts_pes(oFile, nPrefix, 0x101, 900000 + i * 3000, false, Bytes(100, 0x22), &nCounters[2]);
+		if(i == 1)
+			oFile.insert(oFile.end(), 5, 0x00);
+	}
+	return oFile;
+}
+
+static void _test_ts() {
+	static const uint64_t oPts[FRAME_COUNT] = { 0, 33333, 66666, 100000, 133333 };
+
+	// every key frame carries its parameter sets in band, none are added
+	for(int nPrefix = 0;nPrefix <= 4;nPrefix += 4) {
+		std::string oPath = _write_file(_ts_file(nPrefix));
+		NvDemuxer* pDemuxer = NvDemuxer::createDemuxer(oPath.c_str());
+		static uint8_t oBuf[BUFFER_SIZE];
+		NvDemuxerSample oSample;
+
+		CHECK(pDemuxer != NULL);
+		if(! pDemuxer) {
+			unlink(oPath.c_str());
+			continue;
+		}
+		CHECK(strcmp(pDemuxer->getFormatName(), "MPEG-TS") == 0);
+		CHECK(pDemuxer->getCodec() == NV_DEMUXER_CODEC_H264);
+		CHECK(pDemuxer->getDuration() == oPts[FRAME_COUNT - 1]);
+
+		for(int nPass = 0;nPass < 2;++nPass) {
+			for(int i = nPass ? 3 : 0;i < FRAME_COUNT;++i) {
+				Bytes oExpected;
+
+				if(_key(i)) {
+					_annexb(oExpected, _sps, sizeof(_sps));
+					_annexb(oExpected, _pps, sizeof(_pps));
+				}
+				_append(oExpected, _frame_annexb(i));
+				CHECK(pDemuxer->readSample(oBuf, sizeof(oBuf), &oSample) == 1);
+				CHECK(oSample.size == oExpected.size() && memcmp(oBuf, &oExpected[0], oSample.size) == 0);
+				CHECK(oSample.pts == oPts[i]);
+				CHECK(oSample.key_frame == _key(i));
+			}
+			CHECK(pDemuxer->readSample(oBuf, sizeof(oBuf), &oSample) == 0);
+			CHECK(pDemuxer->seek(oPts[4]) == 0);
+		}
+
+		CHECK(pDemuxer->seek(0) == 0);
+		CHECK(pDemuxer->readSample(oBuf, sizeof(oBuf), &oSample) == 1 && oSample.pts == 0);
+		delete pDemuxer;
+		unlink(oPath.c_str());
+	}
+}
+
+static void _test_errors() {
+	Bytes oFile;
+	std::string oPath;
+
+	// not a container
+	oFile.assign(1000, 0x00);
+	oPath = _write_file(oFile);
+	CHECK(NvDemuxer::createDemuxer(oPath.c_str()) == NULL);
+	unlink(oPath.c_str());
+
+	// a movie box without tracks
+	oFile = _box("ftyp", Bytes(8, 0));
+	_append(oFile, _box("moov", Bytes()));
+	oPath = _write_file(oFile);
+	CHECK(NvDemuxer::createDemuxer(oPath.c_str()) == NULL);
+	unlink(oPath.c_str());
+
+	// a truncated movie box
+	oFile = _mp4_file();
+	oFile.resize(oFile.size() - 10);
+	oPath = _write_file(oFile);
+	CHECK(NvDemuxer::createDemuxer(oPath.c_str()) == NULL);
+	unlink(oPath.c_str());
+
+	// transport stream without program tables
+	oFile.clear();
+	for(int i = 0;i < 10;++i) {
+		int nCounter = 0;
+		size_t nUsed;
+		_ts_packet(oFile, 0, 0x100, false, false, NULL, 0, &nUsed, &nCounter);
+	}
+	oPath = _write_file(oFile);
+	CHECK(NvDemuxer::createDemuxer(oPath.c_str()) == NULL);
+	unlink(oPath.c_str());
+
+	CHECK(NvDemuxer::createDemuxer("/nonexistent/file.mp4") == NULL);
+}
+
+int main(int argc, char *argv[]) {
+	_test_mp4();
+	_test_mkv();
+	_test_ts();
+	_test_errors();
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include "NvFrameTracer.h"
+#include "zztest.h"
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ZZ_INIT_LOG("test_nvframetracer");
+
+#define BUSY_THREADS 4
+#define BUSY_EVENTS 4096
+
+static std::string _read_file(const char* pPath) {
+	std::string oContent;
+	char oBuf[4096];
+	FILE* pFile = fopen(pPath, "r");
+	size_t nRead;
+
+	if(! pFile)
+		return oContent;
+	while((nRead = fread(oBuf, 1, sizeof(oBuf), pFile)) > 0)
+		oContent.append(oBuf, nRead);
+	fclose(pFile);
+	return oContent;
+}
+
+static int _count(const std::string& oStr, const char* pNeedle) {
+	int nCount = 0;
+
+	for(size_t nPos = oStr.find(pNeedle);nPos != std::string::npos;nPos = oStr.find(pNeedle, nPos + 1))
+		nCount++;
+	return nCount;
+}
+
+static std::string _dump(int* pEvents) {
+	char oPath[] = "/tmp/nvframetracerXXXXXX";
+	int nFD = mkstemp(oPath);
+	close(nFD);
+
+	*pEvents = NvFrameTracer::getTracerInstance().dumpChromeTrace(oPath);
+	std::string oContent = _read_file(oPath);
+	unlink(oPath);
+	return oContent;
+}
+
+static void _test_frame_ids() {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+
+	uint64_t nID = oTracer.getFrameId(1, 33333);
+	CHECK(nID != 0);
+	CHECK(oTracer.getFrameId(1, 33333) == nID);
+	CHECK(oTracer.getFrameId(2, 33333) != nID);
+	CHECK(oTracer.getFrameId(1, 66666) != nID);
+	CHECK(oTracer.getFrameId(1, 33333) == nID);
+}
+
+static void _test_disabled() {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+	int nEvents;
+
+	CHECK(! oTracer.isEnabled());
+	oTracer.trace(0, 0, "off", NvFrameTracer::TRACE_INSTANT);
+	std::string oJson = _dump(&nEvents);
+	CHECK(nEvents == 0);
+	CHECK(oJson.find("\"traceEvents\":[") != std::string::npos);
+	CHECK(oJson.find("\"name\":\"process_name\"") != std::string::npos);
+	CHECK(oTracer.dumpChromeTrace("/nonexistent/dir/trace.json") == -1);
+}
+
+static void* _ring_proc(void* pArg) {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+
+	pthread_setname_np(pthread_self(), "ring \"1\"");
+	for(int i = 0;i < 300;++i) {
+		oTracer.trace(3, i, "ring", NvFrameTracer::TRACE_BEGIN);
+	}
+	return NULL;
+}
+
+static void _test_ring() {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+	pthread_t oThread;
+	int nEvents;
+
+	// rounded up to 128, the newest events are kept
+	oTracer.enable(100);
+	CHECK(oTracer.isEnabled());
+	pthread_create(&oThread, NULL, _ring_proc, NULL);
+	pthread_join(oThread, NULL);
+
+	std::string oJson = _dump(&nEvents);
+	CHECK(nEvents == 128);
+	CHECK(_count(oJson, "\"cat\":\"ring\"") == 128);
+	CHECK(_count(oJson, "\"ph\":\"b\"") == 128);
+	CHECK(oJson.find("\"args\":{\"name\":\"ring \\\"1\\\"\"}") != std::string::npos);
+	CHECK(oJson.find("\"stream\":3,\"timestamp\":171}") == std::string::npos);
+	CHECK(oJson.find("\"stream\":3,\"timestamp\":172}") != std::string::npos);
+	CHECK(oJson.find("\"stream\":3,\"timestamp\":299}") != std::string::npos);
+
+	// the frame of a (stream, timestamp) keeps its ID
+	char oID[64];
+	snprintf(oID, sizeof(oID), "\"id\":\"0x%llx\"", (unsigned long long)oTracer.getFrameId(3, 299));
+	CHECK(oJson.find(oID) != std::string::npos);
+}
+
+static void* _busy_proc(void* pArg) {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+
+	for(int i = 0;i < BUSY_EVENTS * 3;++i) {
+		oTracer.trace(4, i / 2, "busy", (i & 1) ? NvFrameTracer::TRACE_END : NvFrameTracer::TRACE_BEGIN);
+	}
+	return NULL;
+}
+
+static void _test_concurrent() {
+	NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+	pthread_t oThreads[BUSY_THREADS];
+	int nEvents;
+
+	// dumps never wait for the writers, events overwritten meanwhile are left out
+	oTracer.enable(BUSY_EVENTS);
+	for(int i = 0;i < BUSY_THREADS;++i) {
+		pthread_create(&oThreads[i], NULL, _busy_proc, NULL);
+	}
+	for(int i = 0;i < 10;++i) {
+		std::string oJson = _dump(&nEvents);
+		CHECK(nEvents >= 128 && nEvents <= 128 + BUSY_THREADS * BUSY_EVENTS);
+		CHECK(_count(oJson, "\"cat\":\"busy\"") == nEvents - 128);
+	}
+	for(int i = 0;i < BUSY_THREADS;++i) {
+		pthread_join(oThreads[i], NULL);
+	}
+
+	std::string oJson = _dump(&nEvents);
+	CHECK(nEvents == 128 + BUSY_THREADS * BUSY_EVENTS);
+	CHECK(_count(oJson, "\"ph\":\"e\",\"cat\":\"busy\"") == BUSY_THREADS * BUSY_EVENTS / 2);
+
+	oTracer.enable(0);
+	CHECK(! oTracer.isEnabled());
+}
+
+int main(int argc, char *argv[]) {
+	_test_frame_ids();
+	_test_disabled();
+	_test_ring();
+	_test_concurrent();
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include "zznvcodec.h"
 #include "ZzLog.h"
+#include "NvNalScanner.h"
 #include <unistd.h>
 #include <fstream>
 #include <vector>
@@ -9,32 +10,15 @@
 ZZ_INIT_LOG("test_zznvdec");
 
 #define CHUNK_SIZE 4000000
-
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-		!buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-		(buffer_ptr[2] == 1))
-
-#define H264_NAL_UNIT_CODED_SLICE  1
-#define H264_NAL_UNIT_CODED_SLICE_IDR  5
-
-#define IS_H264_NAL_CODED_SLICE(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE)
-#define IS_H264_NAL_CODED_SLICE_IDR(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE_IDR)
-
-#define GET_H265_NAL_UNIT_TYPE(buffer_ptr) ((buffer_ptr[0] & 0x7E) >> 1)
+#define IVF_FILE_HDR_SIZE 32
+#define IVF_FRAME_HDR_SIZE 12
 
 using namespace std;
 
-static int read_decoder_input_nalu(ifstream * stream, char* nalu, int* nalu_size,
+static int read_decoder_input_nalu(ifstream * stream, NvNalCodec codec, char* nalu, int* nalu_size,
 		char *parse_buffer, streamsize parse_buffer_size)
 {
-	// Length is the size of the buffer in bytes
-	char *buffer_ptr = (char *) nalu;
-	int h265_nal_unit_type;
-	char *stream_ptr;
-	bool nalu_found = false;
-
+	NvNalUnit oUnit;
 	streamsize bytes_read;
 	streamsize stream_initial_pos = stream->tellg();
 
@@ -46,57 +30,72 @@ static int read_decoder_input_nalu(ifstream * stream, char* nalu, int* nalu_size
 		return (*nalu_size = 0);
 	}
 
-	// Find the first NAL unit in the buffer
-	stream_ptr = parse_buffer;
-	while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-	{
-		nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-					IS_NAL_UNIT_START1(stream_ptr);
-		if (nalu_found)
-		{
-			break;
-		}
-		stream_ptr++;
-	}
-
-	// Reached end of buffer but could not find NAL unit
-	if (!nalu_found)
+	// A NAL unit running to the end of the buffer has no following start code
+	if (nv_nal_scan_units((const uint8_t *)parse_buffer, bytes_read, codec, &oUnit, 1) != 1 ||
+		(streamsize)(oUnit.offset + oUnit.size) >= bytes_read)
 	{
 		LOGE("%s(%d): Could not read nal unit from file. EOF or file corrupted", __FUNCTION__, __LINE__);
 		return -1;
 	}
 
-	memcpy(buffer_ptr, stream_ptr, 4);
-	buffer_ptr += 4;
-	*nalu_size = 4;
-	stream_ptr += 4;
+	memcpy(nalu, parse_buffer + oUnit.offset, oUnit.size);
+	*nalu_size = (int)oUnit.size;
 
-	// Copy bytes till the next NAL unit is found
-	while ((stream_ptr - parse_buffer) < (bytes_read - 3))
+	if(stream->eof())
 	{
-		if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-		{
-			streamsize seekto = stream_initial_pos +
-					(stream_ptr - parse_buffer);
-			if(stream->eof())
-			{
-				stream->clear();
-			}
-			stream->seekg(seekto, stream->beg);
-			return 0;
+		stream->clear();
+	}
+	stream->seekg(stream_initial_pos + (streamsize)(oUnit.offset + oUnit.size), stream->beg);
+	return 0;
+}
+
+// VP8/VP9: one frame per call, the IVF file header is skipped on the first one
+static int read_decoder_input_ivf(ifstream * stream, char* frame, int* frame_size, int frame_buffer_size)
+{
+	uint8_t header[IVF_FILE_HDR_SIZE];
+
+	if(stream->tellg() == 0) {
+		stream->read((char*)header, IVF_FILE_HDR_SIZE);
+		if(stream->gcount() != IVF_FILE_HDR_SIZE || memcmp(header, "DKIF", 4) != 0) {
+			LOGE("%s(%d): not an IVF file", __FUNCTION__, __LINE__);
+			return -1;
 		}
-		*buffer_ptr = *stream_ptr;
-		buffer_ptr++;
-		stream_ptr++;
-		(*nalu_size)++;
 	}
 
-	// Reached end of buffer but could not find NAL unit
-	LOGE("%s(%d): Could not read nal unit from file. EOF or file corrupted", __FUNCTION__, __LINE__);
-	return -1;
+	stream->read((char*)header, IVF_FRAME_HDR_SIZE);
+	if(stream->gcount() == 0) {
+		return (*frame_size = 0);
+	}
+	if(stream->gcount() != IVF_FRAME_HDR_SIZE) {
+		LOGE("%s(%d): truncated IVF frame header", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	int size = header[0] | (header[1] << 8) | (header[2] << 16) | (header[3] << 24);
+	if(size <= 0 || size > frame_buffer_size) {
+		LOGE("%s(%d): unexpected IVF frame size %d", __FUNCTION__, __LINE__, size);
+		return -1;
+	}
+
+	stream->read(frame, size);
+	if(stream->gcount() != size) {
+		LOGE("%s(%d): truncated IVF frame", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	*frame_size = size;
+	return 0;
 }
 
+struct test_context_t {
+	zznvcodec_decoder_t* pDecoder;
+	int nFrames;
+};
+
 void _on_video_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	pContext->nFrames++;
 #if 0
 	LOGD("%s(%d): %d, frame={%dx%d(%d %p) %dx%d(%d %p) %dx%d(%d %p)}, %.2f\n", __FUNCTION__, __LINE__, pFrame->num_planes,
 		pFrame->planes[0].width, pFrame->planes[0].height, pFrame->planes[0].stride, pFrame->planes[0].ptr,
@@ -106,49 +105,130 @@ void _on_video_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr
 #endif
 }
 
+void _on_video_dmabuf(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	pContext->nFrames++;
+#if 0
+	LOGD("%s(%d): fd=%d, fmt=%d, layout=%d, %d, planes={%dx%d(%d) %dx%d(%d)}, %.2f\n", __FUNCTION__, __LINE__,
+		pFrame->fd, pFrame->color_format, pFrame->layout, pFrame->num_planes,
+		pFrame->planes[0].width, pFrame->planes[0].height, pFrame->planes[0].pitch,
+		pFrame->planes[1].width, pFrame->planes[1].height, pFrame->planes[1].pitch,
+		nTimestamp / 1000.0);
+#endif
+
+	zznvcodec_decoder_release_dmabuf(pContext->pDecoder, pFrame->release_handle);
+}
+
+void _on_format_change(zznvcodec_video_format_t* pFormat, intptr_t pUser) {
+	LOGD("%s(%d): %dx%d (coded %dx%d), color_format=%d", __FUNCTION__, __LINE__,
+		pFormat->width, pFormat->height, pFormat->coded_width, pFormat->coded_height, pFormat->color_format);
+}
+
 int main(int argc, char *argv[])
 {
-	for(int i = 0;;++i) {
-		zznvcodec_decoder_t* pDecoder = zznvcodec_decoder_new();
-
-		zznvcodec_decoder_set_video_property(pDecoder, 1920, 1080, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
-		int nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
-		zznvcodec_decoder_set_misc_property(pDecoder, ZZNVCODEC_PROP_ENCODER_PIX_FMT, (intptr_t)&nEncoderPixFmt);
-		zznvcodec_decoder_register_callbacks(pDecoder, _on_video_frame, 0);
-
-		zznvcodec_decoder_start(pDecoder);
-
-		int ret;
-		std::ifstream test_video_file(argv[1], std::ios::binary);
-		std::vector<char> nalu_parse_buffer(CHUNK_SIZE);
-
-		int64_t nLastLogTime = 0;
-		for(int t = 0;;++t) {
-			std::vector<char> nalu_buffer(CHUNK_SIZE);
-			int nalu_size;
-
-			ret = read_decoder_input_nalu(&test_video_file, &nalu_buffer[0], &nalu_size, &nalu_parse_buffer[0], nalu_parse_buffer.size());
-			if(ret == -1) break;
-			if(nalu_size == 0) {
-				LOGD("EOF");
-				break;
-			}
-
-			int64_t nTimestamp = t * 1000000LL / 60;
-			if(nTimestamp - nLastLogTime > 1000000LL) {
-				LOGD("%d: %.2f", i, nTimestamp / 1000.0);
-				nLastLogTime = nTimestamp;
-			}
-
-			zznvcodec_decoder_set_video_compression_buffer(pDecoder, (uint8_t*)&nalu_buffer[0], nalu_size, 0, nTimestamp);
-			usleep(1000000 / 60);
+	// test_zznvdec <file> [dmabuf] [h264|h265|vp8|vp9], one pass over the file, at least one frame has to come out
+	bool bDMABuf = false;
+	int nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
+
+	if(argc < 2) {
+		printf("usage: %s <file> [dmabuf] [h264|h265|vp8|vp9]\n", argv[0]);
+		return 1;
+	}
+	for(int i = 2;i < argc;++i) {
+		if(strcmp(argv[i], "dmabuf") == 0)
+			bDMABuf = true;
+		else if(strcmp(argv[i], "h264") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
+		else if(strcmp(argv[i], "h265") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H265;
+		else if(strcmp(argv[i], "vp8") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_VP8;
+		else if(strcmp(argv[i], "vp9") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_VP9;
+		else
+			LOGW("unknown option %s", argv[i]);
+	}
+	bool bIVF = (nEncoderPixFmt == ZZNVCODEC_PIXEL_FORMAT_VP8 || nEncoderPixFmt == ZZNVCODEC_PIXEL_FORMAT_VP9);
+	NvNalCodec nCodec = (nEncoderPixFmt == ZZNVCODEC_PIXEL_FORMAT_H265) ? NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
+
+	std::ifstream test_video_file(argv[1], std::ios::binary);
+	if(! test_video_file) {
+		LOGE("can not open %s", argv[1]);
+		printf("FAILED\n");
+		return 1;
+	}
+
+	test_context_t oContext;
+	memset(&oContext, 0, sizeof(oContext));
+
+	zznvcodec_decoder_t* pDecoder = zznvcodec_decoder_new();
+	oContext.pDecoder = pDecoder;
+
+	zznvcodec_decoder_set_video_property(pDecoder, 1920, 1080, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	zznvcodec_decoder_set_misc_property(pDecoder, ZZNVCODEC_PROP_ENCODER_PIX_FMT, (intptr_t)&nEncoderPixFmt);
+	if(bDMABuf) {
+		int nOutputMode = ZZNVCODEC_OUTPUT_MODE_DMABUF;
+		zznvcodec_decoder_set_misc_property(pDecoder, ZZNVCODEC_PROP_OUTPUT_MODE, (intptr_t)&nOutputMode);
+		zznvcodec_decoder_register_dmabuf_callbacks(pDecoder, _on_video_dmabuf, (intptr_t)&oContext);
+	} else {
+		zznvcodec_decoder_register_callbacks(pDecoder, _on_video_frame, (intptr_t)&oContext);
+	}
+	zznvcodec_decoder_register_format_callbacks(pDecoder, _on_format_change, 0);
+
+	int nStarted = zznvcodec_decoder_start(pDecoder);
+
+	int ret;
+	int nPackets = 0;
+	int nFailedPackets = 0;
+	std::vector<char> nalu_parse_buffer(CHUNK_SIZE);
+	std::vector<char> nalu_buffer(CHUNK_SIZE);
+
+	int64_t nLastLogTime = 0;
+	for(int t = 0;nStarted == 1;++t) {
+		int nalu_size;
+
+		if(bIVF)
+			ret = read_decoder_input_ivf(&test_video_file, &nalu_buffer[0], &nalu_size, nalu_buffer.size());
+		else
+			ret = read_decoder_input_nalu(&test_video_file, nCodec, &nalu_buffer[0], &nalu_size, &nalu_parse_buffer[0], nalu_parse_buffer.size());
+		if(ret == -1) break;
+		if(nalu_size == 0) {
+			LOGD("EOF");
+			break;
+		}
+
+		int64_t nTimestamp = t * 1000000LL / 60;
+		if(nTimestamp - nLastLogTime > 1000000LL) {
+			LOGD("%.2f", nTimestamp / 1000.0);
+			nLastLogTime = nTimestamp;
+		}
+
+		nPackets++;
+		if(zznvcodec_decoder_set_video_compression_buffer(pDecoder, (uint8_t*)&nalu_buffer[0], nalu_size, 0, nTimestamp) != ZZNVCODEC_RESULT_OK) {
+			LOGE("packet %d failed", t);
+			nFailedPackets++;
 		}
+		usleep(1000000 / 60);
+	}
 
+	// a short file may not have come out of the decoder yet
+	for(int i = 0;i < 100 && nStarted == 1 && oContext.nFrames == 0;++i) {
+		usleep(10000);
+	}
+
+	if(nStarted == 1)
 		zznvcodec_decoder_stop(pDecoder);
+	zznvcodec_decoder_delete(pDecoder);
+	pDecoder = NULL;
+
+	LOGI("%d packets, %d failed, %d frames", nPackets, nFailedPackets, oContext.nFrames);
 
-		zznvcodec_decoder_delete(pDecoder);
-		pDecoder = NULL;
+	if(nStarted != 1 || nPackets == 0 || nFailedPackets || oContext.nFrames == 0) {
+		printf("FAILED\n");
+		return 1;
 	}
 
+	printf("PASSED\n");
 	return 0;
 }
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <npp.h>
 #include <cuda_runtime.h>
+#include <nvbuf_utils.h>
 
 ZZ_INIT_LOG("test_zznvenc");
 
@@ -14,15 +15,100 @@ void _zznvcodec_encoder_on_video_packet(unsigned char* pBuffer, int nSize, int n
 	LOGD("pBuffer=%p, nSize=%d, nFlags=%d, nTimestamp=%.2f", pBuffer, nSize, nFlags, nTimestamp / 1000.0);
 }
 
+void _zznvcodec_encoder_on_video_packet_info(unsigned char* pBuffer, zznvcodec_encoder_packet_info_t* pInfo, int64_t nTimestamp, intptr_t pUser) {
+	LOGD("nTimestamp=%.2f, frame_type=%d, size=%d, avg_qp=%d (%d~%d), ref_frame_id=%d", nTimestamp / 1000.0,
+		pInfo->frame_type, pInfo->size, pInfo->avg_qp, pInfo->min_qp, pInfo->max_qp, pInfo->ref_frame_id);
+}
+
+void _zznvcodec_encoder_on_frame_done(int64_t nTimestamp, intptr_t pUser) {
+	LOGD("frame done, nTimestamp=%.2f", nTimestamp / 1000.0);
+}
+
+void _zznvcodec_encoder_on_dmabuf_release(int nFD, int64_t nReleaseHandle, int64_t nTimestamp, intptr_t pUser) {
+	LOGD("dmabuf released, nFD=%d, nReleaseHandle=%d, nTimestamp=%.2f", nFD, (int)nReleaseHandle, nTimestamp / 1000.0);
+}
+
 int main(int argc, char *argv[])
 {
-	zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new();
-	zznvcodec_encoder_set_video_property(pEnc, 1920, 1080, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	// test_zznvenc [h264|h265|vp8|vp9] [yuyv|yuyv-cpu|yuyv-npp|dmabuf|dmabuf-bl] [nonblock] [session]
 	int nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H264;
+	int nYUYVConverter = -1;
+	int nNonBlocking = 0;
+	bool bDMABuf = false;
+	bool bBlockLinear = false;
+	zznvcodec_session_t* pSession = NULL;
+	for(int i = 1;i < argc;++i) {
+		if(strcmp(argv[i], "h265") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_H265;
+		else if(strcmp(argv[i], "vp8") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_VP8;
+		else if(strcmp(argv[i], "vp9") == 0)
+			nEncoderPixFmt = ZZNVCODEC_PIXEL_FORMAT_VP9;
+		else if(strcmp(argv[i], "yuyv") == 0)
+			nYUYVConverter = ZZNVCODEC_YUYV_CONVERTER_VIC;
+		else if(strcmp(argv[i], "yuyv-cpu") == 0)
+			nYUYVConverter = ZZNVCODEC_YUYV_CONVERTER_CPU;
+		else if(strcmp(argv[i], "yuyv-npp") == 0)
+			nYUYVConverter = ZZNVCODEC_YUYV_CONVERTER_NPP;
+		else if(strcmp(argv[i], "dmabuf") == 0)
+			bDMABuf = true;
+		else if(strcmp(argv[i], "dmabuf-bl") == 0)
+			bDMABuf = bBlockLinear = true;
+		else if(strcmp(argv[i], "nonblock") == 0)
+			nNonBlocking = 1;
+		else if(strcmp(argv[i], "session") == 0 && ! pSession)
+			pSession = zznvcodec_session_new();
+	}
+
+	zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new();
+	zznvcodec_encoder_set_session(pEnc, pSession);
+	if(nYUYVConverter != -1) {
+		zznvcodec_encoder_set_video_property(pEnc, 1920, 1080, ZZNVCODEC_PIXEL_FORMAT_YUYV422);
+		zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_YUYV_CONVERTER, (intptr_t)&nYUYVConverter);
+	} else {
+		zznvcodec_encoder_set_video_property(pEnc, 1920, 1080, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	}
 	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_ENCODER_PIX_FMT, (intptr_t)&nEncoderPixFmt);
+	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_NONBLOCKING_INPUT, (intptr_t)&nNonBlocking);
 	zznvcodec_encoder_register_callbacks(pEnc, _zznvcodec_encoder_on_video_packet, (intptr_t)0);
+	zznvcodec_encoder_register_packet_info_callbacks(pEnc, _zznvcodec_encoder_on_video_packet_info, (intptr_t)0);
+	zznvcodec_encoder_register_frame_done_callbacks(pEnc, _zznvcodec_encoder_on_frame_done, (intptr_t)0);
+	zznvcodec_encoder_register_dmabuf_callbacks(pEnc, _zznvcodec_encoder_on_dmabuf_release, (intptr_t)0);
 	zznvcodec_encoder_start(pEnc);
 
+	// NvBuffers as they come from capture or decode, dmabuf-bl as the decoder outputs them, converted by
+	// VIC; their content never changes, so cycling them ahead of the release callback is harmless here
+	const int nDMABufs = 4;
+	zznvcodec_dmabuf_frame_t oDMABufFrames[nDMABufs];
+	memset(oDMABufFrames, 0, sizeof(oDMABufFrames));
+	if(bDMABuf) {
+		for(int i = 0;i < nDMABufs;++i) {
+			NvBufferCreateParams cParams;
+			memset(&cParams, 0, sizeof(cParams));
+			cParams.width = 1920;
+			cParams.height = 1080;
+			cParams.layout = bBlockLinear ? NvBufferLayout_BlockLinear : NvBufferLayout_Pitch;
+			cParams.colorFormat = bBlockLinear ? NvBufferColorFormat_NV12_ER : NvBufferColorFormat_YUV420;
+			cParams.nvbuf_tag = NvBufferTag_NONE;
+			cParams.payloadType = NvBufferPayload_SurfArray;
+			if(NvBufferCreateEx(&oDMABufFrames[i].fd, &cParams) != 0) {
+				LOGE("NvBufferCreateEx() failed");
+				return 1;
+			}
+			oDMABufFrames[i].release_handle = i;
+		}
+	}
+
+	// host memory, as it comes from a capture card
+	std::vector<uint8_t> oYUYV(1920 * 2 * 1080, 0x80);
+	zznvcodec_video_frame_t oYUYVFrame;
+	memset(&oYUYVFrame, 0, sizeof(oYUYVFrame));
+	oYUYVFrame.num_planes = 1;
+	oYUYVFrame.planes[0].width = 1920;
+	oYUYVFrame.planes[0].height = 1080;
+	oYUYVFrame.planes[0].ptr = &oYUYV[0];
+	oYUYVFrame.planes[0].stride = 1920 * 2;
+
 	zznvcodec_video_frame_t oVideoFrame;
 	oVideoFrame.num_planes = 3;
 
@@ -44,19 +130,64 @@ int main(int argc, char *argv[])
 	plane2.ptr = nppiMalloc_8u_C1(plane2.width, plane2.height, &plane2.stride);
 	LOGI("plane2.ptr = %p / %d", plane2.ptr, plane2.stride);
 
+	// a capture thread keeps its cadence and drops frames the encoder has no room for
+	int nDropped = 0;
 	for(int i = 0;i < 256;++i) {
 		LOGI("Frame %d", i);
-		zznvcodec_encoder_set_video_uncompression_buffer(pEnc, &oVideoFrame, 1 * 1000000L);
+		if(i == 128) {
+			// what a congestion controller does, halve the bitrate and restart from an IDR
+			int nBitRate = 4 * 1000000;
+			zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_BITRATE, (intptr_t)&nBitRate);
+			zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_FORCE_IDR, (intptr_t)NULL);
+		}
+		int ret;
+		if(bDMABuf)
+			ret = zznvcodec_encoder_set_video_dmabuf(pEnc, &oDMABufFrames[i % nDMABufs], i * 16667L);
+		else
+			ret = zznvcodec_encoder_set_video_uncompression_buffer(pEnc, nYUYVConverter != -1 ? &oYUYVFrame : &oVideoFrame, i * 16667L);
+		if(ret == ZZNVCODEC_RESULT_EAGAIN) {
+			nDropped++;
+		} else if(ret != ZZNVCODEC_RESULT_OK) {
+			LOGE("submitting frame %d failed, ret=%d", i, ret);
+			break;
+		}
+		if(nNonBlocking)
+			usleep(16667);
 	}
+	LOGI("%d frames dropped", nDropped);
 
 	zznvcodec_encoder_stop(pEnc);
 
+	if(pSession) {
+		// a restart takes every buffer from the pools
+		zznvcodec_encoder_start(pEnc);
+		zznvcodec_encoder_stop(pEnc);
+
+		zznvcodec_pool_stats_t oStats[8];
+		int nPools = zznvcodec_session_get_stats(pSession, oStats, 8);
+		for(int i = 0;i < nPools && i < 8;++i) {
+			LOGI("pool %dx%d format=%d layout=%d: in use %d, free %d, high water %d, allocations %lld, reuses %lld, %lld bytes",
+				oStats[i].width, oStats[i].height, oStats[i].color_format, oStats[i].layout,
+				oStats[i].buffers_in_use, oStats[i].buffers_free, oStats[i].buffers_high_water,
+				(long long)oStats[i].allocations, (long long)oStats[i].reuses, (long long)oStats[i].bytes);
+		}
+	}
+
 	zznvcodec_encoder_delete(pEnc);
 	pEnc = NULL;
 
+	if(bDMABuf) {
+		for(int i = 0;i < nDMABufs;++i) {
+			NvBufferDestroy(oDMABufFrames[i].fd);
+		}
+	}
+
 	nppiFree(plane0.ptr);
 	nppiFree(plane1.ptr);
 	nppiFree(plane2.ptr);
 
+	if(pSession)
+		zznvcodec_session_delete(pSession);
+
 	return 0;
 }
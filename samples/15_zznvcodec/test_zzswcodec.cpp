@@ -0,0 +1,426 @@
+#include "zznvcodec.h"
+#include "ZzLog.h"
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ZZ_INIT_LOG("test_zzswcodec");
+
+// not a multiple of 16, the SPS crops
+#define WIDTH 642
+#define HEIGHT 362
+#define FRAMES 60
+#define TRACE_STREAM 7
+
+static uint8_t _sample(int nPlane, int x, int y, int t) {
+	switch(nPlane) {
+	case 0: return (uint8_t)(x + 2 * y + 7 * t);
+	case 1: return (uint8_t)(3 * x + y + t);
+	default: return (uint8_t)(x + 5 * y + 3 * t);
+	}
+}
+
+static int _count(const std::string& oStr, const char* pNeedle) {
+	int nCount = 0;
+
+	for(size_t nPos = oStr.find(pNeedle);nPos != std::string::npos;nPos = oStr.find(pNeedle, nPos + 1))
+		nCount++;
+	return nCount;
+}
+
+// every frame went through the stages of both instances, correlated by timestamp
+static int _check_trace() {
+	char oPath[] = "/tmp/zzswcodec_traceXXXXXX";
+	int nFD = mkstemp(oPath);
+	close(nFD);
+
+	int nEvents = zznvcodec_trace_dump(oPath);
+	std::string oJson;
+	char oBuf[4096];
+	FILE* pFile = fopen(oPath, "r");
+	size_t nRead;
+	while(pFile && (nRead = fread(oBuf, 1, sizeof(oBuf), pFile)) > 0)
+		oJson.append(oBuf, nRead);
+	if(pFile)
+		fclose(pFile);
+	unlink(oPath);
+
+	const char* pStages[] = { "source", "encode", "enc.convert", "enc.deliver", "decode", "dec.transform", "dec.deliver" };
+	int nFailures = 0;
+	for(size_t i = 0;i < sizeof(pStages) / sizeof(pStages[0]);++i) {
+		std::string oCat = std::string("\"cat\":\"") + pStages[i] + "\"";
+		int nCount = _count(oJson, oCat.c_str());
+		int nExpected = (i == 0) ? FRAMES : FRAMES * 2;
+		if(nCount != nExpected) {
+			LOGE("%s: %d events, expected %d", pStages[i], nCount, nExpected);
+			nFailures++;
+		}
+	}
+
+	// frame 0 got the first frame ID
+	if(oJson.find("\"ph\":\"e\",\"cat\":\"decode\",\"name\":\"decode\",\"id\":\"0x1\"") == std::string::npos) {
+		LOGE("decode of frame 0 is not in the trace");
+		nFailures++;
+	}
+
+	LOGI("%d trace events", nEvents);
+	return nFailures;
+}
+
+struct test_context_t {
+	zznvcodec_decoder_t* pDec;
+	int nPackets;
+	int nFrames;
+	int nMismatches;
+	int nFormatChanges;
+	int nEncThreadMismatches;
+	int nDecThreadMismatches;
+};
+
+static int _nice;
+static std::vector<uint8_t> _first_packet;
+
+// the codec thread calling back runs with the policy set before start, on CPU 0 only
+static bool _check_thread_policy(const char* sName) {
+	char oName[16] = { 0 };
+	cpu_set_t oSet;
+
+	prctl(PR_GET_NAME, oName, 0, 0, 0);
+	if(strcmp(oName, sName) != 0) {
+		LOGE("thread name %s, expected %s", oName, sName);
+		return false;
+	}
+	CPU_ZERO(&oSet);
+	if(sched_getaffinity(0, sizeof(oSet), &oSet) != 0 || CPU_COUNT(&oSet) != 1 || ! CPU_ISSET(0, &oSet)) {
+		LOGE("%s is not bound to CPU 0 only", sName);
+		return false;
+	}
+	if(getpriority(PRIO_PROCESS, syscall(SYS_gettid)) != _nice) {
+		LOGE("%s runs at nice %d, expected %d", sName, getpriority(PRIO_PROCESS, syscall(SYS_gettid)), _nice);
+		return false;
+	}
+	return true;
+}
+
+void _zznvcodec_encoder_on_video_packet(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	LOGD("pBuffer=%p, nSize=%d, nFlags=%d, nTimestamp=%.2f", pBuffer, nSize, nFlags, nTimestamp / 1000.0);
+	pContext->nPackets++;
+	if(_first_packet.empty())
+		_first_packet.assign(pBuffer, pBuffer + nSize);
+	if(! _check_thread_policy("zzswenc"))
+		pContext->nEncThreadMismatches++;
+	if(zznvcodec_decoder_set_video_compression_buffer(pContext->pDec, pBuffer, nSize, 0, nTimestamp) != ZZNVCODEC_RESULT_OK) {
+		LOGE("zznvcodec_decoder_set_video_compression_buffer() failed");
+	}
+}
+
+void _zznvcodec_decoder_on_format_change(zznvcodec_video_format_t* pFormat, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	LOGI("format %dx%d, coded %dx%d", pFormat->width, pFormat->height, pFormat->coded_width, pFormat->coded_height);
+	pContext->nFormatChanges++;
+}
+
+void _zznvcodec_decoder_on_video_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+	int t = (int)(nTimestamp / 16667);
+	int nMismatches = 0;
+
+	pContext->nFrames++;
+	if(! _check_thread_policy("zzswdec"))
+		pContext->nDecThreadMismatches++;
+	for(int y = 0;y < HEIGHT;++y) {
+		const uint8_t* pRow = pFrame->planes[0].ptr + y * pFrame->planes[0].stride;
+		for(int x = 0;x < WIDTH;++x) {
+			if(pRow[x] != _sample(0, x, y, t))
+				nMismatches++;
+		}
+	}
+	for(int y = 0;y < HEIGHT / 2;++y) {
+		for(int x = 0;x < WIDTH / 2;++x) {
+			uint8_t u, v;
+			if(pFrame->num_planes == 2) {
+				u = pFrame->planes[1].ptr[y * pFrame->planes[1].stride + x * 2];
+				v = pFrame->planes[1].ptr[y * pFrame->planes[1].stride + x * 2 + 1];
+			} else {
+				u = pFrame->planes[1].ptr[y * pFrame->planes[1].stride + x];
+				v = pFrame->planes[2].ptr[y * pFrame->planes[2].stride + x];
+			}
+			if(u != _sample(1, x, y, t) || v != _sample(2, x, y, t))
+				nMismatches++;
+		}
+	}
+
+	if(nMismatches) {
+		LOGE("frame %d: %d samples differ", t, nMismatches);
+		pContext->nMismatches++;
+	}
+}
+
+static void _zznvcodec_encoder_on_restart_packet(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	pContext->nPackets++;
+	if(! _check_thread_policy("zzswenc"))
+		pContext->nEncThreadMismatches++;
+}
+
+static void _zznvcodec_decoder_on_restart_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	pContext->nFrames++;
+	if(! _check_thread_policy("zzswdec"))
+		pContext->nDecThreadMismatches++;
+}
+
+// a policy set while started is refused, not kept for the next start
+static int _test_thread_policy_restart(const zznvcodec_thread_policy_t& oThreadPolicy, zznvcodec_pixel_format_t nFormat) {
+	test_context_t oContext;
+	memset(&oContext, 0, sizeof(oContext));
+	_nice = getpriority(PRIO_PROCESS, 0);
+
+	zznvcodec_thread_policy_t oLatePolicy = oThreadPolicy;
+	oLatePolicy.cpu_mask = 2;
+	oLatePolicy.nice = _nice + 1;
+
+	std::vector<uint8_t> oPlanes[3];
+	zznvcodec_video_frame_t oVideoFrame;
+	memset(&oVideoFrame, 0, sizeof(oVideoFrame));
+	oVideoFrame.num_planes = 3;
+	for(int i = 0;i < 3;++i) {
+		zznvcodec_video_plane_t& plane = oVideoFrame.planes[i];
+		plane.width = i ? WIDTH / 2 : WIDTH;
+		plane.height = i ? HEIGHT / 2 : HEIGHT;
+		plane.stride = plane.width;
+		oPlanes[i].assign(plane.stride * plane.height, 0x80);
+		plane.ptr = &oPlanes[i][0];
+	}
+
+	zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	zznvcodec_encoder_set_video_property(pEnc, WIDTH, HEIGHT, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	zznvcodec_encoder_register_callbacks(pEnc, _zznvcodec_encoder_on_restart_packet, (intptr_t)&oContext);
+	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oThreadPolicy);
+	zznvcodec_encoder_start(pEnc);
+	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oLatePolicy);
+	zznvcodec_encoder_stop(pEnc);
+	zznvcodec_encoder_start(pEnc);
+	zznvcodec_encoder_set_video_uncompression_buffer(pEnc, &oVideoFrame, 0);
+	zznvcodec_encoder_stop(pEnc);
+	zznvcodec_encoder_delete(pEnc);
+
+	zznvcodec_decoder_t* pDec = zznvcodec_decoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	zznvcodec_decoder_set_video_property(pDec, WIDTH, HEIGHT, nFormat);
+	zznvcodec_decoder_register_callbacks(pDec, _zznvcodec_decoder_on_restart_frame, (intptr_t)&oContext);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oThreadPolicy);
+	zznvcodec_decoder_start(pDec);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oLatePolicy);
+	zznvcodec_decoder_stop(pDec);
+	zznvcodec_decoder_start(pDec);
+	if(! _first_packet.empty())
+		zznvcodec_decoder_set_video_compression_buffer(pDec, &_first_packet[0], _first_packet.size(), 0, 0);
+	for(int i = 0;i < 100 && oContext.nFrames < 1;++i) {
+		usleep(10000);
+	}
+	zznvcodec_decoder_stop(pDec);
+	zznvcodec_decoder_delete(pDec);
+
+	if(oContext.nPackets != 1 || oContext.nFrames != 1 || oContext.nEncThreadMismatches || oContext.nDecThreadMismatches) {
+		LOGE("restart: %d packets, %d frames, %d/%d callbacks off the thread policy",
+			oContext.nPackets, oContext.nFrames, oContext.nEncThreadMismatches, oContext.nDecThreadMismatches);
+		return 1;
+	}
+	return 0;
+}
+
+#define HELD_FRAMES 2
+
+struct held_frames_t {
+	zznvcodec_video_frame_t* pFrames[HELD_FRAMES + 1];
+	uint32_t nSums[HELD_FRAMES + 1];
+	int nFrames;
+};
+
+static uint32_t _sum(const zznvcodec_video_frame_t* pFrame) {
+	uint32_t nSum = 0;
+
+	for(int i = 0;i < pFrame->num_planes;++i) {
+		const zznvcodec_video_plane_t& plane = pFrame->planes[i];
+		for(int y = 0;y < plane.height;++y) {
+			for(int x = 0;x < plane.width;++x)
+				nSum = nSum * 31 + plane.ptr[y * plane.stride + x];
+		}
+	}
+	return nSum;
+}
+
+static void _zznvcodec_decoder_on_held_frame(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	held_frames_t* pHeld = (held_frames_t*)pUser;
+
+	if(pHeld->nFrames > HELD_FRAMES)
+		return;
+	zznvcodec_frame_ref(pFrame);
+	pHeld->pFrames[pHeld->nFrames] = pFrame;
+	pHeld->nSums[pHeld->nFrames] = _sum(pFrame);
+	pHeld->nFrames++;
+}
+
+// frames referenced by the consumer stall the decoder, and stay valid past stop and delete
+static int _test_frame_refs_across_stop(zznvcodec_pixel_format_t nFormat) {
+	held_frames_t oHeld;
+	memset(&oHeld, 0, sizeof(oHeld));
+	int nPoolSize = HELD_FRAMES;
+	int nFailures = 0;
+
+	zznvcodec_decoder_t* pDec = zznvcodec_decoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	zznvcodec_decoder_set_video_property(pDec, WIDTH, HEIGHT, nFormat);
+	zznvcodec_decoder_register_callbacks(pDec, _zznvcodec_decoder_on_held_frame, (intptr_t)&oHeld);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_FRAME_POOL_SIZE, (intptr_t)&nPoolSize);
+	zznvcodec_decoder_start(pDec);
+	for(int t = 0;t < HELD_FRAMES + 2 && ! _first_packet.empty();++t) {
+		zznvcodec_decoder_set_video_compression_buffer(pDec, &_first_packet[0], _first_packet.size(), 0, t * 16667L);
+	}
+
+	// the pool is held, the decoder waits for the consumer
+	for(int i = 0;i < 100 && oHeld.nFrames < HELD_FRAMES;++i) {
+		usleep(10000);
+	}
+	usleep(50000);
+	if(oHeld.nFrames != HELD_FRAMES) {
+		LOGE("%d frames with a pool of %d, expected the decoder to stall", oHeld.nFrames, HELD_FRAMES);
+		nFailures++;
+	}
+
+	// one frame back to the pool, one more decoded
+	if(oHeld.nFrames > 0) {
+		zznvcodec_frame_unref(oHeld.pFrames[0]);
+		oHeld.pFrames[0] = NULL;
+	}
+	for(int i = 0;i < 100 && oHeld.nFrames < HELD_FRAMES + 1;++i) {
+		usleep(10000);
+	}
+	if(oHeld.nFrames != HELD_FRAMES + 1) {
+		LOGE("%d frames after an unref, expected %d", oHeld.nFrames, HELD_FRAMES + 1);
+		nFailures++;
+	}
+
+	// stopped while stalled and still holding the pool
+	zznvcodec_decoder_stop(pDec);
+	zznvcodec_decoder_delete(pDec);
+
+	for(int i = 0;i < oHeld.nFrames;++i) {
+		if(! oHeld.pFrames[i])
+			continue;
+		zznvcodec_frame_ref(oHeld.pFrames[i]);
+		zznvcodec_frame_unref(oHeld.pFrames[i]);
+		if(_sum(oHeld.pFrames[i]) != oHeld.nSums[i]) {
+			LOGE("frame %d changed after the decoder was deleted", i);
+			nFailures++;
+		}
+		zznvcodec_frame_unref(oHeld.pFrames[i]);
+	}
+
+	return nFailures;
+}
+
+int main(int argc, char *argv[])
+{
+	// test_zzswcodec [nv12], encode and decode with the software backend, the frames have to come back bit-exact
+	zznvcodec_pixel_format_t nFormat = ZZNVCODEC_PIXEL_FORMAT_YUV420P;
+	for(int i = 1;i < argc;++i) {
+		if(strcmp(argv[i], "nv12") == 0)
+			nFormat = ZZNVCODEC_PIXEL_FORMAT_NV12;
+	}
+
+	test_context_t oContext;
+	memset(&oContext, 0, sizeof(oContext));
+
+	zznvcodec_trace_enable(4096);
+	int nTraceStream = TRACE_STREAM;
+
+	// run the codec threads on CPU 0 so the thread policy path is exercised, unprivileged
+	zznvcodec_thread_policy_t oThreadPolicy;
+	oThreadPolicy.cpu_mask = 1;
+	oThreadPolicy.sched_policy = SCHED_OTHER;
+	oThreadPolicy.sched_priority = 0;
+	oThreadPolicy.nice = ZZNVCODEC_NICE_KEEP;
+
+	zznvcodec_decoder_t* pDec = zznvcodec_decoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	oContext.pDec = pDec;
+	zznvcodec_decoder_set_video_property(pDec, WIDTH, HEIGHT, nFormat);
+	zznvcodec_decoder_register_callbacks(pDec, _zznvcodec_decoder_on_video_frame, (intptr_t)&oContext);
+	zznvcodec_decoder_register_format_callbacks(pDec, _zznvcodec_decoder_on_format_change, (intptr_t)&oContext);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oThreadPolicy);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_TRACE_STREAM, (intptr_t)&nTraceStream);
+	zznvcodec_decoder_start(pDec);
+
+	zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	zznvcodec_encoder_set_video_property(pEnc, WIDTH, HEIGHT, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	zznvcodec_encoder_register_callbacks(pEnc, _zznvcodec_encoder_on_video_packet, (intptr_t)&oContext);
+	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_THREAD_POLICY, (intptr_t)&oThreadPolicy);
+	zznvcodec_encoder_set_misc_property(pEnc, ZZNVCODEC_PROP_TRACE_STREAM, (intptr_t)&nTraceStream);
+	zznvcodec_encoder_start(pEnc);
+
+	std::vector<uint8_t> oPlanes[3];
+	zznvcodec_video_frame_t oVideoFrame;
+	memset(&oVideoFrame, 0, sizeof(oVideoFrame));
+	oVideoFrame.num_planes = 3;
+	for(int i = 0;i < 3;++i) {
+		zznvcodec_video_plane_t& plane = oVideoFrame.planes[i];
+		plane.width = i ? WIDTH / 2 : WIDTH;
+		plane.height = i ? HEIGHT / 2 : HEIGHT;
+		plane.stride = plane.width + 32;
+		oPlanes[i].resize(plane.stride * plane.height);
+		plane.ptr = &oPlanes[i][0];
+	}
+
+	for(int t = 0;t < FRAMES;++t) {
+		for(int i = 0;i < 3;++i) {
+			zznvcodec_video_plane_t& plane = oVideoFrame.planes[i];
+			for(int y = 0;y < plane.height;++y) {
+				for(int x = 0;x < plane.width;++x)
+					plane.ptr[y * plane.stride + x] = _sample(i, x, y, t);
+			}
+		}
+		zznvcodec_trace_event(TRACE_STREAM, t * 16667L, "source", ZZNVCODEC_TRACE_INSTANT);
+		if(zznvcodec_encoder_set_video_uncompression_buffer(pEnc, &oVideoFrame, t * 16667L) != ZZNVCODEC_RESULT_OK) {
+			LOGE("submitting frame %d failed", t);
+			break;
+		}
+	}
+
+	// the encoder drains on stop, the decoder drops what is still queued
+	zznvcodec_encoder_stop(pEnc);
+	zznvcodec_encoder_delete(pEnc);
+	for(int i = 0;i < 100 && oContext.nFrames < oContext.nPackets;++i) {
+		usleep(10000);
+	}
+	zznvcodec_decoder_stop(pDec);
+	zznvcodec_decoder_delete(pDec);
+
+	LOGI("%d packets, %d frames, %d format changes, %d frames differ, %d/%d callbacks off the thread policy",
+		oContext.nPackets, oContext.nFrames, oContext.nFormatChanges, oContext.nMismatches,
+		oContext.nEncThreadMismatches, oContext.nDecThreadMismatches);
+
+	int nTraceFailures = _check_trace();
+	int nRestartFailures = _test_thread_policy_restart(oThreadPolicy, nFormat);
+	int nHeldFailures = _test_frame_refs_across_stop(nFormat);
+
+	if(oContext.nPackets != FRAMES || oContext.nFrames != FRAMES || oContext.nFormatChanges != 1 || oContext.nMismatches ||
+		oContext.nEncThreadMismatches || oContext.nDecThreadMismatches || nTraceFailures || nRestartFailures ||
+		nHeldFailures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
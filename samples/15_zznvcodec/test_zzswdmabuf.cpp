@@ -0,0 +1,343 @@
+#include "zznvcodec_backend.h"
+#include "zztest.h"
+#include "nvbuf_utils.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ZZ_INIT_LOG("test_zzswdmabuf");
+
+// DMABUF output of the software decoder: the consumer holds frames, the decoder stalls on them and
+// refuses release handles of buffers gone with a resolution change or Stop()
+#define WIDTH_A 642
+#define HEIGHT_A 362
+#define FRAMES_A 4
+#define WIDTH_B 320
+#define HEIGHT_B 240
+#define FRAMES_B 5
+#define T_B 100			// first frame number of stream B
+#define POOL_SIZE 3
+#define WAIT_MS 2000
+#define STALL_MS 200
+
+struct packet_t {
+	std::vector<uint8_t> mData;
+	int64_t mTimestamp;
+};
+
+struct held_frame_t {
+	int nFD;
+	int nT;
+	int64_t nReleaseHandle;
+};
+
+struct test_context_t {
+	pthread_mutex_t mLock;
+	std::vector<held_frame_t> mFrames;		// every frame delivered, in order
+	int nFormatChanges;
+	int nLastWidth;
+	int nLastHeight;
+	int nColorFormat;
+	int nMismatches;
+};
+
+static uint8_t _sample(int nPlane, int x, int y, int t) {
+	switch(nPlane) {
+	case 0: return (uint8_t)(x + 2 * y + 7 * t);
+	case 1: return (uint8_t)(3 * x + y + t);
+	default: return (uint8_t)(x + 5 * y + 3 * t);
+	}
+}
+
+static void _on_packet(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp, intptr_t pUser) {
+	std::vector<packet_t>* pPackets = (std::vector<packet_t>*)pUser;
+
+	pPackets->push_back(packet_t());
+	pPackets->back().mData.assign(pBuffer, pBuffer + nSize);
+	pPackets->back().mTimestamp = nTimestamp;
+}
+
+static void _encode(std::vector<packet_t>& oPackets, int nWidth, int nHeight, int nFirst, int nFrames) {
+	zznvcodec_encoder_t* pEnc = zznvcodec_encoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	zznvcodec_encoder_set_video_property(pEnc, nWidth, nHeight, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	zznvcodec_encoder_register_callbacks(pEnc, _on_packet, (intptr_t)&oPackets);
+	zznvcodec_encoder_start(pEnc);
+
+	std::vector<uint8_t> oPlanes[3];
+	zznvcodec_video_frame_t oVideoFrame;
+	memset(&oVideoFrame, 0, sizeof(oVideoFrame));
+	oVideoFrame.num_planes = 3;
+	for(int i = 0;i < 3;++i) {
+		zznvcodec_video_plane_t& plane = oVideoFrame.planes[i];
+		plane.width = i ? nWidth / 2 : nWidth;
+		plane.height = i ? nHeight / 2 : nHeight;
+		plane.stride = plane.width;
+		oPlanes[i].resize(plane.stride * plane.height);
+		plane.ptr = &oPlanes[i][0];
+	}
+
+	for(int t = nFirst;t < nFirst + nFrames;++t) {
+		for(int i = 0;i < 3;++i) {
+			zznvcodec_video_plane_t& plane = oVideoFrame.planes[i];
+			for(int y = 0;y < plane.height;++y) {
+				for(int x = 0;x < plane.width;++x)
+					plane.ptr[y * plane.stride + x] = _sample(i, x, y, t);
+			}
+		}
+		zznvcodec_encoder_set_video_uncompression_buffer(pEnc, &oVideoFrame, t * 16667L);
+	}
+
+	zznvcodec_encoder_stop(pEnc);
+	zznvcodec_encoder_delete(pEnc);
+}
+
+static void _on_format_change(zznvcodec_video_format_t* pFormat, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+
+	LOGI("format %dx%d, color_format %d", pFormat->width, pFormat->height, pFormat->color_format);
+	pthread_mutex_lock(&pContext->mLock);
+	pContext->nFormatChanges++;
+	pContext->nLastWidth = pFormat->width;
+	pContext->nLastHeight = pFormat->height;
+	pContext->nColorFormat = pFormat->color_format;
+	pthread_mutex_unlock(&pContext->mLock);
+}
+
+// the frame is read through its own mapping of the fd, as a consumer in another process would
+static void _on_video_dmabuf(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser) {
+	test_context_t* pContext = (test_context_t*)pUser;
+	int t = (int)(nTimestamp / 16667);
+	int nMismatches = 0;
+	int nWidth = pFrame->planes[0].width;
+	int nHeight = pFrame->planes[0].height;
+	size_t nSize = pFrame->planes[pFrame->num_planes - 1].offset + pFrame->planes[pFrame->num_planes - 1].size;
+
+	uint8_t* pBase = (uint8_t*)mmap(NULL, nSize, PROT_READ, MAP_SHARED, pFrame->fd, 0);
+	if(pBase == MAP_FAILED || pFrame->num_planes != 3 || pFrame->layout != NvBufferLayout_Pitch ||
+		pFrame->color_format != NvBufferColorFormat_YUV420) {
+		LOGE("frame %d: fd %d, %d planes, layout %d, color_format %d", t, pFrame->fd, pFrame->num_planes,
+			pFrame->layout, pFrame->color_format);
+		nMismatches++;
+	} else {
+		for(int i = 0;i < 3;++i) {
+			const zznvcodec_dmabuf_plane_t& plane = pFrame->planes[i];
+			int nPlaneWidth = i ? nWidth / 2 : nWidth;
+			int nPlaneHeight = i ? nHeight / 2 : nHeight;
+			for(int y = 0;y < nPlaneHeight;++y) {
+				const uint8_t* pRow = pBase + plane.offset + y * plane.pitch;
+				for(int x = 0;x < nPlaneWidth;++x) {
+					if(pRow[x] != _sample(i, x, y, t))
+						nMismatches++;
+				}
+			}
+		}
+		munmap(pBase, nSize);
+	}
+
+	held_frame_t oFrame;
+	oFrame.nFD = pFrame->fd;
+	oFrame.nT = t;
+	oFrame.nReleaseHandle = pFrame->release_handle;
+
+	pthread_mutex_lock(&pContext->mLock);
+	pContext->mFrames.push_back(oFrame);
+	if(nMismatches) {
+		LOGE("frame %d: %d samples differ", t, nMismatches);
+		pContext->nMismatches++;
+	}
+	pthread_mutex_unlock(&pContext->mLock);
+}
+
+static int _frames(test_context_t& oContext) {
+	pthread_mutex_lock(&oContext.mLock);
+	int nFrames = (int)oContext.mFrames.size();
+	pthread_mutex_unlock(&oContext.mLock);
+
+	return nFrames;
+}
+
+static held_frame_t _frame(test_context_t& oContext, int nIndex) {
+	pthread_mutex_lock(&oContext.mLock);
+	held_frame_t oFrame = oContext.mFrames[nIndex];
+	pthread_mutex_unlock(&oContext.mLock);
+
+	return oFrame;
+}
+
+static bool _wait_frames(test_context_t& oContext, int nFrames) {
+	for(int i = 0;i < WAIT_MS / 10;++i) {
+		if(_frames(oContext) >= nFrames)
+			return true;
+		usleep(10000);
+	}
+	LOGE("%d frames, expected %d", _frames(oContext), nFrames);
+	return false;
+}
+
+// the decoder delivers nothing beyond nFrames while it waits for a release
+static bool _stalled_at(test_context_t& oContext, int nFrames) {
+	usleep(STALL_MS * 1000);
+	return _frames(oContext) == nFrames;
+}
+
+static void _feed(zznvcodec_decoder_t* pDec, const packet_t& oPacket) {
+	if(zznvcodec_decoder_set_video_compression_buffer(pDec, (unsigned char*)&oPacket.mData[0], oPacket.mData.size(), 0,
+		oPacket.mTimestamp) != ZZNVCODEC_RESULT_OK) {
+		LOGE("zznvcodec_decoder_set_video_compression_buffer() failed");
+		_failures++;
+	}
+}
+
+// a handle given out 2^24 holds (the old serial width) or 2^31 holds (a 32-bit intptr_t) later is still unique
+static void _test_release_handles() {
+	zznvcodec_dmabuf_holds_t oHolds;
+
+	int64_t nFirst = oHolds.Hold(1);
+	pthread_mutex_lock(&oHolds.mLock);
+	CHECK(oHolds.ReleaseLocked(nFirst, POOL_SIZE) == 1);
+	pthread_mutex_unlock(&oHolds.mLock);
+
+	oHolds.mSerial += (1 << 24) - 1;
+	int64_t nWrapped = oHolds.Hold(1);
+	CHECK(nWrapped != nFirst);
+	pthread_mutex_lock(&oHolds.mLock);
+	CHECK(oHolds.ReleaseLocked(nFirst, POOL_SIZE) == -1);
+	CHECK(oHolds.ReleaseLocked(nWrapped, POOL_SIZE) == 1);
+	pthread_mutex_unlock(&oHolds.mLock);
+
+	oHolds.mSerial = INT32_MAX;
+	int64_t nLarge = oHolds.Hold(2);
+	CHECK(nLarge > 0);
+	pthread_mutex_lock(&oHolds.mLock);
+	CHECK(oHolds.ReleaseLocked(nLarge, POOL_SIZE) == 2);
+	pthread_mutex_unlock(&oHolds.mLock);
+}
+
+int main(int argc, char *argv[])
+{
+	// a release that frees a buffer twice, or a Stop() waiting on the consumer, hangs; fail instead
+	alarm(60);
+
+	_test_release_handles();
+
+	std::vector<packet_t> oPacketsA, oPacketsB;
+	_encode(oPacketsA, WIDTH_A, HEIGHT_A, 0, FRAMES_A);
+	_encode(oPacketsB, WIDTH_B, HEIGHT_B, T_B, FRAMES_B);
+	CHECK(oPacketsA.size() == FRAMES_A);
+	CHECK(oPacketsB.size() == FRAMES_B);
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	test_context_t oContext;
+	pthread_mutex_init(&oContext.mLock, NULL);
+	oContext.nFormatChanges = 0;
+	oContext.nLastWidth = 0;
+	oContext.nLastHeight = 0;
+	oContext.nColorFormat = -1;
+	oContext.nMismatches = 0;
+
+	zznvcodec_session_t* pSession = zznvcodec_session_new();
+	zznvcodec_decoder_t* pDec = zznvcodec_decoder_new_with_backend(ZZNVCODEC_BACKEND_SW);
+	int nOutputMode = ZZNVCODEC_OUTPUT_MODE_DMABUF;
+	int nPoolSize = POOL_SIZE;
+	zznvcodec_decoder_set_video_property(pDec, WIDTH_A, HEIGHT_A, ZZNVCODEC_PIXEL_FORMAT_YUV420P);
+	zznvcodec_decoder_set_session(pDec, pSession);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_OUTPUT_MODE, (intptr_t)&nOutputMode);
+	zznvcodec_decoder_set_misc_property(pDec, ZZNVCODEC_PROP_FRAME_POOL_SIZE, (intptr_t)&nPoolSize);
+	zznvcodec_decoder_register_dmabuf_callbacks(pDec, _on_video_dmabuf, (intptr_t)&oContext);
+	zznvcodec_decoder_register_format_callbacks(pDec, _on_format_change, (intptr_t)&oContext);
+	CHECK(zznvcodec_decoder_start(pDec) == 1);
+
+	// A0..A2 fill the pool, A3 waits until A0 comes back and reuses its buffer
+	for(int i = 0;i < FRAMES_A;++i)
+		_feed(pDec, oPacketsA[i]);
+	CHECK(_wait_frames(oContext, POOL_SIZE));
+	CHECK(_stalled_at(oContext, POOL_SIZE));
+	CHECK(oContext.nFormatChanges == 1 && oContext.nLastWidth == WIDTH_A && oContext.nLastHeight == HEIGHT_A);
+	CHECK(oContext.nColorFormat == NvBufferColorFormat_YUV420);
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 0).nReleaseHandle);
+	CHECK(_wait_frames(oContext, FRAMES_A));
+	CHECK(_frame(oContext, 3).nFD == _frame(oContext, 0).nFD);
+	CHECK(_frame(oContext, 3).nT == FRAMES_A - 1);
+
+	// a handle released twice is refused, A3 holding the same buffer stays held
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 0).nReleaseHandle);
+
+	// B0 changes the resolution, the switch waits until A1..A3 are released
+	_feed(pDec, oPacketsB[0]);
+	CHECK(_stalled_at(oContext, FRAMES_A));
+	CHECK(oContext.nFormatChanges == 1);
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 1).nReleaseHandle);
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 2).nReleaseHandle);
+	CHECK(_stalled_at(oContext, FRAMES_A));
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 3).nReleaseHandle);
+	CHECK(_wait_frames(oContext, FRAMES_A + 1));
+	CHECK(oContext.nFormatChanges == 2 && oContext.nLastWidth == WIDTH_B && oContext.nLastHeight == HEIGHT_B);
+
+	// B0..B2 fill the new buffers. A handle of the old ones with the index of B0 must not free it,
+	// else B3 would be delivered.
+	_feed(pDec, oPacketsB[1]);
+	_feed(pDec, oPacketsB[2]);
+	CHECK(_wait_frames(oContext, FRAMES_A + POOL_SIZE));
+	_feed(pDec, oPacketsB[3]);
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, 3).nReleaseHandle);
+	CHECK(_stalled_at(oContext, FRAMES_A + POOL_SIZE));
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, FRAMES_A).nReleaseHandle);
+	CHECK(_wait_frames(oContext, FRAMES_A + POOL_SIZE + 1));
+	CHECK(_frame(oContext, FRAMES_A + POOL_SIZE).nT == T_B + 3);
+
+	// B1..B3 held and the decoder thread waiting with B4, Stop() returns anyway
+	_feed(pDec, oPacketsB[4]);
+	CHECK(_stalled_at(oContext, FRAMES_A + POOL_SIZE + 1));
+	zznvcodec_decoder_stop(pDec);
+
+	zznvcodec_pool_stats_t oStats[4];
+	int nPools = zznvcodec_session_get_stats(pSession, oStats, 4);
+	int nInUse = 0;
+	for(int i = 0;i < nPools && i < 4;++i)
+		nInUse += oStats[i].buffers_in_use;
+	CHECK(nPools >= 1);
+	CHECK(nInUse == 0);
+
+	// restarted, A0..A2 fill the pool again; the handles of B1..B3 from before Stop() are refused
+	int nRestart = _frames(oContext);
+	CHECK(zznvcodec_decoder_start(pDec) == 1);
+	for(int i = 0;i < POOL_SIZE;++i)
+		_feed(pDec, oPacketsA[i]);
+	CHECK(_wait_frames(oContext, nRestart + POOL_SIZE));
+	CHECK(oContext.nFormatChanges == 3);
+	_feed(pDec, oPacketsA[3]);
+	for(int i = FRAMES_A + 1;i < nRestart;++i)
+		zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, i).nReleaseHandle);
+	CHECK(_stalled_at(oContext, nRestart + POOL_SIZE));
+	for(int i = 0;i < POOL_SIZE;++i)
+		zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, nRestart + i).nReleaseHandle);
+	CHECK(_wait_frames(oContext, nRestart + FRAMES_A));
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, nRestart + POOL_SIZE).nReleaseHandle);
+	zznvcodec_decoder_stop(pDec);
+
+	// released after Stop(), refused
+	zznvcodec_decoder_release_dmabuf(pDec, _frame(oContext, nRestart).nReleaseHandle);
+
+	zznvcodec_decoder_delete(pDec);
+	zznvcodec_session_delete(pSession);
+	CHECK(oContext.nMismatches == 0);
+
+	LOGI("%d frames, %d format changes, %d frames differ", _frames(oContext), oContext.nFormatChanges, oContext.nMismatches);
+
+	pthread_mutex_destroy(&oContext.mLock);
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "zzyuv.h"
+#include "zztest.h"
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ZZ_INIT_LOG("test_zzyuv");
+
+#define GUARD 0xA5
+
+struct i420_t {
+	std::vector<uint8_t> oY;
+	std::vector<uint8_t> oU;
+	std::vector<uint8_t> oV;
+};
+
+// every byte of the destination is compared, the ones the converter must not touch keep GUARD
+static void _convert(zzyuv_isa_t nIsa, const std::vector<uint8_t>& oSrc, int nSrcStride,
+	int nStrideY, int nStrideC, int nWidth, int nHeight, i420_t* pDst) {
+	pDst->oY.assign(nStrideY * nHeight, GUARD);
+	pDst->oU.assign(nStrideC * ((nHeight + 1) / 2), GUARD);
+	pDst->oV.assign(nStrideC * ((nHeight + 1) / 2), GUARD);
+
+	zzyuv_set_isa(nIsa);
+	zzyuv_yuyv_to_i420(&oSrc[0], nSrcStride, &pDst->oY[0], nStrideY, &pDst->oU[0], nStrideC, &pDst->oV[0], nStrideC,
+		nWidth, nHeight);
+}
+
+static void _test_isa(zzyuv_isa_t nIsa) {
+	// around the 16 (SSE2) and 32 (NEON) pixel steps, odd sizes take the scalar tail
+	const int nWidths[] = { 1, 2, 3, 15, 16, 17, 30, 31, 32, 33, 34, 47, 48, 63, 64, 65, 97, 642 };
+	const int nHeights[] = { 1, 2, 3, 4, 5, 17, 362 };
+	const int nPads[] = { 0, 1, 7, 32 };
+	int nCases = 0;
+
+	for(size_t w = 0;w < sizeof(nWidths) / sizeof(nWidths[0]);++w) {
+		for(size_t h = 0;h < sizeof(nHeights) / sizeof(nHeights[0]);++h) {
+			for(size_t p = 0;p < sizeof(nPads) / sizeof(nPads[0]);++p) {
+				int nWidth = nWidths[w];
+				int nHeight = nHeights[h];
+				int nSrcStride = nWidth * 2 + nPads[p];
+				int nStrideY = nWidth + nPads[p];
+				int nStrideC = (nWidth + 1) / 2 + nPads[p];
+				std::vector<uint8_t> oSrc(nSrcStride * nHeight);
+				i420_t oScalar, oSimd;
+
+				for(size_t i = 0;i < oSrc.size();++i)
+					oSrc[i] = (uint8_t)(rand() >> 4);
+
+				_convert(ZZYUV_ISA_SCALAR, oSrc, nSrcStride, nStrideY, nStrideC, nWidth, nHeight, &oScalar);
+				_convert(nIsa, oSrc, nSrcStride, nStrideY, nStrideC, nWidth, nHeight, &oSimd);
+
+				bool bSame = oScalar.oY == oSimd.oY && oScalar.oU == oSimd.oU && oScalar.oV == oSimd.oV;
+				if(! bSame) {
+					LOGE("%s: %dx%d, pad %d differs from scalar", zzyuv_isa_name(nIsa), nWidth, nHeight, nPads[p]);
+				}
+				CHECK(bSame);
+				nCases++;
+			}
+		}
+	}
+
+	LOGI("%s: %d cases against scalar", zzyuv_isa_name(nIsa), nCases);
+}
+
+// the scalar reference itself, on a frame small enough to spell out
+static void _test_scalar() {
+	// 4x3: rows of Y0 U Y1 V, the odd last row takes its chroma from itself
+	const uint8_t oSrc[] = {
+		10, 100, 11, 200, 12, 102, 13, 202,
+		20, 110, 21, 211, 22, 112, 23, 212,
+		30, 120, 31, 221, 32, 122, 33, 222,
+	};
+	uint8_t oY[12], oU[4], oV[4];
+	const uint8_t oExpectedY[] = { 10, 11, 12, 13, 20, 21, 22, 23, 30, 31, 32, 33 };
+	const uint8_t oExpectedU[] = { 105, 107, 120, 122 };
+	const uint8_t oExpectedV[] = { 206, 207, 221, 222 };
+
+	zzyuv_set_isa(ZZYUV_ISA_SCALAR);
+	zzyuv_yuyv_to_i420(oSrc, 8, oY, 4, oU, 2, oV, 2, 4, 3);
+	CHECK(memcmp(oY, oExpectedY, sizeof(oY)) == 0);
+	CHECK(memcmp(oU, oExpectedU, sizeof(oU)) == 0);
+	CHECK(memcmp(oV, oExpectedV, sizeof(oV)) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	// test_zzyuv, every SIMD path of this CPU has to match the scalar one byte for byte
+	int nTested = 0;
+
+	srand(1);
+	_test_scalar();
+	for(int i = 0;i < ZZYUV_ISA_COUNT;++i) {
+		zzyuv_isa_t nIsa = (zzyuv_isa_t)i;
+
+		if(nIsa == ZZYUV_ISA_SCALAR || zzyuv_set_isa(nIsa) != 0)
+			continue;
+
+		_test_isa(nIsa);
+		nTested++;
+	}
+	if(nTested == 0) {
+		LOGW("no SIMD path on this CPU, only the scalar one was checked");
+	}
+
+	if(_failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
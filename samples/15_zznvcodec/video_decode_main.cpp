@@ -28,6 +28,7 @@
 
 #include "NvApplicationProfiler.h"
 #include "NvUtils.h"
+#include "NvNalScanner.h"
 #include <errno.h>
 #include <fstream>
 #include <iostream>
@@ -52,12 +53,6 @@
 #define CHUNK_SIZE 4000000
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
-
 #define H264_NAL_UNIT_CODED_SLICE  1
 #define H264_NAL_UNIT_CODED_SLICE_IDR  5
 
@@ -69,10 +64,6 @@
 #define IVF_FILE_HDR_SIZE   32
 #define IVF_FRAME_HDR_SIZE  12
 
-#define IS_H264_NAL_CODED_SLICE(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE)
-#define IS_H264_NAL_CODED_SLICE_IDR(buffer_ptr) ((buffer_ptr[0] & 0x1F) == H264_NAL_UNIT_CODED_SLICE_IDR)
-
-#define GET_H265_NAL_UNIT_TYPE(buffer_ptr) ((buffer_ptr[0] & 0x7E) >> 1)
 
 using namespace std;
 
@@ -117,14 +108,12 @@ static int
 read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
         char *parse_buffer, streamsize parse_buffer_size, context_t * ctx)
 {
-    // Length is the size of the buffer in bytes
-    char *buffer_ptr = (char *) buffer->planes[0].data;
-    int h265_nal_unit_type;
-    char *stream_ptr;
-    bool nalu_found = false;
-
+    NvNalUnit nalu;
     streamsize bytes_read;
     streamsize stream_initial_pos = stream->tellg();
+    NvNalCodec codec = (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) ?
+        NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
+    int h265_nal_unit_type;
 
     stream->read(parse_buffer, parse_buffer_size);
     bytes_read = stream->gcount();
@@ -134,42 +123,26 @@ read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
         return buffer->planes[0].bytesused = 0;
     }
 
-    // Find the first NAL unit in the buffer
-    stream_ptr = parse_buffer;
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-                    IS_NAL_UNIT_START1(stream_ptr);
-        if (nalu_found)
-        {
-            break;
-        }
-        stream_ptr++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    if (!nalu_found)
+    // Find the first NAL unit in the buffer, it has to end at a start code
+    if (nv_nal_scan_units((const uint8_t *) parse_buffer, bytes_read,
+                codec, &nalu, 1) != 1 ||
+            (streamsize) (nalu.offset + nalu.size) >= bytes_read)
     {
         cerr << "Could not read nal unit from file. EOF or file corrupted"
             << endl;
         return -1;
     }
 
-    memcpy(buffer_ptr, stream_ptr, 4);
-    buffer_ptr += 4;
-    buffer->planes[0].bytesused = 4;
-    stream_ptr += 4;
-
     if (ctx->copy_timestamp)
     {
       if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H264) {
-        if ((IS_H264_NAL_CODED_SLICE(stream_ptr)) ||
-            (IS_H264_NAL_CODED_SLICE_IDR(stream_ptr)))
+        if ((nalu.type == H264_NAL_UNIT_CODED_SLICE) ||
+            (nalu.type == H264_NAL_UNIT_CODED_SLICE_IDR))
           ctx->flag_copyts = true;
         else
           ctx->flag_copyts = false;
       } else if (ctx->decoder_pixfmt == V4L2_PIX_FMT_H265) {
-        h265_nal_unit_type = GET_H265_NAL_UNIT_TYPE(stream_ptr);
+        h265_nal_unit_type = nalu.type;
         if ((h265_nal_unit_type >= HEVC_NUT_TRAIL_N && h265_nal_unit_type <= HEVC_NUT_RASL_R) ||
             (h265_nal_unit_type >= HEVC_NUT_BLA_W_LP && h265_nal_unit_type <= HEVC_NUT_CRA_NUT))
           ctx->flag_copyts = true;
@@ -178,30 +151,16 @@ read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
       }
     }
 
-    // Copy bytes till the next NAL unit is found
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
+    memcpy(buffer->planes[0].data, parse_buffer + nalu.offset, nalu.size);
+    buffer->planes[0].bytesused = nalu.size;
+
+    if (stream->eof())
     {
-        if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-        {
-            streamsize seekto = stream_initial_pos +
-                    (stream_ptr - parse_buffer);
-            if(stream->eof())
-            {
-                stream->clear();
-            }
-            stream->seekg(seekto, stream->beg);
-            return 0;
-        }
-        *buffer_ptr = *stream_ptr;
-        buffer_ptr++;
-        stream_ptr++;
-        buffer->planes[0].bytesused++;
+        stream->clear();
     }
-
-    // Reached end of buffer but could not find NAL unit
-    cerr << "Could not read nal unit from file. EOF or file corrupted"
-            << endl;
-    return -1;
+    stream->seekg(stream_initial_pos + (streamsize) (nalu.offset + nalu.size),
+            stream->beg);
+    return 0;
 }
 
 static int
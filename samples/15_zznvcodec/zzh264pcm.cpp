@@ -0,0 +1,543 @@
+#include "zzh264pcm.h"
+#include "ZzLog.h"
+
+#include <string.h>
+
+ZZ_INIT_LOG("zzh264pcm");
+
+#define MB_TYPE_I_PCM 25
+#define PCM_MB_BYTES (256 + 64 + 64)
+
+namespace {
+
+struct BitWriter {
+	std::vector<uint8_t>& mOut;
+	uint32_t mBits;
+	int mNumBits;
+
+	explicit BitWriter(std::vector<uint8_t>& oOut) : mOut(oOut), mBits(0), mNumBits(0) {
+	}
+
+	void U(int n, uint32_t v) {
+		for(int i = n - 1;i >= 0;--i) {
+			mBits = (mBits << 1) | ((v >> i) & 1);
+			if(++mNumBits == 8) {
+				mOut.push_back((uint8_t)mBits);
+				mBits = 0;
+				mNumBits = 0;
+			}
+		}
+	}
+
+	void UE(uint32_t v) {
+		uint32_t x = v + 1;
+		int n = 0;
+		while((x >> n) > 1)
+			n++;
+		U(n, 0);
+		U(n + 1, x);
+	}
+
+	void SE(int v) {
+		UE(v > 0 ? 2 * v - 1 : -2 * v);
+	}
+
+	void AlignZero() {
+		if(mNumBits)
+			U(8 - mNumBits, 0);
+	}
+
+	void TrailingBits() {
+		U(1, 1);
+		AlignZero();
+	}
+};
+
+struct BitReader {
+	const uint8_t* mData;
+	int mSize;
+	int mPos; // bits
+	int mEnd; // position of the rbsp_stop_one_bit
+	bool mError;
+
+	BitReader(const uint8_t* pData, int nSize) : mData(pData), mSize(nSize), mPos(0), mEnd(nSize * 8), mError(false) {
+		// rbsp_trailing_bits, the last set bit of the payload
+		int i = nSize - 1;
+		while(i >= 0 && mData[i] == 0)
+			i--;
+		if(i >= 0) {
+			int b = 0;
+			while(((mData[i] >> b) & 1) == 0)
+				b++;
+			mEnd = i * 8 + 7 - b;
+		}
+	}
+
+	uint32_t U(int n) {
+		uint32_t v = 0;
+		if(mPos + n > mSize * 8) {
+			mError = true;
+			mPos = mSize * 8;
+			return 0;
+		}
+		for(int i = 0;i < n;++i, ++mPos) {
+			v = (v << 1) | ((mData[mPos >> 3] >> (7 - (mPos & 7))) & 1);
+		}
+		return v;
+	}
+
+	uint32_t UE() {
+		int n = 0;
+		while(U(1) == 0) {
+			if(mError || ++n > 31) {
+				mError = true;
+				return 0;
+			}
+		}
+		return ((1u << n) - 1) + U(n);
+	}
+
+	int SE() {
+		uint32_t v = UE();
+		return (v & 1) ? (int)((v + 1) / 2) : -(int)(v / 2);
+	}
+
+	bool MoreRBSPData() const {
+		return mPos < mEnd;
+	}
+
+	void AlignByte() {
+		mPos = (mPos + 7) & ~7;
+	}
+};
+
+void AppendNAL(std::vector<uint8_t>& oStream, uint8_t nHeader, const std::vector<uint8_t>& oRBSP) {
+	oStream.reserve(oStream.size() + oRBSP.size() + oRBSP.size() / 64 + 5);
+	oStream.push_back(0);
+	oStream.push_back(0);
+	oStream.push_back(0);
+	oStream.push_back(1);
+	oStream.push_back(nHeader);
+
+	int nZeros = 0;
+	for(size_t i = 0;i < oRBSP.size();++i) {
+		uint8_t b = oRBSP[i];
+		if(nZeros == 2 && b <= 3) {
+			oStream.push_back(3); // emulation_prevention_three_byte
+			nZeros = 0;
+		}
+		oStream.push_back(b);
+		nZeros = (b == 0) ? nZeros + 1 : 0;
+	}
+}
+
+// 16x16 (or 8x8) block at (x, y), the right and bottom edges are replicated past the picture
+void CopyBlock(std::vector<uint8_t>& oOut, const uint8_t* pSrc, int nStride, int x, int y, int nSize, int nWidth, int nHeight) {
+	for(int j = 0;j < nSize;++j) {
+		int sy = y + j < nHeight ? y + j : nHeight - 1;
+		const uint8_t* pRow = pSrc + sy * nStride;
+		if(x + nSize <= nWidth) {
+			oOut.insert(oOut.end(), pRow + x, pRow + x + nSize);
+		} else {
+			for(int i = 0;i < nSize;++i) {
+				int sx = x + i < nWidth ? x + i : nWidth - 1;
+				oOut.push_back(pRow[sx]);
+			}
+		}
+	}
+}
+
+}
+
+void zzh264pcm_encode(const uint8_t* pY, int nStrideY, const uint8_t* pU, int nStrideU, const uint8_t* pV, int nStrideV,
+	int nWidth, int nHeight, int nIdrPicId, std::vector<uint8_t>& oStream) {
+	int nWidthInMbs = (nWidth + 15) / 16;
+	int nHeightInMbs = (nHeight + 15) / 16;
+	int nChromaWidth = (nWidth + 1) / 2;
+	int nChromaHeight = (nHeight + 1) / 2;
+	std::vector<uint8_t> oRBSP;
+
+	{
+		BitWriter bw(oRBSP);
+		int nMbs = nWidthInMbs * nHeightInMbs;
+		bw.U(8, 66);		// profile_idc, baseline
+		bw.U(8, 0xC0);		// constraint_set0_flag, constraint_set1_flag
+		bw.U(8, nMbs <= 8192 ? 40 : (nMbs <= 36864 ? 51 : 52));
+		bw.UE(0);			// seq_parameter_set_id
+		bw.UE(0);			// log2_max_frame_num_minus4
+		bw.UE(2);			// pic_order_cnt_type, output order is decoding order
+		bw.UE(0);			// max_num_ref_frames
+		bw.U(1, 0);			// gaps_in_frame_num_value_allowed_flag
+		bw.UE(nWidthInMbs - 1);
+		bw.UE(nHeightInMbs - 1);
+		bw.U(1, 1);			// frame_mbs_only_flag
+		bw.U(1, 1);			// direct_8x8_inference_flag
+		int nCropRight = (nWidthInMbs * 16 - nWidth) / 2;
+		int nCropBottom = (nHeightInMbs * 16 - nHeight) / 2;
+		if(nCropRight || nCropBottom) {
+			bw.U(1, 1);
+			bw.UE(0);
+			bw.UE(nCropRight);
+			bw.UE(0);
+			bw.UE(nCropBottom);
+		} else {
+			bw.U(1, 0);
+		}
+		bw.U(1, 0);			// vui_parameters_present_flag
+		bw.TrailingBits();
+	}
+	AppendNAL(oStream, 0x67, oRBSP);
+
+	oRBSP.clear();
+	{
+		BitWriter bw(oRBSP);
+		bw.UE(0);			// pic_parameter_set_id
+		bw.UE(0);			// seq_parameter_set_id
+		bw.U(1, 0);			// entropy_coding_mode_flag, CAVLC
+		bw.U(1, 0);			// bottom_field_pic_order_in_frame_present_flag
+		bw.UE(0);			// num_slice_groups_minus1
+		bw.UE(0);			// num_ref_idx_l0_default_active_minus1
+		bw.UE(0);			// num_ref_idx_l1_default_active_minus1
+		bw.U(1, 0);			// weighted_pred_flag
+		bw.U(2, 0);			// weighted_bipred_idc
+		bw.SE(0);			// pic_init_qp_minus26
+		bw.SE(0);			// pic_init_qs_minus26
+		bw.SE(0);			// chroma_qp_index_offset
+		bw.U(1, 1);			// deblocking_filter_control_present_flag
+		bw.U(1, 0);			// constrained_intra_pred_flag
+		bw.U(1, 0);			// redundant_pic_cnt_present_flag
+		bw.TrailingBits();
+	}
+	AppendNAL(oStream, 0x68, oRBSP);
+
+	oRBSP.clear();
+	oRBSP.reserve(nWidthInMbs * nHeightInMbs * (PCM_MB_BYTES + 2) + 16);
+	{
+		BitWriter bw(oRBSP);
+		bw.UE(0);			// first_mb_in_slice
+		bw.UE(7);			// slice_type, I, all slices of the picture
+		bw.UE(0);			// pic_parameter_set_id
+		bw.U(4, 0);			// frame_num
+		bw.UE(nIdrPicId & 0xFFFF);
+		bw.U(1, 0);			// no_output_of_prior_pics_flag
+		bw.U(1, 0);			// long_term_reference_flag
+		bw.SE(0);			// slice_qp_delta
+		bw.UE(1);			// disable_deblocking_filter_idc
+
+		for(int mby = 0;mby < nHeightInMbs;++mby) {
+			for(int mbx = 0;mbx < nWidthInMbs;++mbx) {
+				bw.UE(MB_TYPE_I_PCM);
+				bw.AlignZero();	// pcm_alignment_zero_bit
+				CopyBlock(oRBSP, pY, nStrideY, mbx * 16, mby * 16, 16, nWidth, nHeight);
+				CopyBlock(oRBSP, pU, nStrideU, mbx * 8, mby * 8, 8, nChromaWidth, nChromaHeight);
+				CopyBlock(oRBSP, pV, nStrideV, mbx * 8, mby * 8, 8, nChromaWidth, nChromaHeight);
+			}
+		}
+		bw.TrailingBits();
+	}
+	AppendNAL(oStream, 0x65, oRBSP);
+}
+
+zzh264pcm_decoder_t::zzh264pcm_decoder_t() {
+	memset(mSPS, 0, sizeof(mSPS));
+	memset(mPPS, 0, sizeof(mPPS));
+	mCodedWidth = 0;
+	mCodedHeight = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mCropX = 0;
+	mCropY = 0;
+	mDecodedMbs = 0;
+}
+
+int zzh264pcm_decoder_t::DecodeNAL(const uint8_t* pNAL, int nSize) {
+	if(nSize < 1)
+		return 0;
+
+	int nRefIdc = (pNAL[0] >> 5) & 3;
+	int nType = pNAL[0] & 0x1F;
+
+	switch(nType) {
+	case 1:
+	case 5:
+	case 7:
+	case 8:
+		break;
+
+	default:
+		// SEI, AUD, end of sequence, ...
+		return 0;
+	}
+
+	// strip emulation_prevention_three_byte
+	mRBSP.resize(nSize);
+	int nRBSP = 0;
+	int nZeros = 0;
+	for(int i = 1;i < nSize;++i) {
+		uint8_t b = pNAL[i];
+		if(nZeros == 2 && b == 3) {
+			nZeros = 0;
+			continue;
+		}
+		mRBSP[nRBSP++] = b;
+		nZeros = (b == 0) ? nZeros + 1 : 0;
+	}
+	mRBSP.resize(nRBSP);
+
+	switch(nType) {
+	case 7:
+		return ParseSPS();
+
+	case 8:
+		return ParsePPS();
+
+	default:
+		return ParseSlice(nType, nRefIdc);
+	}
+}
+
+int zzh264pcm_decoder_t::ParseSPS() {
+	BitReader br(mRBSP.data(), (int)mRBSP.size());
+
+	int nProfile = br.U(8);
+	br.U(8); // constraint_set flags
+	br.U(8); // level_idc
+	uint32_t nId = br.UE();
+	if(nId >= 32) {
+		LOGE("%s(%d): unexpected value, seq_parameter_set_id=%d", __FUNCTION__, __LINE__, nId);
+		return -1;
+	}
+
+	SPS sps;
+	memset(&sps, 0, sizeof(sps));
+
+	switch(nProfile) {
+	case 100: case 110: case 122: case 244: case 44:
+	case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135: {
+		int nChromaFormat = br.UE();
+		if(nChromaFormat == 3)
+			br.U(1); // separate_colour_plane_flag
+		int nBitDepthLuma = br.UE() + 8;
+		int nBitDepthChroma = br.UE() + 8;
+		br.U(1); // qpprime_y_zero_transform_bypass_flag
+		int nScalingMatrix = br.U(1);
+		if(nChromaFormat != 1 || nBitDepthLuma != 8 || nBitDepthChroma != 8 || nScalingMatrix) {
+			LOGE("%s(%d): only 8-bit 4:2:0 without scaling matrices, chroma_format_idc=%d, bit_depth=%d/%d", __FUNCTION__, __LINE__,
+				nChromaFormat, nBitDepthLuma, nBitDepthChroma);
+			return -1;
+		}
+	}
+		break;
+	}
+
+	sps.mLog2MaxFrameNum = br.UE() + 4;
+	sps.mPocType = br.UE();
+	if(sps.mPocType == 0) {
+		sps.mLog2MaxPocLsb = br.UE() + 4;
+	} else if(sps.mPocType == 1) {
+		sps.mDeltaPicOrderAlwaysZero = br.U(1);
+		br.SE(); // offset_for_non_ref_pic
+		br.SE(); // offset_for_top_to_bottom_field
+		int nCycle = br.UE();
+		for(int i = 0;i < nCycle && ! br.mError;++i)
+			br.SE();
+	}
+	br.UE(); // max_num_ref_frames
+	br.U(1); // gaps_in_frame_num_value_allowed_flag
+	sps.mWidthInMbs = br.UE() + 1;
+	sps.mHeightInMbs = br.UE() + 1;
+	if(! br.U(1)) {
+		LOGE("%s(%d): interlaced streams are not supported", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	br.U(1); // direct_8x8_inference_flag
+	if(br.U(1)) {
+		sps.mCropLeft = br.UE() * 2;
+		sps.mCropRight = br.UE() * 2;
+		sps.mCropTop = br.UE() * 2;
+		sps.mCropBottom = br.UE() * 2;
+	}
+
+	if(br.mError || sps.mWidthInMbs > 1024 || sps.mHeightInMbs > 1024 ||
+		sps.mCropLeft + sps.mCropRight >= sps.mWidthInMbs * 16 || sps.mCropTop + sps.mCropBottom >= sps.mHeightInMbs * 16) {
+		LOGE("%s(%d): broken SPS", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	sps.mValid = true;
+	mSPS[nId] = sps;
+
+	return 0;
+}
+
+int zzh264pcm_decoder_t::ParsePPS() {
+	BitReader br(mRBSP.data(), (int)mRBSP.size());
+
+	uint32_t nId = br.UE();
+	PPS pps;
+	memset(&pps, 0, sizeof(pps));
+	pps.mSPSId = br.UE();
+	if(nId >= 256 || pps.mSPSId >= 32) {
+		LOGE("%s(%d): unexpected value, pic_parameter_set_id=%d, seq_parameter_set_id=%d", __FUNCTION__, __LINE__, nId, pps.mSPSId);
+		return -1;
+	}
+	if(br.U(1)) {
+		LOGE("%s(%d): CABAC is not supported", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	pps.mBottomFieldPicOrderInFramePresent = br.U(1);
+	if(br.UE() != 0) {
+		LOGE("%s(%d): slice groups are not supported", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	br.UE(); // num_ref_idx_l0_default_active_minus1
+	br.UE(); // num_ref_idx_l1_default_active_minus1
+	br.U(1); // weighted_pred_flag
+	br.U(2); // weighted_bipred_idc
+	br.SE(); // pic_init_qp_minus26
+	br.SE(); // pic_init_qs_minus26
+	pps.mChromaQpIndexOffset = br.SE();
+	pps.mDeblockingFilterControlPresent = br.U(1);
+	br.U(1); // constrained_intra_pred_flag
+	pps.mRedundantPicCntPresent = br.U(1);
+	// transform_8x8_mode_flag and the rest only matter to I_NxN
+
+	if(br.mError) {
+		LOGE("%s(%d): broken PPS", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	pps.mValid = true;
+	mPPS[nId] = pps;
+
+	return 0;
+}
+
+int zzh264pcm_decoder_t::ParseSlice(int nNALType, int nRefIdc) {
+	BitReader br(mRBSP.data(), (int)mRBSP.size());
+
+	int nFirstMb = br.UE();
+	int nSliceType = br.UE() % 5;
+	uint32_t nPPSId = br.UE();
+	if(nPPSId >= 256 || ! mPPS[nPPSId].mValid || ! mSPS[mPPS[nPPSId].mSPSId].mValid) {
+		LOGE("%s(%d): slice without parameter sets, pic_parameter_set_id=%d", __FUNCTION__, __LINE__, nPPSId);
+		return -1;
+	}
+	if(nSliceType != 2) {
+		LOGE("%s(%d): only I slices are supported, slice_type=%d", __FUNCTION__, __LINE__, nSliceType);
+		return -1;
+	}
+
+	const PPS& pps = mPPS[nPPSId];
+	const SPS& sps = mSPS[pps.mSPSId];
+
+	br.U(sps.mLog2MaxFrameNum); // frame_num
+	if(nNALType == 5)
+		br.UE(); // idr_pic_id
+	if(sps.mPocType == 0) {
+		br.U(sps.mLog2MaxPocLsb);
+		if(pps.mBottomFieldPicOrderInFramePresent)
+			br.SE();
+	} else if(sps.mPocType == 1 && ! sps.mDeltaPicOrderAlwaysZero) {
+		br.SE();
+		if(pps.mBottomFieldPicOrderInFramePresent)
+			br.SE();
+	}
+	if(pps.mRedundantPicCntPresent)
+		br.UE();
+	if(nRefIdc) {
+		if(nNALType == 5) {
+			br.U(1); // no_output_of_prior_pics_flag
+			br.U(1); // long_term_reference_flag
+		} else if(br.U(1)) {
+			// adaptive_ref_pic_marking_mode_flag
+			for(;;) {
+				int nOp = br.UE();
+				if(nOp == 0 || br.mError)
+					break;
+				if(nOp == 1 || nOp == 3)
+					br.UE();
+				if(nOp == 2 || nOp == 3 || nOp == 4 || nOp == 6)
+					br.UE();
+			}
+		}
+	}
+	br.SE(); // slice_qp_delta
+	if(pps.mDeblockingFilterControlPresent) {
+		int nDisable = br.UE();
+		if(nDisable != 1) {
+			int nAlpha = br.SE() * 2;
+			int nBeta = br.SE() * 2;
+			// qPp of an I_PCM macroblock is 0, alpha and beta stay 0 below indexA/indexB 16
+			int nChromaQp = pps.mChromaQpIndexOffset > 0 ? pps.mChromaQpIndexOffset : 0;
+			if(nAlpha + nChromaQp >= 16 && nBeta + nChromaQp >= 16) {
+				LOGE("%s(%d): deblocking of I_PCM macroblocks is not supported", __FUNCTION__, __LINE__);
+				return -1;
+			}
+		}
+	}
+
+	if(br.mError) {
+		LOGE("%s(%d): broken slice header", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	int nCodedWidth = sps.mWidthInMbs * 16;
+	int nCodedHeight = sps.mHeightInMbs * 16;
+	if(nCodedWidth != mCodedWidth || nCodedHeight != mCodedHeight) {
+		mCodedWidth = nCodedWidth;
+		mCodedHeight = nCodedHeight;
+		mPicture.assign(nCodedWidth * nCodedHeight * 3 / 2, 0);
+		mDecodedMbs = 0;
+	}
+	mWidth = nCodedWidth - sps.mCropLeft - sps.mCropRight;
+	mHeight = nCodedHeight - sps.mCropTop - sps.mCropBottom;
+	mCropX = sps.mCropLeft;
+	mCropY = sps.mCropTop;
+
+	int nMbs = sps.mWidthInMbs * sps.mHeightInMbs;
+	if(nFirstMb == 0)
+		mDecodedMbs = 0;
+
+	uint8_t* pY = &mPicture[0];
+	uint8_t* pU = pY + nCodedWidth * nCodedHeight;
+	uint8_t* pV = pU + nCodedWidth * nCodedHeight / 4;
+	for(int nMb = nFirstMb;br.MoreRBSPData();++nMb) {
+		if(nMb >= nMbs) {
+			LOGE("%s(%d): too many macroblocks, %d", __FUNCTION__, __LINE__, nMb);
+			return -1;
+		}
+
+		int nMbType = br.UE();
+		if(nMbType != MB_TYPE_I_PCM) {
+			LOGE("%s(%d): only I_PCM macroblocks are supported, mb_type=%d", __FUNCTION__, __LINE__, nMbType);
+			return -1;
+		}
+		br.AlignByte();
+
+		int nOffset = br.mPos >> 3;
+		if(nOffset + PCM_MB_BYTES > br.mSize) {
+			LOGE("%s(%d): truncated macroblock %d", __FUNCTION__, __LINE__, nMb);
+			return -1;
+		}
+		const uint8_t* pSamples = br.mData + nOffset;
+		int mbx = nMb % sps.mWidthInMbs;
+		int mby = nMb / sps.mWidthInMbs;
+		for(int j = 0;j < 16;++j, pSamples += 16)
+			memcpy(pY + (mby * 16 + j) * nCodedWidth + mbx * 16, pSamples, 16);
+		for(int j = 0;j < 8;++j, pSamples += 8)
+			memcpy(pU + (mby * 8 + j) * (nCodedWidth / 2) + mbx * 8, pSamples, 8);
+		for(int j = 0;j < 8;++j, pSamples += 8)
+			memcpy(pV + (mby * 8 + j) * (nCodedWidth / 2) + mbx * 8, pSamples, 8);
+		br.mPos += PCM_MB_BYTES * 8;
+
+		mDecodedMbs++;
+	}
+
+	if(mDecodedMbs >= nMbs) {
+		mDecodedMbs = 0;
+		return 1;
+	}
+
+	return 0;
+}
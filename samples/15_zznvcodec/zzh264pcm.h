@@ -0,0 +1,70 @@
+#ifndef __ZZH264PCM_H__
+#define __ZZH264PCM_H__
+
+#include <stdint.h>
+#include <vector>
+
+// H.264 of the software backend. Every macroblock is I_PCM, the stream carries the raw 4:2:0 samples
+// in a syntax any H.264 decoder reads, baseline profile, one IDR slice per frame.
+
+// Appends SPS, PPS and the IDR slice of one I420 frame, Annex-B with 4-byte start codes.
+// nIdrPicId has to differ between consecutive frames.
+void zzh264pcm_encode(const uint8_t* pY, int nStrideY, const uint8_t* pU, int nStrideU, const uint8_t* pV, int nStrideV,
+	int nWidth, int nHeight, int nIdrPicId, std::vector<uint8_t>& oStream);
+
+// Reads the I_PCM subset back: baseline/main/high 8-bit 4:2:0 SPS, CAVLC PPS, I slices made of
+// I_PCM macroblocks only. Anything else is reported as an error.
+struct zzh264pcm_decoder_t {
+	struct SPS {
+		bool mValid;
+		int mLog2MaxFrameNum;
+		int mPocType;
+		int mLog2MaxPocLsb;
+		bool mDeltaPicOrderAlwaysZero;
+		int mWidthInMbs;
+		int mHeightInMbs;
+		int mCropLeft;
+		int mCropRight;
+		int mCropTop;
+		int mCropBottom;
+	};
+
+	struct PPS {
+		bool mValid;
+		int mSPSId;
+		bool mBottomFieldPicOrderInFramePresent;
+		int mChromaQpIndexOffset;
+		bool mDeblockingFilterControlPresent;
+		bool mRedundantPicCntPresent;
+	};
+
+	SPS mSPS[32];
+	PPS mPPS[256];
+	std::vector<uint8_t> mRBSP;
+
+	// current picture, I420 at the coded size
+	std::vector<uint8_t> mPicture;
+	int mCodedWidth;
+	int mCodedHeight;
+	int mWidth;
+	int mHeight;
+	int mCropX;
+	int mCropY;
+	int mDecodedMbs;
+
+	zzh264pcm_decoder_t();
+
+	// pNAL starts after the start code. Returns 1 when a picture got complete, 0 if not, -1 on errors.
+	int DecodeNAL(const uint8_t* pNAL, int nSize);
+
+	const uint8_t* PlaneY() const { return &mPicture[0]; }
+	const uint8_t* PlaneU() const { return &mPicture[mCodedWidth * mCodedHeight]; }
+	const uint8_t* PlaneV() const { return &mPicture[mCodedWidth * mCodedHeight * 5 / 4]; }
+
+private:
+	int ParseSPS();
+	int ParsePPS();
+	int ParseSlice(int nNALType, int nRefIdc);
+};
+
+#endif // __ZZH264PCM_H__
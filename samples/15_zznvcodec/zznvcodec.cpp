@@ -0,0 +1,205 @@
+#include "zznvcodec_backend.h"
+#include "ZzLog.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ZZ_INIT_LOG("zznvcodec");
+
+static int _resolve_backend(int nBackend) {
+	if(nBackend != ZZNVCODEC_BACKEND_DEFAULT)
+		return nBackend;
+
+	const char* pEnv = getenv("ZZNVCODEC_BACKEND");
+	if(pEnv) {
+		if(strcmp(pEnv, "sw") == 0)
+			return ZZNVCODEC_BACKEND_SW;
+		if(strcmp(pEnv, "nv") == 0)
+			return ZZNVCODEC_BACKEND_NV;
+
+		LOGW("%s(%d): unexpected value, ZZNVCODEC_BACKEND=%s", __FUNCTION__, __LINE__, pEnv);
+	}
+
+#ifdef ZZNVCODEC_SW_ONLY
+	return ZZNVCODEC_BACKEND_SW;
+#else
+	return ZZNVCODEC_BACKEND_NV;
+#endif
+}
+
+zznvcodec_decoder_t* zznvcodec_decoder_new() {
+	return zznvcodec_decoder_new_with_backend(ZZNVCODEC_BACKEND_DEFAULT);
+}
+
+zznvcodec_decoder_t* zznvcodec_decoder_new_with_backend(int nBackend) {
+	switch(_resolve_backend(nBackend)) {
+#ifndef ZZNVCODEC_SW_ONLY
+	case ZZNVCODEC_BACKEND_NV:
+		return zznvdec_new();
+#endif
+
+	case ZZNVCODEC_BACKEND_SW:
+		return zzswdec_new();
+
+	default:
+		LOGE("%s(%d): backend %d is not available", __FUNCTION__, __LINE__, nBackend);
+		return NULL;
+	}
+}
+
+void zznvcodec_decoder_delete(zznvcodec_decoder_t* pThis) {
+	delete pThis;
+}
+
+void zznvcodec_decoder_set_video_property(zznvcodec_decoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
+	pThis->SetVideoProperty(nWidth, nHeight, nFormat);
+}
+
+void zznvcodec_decoder_set_session(zznvcodec_decoder_t* pThis, zznvcodec_session_t* pSession) {
+	pThis->SetSession(pSession);
+}
+
+void zznvcodec_decoder_set_misc_property(zznvcodec_decoder_t* pThis, int nProperty, intptr_t pValue) {
+	pThis->SetMiscProperty(nProperty, pValue);
+}
+
+void zznvcodec_decoder_register_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_video_frame_t pCB, intptr_t pUser) {
+	pThis->RegisterCallbacks(pCB, pUser);
+}
+
+void zznvcodec_decoder_register_dmabuf_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_video_dmabuf_t pCB, intptr_t pUser) {
+	pThis->RegisterDMABufCallbacks(pCB, pUser);
+}
+
+void zznvcodec_decoder_register_format_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_format_change_t pCB, intptr_t pUser) {
+	pThis->RegisterFormatCallbacks(pCB, pUser);
+}
+
+int zznvcodec_decoder_start(zznvcodec_decoder_t* pThis) {
+	return pThis->Start();
+}
+
+void zznvcodec_decoder_stop(zznvcodec_decoder_t* pThis) {
+	return pThis->Stop();
+}
+
+int zznvcodec_decoder_set_video_compression_buffer(zznvcodec_decoder_t* pThis, unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) {
+	return pThis->SetVideoCompressionBuffer(pBuffer, nSize, nFlags, nTimestamp);
+}
+
+void zznvcodec_decoder_release_dmabuf(zznvcodec_decoder_t* pThis, int64_t nReleaseHandle) {
+	pThis->ReleaseDMABuf(nReleaseHandle);
+}
+
+pthread_mutex_t zznvcodec_video_frame_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void zznvcodec_frame_ref(zznvcodec_video_frame_t* pFrame) {
+	zznvcodec_video_frame_slot_t* pSlot = (zznvcodec_video_frame_slot_t*)pFrame;
+
+	pthread_mutex_lock(&zznvcodec_video_frame_slots_lock);
+	if(pSlot->mOwner)
+		pSlot->mOwner->RefVideoFrame(pSlot);
+	else
+		pSlot->mRefs++;
+	pthread_mutex_unlock(&zznvcodec_video_frame_slots_lock);
+}
+
+void zznvcodec_frame_unref(zznvcodec_video_frame_t* pFrame) {
+	zznvcodec_video_frame_slot_t* pSlot = (zznvcodec_video_frame_slot_t*)pFrame;
+
+	pthread_mutex_lock(&zznvcodec_video_frame_slots_lock);
+	if(pSlot->mOwner) {
+		pSlot->mOwner->UnrefVideoFrame(pSlot);
+	} else if(pSlot->mRefs <= 0) {
+		LOGE("%s(%d): unbalanced unref, mRefs=%d", __FUNCTION__, __LINE__, pSlot->mRefs);
+	} else if(--pSlot->mRefs == 0) {
+		// detached by Stop() or a format change, the frame goes away with its last reference
+		pSlot->mRelease(pSlot);
+	}
+	pthread_mutex_unlock(&zznvcodec_video_frame_slots_lock);
+}
+
+zznvcodec_encoder_t* zznvcodec_encoder_new() {
+	return zznvcodec_encoder_new_with_backend(ZZNVCODEC_BACKEND_DEFAULT);
+}
+
+zznvcodec_encoder_t* zznvcodec_encoder_new_with_backend(int nBackend) {
+	switch(_resolve_backend(nBackend)) {
+#ifndef ZZNVCODEC_SW_ONLY
+	case ZZNVCODEC_BACKEND_NV:
+		return zznvenc_new();
+#endif
+
+	case ZZNVCODEC_BACKEND_SW:
+		return zzswenc_new();
+
+	default:
+		LOGE("%s(%d): backend %d is not available", __FUNCTION__, __LINE__, nBackend);
+		return NULL;
+	}
+}
+
+void zznvcodec_encoder_delete(zznvcodec_encoder_t* pThis) {
+	delete pThis;
+}
+
+void zznvcodec_encoder_set_video_property(zznvcodec_encoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
+	pThis->SetVideoProperty(nWidth, nHeight, nFormat);
+}
+
+void zznvcodec_encoder_set_misc_property(zznvcodec_encoder_t* pThis, int nProperty, intptr_t pValue) {
+	pThis->SetMiscProperty(nProperty, pValue);
+}
+
+void zznvcodec_encoder_set_session(zznvcodec_encoder_t* pThis, zznvcodec_session_t* pSession) {
+	pThis->SetSession(pSession);
+}
+
+void zznvcodec_encoder_register_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser) {
+	pThis->RegisterCallbacks(pCB, pUser);
+}
+
+void zznvcodec_encoder_register_packet_info_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_video_packet_info_t pCB, intptr_t pUser) {
+	pThis->RegisterPacketInfoCallbacks(pCB, pUser);
+}
+
+void zznvcodec_encoder_register_frame_done_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_frame_done_t pCB, intptr_t pUser) {
+	pThis->RegisterFrameDoneCallbacks(pCB, pUser);
+}
+
+void zznvcodec_encoder_register_dmabuf_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_dmabuf_release_t pCB, intptr_t pUser) {
+	pThis->RegisterDMABufCallbacks(pCB, pUser);
+}
+
+int zznvcodec_encoder_start(zznvcodec_encoder_t* pThis) {
+	return pThis->Start();
+}
+
+void zznvcodec_encoder_stop(zznvcodec_encoder_t* pThis) {
+	return pThis->Stop();
+}
+
+int zznvcodec_encoder_set_video_uncompression_buffer(zznvcodec_encoder_t* pThis, zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) {
+	return pThis->SetVideoUncompressionBuffer(pFrame, nTimestamp);
+}
+
+int zznvcodec_encoder_set_video_dmabuf(zznvcodec_encoder_t* pThis, zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp) {
+	return pThis->SetVideoDMABuf(pFrame, nTimestamp);
+}
+
+void zznvcodec_trace_enable(int nEventsPerThread) {
+	NvFrameTracer::getTracerInstance().enable(nEventsPerThread > 0 ? nEventsPerThread : 0);
+}
+
+void zznvcodec_trace_event(int nStream, int64_t nTimestamp, const char* pStage, int nPhase) {
+	if(nPhase < ZZNVCODEC_TRACE_BEGIN || nPhase > ZZNVCODEC_TRACE_INSTANT) {
+		LOGE("%s(%d): unexpected value, nPhase=%d", __FUNCTION__, __LINE__, nPhase);
+		return;
+	}
+
+	NvFrameTracer::getTracerInstance().trace(nStream, nTimestamp, pStage, (NvFrameTracer::TracePhase)nPhase);
+}
+
+int zznvcodec_trace_dump(const char* pPath) {
+	return NvFrameTracer::getTracerInstance().dumpChromeTrace(pPath);
+}
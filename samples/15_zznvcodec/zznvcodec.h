@@ -13,20 +13,75 @@ extern "C" {
 
 struct zznvcodec_decoder_t;
 struct zznvcodec_encoder_t;
+struct zznvcodec_session_t;
 
 enum zznvcodec_consts_t {
 	ZZNVCODEC_MAX_PLANES = 3,
+	ZZNVCODEC_MAX_ROI_REGIONS = 8,
+	ZZNVCODEC_NICE_KEEP = -128,
+};
+
+enum zznvcodec_backend_t {
+	ZZNVCODEC_BACKEND_DEFAULT,			// $ZZNVCODEC_BACKEND ("nv" or "sw"), else NV unless built with ZZNVCODEC_SW_ONLY
+	ZZNVCODEC_BACKEND_NV,				// NvVideoDecoder/NvVideoEncoder
+	ZZNVCODEC_BACKEND_SW,				// CPU only, H.264 I_PCM, for hosts without Tegra hardware
 };
 
 enum zznvcodec_props_t {
-	ZZNVCODEC_PROP_ENCODER_PIX_FMT,		// zznvcodec_pixel_format_t
-	ZZNVCODEC_PROP_BITRATE,				// int
-	ZZNVCODEC_PROP_PROFILE,				// int
-	ZZNVCODEC_PROP_LEVEL,				// int
+	ZZNVCODEC_PROP_ENCODER_PIX_FMT,		// zznvcodec_pixel_format_t, H264 (default), H265, VP8 or VP9
+	ZZNVCODEC_PROP_BITRATE,				// int, also while started
+	ZZNVCODEC_PROP_PROFILE,				// int, v4l2_mpeg_video_h264_profile or v4l2_mpeg_video_h265_profile
+	ZZNVCODEC_PROP_LEVEL,				// int, v4l2_mpeg_video_h264_level, or v4l2_mpeg_video_hevc_level for H.265
 	ZZNVCODEC_PROP_RATECONTROL,			// int
 	ZZNVCODEC_PROP_IDRINTERVAL,			// int
 	ZZNVCODEC_PROP_IFRAMEINTERVAL,		// int
-	ZZNVCODEC_PROP_FRAMERATE,			// int[2] (num/deno)
+	ZZNVCODEC_PROP_FRAMERATE,			// int[2] (num/deno), also while started
+	ZZNVCODEC_PROP_OUTPUT_MODE,			// zznvcodec_output_mode_t
+	ZZNVCODEC_PROP_FRAME_POOL_SIZE,		// int, decoder video frames in flight (default 4, max 16)
+	ZZNVCODEC_PROP_INPUT_MODE,			// zznvcodec_input_mode_t, VP8/VP9 always take one frame per packet
+	ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS,	// int, decoder bitstream buffers (default 4) or encoder frames in flight (default 10), max 32
+	ZZNVCODEC_PROP_NONBLOCKING_INPUT,	// int, 1: return ZZNVCODEC_RESULT_EAGAIN instead of blocking
+	ZZNVCODEC_PROP_YUYV_CONVERTER,		// zznvcodec_yuyv_converter_t, encoder YUYV422 input
+	ZZNVCODEC_PROP_FORCE_IDR,			// NULL, while started, the next frame queued is encoded as IDR
+	ZZNVCODEC_PROP_ROI,					// zznvcodec_encoder_roi_t, set before start to enable, regions may change while started
+	ZZNVCODEC_PROP_QP_RANGE,			// int[6] (min/max of I, P and B frames), before start only
+	ZZNVCODEC_PROP_THREAD_POLICY,		// zznvcodec_thread_policy_t, codec and DQ threads, before start only
+	ZZNVCODEC_PROP_TRACE_STREAM,		// int (default 0), instances of one trace stream see a frame by its timestamp
+};
+
+enum zznvcodec_yuyv_converter_t {
+	ZZNVCODEC_YUYV_CONVERTER_VIC,		// staged in a YUYV NvBuffer, NvBufferTransform into the encoder buffer (default)
+	ZZNVCODEC_YUYV_CONVERTER_CPU,		// SSE2/NEON straight into the mapped encoder buffer
+	ZZNVCODEC_YUYV_CONVERTER_NPP,		// CUDA round trip through NPP
+};
+
+enum zznvcodec_trace_phase_t {
+	ZZNVCODEC_TRACE_BEGIN,				// the frame enters the stage
+	ZZNVCODEC_TRACE_END,				// the frame leaves the stage
+	ZZNVCODEC_TRACE_INSTANT,
+};
+
+enum zznvcodec_input_mode_t {
+	ZZNVCODEC_INPUT_MODE_NALU,			// packets are split, one NAL unit per decoder buffer (default)
+	ZZNVCODEC_INPUT_MODE_ACCESS_UNIT,	// one complete access unit per packet and decoder buffer
+};
+
+enum zznvcodec_result_t {
+	ZZNVCODEC_RESULT_OK = 0,
+	ZZNVCODEC_RESULT_ERROR = -1,
+	ZZNVCODEC_RESULT_EAGAIN = -2,		// no free decoder/encoder buffer, nothing of the packet or frame was queued
+};
+
+enum zznvcodec_frame_type_t {
+	ZZNVCODEC_FRAME_TYPE_UNKNOWN = -1,	// no encoder metadata
+	ZZNVCODEC_FRAME_TYPE_KEY,			// IDR/I frame
+	ZZNVCODEC_FRAME_TYPE_INTER,
+	ZZNVCODEC_FRAME_TYPE_GOLDEN,		// VP8/VP9 golden or alternate reference frame
+};
+
+enum zznvcodec_output_mode_t {
+	ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME,	// pitch-linear copy, CPU mapped (default)
+	ZZNVCODEC_OUTPUT_MODE_DMABUF,		// decoder capture buffer, released by zznvcodec_decoder_release_dmabuf()
 };
 
 struct zznvcodec_video_plane_t {
@@ -41,6 +96,75 @@ struct zznvcodec_video_frame_t {
 	zznvcodec_video_plane_t planes[ZZNVCODEC_MAX_PLANES];
 };
 
+struct zznvcodec_dmabuf_plane_t {
+	int width;
+	int height;
+	int pitch;
+	int offset;
+	int size;
+};
+
+struct zznvcodec_dmabuf_frame_t {
+	int fd;
+	int color_format;	// NvBufferColorFormat
+	int layout;			// NvBufferLayout
+	int num_planes;
+	zznvcodec_dmabuf_plane_t planes[ZZNVCODEC_MAX_PLANES];
+	int64_t release_handle;
+};
+
+struct zznvcodec_roi_region_t {
+	int left;
+	int top;
+	int width;
+	int height;
+	int qp_delta;		// negative for better quality
+};
+
+struct zznvcodec_encoder_roi_t {
+	int num_regions;
+	zznvcodec_roi_region_t regions[ZZNVCODEC_MAX_ROI_REGIONS];
+};
+
+struct zznvcodec_thread_policy_t {
+	uint64_t cpu_mask;	// bit n for CPU n, 0 keeps the affinity
+	int sched_policy;	// SCHED_OTHER or SCHED_FIFO, -1 keeps the scheduling class
+	int sched_priority;	// SCHED_FIFO priority, 1 to 99
+	int nice;			// -20 to 19, ZZNVCODEC_NICE_KEEP keeps the nice value
+};
+
+struct zznvcodec_encoder_packet_info_t {
+	int frame_type;		// zznvcodec_frame_type_t
+	int size;			// bytes
+	int encoded_bits;	// as reported by the encoder, 0 if unknown
+	int avg_qp;			// -1 if unknown
+	int min_qp;
+	int max_qp;
+	int ref_frame_id;	// frame the encoder referenced, -1 for key frames or if unknown
+	int num_ref_frames;	// active reference frames
+};
+
+struct zznvcodec_pool_stats_t {
+	int width;
+	int height;
+	int color_format;	// NvBufferColorFormat
+	int layout;			// NvBufferLayout
+	int buffers_in_use;
+	int buffers_free;
+	int64_t allocations;	// NvBufferCreateEx calls
+	int64_t reuses;			// buffers handed out again from the pool
+	int64_t bytes;			// memory of all buffers of the pool
+	int buffers_high_water;	// most buffers in use at once since the last trim
+};
+
+struct zznvcodec_video_format_t {
+	int width;			// display size, the size of video frames
+	int height;
+	int coded_width;	// decoder buffer size, multiple of the macroblock size
+	int coded_height;
+	int color_format;	// NvBufferColorFormat of DMABUF mode frames
+};
+
 enum zznvcodec_pixel_format_t {
 	ZZNVCODEC_PIXEL_FORMAT_UNKNOWN = -1,
 	ZZNVCODEC_PIXEL_FORMAT_NV12,
@@ -48,34 +172,98 @@ enum zznvcodec_pixel_format_t {
 	ZZNVCODEC_PIXEL_FORMAT_YUYV422,
 	ZZNVCODEC_PIXEL_FORMAT_H264,
 	ZZNVCODEC_PIXEL_FORMAT_H265,
+	ZZNVCODEC_PIXEL_FORMAT_VP8,			// one frame per packet, IVF frame header stripped
+	ZZNVCODEC_PIXEL_FORMAT_VP9,
 };
 
 typedef void (*zznvcodec_decoder_on_video_frame_t)(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser);
+typedef void (*zznvcodec_decoder_on_video_dmabuf_t)(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp, intptr_t pUser);
+typedef void (*zznvcodec_decoder_on_format_change_t)(zznvcodec_video_format_t* pFormat, intptr_t pUser);
 typedef void (*zznvcodec_encoder_on_video_packet_t)(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp, intptr_t pUser);
+typedef void (*zznvcodec_encoder_on_video_packet_info_t)(unsigned char* pBuffer, zznvcodec_encoder_packet_info_t* pInfo, int64_t nTimestamp, intptr_t pUser);
+typedef void (*zznvcodec_encoder_on_frame_done_t)(int64_t nTimestamp, intptr_t pUser);
+typedef void (*zznvcodec_encoder_on_dmabuf_release_t)(int nFD, int64_t nReleaseHandle, int64_t nTimestamp, intptr_t pUser);
+
+// NvBuffers shared by the decoders and encoders of a session, pooled by (width, height, colour format,
+// layout). Buffers released by Stop() are reused by the next Start() of any instance of the session.
+ZZNVCODEC_API zznvcodec_session_t* zznvcodec_session_new();
+// The session has to outlive every decoder and encoder using it, and every decoder video frame still referenced.
+ZZNVCODEC_API void zznvcodec_session_delete(zznvcodec_session_t* pThis);
+// Frees the buffers no instance is using.
+ZZNVCODEC_API void zznvcodec_session_trim(zznvcodec_session_t* pThis);
+// Fills up to nMaxPools entries, returns the number of pools.
+ZZNVCODEC_API int zznvcodec_session_get_stats(zznvcodec_session_t* pThis, zznvcodec_pool_stats_t* pStats, int nMaxPools);
 
 ZZNVCODEC_API zznvcodec_decoder_t* zznvcodec_decoder_new();
+// NULL if the backend is not built in
+ZZNVCODEC_API zznvcodec_decoder_t* zznvcodec_decoder_new_with_backend(int nBackend);
 ZZNVCODEC_API void zznvcodec_decoder_delete(zznvcodec_decoder_t* pThis);
 
 ZZNVCODEC_API void zznvcodec_decoder_set_video_property(zznvcodec_decoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat);
 ZZNVCODEC_API void zznvcodec_decoder_set_misc_property(zznvcodec_decoder_t* pThis, int nProperty, intptr_t pValue);
+ZZNVCODEC_API void zznvcodec_decoder_set_session(zznvcodec_decoder_t* pThis, zznvcodec_session_t* pSession);
 ZZNVCODEC_API void zznvcodec_decoder_register_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_video_frame_t pCB, intptr_t pUser);
+ZZNVCODEC_API void zznvcodec_decoder_register_dmabuf_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_video_dmabuf_t pCB, intptr_t pUser);
+// Called from the decoder thread before the first frame of every new geometry. Frames of the
+// old geometry still referenced (or DMABUF frames not released) stall the switch until released.
+ZZNVCODEC_API void zznvcodec_decoder_register_format_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_format_change_t pCB, intptr_t pUser);
 
 ZZNVCODEC_API int zznvcodec_decoder_start(zznvcodec_decoder_t* pThis);
 ZZNVCODEC_API void zznvcodec_decoder_stop(zznvcodec_decoder_t* pThis);
 
-ZZNVCODEC_API void zznvcodec_decoder_set_video_compression_buffer(zznvcodec_decoder_t* pThis, unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp);
+// With ZZNVCODEC_PROP_NONBLOCKING_INPUT and ZZNVCODEC_INPUT_MODE_NALU a packet is queued all or nothing,
+// one decoder bitstream buffer per NAL unit. A packet of more NAL units than ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS
+// can never be queued and fails with ZZNVCODEC_RESULT_ERROR; the default covers SPS, PPS, SEI and IDR slice.
+ZZNVCODEC_API int zznvcodec_decoder_set_video_compression_buffer(zznvcodec_decoder_t* pThis, unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp);
+ZZNVCODEC_API void zznvcodec_decoder_release_dmabuf(zznvcodec_decoder_t* pThis, int64_t nReleaseHandle);
+
+// Keep a decoder video frame valid past the callback; every ref needs a matching unref.
+// The decoder stalls once all frames of the pool are referenced. A frame may outlive the
+// zznvcodec_decoder_stop()/zznvcodec_decoder_delete() of its decoder, its last unref frees it.
+ZZNVCODEC_API void zznvcodec_frame_ref(zznvcodec_video_frame_t* pFrame);
+ZZNVCODEC_API void zznvcodec_frame_unref(zznvcodec_video_frame_t* pFrame);
 
 ZZNVCODEC_API zznvcodec_encoder_t* zznvcodec_encoder_new();
+ZZNVCODEC_API zznvcodec_encoder_t* zznvcodec_encoder_new_with_backend(int nBackend);
 ZZNVCODEC_API void zznvcodec_encoder_delete(zznvcodec_encoder_t* pThis);
 
 ZZNVCODEC_API void zznvcodec_encoder_set_video_property(zznvcodec_encoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat);
 ZZNVCODEC_API void zznvcodec_encoder_set_misc_property(zznvcodec_encoder_t* pThis, int nProperty, intptr_t pValue);
+ZZNVCODEC_API void zznvcodec_encoder_set_session(zznvcodec_encoder_t* pThis, zznvcodec_session_t* pSession);
 ZZNVCODEC_API void zznvcodec_encoder_register_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser);
+// Same packets as zznvcodec_encoder_register_callbacks() with the per-frame encoder metadata,
+// both callbacks are called when both are registered.
+ZZNVCODEC_API void zznvcodec_encoder_register_packet_info_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_video_packet_info_t pCB, intptr_t pUser);
+// Called from the output plane DQ thread once the encoder is done with the frame of nTimestamp
+// and its encoder buffer is free again.
+ZZNVCODEC_API void zznvcodec_encoder_register_frame_done_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_frame_done_t pCB, intptr_t pUser);
+// Called from the output plane DQ thread, or from zznvcodec_encoder_stop(), when the encoder no longer
+// reads a DMABUF given to zznvcodec_encoder_set_video_dmabuf(). Converted DMABUFs are handed back from
+// zznvcodec_encoder_set_video_dmabuf() itself.
+ZZNVCODEC_API void zznvcodec_encoder_register_dmabuf_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_dmabuf_release_t pCB, intptr_t pUser);
 
 ZZNVCODEC_API int zznvcodec_encoder_start(zznvcodec_encoder_t* pThis);
 ZZNVCODEC_API void zznvcodec_encoder_stop(zznvcodec_encoder_t* pThis);
 
-ZZNVCODEC_API void zznvcodec_encoder_set_video_uncompression_buffer(zznvcodec_encoder_t* pThis, zznvcodec_video_frame_t* pFrame, int64_t nTimestamp);
+// pFrame is copied, its memory can be reused on return. Returns ZZNVCODEC_RESULT_EAGAIN instead of
+// waiting for a free encoder buffer with ZZNVCODEC_PROP_NONBLOCKING_INPUT.
+ZZNVCODEC_API int zznvcodec_encoder_set_video_uncompression_buffer(zznvcodec_encoder_t* pThis, zznvcodec_video_frame_t* pFrame, int64_t nTimestamp);
+// Queues the caller's NvBuffer of the video property size. A pitch-linear one in the encoder format (NV12
+// or YUV420P) is encoded without a copy and stays in use until the release callback, other formats and
+// layouts are converted by VIC first. pFrame->fd and pFrame->release_handle are passed back there, a
+// decoder DMABUF frame (block-linear NV12) can be handed on as is and released with
+// zznvcodec_decoder_release_dmabuf().
+ZZNVCODEC_API int zznvcodec_encoder_set_video_dmabuf(zznvcodec_encoder_t* pThis, zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp);
+
+// Frame tracing, off by default. The decoders and encoders record the stages of every frame, keyed by
+// ZZNVCODEC_PROP_TRACE_STREAM and the timestamp, in a ring of nEventsPerThread events per thread
+// (0 disables). The oldest events are overwritten when a ring is full.
+ZZNVCODEC_API void zznvcodec_trace_enable(int nEventsPerThread);
+// Records a stage of the application, pStage is not copied and must outlive the dump (e.g. a literal).
+ZZNVCODEC_API void zznvcodec_trace_event(int nStream, int64_t nTimestamp, const char* pStage, int nPhase);
+// Writes the events so far as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev),
+// returns the number of events or -1.
+ZZNVCODEC_API int zznvcodec_trace_dump(const char* pPath);
 
 #ifdef __cplusplus
 }
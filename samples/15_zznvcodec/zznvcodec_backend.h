@@ -0,0 +1,204 @@
+#ifndef __ZZNVCODEC_BACKEND_H__
+#define __ZZNVCODEC_BACKEND_H__
+
+#include "zznvcodec.h"
+#include "NvThreadPolicy.h"
+#include "NvFrameTracer.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// mFrame must stay first, zznvcodec_frame_ref/unref cast the frame pointer back to the slot.
+// A slot still referenced when its decoder drops the frame pool is detached, mOwner is NULL and
+// the last zznvcodec_frame_unref() hands it to mRelease.
+struct zznvcodec_video_frame_slot_t {
+	zznvcodec_video_frame_t mFrame;
+	zznvcodec_decoder_t* mOwner;
+	int mRefs;
+	void (*mRelease)(zznvcodec_video_frame_slot_t* pSlot);
+};
+
+// taken before the lock of the owner, mOwner changes and detached slots are counted under it
+extern pthread_mutex_t zznvcodec_video_frame_slots_lock;
+
+// ZZNVCODEC_PROP_THREAD_POLICY to the policy the codec threads apply to themselves
+inline void zznvcodec_thread_policy_set(NvThreadPolicy* pPolicy, const zznvcodec_thread_policy_t* p, const char* sName) {
+	nv_thread_policy_init(pPolicy);
+	pPolicy->cpu_mask = p->cpu_mask;
+	pPolicy->sched_policy = p->sched_policy;
+	pPolicy->sched_priority = p->sched_priority;
+	pPolicy->nice = (p->nice == ZZNVCODEC_NICE_KEEP) ? NV_THREAD_NICE_KEEP : p->nice;
+	strncpy(pPolicy->name, sName, sizeof(pPolicy->name) - 1);
+}
+
+// ZZNVCODEC_PROP_TRACE_STREAM, the stages of the frames of one instance
+struct zznvcodec_trace_t {
+	int mStream;
+	int64_t mLastBegin;		// NAL units of one frame share the timestamp, its stage begins once
+
+	zznvcodec_trace_t() : mStream(0), mLastBegin(INT64_MIN) {}
+
+	void Reset() {
+		mLastBegin = INT64_MIN;
+	}
+
+	void Begin(int64_t nTimestamp, const char* sStage) {
+		NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+		if(oTracer.isEnabled())
+			oTracer.trace(mStream, nTimestamp, sStage, NvFrameTracer::TRACE_BEGIN);
+	}
+
+	void BeginOnce(int64_t nTimestamp, const char* sStage) {
+		if(nTimestamp == mLastBegin)
+			return;
+		mLastBegin = nTimestamp;
+		Begin(nTimestamp, sStage);
+	}
+
+	void End(int64_t nTimestamp, const char* sStage) {
+		NvFrameTracer& oTracer = NvFrameTracer::getTracerInstance();
+		if(oTracer.isEnabled())
+			oTracer.trace(mStream, nTimestamp, sStage, NvFrameTracer::TRACE_END);
+	}
+};
+
+#define ZZNVCODEC_MAX_DMABUFS 32
+#define ZZNVCODEC_DMABUF_HANDLE_INDEX_BITS 8
+
+// ZZNVCODEC_OUTPUT_MODE_DMABUF, the decoder buffers the consumer holds. A release handle is the buffer
+// index and a serial number given to every hold, so a handle released twice, or kept past a resolution
+// change or Stop(), no longer matches once the buffer is held again or gone, and is refused. Handles are
+// 64-bit on every target, the serial does not wrap.
+struct zznvcodec_dmabuf_holds_t {
+	pthread_mutex_t mLock;
+	pthread_cond_t mCond;		// broadcast on every release
+	int64_t mHeld[ZZNVCODEC_MAX_DMABUFS];	// serial of the hold, 0 when not held
+	int64_t mSerial;
+
+	zznvcodec_dmabuf_holds_t() : mSerial(0) {
+		pthread_mutex_init(&mLock, NULL);
+		pthread_cond_init(&mCond, NULL);
+		memset(mHeld, 0, sizeof(mHeld));
+	}
+
+	~zznvcodec_dmabuf_holds_t() {
+		pthread_cond_destroy(&mCond);
+		pthread_mutex_destroy(&mLock);
+	}
+
+	int64_t Hold(int nIndex) {
+		pthread_mutex_lock(&mLock);
+		mHeld[nIndex] = ++mSerial;
+		int64_t nReleaseHandle = (mSerial << ZZNVCODEC_DMABUF_HANDLE_INDEX_BITS) | nIndex;
+		pthread_mutex_unlock(&mLock);
+
+		return nReleaseHandle;
+	}
+
+	// with mLock held, so the caller hands the buffer back before the next Reset(). Returns the
+	// index, or -1 for an index >= nNumBuffers or a handle that is not the current hold of its buffer.
+	int ReleaseLocked(int64_t nReleaseHandle, int nNumBuffers) {
+		int nIndex = (int)(nReleaseHandle & ((1 << ZZNVCODEC_DMABUF_HANDLE_INDEX_BITS) - 1));
+		int64_t nSerial = nReleaseHandle >> ZZNVCODEC_DMABUF_HANDLE_INDEX_BITS;
+
+		if(nIndex >= nNumBuffers || nSerial <= 0 || mHeld[nIndex] != nSerial)
+			return -1;
+
+		mHeld[nIndex] = 0;
+		pthread_cond_broadcast(&mCond);
+		return nIndex;
+	}
+
+	bool IsHeldLocked(int nIndex) {
+		return mHeld[nIndex] != 0;
+	}
+
+	// forgets every hold and invalidates the handles given out so far, returns the buffers still held
+	int Reset() {
+		int nHeld = 0;
+
+		pthread_mutex_lock(&mLock);
+		for(int i = 0;i < ZZNVCODEC_MAX_DMABUFS;++i) {
+			if(mHeld[i])
+				nHeld++;
+		}
+		memset(mHeld, 0, sizeof(mHeld));
+		pthread_mutex_unlock(&mLock);
+
+		return nHeld;
+	}
+
+	// until the consumer has released every buffer, or *pStop is set and Wake() called
+	void WaitIdle(volatile int* pStop) {
+		pthread_mutex_lock(&mLock);
+		while(! *pStop) {
+			bool bIdle = true;
+			for(int i = 0;i < ZZNVCODEC_MAX_DMABUFS;++i) {
+				if(mHeld[i]) {
+					bIdle = false;
+					break;
+				}
+			}
+			if(bIdle)
+				break;
+
+			pthread_cond_wait(&mCond, &mLock);
+		}
+		pthread_mutex_unlock(&mLock);
+	}
+
+	void Wake() {
+		pthread_mutex_lock(&mLock);
+		pthread_cond_broadcast(&mCond);
+		pthread_mutex_unlock(&mLock);
+	}
+};
+
+// The C API in zznvcodec.cpp dispatches to one implementation per zznvcodec_backend_t.
+struct zznvcodec_decoder_t {
+	virtual ~zznvcodec_decoder_t() {}
+
+	virtual void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) = 0;
+	virtual void SetMiscProperty(int nProperty, intptr_t pValue) = 0;
+	virtual void SetSession(zznvcodec_session_t* pSession) = 0;
+	virtual void RegisterCallbacks(zznvcodec_decoder_on_video_frame_t pCB, intptr_t pUser) = 0;
+	virtual void RegisterDMABufCallbacks(zznvcodec_decoder_on_video_dmabuf_t pCB, intptr_t pUser) = 0;
+	virtual void RegisterFormatCallbacks(zznvcodec_decoder_on_format_change_t pCB, intptr_t pUser) = 0;
+
+	virtual int Start() = 0;
+	virtual void Stop() = 0;
+
+	virtual int SetVideoCompressionBuffer(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) = 0;
+	virtual void ReleaseDMABuf(int64_t nReleaseHandle) = 0;
+
+	virtual void RefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) = 0;
+	virtual void UnrefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) = 0;
+};
+
+struct zznvcodec_encoder_t {
+	virtual ~zznvcodec_encoder_t() {}
+
+	virtual void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) = 0;
+	virtual void SetMiscProperty(int nProperty, intptr_t pValue) = 0;
+	virtual void SetSession(zznvcodec_session_t* pSession) = 0;
+	virtual void RegisterCallbacks(zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser) = 0;
+	virtual void RegisterPacketInfoCallbacks(zznvcodec_encoder_on_video_packet_info_t pCB, intptr_t pUser) = 0;
+	virtual void RegisterFrameDoneCallbacks(zznvcodec_encoder_on_frame_done_t pCB, intptr_t pUser) = 0;
+	virtual void RegisterDMABufCallbacks(zznvcodec_encoder_on_dmabuf_release_t pCB, intptr_t pUser) = 0;
+
+	virtual int Start() = 0;
+	virtual void Stop() = 0;
+
+	virtual int SetVideoUncompressionBuffer(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) = 0;
+	virtual int SetVideoDMABuf(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp) = 0;
+};
+
+// NvVideoDecoder/NvVideoEncoder, not built with ZZNVCODEC_SW_ONLY
+zznvcodec_decoder_t* zznvdec_new();
+zznvcodec_encoder_t* zznvenc_new();
+
+// CPU only, H.264 I_PCM
+zznvcodec_decoder_t* zzswdec_new();
+zznvcodec_encoder_t* zzswenc_new();
+
+#endif // __ZZNVCODEC_BACKEND_H__
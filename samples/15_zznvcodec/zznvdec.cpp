@@ -1,6 +1,9 @@
-#include "zznvcodec.h"
+#include "zznvcodec_backend.h"
 #include "NvVideoDecoder.h"
+#include "NvNalScanner.h"
 #include "ZzLog.h"
+#include "zznvsession.h"
+#include "zznvdec_poll.h"
 
 #include "NvUtils.h"
 #include <errno.h>
@@ -18,15 +21,13 @@
 
 #define CHUNK_SIZE 4000000
 #define MAX_BUFFERS 32
-#define MAX_VIDEO_BUFFERS 4
+#define MAX_VIDEO_BUFFERS 16
+#define DEFAULT_VIDEO_BUFFERS 4
+#define DEFAULT_OUTPUT_PLANE_BUFFERS 4	// SPS, PPS, SEI and IDR slice, an access unit queued whole with ZZNVCODEC_PROP_NONBLOCKING_INPUT
 
 ZZ_INIT_LOG("zznvdec");
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
+#define MAX_NAL_UNITS_PER_SCAN 64
 
 static int MapDMABuf(int dmabuf_fd, unsigned int planes, void** ppsrc_data)
 {
@@ -60,22 +61,60 @@ static void UnmapDMABuf(int dmabuf_fd, unsigned int planes, void** ppsrc_data) {
 	}
 }
 
-struct zznvcodec_decoder_t {
+// a frame of the video frame pool, a pitch-linear NvBuffer of the session mapped for the consumer
+struct zznvdec_video_frame_slot_t : public zznvcodec_video_frame_slot_t {
+	int mFD;
+	zznvcodec_session_t* mSession;
+};
+
+static void DestroyVideoFrameBuffer(zznvdec_video_frame_slot_t* pSlot) {
+	zznvcodec_video_frame_t& oVideoFrame = pSlot->mFrame;
+
+	if(pSlot->mFD == 0)
+		return;
+
+	if(oVideoFrame.num_planes != 0) {
+		void* pPlanes[ZZNVCODEC_MAX_PLANES] = {
+			oVideoFrame.planes[0].ptr,
+			oVideoFrame.planes[1].ptr,
+			oVideoFrame.planes[2].ptr };
+		UnmapDMABuf(pSlot->mFD, oVideoFrame.num_planes, pPlanes);
+	}
+
+	zznvsession_destroy_buffer(pSlot->mSession, pSlot->mFD);
+	pSlot->mFD = 0;
+	memset(&oVideoFrame, 0, sizeof(oVideoFrame));
+}
+
+// the last unref of a detached slot
+static void ReleaseVideoFrameSlot(zznvcodec_video_frame_slot_t* pSlot) {
+	zznvdec_video_frame_slot_t* pVideoSlot = static_cast<zznvdec_video_frame_slot_t*>(pSlot);
+
+	DestroyVideoFrameBuffer(pVideoSlot);
+	delete pVideoSlot;
+}
+
+struct zznvdec_t : public zznvcodec_decoder_t, public zznvdec_poll_ops_t {
 	enum {
 		STATE_READY,
 		STATE_STARTED,
 	} mState;
 
 	NvVideoDecoder* mDecoder;
+	zznvcodec_session_t* mSession;
 	pthread_t mDecoderThread;
 
 	int mDMABufFDs[MAX_BUFFERS];
 	int mNumCapBuffers;
-	int mVideoDMAFDs[MAX_VIDEO_BUFFERS];
-	zznvcodec_video_frame_t mVideoFrames[MAX_VIDEO_BUFFERS];
+	zznvdec_video_frame_slot_t* mVideoFrames[MAX_VIDEO_BUFFERS];
+	int mNumVideoBuffers;
 	int mCurVideoDMAFDIndex;
+	pthread_mutex_t mVideoFramesLock;
+	pthread_cond_t mVideoFramesCond;
 	int mFormatWidth;
 	int mFormatHeight;
+	int mCropWidth;
+	int mCropHeight;
 	volatile int mGotEOS;
 	int mGotError;
 
@@ -84,24 +123,51 @@ struct zznvcodec_decoder_t {
 	zznvcodec_pixel_format_t mFormat;
 	zznvcodec_decoder_on_video_frame_t mOnVideoFrame;
 	intptr_t mOnVideoFrame_User;
+	zznvcodec_decoder_on_format_change_t mOnFormatChange;
+	intptr_t mOnFormatChange_User;
 	int mMaxPreloadBuffers;
-	int mPreloadBuffersIndex;
+	int mFreeOutputBuffers[MAX_BUFFERS];
+	int mNumFreeOutputBuffers;
+	zznvcodec_input_mode_t mInputMode;
+	int mNonBlockingInput;
 	NvBufferColorFormat mBufferColorFormat;
 	int mV4L2PixFmt;
 
-	explicit zznvcodec_decoder_t() {
+	zznvcodec_output_mode_t mOutputMode;
+	zznvcodec_decoder_on_video_dmabuf_t mOnVideoDMABuf;
+	intptr_t mOnVideoDMABuf_User;
+	zznvcodec_dmabuf_holds_t mDMABufHolds;
+	bool mCaptureReconfiguring;
+
+	pthread_mutex_t mPollLock;
+	pthread_cond_t mPollCond;
+	bool mOutputPlaneWanted;
+	int mOutputPlaneGeneration;
+
+	NvThreadPolicy mThreadPolicy; // decoder thread
+	zznvcodec_trace_t mTrace;
+
+	explicit zznvdec_t() {
 		mState = STATE_READY;
 
 		mDecoder = NULL;
+		mSession = NULL;
 		mDecoderThread = (pthread_t)NULL;
+		nv_thread_policy_init(&mThreadPolicy);
 
 		memset(mDMABufFDs, 0, sizeof(mDMABufFDs));
 		mNumCapBuffers = 0;
-		memset(mVideoDMAFDs, 0, sizeof(mVideoDMAFDs));
-		memset(mVideoFrames, 0, sizeof(mVideoFrames));
+		for(int i = 0;i < MAX_VIDEO_BUFFERS;++i) {
+			mVideoFrames[i] = NewVideoFrameSlot();
+		}
+		mNumVideoBuffers = DEFAULT_VIDEO_BUFFERS;
 		mCurVideoDMAFDIndex = 0;
+		pthread_mutex_init(&mVideoFramesLock, NULL);
+		pthread_cond_init(&mVideoFramesCond, NULL);
 		mFormatWidth = 0;
 		mFormatHeight = 0;
+		mCropWidth = 0;
+		mCropHeight = 0;
 		mGotEOS = 0;
 		mGotError = 0;
 
@@ -110,16 +176,47 @@ struct zznvcodec_decoder_t {
 		mFormat = ZZNVCODEC_PIXEL_FORMAT_UNKNOWN;
 		mOnVideoFrame = NULL;
 		mOnVideoFrame_User = 0;
-		mMaxPreloadBuffers = 2;
-		mPreloadBuffersIndex = 0;
+		mOnFormatChange = NULL;
+		mOnFormatChange_User = 0;
+		mMaxPreloadBuffers = DEFAULT_OUTPUT_PLANE_BUFFERS;
+		memset(mFreeOutputBuffers, 0, sizeof(mFreeOutputBuffers));
+		mNumFreeOutputBuffers = 0;
+		mInputMode = ZZNVCODEC_INPUT_MODE_NALU;
+		mNonBlockingInput = 0;
 		mBufferColorFormat = NvBufferColorFormat_Invalid;
 		mV4L2PixFmt = V4L2_PIX_FMT_H264;
+
+		mOutputMode = ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME;
+		mOnVideoDMABuf = NULL;
+		mOnVideoDMABuf_User = 0;
+		mCaptureReconfiguring = false;
+
+		pthread_mutex_init(&mPollLock, NULL);
+		pthread_cond_init(&mPollCond, NULL);
+		mOutputPlaneWanted = false;
+		mOutputPlaneGeneration = 0;
 	}
 
-	~zznvcodec_decoder_t() {
+	~zznvdec_t() {
 		if(mState != STATE_READY) {
 			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
 		}
+
+		for(int i = 0;i < MAX_VIDEO_BUFFERS;++i) {
+			delete mVideoFrames[i];
+		}
+		pthread_cond_destroy(&mPollCond);
+		pthread_mutex_destroy(&mPollLock);
+		pthread_cond_destroy(&mVideoFramesCond);
+		pthread_mutex_destroy(&mVideoFramesLock);
+	}
+
+	void SetSession(zznvcodec_session_t* pSession) {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): session can not be changed while started", __FUNCTION__, __LINE__);
+			return;
+		}
+		mSession = pSession;
 	}
 
 	void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
@@ -146,11 +243,65 @@ struct zznvcodec_decoder_t {
 		switch(nProperty) {
 		case ZZNVCODEC_PROP_ENCODER_PIX_FMT: {
 			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): codec can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
 			switch(*p) {
 			case ZZNVCODEC_PIXEL_FORMAT_H264:
 				mV4L2PixFmt = V4L2_PIX_FMT_H264;
 				break;
 
+			case ZZNVCODEC_PIXEL_FORMAT_H265:
+				mV4L2PixFmt = V4L2_PIX_FMT_H265;
+				break;
+
+			case ZZNVCODEC_PIXEL_FORMAT_VP8:
+				mV4L2PixFmt = V4L2_PIX_FMT_VP8;
+				break;
+
+			case ZZNVCODEC_PIXEL_FORMAT_VP9:
+				mV4L2PixFmt = V4L2_PIX_FMT_VP9;
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_OUTPUT_MODE: {
+			int* p = (int*)pValue;
+			switch(*p) {
+			case ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME:
+			case ZZNVCODEC_OUTPUT_MODE_DMABUF:
+				if(mState != STATE_READY) {
+					LOGE("%s(%d): output mode can not be changed while started", __FUNCTION__, __LINE__);
+					break;
+				}
+				mOutputMode = (zznvcodec_output_mode_t)*p;
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_INPUT_MODE: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): input mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			switch(*p) {
+			case ZZNVCODEC_INPUT_MODE_NALU:
+			case ZZNVCODEC_INPUT_MODE_ACCESS_UNIT:
+				mInputMode = (zznvcodec_input_mode_t)*p;
+				break;
+
 			default:
 				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
 				break;
@@ -158,6 +309,62 @@ struct zznvcodec_decoder_t {
 		}
 			break;
 
+		case ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): output plane buffers can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mMaxPreloadBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_NONBLOCKING_INPUT: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): blocking mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mNonBlockingInput = (*p != 0);
+		}
+			break;
+
+		case ZZNVCODEC_PROP_FRAME_POOL_SIZE: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): frame pool size can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_VIDEO_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mNumVideoBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_THREAD_POLICY:
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): thread policy can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			zznvcodec_thread_policy_set(&mThreadPolicy, (zznvcodec_thread_policy_t*)pValue, "zznvdec");
+			break;
+
+		case ZZNVCODEC_PROP_TRACE_STREAM: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): trace stream can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mTrace.mStream = *p;
+		}
+			break;
+
 		default:
 			LOGE("%s(%d): unexpected value, nProperty = %d", __FUNCTION__, __LINE__, nProperty);
 		}
@@ -168,6 +375,16 @@ struct zznvcodec_decoder_t {
 		mOnVideoFrame_User = pUser;
 	}
 
+	void RegisterDMABufCallbacks(zznvcodec_decoder_on_video_dmabuf_t pCB, intptr_t pUser) {
+		mOnVideoDMABuf = pCB;
+		mOnVideoDMABuf_User = pUser;
+	}
+
+	void RegisterFormatCallbacks(zznvcodec_decoder_on_format_change_t pCB, intptr_t pUser) {
+		mOnFormatChange = pCB;
+		mOnFormatChange_User = pUser;
+	}
+
 	int Start() {
 		int ret;
 
@@ -178,7 +395,8 @@ struct zznvcodec_decoder_t {
 
 		LOGD("Start decoder...");
 
-		mDecoder = NvVideoDecoder::createVideoDecoder("dec0");
+		// DevicePoll/SetPollInterrupt need O_NONBLOCK, blocking input is emulated in ReclaimOutputBuffer
+		mDecoder = NvVideoDecoder::createVideoDecoder("dec0", O_NONBLOCK);
 		if(! mDecoder) {
 			LOGE("%s(%d): NvVideoDecoder::createVideoDecoder failed", __FUNCTION__, __LINE__);
 		}
@@ -188,12 +406,12 @@ struct zznvcodec_decoder_t {
 			LOGE("%s(%d): subscribeEvent failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
-		ret = mDecoder->setOutputPlaneFormat(V4L2_PIX_FMT_H264, CHUNK_SIZE);
+		ret = mDecoder->setOutputPlaneFormat(mV4L2PixFmt, CHUNK_SIZE);
 		if(ret) {
 			LOGE("%s(%d): setOutputPlaneFormat failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
-		ret = mDecoder->setFrameInputMode(0); // 0 --> NALu-based, 1 --> Chunk-based
+		ret = mDecoder->setFrameInputMode(IsFrameInput() ? 1 : 0); // 0 --> NALu-based, 1 --> Chunk-based
 		if(ret) {
 			LOGE("%s(%d): setFrameInputMode failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
@@ -202,6 +420,15 @@ struct zznvcodec_decoder_t {
 		if(ret) {
 			LOGE("%s(%d): setupPlane failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
+		if(mNonBlockingInput && ! IsFrameInput() && mMaxPreloadBuffers < DEFAULT_OUTPUT_PLANE_BUFFERS) {
+			LOGW("%s(%d): ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS=%d, nonblocking NALU input fails packets of more NAL units",
+				__FUNCTION__, __LINE__, mMaxPreloadBuffers);
+		}
+
+		mNumFreeOutputBuffers = 0;
+		for(uint32_t i = 0;i < mDecoder->output_plane.getNumBuffers() && i < MAX_BUFFERS;++i) {
+			mFreeOutputBuffers[mNumFreeOutputBuffers++] = i;
+		}
 
 		ret = mDecoder->output_plane.setStreamStatus(true);
 		if(ret) {
@@ -214,6 +441,7 @@ struct zznvcodec_decoder_t {
 			LOGE("%s(%d): pthread_create failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
+		mTrace.Reset();
 		mState = STATE_STARTED;
 
 		LOGD("Start decoder... DONE");
@@ -222,8 +450,6 @@ struct zznvcodec_decoder_t {
 	}
 
 	void Stop() {
-		int ret;
-
 		if(mState != STATE_STARTED) {
 			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
 			return;
@@ -231,72 +457,151 @@ struct zznvcodec_decoder_t {
 
 		LOGD("Stop decoder...");
 
+		pthread_mutex_lock(&mVideoFramesLock);
 		mGotEOS = 1;
+		pthread_cond_broadcast(&mVideoFramesCond);
+		pthread_mutex_unlock(&mVideoFramesLock);
+		mDMABufHolds.Wake();
+		pthread_mutex_lock(&mPollLock);
+		pthread_cond_broadcast(&mPollCond);
+		pthread_mutex_unlock(&mPollLock);
+		mDecoder->SetPollInterrupt();
 		mDecoder->abort();
 
 		pthread_join(mDecoderThread, NULL);
-		mDecoder = NULL;
 
+		ResetDMABufHeld();
+		mCaptureReconfiguring = false;
+
+		// the capture buffers are only free once the decoder is gone
 		delete mDecoder;
 		mDecoder = NULL;
 
 		for(int i = 0 ; i < mNumCapBuffers ; i++) {
 			if(mDMABufFDs[i] != 0) {
-				ret = NvBufferDestroy (mDMABufFDs[i]);
+				zznvsession_destroy_buffer(mSession, mDMABufFDs[i]);
 			}
 		}
 		memset(mDMABufFDs, 0, sizeof(mDMABufFDs));
 		mNumCapBuffers = 0;
-		for(int i = 0 ; i < MAX_VIDEO_BUFFERS ; i++) {
-			if(mVideoDMAFDs[i] != 0) {
-				if(mVideoFrames[i].num_planes != 0) {
-					void* pPlanes[ZZNVCODEC_MAX_PLANES] = {
-						mVideoFrames[i].planes[0].ptr,
-						mVideoFrames[i].planes[1].ptr,
-						mVideoFrames[i].planes[2].ptr };
-					UnmapDMABuf(mVideoDMAFDs[i], mVideoFrames[i].num_planes, pPlanes);
-				}
-				ret = NvBufferDestroy (mVideoDMAFDs[i]);
-			}
-		}
-		memset(mVideoDMAFDs, 0, sizeof(mVideoDMAFDs));
-		memset(mVideoFrames, 0, sizeof(mVideoFrames));
-		mCurVideoDMAFDIndex = 0;
+		DestroyVideoBuffers();
 		mFormatWidth = 0;
 		mFormatHeight = 0;
+		mCropWidth = 0;
+		mCropHeight = 0;
 		mGotEOS = 0;
 		mGotError = 0;
-		mMaxPreloadBuffers = 2;
-		mPreloadBuffersIndex = 0;
+		memset(mFreeOutputBuffers, 0, sizeof(mFreeOutputBuffers));
+		mNumFreeOutputBuffers = 0;
 		mBufferColorFormat = NvBufferColorFormat_Invalid;
+		mOutputPlaneWanted = false;
 
 		mState = STATE_READY;
 
 		LOGD("Stop decoder... DONE");
 	}
 
-	void EnqueuePacket(unsigned char* pBuffer, int nSize, int64_t nTimestamp) {
+	// sleep until the decoder thread sees POLLOUT, the device is opened O_NONBLOCK
+	int WaitOutputPlane() {
+		int ret = ZZNVCODEC_RESULT_OK;
+
+		pthread_mutex_lock(&mPollLock);
+		int nGeneration = mOutputPlaneGeneration;
+		mOutputPlaneWanted = true;
+		pthread_mutex_unlock(&mPollLock);
+
+		// kick the decoder thread so it polls again with POLLOUT
+		mDecoder->SetPollInterrupt();
+
+		pthread_mutex_lock(&mPollLock);
+		while(nGeneration == mOutputPlaneGeneration) {
+			if(mGotEOS || mGotError) {
+				ret = ZZNVCODEC_RESULT_ERROR;
+				break;
+			}
+			pthread_cond_wait(&mPollCond, &mPollLock);
+		}
+		pthread_mutex_unlock(&mPollLock);
+
+		return ret;
+	}
+
+	// get one output plane buffer back from the decoder
+	int ReclaimOutputBuffer(bool bBlock) {
+		int ret;
+		struct v4l2_buffer v4l2_buf;
+		struct v4l2_plane planes[MAX_PLANES];
+
+		for(;;) {
+			memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+			memset(planes, 0, sizeof(planes));
+
+			v4l2_buf.m.planes = planes;
+
+			ret = mDecoder->output_plane.dqBuffer(v4l2_buf, NULL, NULL, 0);
+			if(ret == 0)
+				break;
+
+			if(errno != EAGAIN) {
+				LOGE("%s(%d): Error DQing buffer at output plane", __FUNCTION__, __LINE__);
+				return ZZNVCODEC_RESULT_ERROR;
+			}
+
+			if(! bBlock)
+				return ZZNVCODEC_RESULT_EAGAIN;
+
+			ret = WaitOutputPlane();
+			if(ret != ZZNVCODEC_RESULT_OK)
+				return ret;
+		}
+
+		mFreeOutputBuffers[mNumFreeOutputBuffers++] = v4l2_buf.index;
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	// make at least nCount output plane buffers available without blocking
+	int ReserveOutputBuffers(int nCount) {
+		int ret;
+
+		if(nCount > (int)mDecoder->output_plane.getNumBuffers()) {
+			LOGE("%s(%d): %d NAL units in one packet but only %d output plane buffers, raise ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS",
+				__FUNCTION__, __LINE__, nCount, mDecoder->output_plane.getNumBuffers());
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		while(mNumFreeOutputBuffers < nCount) {
+			ret = ReclaimOutputBuffer(false);
+			if(ret != ZZNVCODEC_RESULT_OK)
+				return ret;
+		}
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	int EnqueuePacket(unsigned char* pBuffer, int nSize, int64_t nTimestamp) {
 		int ret;
 		struct v4l2_buffer v4l2_buf;
 		struct v4l2_plane planes[MAX_PLANES];
 		NvBuffer *buffer;
 
+		if(mNumFreeOutputBuffers == 0) {
+			ret = ReclaimOutputBuffer(! mNonBlockingInput);
+			if(ret != ZZNVCODEC_RESULT_OK)
+				return ret;
+		}
+
 		memset(&v4l2_buf, 0, sizeof(v4l2_buf));
 		memset(planes, 0, sizeof(planes));
 
 		v4l2_buf.m.planes = planes;
+		v4l2_buf.index = mFreeOutputBuffers[--mNumFreeOutputBuffers];
+		buffer = mDecoder->output_plane.getNthBuffer(v4l2_buf.index);
 
-		if(mPreloadBuffersIndex == mDecoder->output_plane.getNumBuffers()) {
-			// reused
-			ret = mDecoder->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, -1);
-			if(ret < 0) {
-				LOGE("%s(%d): Error DQing buffer at output plane", __FUNCTION__, __LINE__);
-			}
-		} else {
-			// preload
-			buffer = mDecoder->output_plane.getNthBuffer(mPreloadBuffersIndex);
-			v4l2_buf.index = mPreloadBuffersIndex;
-			mPreloadBuffersIndex++;
+		if(nSize > (int)buffer->planes[0].length) {
+			LOGE("%s(%d): packet too large, nSize=%d, length=%d", __FUNCTION__, __LINE__, nSize, buffer->planes[0].length);
+			mFreeOutputBuffers[mNumFreeOutputBuffers++] = v4l2_buf.index;
+			return ZZNVCODEC_RESULT_ERROR;
 		}
 
 		char *buffer_ptr = (char *) buffer->planes[0].data;
@@ -322,202 +627,486 @@ struct zznvcodec_decoder_t {
 		if (ret < 0)
 		{
 			LOGE("%s(%d): Error Qing buffer at output plane", __FUNCTION__, __LINE__);
+			mFreeOutputBuffers[mNumFreeOutputBuffers++] = v4l2_buf.index;
+			return ZZNVCODEC_RESULT_ERROR;
 		}
+
+		return ZZNVCODEC_RESULT_OK;
 	}
 
-	void SetVideoCompressionBuffer(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) {
-#if 0
-		EnqueuePacket(pBuffer, nSize, nTimestamp);
-#else
-		// find first NALu
-		int start_bytes;
-		while(nSize > 4) {
-			if(IS_NAL_UNIT_START(pBuffer)) {
-				start_bytes = 4;
-				break;
-			} else if(IS_NAL_UNIT_START1(pBuffer)) {
-				start_bytes = 3;
+	// VP8/VP9 have no start codes, they are always fed frame by frame
+	bool IsFrameInput() {
+		return mInputMode == ZZNVCODEC_INPUT_MODE_ACCESS_UNIT ||
+			mV4L2PixFmt == V4L2_PIX_FMT_VP8 || mV4L2PixFmt == V4L2_PIX_FMT_VP9;
+	}
+
+	int SetVideoCompressionBuffer(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) {
+		int ret;
+
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		mTrace.BeginOnce(nTimestamp, "decode");
+
+		if(IsFrameInput()) {
+			// one buffer per access unit or VP8/VP9 frame, the decoder splits the NAL units itself
+			return EnqueuePacket(pBuffer, nSize, nTimestamp);
+		}
+
+		NvNalUnit oUnits[MAX_NAL_UNITS_PER_SCAN];
+		NvNalCodec nCodec = (mV4L2PixFmt == V4L2_PIX_FMT_H265) ? NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
+
+		// bytes in front of the first start code are dropped, the last NALu runs to the end of the packet
+		while(nSize > 0) {
+			int nUnits = nv_nal_scan_units(pBuffer, nSize, nCodec, oUnits, MAX_NAL_UNITS_PER_SCAN);
+			if(nUnits == 0)
 				break;
+
+			int nConsumed = (int)(oUnits[nUnits - 1].offset + oUnits[nUnits - 1].size);
+
+			if(mNonBlockingInput) {
+				// all or nothing, a packet is never half enqueued when EAGAIN is returned
+				if(nConsumed != nSize) {
+					LOGE("%s(%d): more than %d NAL units in one packet", __FUNCTION__, __LINE__, MAX_NAL_UNITS_PER_SCAN);
+					return ZZNVCODEC_RESULT_ERROR;
+				}
+
+				ret = ReserveOutputBuffers(nUnits);
+				if(ret != ZZNVCODEC_RESULT_OK)
+					return ret;
 			}
 
-			pBuffer++;
-			nSize--;
+			for(int i = 0;i < nUnits;++i) {
+				ret = EnqueuePacket(pBuffer + oUnits[i].offset, (int)oUnits[i].size, nTimestamp);
+				if(ret != ZZNVCODEC_RESULT_OK)
+					return ret;
+			}
+
+			pBuffer += nConsumed;
+			nSize -= nConsumed;
 		}
 
-		// find rest of NALu
-		while(true) {
-			unsigned char* next_nalu = pBuffer + start_bytes;
-			int next_size = nSize - start_bytes;
-			int next_start_bytes;
-			while(next_size > 4) {
-				if(IS_NAL_UNIT_START(next_nalu)) {
-					next_start_bytes = 4;
-					break;
-				} else if(IS_NAL_UNIT_START1(next_nalu)) {
-					next_start_bytes = 3;
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	zznvdec_video_frame_slot_t* NewVideoFrameSlot() {
+		zznvdec_video_frame_slot_t* pSlot = new zznvdec_video_frame_slot_t();
+
+		pSlot->mOwner = this;
+		pSlot->mRelease = ReleaseVideoFrameSlot;
+		return pSlot;
+	}
+
+	// frames the consumer still references are detached and replaced, their last unref frees them
+	void DestroyVideoBuffers() {
+		int nHeld = 0;
+
+		pthread_mutex_lock(&zznvcodec_video_frame_slots_lock);
+		pthread_mutex_lock(&mVideoFramesLock);
+		for(int i = 0 ; i < MAX_VIDEO_BUFFERS ; i++) {
+			zznvdec_video_frame_slot_t* pSlot = mVideoFrames[i];
+
+			if(pSlot->mRefs != 0) {
+				pSlot->mOwner = NULL;
+				mVideoFrames[i] = NewVideoFrameSlot();
+				nHeld++;
+				continue;
+			}
+
+			DestroyVideoFrameBuffer(pSlot);
+		}
+		mCurVideoDMAFDIndex = 0;
+		pthread_mutex_unlock(&mVideoFramesLock);
+		pthread_mutex_unlock(&zznvcodec_video_frame_slots_lock);
+
+		if(nHeld) {
+			LOGD("%s(%d): %d video frame(s) still referenced, detached", __FUNCTION__, __LINE__, nHeld);
+		}
+	}
+
+	// wait until the consumer has unref'ed every frame, or the decoder is stopping
+	void WaitVideoFramesIdle() {
+		pthread_mutex_lock(&mVideoFramesLock);
+		while(! mGotEOS) {
+			bool bIdle = true;
+			for(int i = 0;i < mNumVideoBuffers;++i) {
+				if(mVideoFrames[i]->mRefs != 0) {
+					bIdle = false;
 					break;
 				}
+			}
+			if(bIdle)
+				break;
 
-				next_nalu++;
-				next_size--;
+			pthread_cond_wait(&mVideoFramesCond, &mVideoFramesLock);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	// pick the next unreferenced slot, blocking the decoder thread while the consumer holds them all
+	int AcquireVideoFrameSlot() {
+		int nIndex = -1;
+		bool bWaited = false;
+
+		pthread_mutex_lock(&mVideoFramesLock);
+		while(! mGotEOS) {
+			for(int i = 0;i < mNumVideoBuffers;++i) {
+				int j = (mCurVideoDMAFDIndex + i) % mNumVideoBuffers;
+				if(mVideoFrames[j]->mRefs == 0) {
+					nIndex = j;
+					break;
+				}
 			}
 
-			if(next_size <= 4) {
-				// the last NALu
-				EnqueuePacket(pBuffer, nSize, nTimestamp);
+			if(nIndex != -1) {
+				mVideoFrames[nIndex]->mRefs = 1;
+				mCurVideoDMAFDIndex = (nIndex + 1) % mNumVideoBuffers;
 				break;
 			}
 
-			EnqueuePacket(pBuffer, (int)(next_nalu - pBuffer), nTimestamp);
-			pBuffer = next_nalu;
-			nSize = next_size;
-			start_bytes = next_start_bytes;
+			if(! bWaited) {
+				LOGV("%s(%d): all %d video frames referenced, waiting...", __FUNCTION__, __LINE__, mNumVideoBuffers);
+				bWaited = true;
+			}
+			pthread_cond_wait(&mVideoFramesCond, &mVideoFramesLock);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+
+		return nIndex;
+	}
+
+	void RefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) {
+		pthread_mutex_lock(&mVideoFramesLock);
+		pSlot->mRefs++;
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	void UnrefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) {
+		pthread_mutex_lock(&mVideoFramesLock);
+		if(pSlot->mRefs <= 0) {
+			LOGE("%s(%d): unbalanced unref, mRefs=%d", __FUNCTION__, __LINE__, pSlot->mRefs);
+		} else if(--pSlot->mRefs == 0) {
+			pthread_cond_broadcast(&mVideoFramesCond);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	void ResetDMABufHeld() {
+		int nHeld = mDMABufHolds.Reset();
+
+		if(nHeld) {
+			LOGW("%s(%d): %d dmabuf frame(s) still held, handles invalidated", __FUNCTION__, __LINE__, nHeld);
+		}
+	}
+
+	// wait until the consumer has released every DMABUF frame, or the decoder is stopping
+	void WaitDMABufIdle() {
+		mDMABufHolds.WaitIdle(&mGotEOS);
+	}
+
+	int QueueCaptureBuffer(int nIndex) {
+		struct v4l2_buffer v4l2_buf;
+		struct v4l2_plane planes[MAX_PLANES];
+
+		memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+		memset(planes, 0, sizeof(planes));
+
+		v4l2_buf.index = nIndex;
+		v4l2_buf.m.planes = planes;
+		v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		v4l2_buf.memory = V4L2_MEMORY_DMABUF;
+		v4l2_buf.m.planes[0].m.fd = mDMABufFDs[nIndex];
+
+		return mDecoder->capture_plane.qBuffer(v4l2_buf, NULL);
+	}
+
+	void ReleaseDMABuf(int64_t nReleaseHandle) {
+		pthread_mutex_lock(&mDMABufHolds.mLock);
+		int nIndex = mDMABufHolds.ReleaseLocked(nReleaseHandle, mState == STATE_STARTED ? mNumCapBuffers : 0);
+		if(nIndex < 0) {
+			pthread_mutex_unlock(&mDMABufHolds.mLock);
+			LOGW("%s(%d): stale release handle %lld", __FUNCTION__, __LINE__, (long long)nReleaseHandle);
+			return;
+		}
+
+		// while reconfiguring the capture plane is streamed off, the buffer goes away with it
+		if(! mCaptureReconfiguring && QueueCaptureBuffer(nIndex) < 0) {
+			LOGE("%s(%d): Error while queueing buffer at decoder capture plane", __FUNCTION__, __LINE__);
+			mGotError = 1;
+		}
+		pthread_mutex_unlock(&mDMABufHolds.mLock);
+	}
+
+	int DeliverDMABuf(struct v4l2_buffer& v4l2_buf) {
+		int ret;
+		int nIndex = v4l2_buf.index;
+		int64_t pts = v4l2_buf.timestamp.tv_sec * 1000000LL + v4l2_buf.timestamp.tv_usec;
+
+		if(! mOnVideoDMABuf) {
+			// nobody to hand it to, give it back to the decoder right away
+			return QueueCaptureBuffer(nIndex);
+		}
+
+		NvBufferParams parm;
+		ret = NvBufferGetParams(mDMABufFDs[nIndex], &parm);
+		if(ret != 0) {
+			LOGE("%s(%d): NvBufferGetParams failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			return QueueCaptureBuffer(nIndex);
+		}
+
+		zznvcodec_dmabuf_frame_t oFrame;
+		memset(&oFrame, 0, sizeof(oFrame));
+		oFrame.fd = mDMABufFDs[nIndex];
+		oFrame.color_format = parm.pixel_format;
+		oFrame.layout = parm.layout[0];
+		oFrame.num_planes = parm.num_planes;
+		for(int i = 0;i < (int)parm.num_planes && i < ZZNVCODEC_MAX_PLANES;++i) {
+			oFrame.planes[i].width = parm.width[i];
+			oFrame.planes[i].height = parm.height[i];
+			oFrame.planes[i].pitch = parm.pitch[i];
+			oFrame.planes[i].offset = parm.offset[i];
+			oFrame.planes[i].size = parm.psize[i];
+		}
+
+		oFrame.release_handle = mDMABufHolds.Hold(nIndex);
+
+		mTrace.Begin(pts, "dec.deliver");
+		mOnVideoDMABuf(&oFrame, pts, mOnVideoDMABuf_User);
+		mTrace.End(pts, "dec.deliver");
+
+		return 0;
+	}
+
+	// returns 0 once the buffer is handed on or back to the decoder, -1 on fatal errors
+	int ProcessCaptureBuffer(struct v4l2_buffer& v4l2_buf, NvBuffer* dec_buffer) {
+		int ret;
+		int64_t pts = v4l2_buf.timestamp.tv_sec * 1000000LL + v4l2_buf.timestamp.tv_usec;
+
+		mTrace.End(pts, "decode");
+
+		if(mOutputMode == ZZNVCODEC_OUTPUT_MODE_DMABUF) {
+			if(DeliverDMABuf(v4l2_buf) < 0) {
+				LOGE("%s(%d): Error while queueing buffer at decoder capture plane", __FUNCTION__, __LINE__);
+				return -1;
+			}
+			return 0;
+		}
+
+		/* Clip & Stitch can be done by adjusting rectangle */
+		NvBufferRect src_rect, dest_rect;
+		src_rect.top = 0;
+		src_rect.left = 0;
+		src_rect.width = mCropWidth;
+		src_rect.height = mCropHeight;
+		dest_rect.top = 0;
+		dest_rect.left = 0;
+		dest_rect.width = mCropWidth;
+		dest_rect.height = mCropHeight;
+		NvBufferTransformParams transform_params;
+		memset(&transform_params,0,sizeof(transform_params));
+		/* Indicates which of the transform parameters are valid */
+		transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+		transform_params.transform_flip = NvBufferTransform_None;
+		transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+		transform_params.src_rect = src_rect;
+		transform_params.dst_rect = dest_rect;
+
+		dec_buffer->planes[0].fd = mDMABufFDs[v4l2_buf.index];
+
+		// video frame pool, the decoder holds one reference across the callback
+		int nSlot = AcquireVideoFrameSlot();
+		if(nSlot == -1) {
+			// stopping, the buffer goes away with the capture plane
+			return 0;
+		}
+		zznvdec_video_frame_slot_t& oSlot = *mVideoFrames[nSlot];
+		int dst_fd = oSlot.mFD;
+		zznvcodec_video_frame_t& oVideoFrame = oSlot.mFrame;
+
+		// Convert Blocklinear to PitchLinear
+		mTrace.Begin(pts, "dec.transform");
+		ret = NvBufferTransform(dec_buffer->planes[0].fd, dst_fd, &transform_params);
+		mTrace.End(pts, "dec.transform");
+		if (ret == -1)
+		{
+			LOGE("%s(%d): Transform failed", __FUNCTION__, __LINE__);
+			UnrefVideoFrame(&oSlot);
+			return -1;
 		}
+
+		NvBufferParams parm;
+		ret = NvBufferGetParams(dst_fd, &parm);
+
+#if 0
+		LOGD("%s(%d): parm={%d(%d) %d, %dx%d(%d) %dx%d(%d) %dx%d(%d)}\n", __FUNCTION__, __LINE__,
+			parm.pixel_format, NvBufferColorFormat_YUV420, parm.num_planes,
+			parm.width[0], parm.height[0], parm.pitch[0],
+			parm.width[1], parm.height[1], parm.pitch[1],
+			parm.width[2], parm.height[2], parm.pitch[2]);
 #endif
+
+		if(oVideoFrame.num_planes == 0) {
+			void* pPlanes[ZZNVCODEC_MAX_PLANES] = { NULL, NULL, NULL };
+			ret = MapDMABuf(dst_fd, parm.num_planes, pPlanes);
+
+			oVideoFrame.num_planes = parm.num_planes;
+			for(int i = 0;i < parm.num_planes;++i) {
+				oVideoFrame.planes[i].width = parm.width[i];
+				oVideoFrame.planes[i].height = parm.height[i];
+				oVideoFrame.planes[i].ptr = (uint8_t*)pPlanes[i];
+				oVideoFrame.planes[i].stride = parm.pitch[i];
+			}
+		}
+
+#if 0
+		LOGD("%s(%d): dst_fd=%d planes[]={%p %p %p}\n", __FUNCTION__, __LINE__, dst_fd,
+			oVideoFrame.planes[0].ptr, oVideoFrame.planes[1].ptr, oVideoFrame.planes[2].ptr);
+#endif
+
+		if(mOnVideoFrame) {
+			mTrace.Begin(pts, "dec.deliver");
+			mOnVideoFrame(&oVideoFrame, pts, mOnVideoFrame_User);
+			mTrace.End(pts, "dec.deliver");
+		}
+		UnrefVideoFrame(&oSlot);
+
+		v4l2_buf.m.planes[0].m.fd = mDMABufFDs[v4l2_buf.index];
+		if (mDecoder->capture_plane.qBuffer(v4l2_buf, NULL) < 0)
+		{
+			LOGE("%s(%d): Error while queueing buffer at decoder capture plane", __FUNCTION__, __LINE__);
+			return -1;
+		}
+
+		return 0;
 	}
 
 	static void* _DecodeMain(void* arg) {
-		zznvcodec_decoder_t* pThis = (zznvcodec_decoder_t*)arg;
+		zznvdec_t* pThis = (zznvdec_t*)arg;
 
 		return pThis->DecoderMain();
 	}
 
-	void* DecoderMain() {
-		int ret, err;
+	// drain the V4L2 event queue, resolution changes (re)build the capture plane
+	void HandleEvents() {
+		int ret;
 		struct v4l2_event ev;
 
-		LOGD("%s: begins", __FUNCTION__);
+		while(! mGotEOS) {
+			ret = mDecoder->dqEvent(ev, 0);
+			if(ret != 0)
+				break;
 
-		bool got_resolution = false;
-		while(! got_resolution && !mGotError) {
-			LOGD("%s(%d): wait for V4L2_EVENT_RESOLUTION_CHANGE...", __FUNCTION__, __LINE__);
-			ret = mDecoder->dqEvent(ev, 50000);
-			if (ret == 0)
-			{
-				switch (ev.type)
-				{
-					case V4L2_EVENT_RESOLUTION_CHANGE:
-						LOGD("%s(%d): New V4L2_EVENT_RESOLUTION_CHANGE received!!", __FUNCTION__, __LINE__);
-						QueryAndSetCapture();
-						got_resolution = true;
-						break;
-
-					default:
-						LOGE("%s(%d): unexpected value, ev.type=%d", __FUNCTION__, __LINE__, ev.type);
-						break;
+			switch(ev.type) {
+			case V4L2_EVENT_RESOLUTION_CHANGE:
+				LOGD("%s(%d): New V4L2_EVENT_RESOLUTION_CHANGE received!!", __FUNCTION__, __LINE__);
+				if(mNumCapBuffers > 0) {
+					// frames of the old geometry go out before the capture plane is rebuilt
+					if(HandleCapture() < 0) {
+						mGotError = 1;
+						return;
+					}
 				}
-			} else {
-				LOGE("%s(%d): failed to received V4L2_EVENT_RESOLUTION_CHANGE, ret=%d", __FUNCTION__, __LINE__, ret);
-				mGotError = 1;
+				QueryAndSetCapture();
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, ev.type=%d", __FUNCTION__, __LINE__, ev.type);
+				break;
 			}
 		}
+	}
 
-		LOGD("start decoding... error=%d, isInError=%d, EOS=%d", mGotError, mDecoder->isInError(), mGotEOS);
-		while (!(mGotError || mDecoder->isInError() || mGotEOS)) {
-			NvBuffer *dec_buffer;
-			struct v4l2_buffer v4l2_buf;
-			struct v4l2_plane planes[MAX_PLANES];
+	// drain every decoded frame that is ready, returns -1 on fatal errors
+	int HandleCapture() {
+		int err;
+		int nCount;
+		NvBuffer *dec_buffers[MAX_DQ_BATCH];
+		struct v4l2_buffer v4l2_bufs[MAX_DQ_BATCH];
+		struct v4l2_plane planes[MAX_DQ_BATCH][MAX_PLANES];
 
-			memset(&v4l2_buf, 0, sizeof(v4l2_buf));
-			memset(planes, 0, sizeof(planes));
-			v4l2_buf.m.planes = planes;
+		memset(v4l2_bufs, 0, sizeof(v4l2_bufs));
+		memset(planes, 0, sizeof(planes));
 
-			// Dequeue a filled buffer
-			if (mDecoder->capture_plane.dqBuffer(v4l2_buf, &dec_buffer, NULL, 0))
+		while(! mGotEOS) {
+			// one plane lock round trip for everything the decoder has ready
+			for(int i = 0;i < MAX_DQ_BATCH;++i) {
+				v4l2_bufs[i].m.planes = planes[i];
+				v4l2_bufs[i].flags = 0;
+			}
+
+			nCount = mDecoder->capture_plane.dqBuffers(v4l2_bufs, dec_buffers, NULL, MAX_DQ_BATCH, 0);
+			if (nCount < 0)
 			{
 				err = errno;
 				if (err == EAGAIN)
-				{
-					usleep(1000);
-					continue;
-				}
-				else
-				{
-					if(! mGotEOS)
-						LOGE("%s(%d): Error while calling dequeue at capture plane, errno=%d", __FUNCTION__, __LINE__, err);
-				}
-				mGotError = 1;
-				break;
+					return 0;
+
+				if(! mGotEOS)
+					LOGE("%s(%d): Error while calling dequeue at capture plane, errno=%d", __FUNCTION__, __LINE__, err);
+				return -1;
 			}
 
-			/* Clip & Stitch can be done by adjusting rectangle */
-			NvBufferRect src_rect, dest_rect;
-			src_rect.top = 0;
-			src_rect.left = 0;
-			src_rect.width = mFormatWidth;
-			src_rect.height = mFormatHeight;
-			dest_rect.top = 0;
-			dest_rect.left = 0;
-			dest_rect.width = mFormatWidth;
-			dest_rect.height = mFormatHeight;
-			NvBufferTransformParams transform_params;
-			memset(&transform_params,0,sizeof(transform_params));
-			/* Indicates which of the transform parameters are valid */
-			transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
-			transform_params.transform_flip = NvBufferTransform_None;
-			transform_params.transform_filter = NvBufferTransform_Filter_Smart;
-			transform_params.src_rect = src_rect;
-			transform_params.dst_rect = dest_rect;
-
-			dec_buffer->planes[0].fd = mDMABufFDs[v4l2_buf.index];
-
-			// ring video frame buffer
-			int dst_fd = mVideoDMAFDs[mCurVideoDMAFDIndex];
-			zznvcodec_video_frame_t& oVideoFrame = mVideoFrames[mCurVideoDMAFDIndex];
-			mCurVideoDMAFDIndex = (mCurVideoDMAFDIndex + 1) % MAX_VIDEO_BUFFERS;
-
-			// Convert Blocklinear to PitchLinear
-			ret = NvBufferTransform(dec_buffer->planes[0].fd, dst_fd, &transform_params);
-			if (ret == -1)
-			{
-				LOGE("%s(%d): Transform failed", __FUNCTION__, __LINE__);
-				mGotError = 1;
-				break;
+			for(int i = 0;i < nCount && ! mGotEOS;++i) {
+				if(ProcessCaptureBuffer(v4l2_bufs[i], dec_buffers[i]) < 0)
+					return -1;
 			}
+		}
 
-			NvBufferParams parm;
-			ret = NvBufferGetParams(dst_fd, &parm);
+		return 0;
+	}
 
-#if 0
-			LOGD("%s(%d): parm={%d(%d) %d, %dx%d(%d) %dx%d(%d) %dx%d(%d)}\n", __FUNCTION__, __LINE__,
-				parm.pixel_format, NvBufferColorFormat_YUV420, parm.num_planes,
-				parm.width[0], parm.height[0], parm.pitch[0],
-				parm.width[1], parm.height[1], parm.pitch[1],
-				parm.width[2], parm.height[2], parm.pitch[2]);
-#endif
+	// wake up ReclaimOutputBuffer() callers
+	void SignalOutputPlane() {
+		pthread_mutex_lock(&mPollLock);
+		mOutputPlaneWanted = false;
+		mOutputPlaneGeneration++;
+		pthread_cond_broadcast(&mPollCond);
+		pthread_mutex_unlock(&mPollLock);
+	}
 
-			if(oVideoFrame.num_planes == 0) {
-				void* pPlanes[ZZNVCODEC_MAX_PLANES] = { NULL, NULL, NULL };
-				ret = MapDMABuf(dst_fd, parm.num_planes, pPlanes);
+	void ClearPollInterrupt() {
+		mDecoder->ClearPollInterrupt();
+	}
 
-				oVideoFrame.num_planes = parm.num_planes;
-				for(int i = 0;i < parm.num_planes;++i) {
-					oVideoFrame.planes[i].width = parm.width[i];
-					oVideoFrame.planes[i].height = parm.height[i];
-					oVideoFrame.planes[i].ptr = (uint8_t*)pPlanes[i];
-					oVideoFrame.planes[i].stride = parm.pitch[i];
-				}
-			}
+	int DevicePoll(uint16_t nReqEvents, uint16_t* pRespEvents) {
+		v4l2_ctrl_video_device_poll devicepoll;
 
-#if 0
-			LOGD("%s(%d): dst_fd=%d planes[]={%p %p %p}\n", __FUNCTION__, __LINE__, dst_fd,
-				oVideoFrame.planes[0].ptr, oVideoFrame.planes[1].ptr, oVideoFrame.planes[2].ptr);
-#endif
+		memset(&devicepoll, 0, sizeof(devicepoll));
+		devicepoll.req_events = nReqEvents;
+		int ret = mDecoder->DevicePoll(&devicepoll);
+		*pRespEvents = devicepoll.resp_events;
 
-			if(mOnVideoFrame) {
-				int64_t pts = v4l2_buf.timestamp.tv_sec * 1000000LL + v4l2_buf.timestamp.tv_usec;
-				mOnVideoFrame(&oVideoFrame, pts, mOnVideoFrame_User);
-			}
+		return ret;
+	}
 
-			v4l2_buf.m.planes[0].m.fd = mDMABufFDs[v4l2_buf.index];
-			if (mDecoder->capture_plane.qBuffer(v4l2_buf, NULL) < 0)
-			{
-				LOGE("%s(%d): Error while queueing buffer at decoder capture plane", __FUNCTION__, __LINE__);
-				mGotError = 1;
-				break;
-			}
+	bool IsInError() {
+		return mDecoder->isInError();
+	}
+
+	bool IsCaptureSetUp() {
+		return mNumCapBuffers > 0;
+	}
+
+	bool IsOutputPlaneWanted() {
+		pthread_mutex_lock(&mPollLock);
+		bool bWanted = mOutputPlaneWanted;
+		pthread_mutex_unlock(&mPollLock);
+
+		return bWanted;
+	}
+
+	// Stop() and WaitOutputPlane() break the poll of zznvdec_poll_loop() with SetPollInterrupt()
+	void* DecoderMain() {
+		LOGD("%s: begins", __FUNCTION__);
+
+		if(! nv_thread_policy_is_default(&mThreadPolicy) && nv_thread_policy_apply(&mThreadPolicy) < 0) {
+			LOGW("%s(%d): thread policy not fully applied, errno=%d", __FUNCTION__, __LINE__, errno);
 		}
 
+		zznvdec_poll_loop(this, &mGotEOS, &mGotError);
+
 		LOGD("%s: ends", __FUNCTION__);
 
 		return NULL;
@@ -536,34 +1125,35 @@ struct zznvcodec_decoder_t {
 		LOGD("Video Resolution: %d x %d (PixFmt=%08X, %dx%d)", crop.c.width, crop.c.height,
 			format.fmt.pix_mp.pixelformat, format.fmt.pix_mp.width, format.fmt.pix_mp.height);
 
+		// only the capture plane is rebuilt, bitstream already queued on the output plane is kept
+		pthread_mutex_lock(&mDMABufHolds.mLock);
+		mCaptureReconfiguring = true;
+		pthread_mutex_unlock(&mDMABufHolds.mLock);
+		mDecoder->capture_plane.setStreamStatus(false);
+
+		WaitDMABufIdle();
+		ResetDMABufHeld();
 		mDecoder->capture_plane.deinitPlane();
 		for(int index = 0 ; index < mNumCapBuffers ; index++) {
 			if(mDMABufFDs[index] != 0) {
-				ret = NvBufferDestroy (mDMABufFDs[index]);
+				zznvsession_destroy_buffer(mSession, mDMABufFDs[index]);
 			}
 		}
 		memset(mDMABufFDs, 0, sizeof(mDMABufFDs));
-		for(int i = 0 ; i < MAX_VIDEO_BUFFERS ; i++) {
-			if(mVideoDMAFDs[i] != 0) {
-				if(mVideoFrames[i].num_planes != 0) {
-					void* pPlanes[ZZNVCODEC_MAX_PLANES] = {
-						mVideoFrames[i].planes[0].ptr,
-						mVideoFrames[i].planes[1].ptr,
-						mVideoFrames[i].planes[2].ptr };
-					UnmapDMABuf(mVideoDMAFDs[i], mVideoFrames[i].num_planes, pPlanes);
-				}
+		mNumCapBuffers = 0;
+		WaitVideoFramesIdle();
+		DestroyVideoBuffers();
 
-				ret = NvBufferDestroy (mVideoDMAFDs[i]);
-			}
-		}
-		memset(mVideoDMAFDs, 0, sizeof(mVideoDMAFDs));
-		memset(mVideoFrames, 0, sizeof(mVideoFrames));
+		if(mGotEOS)
+			return;
 
 		ret = mDecoder->setCapturePlaneFormat(format.fmt.pix_mp.pixelformat, format.fmt.pix_mp.width, format.fmt.pix_mp.height);
 		mFormatHeight = format.fmt.pix_mp.height;
 		mFormatWidth = format.fmt.pix_mp.width;
+		mCropWidth = crop.c.width;
+		mCropHeight = crop.c.height;
 
-		for(int i = 0;i < MAX_VIDEO_BUFFERS;++i) {
+		for(int i = 0;i < mNumVideoBuffers && mOutputMode == ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME;++i) {
 			input_params.payloadType = NvBufferPayload_SurfArray;
 			input_params.width = crop.c.width;
 			input_params.height = crop.c.height;
@@ -571,7 +1161,8 @@ struct zznvcodec_decoder_t {
 			input_params.colorFormat = mBufferColorFormat;
 			input_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
 
-			ret = NvBufferCreateEx (&mVideoDMAFDs[i], &input_params);
+			mVideoFrames[i]->mSession = mSession;
+			ret = zznvsession_create_buffer(mSession, &input_params, &mVideoFrames[i]->mFD);
 		}
 
 		ret = mDecoder->getMinimumCapturePlaneBuffers(min_dec_capture_buffers);
@@ -622,6 +1213,12 @@ struct zznvcodec_decoder_t {
 		}
 
 		mNumCapBuffers = min_dec_capture_buffers + 1;
+		if(mOutputMode == ZZNVCODEC_OUTPUT_MODE_DMABUF) {
+			// the consumer holds frames past the callback, keep the decoder fed meanwhile
+			mNumCapBuffers += mNumVideoBuffers;
+			if(mNumCapBuffers > MAX_BUFFERS)
+				mNumCapBuffers = MAX_BUFFERS;
+		}
 
 		for (int index = 0; index < mNumCapBuffers; index++)
 		{
@@ -630,7 +1227,7 @@ struct zznvcodec_decoder_t {
 			cParams.layout = NvBufferLayout_BlockLinear;
 			cParams.payloadType = NvBufferPayload_SurfArray;
 			cParams.nvbuf_tag = NvBufferTag_VIDEO_DEC;
-			ret = NvBufferCreateEx(&mDMABufFDs[index], &cParams);
+			ret = zznvsession_create_buffer(mSession, &cParams, &mDMABufFDs[index]);
 		}
 		ret = mDecoder->capture_plane.reqbufs(V4L2_MEMORY_DMABUF, mNumCapBuffers);
 
@@ -651,37 +1248,25 @@ struct zznvcodec_decoder_t {
 			v4l2_buf.m.planes[0].m.fd = mDMABufFDs[i];
 			ret = mDecoder->capture_plane.qBuffer(v4l2_buf, NULL);
 		}
-	}
-};
 
-zznvcodec_decoder_t* zznvcodec_decoder_new() {
-	return new zznvcodec_decoder_t();
-}
+		pthread_mutex_lock(&mDMABufHolds.mLock);
+		mCaptureReconfiguring = false;
+		pthread_mutex_unlock(&mDMABufHolds.mLock);
 
-void zznvcodec_decoder_delete(zznvcodec_decoder_t* pThis) {
-	delete pThis;
-}
+		if(mOnFormatChange) {
+			zznvcodec_video_format_t oFormat;
 
-void zznvcodec_decoder_set_video_property(zznvcodec_decoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
-	pThis->SetVideoProperty(nWidth, nHeight, nFormat);
-}
-
-void zznvcodec_decoder_set_misc_property(zznvcodec_decoder_t* pThis, int nProperty, intptr_t pValue) {
-	pThis->SetMiscProperty(nProperty, pValue);
-}
-
-void zznvcodec_decoder_register_callbacks(zznvcodec_decoder_t* pThis, zznvcodec_decoder_on_video_frame_t pCB, intptr_t pUser) {
-	pThis->RegisterCallbacks(pCB, pUser);
-}
-
-int zznvcodec_decoder_start(zznvcodec_decoder_t* pThis) {
-	return pThis->Start();
-}
+			memset(&oFormat, 0, sizeof(oFormat));
+			oFormat.width = mCropWidth;
+			oFormat.height = mCropHeight;
+			oFormat.coded_width = mFormatWidth;
+			oFormat.coded_height = mFormatHeight;
+			oFormat.color_format = cParams.colorFormat;
+			mOnFormatChange(&oFormat, mOnFormatChange_User);
+		}
+	}
+};
 
-void zznvcodec_decoder_stop(zznvcodec_decoder_t* pThis) {
-	return pThis->Stop();
+zznvcodec_decoder_t* zznvdec_new() {
+	return new zznvdec_t();
 }
-
-void zznvcodec_decoder_set_video_compression_buffer(zznvcodec_decoder_t* pThis, unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) {
-	return pThis->SetVideoCompressionBuffer(pBuffer, nSize, nFlags, nTimestamp);
-}
\ No newline at end of file
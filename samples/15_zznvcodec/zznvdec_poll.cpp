@@ -0,0 +1,62 @@
+#include "zznvdec_poll.h"
+#include "ZzLog.h"
+
+#include <poll.h>
+
+ZZ_INIT_LOG("zznvdec_poll");
+
+/*
+ * One DevicePoll per wakeup instead of sleeping between DQ attempts:
+ * POLLIN for decoded frames, POLLPRI for resolution change events and
+ * POLLOUT only while an input caller waits for an output plane buffer.
+ */
+void zznvdec_poll_loop(zznvdec_poll_ops_t* pOps, volatile int* pGotEOS, int* pGotError) {
+	int ret;
+
+	while (!(*pGotError || pOps->IsInError() || *pGotEOS)) {
+		// clear before reading the state it guards, so a later interrupt is never lost
+		pOps->ClearPollInterrupt();
+		if(*pGotEOS)
+			break;
+
+		uint16_t nReqEvents = POLLPRI | POLLERR;
+		uint16_t nRespEvents = 0;
+		if(pOps->IsCaptureSetUp())
+			nReqEvents |= POLLIN;
+		if(pOps->IsOutputPlaneWanted())
+			nReqEvents |= POLLOUT;
+
+		ret = pOps->DevicePoll(nReqEvents, &nRespEvents);
+		if(ret < 0) {
+			if(! *pGotEOS)
+				LOGE("%s(%d): DevicePoll failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			*pGotError = 1;
+			break;
+		}
+
+		if(*pGotEOS)
+			break;
+
+		if(nRespEvents & POLLERR) {
+			LOGE("%s(%d): decoder reported POLLERR", __FUNCTION__, __LINE__);
+			*pGotError = 1;
+			break;
+		}
+
+		if(nRespEvents & POLLPRI)
+			pOps->HandleEvents();
+
+		if(nRespEvents & POLLOUT)
+			pOps->SignalOutputPlane();
+
+		if((nRespEvents & POLLIN) && pOps->IsCaptureSetUp()) {
+			if(pOps->HandleCapture() < 0) {
+				*pGotError = 1;
+				break;
+			}
+		}
+	}
+
+	// let blocked input callers see the error
+	pOps->SignalOutputPlane();
+}
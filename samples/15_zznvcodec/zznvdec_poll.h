@@ -0,0 +1,27 @@
+#ifndef __ZZNVDEC_POLL_H__
+#define __ZZNVDEC_POLL_H__
+
+#include <stdint.h>
+
+// What the DecoderMain() loop of zznvdec_t needs from the decoder. zznvdec_t implements it on
+// NvVideoDecoder, bench_capture_wakeup on a mock device fd, both run the same zznvdec_poll_loop().
+struct zznvdec_poll_ops_t {
+	virtual ~zznvdec_poll_ops_t() {}
+
+	virtual void ClearPollInterrupt() = 0;
+	// blocks until one of nReqEvents (POLLIN, POLLOUT, POLLPRI, POLLERR) or the poll interrupt, -1 on errors
+	virtual int DevicePoll(uint16_t nReqEvents, uint16_t* pRespEvents) = 0;
+	virtual bool IsInError() = 0;
+	virtual bool IsCaptureSetUp() = 0;			// POLLIN is only asked for with capture buffers
+	virtual bool IsOutputPlaneWanted() = 0;		// POLLOUT only while an input caller waits
+
+	virtual void HandleEvents() = 0;			// POLLPRI
+	virtual void SignalOutputPlane() = 0;		// POLLOUT, and once more when the loop ends
+	virtual int HandleCapture() = 0;			// POLLIN, drains every ready frame, -1 on fatal errors
+};
+
+// One DevicePoll per wakeup until *pGotEOS or an error, which sets *pGotError. The owner
+// breaks the poll with its SetPollInterrupt() after setting *pGotEOS.
+void zznvdec_poll_loop(zznvdec_poll_ops_t* pOps, volatile int* pGotEOS, int* pGotError);
+
+#endif // __ZZNVDEC_POLL_H__
@@ -1,6 +1,8 @@
-#include "zznvcodec.h"
+#include "zznvcodec_backend.h"
 #include "NvVideoEncoder.h"
 #include "ZzLog.h"
+#include "zzyuv.h"
+#include "zznvsession.h"
 
 #include "NvUtils.h"
 #include <errno.h>
@@ -16,87 +18,206 @@
 #include <nvbuf_utils.h>
 #include <npp.h>
 
+#define MAX_BUFFERS 32
+
 ZZ_INIT_LOG("zznvenc");
 
-struct zznvcodec_encoder_t {
+struct zznvenc_t : public zznvcodec_encoder_t {
 	enum {
 		STATE_READY,
 		STATE_STARTED,
 	} mState;
 
 	NvVideoEncoder* mEncoder;
+	zznvcodec_session_t* mSession;
 
 	int mWidth;
 	int mHeight;
 	zznvcodec_pixel_format_t mFormat;
 	zznvcodec_encoder_on_video_packet_t mOnVideoPacket;
 	intptr_t mOnVideoPacket_User;
+	zznvcodec_encoder_on_video_packet_info_t mOnVideoPacketInfo;
+	intptr_t mOnVideoPacketInfo_User;
 
 	zznvcodec_pixel_format_t mEncoderPixFormat;
+	uint32_t mV4L2PixFmt;
 	int mBitRate;
-	int mProfile;
-	v4l2_mpeg_video_h264_level mLevel;
+	int mProfile; // -1: codec default
+	int mLevel; // -1: codec default
 	v4l2_mpeg_video_bitrate_mode mRateControl;
 	int mIDRInterval;
 	int mIFrameInterval;
 	int mFrameRateNum;
 	int mFrameRateDeno;
+	int mQpRange[6]; // mQpRange[0] == -1: encoder default
+
+	// per-frame ROI, applied to every frame queued after it changed
+	pthread_mutex_t mROILock;
+	bool mROIEnabled;
+	zznvcodec_encoder_roi_t mROI;
+
+	NvThreadPolicy mThreadPolicy; // output and capture plane DQ threads
+	zznvcodec_trace_t mTrace;
 
+	zznvcodec_yuyv_converter_t mYUYVConverter;
 	zznvcodec_video_frame_t mYUY2VideoFrame; // NPP memory
 	zznvcodec_video_frame_t mYV12VideoFrame; // NPP memory
+	int mYUYVStagingFD; // VIC source
+	uint8_t* mYUYVStagingPtr;
+	int mYUYVStagingPitch;
 
 	int mMaxPreloadBuffers;
-	int mPreloadBuffersIndex;
-	int mOutputPlaneFDs[32];
-
-	explicit zznvcodec_encoder_t() {
+	int mOutputPlaneFDs[MAX_BUFFERS];
+	int64_t mOutputPlaneTimestamps[MAX_BUFFERS];
+	NvBufferColorFormat mBufferColorFormat;
+	uint32_t mV4L2OutputPixFmt;
+
+	// caller DMABUFs queued in place of mOutputPlaneFDs, -1 when the slot holds a copied frame
+	int mOutputPlaneDMABufFDs[MAX_BUFFERS];
+	int64_t mOutputPlaneReleaseHandles[MAX_BUFFERS];
+	zznvcodec_encoder_on_dmabuf_release_t mOnDMABufRelease;
+	intptr_t mOnDMABufRelease_User;
+	int mNonBlockingInput;
+
+	// output plane buffers not owned by the encoder, refilled by the output plane DQ thread
+	pthread_mutex_t mOutputPlaneLock;
+	pthread_cond_t mOutputPlaneCond;
+	int mFreeOutputBuffers[MAX_BUFFERS];
+	int mNumFreeOutputBuffers;
+	int mEOSIndex;
+	volatile bool mGotError;
+	zznvcodec_encoder_on_frame_done_t mOnFrameDone;
+	intptr_t mOnFrameDone_User;
+
+	explicit zznvenc_t() {
 		mState = STATE_READY;
+		nv_thread_policy_init(&mThreadPolicy);
 
 		mEncoder = NULL;
+		mSession = NULL;
 
 		mWidth = 0;
 		mHeight = 0;
 		mFormat = ZZNVCODEC_PIXEL_FORMAT_UNKNOWN;
 		mOnVideoPacket = NULL;
 		mOnVideoPacket_User = 0;
+		mOnVideoPacketInfo = NULL;
+		mOnVideoPacketInfo_User = 0;
 
-		mEncoderPixFormat = ZZNVCODEC_PIXEL_FORMAT_UNKNOWN;
+		mEncoderPixFormat = ZZNVCODEC_PIXEL_FORMAT_H264;
+		mV4L2PixFmt = V4L2_PIX_FMT_H264;
 		mBitRate = 8 * 1000000;
-		mProfile = V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE;
-		mLevel = V4L2_MPEG_VIDEO_H264_LEVEL_5_1;
+		mProfile = -1;
+		mLevel = -1;
 		mRateControl = V4L2_MPEG_VIDEO_BITRATE_MODE_CBR;
 		mIDRInterval = 60;
 		mIFrameInterval = 60;
 		mFrameRateNum = 60;
 		mFrameRateDeno = 1;
+		memset(mQpRange, -1, sizeof(mQpRange));
+		pthread_mutex_init(&mROILock, NULL);
+		mROIEnabled = false;
+		memset(&mROI, 0, sizeof(mROI));
+		mYUYVConverter = ZZNVCODEC_YUYV_CONVERTER_VIC;
 		memset(&mYUY2VideoFrame, 0, sizeof(mYUY2VideoFrame));
 		memset(&mYV12VideoFrame, 0, sizeof(mYV12VideoFrame));
+		mYUYVStagingFD = -1;
+		mYUYVStagingPtr = NULL;
+		mYUYVStagingPitch = 0;
 
 		mMaxPreloadBuffers = 10;
-		mPreloadBuffersIndex = 0;
 		memset(mOutputPlaneFDs, -1, sizeof(mOutputPlaneFDs));
+		memset(mOutputPlaneTimestamps, 0, sizeof(mOutputPlaneTimestamps));
+		mBufferColorFormat = NvBufferColorFormat_YUV420;
+		mV4L2OutputPixFmt = V4L2_PIX_FMT_YUV420M;
+
+		memset(mOutputPlaneDMABufFDs, -1, sizeof(mOutputPlaneDMABufFDs));
+		memset(mOutputPlaneReleaseHandles, 0, sizeof(mOutputPlaneReleaseHandles));
+		mOnDMABufRelease = NULL;
+		mOnDMABufRelease_User = 0;
+		mNonBlockingInput = 0;
+
+		pthread_mutex_init(&mOutputPlaneLock, NULL);
+		pthread_cond_init(&mOutputPlaneCond, NULL);
+		mNumFreeOutputBuffers = 0;
+		mEOSIndex = -1;
+		mGotError = false;
+		mOnFrameDone = NULL;
+		mOnFrameDone_User = 0;
 	}
 
-	~zznvcodec_encoder_t() {
+	~zznvenc_t() {
 		if(mState != STATE_READY) {
 			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
 		}
+
+		pthread_cond_destroy(&mOutputPlaneCond);
+		pthread_mutex_destroy(&mOutputPlaneLock);
+		pthread_mutex_destroy(&mROILock);
 	}
 
 	void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
 		mWidth = nWidth;
 		mHeight = nHeight;
 		mFormat = nFormat;
+
+		switch(mFormat) {
+		case ZZNVCODEC_PIXEL_FORMAT_NV12:
+			mBufferColorFormat = NvBufferColorFormat_NV12;
+			mV4L2OutputPixFmt = V4L2_PIX_FMT_NV12M;
+			break;
+
+		case ZZNVCODEC_PIXEL_FORMAT_YUV420P:
+		case ZZNVCODEC_PIXEL_FORMAT_YUYV422: // converted to I420
+			mBufferColorFormat = NvBufferColorFormat_YUV420;
+			mV4L2OutputPixFmt = V4L2_PIX_FMT_YUV420M;
+			break;
+
+		default:
+			LOGE("%s(%d): unexpected value, mFormat=%d", __FUNCTION__, __LINE__, mFormat);
+			break;
+		}
 	}
 
 	void SetMiscProperty(int nProperty, intptr_t pValue) {
+		int ret;
+
 		switch(nProperty) {
-		case ZZNVCODEC_PROP_ENCODER_PIX_FMT:
-			mEncoderPixFormat = *(zznvcodec_pixel_format_t*)pValue;
+		case ZZNVCODEC_PROP_ENCODER_PIX_FMT: {
+			int* p = (int*)pValue;
+			switch(*p) {
+			case ZZNVCODEC_PIXEL_FORMAT_H264:
+				mV4L2PixFmt = V4L2_PIX_FMT_H264;
+				break;
+
+			case ZZNVCODEC_PIXEL_FORMAT_H265:
+				mV4L2PixFmt = V4L2_PIX_FMT_H265;
+				break;
+
+			case ZZNVCODEC_PIXEL_FORMAT_VP8:
+				mV4L2PixFmt = V4L2_PIX_FMT_VP8;
+				break;
+
+			case ZZNVCODEC_PIXEL_FORMAT_VP9:
+				mV4L2PixFmt = V4L2_PIX_FMT_VP9;
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				return;
+			}
+			mEncoderPixFormat = (zznvcodec_pixel_format_t)*p;
+		}
 			break;
 
 		case ZZNVCODEC_PROP_BITRATE:
 			mBitRate = *(int*)pValue;
+			if(mState == STATE_STARTED) {
+				ret = mEncoder->setBitrate(mBitRate);
+				if(ret != 0) {
+					LOGE("%s(%d): mEncoder->setBitrate() failed, err=%d", __FUNCTION__, __LINE__, ret);
+				}
+			}
 			break;
 
 		case ZZNVCODEC_PROP_PROFILE:
@@ -104,7 +225,7 @@ struct zznvcodec_encoder_t {
 			break;
 
 		case ZZNVCODEC_PROP_LEVEL:
-			mLevel = (v4l2_mpeg_video_h264_level)*(int*)pValue;
+			mLevel = *(int*)pValue;
 			break;
 
 		case ZZNVCODEC_PROP_RATECONTROL:
@@ -122,6 +243,110 @@ struct zznvcodec_encoder_t {
 		case ZZNVCODEC_PROP_FRAMERATE:
 			mFrameRateNum = ((int*)pValue)[0];
 			mFrameRateDeno = ((int*)pValue)[1];
+			if(mState == STATE_STARTED) {
+				ret = mEncoder->setFrameRate(mFrameRateNum, mFrameRateDeno);
+				if(ret != 0) {
+					LOGE("%s(%d): mEncoder->setFrameRate() failed, err=%d", __FUNCTION__, __LINE__, ret);
+				}
+			}
+			break;
+
+		case ZZNVCODEC_PROP_FORCE_IDR:
+			if(mState != STATE_STARTED) {
+				LOGE("%s(%d): IDR can only be forced while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			ret = mEncoder->forceIDR();
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->forceIDR() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+			break;
+
+		case ZZNVCODEC_PROP_ROI: {
+			zznvcodec_encoder_roi_t* p = (zznvcodec_encoder_roi_t*)pValue;
+			if(p->num_regions < 0 || p->num_regions > ZZNVCODEC_MAX_ROI_REGIONS) {
+				LOGE("%s(%d): unexpected value, p->num_regions = %d", __FUNCTION__, __LINE__, p->num_regions);
+				break;
+			}
+			if(mState != STATE_READY && ! mROIEnabled) {
+				LOGE("%s(%d): ROI has to be set once before start", __FUNCTION__, __LINE__);
+				break;
+			}
+			pthread_mutex_lock(&mROILock);
+			mROI = *p;
+			mROIEnabled = true;
+			pthread_mutex_unlock(&mROILock);
+		}
+			break;
+
+		case ZZNVCODEC_PROP_QP_RANGE:
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): QP range can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			memcpy(mQpRange, (int*)pValue, sizeof(mQpRange));
+			break;
+
+		case ZZNVCODEC_PROP_YUYV_CONVERTER: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): YUYV converter can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			switch(*p) {
+			case ZZNVCODEC_YUYV_CONVERTER_VIC:
+			case ZZNVCODEC_YUYV_CONVERTER_CPU:
+			case ZZNVCODEC_YUYV_CONVERTER_NPP:
+				mYUYVConverter = (zznvcodec_yuyv_converter_t)*p;
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): output plane buffers can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mMaxPreloadBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_NONBLOCKING_INPUT: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): blocking mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mNonBlockingInput = (*p != 0);
+		}
+			break;
+
+		case ZZNVCODEC_PROP_THREAD_POLICY:
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): thread policy can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			zznvcodec_thread_policy_set(&mThreadPolicy, (zznvcodec_thread_policy_t*)pValue, "zznvenc");
+			break;
+
+		case ZZNVCODEC_PROP_TRACE_STREAM: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): trace stream can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mTrace.mStream = *p;
+		}
 			break;
 
 		default:
@@ -130,11 +355,34 @@ struct zznvcodec_encoder_t {
 		}
 	}
 
+	void SetSession(zznvcodec_session_t* pSession) {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): session can not be changed while started", __FUNCTION__, __LINE__);
+			return;
+		}
+		mSession = pSession;
+	}
+
 	void RegisterCallbacks(zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser) {
 		mOnVideoPacket = pCB;
 		mOnVideoPacket_User = pUser;
 	}
 
+	void RegisterPacketInfoCallbacks(zznvcodec_encoder_on_video_packet_info_t pCB, intptr_t pUser) {
+		mOnVideoPacketInfo = pCB;
+		mOnVideoPacketInfo_User = pUser;
+	}
+
+	void RegisterFrameDoneCallbacks(zznvcodec_encoder_on_frame_done_t pCB, intptr_t pUser) {
+		mOnFrameDone = pCB;
+		mOnFrameDone_User = pUser;
+	}
+
+	void RegisterDMABufCallbacks(zznvcodec_encoder_on_dmabuf_release_t pCB, intptr_t pUser) {
+		mOnDMABufRelease = pCB;
+		mOnDMABufRelease_User = pUser;
+	}
+
 	int SetupOutputDMABuf(uint32_t num_buffers) {
 		int ret=0;
 		NvBufferCreateParams cParams;
@@ -145,33 +393,226 @@ struct zznvcodec_encoder_t {
 			return ret;
 		}
 
+		memset(&cParams, 0, sizeof(cParams));
 		for (uint32_t i = 0; i < mEncoder->output_plane.getNumBuffers(); i++)
 		{
 			cParams.width = mWidth;
 			cParams.height = mHeight;
 			cParams.layout = NvBufferLayout_Pitch;
-			cParams.colorFormat = NvBufferColorFormat_YUV420;
+			cParams.colorFormat = mBufferColorFormat;
 			cParams.nvbuf_tag = NvBufferTag_VIDEO_ENC;
 			cParams.payloadType = NvBufferPayload_SurfArray;
-			ret = NvBufferCreateEx(&fd, &cParams);
+			ret = zznvsession_create_buffer(mSession, &cParams, &fd);
 			if(ret < 0) {
 				LOGE("%s(%d): Failed to create NvBuffer", __FUNCTION__, __LINE__);
 				return ret;
 			}
 			mOutputPlaneFDs[i] = fd;
+
+			struct v4l2_buffer v4l2_buf;
+			struct v4l2_plane planes[MAX_PLANES];
+
+			memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+			memset(planes, 0, sizeof(planes));
+
+			v4l2_buf.index = i;
+			v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+			v4l2_buf.memory = V4L2_MEMORY_DMABUF;
+			v4l2_buf.m.planes = planes;
+			ret = mEncoder->output_plane.mapOutputBuffers(v4l2_buf, fd);
+			if(ret < 0) {
+				LOGE("%s(%d): Error while mapping buffer at output plane", __FUNCTION__, __LINE__);
+				return ret;
+			}
+
+			mFreeOutputBuffers[mNumFreeOutputBuffers++] = i;
+		}
+		return ret;
+	}
+
+	// take a free output plane buffer, the DQ thread hands them back once encoded
+	int AcquireOutputBuffer(int* pIndex, bool bBlock) {
+		int ret = ZZNVCODEC_RESULT_OK;
+
+		pthread_mutex_lock(&mOutputPlaneLock);
+		while(mNumFreeOutputBuffers == 0) {
+			if(mGotError) {
+				ret = ZZNVCODEC_RESULT_ERROR;
+				break;
+			}
+			if(! bBlock) {
+				ret = ZZNVCODEC_RESULT_EAGAIN;
+				break;
+			}
+			pthread_cond_wait(&mOutputPlaneCond, &mOutputPlaneLock);
 		}
+		if(ret == ZZNVCODEC_RESULT_OK)
+			*pIndex = mFreeOutputBuffers[--mNumFreeOutputBuffers];
+		pthread_mutex_unlock(&mOutputPlaneLock);
+
 		return ret;
 	}
 
+	void ReturnOutputBuffer(int nIndex) {
+		pthread_mutex_lock(&mOutputPlaneLock);
+		mFreeOutputBuffers[mNumFreeOutputBuffers++] = nIndex;
+		pthread_cond_broadcast(&mOutputPlaneCond);
+		pthread_mutex_unlock(&mOutputPlaneLock);
+	}
+
+	// one pitch-linear YUYV NvBuffer the caller's frame is copied into, VIC converts from there
+	int SetupYUYVStaging() {
+		int ret;
+		NvBufferCreateParams cParams;
+		NvBufferParams parm;
+		void* ptr = NULL;
+
+		memset(&cParams, 0, sizeof(cParams));
+		cParams.width = mWidth;
+		cParams.height = mHeight;
+		cParams.layout = NvBufferLayout_Pitch;
+		cParams.colorFormat = NvBufferColorFormat_YUYV;
+		cParams.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+		cParams.payloadType = NvBufferPayload_SurfArray;
+		ret = zznvsession_create_buffer(mSession, &cParams, &mYUYVStagingFD);
+		if(ret < 0) {
+			LOGE("%s(%d): Failed to create NvBuffer", __FUNCTION__, __LINE__);
+			mYUYVStagingFD = -1;
+			return ret;
+		}
+
+		ret = NvBufferGetParams(mYUYVStagingFD, &parm);
+		if(ret < 0) {
+			LOGE("%s(%d): NvBufferGetParams failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			return ret;
+		}
+		mYUYVStagingPitch = parm.pitch[0];
+
+		ret = NvBufferMemMap(mYUYVStagingFD, 0, NvBufferMem_Write, &ptr);
+		if(ret < 0) {
+			LOGE("%s(%d): NvBufferMemMap failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			return ret;
+		}
+		mYUYVStagingPtr = (uint8_t*)ptr;
+
+		return 0;
+	}
+
+	void DestroyYUYVStaging() {
+		if(mYUYVStagingFD == -1)
+			return;
+
+		if(mYUYVStagingPtr) {
+			void* ptr = mYUYVStagingPtr;
+			NvBufferMemUnMap(mYUYVStagingFD, 0, &ptr);
+		}
+		zznvsession_destroy_buffer(mSession, mYUYVStagingFD);
+
+		mYUYVStagingFD = -1;
+		mYUYVStagingPtr = NULL;
+		mYUYVStagingPitch = 0;
+	}
+
+	// the only CPU pass is the copy into the staging buffer, VIC writes the encoder buffer
+	int ConvertYUYVWithVIC(zznvcodec_video_frame_t* pFrame, int dst_fd) {
+		int ret;
+		zznvcodec_video_plane_t& srcPlane = pFrame->planes[0];
+
+		if(! mYUYVStagingPtr) {
+			LOGE("%s(%d): no YUYV staging buffer", __FUNCTION__, __LINE__);
+			return -1;
+		}
+
+		for(int y = 0;y < mHeight;++y) {
+			memcpy(mYUYVStagingPtr + (intptr_t)y * mYUYVStagingPitch, srcPlane.ptr + (intptr_t)y * srcPlane.stride, mWidth * 2);
+		}
+
+		void* ptr = mYUYVStagingPtr;
+		ret = NvBufferMemSyncForDevice(mYUYVStagingFD, 0, &ptr);
+		if(ret < 0) {
+			LOGE("%s(%d): NvBufferMemSyncForDevice failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			return ret;
+		}
+
+		return TransformWithVIC(mYUYVStagingFD, dst_fd);
+	}
+
+	// VIC converts format and layout of a whole frame, NvBufferTransform() returns once dst_fd is written
+	int TransformWithVIC(int src_fd, int dst_fd) {
+		int ret;
+
+		NvBufferTransformParams transform_params;
+		memset(&transform_params, 0, sizeof(transform_params));
+		transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+		transform_params.transform_flip = NvBufferTransform_None;
+		transform_params.transform_filter = NvBufferTransform_Filter_Nearest;
+		transform_params.src_rect.width = mWidth;
+		transform_params.src_rect.height = mHeight;
+		transform_params.dst_rect.width = mWidth;
+		transform_params.dst_rect.height = mHeight;
+
+		ret = NvBufferTransform(src_fd, dst_fd, &transform_params);
+		if(ret == -1) {
+			LOGE("%s(%d): Transform failed", __FUNCTION__, __LINE__);
+			return ret;
+		}
+
+		return 0;
+	}
+
+	// straight into the CPU mapping of the encoder buffer, synced for the device afterwards
+	void ConvertYUYVWithCPU(zznvcodec_video_frame_t* pFrame, NvBuffer* buffer) {
+		zznvcodec_video_plane_t& srcPlane = pFrame->planes[0];
+
+		zzyuv_yuyv_to_i420(srcPlane.ptr, srcPlane.stride,
+			(uint8_t*)buffer->planes[0].data, buffer->planes[0].fmt.stride,
+			(uint8_t*)buffer->planes[1].data, buffer->planes[1].fmt.stride,
+			(uint8_t*)buffer->planes[2].data, buffer->planes[2].fmt.stride,
+			mWidth, mHeight);
+	}
+
+	void ConvertYUYVWithNPP(zznvcodec_video_frame_t* pFrame, NvBuffer* buffer) {
+		NppStatus status;
+		cudaError_t cudaError;
+
+		zznvcodec_video_plane_t& srcPlane = pFrame->planes[0];
+		zznvcodec_video_plane_t& dstPlaneYUY2 = mYUY2VideoFrame.planes[0];
+		cudaError = cudaMemcpy2D(dstPlaneYUY2.ptr, dstPlaneYUY2.stride, 
+			srcPlane.ptr, srcPlane.stride, srcPlane.width * 2, srcPlane.height, cudaMemcpyHostToDevice);
+		if(cudaError != cudaSuccess) {
+			LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", __FUNCTION__, __LINE__, cudaError);
+		}
+
+		Npp8u* pYV12[3] = { mYV12VideoFrame.planes[0].ptr, mYV12VideoFrame.planes[1].ptr, mYV12VideoFrame.planes[2].ptr };
+		int nYV12Step[3] = { mYV12VideoFrame.planes[0].stride, mYV12VideoFrame.planes[1].stride, mYV12VideoFrame.planes[2].stride };
+		NppiSize oSizeROI = { dstPlaneYUY2.width, dstPlaneYUY2.height };
+		status = nppiYCbCr422ToYCbCr420_8u_C2P3R(dstPlaneYUY2.ptr, dstPlaneYUY2.stride, pYV12, nYV12Step, oSizeROI);
+		if(status != 0) {
+			LOGE("%s(%d): nppiYCbCr422ToYCbCr420_8u_C2P3R failed, status = %d", __FUNCTION__, __LINE__, status);
+		}
+
+		for(int i = 0;i < 3;++i) {
+			zznvcodec_video_plane_t& srcPlane = mYV12VideoFrame.planes[i];
+			NvBuffer::NvBufferPlane &dstPlane = buffer->planes[i];
+
+			cudaError = cudaMemcpy2D(dstPlane.data, dstPlane.fmt.stride, srcPlane.ptr, srcPlane.stride, 
+				srcPlane.width, srcPlane.height, cudaMemcpyDeviceToHost);
+			if(cudaError != cudaSuccess) {
+				LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", __FUNCTION__, __LINE__, cudaError);
+			}
+		}
+	}
+
 	static bool _EncoderCapturePlaneDQCallback(struct v4l2_buffer *v4l2_buf, NvBuffer * buffer, NvBuffer * shared_buffer, void *arg) {
-		zznvcodec_encoder_t* pThis = (zznvcodec_encoder_t*)arg;
+		zznvenc_t* pThis = (zznvenc_t*)arg;
 
 		return pThis->EncoderCapturePlaneDQCallback(v4l2_buf, buffer, shared_buffer);
 	}
 
 	bool EncoderCapturePlaneDQCallback(struct v4l2_buffer *v4l2_buf, NvBuffer * buffer, NvBuffer * shared_buffer) {
 		if (v4l2_buf == NULL) {
-			LOGE("%s(%d): Error while dequeing buffer from output plane", __FUNCTION__, __LINE__);
+			LOGE("%s(%d): Error while dequeing buffer from capture plane", __FUNCTION__, __LINE__);
+			SetError();
 			return false;
 		}
 
@@ -181,26 +622,152 @@ struct zznvcodec_encoder_t {
 		}
 
 		int flags = 0;
+		zznvcodec_encoder_packet_info_t info;
 		v4l2_ctrl_videoenc_outputbuf_metadata enc_metadata;
+
+		info.frame_type = ZZNVCODEC_FRAME_TYPE_UNKNOWN;
+		info.size = buffer->planes[0].bytesused;
+		info.encoded_bits = 0;
+		info.avg_qp = -1;
+		info.min_qp = -1;
+		info.max_qp = -1;
+		info.ref_frame_id = -1;
+		info.num_ref_frames = 0;
 		if (mEncoder->getMetadata(v4l2_buf->index, enc_metadata) == 0) {
 			if(enc_metadata.KeyFrame) {
 				flags = 1;
+				info.frame_type = ZZNVCODEC_FRAME_TYPE_KEY;
+			} else if(enc_metadata.bIsGoldenOrAlternateFrame) {
+				info.frame_type = ZZNVCODEC_FRAME_TYPE_GOLDEN;
+			} else {
+				info.frame_type = ZZNVCODEC_FRAME_TYPE_INTER;
+				info.ref_frame_id = enc_metadata.nCurrentRefFrameId;
 			}
+			info.encoded_bits = enc_metadata.EncodedFrameBits;
+			info.avg_qp = enc_metadata.AvgQP;
+			info.min_qp = enc_metadata.FrameMinQP;
+			info.max_qp = enc_metadata.FrameMaxQP;
+			info.num_ref_frames = enc_metadata.nActiveRefFrames;
 		}
 
+		int64_t pts = v4l2_buf->timestamp.tv_sec * 1000000LL + v4l2_buf->timestamp.tv_usec;
+		mTrace.End(pts, "encode");
+
+		mTrace.Begin(pts, "enc.deliver");
 		if(mOnVideoPacket) {
-			int64_t pts = v4l2_buf->timestamp.tv_sec * 1000000LL + v4l2_buf->timestamp.tv_usec;
 			mOnVideoPacket((uint8_t*)buffer->planes[0].data, buffer->planes[0].bytesused, flags, pts, mOnVideoPacket_User);
 		}
 
+		if(mOnVideoPacketInfo) {
+			mOnVideoPacketInfo((uint8_t*)buffer->planes[0].data, &info, pts, mOnVideoPacketInfo_User);
+		}
+		mTrace.End(pts, "enc.deliver");
+
 		if (mEncoder->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
 			LOGE("%s(%d): Error while Qing buffer at capture plane", __FUNCTION__, __LINE__);
+			SetError();
+			return false;
+		}
+
+		return true;
+	}
+
+	// wake up producers waiting for an output plane buffer that will never come back
+	void SetError() {
+		pthread_mutex_lock(&mOutputPlaneLock);
+		mGotError = true;
+		pthread_cond_broadcast(&mOutputPlaneCond);
+		pthread_mutex_unlock(&mOutputPlaneLock);
+	}
+
+	static bool _EncoderOutputPlaneDQCallback(struct v4l2_buffer *v4l2_buf, NvBuffer * buffer, NvBuffer * shared_buffer, void *arg) {
+		zznvenc_t* pThis = (zznvenc_t*)arg;
+
+		return pThis->EncoderOutputPlaneDQCallback(v4l2_buf, buffer, shared_buffer);
+	}
+
+	bool EncoderOutputPlaneDQCallback(struct v4l2_buffer *v4l2_buf, NvBuffer * buffer, NvBuffer * shared_buffer) {
+		if (v4l2_buf == NULL) {
+			// STREAMOFF in Stop() also ends up here
+			if(mEncoder->output_plane.getStreamStatus()) {
+				LOGE("%s(%d): Error while dequeing buffer from output plane", __FUNCTION__, __LINE__);
+			}
+			SetError();
 			return false;
 		}
 
+		int nIndex = v4l2_buf->index;
+		bool bEOS = (nIndex == mEOSIndex);
+		int64_t nTimestamp = mOutputPlaneTimestamps[nIndex];
+		int nDMABufFD = mOutputPlaneDMABufFDs[nIndex];
+		int64_t nReleaseHandle = mOutputPlaneReleaseHandles[nIndex];
+
+		// the slot may be taken again as soon as it is back in the free list
+		mOutputPlaneDMABufFDs[nIndex] = -1;
+		ReturnOutputBuffer(nIndex);
+
+		if(bEOS) {
+			LOGD("%s(%d): Got EOS buffer back at output plane", __FUNCTION__, __LINE__);
+			return false;
+		}
+
+		if(nDMABufFD != -1 && mOnDMABufRelease) {
+			mOnDMABufRelease(nDMABufFD, nReleaseHandle, nTimestamp, mOnDMABufRelease_User);
+		}
+
+		if(mOnFrameDone) {
+			mOnFrameDone(nTimestamp, mOnFrameDone_User);
+		}
+
 		return true;
 	}
 
+	// hand back caller DMABUFs the encoder never returned, after the output plane DQ thread is gone
+	void ReleaseDMABufs() {
+		for(int i = 0;i < MAX_BUFFERS;++i) {
+			if(mOutputPlaneDMABufFDs[i] == -1)
+				continue;
+
+			if(mOnDMABufRelease) {
+				mOnDMABufRelease(mOutputPlaneDMABufFDs[i], mOutputPlaneReleaseHandles[i], mOutputPlaneTimestamps[i], mOnDMABufRelease_User);
+			}
+			mOutputPlaneDMABufFDs[i] = -1;
+		}
+	}
+
+	// an empty buffer tells the encoder to drain, it comes back on the output plane after the last frame
+	int QueueEOS() {
+		int ret;
+		int nIndex;
+		struct v4l2_buffer v4l2_buf;
+		struct v4l2_plane planes[MAX_PLANES];
+
+		ret = AcquireOutputBuffer(&nIndex, true);
+		if(ret != ZZNVCODEC_RESULT_OK)
+			return ret;
+
+		memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+		memset(planes, 0, sizeof(planes));
+
+		v4l2_buf.index = nIndex;
+		v4l2_buf.m.planes = planes;
+		for(uint32_t j = 0;j < mEncoder->output_plane.getNumPlanes();++j) {
+			v4l2_buf.m.planes[j].m.fd = mOutputPlaneFDs[nIndex];
+			v4l2_buf.m.planes[j].bytesused = 0;
+		}
+
+		mEOSIndex = nIndex;
+		ret = mEncoder->output_plane.qBuffer(v4l2_buf, NULL);
+		if(ret < 0) {
+			LOGE("%s(%d): Error while queueing EOS buffer at output plane", __FUNCTION__, __LINE__);
+			mEOSIndex = -1;
+			ReturnOutputBuffer(nIndex);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
 	int Start() {
 		int ret;
 		NppStatus status;
@@ -217,12 +784,25 @@ struct zznvcodec_encoder_t {
 			LOGE("%s(%d): NvVideoEncoder::createVideoEncoder() failed", __FUNCTION__, __LINE__);
 		}
 
-		ret = mEncoder->setCapturePlaneFormat(mEncoderPixFormat, mWidth, mHeight, 2 * 1024 * 1024);
+		if(mV4L2PixFmt == V4L2_PIX_FMT_H265 && (mWidth < 144 || mHeight < 144)) {
+			LOGE("%s(%d): H.265 needs at least 144x144, %dx%d", __FUNCTION__, __LINE__, mWidth, mHeight);
+		}
+
+		ret = mEncoder->setCapturePlaneFormat(mV4L2PixFmt, mWidth, mHeight, 2 * 1024 * 1024);
 		if(ret != 0) {
 			LOGE("%s(%d): mEncoder->setCapturePlaneFormat() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
-		if(mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422) {
+		if(mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422 && mYUYVConverter == ZZNVCODEC_YUYV_CONVERTER_VIC) {
+			ret = SetupYUYVStaging();
+			if(ret != 0) {
+				LOGW("%s(%d): SetupYUYVStaging() failed, err=%d, converting on the CPU", __FUNCTION__, __LINE__, ret);
+				DestroyYUYVStaging();
+				mYUYVConverter = ZZNVCODEC_YUYV_CONVERTER_CPU;
+			}
+		}
+
+		if(mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422 && mYUYVConverter == ZZNVCODEC_YUYV_CONVERTER_NPP) {
 			LOGD("prepare buffer for YUY2 to YV12 conversion");
 			{
 				mYUY2VideoFrame.num_planes = 1;
@@ -250,7 +830,7 @@ struct zznvcodec_encoder_t {
 				plane2.ptr = nppiMalloc_8u_C1(plane2.width, plane2.height, &plane2.stride);
 			}
 		}
-		ret = mEncoder->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, mWidth, mHeight);
+		ret = mEncoder->setOutputPlaneFormat(mV4L2OutputPixFmt, mWidth, mHeight);
 		if(ret != 0) {
 			LOGE("%s(%d): mEncoder->setOutputPlaneFormat() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
@@ -260,14 +840,37 @@ struct zznvcodec_encoder_t {
 			LOGE("%s(%d): mEncoder->setBitrate() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
-		ret = mEncoder->setProfile(mProfile);
-		if(ret != 0) {
-			LOGE("%s(%d): mEncoder->setProfile() failed, err=%d", __FUNCTION__, __LINE__, ret);
+		// VP8/VP9 have no profile/level controls
+		if(mV4L2PixFmt == V4L2_PIX_FMT_H264 || mV4L2PixFmt == V4L2_PIX_FMT_H265) {
+			int nProfile = mProfile;
+			if(nProfile == -1) {
+				if(mV4L2PixFmt == V4L2_PIX_FMT_H265)
+					nProfile = V4L2_MPEG_VIDEO_H265_PROFILE_MAIN;
+				else
+					nProfile = V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE;
+			}
+
+			ret = mEncoder->setProfile(nProfile);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setProfile() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
 		}
 
-		ret = mEncoder->setLevel(mLevel);
-		if(ret != 0) {
-			LOGE("%s(%d): mEncoder->setLevel() failed, err=%d", __FUNCTION__, __LINE__, ret);
+		if(mV4L2PixFmt == V4L2_PIX_FMT_H264) {
+			int nLevel = (mLevel == -1) ? V4L2_MPEG_VIDEO_H264_LEVEL_5_1 : mLevel;
+
+			ret = mEncoder->setLevel((v4l2_mpeg_video_h264_level)nLevel);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setLevel() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+		} else if(mV4L2PixFmt == V4L2_PIX_FMT_H265 && mLevel != -1) {
+			// v4l2_mpeg_video_hevc_level, the driver picks the level otherwise
+			ret = mEncoder->setLevel((v4l2_mpeg_video_h264_level)mLevel);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setLevel() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+		} else if(mLevel != -1) {
+			LOGW("%s(%d): level is not supported for VP8/VP9, ignored", __FUNCTION__, __LINE__);
 		}
 
 		ret = mEncoder->setRateControlMode(mRateControl);
@@ -290,9 +893,28 @@ struct zznvcodec_encoder_t {
 			LOGE("%s(%d): mEncoder->setFrameRate() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
-		ret = mEncoder->setInsertSpsPpsAtIdrEnabled(true);
-		if(ret != 0) {
-			LOGE("%s(%d): mEncoder->setInsertSpsPpsAtIdrEnabled() failed, err=%d", __FUNCTION__, __LINE__, ret);
+		if(mV4L2PixFmt == V4L2_PIX_FMT_H264 || mV4L2PixFmt == V4L2_PIX_FMT_H265) {
+			ret = mEncoder->setInsertSpsPpsAtIdrEnabled(true);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setInsertSpsPpsAtIdrEnabled() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+		}
+
+		if(mROIEnabled) {
+			v4l2_enc_enable_roi_param roi_param;
+
+			roi_param.bEnableROI = 1;
+			ret = mEncoder->enableROI(roi_param);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->enableROI() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+		}
+
+		if(mQpRange[0] != -1) {
+			ret = mEncoder->setQpRange(mQpRange[0], mQpRange[1], mQpRange[2], mQpRange[3], mQpRange[4], mQpRange[5]);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setQpRange() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
 		}
 
 		ret = SetupOutputDMABuf(mMaxPreloadBuffers);
@@ -322,6 +944,16 @@ struct zznvcodec_encoder_t {
 			LOGE("%s(%d): mEncoder->capture_plane.setStreamStatus() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
+		if(! nv_thread_policy_is_default(&mThreadPolicy)) {
+			ret = mEncoder->setDQThreadPolicy(mThreadPolicy);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setDQThreadPolicy() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
+		}
+
+		mEncoder->output_plane.setDQThreadCallback(_EncoderOutputPlaneDQCallback);
+		mEncoder->output_plane.startDQThread(this);
+
 		mEncoder->capture_plane.setDQThreadCallback(_EncoderCapturePlaneDQCallback);
 		mEncoder->capture_plane.startDQThread(this);
 
@@ -346,6 +978,7 @@ struct zznvcodec_encoder_t {
 			}
 		}
 
+		mTrace.Reset();
 		mState = STATE_STARTED;
 
 		return ret;
@@ -361,9 +994,12 @@ struct zznvcodec_encoder_t {
 
 		LOGD("Stop....");
 
-		ret = mEncoder->setEncoderCommand(V4L2_ENC_CMD_STOP, 1);
-		if(ret != 0) {
-			LOGE("%s(%d): mEncoder->setEncoderCommand(V4L2_ENC_CMD_STOP) failed, err=%d", __FUNCTION__, __LINE__, ret);
+		ret = QueueEOS();
+		if(ret != ZZNVCODEC_RESULT_OK) {
+			ret = mEncoder->setEncoderCommand(V4L2_ENC_CMD_STOP, 1);
+			if(ret != 0) {
+				LOGE("%s(%d): mEncoder->setEncoderCommand(V4L2_ENC_CMD_STOP) failed, err=%d", __FUNCTION__, __LINE__, ret);
+			}
 		}
 
 		ret = mEncoder->capture_plane.waitForDQThread(3000);
@@ -371,31 +1007,41 @@ struct zznvcodec_encoder_t {
 			LOGE("%s(%d): mEncoder->capture_plane.waitForDQThread() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
+		// releases the output plane DQ thread if the EOS buffer never came back
+		ret = mEncoder->output_plane.setStreamStatus(false);
+		if(ret != 0) {
+			LOGE("%s(%d): mEncoder->output_plane.setStreamStatus() failed, err=%d", __FUNCTION__, __LINE__, ret);
+		}
+
 		ret = mEncoder->output_plane.waitForDQThread(3000);
 		if(ret != 0) {
 			LOGE("%s(%d): mEncoder->output_plane.waitForDQThread() failed, err=%d", __FUNCTION__, __LINE__, ret);
 		}
 
+		ReleaseDMABufs();
+
         for (uint32_t i = 0; i < mEncoder->output_plane.getNumBuffers(); i++) {
             ret = mEncoder->output_plane.unmapOutputBuffers(i, mOutputPlaneFDs[i]);
             if (ret < 0) {
                 LOGE("%s(%d): Error while unmapping buffer at output plane", __FUNCTION__, __LINE__);
             }
 			// LOGD("unmapOutputBuffers(%d)", i);
-
-            ret = NvBufferDestroy(mOutputPlaneFDs[i]);
-            if(ret < 0) {
-                LOGE("%s(%d): Failed to Destroy NvBuffer", __FUNCTION__, __LINE__);
-            }
-			// LOGD("NvBufferDestroy(%d)", i);
         }
-        memset(mOutputPlaneFDs, 0, sizeof(mOutputPlaneFDs));
 
         delete mEncoder;
 		// LOGD("delete mEncoder");
         mEncoder = NULL;
 
-		mPreloadBuffersIndex = 0;
+		// only once the encoder has let go of them, pooled buffers go to the next instance
+		for(int i = 0;i < MAX_BUFFERS;++i) {
+			if(mOutputPlaneFDs[i] != -1)
+				zznvsession_destroy_buffer(mSession, mOutputPlaneFDs[i]);
+		}
+        memset(mOutputPlaneFDs, -1, sizeof(mOutputPlaneFDs));
+
+		mNumFreeOutputBuffers = 0;
+		mEOSIndex = -1;
+		mGotError = false;
 
 		for(int i = 0;i < mYUY2VideoFrame.num_planes;++i) {
 			nppiFree(mYUY2VideoFrame.planes[i].ptr);
@@ -407,146 +1053,240 @@ struct zznvcodec_encoder_t {
 		}
 		memset(&mYV12VideoFrame, 0, sizeof(mYV12VideoFrame));
 
+		DestroyYUYVStaging();
+
         mState = STATE_READY;
 	}
 
-	void SetVideoUncompressionBuffer(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) {
+	int SetVideoUncompressionBuffer(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) {
 		int ret;
+		int nIndex;
 		struct v4l2_buffer v4l2_buf;
 		struct v4l2_plane planes[MAX_PLANES];
 		NvBuffer *buffer;
-		NppStatus status;
 		cudaError_t cudaError;
 
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		if(pFrame->num_planes != (mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422 ? 1 : (int)mEncoder->output_plane.getNumPlanes())) {
+			LOGE("%s(%d): unexpected pFrame->num_planes = %d", __FUNCTION__, __LINE__, pFrame->num_planes);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		ret = AcquireOutputBuffer(&nIndex, ! mNonBlockingInput);
+		if(ret != ZZNVCODEC_RESULT_OK)
+			return ret;
+
 		memset(&v4l2_buf, 0, sizeof(v4l2_buf));
 		memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
 
+		v4l2_buf.index = nIndex;
 		v4l2_buf.m.planes = planes;
+		buffer = mEncoder->output_plane.getNthBuffer(nIndex);
 
-		if(mPreloadBuffersIndex == mEncoder->output_plane.getNumBuffers()) {
-			// reused
-			ret = mEncoder->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10);
-			if(ret < 0) {
-				LOGE("%s(%d): Error DQing buffer at output plane", __FUNCTION__, __LINE__);
-			}
-		} else {
-			// preload
-			buffer = mEncoder->output_plane.getNthBuffer(mPreloadBuffersIndex);
-			v4l2_buf.index = mPreloadBuffersIndex;
-			v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-			v4l2_buf.memory = V4L2_MEMORY_DMABUF;
-			ret = mEncoder->output_plane.mapOutputBuffers(v4l2_buf, mOutputPlaneFDs[mPreloadBuffersIndex]);
-			if (ret < 0) {
-				LOGE("%s(%d): Error while mapping buffer at output plane", __FUNCTION__, __LINE__);
-			}
-
-			mPreloadBuffersIndex++;
-		}
-
+		mTrace.Begin(nTimestamp, "encode");
+		mTrace.Begin(nTimestamp, "enc.convert");
+		bool bWrittenByDevice = false;
 		if(mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422) {
-			if(pFrame->num_planes != 1) {
-				LOGE("%s(%d): unexpected pFrame->num_planes = %d", __FUNCTION__, __LINE__, pFrame->num_planes);
-				return;
-			}
+			switch(mYUYVConverter) {
+			case ZZNVCODEC_YUYV_CONVERTER_VIC:
+				if(ConvertYUYVWithVIC(pFrame, mOutputPlaneFDs[nIndex]) == 0) {
+					bWrittenByDevice = true;
+					break;
+				}
+				// VIC is unavailable, do it on the CPU
+				ConvertYUYVWithCPU(pFrame, buffer);
+				break;
 
-			zznvcodec_video_plane_t& srcPlane = pFrame->planes[0];
-			zznvcodec_video_plane_t& dstPlaneYUY2 = mYUY2VideoFrame.planes[0];
-			cudaError = cudaMemcpy2D(dstPlaneYUY2.ptr, dstPlaneYUY2.stride, 
-				srcPlane.ptr, srcPlane.stride, srcPlane.width * 2, srcPlane.height, cudaMemcpyHostToDevice);
-			if(cudaError != cudaSuccess) {
-				LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", __FUNCTION__, __LINE__, cudaError);
-			}
+			case ZZNVCODEC_YUYV_CONVERTER_CPU:
+				ConvertYUYVWithCPU(pFrame, buffer);
+				break;
 
-			Npp8u* pYV12[3] = { mYV12VideoFrame.planes[0].ptr, mYV12VideoFrame.planes[1].ptr, mYV12VideoFrame.planes[2].ptr };
-			int nYV12Step[3] = { mYV12VideoFrame.planes[0].stride, mYV12VideoFrame.planes[1].stride, mYV12VideoFrame.planes[2].stride };
-			NppiSize oSizeROI = { dstPlaneYUY2.width, dstPlaneYUY2.height };
-			status = nppiYCbCr422ToYCbCr420_8u_C2P3R(dstPlaneYUY2.ptr, dstPlaneYUY2.stride, pYV12, nYV12Step, oSizeROI);
-			if(status != 0) {
-				LOGE("%s(%d): nppiYCbCr422ToYCbCr420_8u_C2P3R failed, status = %d", __FUNCTION__, __LINE__, status);
+			case ZZNVCODEC_YUYV_CONVERTER_NPP:
+				ConvertYUYVWithNPP(pFrame, buffer);
+				break;
 			}
 
 			for(int i = 0;i < 3;++i) {
-				zznvcodec_video_plane_t& srcPlane = mYV12VideoFrame.planes[i];
 				NvBuffer::NvBufferPlane &dstPlane = buffer->planes[i];
-
-				cudaError = cudaMemcpy2D(dstPlane.data, dstPlane.fmt.stride, srcPlane.ptr, srcPlane.stride, 
-					srcPlane.width, srcPlane.height, cudaMemcpyDeviceToHost);
-				if(cudaError != cudaSuccess) {
-					LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", __FUNCTION__, __LINE__, cudaError);
-				}
-
 				dstPlane.bytesused = dstPlane.fmt.stride * dstPlane.fmt.height;
 			}
-
 		} else {
-			if(pFrame->num_planes != 3) {
-				LOGE("%s(%d): unexpected pFrame->num_planes = %d", __FUNCTION__, __LINE__, pFrame->num_planes);
-				return;
-			}
-
-			for(int i = 0;i < 3;++i) {
+			for(int i = 0;i < pFrame->num_planes;++i) {
 				zznvcodec_video_plane_t& srcPlane = pFrame->planes[i];
 				NvBuffer::NvBufferPlane &dstPlane = buffer->planes[i];
 
+				// the interleaved NV12 chroma plane is twice as wide in bytes
 				cudaError = cudaMemcpy2D(dstPlane.data, dstPlane.fmt.stride, srcPlane.ptr, srcPlane.stride, 
-					srcPlane.width, srcPlane.height, cudaMemcpyHostToHost);
+					dstPlane.fmt.width * dstPlane.fmt.bytesperpixel, dstPlane.fmt.height, cudaMemcpyHostToHost);
 				if(cudaError != cudaSuccess) {
-					LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", cudaError);
+					LOGE("%s(%d): cudaMemcpy2D failed, cudaError = %d", __FUNCTION__, __LINE__, cudaError);
+					ReturnOutputBuffer(nIndex);
+					return ZZNVCODEC_RESULT_ERROR;
 				}
 
 				dstPlane.bytesused = dstPlane.fmt.stride * dstPlane.fmt.height;
 			}
 		}
+		mTrace.End(nTimestamp, "enc.convert");
 
 		for (uint32_t j = 0 ; j < buffer->n_planes ; j++) {
-			ret = NvBufferMemSyncForDevice (buffer->planes[j].fd, j, (void **)&buffer->planes[j].data);
+			// nothing in the CPU cache when VIC wrote the planes
+			ret = bWrittenByDevice ? 0 : NvBufferMemSyncForDevice (buffer->planes[j].fd, j, (void **)&buffer->planes[j].data);
 			if (ret < 0) {
 				LOGE("%s(%d): Error while NvBufferMemSyncForDevice at output plane for V4L2_MEMORY_DMABUF", __FUNCTION__, __LINE__);
-				break;
+				ReturnOutputBuffer(nIndex);
+				return ZZNVCODEC_RESULT_ERROR;
 			}
 
+			v4l2_buf.m.planes[j].m.fd = mOutputPlaneFDs[nIndex];
 			v4l2_buf.m.planes[j].bytesused = buffer->planes[j].bytesused;
 		}
 
+		return QueueOutputBuffer(v4l2_buf, nTimestamp);
+	}
+
+	// ROI is input metadata of the buffer, tied to it by the config store index
+	void SetFrameROI(struct v4l2_buffer& v4l2_buf) {
+		int ret;
+		v4l2_ctrl_videoenc_input_metadata meta;
+		v4l2_enc_frame_ROI_params roi;
+
+		memset(&meta, 0, sizeof(meta));
+		memset(&roi, 0, sizeof(roi));
+
+		pthread_mutex_lock(&mROILock);
+		roi.num_ROI_regions = mROI.num_regions;
+		for(int i = 0;i < mROI.num_regions;++i) {
+			zznvcodec_roi_region_t& region = mROI.regions[i];
+
+			roi.ROI_params[i].ROIRect.left = region.left;
+			roi.ROI_params[i].ROIRect.top = region.top;
+			roi.ROI_params[i].ROIRect.width = region.width;
+			roi.ROI_params[i].ROIRect.height = region.height;
+			roi.ROI_params[i].QPdelta = region.qp_delta;
+		}
+		pthread_mutex_unlock(&mROILock);
+
+		meta.flag = V4L2_ENC_INPUT_ROI_PARAM_FLAG;
+		meta.VideoEncROIParams = &roi;
+		ret = mEncoder->SetInputMetaParams(v4l2_buf.index, meta);
+		if(ret != 0) {
+			LOGE("%s(%d): mEncoder->SetInputMetaParams() failed, err=%d", __FUNCTION__, __LINE__, ret);
+			return;
+		}
+		v4l2_buf.reserved2 = v4l2_buf.index;
+	}
+
+	int QueueOutputBuffer(struct v4l2_buffer& v4l2_buf, int64_t nTimestamp) {
+		int ret;
+		int nIndex = v4l2_buf.index;
+
 		v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
 		v4l2_buf.timestamp.tv_sec = (int)(nTimestamp / 1000000);
 		v4l2_buf.timestamp.tv_usec = (int)(nTimestamp % 1000000);
+		mOutputPlaneTimestamps[nIndex] = nTimestamp;
+
+		if(mROIEnabled) {
+			SetFrameROI(v4l2_buf);
+		}
 
 		ret = mEncoder->output_plane.qBuffer(v4l2_buf, NULL);
 		if (ret < 0) {
 			LOGE("%s(%d): Error while queueing buffer at output plane", __FUNCTION__, __LINE__);
+			mOutputPlaneDMABufFDs[nIndex] = -1;
+			ReturnOutputBuffer(nIndex);
+			return ZZNVCODEC_RESULT_ERROR;
 		}
+
+		return ZZNVCODEC_RESULT_OK;
 	}
-};
 
-zznvcodec_encoder_t* zznvcodec_encoder_new() {
-	return new zznvcodec_encoder_t();
-}
+	// A pitch-linear NvBuffer in the encoder format is queued without a copy, the encoder reads it until
+	// mOnDMABufRelease hands it back. Other formats and layouts, such as the block-linear NV12 (_ER, _709)
+	// of the decoder, are converted by VIC into the encoder's own buffer and handed back right away.
+	int SetVideoDMABuf(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp) {
+		int ret;
+		int nIndex;
+		struct v4l2_buffer v4l2_buf;
+		struct v4l2_plane planes[MAX_PLANES];
+		NvBufferParams parm;
 
-void zznvcodec_encoder_delete(zznvcodec_encoder_t* pThis) {
-	delete pThis;
-}
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
 
-void zznvcodec_encoder_set_video_property(zznvcodec_encoder_t* pThis, int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
-	pThis->SetVideoProperty(nWidth, nHeight, nFormat);
-}
+		ret = NvBufferGetParams(pFrame->fd, &parm);
+		if(ret != 0) {
+			LOGE("%s(%d): NvBufferGetParams failed, fd=%d, ret=%d", __FUNCTION__, __LINE__, pFrame->fd, ret);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
 
-void zznvcodec_encoder_set_misc_property(zznvcodec_encoder_t* pThis, int nProperty, intptr_t pValue) {
-	pThis->SetMiscProperty(nProperty, pValue);
-}
+		if((int)parm.width[0] != mWidth || (int)parm.height[0] != mHeight) {
+			LOGE("%s(%d): NvBuffer %dx%d does not match the encoder, %dx%d", __FUNCTION__, __LINE__,
+				parm.width[0], parm.height[0], mWidth, mHeight);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
 
-void zznvcodec_encoder_register_callbacks(zznvcodec_encoder_t* pThis, zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser) {
-	pThis->RegisterCallbacks(pCB, pUser);
-}
+		ret = AcquireOutputBuffer(&nIndex, ! mNonBlockingInput);
+		if(ret != ZZNVCODEC_RESULT_OK)
+			return ret;
 
-int zznvcodec_encoder_start(zznvcodec_encoder_t* pThis) {
-	return pThis->Start();
-}
+		memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+		memset(planes, 0, sizeof(planes));
 
-void zznvcodec_encoder_stop(zznvcodec_encoder_t* pThis) {
-	return pThis->Stop();
-}
+		v4l2_buf.index = nIndex;
+		v4l2_buf.m.planes = planes;
+
+		if(parm.pixel_format != mBufferColorFormat || parm.layout[0] != NvBufferLayout_Pitch)
+			return TransformDMABuf(pFrame, v4l2_buf, nTimestamp);
 
-void zznvcodec_encoder_set_video_uncompression_buffer(zznvcodec_encoder_t* pThis, zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) {
-	return pThis->SetVideoUncompressionBuffer(pFrame, nTimestamp);
-}
\ No newline at end of file
+		for(uint32_t j = 0;j < mEncoder->output_plane.getNumPlanes();++j) {
+			v4l2_buf.m.planes[j].m.fd = pFrame->fd;
+			v4l2_buf.m.planes[j].bytesused = parm.pitch[j] * parm.height[j];
+		}
+
+		mOutputPlaneDMABufFDs[nIndex] = pFrame->fd;
+		mOutputPlaneReleaseHandles[nIndex] = pFrame->release_handle;
+
+		mTrace.Begin(nTimestamp, "encode");
+		return QueueOutputBuffer(v4l2_buf, nTimestamp);
+	}
+
+	// the caller's NvBuffer is only read by the transform, the encoder buffer of v4l2_buf.index is queued
+	int TransformDMABuf(zznvcodec_dmabuf_frame_t* pFrame, struct v4l2_buffer& v4l2_buf, int64_t nTimestamp) {
+		int nIndex = v4l2_buf.index;
+		NvBuffer* buffer = mEncoder->output_plane.getNthBuffer(nIndex);
+
+		mTrace.Begin(nTimestamp, "encode");
+		mTrace.Begin(nTimestamp, "enc.convert");
+		if(TransformWithVIC(pFrame->fd, mOutputPlaneFDs[nIndex]) < 0) {
+			mTrace.End(nTimestamp, "enc.convert");
+			ReturnOutputBuffer(nIndex);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+		mTrace.End(nTimestamp, "enc.convert");
+
+		if(mOnDMABufRelease) {
+			mOnDMABufRelease(pFrame->fd, pFrame->release_handle, nTimestamp, mOnDMABufRelease_User);
+		}
+
+		for(uint32_t j = 0;j < buffer->n_planes;++j) {
+			NvBuffer::NvBufferPlane &dstPlane = buffer->planes[j];
+
+			dstPlane.bytesused = dstPlane.fmt.stride * dstPlane.fmt.height;
+			v4l2_buf.m.planes[j].m.fd = mOutputPlaneFDs[nIndex];
+			v4l2_buf.m.planes[j].bytesused = dstPlane.bytesused;
+		}
+
+		return QueueOutputBuffer(v4l2_buf, nTimestamp);
+	}
+};
+
+zznvcodec_encoder_t* zznvenc_new() {
+	return new zznvenc_t();
+}
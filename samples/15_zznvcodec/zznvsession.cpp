@@ -0,0 +1,91 @@
+#include "zznvsession.h"
+#include "NvBufferPool.h"
+#include "ZzLog.h"
+
+#include <vector>
+#include <pthread.h>
+#include <string.h>
+
+ZZ_INIT_LOG("zznvsession");
+
+// a session is a pool of its own, the process pool of NvBufferPool stays untouched
+struct zznvcodec_session_t {
+	NvBufferPool* mPool;
+
+	explicit zznvcodec_session_t() {
+		mPool = NvBufferPool::createBufferPool("zznvsession");
+	}
+
+	~zznvcodec_session_t() {
+		delete mPool;
+	}
+
+	int AcquireBuffer(NvBufferCreateParams* pParams, int* pFD) {
+		return mPool->acquireDmabuf(pParams, pFD);
+	}
+
+	void ReleaseBuffer(int nFD) {
+		if(mPool->releaseDmabuf(nFD) != 0) {
+			LOGE("%s(%d): fd %d is not from this session", __FUNCTION__, __LINE__, nFD);
+		}
+	}
+
+	void Trim() {
+		mPool->trim();
+	}
+
+	int GetStats(zznvcodec_pool_stats_t* pStats, int nMaxPools) {
+		std::vector<NvBufferPoolStats> oStats(nMaxPools > 0 ? nMaxPools : 0);
+		int nPools = (int)mPool->getStats(oStats.data(), oStats.size());
+
+		for(int i = 0;i < nPools && i < nMaxPools;++i) {
+			const NvBufferPoolStats& pool = oStats[i];
+			zznvcodec_pool_stats_t& stats = pStats[i];
+
+			stats.width = pool.width;
+			stats.height = pool.height;
+			stats.color_format = pool.format;
+			stats.layout = pool.layout;
+			stats.buffers_in_use = pool.in_use;
+			stats.buffers_free = pool.idle;
+			stats.allocations = pool.allocations;
+			stats.reuses = pool.reuses;
+			stats.bytes = pool.size * (pool.in_use + pool.idle);
+			stats.buffers_high_water = pool.high_water;
+		}
+
+		return nPools;
+	}
+};
+
+int zznvsession_create_buffer(zznvcodec_session_t* pSession, NvBufferCreateParams* pParams, int* pFD) {
+	if(! pSession)
+		return NvBufferCreateEx(pFD, pParams);
+
+	return pSession->AcquireBuffer(pParams, pFD);
+}
+
+void zznvsession_destroy_buffer(zznvcodec_session_t* pSession, int nFD) {
+	if(! pSession) {
+		NvBufferDestroy(nFD);
+		return;
+	}
+
+	pSession->ReleaseBuffer(nFD);
+}
+
+zznvcodec_session_t* zznvcodec_session_new() {
+	return new zznvcodec_session_t();
+}
+
+void zznvcodec_session_delete(zznvcodec_session_t* pThis) {
+	delete pThis;
+}
+
+void zznvcodec_session_trim(zznvcodec_session_t* pThis) {
+	pThis->Trim();
+}
+
+int zznvcodec_session_get_stats(zznvcodec_session_t* pThis, zznvcodec_pool_stats_t* pStats, int nMaxPools) {
+	return pThis->GetStats(pStats, nMaxPools);
+}
@@ -0,0 +1,13 @@
+#ifndef __ZZNVSESSION_H__
+#define __ZZNVSESSION_H__
+
+#include "zznvcodec.h"
+
+#include <nvbuf_utils.h>
+
+// NvBufferCreateEx()/NvBufferDestroy() for the decoder and encoder. With a session the buffer
+// comes from and goes back to its pool, without one these are plain allocations.
+int zznvsession_create_buffer(zznvcodec_session_t* pSession, NvBufferCreateParams* pParams, int* pFD);
+void zznvsession_destroy_buffer(zznvcodec_session_t* pSession, int nFD);
+
+#endif // __ZZNVSESSION_H__
@@ -0,0 +1,824 @@
+#include "zznvcodec_backend.h"
+#include "zznvsession.h"
+#include "zzh264pcm.h"
+#include "NvNalScanner.h"
+#include "ZzLog.h"
+
+#include <deque>
+#include <vector>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BUFFERS 32
+#define MAX_VIDEO_BUFFERS 16
+#define DEFAULT_VIDEO_BUFFERS 4
+#define MAX_NAL_UNITS_PER_SCAN 64
+#define STRIDE_ALIGN 64
+
+ZZ_INIT_LOG("zzswdec");
+
+// Software decoder: same threading and callbacks as zznvdec_t, the decoder thread runs zzh264pcm_decoder_t
+// instead of NvVideoDecoder. Packets are queued whole, ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS counts packets.
+// ZZNVCODEC_OUTPUT_MODE_DMABUF frames are pitch-linear NvBuffers of the session, ZZNVCODEC_PROP_FRAME_POOL_SIZE
+// of them, held by the consumer like the capture buffers of zznvdec_t.
+struct zzswdec_t : public zznvcodec_decoder_t {
+	struct Packet {
+		std::vector<uint8_t> mData;
+		int64_t mTimestamp;
+	};
+
+	enum {
+		STATE_READY,
+		STATE_STARTED,
+	} mState;
+
+	zznvcodec_session_t* mSession;
+	pthread_t mDecoderThread;
+	zzh264pcm_decoder_t* mPCM;
+
+	std::deque<Packet> mPackets;
+	pthread_mutex_t mPacketsLock;
+	pthread_cond_t mPacketsCond;
+
+	zznvcodec_video_frame_slot_t* mVideoFrames[MAX_VIDEO_BUFFERS];
+	int mNumVideoBuffers;
+	int mCurVideoFrameIndex;
+	pthread_mutex_t mVideoFramesLock;
+	pthread_cond_t mVideoFramesCond;
+	int mFormatWidth;
+	int mFormatHeight;
+	volatile int mGotEOS;
+
+	int mDMABufFDs[MAX_VIDEO_BUFFERS];
+	zznvcodec_dmabuf_holds_t mDMABufHolds;
+
+	int mWidth;
+	int mHeight;
+	zznvcodec_pixel_format_t mFormat;
+	zznvcodec_pixel_format_t mCodec;
+	zznvcodec_decoder_on_video_frame_t mOnVideoFrame;
+	intptr_t mOnVideoFrame_User;
+	zznvcodec_decoder_on_video_dmabuf_t mOnVideoDMABuf;
+	intptr_t mOnVideoDMABuf_User;
+	zznvcodec_decoder_on_format_change_t mOnFormatChange;
+	intptr_t mOnFormatChange_User;
+	int mMaxPreloadBuffers;
+	int mNonBlockingInput;
+	zznvcodec_output_mode_t mOutputMode;
+	NvThreadPolicy mThreadPolicy; // decoder thread
+	zznvcodec_trace_t mTrace;
+
+	explicit zzswdec_t() {
+		mState = STATE_READY;
+		nv_thread_policy_init(&mThreadPolicy);
+
+		mSession = NULL;
+		mDecoderThread = (pthread_t)NULL;
+		mPCM = NULL;
+
+		pthread_mutex_init(&mPacketsLock, NULL);
+		pthread_cond_init(&mPacketsCond, NULL);
+
+		for(int i = 0;i < MAX_VIDEO_BUFFERS;++i) {
+			mVideoFrames[i] = NewVideoFrameSlot();
+		}
+		mNumVideoBuffers = DEFAULT_VIDEO_BUFFERS;
+		mCurVideoFrameIndex = 0;
+		pthread_mutex_init(&mVideoFramesLock, NULL);
+		pthread_cond_init(&mVideoFramesCond, NULL);
+		mFormatWidth = 0;
+		mFormatHeight = 0;
+		mGotEOS = 0;
+
+		memset(mDMABufFDs, 0, sizeof(mDMABufFDs));
+
+		mWidth = 0;
+		mHeight = 0;
+		mFormat = ZZNVCODEC_PIXEL_FORMAT_UNKNOWN;
+		mCodec = ZZNVCODEC_PIXEL_FORMAT_H264;
+		mOnVideoFrame = NULL;
+		mOnVideoFrame_User = 0;
+		mOnVideoDMABuf = NULL;
+		mOnVideoDMABuf_User = 0;
+		mOnFormatChange = NULL;
+		mOnFormatChange_User = 0;
+		mMaxPreloadBuffers = 4;
+		mNonBlockingInput = 0;
+		mOutputMode = ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME;
+	}
+
+	~zzswdec_t() {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+		}
+
+		for(int i = 0;i < MAX_VIDEO_BUFFERS;++i) {
+			free(mVideoFrames[i]);
+		}
+		pthread_cond_destroy(&mVideoFramesCond);
+		pthread_mutex_destroy(&mVideoFramesLock);
+		pthread_cond_destroy(&mPacketsCond);
+		pthread_mutex_destroy(&mPacketsLock);
+	}
+
+	void SetSession(zznvcodec_session_t* pSession) {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): session can not be changed while started", __FUNCTION__, __LINE__);
+			return;
+		}
+		// DMABUF mode buffers come from its pool
+		mSession = pSession;
+	}
+
+	void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
+		mWidth = nWidth;
+		mHeight = nHeight;
+		mFormat = nFormat;
+
+		switch(mFormat) {
+		case ZZNVCODEC_PIXEL_FORMAT_NV12:
+		case ZZNVCODEC_PIXEL_FORMAT_YUV420P:
+			break;
+
+		default:
+			LOGE("%s(%d): unexpected value, mFormat=%d", __FUNCTION__, __LINE__, mFormat);
+			break;
+		}
+	}
+
+	void SetMiscProperty(int nProperty, intptr_t pValue) {
+		switch(nProperty) {
+		case ZZNVCODEC_PROP_ENCODER_PIX_FMT: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): codec can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p != ZZNVCODEC_PIXEL_FORMAT_H264) {
+				LOGE("%s(%d): only H.264 is supported, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mCodec = (zznvcodec_pixel_format_t)*p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_OUTPUT_MODE: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): output mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			switch(*p) {
+			case ZZNVCODEC_OUTPUT_MODE_VIDEO_FRAME:
+			case ZZNVCODEC_OUTPUT_MODE_DMABUF:
+				mOutputMode = (zznvcodec_output_mode_t)*p;
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_INPUT_MODE: {
+			int* p = (int*)pValue;
+			switch(*p) {
+			case ZZNVCODEC_INPUT_MODE_NALU:
+			case ZZNVCODEC_INPUT_MODE_ACCESS_UNIT:
+				// packets are scanned for start codes either way
+				break;
+
+			default:
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): output plane buffers can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mMaxPreloadBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_NONBLOCKING_INPUT: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): blocking mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mNonBlockingInput = (*p != 0);
+		}
+			break;
+
+		case ZZNVCODEC_PROP_FRAME_POOL_SIZE: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): frame pool size can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_VIDEO_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mNumVideoBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_THREAD_POLICY:
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): thread policy can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			zznvcodec_thread_policy_set(&mThreadPolicy, (zznvcodec_thread_policy_t*)pValue, "zzswdec");
+			break;
+
+		case ZZNVCODEC_PROP_TRACE_STREAM: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): trace stream can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mTrace.mStream = *p;
+		}
+			break;
+
+		default:
+			LOGE("%s(%d): unexpected value, nProperty = %d", __FUNCTION__, __LINE__, nProperty);
+		}
+	}
+
+	void RegisterCallbacks(zznvcodec_decoder_on_video_frame_t pCB, intptr_t pUser) {
+		mOnVideoFrame = pCB;
+		mOnVideoFrame_User = pUser;
+	}
+
+	void RegisterDMABufCallbacks(zznvcodec_decoder_on_video_dmabuf_t pCB, intptr_t pUser) {
+		mOnVideoDMABuf = pCB;
+		mOnVideoDMABuf_User = pUser;
+	}
+
+	void RegisterFormatCallbacks(zznvcodec_decoder_on_format_change_t pCB, intptr_t pUser) {
+		mOnFormatChange = pCB;
+		mOnFormatChange_User = pUser;
+	}
+
+	int Start() {
+		int ret;
+
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return 0;
+		}
+
+		if(mFormat != ZZNVCODEC_PIXEL_FORMAT_NV12 && mFormat != ZZNVCODEC_PIXEL_FORMAT_YUV420P) {
+			LOGE("%s(%d): unexpected value, mFormat=%d", __FUNCTION__, __LINE__, mFormat);
+			return 0;
+		}
+
+		LOGD("Start decoder...");
+
+		mPCM = new zzh264pcm_decoder_t();
+
+		ret = pthread_create(&mDecoderThread, NULL, _DecodeMain, this);
+		if(ret) {
+			LOGE("%s(%d): pthread_create failed, err=%d", __FUNCTION__, __LINE__, ret);
+			delete mPCM;
+			mPCM = NULL;
+			return 0;
+		}
+
+		mTrace.Reset();
+		mState = STATE_STARTED;
+
+		LOGD("Start decoder... DONE");
+
+		return 1;
+	}
+
+	void Stop() {
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return;
+		}
+
+		LOGD("Stop decoder...");
+
+		pthread_mutex_lock(&mVideoFramesLock);
+		mGotEOS = 1;
+		pthread_cond_broadcast(&mVideoFramesCond);
+		pthread_mutex_unlock(&mVideoFramesLock);
+		mDMABufHolds.Wake();
+		pthread_mutex_lock(&mPacketsLock);
+		pthread_cond_broadcast(&mPacketsCond);
+		pthread_mutex_unlock(&mPacketsLock);
+
+		pthread_join(mDecoderThread, NULL);
+
+		// packets not decoded yet are dropped, as NvVideoDecoder does on abort
+		mPackets.clear();
+		DestroyVideoBuffers();
+		ResetDMABufHeld();
+		DestroyDMABufs();
+		delete mPCM;
+		mPCM = NULL;
+		mFormatWidth = 0;
+		mFormatHeight = 0;
+		mGotEOS = 0;
+
+		mState = STATE_READY;
+
+		LOGD("Stop decoder... DONE");
+	}
+
+	int SetVideoCompressionBuffer(unsigned char* pBuffer, int nSize, int nFlags, int64_t nTimestamp) {
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		mTrace.BeginOnce(nTimestamp, "decode");
+
+		pthread_mutex_lock(&mPacketsLock);
+		while((int)mPackets.size() >= mMaxPreloadBuffers) {
+			if(mNonBlockingInput || mGotEOS) {
+				pthread_mutex_unlock(&mPacketsLock);
+				return mGotEOS ? ZZNVCODEC_RESULT_ERROR : ZZNVCODEC_RESULT_EAGAIN;
+			}
+			pthread_cond_wait(&mPacketsCond, &mPacketsLock);
+		}
+		mPackets.push_back(Packet());
+		mPackets.back().mData.assign(pBuffer, pBuffer + nSize);
+		mPackets.back().mTimestamp = nTimestamp;
+		pthread_cond_broadcast(&mPacketsCond);
+		pthread_mutex_unlock(&mPacketsLock);
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	void ReleaseDMABuf(int64_t nReleaseHandle) {
+		pthread_mutex_lock(&mDMABufHolds.mLock);
+		int nIndex = mDMABufHolds.ReleaseLocked(nReleaseHandle, mState == STATE_STARTED ? mNumVideoBuffers : 0);
+		pthread_mutex_unlock(&mDMABufHolds.mLock);
+
+		if(nIndex < 0) {
+			LOGW("%s(%d): stale release handle %lld", __FUNCTION__, __LINE__, (long long)nReleaseHandle);
+		}
+	}
+
+	// invalidate the handles of the current buffers, frames still held are not returned anymore
+	void ResetDMABufHeld() {
+		int nHeld = mDMABufHolds.Reset();
+
+		if(nHeld) {
+			LOGW("%s(%d): %d dmabuf frame(s) still held, handles invalidated", __FUNCTION__, __LINE__, nHeld);
+		}
+	}
+
+	void DestroyDMABufs() {
+		for(int i = 0 ; i < MAX_VIDEO_BUFFERS ; i++) {
+			if(mDMABufFDs[i] != 0)
+				zznvsession_destroy_buffer(mSession, mDMABufFDs[i]);
+		}
+		memset(mDMABufFDs, 0, sizeof(mDMABufFDs));
+	}
+
+	NvBufferColorFormat DMABufColorFormat() {
+		return (mFormat == ZZNVCODEC_PIXEL_FORMAT_NV12) ? NvBufferColorFormat_NV12 : NvBufferColorFormat_YUV420;
+	}
+
+	int CreateDMABufs(int nWidth, int nHeight) {
+		NvBufferCreateParams cParams;
+
+		memset(&cParams, 0, sizeof(cParams));
+		cParams.width = nWidth;
+		cParams.height = nHeight;
+		cParams.layout = NvBufferLayout_Pitch;
+		cParams.colorFormat = DMABufColorFormat();
+		cParams.payloadType = NvBufferPayload_SurfArray;
+		cParams.nvbuf_tag = NvBufferTag_VIDEO_DEC;
+		for(int i = 0;i < mNumVideoBuffers;++i) {
+			if(zznvsession_create_buffer(mSession, &cParams, &mDMABufFDs[i]) < 0) {
+				LOGE("%s(%d): Failed to create buffers", __FUNCTION__, __LINE__);
+				mDMABufFDs[i] = 0;
+				DestroyDMABufs();
+				return -1;
+			}
+		}
+		mCurVideoFrameIndex = 0;
+
+		return 0;
+	}
+
+	// pick the next buffer the consumer does not hold, blocking the decoder thread while it holds them all
+	int AcquireDMABuf() {
+		int nIndex = -1;
+
+		pthread_mutex_lock(&mDMABufHolds.mLock);
+		while(! mGotEOS) {
+			for(int i = 0;i < mNumVideoBuffers;++i) {
+				int j = (mCurVideoFrameIndex + i) % mNumVideoBuffers;
+				if(! mDMABufHolds.IsHeldLocked(j)) {
+					nIndex = j;
+					break;
+				}
+			}
+
+			if(nIndex != -1) {
+				mCurVideoFrameIndex = (nIndex + 1) % mNumVideoBuffers;
+				break;
+			}
+
+			pthread_cond_wait(&mDMABufHolds.mCond, &mDMABufHolds.mLock);
+		}
+		pthread_mutex_unlock(&mDMABufHolds.mLock);
+
+		return nIndex;
+	}
+
+	zznvcodec_video_frame_slot_t* NewVideoFrameSlot() {
+		zznvcodec_video_frame_slot_t* pSlot = (zznvcodec_video_frame_slot_t*)calloc(1, sizeof(zznvcodec_video_frame_slot_t));
+
+		pSlot->mOwner = this;
+		pSlot->mRelease = ReleaseVideoFrameSlot;
+		return pSlot;
+	}
+
+	// the last unref of a detached slot, planes[0] is the start of its buffer
+	static void ReleaseVideoFrameSlot(zznvcodec_video_frame_slot_t* pSlot) {
+		free(pSlot->mFrame.planes[0].ptr);
+		free(pSlot);
+	}
+
+	// frames the consumer still references are detached and replaced, their last unref frees them
+	void DestroyVideoBuffers() {
+		int nHeld = 0;
+
+		pthread_mutex_lock(&zznvcodec_video_frame_slots_lock);
+		pthread_mutex_lock(&mVideoFramesLock);
+		for(int i = 0 ; i < MAX_VIDEO_BUFFERS ; i++) {
+			zznvcodec_video_frame_slot_t* pSlot = mVideoFrames[i];
+
+			if(pSlot->mRefs != 0) {
+				pSlot->mOwner = NULL;
+				mVideoFrames[i] = NewVideoFrameSlot();
+				nHeld++;
+				continue;
+			}
+
+			free(pSlot->mFrame.planes[0].ptr);
+			memset(&pSlot->mFrame, 0, sizeof(pSlot->mFrame));
+		}
+		mCurVideoFrameIndex = 0;
+		pthread_mutex_unlock(&mVideoFramesLock);
+		pthread_mutex_unlock(&zznvcodec_video_frame_slots_lock);
+
+		if(nHeld) {
+			LOGD("%s(%d): %d video frame(s) still referenced, detached", __FUNCTION__, __LINE__, nHeld);
+		}
+	}
+
+	// the frames keep their memory for the whole geometry, like the NvBuffers of zznvdec_t
+	void CreateVideoBuffers(int nWidth, int nHeight) {
+		int nStrideY = (nWidth + STRIDE_ALIGN - 1) & ~(STRIDE_ALIGN - 1);
+		int nStrideC = (mFormat == ZZNVCODEC_PIXEL_FORMAT_NV12) ? nStrideY : ((nWidth / 2 + STRIDE_ALIGN - 1) & ~(STRIDE_ALIGN - 1));
+		int nSizeY = nStrideY * nHeight;
+		int nSizeC = nStrideC * (nHeight / 2);
+
+		pthread_mutex_lock(&mVideoFramesLock);
+		for(int i = 0;i < mNumVideoBuffers;++i) {
+			zznvcodec_video_frame_t& oVideoFrame = mVideoFrames[i]->mFrame;
+			uint8_t* pBuffer = (uint8_t*)malloc(nSizeY + nSizeC * 2);
+
+			oVideoFrame.planes[0].width = nWidth;
+			oVideoFrame.planes[0].height = nHeight;
+			oVideoFrame.planes[0].ptr = pBuffer;
+			oVideoFrame.planes[0].stride = nStrideY;
+			if(mFormat == ZZNVCODEC_PIXEL_FORMAT_NV12) {
+				oVideoFrame.num_planes = 2;
+				oVideoFrame.planes[1].width = nWidth / 2;
+				oVideoFrame.planes[1].height = nHeight / 2;
+				oVideoFrame.planes[1].ptr = pBuffer + nSizeY;
+				oVideoFrame.planes[1].stride = nStrideC;
+			} else {
+				oVideoFrame.num_planes = 3;
+				for(int j = 1;j < 3;++j) {
+					oVideoFrame.planes[j].width = nWidth / 2;
+					oVideoFrame.planes[j].height = nHeight / 2;
+					oVideoFrame.planes[j].ptr = pBuffer + nSizeY + nSizeC * (j - 1);
+					oVideoFrame.planes[j].stride = nStrideC;
+				}
+			}
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	// wait until the consumer has unref'ed every frame, or the decoder is stopping
+	void WaitVideoFramesIdle() {
+		pthread_mutex_lock(&mVideoFramesLock);
+		while(! mGotEOS) {
+			bool bIdle = true;
+			for(int i = 0;i < mNumVideoBuffers;++i) {
+				if(mVideoFrames[i]->mRefs != 0) {
+					bIdle = false;
+					break;
+				}
+			}
+			if(bIdle)
+				break;
+
+			pthread_cond_wait(&mVideoFramesCond, &mVideoFramesLock);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	// pick the next unreferenced slot, blocking the decoder thread while the consumer holds them all
+	int AcquireVideoFrameSlot() {
+		int nIndex = -1;
+
+		pthread_mutex_lock(&mVideoFramesLock);
+		while(! mGotEOS) {
+			for(int i = 0;i < mNumVideoBuffers;++i) {
+				int j = (mCurVideoFrameIndex + i) % mNumVideoBuffers;
+				if(mVideoFrames[j]->mRefs == 0) {
+					nIndex = j;
+					break;
+				}
+			}
+
+			if(nIndex != -1) {
+				mVideoFrames[nIndex]->mRefs = 1;
+				mCurVideoFrameIndex = (nIndex + 1) % mNumVideoBuffers;
+				break;
+			}
+
+			pthread_cond_wait(&mVideoFramesCond, &mVideoFramesLock);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+
+		return nIndex;
+	}
+
+	void RefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) {
+		pthread_mutex_lock(&mVideoFramesLock);
+		pSlot->mRefs++;
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	void UnrefVideoFrame(zznvcodec_video_frame_slot_t* pSlot) {
+		pthread_mutex_lock(&mVideoFramesLock);
+		if(pSlot->mRefs <= 0) {
+			LOGE("%s(%d): unbalanced unref, mRefs=%d", __FUNCTION__, __LINE__, pSlot->mRefs);
+		} else if(--pSlot->mRefs == 0) {
+			pthread_cond_broadcast(&mVideoFramesCond);
+		}
+		pthread_mutex_unlock(&mVideoFramesLock);
+	}
+
+	// the crop of the decoded picture into NV12 (2 planes) or YUV420P (3 planes)
+	void CopyPicture(uint8_t** pDst, const int* nDstStride, int nPlanes, int nWidth, int nHeight) {
+		int nCodedWidth = mPCM->mCodedWidth;
+		int nCodedHalf = nCodedWidth / 2;
+		const uint8_t* pY = mPCM->PlaneY() + mPCM->mCropY * nCodedWidth + mPCM->mCropX;
+		const uint8_t* pU = mPCM->PlaneU() + (mPCM->mCropY / 2) * nCodedHalf + mPCM->mCropX / 2;
+		const uint8_t* pV = mPCM->PlaneV() + (mPCM->mCropY / 2) * nCodedHalf + mPCM->mCropX / 2;
+
+		for(int y = 0;y < nHeight;++y) {
+			memcpy(pDst[0] + y * nDstStride[0], pY + y * nCodedWidth, nWidth);
+		}
+		if(nPlanes == 2) {
+			for(int y = 0;y < nHeight / 2;++y) {
+				uint8_t* pDstUV = pDst[1] + y * nDstStride[1];
+				const uint8_t* pSrcU = pU + y * nCodedHalf;
+				const uint8_t* pSrcV = pV + y * nCodedHalf;
+				for(int x = 0;x < nWidth / 2;++x) {
+					pDstUV[x * 2] = pSrcU[x];
+					pDstUV[x * 2 + 1] = pSrcV[x];
+				}
+			}
+		} else {
+			for(int y = 0;y < nHeight / 2;++y) {
+				memcpy(pDst[1] + y * nDstStride[1], pU + y * nCodedHalf, nWidth / 2);
+				memcpy(pDst[2] + y * nDstStride[2], pV + y * nCodedHalf, nWidth / 2);
+			}
+		}
+	}
+
+	void DeliverDMABuf(int64_t nTimestamp, int nWidth, int nHeight) {
+		int ret;
+
+		if(! mOnVideoDMABuf) {
+			// nobody to hand it to, as zznvdec_t the picture is dropped
+			return;
+		}
+
+		int nIndex = AcquireDMABuf();
+		if(nIndex == -1)
+			return;
+
+		int nFD = mDMABufFDs[nIndex];
+		NvBufferParams parm;
+		ret = NvBufferGetParams(nFD, &parm);
+		if(ret != 0) {
+			LOGE("%s(%d): NvBufferGetParams failed, ret=%d", __FUNCTION__, __LINE__, ret);
+			return;
+		}
+
+		uint8_t* pDst[3];
+		int nDstStride[3];
+		for(int i = 0;i < (int)parm.num_planes;++i) {
+			void* ptr;
+			ret = NvBufferMemMap(nFD, i, NvBufferMem_Write, &ptr);
+			if(ret != 0) {
+				LOGE("%s(%d): NvBufferMemMap failed, ret=%d", __FUNCTION__, __LINE__, ret);
+				for(int j = 0;j < i;++j)
+					NvBufferMemUnMap(nFD, j, (void**)&pDst[j]);
+				return;
+			}
+			pDst[i] = (uint8_t*)ptr;
+			nDstStride[i] = parm.pitch[i];
+		}
+
+		mTrace.Begin(nTimestamp, "dec.transform");
+		CopyPicture(pDst, nDstStride, parm.num_planes, nWidth, nHeight);
+		mTrace.End(nTimestamp, "dec.transform");
+
+		for(int i = 0;i < (int)parm.num_planes;++i) {
+			NvBufferMemSyncForDevice(nFD, i, (void**)&pDst[i]);
+			NvBufferMemUnMap(nFD, i, (void**)&pDst[i]);
+		}
+
+		zznvcodec_dmabuf_frame_t oFrame;
+		memset(&oFrame, 0, sizeof(oFrame));
+		oFrame.fd = nFD;
+		oFrame.color_format = parm.pixel_format;
+		oFrame.layout = parm.layout[0];
+		oFrame.num_planes = parm.num_planes;
+		for(int i = 0;i < (int)parm.num_planes && i < ZZNVCODEC_MAX_PLANES;++i) {
+			oFrame.planes[i].width = parm.width[i];
+			oFrame.planes[i].height = parm.height[i];
+			oFrame.planes[i].pitch = parm.pitch[i];
+			oFrame.planes[i].offset = parm.offset[i];
+			oFrame.planes[i].size = parm.psize[i];
+		}
+
+		oFrame.release_handle = mDMABufHolds.Hold(nIndex);
+
+		mTrace.Begin(nTimestamp, "dec.deliver");
+		mOnVideoDMABuf(&oFrame, nTimestamp, mOnVideoDMABuf_User);
+		mTrace.End(nTimestamp, "dec.deliver");
+	}
+
+	void OnPicture(int64_t nTimestamp) {
+		int nWidth = mPCM->mWidth & ~1;
+		int nHeight = mPCM->mHeight & ~1;
+
+		mTrace.End(nTimestamp, "decode");
+
+		if(nWidth != mFormatWidth || nHeight != mFormatHeight) {
+			LOGD("%s(%d): video format %dx%d -> %dx%d", __FUNCTION__, __LINE__, mFormatWidth, mFormatHeight, nWidth, nHeight);
+
+			if(mOutputMode == ZZNVCODEC_OUTPUT_MODE_DMABUF) {
+				mDMABufHolds.WaitIdle(&mGotEOS);
+				if(mGotEOS)
+					return;
+
+				ResetDMABufHeld();
+				DestroyDMABufs();
+				if(CreateDMABufs(nWidth, nHeight) < 0)
+					return;
+			} else {
+				WaitVideoFramesIdle();
+				if(mGotEOS)
+					return;
+
+				DestroyVideoBuffers();
+				CreateVideoBuffers(nWidth, nHeight);
+			}
+			mFormatWidth = nWidth;
+			mFormatHeight = nHeight;
+
+			if(mOnFormatChange) {
+				zznvcodec_video_format_t oFormat;
+				oFormat.width = nWidth;
+				oFormat.height = nHeight;
+				oFormat.coded_width = mPCM->mCodedWidth;
+				oFormat.coded_height = mPCM->mCodedHeight;
+				oFormat.color_format = (mOutputMode == ZZNVCODEC_OUTPUT_MODE_DMABUF) ? DMABufColorFormat() : -1;
+				mOnFormatChange(&oFormat, mOnFormatChange_User);
+			}
+		}
+
+		if(mOutputMode == ZZNVCODEC_OUTPUT_MODE_DMABUF) {
+			DeliverDMABuf(nTimestamp, nWidth, nHeight);
+			return;
+		}
+
+		int nSlot = AcquireVideoFrameSlot();
+		if(nSlot == -1)
+			return;
+
+		zznvcodec_video_frame_slot_t& oSlot = *mVideoFrames[nSlot];
+		zznvcodec_video_frame_t& oVideoFrame = oSlot.mFrame;
+		uint8_t* pDst[3];
+		int nDstStride[3];
+
+		for(int i = 0;i < oVideoFrame.num_planes;++i) {
+			pDst[i] = oVideoFrame.planes[i].ptr;
+			nDstStride[i] = oVideoFrame.planes[i].stride;
+		}
+		mTrace.Begin(nTimestamp, "dec.transform");
+		CopyPicture(pDst, nDstStride, oVideoFrame.num_planes, nWidth, nHeight);
+		mTrace.End(nTimestamp, "dec.transform");
+
+		if(mOnVideoFrame) {
+			mTrace.Begin(nTimestamp, "dec.deliver");
+			mOnVideoFrame(&oVideoFrame, nTimestamp, mOnVideoFrame_User);
+			mTrace.End(nTimestamp, "dec.deliver");
+		}
+		UnrefVideoFrame(&oSlot);
+	}
+
+	void DecodePacket(Packet& oPacket) {
+		NvNalUnit oUnits[MAX_NAL_UNITS_PER_SCAN];
+		const uint8_t* pBuffer = &oPacket.mData[0];
+		size_t nSize = oPacket.mData.size();
+
+		while(nSize > 0 && ! mGotEOS) {
+			int nUnits = nv_nal_scan_units(pBuffer, nSize, NV_NAL_CODEC_H264, oUnits, MAX_NAL_UNITS_PER_SCAN);
+			if(nUnits == 0)
+				break;
+
+			for(int i = 0;i < nUnits;++i) {
+				const uint8_t* pNAL = pBuffer + oUnits[i].offset + oUnits[i].start_code_len;
+				int nNAL = (int)(oUnits[i].size - oUnits[i].start_code_len);
+
+				int ret = mPCM->DecodeNAL(pNAL, nNAL);
+				if(ret < 0) {
+					LOGE("%s(%d): DecodeNAL failed, type=%d, nTimestamp=%.2f", __FUNCTION__, __LINE__,
+						oUnits[i].type, oPacket.mTimestamp / 1000.0);
+					return;
+				}
+				if(ret == 1)
+					OnPicture(oPacket.mTimestamp);
+			}
+
+			size_t nConsumed = oUnits[nUnits - 1].offset + oUnits[nUnits - 1].size;
+			pBuffer += nConsumed;
+			nSize -= nConsumed;
+		}
+	}
+
+	static void* _DecodeMain(void* arg) {
+		zzswdec_t* pThis = (zzswdec_t*)arg;
+
+		return pThis->DecoderMain();
+	}
+
+	void* DecoderMain() {
+		LOGD("%s(%d): ++", __FUNCTION__, __LINE__);
+
+		if(! nv_thread_policy_is_default(&mThreadPolicy) && nv_thread_policy_apply(&mThreadPolicy) < 0) {
+			LOGW("%s(%d): thread policy not fully applied, errno=%d", __FUNCTION__, __LINE__, errno);
+		}
+
+		for(;;) {
+			Packet oPacket;
+
+			pthread_mutex_lock(&mPacketsLock);
+			while(mPackets.empty() && ! mGotEOS)
+				pthread_cond_wait(&mPacketsCond, &mPacketsLock);
+			if(mGotEOS) {
+				pthread_mutex_unlock(&mPacketsLock);
+				break;
+			}
+			oPacket.mData.swap(mPackets.front().mData);
+			oPacket.mTimestamp = mPackets.front().mTimestamp;
+			mPackets.pop_front();
+			pthread_cond_broadcast(&mPacketsCond);
+			pthread_mutex_unlock(&mPacketsLock);
+
+			if(! oPacket.mData.empty())
+				DecodePacket(oPacket);
+		}
+
+		LOGD("%s(%d): --", __FUNCTION__, __LINE__);
+
+		return NULL;
+	}
+};
+
+zznvcodec_decoder_t* zzswdec_new() {
+	return new zzswdec_t();
+}
@@ -0,0 +1,444 @@
+#include "zznvcodec_backend.h"
+#include "zzh264pcm.h"
+#include "zzyuv.h"
+#include "ZzLog.h"
+
+#include <deque>
+#include <vector>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BUFFERS 32
+
+ZZ_INIT_LOG("zzswenc");
+
+// Software encoder: same threading and callbacks as zznvenc_t, every frame becomes an I_PCM IDR access unit
+// with SPS and PPS. Frames are host memory, rate control, ROI and QP properties are accepted and ignored.
+struct zzswenc_t : public zznvcodec_encoder_t {
+	struct Frame {
+		int mIndex;
+		int64_t mTimestamp;
+	};
+
+	enum {
+		STATE_READY,
+		STATE_STARTED,
+	} mState;
+
+	zznvcodec_session_t* mSession;
+	pthread_t mEncoderThread;
+
+	// I420 copies of the frames in flight, the output plane of zznvenc_t
+	std::vector<uint8_t> mFrameBuffers[MAX_BUFFERS];
+	int mFreeFrameBuffers[MAX_BUFFERS];
+	int mNumFreeFrameBuffers;
+	std::deque<Frame> mPendingFrames;
+	pthread_mutex_t mFramesLock;
+	pthread_cond_t mFramesCond;
+	bool mStopping;
+	int mIdrPicId;
+	std::vector<uint8_t> mPacket;
+
+	int mWidth;
+	int mHeight;
+	zznvcodec_pixel_format_t mFormat;
+	zznvcodec_encoder_on_video_packet_t mOnVideoPacket;
+	intptr_t mOnVideoPacket_User;
+	zznvcodec_encoder_on_video_packet_info_t mOnVideoPacketInfo;
+	intptr_t mOnVideoPacketInfo_User;
+	zznvcodec_encoder_on_frame_done_t mOnFrameDone;
+	intptr_t mOnFrameDone_User;
+	int mMaxPreloadBuffers;
+	int mNonBlockingInput;
+	NvThreadPolicy mThreadPolicy; // encoder thread
+	zznvcodec_trace_t mTrace;
+
+	explicit zzswenc_t() {
+		mState = STATE_READY;
+		nv_thread_policy_init(&mThreadPolicy);
+
+		mSession = NULL;
+		mEncoderThread = (pthread_t)NULL;
+
+		memset(mFreeFrameBuffers, 0, sizeof(mFreeFrameBuffers));
+		mNumFreeFrameBuffers = 0;
+		pthread_mutex_init(&mFramesLock, NULL);
+		pthread_cond_init(&mFramesCond, NULL);
+		mStopping = false;
+		mIdrPicId = 0;
+
+		mWidth = 0;
+		mHeight = 0;
+		mFormat = ZZNVCODEC_PIXEL_FORMAT_UNKNOWN;
+		mOnVideoPacket = NULL;
+		mOnVideoPacket_User = 0;
+		mOnVideoPacketInfo = NULL;
+		mOnVideoPacketInfo_User = 0;
+		mOnFrameDone = NULL;
+		mOnFrameDone_User = 0;
+		mMaxPreloadBuffers = 10;
+		mNonBlockingInput = 0;
+	}
+
+	~zzswenc_t() {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+		}
+
+		pthread_cond_destroy(&mFramesCond);
+		pthread_mutex_destroy(&mFramesLock);
+	}
+
+	void SetVideoProperty(int nWidth, int nHeight, zznvcodec_pixel_format_t nFormat) {
+		mWidth = nWidth;
+		mHeight = nHeight;
+		mFormat = nFormat;
+
+		switch(mFormat) {
+		case ZZNVCODEC_PIXEL_FORMAT_NV12:
+		case ZZNVCODEC_PIXEL_FORMAT_YUV420P:
+		case ZZNVCODEC_PIXEL_FORMAT_YUYV422:
+			break;
+
+		default:
+			LOGE("%s(%d): unexpected value, mFormat=%d", __FUNCTION__, __LINE__, mFormat);
+			break;
+		}
+	}
+
+	void SetMiscProperty(int nProperty, intptr_t pValue) {
+		switch(nProperty) {
+		case ZZNVCODEC_PROP_ENCODER_PIX_FMT: {
+			int* p = (int*)pValue;
+			if(*p != ZZNVCODEC_PIXEL_FORMAT_H264) {
+				LOGE("%s(%d): only H.264 is supported, *p = %d", __FUNCTION__, __LINE__, *p);
+			}
+		}
+			break;
+
+		case ZZNVCODEC_PROP_BITRATE:
+		case ZZNVCODEC_PROP_PROFILE:
+		case ZZNVCODEC_PROP_LEVEL:
+		case ZZNVCODEC_PROP_RATECONTROL:
+		case ZZNVCODEC_PROP_IDRINTERVAL:
+		case ZZNVCODEC_PROP_IFRAMEINTERVAL:
+		case ZZNVCODEC_PROP_FRAMERATE:
+		case ZZNVCODEC_PROP_ROI:
+		case ZZNVCODEC_PROP_QP_RANGE:
+		case ZZNVCODEC_PROP_YUYV_CONVERTER:
+			// I_PCM has no rate or quality to control
+			break;
+
+		case ZZNVCODEC_PROP_FORCE_IDR:
+			if(mState != STATE_STARTED) {
+				LOGE("%s(%d): IDR can only be forced while started", __FUNCTION__, __LINE__);
+			}
+			// every frame is an IDR already
+			break;
+
+		case ZZNVCODEC_PROP_OUTPUT_PLANE_BUFFERS: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): output plane buffers can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			if(*p < 1 || *p > MAX_BUFFERS) {
+				LOGE("%s(%d): unexpected value, *p = %d", __FUNCTION__, __LINE__, *p);
+				break;
+			}
+			mMaxPreloadBuffers = *p;
+		}
+			break;
+
+		case ZZNVCODEC_PROP_NONBLOCKING_INPUT: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): blocking mode can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mNonBlockingInput = (*p != 0);
+		}
+			break;
+
+		case ZZNVCODEC_PROP_THREAD_POLICY:
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): thread policy can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			zznvcodec_thread_policy_set(&mThreadPolicy, (zznvcodec_thread_policy_t*)pValue, "zzswenc");
+			break;
+
+		case ZZNVCODEC_PROP_TRACE_STREAM: {
+			int* p = (int*)pValue;
+			if(mState != STATE_READY) {
+				LOGE("%s(%d): trace stream can not be changed while started", __FUNCTION__, __LINE__);
+				break;
+			}
+			mTrace.mStream = *p;
+		}
+			break;
+
+		default:
+			LOGE("%s(%d): unexpected value, nProperty = %d", __FUNCTION__, __LINE__, nProperty);
+			break;
+		}
+	}
+
+	void SetSession(zznvcodec_session_t* pSession) {
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): session can not be changed while started", __FUNCTION__, __LINE__);
+			return;
+		}
+		// no NvBuffers to pool
+		mSession = pSession;
+	}
+
+	void RegisterCallbacks(zznvcodec_encoder_on_video_packet_t pCB, intptr_t pUser) {
+		mOnVideoPacket = pCB;
+		mOnVideoPacket_User = pUser;
+	}
+
+	void RegisterPacketInfoCallbacks(zznvcodec_encoder_on_video_packet_info_t pCB, intptr_t pUser) {
+		mOnVideoPacketInfo = pCB;
+		mOnVideoPacketInfo_User = pUser;
+	}
+
+	void RegisterFrameDoneCallbacks(zznvcodec_encoder_on_frame_done_t pCB, intptr_t pUser) {
+		mOnFrameDone = pCB;
+		mOnFrameDone_User = pUser;
+	}
+
+	void RegisterDMABufCallbacks(zznvcodec_encoder_on_dmabuf_release_t pCB, intptr_t pUser) {
+		LOGW("%s(%d): DMABUF input is not supported by the software backend", __FUNCTION__, __LINE__);
+	}
+
+	int Start() {
+		int ret;
+
+		if(mState != STATE_READY) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		if(mWidth <= 0 || mHeight <= 0 || (mWidth & 1) || (mHeight & 1)) {
+			LOGE("%s(%d): unexpected value, %dx%d", __FUNCTION__, __LINE__, mWidth, mHeight);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		LOGD("Start encoder...");
+
+		mNumFreeFrameBuffers = 0;
+		for(int i = 0;i < mMaxPreloadBuffers;++i) {
+			mFrameBuffers[i].resize(mWidth * mHeight * 3 / 2);
+			mFreeFrameBuffers[mNumFreeFrameBuffers++] = i;
+		}
+		mStopping = false;
+
+		ret = pthread_create(&mEncoderThread, NULL, _EncodeMain, this);
+		if(ret) {
+			LOGE("%s(%d): pthread_create failed, err=%d", __FUNCTION__, __LINE__, ret);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		mTrace.Reset();
+		mState = STATE_STARTED;
+
+		LOGD("Start encoder... DONE");
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	void Stop() {
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return;
+		}
+
+		LOGD("Stop encoder...");
+
+		// frames already queued are encoded, as with the EOS buffer of zznvenc_t
+		pthread_mutex_lock(&mFramesLock);
+		mStopping = true;
+		pthread_cond_broadcast(&mFramesCond);
+		pthread_mutex_unlock(&mFramesLock);
+
+		pthread_join(mEncoderThread, NULL);
+
+		for(int i = 0;i < MAX_BUFFERS;++i) {
+			std::vector<uint8_t>().swap(mFrameBuffers[i]);
+		}
+		mNumFreeFrameBuffers = 0;
+		mIdrPicId = 0;
+
+		mState = STATE_READY;
+
+		LOGD("Stop encoder... DONE");
+	}
+
+	int AcquireFrameBuffer(int* pIndex, bool bBlock) {
+		int ret = ZZNVCODEC_RESULT_OK;
+
+		pthread_mutex_lock(&mFramesLock);
+		while(mNumFreeFrameBuffers == 0) {
+			if(! bBlock) {
+				ret = ZZNVCODEC_RESULT_EAGAIN;
+				break;
+			}
+			pthread_cond_wait(&mFramesCond, &mFramesLock);
+		}
+		if(ret == ZZNVCODEC_RESULT_OK)
+			*pIndex = mFreeFrameBuffers[--mNumFreeFrameBuffers];
+		pthread_mutex_unlock(&mFramesLock);
+
+		return ret;
+	}
+
+	int SetVideoUncompressionBuffer(zznvcodec_video_frame_t* pFrame, int64_t nTimestamp) {
+		int ret;
+		int nIndex;
+
+		if(mState != STATE_STARTED) {
+			LOGE("%s(%d): unexpected value, mState=%d", __FUNCTION__, __LINE__, mState);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		int nPlanes = (mFormat == ZZNVCODEC_PIXEL_FORMAT_YUYV422) ? 1 : (mFormat == ZZNVCODEC_PIXEL_FORMAT_NV12 ? 2 : 3);
+		if(pFrame->num_planes != nPlanes) {
+			LOGE("%s(%d): unexpected pFrame->num_planes = %d", __FUNCTION__, __LINE__, pFrame->num_planes);
+			return ZZNVCODEC_RESULT_ERROR;
+		}
+
+		ret = AcquireFrameBuffer(&nIndex, ! mNonBlockingInput);
+		if(ret != ZZNVCODEC_RESULT_OK)
+			return ret;
+
+		mTrace.Begin(nTimestamp, "encode");
+		mTrace.Begin(nTimestamp, "enc.convert");
+
+		uint8_t* pY = &mFrameBuffers[nIndex][0];
+		uint8_t* pU = pY + mWidth * mHeight;
+		uint8_t* pV = pU + mWidth * mHeight / 4;
+		int nHalf = mWidth / 2;
+
+		switch(mFormat) {
+		case ZZNVCODEC_PIXEL_FORMAT_YUYV422:
+			zzyuv_yuyv_to_i420(pFrame->planes[0].ptr, pFrame->planes[0].stride,
+				pY, mWidth, pU, nHalf, pV, nHalf, mWidth, mHeight);
+			break;
+
+		case ZZNVCODEC_PIXEL_FORMAT_NV12:
+			for(int y = 0;y < mHeight;++y)
+				memcpy(pY + y * mWidth, pFrame->planes[0].ptr + y * pFrame->planes[0].stride, mWidth);
+			for(int y = 0;y < mHeight / 2;++y) {
+				const uint8_t* pSrc = pFrame->planes[1].ptr + y * pFrame->planes[1].stride;
+				for(int x = 0;x < nHalf;++x) {
+					pU[y * nHalf + x] = pSrc[x * 2];
+					pV[y * nHalf + x] = pSrc[x * 2 + 1];
+				}
+			}
+			break;
+
+		default:
+			for(int y = 0;y < mHeight;++y)
+				memcpy(pY + y * mWidth, pFrame->planes[0].ptr + y * pFrame->planes[0].stride, mWidth);
+			for(int y = 0;y < mHeight / 2;++y) {
+				memcpy(pU + y * nHalf, pFrame->planes[1].ptr + y * pFrame->planes[1].stride, nHalf);
+				memcpy(pV + y * nHalf, pFrame->planes[2].ptr + y * pFrame->planes[2].stride, nHalf);
+			}
+			break;
+		}
+		mTrace.End(nTimestamp, "enc.convert");
+
+		Frame oFrame;
+		oFrame.mIndex = nIndex;
+		oFrame.mTimestamp = nTimestamp;
+
+		pthread_mutex_lock(&mFramesLock);
+		mPendingFrames.push_back(oFrame);
+		pthread_cond_broadcast(&mFramesCond);
+		pthread_mutex_unlock(&mFramesLock);
+
+		return ZZNVCODEC_RESULT_OK;
+	}
+
+	int SetVideoDMABuf(zznvcodec_dmabuf_frame_t* pFrame, int64_t nTimestamp) {
+		LOGE("%s(%d): DMABUF input is not supported by the software backend", __FUNCTION__, __LINE__);
+		return ZZNVCODEC_RESULT_ERROR;
+	}
+
+	static void* _EncodeMain(void* arg) {
+		zzswenc_t* pThis = (zzswenc_t*)arg;
+
+		return pThis->EncoderMain();
+	}
+
+	void* EncoderMain() {
+		LOGD("%s(%d): ++", __FUNCTION__, __LINE__);
+
+		if(! nv_thread_policy_is_default(&mThreadPolicy) && nv_thread_policy_apply(&mThreadPolicy) < 0) {
+			LOGW("%s(%d): thread policy not fully applied, errno=%d", __FUNCTION__, __LINE__, errno);
+		}
+
+		for(;;) {
+			pthread_mutex_lock(&mFramesLock);
+			while(mPendingFrames.empty() && ! mStopping)
+				pthread_cond_wait(&mFramesCond, &mFramesLock);
+			if(mPendingFrames.empty()) {
+				pthread_mutex_unlock(&mFramesLock);
+				break;
+			}
+			Frame oFrame = mPendingFrames.front();
+			mPendingFrames.pop_front();
+			pthread_mutex_unlock(&mFramesLock);
+
+			const uint8_t* pY = &mFrameBuffers[oFrame.mIndex][0];
+			const uint8_t* pU = pY + mWidth * mHeight;
+			const uint8_t* pV = pU + mWidth * mHeight / 4;
+			mPacket.clear();
+			zzh264pcm_encode(pY, mWidth, pU, mWidth / 2, pV, mWidth / 2, mWidth, mHeight, mIdrPicId++, mPacket);
+
+			// the frame buffer is free once encoded, the packet follows as from the capture plane
+			pthread_mutex_lock(&mFramesLock);
+			mFreeFrameBuffers[mNumFreeFrameBuffers++] = oFrame.mIndex;
+			pthread_cond_broadcast(&mFramesCond);
+			pthread_mutex_unlock(&mFramesLock);
+
+			mTrace.End(oFrame.mTimestamp, "encode");
+
+			if(mOnFrameDone) {
+				mOnFrameDone(oFrame.mTimestamp, mOnFrameDone_User);
+			}
+
+			mTrace.Begin(oFrame.mTimestamp, "enc.deliver");
+
+			if(mOnVideoPacket) {
+				mOnVideoPacket(&mPacket[0], (int)mPacket.size(), 1, oFrame.mTimestamp, mOnVideoPacket_User);
+			}
+
+			if(mOnVideoPacketInfo) {
+				zznvcodec_encoder_packet_info_t info;
+
+				info.frame_type = ZZNVCODEC_FRAME_TYPE_KEY;
+				info.size = (int)mPacket.size();
+				info.encoded_bits = info.size * 8;
+				info.avg_qp = -1;
+				info.min_qp = -1;
+				info.max_qp = -1;
+				info.ref_frame_id = -1;
+				info.num_ref_frames = 0;
+				mOnVideoPacketInfo(&mPacket[0], &info, oFrame.mTimestamp, mOnVideoPacketInfo_User);
+			}
+			mTrace.End(oFrame.mTimestamp, "enc.deliver");
+		}
+
+		LOGD("%s(%d): --", __FUNCTION__, __LINE__);
+
+		return NULL;
+	}
+};
+
+zznvcodec_encoder_t* zzswenc_new() {
+	return new zzswenc_t();
+}
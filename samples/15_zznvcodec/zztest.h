@@ -0,0 +1,17 @@
+#ifndef __ZZTEST_H__
+#define __ZZTEST_H__
+
+#include "ZzLog.h"
+
+// for the test programs, one translation unit each: CHECK() logs a failed condition and counts it,
+// main() prints FAILED and returns 1 if _failures is not 0
+static int _failures = 0;
+
+#define CHECK(cond) do { \
+	if(! (cond)) { \
+		LOGE("%s(%d): check failed: %s", __FUNCTION__, __LINE__, #cond); \
+		_failures++; \
+	} \
+} while(0)
+
+#endif // __ZZTEST_H__
@@ -0,0 +1,179 @@
+#include "zzyuv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ZZYUV_X86 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define ZZYUV_NEON 1
+#include <arm_neon.h>
+#endif
+
+// one row pair: s0/s1 are YUYV rows, y0/y1 the luma rows, u/v the shared chroma row
+typedef void (*row_pair_fn)(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+	uint8_t* u, uint8_t* v, int nWidth);
+
+static void row_pair_scalar_from(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+	uint8_t* u, uint8_t* v, int x, int nWidth) {
+	for(;x + 1 < nWidth;x += 2) {
+		const uint8_t* p0 = s0 + x * 2;
+		const uint8_t* p1 = s1 + x * 2;
+
+		y0[x] = p0[0];
+		y0[x + 1] = p0[2];
+		y1[x] = p1[0];
+		y1[x + 1] = p1[2];
+		// same rounding as pavgb/vrhadd
+		u[x / 2] = (uint8_t)((p0[1] + p1[1] + 1) >> 1);
+		v[x / 2] = (uint8_t)((p0[3] + p1[3] + 1) >> 1);
+	}
+}
+
+static void row_pair_scalar(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+	uint8_t* u, uint8_t* v, int nWidth) {
+	row_pair_scalar_from(s0, s1, y0, y1, u, v, 0, nWidth);
+}
+
+#ifdef ZZYUV_X86
+static void row_pair_sse2(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+	uint8_t* u, uint8_t* v, int nWidth) {
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+
+	for(;x + 16 <= nWidth;x += 16) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(s0 + x * 2));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(s0 + x * 2 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(s1 + x * 2));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(s1 + x * 2 + 16));
+
+		_mm_storeu_si128((__m128i*)(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask)));
+		_mm_storeu_si128((__m128i*)(y1 + x), _mm_packus_epi16(_mm_and_si128(b0, mask), _mm_and_si128(b1, mask)));
+
+		// U0 V0 U1 V1 ... of both rows, averaged
+		__m128i ca = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+		__m128i cb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+		__m128i c = _mm_avg_epu8(ca, cb);
+
+		_mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(_mm_and_si128(c, mask), zero));
+		_mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+	}
+
+	row_pair_scalar_from(s0, s1, y0, y1, u, v, x, nWidth);
+}
+#endif
+
+#ifdef ZZYUV_NEON
+static void row_pair_neon(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+	uint8_t* u, uint8_t* v, int nWidth) {
+	int x = 0;
+
+	for(;x + 32 <= nWidth;x += 32) {
+		// val[0]/val[2]: even/odd luma, val[1]: U, val[3]: V
+		uint8x16x4_t a = vld4q_u8(s0 + x * 2);
+		uint8x16x4_t b = vld4q_u8(s1 + x * 2);
+		uint8x16x2_t ya, yb;
+
+		ya.val[0] = a.val[0];
+		ya.val[1] = a.val[2];
+		yb.val[0] = b.val[0];
+		yb.val[1] = b.val[2];
+		vst2q_u8(y0 + x, ya);
+		vst2q_u8(y1 + x, yb);
+
+		vst1q_u8(u + x / 2, vrhaddq_u8(a.val[1], b.val[1]));
+		vst1q_u8(v + x / 2, vrhaddq_u8(a.val[3], b.val[3]));
+	}
+
+	row_pair_scalar_from(s0, s1, y0, y1, u, v, x, nWidth);
+}
+#endif
+
+static bool isa_supported(zzyuv_isa_t nIsa) {
+#ifdef ZZYUV_X86
+	__builtin_cpu_init();
+#endif
+	switch(nIsa) {
+	case ZZYUV_ISA_SCALAR:
+		return true;
+#ifdef ZZYUV_X86
+	case ZZYUV_ISA_SSE2:
+		return __builtin_cpu_supports("sse2");
+#endif
+#ifdef ZZYUV_NEON
+	case ZZYUV_ISA_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+static row_pair_fn isa_function(zzyuv_isa_t nIsa) {
+	switch(nIsa) {
+#ifdef ZZYUV_X86
+	case ZZYUV_ISA_SSE2:
+		return row_pair_sse2;
+#endif
+#ifdef ZZYUV_NEON
+	case ZZYUV_ISA_NEON:
+		return row_pair_neon;
+#endif
+	default:
+		return row_pair_scalar;
+	}
+}
+
+static zzyuv_isa_t best_isa() {
+	if(isa_supported(ZZYUV_ISA_NEON))
+		return ZZYUV_ISA_NEON;
+	if(isa_supported(ZZYUV_ISA_SSE2))
+		return ZZYUV_ISA_SSE2;
+	return ZZYUV_ISA_SCALAR;
+}
+
+static zzyuv_isa_t yuv_isa = best_isa();
+static row_pair_fn yuv_row_pair = isa_function(yuv_isa);
+
+void zzyuv_yuyv_to_i420(const uint8_t* pSrc, int nSrcStride,
+	uint8_t* pDstY, int nDstStrideY, uint8_t* pDstU, int nDstStrideU, uint8_t* pDstV, int nDstStrideV,
+	int nWidth, int nHeight) {
+	row_pair_fn row_pair = yuv_row_pair;
+
+	for(int y = 0;y < nHeight;y += 2) {
+		const uint8_t* s0 = pSrc + (intptr_t)y * nSrcStride;
+		// an odd last row is paired with itself, its luma is written twice to the same place
+		int y1 = (y + 1 < nHeight) ? y + 1 : y;
+		const uint8_t* s1 = pSrc + (intptr_t)y1 * nSrcStride;
+
+		row_pair(s0, s1, pDstY + (intptr_t)y * nDstStrideY, pDstY + (intptr_t)y1 * nDstStrideY,
+			pDstU + (intptr_t)(y / 2) * nDstStrideU, pDstV + (intptr_t)(y / 2) * nDstStrideV, nWidth);
+	}
+}
+
+int zzyuv_set_isa(zzyuv_isa_t nIsa) {
+	if(nIsa < 0 || nIsa >= ZZYUV_ISA_COUNT || ! isa_supported(nIsa))
+		return -1;
+
+	yuv_isa = nIsa;
+	yuv_row_pair = isa_function(nIsa);
+	return 0;
+}
+
+zzyuv_isa_t zzyuv_get_isa() {
+	return yuv_isa;
+}
+
+const char* zzyuv_isa_name(zzyuv_isa_t nIsa) {
+	switch(nIsa) {
+	case ZZYUV_ISA_SCALAR:
+		return "scalar";
+	case ZZYUV_ISA_SSE2:
+		return "sse2";
+	case ZZYUV_ISA_NEON:
+		return "neon";
+	default:
+		return "unknown";
+	}
+}
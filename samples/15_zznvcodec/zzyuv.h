@@ -0,0 +1,24 @@
+#ifndef __ZZYUV_H__
+#define __ZZYUV_H__
+
+#include <stdint.h>
+
+enum zzyuv_isa_t {
+	ZZYUV_ISA_SCALAR,
+	ZZYUV_ISA_SSE2,		// 16 pixels per step, x86/x86_64
+	ZZYUV_ISA_NEON,		// 32 pixels per step, ARMv7 NEON/AArch64
+	ZZYUV_ISA_COUNT,
+};
+
+// Packed YUYV 4:2:2 to planar I420, the chroma of each row pair is averaged.
+// An odd last row takes its chroma from itself.
+void zzyuv_yuyv_to_i420(const uint8_t* pSrc, int nSrcStride,
+	uint8_t* pDstY, int nDstStrideY, uint8_t* pDstU, int nDstStrideU, uint8_t* pDstV, int nDstStrideV,
+	int nWidth, int nHeight);
+
+// The fastest supported ISA is used by default, forcing one is meant for benchmarks.
+int zzyuv_set_isa(zzyuv_isa_t nIsa);
+zzyuv_isa_t zzyuv_get_isa();
+const char* zzyuv_isa_name(zzyuv_isa_t nIsa);
+
+#endif // __ZZYUV_H__
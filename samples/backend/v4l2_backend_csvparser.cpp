@@ -63,6 +63,8 @@ print_help(void)
             "\t--s                  Give a statistic of each channel\n"
             "\t--input-nalu         Input to the decoder will be nal units[Default]\n"
             "\t--input-chunks       Input to the decoder will be a chunk of bytes\n\n"
+            "\t--dq-workers <num>   Run the converter DQ callbacks of all channels on <num> shared threads\n"
+            "\t                     [Default = 0, one thread per plane]\n\n"
 #ifdef ENABLE_TRT
             "\t--trt-deployfile     set deploy file name\n"
             "\t--trt-modelfile      set model file name\n"
@@ -176,6 +178,13 @@ parse_csv_args(context_t * ctx,
             print_help();
             exit(EXIT_SUCCESS);
         }
+        else if (!strcmp(arg, "--dq-workers"))
+        {
+            argp++;
+            /* This parameter has been parsed in global_cfg,
+               but need to skip if found here */
+            continue;
+        }
 #ifdef ENABLE_TRT
         else if (!strcmp(arg, "--trt-deployfile"))
         {
@@ -276,11 +285,19 @@ parse_global(global_cfg* cfg, int argc, char ***argv)
 
     *argv = argp;
 
-#ifdef ENABLE_TRT
-    // seek for TRT deploy & caffemodel
+    // seek for options shared by all channels
     while ((arg = *(++argp)))
     {
-        if (!strcmp(arg, "--trt-deployfile"))
+        if (!strcmp(arg, "--dq-workers"))
+        {
+            argp++;
+            CHECK_OPTION_VALUE(argp);
+            cfg->dq_workers = atoi(*argp);
+            CSV_PARSE_CHECK_ERROR(cfg->dq_workers > 64,
+                    "DQ workers should be 0 to 64");
+        }
+#ifdef ENABLE_TRT
+        else if (!strcmp(arg, "--trt-deployfile"))
         {
             argp++;
             cfg->deployfile = *argp;
@@ -290,8 +307,8 @@ parse_global(global_cfg* cfg, int argc, char ***argv)
             argp++;
             cfg->modelfile = *argp;
         }
-    }
 #endif
+    }
     return;
 
 error:
@@ -27,6 +27,7 @@
  */
 
 #include "NvUtils.h"
+#include "NvBitstreamSource.h"
 #include <errno.h>
 #include <fstream>
 #include <iostream>
@@ -70,23 +71,17 @@ const char *GOOGLE_NET_DEPLOY_NAME =
 const char *GOOGLE_NET_MODEL_NAME =
         "../../data/Model/GoogleNet_one_class/GoogleNet_modified_oneClass_halfHD.caffemodel";
 
-#define IS_NAL_UNIT_START(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        !buffer_ptr[2] && (buffer_ptr[3] == 1))
-
-#define IS_NAL_UNIT_START1(buffer_ptr) (!buffer_ptr[0] && !buffer_ptr[1] && \
-        (buffer_ptr[2] == 1))
-
 using namespace std;
 
 #ifdef ENABLE_TRT
 #define OSD_BUF_NUM 100
 static int frame_num = 1;  //this is used to filter image feeding to TRT
 
+#define TRT_RING_SIZE 128
+
 //following struture is used to conmmunicate between TRT thread and
-//V4l2 capture thread
-queue<Shared_Buffer> TRT_Buffer_Queue;
-pthread_mutex_t      TRT_lock; // for dec and conv
-pthread_cond_t       TRT_cond;
+//V4l2 capture thread, every conv1 capture DQ thread is a producer
+NvMpmcRing<Shared_Buffer, TRT_RING_SIZE> TRT_Buffer_Queue;
 int                  TRT_Stop = 0;
 pthread_t            TRT_Thread_handle;
 
@@ -103,6 +98,7 @@ jpeg_enc_context_t g_jpeg_enc_context;
 
 static uint64_t ts[CHANNEL_NUM];
 static uint64_t time_scale[CHANNEL_NUM];
+static NvDQWorkerPool *dq_pool; // Shared by the converters of all channels, if set
 
 static int
 init_jpeg_context()
@@ -135,88 +131,40 @@ destroy_jpeg_context()
 }
 
 static int
-read_decoder_input_nalu(ifstream * stream, NvBuffer * buffer,
-        char *parse_buffer, streamsize parse_buffer_size)
+read_decoder_input_nalu(NvBitstreamSource * source, NvBuffer * buffer)
 {
-    // Length is the size of the buffer in bytes
-    char *buffer_ptr = (char *) buffer->planes[0].data;
-
-    char *stream_ptr;
-    bool nalu_found = false;
-
-    streamsize bytes_read;
-    streamsize stream_initial_pos = stream->tellg();
-
-    stream->read(parse_buffer, parse_buffer_size);
-    bytes_read = stream->gcount();
+    NvNalUnit nalu;
+    const uint8_t *data = source->nextNalu(NV_NAL_CODEC_H264, &nalu);
 
-    if (bytes_read == 0)
+    if (!data)
     {
         return buffer->planes[0].bytesused = 0;
     }
 
-    // Find the first NAL unit in the buffer
-    stream_ptr = parse_buffer;
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
+    if (nalu.size > buffer->planes[0].length)
     {
-        nalu_found = IS_NAL_UNIT_START(stream_ptr) ||
-                        IS_NAL_UNIT_START1(stream_ptr);
-        if (nalu_found)
-        {
-            break;
-        }
-        stream_ptr++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    if (!nalu_found)
-    {
-        cerr << "Could not read nal unit from file. EOF or file corrupted"
+        cerr << "NAL unit of " << nalu.size << " bytes does not fit the buffer"
             << endl;
+        buffer->planes[0].bytesused = 0;
         return -1;
     }
 
-    memcpy(buffer_ptr, stream_ptr, 4);
-    buffer_ptr += 4;
-    buffer->planes[0].bytesused = 4;
-    stream_ptr += 4;
-
-    // Copy bytes till the next NAL unit is found
-    while ((stream_ptr - parse_buffer) < (bytes_read - 3))
-    {
-        if (IS_NAL_UNIT_START(stream_ptr) || IS_NAL_UNIT_START1(stream_ptr))
-        {
-            streamsize seekto = stream_initial_pos +
-                    (stream_ptr - parse_buffer);
-            if (stream->eof())
-            {
-                stream->clear();
-            }
-            stream->seekg(seekto, stream->beg);
-            return 0;
-        }
-        *buffer_ptr = *stream_ptr;
-        buffer_ptr++;
-        stream_ptr++;
-        buffer->planes[0].bytesused++;
-    }
-
-    // Reached end of buffer but could not find NAL unit
-    cerr << "Could not read nal unit from file. EOF or file corrupted"
-            << endl;
-    return -1;
+    // The only copy of the NAL unit, straight from the mapped file
+    memcpy(buffer->planes[0].data, data, nalu.size);
+    buffer->planes[0].bytesused = nalu.size;
+    return 0;
 }
 
 static int
-read_decoder_input_chunk(ifstream * stream, NvBuffer * buffer)
+read_decoder_input_chunk(NvBitstreamSource * source, NvBuffer * buffer)
 {
     //length is the size of the buffer in bytes
-    streamsize bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
+    size_t bytes_to_read = MIN(CHUNK_SIZE, buffer->planes[0].length);
 
-    stream->read((char *) buffer->planes[0].data, bytes_to_read);
     // It is necessary to set bytesused properly, so that decoder knows how
     // many bytes in the buffer are valid
-    buffer->planes[0].bytesused = stream->gcount();
+    buffer->planes[0].bytesused = source->read(buffer->planes[0].data,
+            bytes_to_read);
     return 0;
 }
 
@@ -388,21 +336,10 @@ static void *render_thread(void* arg)
 #endif
     while (1)
     {
-        // waiting for buffer to come
-        pthread_mutex_lock(&ctx->render_lock);
-        while (ctx->render_buf_queue->empty())
-        {
-            pthread_cond_wait(&ctx->render_cond, &ctx->render_lock);
-        }
-        //pop up buffer from queue to process
-        trt_buffer = ctx->render_buf_queue->front();
-        ctx->render_buf_queue->pop();
+        // waiting for buffer to come, then pop it up to process
+        ctx->render_buf_queue->pop(trt_buffer);
         if(trt_buffer.buffer == NULL)
-        {
-            pthread_mutex_unlock(&ctx->render_lock);
             break;
-        }
-        pthread_mutex_unlock(&ctx->render_lock);
 
         struct v4l2_buffer *v4l2_buf = &trt_buffer.v4l2_buf;
         NvBuffer *buffer             = trt_buffer.buffer;
@@ -431,10 +368,8 @@ static void *render_thread(void* arg)
             if (trt_buffer.bProcess  == 1)
             {
                 sem_wait(&ctx->result_ready_sem);
-                pthread_mutex_lock(&ctx->osd_lock);
-                if (ctx->osd_queue->size() != 0)
+                if (ctx->osd_queue->try_pop(bbox))
                 {
-                    bbox = ctx->osd_queue->front();
                     if (bbox != NULL)
                     {
                         temp_bbox.g_rect_num = bbox->g_rect_num;
@@ -444,9 +379,7 @@ static void *render_thread(void* arg)
                         delete bbox;
                         bbox = NULL;
                     }
-                    ctx->osd_queue->pop();
                 }
-                pthread_mutex_unlock(&ctx->osd_lock);
             }
 
             if (temp_bbox.g_rect_num != 0)
@@ -495,10 +428,7 @@ conv_capture_dqbuf_thread_callback(struct v4l2_buffer *v4l2_buf,
     {
         // Use buffer = NULL to indicate EOS
         batch_buffer.buffer = NULL;
-        pthread_mutex_lock(&ctx->render_lock);
         ctx->render_buf_queue->push(batch_buffer);
-        pthread_cond_broadcast(&ctx->render_cond);
-        pthread_mutex_unlock(&ctx->render_lock);
         return false;
     }
 
@@ -545,10 +475,7 @@ conv_capture_dqbuf_thread_callback(struct v4l2_buffer *v4l2_buf,
     batch_buffer.buffer = buffer;
     batch_buffer.shared_buffer = shared_buffer;
     batch_buffer.arg = arg;
-    pthread_mutex_lock(&ctx->render_lock);
     ctx->render_buf_queue->push(batch_buffer);
-    pthread_cond_broadcast(&ctx->render_cond);
-    pthread_mutex_unlock(&ctx->render_lock);
 
     return true;
 }
@@ -572,21 +499,11 @@ void *trt_thread(void *data)
     {
         // wait for buffer for process to come
         Shared_Buffer trt_buffer;
-        pthread_mutex_lock(&TRT_lock);
-        while (TRT_Buffer_Queue.empty())
+        TRT_Buffer_Queue.pop(trt_buffer);
+        if( trt_buffer.buffer == NULL)
         {
-            pthread_cond_wait(&TRT_cond, &TRT_lock);
+            process_last_batch = 1;
         }
-        if (TRT_Buffer_Queue.size() != 0)
-        {
-            trt_buffer = TRT_Buffer_Queue.front();
-            TRT_Buffer_Queue.pop();
-            if( trt_buffer.buffer == NULL)
-            {
-                process_last_batch = 1;
-            }
-        }
-        pthread_mutex_unlock(&TRT_lock);
         // we still have buffer, so accumulate buffer into batch
         if (process_last_batch == 0)
         {
@@ -712,9 +629,7 @@ void *trt_thread(void *data)
                 }
             }
             bbox->g_rect_num = rectNum;
-            pthread_mutex_lock(&ctx->osd_lock);
             ctx->osd_queue->push(bbox);
-            pthread_mutex_unlock(&ctx->osd_lock);
             //TRT has prepared result, notify here
             sem_post(&ctx->result_ready_sem);
         }
@@ -749,10 +664,7 @@ conv1_capture_dqbuf_thread_callback(struct v4l2_buffer *v4l2_buf,
     {
         // NULL indicate EOS
         trt_buffer.buffer = NULL;
-        pthread_mutex_lock(&TRT_lock);
         TRT_Buffer_Queue.push(trt_buffer);
-        pthread_cond_broadcast(&TRT_cond);
-        pthread_mutex_unlock(&TRT_lock);
         return false;
     }
 
@@ -764,10 +676,7 @@ conv1_capture_dqbuf_thread_callback(struct v4l2_buffer *v4l2_buf,
     trt_buffer.buffer = buffer;
     trt_buffer.shared_buffer = shared_buffer;
     trt_buffer.arg = arg;
-    pthread_mutex_lock(&TRT_lock);
     TRT_Buffer_Queue.push(trt_buffer);
-    pthread_cond_broadcast(&TRT_cond);
-    pthread_mutex_unlock(&TRT_lock);
 
     return true;
 }
@@ -1306,14 +1215,8 @@ dec_feed_loop_fcn(void *arg)
     int i = 0;
     bool eos = false;
     int ret;
-    char *nalu_parse_buffer = NULL;
     nal_type_e nal_type;
 
-    if (ctx->input_nalu)
-    {
-        nalu_parse_buffer = new char[CHUNK_SIZE];
-    }
-
     // Read encoded data and enqueue all the output plane buffers.
     // Exit loop in case file read is complete.
     while (!eos && !ctx->got_error && !ctx->dec->isInError() &&
@@ -1329,8 +1232,7 @@ dec_feed_loop_fcn(void *arg)
         buffer = ctx->dec->output_plane.getNthBuffer(i);
         if (ctx->input_nalu)
         {
-            read_decoder_input_nalu(ctx->in_file, buffer,
-                    nalu_parse_buffer, CHUNK_SIZE);
+            read_decoder_input_nalu(ctx->in_file, buffer);
             wait_for_nextFrame(ctx);
             if (ctx->cpu_occupation_option == PARSER)
             {
@@ -1422,8 +1324,7 @@ dec_feed_loop_fcn(void *arg)
 
         if (ctx->input_nalu)
         {
-            read_decoder_input_nalu(ctx->in_file, buffer,
-                                    nalu_parse_buffer, CHUNK_SIZE);
+            read_decoder_input_nalu(ctx->in_file, buffer);
             wait_for_nextFrame(ctx);
         }
         else
@@ -1495,11 +1396,6 @@ dec_feed_loop_fcn(void *arg)
         }
     }
 
-    if (ctx->input_nalu)
-    {
-        delete []nalu_parse_buffer;
-    }
-
     ctx->got_eos = true;
     return NULL;
 }
@@ -1525,10 +1421,9 @@ set_defaults(context_t * ctx)
     {
         ctx->conv1_output_plane_buf_queue = new queue < NvBuffer * >;
     }
-    pthread_mutex_init(&ctx->osd_lock, NULL);
-    ctx->osd_queue = new queue <frame_bbox*>;
+    ctx->osd_queue = new NvSpscRing<frame_bbox*, OSD_RING_SIZE>;
 #endif
-    ctx->render_buf_queue = new queue <Shared_Buffer>;
+    ctx->render_buf_queue = new NvSpscRing<Shared_Buffer, RENDER_RING_SIZE>;
     ctx->stop_render = 0;
     ctx->frame_info_map = new map< uint64_t, frame_info_t* >;
     ctx->nvosd_context = NULL;
@@ -1537,6 +1432,7 @@ set_defaults(context_t * ctx)
 static void
 set_globalcfg_default(global_cfg *cfg)
 {
+    cfg->dq_workers = 0;
 #ifdef ENABLE_TRT
     cfg->deployfile = GOOGLE_NET_DEPLOY_NAME;
     cfg->modelfile = GOOGLE_NET_MODEL_NAME;
@@ -1646,6 +1542,16 @@ main(int argc, char *argv[])
     get_disp_resolution(&disp_info);
     init_decode_ts();
 
+    if (cfg.dq_workers)
+    {
+        dq_pool = NvDQWorkerPool::createDQWorkerPool("DQPool", cfg.dq_workers);
+        if (!dq_pool)
+        {
+            cerr << "Could not create DQ worker pool" << endl;
+            return -1;
+        }
+    }
+
     if (0)
         init_jpeg_context();
 
@@ -1725,8 +1631,9 @@ main(int argc, char *argv[])
                 V4L2_MEMORY_MMAP, 10, true, false);
         TEST_ERROR(ret < 0, "Error while setting up output plane", cleanup);
 
-        ctx[iterator].in_file = new ifstream(ctx[iterator].in_file_path);
-        TEST_ERROR(!ctx[iterator].in_file->is_open(),
+        ctx[iterator].in_file = NvBitstreamSource::createBitstreamSource(
+                ctx[iterator].in_file_path);
+        TEST_ERROR(!ctx[iterator].in_file,
                 "Error opening input file", cleanup);
 
         if (ctx[iterator].out_file_path)
@@ -1755,6 +1662,8 @@ main(int argc, char *argv[])
             setDQThreadCallback(conv_output_dqbuf_thread_callback);
         ctx[iterator].conv->capture_plane.
             setDQThreadCallback(conv_capture_dqbuf_thread_callback);
+        if (dq_pool)
+            ctx[iterator].conv->setDQWorkerPool(dq_pool);
 #ifdef ENABLE_TRT
         if (iterator < g_trt_context.getNumTrtInstances())
         {
@@ -1768,6 +1677,8 @@ main(int argc, char *argv[])
                 setDQThreadCallback(conv1_output_dqbuf_thread_callback);
             ctx[iterator].conv1->capture_plane.
                 setDQThreadCallback(conv1_capture_dqbuf_thread_callback);
+            if (dq_pool)
+                ctx[iterator].conv1->setDQWorkerPool(dq_pool);
         }
 #endif
         ret = ctx[iterator].dec->output_plane.setStreamStatus(true);
@@ -1834,7 +1745,6 @@ cleanup:
 
         //send stop command to render, and wait it get consumed
         ctx[iterator].stop_render = 1;
-        pthread_cond_broadcast(&ctx[iterator].render_cond);
         pthread_join(ctx[iterator].render_feed_handle, NULL);
 
 #ifdef ENABLE_TRT
@@ -1849,7 +1759,6 @@ cleanup:
         if (TRT_Stop == 0)
         {
             TRT_Stop = 1;
-            pthread_cond_broadcast(&TRT_cond);
             pthread_join(TRT_Thread_handle, NULL);
         }
 #endif
@@ -1885,7 +1794,6 @@ cleanup:
         sem_destroy(&(ctx[iterator].dec_run_sem));
 #ifdef ENABLE_TRT
         sem_destroy(&(ctx[iterator].result_ready_sem));
-        pthread_mutex_destroy(&ctx[iterator].osd_lock);
 #endif
         // The decoder destructor does all the cleanup i.e set streamoff on output and capture planes,
         // unmap buffers, tell decoder to deallocate buffer (reqbufs ioctl with counnt = 0),
@@ -1932,6 +1840,7 @@ cleanup:
             cout << "App run was successful" << endl;
         }
     }
+    delete dq_pool;
 #ifdef ENABLE_TRT
 #if USE_CPU_FOR_INTFLOAT_CONVERSION
     g_trt_context.destroyTrtContext(true);
@@ -32,6 +32,7 @@
 #include "NvVideoConverter.h"
 #include "NvEglRenderer.h"
 #include "NvJpegEncoder.h"
+#include "NvBitstreamSource.h"
 #include <queue>
 #include <utility>
 #include <map>
@@ -39,11 +40,18 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include "nvosd.h"
+#include "NvRingBuffer.h"
+#include "NvDQWorkerPool.h"
 
 using namespace std;
 
 #define JPEG_ENC_BUF_SIZE 5*1024*1024
 
+// Ring capacities, powers of two and larger than the number of converter
+// capture buffers so the DQ threads never wait on a full ring.
+#define RENDER_RING_SIZE 64
+#define OSD_RING_SIZE 64
+
 enum slice_type_e
 {
     SLICE_TYPE_P = 0,
@@ -143,7 +151,7 @@ typedef struct
     EGLImageKHR egl_image;
 
     char *in_file_path;
-    std::ifstream *in_file;
+    NvBitstreamSource *in_file;
 
     char *out_file_path;
     std::ofstream *out_file;
@@ -184,18 +192,14 @@ typedef struct
 
     uint32_t *parray;
     uint32_t rect_count;
-    pthread_mutex_t osd_lock;
-    std::queue<frame_bbox*> *osd_queue;
+    NvSpscRing<frame_bbox*, OSD_RING_SIZE> *osd_queue; // TRT thread -> render
 #endif
     pthread_t dec_capture_loop;
     pthread_t dec_feed_handle;
     pthread_t render_feed_handle;
-    std::queue<Shared_Buffer> *render_buf_queue;
+    NvSpscRing<Shared_Buffer, RENDER_RING_SIZE> *render_buf_queue; // conv -> render
     int stop_render;
 
-    pthread_mutex_t render_lock; // for dec and conv
-    pthread_cond_t render_cond;
-
     //VIC need wait until dec get run
     sem_t dec_run_sem;
     bool got_error;
@@ -218,6 +222,7 @@ typedef struct
 {
     int dump_jpeg;
     uint32_t channel_num;
+    uint32_t dq_workers; // Converter DQ worker pool size, 0 for a thread per plane
     char *in_file_path[CHANNEL_NUM];
 #ifdef ENABLE_TRT
     string deployfile;
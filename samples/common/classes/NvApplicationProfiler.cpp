@@ -27,16 +27,27 @@
  */
 
 #include "NvApplicationProfiler.h"
+#include "NvElement.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <fstream>
+#include <iomanip>
+#include <math.h>
 #include <sstream>
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define GOVERNOR_SYS_FILE "/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor"
 #define CPU_FREQ_FILE "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq"
 #define REQUIRED_GOVERNOR "performance"
+#define UNIX_SOCKET_PREFIX "unix:"
 
 #define TIMESPEC_DIFF_USEC(timespec1, timespec2) \
     (timespec1.tv_sec - timespec2.tv_sec) * 1000000.0 + \
@@ -44,10 +55,200 @@
 
 using namespace std;
 
+/**
+ * CPU time of a thread, read from /proc/self/task.
+ */
+struct ThreadStat
+{
+    int tid;
+    string name;
+    uint64_t ticks;
+    float cpu_usage;
+};
+
+/**
+ * Values of a registered element in a snapshot.
+ */
+struct ElementStat
+{
+    string name;
+    string stream;
+    NvElementProfiler::NvElementProfilerData data;
+    uint64_t latency_samples;
+    float window_fps;
+    uint64_t window_samples;
+    uint64_t window_latency_usec[4];
+};
+
+static const double percentiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *percentile_names[4] = { "p50", "p90", "p99", "p999" };
+static const char *quantile_labels[4] = { "0.5", "0.9", "0.99", "0.999" };
+
+static uint64_t
+monotonic_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool
+read_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t len;
+
+    if (fd < 0)
+        return false;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+    buf[len] = '\0';
+    return true;
+}
+
+static void
+read_threads(vector<ThreadStat> &threads)
+{
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+
+    threads.clear();
+    if (!dir)
+        return;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[64];
+        char buf[512];
+        unsigned long utime, stime;
+        ThreadStat thread;
+
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        if (!read_file(path, buf, sizeof(buf)))
+            continue;
+
+        // The name may contain spaces and parentheses, it ends at the last ')'
+        char *name_start = strchr(buf, '(');
+        char *name_end = strrchr(buf, ')');
+        if (!name_start || !name_end || name_end < name_start)
+            continue;
+        if (sscanf(name_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &utime, &stime) != 2)
+            continue;
+
+        thread.tid = atoi(entry->d_name);
+        thread.name.assign(name_start + 1, name_end - name_start - 1);
+        thread.ticks = utime + stime;
+        thread.cpu_usage = 0;
+        threads.push_back(thread);
+    }
+    closedir(dir);
+}
+
+static uint64_t
+histogram_percentile(const vector<uint64_t> &counts,
+        const vector<uint64_t> &bounds, uint64_t total, double fraction)
+{
+    uint64_t rank = (uint64_t) ceil(total * fraction);
+    uint64_t seen = 0;
+
+    if (total == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    for (uint32_t i = 0; i < counts.size(); i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return bounds[i];
+    }
+    return bounds.back();
+}
+
+static string
+json_escape(const string &str)
+{
+    string escaped;
+
+    for (uint32_t i = 0; i < str.size(); i++)
+    {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (c < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static string
+prometheus_escape(const string &str)
+{
+    string escaped;
+
+    for (uint32_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] == '"' || str[i] == '\\')
+        {
+            escaped += '\\';
+            escaped += str[i];
+        }
+        else if (str[i] == '\n')
+        {
+            escaped += "\\n";
+        }
+        else
+        {
+            escaped += str[i];
+        }
+    }
+    return escaped;
+}
+
+static int
+write_all(int fd, const string &str, bool is_socket)
+{
+    size_t written = 0;
+
+    while (written < str.size())
+    {
+        ssize_t ret;
+
+        if (is_socket)
+            ret = send(fd, str.data() + written, str.size() - written,
+                    MSG_NOSIGNAL | MSG_DONTWAIT);
+        else
+            ret = write(fd, str.data() + written, str.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        written += ret;
+    }
+    return 0;
+}
+
 NvApplicationProfiler::NvApplicationProfiler()
 {
-    char governor[64];
-    uint64_t cpu_freq_khz;
+    char governor[64] = "";
+    uint64_t cpu_freq_khz = 0;
 
     memset(&data, 0, sizeof(data));
 
@@ -59,21 +260,27 @@ NvApplicationProfiler::NvApplicationProfiler()
 
     profiling_thread = 0;
     pthread_mutex_init(&thread_lock, NULL);
-    check_cpu_usage = true;
 
     ifstream cpu_governor_file(GOVERNOR_SYS_FILE, std::ifstream::in);
-    cpu_governor_file >> governor;
-    if (strcmp(governor, REQUIRED_GOVERNOR))
-    {
-        cerr << "Set governor to " REQUIRED_GOVERNOR " before enabling profiler"
-            << endl;
-        check_cpu_usage = false;
-    }
+    cpu_governor_file >> setw(sizeof(governor)) >> governor;
+    fixed_cpu_freq = !strcmp(governor, REQUIRED_GOVERNOR);
     num_cpu_cores = sysconf(_SC_NPROCESSORS_ONLN);
 
     ifstream cpu_freq_file(CPU_FREQ_FILE, std::ifstream::in);
     cpu_freq_file >> cpu_freq_khz;
     cpu_freq = cpu_freq_khz / 1000;
+
+    clock_ticks = sysconf(_SC_CLK_TCK);
+    page_size = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_init(&metrics_lock, NULL);
+    metrics_format = METRICS_FORMAT_JSON_LINES;
+    metrics_interval_nsec = 0;
+    next_metrics_nsec = 0;
+    metrics_fd = -1;
+    metrics_error = false;
+    last_metrics_nsec = monotonic_nsec();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &last_metrics_proc_cpu);
 }
 
 NvApplicationProfiler&
@@ -95,12 +302,10 @@ NvApplicationProfiler::start(uint32_t sampling_interval_ms)
         return;
     }
 
-    if (!check_cpu_usage)
+    if (!fixed_cpu_freq)
     {
-        cerr << "Set governor to " REQUIRED_GOVERNOR " before enabling profiler"
-            << endl;
-        pthread_mutex_unlock(&thread_lock);
-        return;
+        cerr << "CPU governor is not " REQUIRED_GOVERNOR
+            ", CPU usage depends on the varying CPU frequency" << endl;
     }
 
     running = true;
@@ -110,11 +315,8 @@ NvApplicationProfiler::start(uint32_t sampling_interval_ms)
 
     gettimeofday(&data.start_time, NULL);
 
-    if (check_cpu_usage)
-    {
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &data.start_proc_cpu_clock_time);
-        clock_gettime(CLOCK_MONOTONIC, &data.start_cpu_clock_time);
-    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &data.start_proc_cpu_clock_time);
+    clock_gettime(CLOCK_MONOTONIC, &data.start_cpu_clock_time);
 
     pthread_create(&profiling_thread, NULL, ProfilerThread, this);
     pthread_setname_np(profiling_thread, "ProfilingThread");
@@ -125,47 +327,58 @@ NvApplicationProfiler::start(uint32_t sampling_interval_ms)
 void
 NvApplicationProfiler::stop()
 {
+    pthread_mutex_lock(&thread_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&thread_lock);
+        return;
+    }
     running = false;
+    pthread_mutex_unlock(&thread_lock);
+
     pthread_join(profiling_thread, NULL);
 
     pthread_mutex_lock(&thread_lock);
     gettimeofday(&data.stop_time, NULL);
     pthread_mutex_unlock(&thread_lock);
+
+    pthread_mutex_lock(&metrics_lock);
+    bool exporting = !metrics_destination.empty();
+    pthread_mutex_unlock(&metrics_lock);
+    if (exporting)
+        exportMetrics();
 }
 
 void
 NvApplicationProfiler::profile()
 {
-    if (check_cpu_usage)
-    {
-        struct timespec cur_proc_cpu_clock_time;
-        struct timespec cur_cpu_clock_time;
+    struct timespec cur_proc_cpu_clock_time;
+    struct timespec cur_cpu_clock_time;
 
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cur_proc_cpu_clock_time);
-        clock_gettime(CLOCK_MONOTONIC, &cur_cpu_clock_time);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cur_proc_cpu_clock_time);
+    clock_gettime(CLOCK_MONOTONIC, &cur_cpu_clock_time);
 
-        if (data.num_readings)
-        {
-            float proc_cpu_time = TIMESPEC_DIFF_USEC(cur_proc_cpu_clock_time,
-                    data.stop_proc_cpu_clock_time);
+    if (data.num_readings)
+    {
+        float proc_cpu_time = TIMESPEC_DIFF_USEC(cur_proc_cpu_clock_time,
+                data.stop_proc_cpu_clock_time);
 
-            float total_cpu_time = TIMESPEC_DIFF_USEC(cur_cpu_clock_time,
-                    data.stop_cpu_clock_time);
+        float total_cpu_time = TIMESPEC_DIFF_USEC(cur_cpu_clock_time,
+                data.stop_cpu_clock_time);
 
-            float cpu_usage = proc_cpu_time * 100 / total_cpu_time;
-            if (cpu_usage < data.min_cpu_usage && cpu_usage > 0)
-            {
-                data.min_cpu_usage = cpu_usage;
-            }
-            if (cpu_usage > data.max_cpu_usage)
-            {
-                data.max_cpu_usage = cpu_usage;
-            }
+        float cpu_usage = proc_cpu_time * 100 / total_cpu_time;
+        if (cpu_usage < data.min_cpu_usage && cpu_usage > 0)
+        {
+            data.min_cpu_usage = cpu_usage;
+        }
+        if (cpu_usage > data.max_cpu_usage)
+        {
+            data.max_cpu_usage = cpu_usage;
         }
-
-        data.stop_proc_cpu_clock_time = cur_proc_cpu_clock_time;
-        data.stop_cpu_clock_time = cur_cpu_clock_time;
     }
+
+    data.stop_proc_cpu_clock_time = cur_proc_cpu_clock_time;
+    data.stop_cpu_clock_time = cur_cpu_clock_time;
     data.num_readings++;
 }
 
@@ -190,6 +403,11 @@ NvApplicationProfiler::ProfilerThread(void * data)
                 &next_profile_time);
         profiler->profile();
 
+        // Writing a snapshot may block on I/O, getProfilerData() should not
+        pthread_mutex_unlock(&profiler->thread_lock);
+        profiler->exportMetricsIfDue(monotonic_nsec());
+        pthread_mutex_lock(&profiler->thread_lock);
+
         next_profile_time.tv_sec += profiler->sampling_interval / 1000;
         next_profile_time.tv_nsec += (profiler->sampling_interval % 1000) * 1000000L;
         next_profile_time.tv_sec += next_profile_time.tv_nsec / 1000000000L;
@@ -198,6 +416,7 @@ NvApplicationProfiler::ProfilerThread(void * data)
     }
     pthread_mutex_unlock(&profiler->thread_lock);
 
+    pthread_cond_destroy(&sleep_cond);
     return NULL;
 }
 
@@ -208,29 +427,27 @@ NvApplicationProfiler::getProfilerData(NvAppProfilerData &pdata)
 
     memset (&pdata, 0, sizeof(pdata));
 
-    if (check_cpu_usage)
-    {
-        float proc_cpu_time = TIMESPEC_DIFF_USEC(data.stop_proc_cpu_clock_time,
-                data.start_proc_cpu_clock_time);
+    float proc_cpu_time = TIMESPEC_DIFF_USEC(data.stop_proc_cpu_clock_time,
+            data.start_proc_cpu_clock_time);
 
-        float total_cpu_time = TIMESPEC_DIFF_USEC(data.stop_cpu_clock_time,
-                data.start_cpu_clock_time);
+    float total_cpu_time = TIMESPEC_DIFF_USEC(data.stop_cpu_clock_time,
+            data.start_cpu_clock_time);
 
-        pdata.peak_cpu_usage = data.max_cpu_usage / num_cpu_cores;
+    pdata.peak_cpu_usage = data.max_cpu_usage / num_cpu_cores;
+    if (total_cpu_time > 0)
         pdata.avg_cpu_usage = proc_cpu_time * 100 / total_cpu_time / num_cpu_cores;
 
-        pdata.total_time.tv_sec = data.stop_time.tv_sec - data.start_time.tv_sec;
-        pdata.total_time.tv_usec = data.stop_time.tv_usec - data.start_time.tv_usec;
-        if (pdata.total_time.tv_usec < 0)
-        {
-            pdata.total_time.tv_sec--;
-            pdata.total_time.tv_usec += 1000000;
-        }
-
-        pdata.num_cpu_cores = num_cpu_cores;
-        pdata.cpu_freq_mhz = cpu_freq;
+    pdata.total_time.tv_sec = data.stop_time.tv_sec - data.start_time.tv_sec;
+    pdata.total_time.tv_usec = data.stop_time.tv_usec - data.start_time.tv_usec;
+    if (pdata.total_time.tv_usec < 0)
+    {
+        pdata.total_time.tv_sec--;
+        pdata.total_time.tv_usec += 1000000;
     }
 
+    pdata.num_cpu_cores = num_cpu_cores;
+    pdata.cpu_freq_mhz = cpu_freq;
+
     pthread_mutex_unlock(&thread_lock);
 }
 void
@@ -242,13 +459,473 @@ NvApplicationProfiler::printProfilerData(std::ostream &outstream)
     outstream << "Total Profiling Time = " <<
         (data.total_time.tv_sec + 0.000001 * data.total_time.tv_usec) <<
         " sec" << endl;
-    if (check_cpu_usage)
+    outstream << "Peak CPU Usage = " << data.peak_cpu_usage << "%" << endl;
+    outstream << "Avg CPU Usage = " << data.avg_cpu_usage << "%" << endl;
+    outstream << "Num. of Cores = " << data.num_cpu_cores << endl;
+    outstream << "CPU frequency = " << data.cpu_freq_mhz << "MHz" <<
+        (fixed_cpu_freq ? "" : " (not fixed)") << endl;
+    outstream << "************************************" << endl;
+}
+
+int
+NvApplicationProfiler::registerElement(NvElement *element, const char *stream)
+{
+    MetricsElement entry;
+
+    pthread_mutex_lock(&metrics_lock);
+    for (uint32_t i = 0; i < metrics_elements.size(); i++)
     {
-        outstream << "Peak CPU Usage = " << data.peak_cpu_usage << "%" << endl;
-        outstream << "Avg CPU Usage = " << data.avg_cpu_usage << "%" << endl;
-        outstream << "Num. of Cores = " << data.num_cpu_cores << endl;
-        outstream << "CPU frequency = " << data.cpu_freq_mhz << "MHz" << endl;
+        if (metrics_elements[i].element == element)
+        {
+            pthread_mutex_unlock(&metrics_lock);
+            cerr << "Element " << element->getName() <<
+                " is already registered" << endl;
+            return -1;
+        }
     }
-    outstream << "************************************" << endl;
+
+    if (!element->isProfilingEnabled())
+        element->enableProfiling();
+
+    if (histogram_bounds.empty())
+    {
+        histogram_bounds.resize(PROFILER_HISTOGRAM_BUCKETS);
+        entry.last_histogram.resize(PROFILER_HISTOGRAM_BUCKETS);
+        element->getLatencyHistogram(&entry.last_histogram[0],
+                &histogram_bounds[0], PROFILER_HISTOGRAM_BUCKETS);
+    }
+    else
+    {
+        entry.last_histogram.resize(PROFILER_HISTOGRAM_BUCKETS);
+        element->getLatencyHistogram(&entry.last_histogram[0], NULL,
+                PROFILER_HISTOGRAM_BUCKETS);
+    }
+
+    NvElementProfiler::NvElementProfilerData element_data;
+    element->getProfilingData(element_data);
+
+    entry.element = element;
+    entry.stream = stream ? stream : "";
+    entry.last_units = element_data.total_processed_units;
+    metrics_elements.push_back(entry);
+    pthread_mutex_unlock(&metrics_lock);
+    return 0;
+}
+
+void
+NvApplicationProfiler::unregisterElement(NvElement *element)
+{
+    pthread_mutex_lock(&metrics_lock);
+    for (uint32_t i = 0; i < metrics_elements.size(); i++)
+    {
+        if (metrics_elements[i].element == element)
+        {
+            metrics_elements.erase(metrics_elements.begin() + i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+int
+NvApplicationProfiler::setMetricsExport(const char *destination,
+        MetricsFormat format, uint32_t interval_ms)
+{
+    vector<ThreadStat> threads;
+    int fd = -1;
+
+    if (destination && destination[0] == '\0')
+        destination = NULL;
+    if (destination && strncmp(destination, UNIX_SOCKET_PREFIX,
+                strlen(UNIX_SOCKET_PREFIX)) == 0)
+    {
+        if (strlen(destination) - strlen(UNIX_SOCKET_PREFIX) >=
+                sizeof(((struct sockaddr_un *) NULL)->sun_path))
+        {
+            cerr << "Socket path too long: " << destination << endl;
+            return -1;
+        }
+    }
+    else if (destination && strcmp(destination, "-") &&
+            format == METRICS_FORMAT_JSON_LINES)
+    {
+        fd = open(destination, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            cerr << "Could not open " << destination << ": " <<
+                strerror(errno) << endl;
+            return -1;
+        }
+    }
+
+    read_threads(threads);
+
+    pthread_mutex_lock(&metrics_lock);
+    if (metrics_fd >= 0)
+        close(metrics_fd);
+    metrics_fd = fd;
+    metrics_error = false;
+    metrics_destination = destination ? destination : "";
+    metrics_format = format;
+    metrics_interval_nsec = interval_ms * 1000000ULL;
+    last_metrics_nsec = monotonic_nsec();
+    next_metrics_nsec = last_metrics_nsec + metrics_interval_nsec;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &last_metrics_proc_cpu);
+    last_thread_ticks.clear();
+    for (uint32_t i = 0; i < threads.size(); i++)
+        last_thread_ticks[threads[i].tid] = threads[i].ticks;
+    pthread_mutex_unlock(&metrics_lock);
+    return 0;
+}
+
+int
+NvApplicationProfiler::exportMetrics()
+{
+    ostringstream snapshot;
+    int ret;
+
+    pthread_mutex_lock(&metrics_lock);
+    if (metrics_destination.empty())
+    {
+        pthread_mutex_unlock(&metrics_lock);
+        return -1;
+    }
+    collectMetrics(snapshot, metrics_format);
+    ret = writeSnapshot(snapshot.str());
+    pthread_mutex_unlock(&metrics_lock);
+    return ret;
+}
+
+void
+NvApplicationProfiler::exportMetricsIfDue(uint64_t now_nsec)
+{
+    ostringstream snapshot;
+
+    pthread_mutex_lock(&metrics_lock);
+    if (metrics_destination.empty() || now_nsec < next_metrics_nsec)
+    {
+        pthread_mutex_unlock(&metrics_lock);
+        return;
+    }
+
+    next_metrics_nsec += metrics_interval_nsec;
+    if (next_metrics_nsec <= now_nsec)
+        next_metrics_nsec = now_nsec + metrics_interval_nsec;
+
+    collectMetrics(snapshot, metrics_format);
+    writeSnapshot(snapshot.str());
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+void
+NvApplicationProfiler::writeMetrics(std::ostream &outstream,
+        MetricsFormat format)
+{
+    ostringstream snapshot;
+
+    pthread_mutex_lock(&metrics_lock);
+    collectMetrics(snapshot, format);
+    pthread_mutex_unlock(&metrics_lock);
+    outstream << snapshot.str();
 }
 
+void
+NvApplicationProfiler::collectMetrics(std::ostream &out, MetricsFormat format)
+{
+    uint64_t now_nsec = monotonic_nsec();
+    struct timespec proc_cpu;
+    struct timeval wall_time;
+    double elapsed_sec;
+    float proc_cpu_usage;
+    uint64_t virtual_bytes = 0, resident_bytes = 0, peak_resident_bytes = 0;
+    vector<ThreadStat> threads;
+    vector<ElementStat> elements;
+    char buf[4096];
+
+    gettimeofday(&wall_time, NULL);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &proc_cpu);
+    elapsed_sec = (now_nsec - last_metrics_nsec) / 1e9;
+    if (elapsed_sec <= 0)
+        elapsed_sec = 1e-9;
+
+    // CPU usage is in percent of one core, like top
+    proc_cpu_usage = (TIMESPEC_DIFF_USEC(proc_cpu, last_metrics_proc_cpu)) /
+        1e6 / elapsed_sec * 100;
+
+    if (read_file("/proc/self/statm", buf, sizeof(buf)))
+    {
+        unsigned long long size, resident;
+
+        if (sscanf(buf, "%llu %llu", &size, &resident) == 2)
+        {
+            virtual_bytes = size * page_size;
+            resident_bytes = resident * page_size;
+        }
+    }
+    if (read_file("/proc/self/status", buf, sizeof(buf)))
+    {
+        const char *hwm = strstr(buf, "VmHWM:");
+        unsigned long long kbytes;
+
+        if (hwm && sscanf(hwm + strlen("VmHWM:"), "%llu", &kbytes) == 1)
+            peak_resident_bytes = kbytes * 1024;
+    }
+
+    read_threads(threads);
+    for (uint32_t i = 0; i < threads.size(); i++)
+    {
+        // A thread started since the previous snapshot used no CPU before it
+        uint64_t last_ticks = last_thread_ticks.count(threads[i].tid) ?
+            last_thread_ticks[threads[i].tid] : 0;
+
+        if (threads[i].ticks >= last_ticks && clock_ticks > 0)
+        {
+            threads[i].cpu_usage = (threads[i].ticks - last_ticks) /
+                (double) clock_ticks / elapsed_sec * 100;
+        }
+    }
+    last_thread_ticks.clear();
+    for (uint32_t i = 0; i < threads.size(); i++)
+        last_thread_ticks[threads[i].tid] = threads[i].ticks;
+
+    for (uint32_t i = 0; i < metrics_elements.size(); i++)
+    {
+        MetricsElement &entry = metrics_elements[i];
+        vector<uint64_t> histogram(PROFILER_HISTOGRAM_BUCKETS);
+        vector<uint64_t> window(PROFILER_HISTOGRAM_BUCKETS);
+        ElementStat stat;
+
+        entry.element->getProfilingData(stat.data);
+        entry.element->getLatencyHistogram(&histogram[0], NULL,
+                PROFILER_HISTOGRAM_BUCKETS);
+
+        stat.name = entry.element->getName();
+        stat.stream = entry.stream;
+        stat.latency_samples = 0;
+        stat.window_samples = 0;
+        for (uint32_t j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++)
+        {
+            stat.latency_samples += histogram[j];
+            // The histogram restarts when profiling is enabled again
+            window[j] = histogram[j] >= entry.last_histogram[j] ?
+                histogram[j] - entry.last_histogram[j] : histogram[j];
+            stat.window_samples += window[j];
+        }
+        for (uint32_t j = 0; j < 4; j++)
+        {
+            stat.window_latency_usec[j] = histogram_percentile(window,
+                    histogram_bounds, stat.window_samples, percentiles[j]);
+        }
+        stat.window_fps = stat.data.total_processed_units >= entry.last_units ?
+            (stat.data.total_processed_units - entry.last_units) / elapsed_sec : 0;
+
+        entry.last_units = stat.data.total_processed_units;
+        entry.last_histogram.swap(histogram);
+        elements.push_back(stat);
+    }
+
+    last_metrics_nsec = now_nsec;
+    last_metrics_proc_cpu = proc_cpu;
+
+    out << fixed << setprecision(2);
+    if (format == METRICS_FORMAT_JSON_LINES)
+    {
+        out << "{\"timestamp_ms\":" << (uint64_t) wall_time.tv_sec * 1000 +
+            wall_time.tv_usec / 1000;
+        out << ",\"interval_sec\":" << elapsed_sec;
+        out << ",\"process\":{\"cpu_percent\":" << proc_cpu_usage <<
+            ",\"cpu_cores\":" << num_cpu_cores <<
+            ",\"virtual_bytes\":" << virtual_bytes <<
+            ",\"resident_bytes\":" << resident_bytes <<
+            ",\"peak_resident_bytes\":" << peak_resident_bytes << "}";
+
+        out << ",\"threads\":[";
+        for (uint32_t i = 0; i < threads.size(); i++)
+        {
+            out << (i ? "," : "") << "{\"tid\":" << threads[i].tid <<
+                ",\"name\":\"" << json_escape(threads[i].name) << "\"" <<
+                ",\"cpu_seconds\":" << threads[i].ticks / (double) clock_ticks <<
+                ",\"cpu_percent\":" << threads[i].cpu_usage << "}";
+        }
+        out << "]";
+
+        out << ",\"elements\":[";
+        for (uint32_t i = 0; i < elements.size(); i++)
+        {
+            const ElementStat &stat = elements[i];
+
+            out << (i ? "," : "") << "{\"element\":\"" <<
+                json_escape(stat.name) << "\",\"stream\":\"" <<
+                json_escape(stat.stream) << "\"" <<
+                ",\"units\":" << stat.data.total_processed_units <<
+                ",\"late_units\":" << stat.data.num_late_units <<
+                ",\"dropped_samples\":" << stat.data.num_dropped_samples <<
+                ",\"fps\":" << stat.data.average_fps <<
+                ",\"window_fps\":" << stat.window_fps;
+            out << ",\"latency_usec\":{\"avg\":" <<
+                stat.data.average_latency_usec <<
+                ",\"min\":" << stat.data.min_latency_usec <<
+                ",\"max\":" << stat.data.max_latency_usec <<
+                ",\"p50\":" << stat.data.p50_latency_usec <<
+                ",\"p90\":" << stat.data.p90_latency_usec <<
+                ",\"p99\":" << stat.data.p99_latency_usec <<
+                ",\"p999\":" << stat.data.p999_latency_usec << "}";
+            out << ",\"window_latency_usec\":{\"samples\":" <<
+                stat.window_samples;
+            for (uint32_t j = 0; j < 4; j++)
+            {
+                out << ",\"" << percentile_names[j] << "\":" <<
+                    stat.window_latency_usec[j];
+            }
+            out << "}}";
+        }
+        out << "]}" << endl;
+        return;
+    }
+
+    out << "# HELP nvmm_process_cpu_percent CPU usage since the previous snapshot, 100 per core.\n";
+    out << "# TYPE nvmm_process_cpu_percent gauge\n";
+    out << "nvmm_process_cpu_percent " << proc_cpu_usage << "\n";
+    out << "# TYPE nvmm_process_cpu_cores gauge\n";
+    out << "nvmm_process_cpu_cores " << num_cpu_cores << "\n";
+    out << "# TYPE nvmm_process_virtual_bytes gauge\n";
+    out << "nvmm_process_virtual_bytes " << virtual_bytes << "\n";
+    out << "# TYPE nvmm_process_resident_bytes gauge\n";
+    out << "nvmm_process_resident_bytes " << resident_bytes << "\n";
+    out << "# TYPE nvmm_process_resident_peak_bytes gauge\n";
+    out << "nvmm_process_resident_peak_bytes " << peak_resident_bytes << "\n";
+
+    out << "# TYPE nvmm_thread_cpu_seconds_total counter\n";
+    for (uint32_t i = 0; i < threads.size(); i++)
+    {
+        out << "nvmm_thread_cpu_seconds_total{tid=\"" << threads[i].tid <<
+            "\",name=\"" << prometheus_escape(threads[i].name) << "\"} " <<
+            threads[i].ticks / (double) clock_ticks << "\n";
+    }
+    out << "# HELP nvmm_thread_cpu_percent CPU usage since the previous snapshot, 100 per core.\n";
+    out << "# TYPE nvmm_thread_cpu_percent gauge\n";
+    for (uint32_t i = 0; i < threads.size(); i++)
+    {
+        out << "nvmm_thread_cpu_percent{tid=\"" << threads[i].tid <<
+            "\",name=\"" << prometheus_escape(threads[i].name) << "\"} " <<
+            threads[i].cpu_usage << "\n";
+    }
+
+    vector<string> labels;
+    for (uint32_t i = 0; i < elements.size(); i++)
+    {
+        labels.push_back("element=\"" + prometheus_escape(elements[i].name) +
+                "\",stream=\"" + prometheus_escape(elements[i].stream) + "\"");
+    }
+
+    out << "# TYPE nvmm_element_units_total counter\n";
+    for (uint32_t i = 0; i < elements.size(); i++)
+    {
+        out << "nvmm_element_units_total{" << labels[i] << "} " <<
+            elements[i].data.total_processed_units << "\n";
+    }
+    out << "# TYPE nvmm_element_late_units_total counter\n";
+    for (uint32_t i = 0; i < elements.size(); i++)
+    {
+        out << "nvmm_element_late_units_total{" << labels[i] << "} " <<
+            elements[i].data.num_late_units << "\n";
+    }
+    out << "# HELP nvmm_element_fps Units per second since the previous snapshot.\n";
+    out << "# TYPE nvmm_element_fps gauge\n";
+    for (uint32_t i = 0; i < elements.size(); i++)
+    {
+        out << "nvmm_element_fps{" << labels[i] << "} " <<
+            elements[i].window_fps << "\n";
+    }
+    out << "# HELP nvmm_element_latency_usec Quantiles since the previous snapshot.\n";
+    out << "# TYPE nvmm_element_latency_usec summary\n";
+    for (uint32_t i = 0; i < elements.size(); i++)
+    {
+        const ElementStat &stat = elements[i];
+
+        for (uint32_t j = 0; j < 4; j++)
+        {
+            out << "nvmm_element_latency_usec{" << labels[i] <<
+                ",quantile=\"" << quantile_labels[j] << "\"} " <<
+                stat.window_latency_usec[j] << "\n";
+        }
+        out << "nvmm_element_latency_usec_sum{" << labels[i] << "} " <<
+            stat.data.average_latency_usec * stat.latency_samples << "\n";
+        out << "nvmm_element_latency_usec_count{" << labels[i] << "} " <<
+            stat.latency_samples << "\n";
+    }
+}
+
+int
+NvApplicationProfiler::writeSnapshot(const string &snapshot)
+{
+    const char *destination = metrics_destination.c_str();
+    int ret;
+
+    if (metrics_destination == "-")
+    {
+        ret = write_all(STDOUT_FILENO, snapshot, false);
+    }
+    else if (strncmp(destination, UNIX_SOCKET_PREFIX,
+                strlen(UNIX_SOCKET_PREFIX)) == 0)
+    {
+        if (metrics_fd < 0)
+        {
+            struct sockaddr_un addr;
+
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, destination + strlen(UNIX_SOCKET_PREFIX),
+                    sizeof(addr.sun_path) - 1);
+            metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (metrics_fd >= 0 &&
+                    connect(metrics_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+            {
+                close(metrics_fd);
+                metrics_fd = -1;
+            }
+        }
+        ret = -1;
+        if (metrics_fd >= 0)
+        {
+            if (metrics_format == METRICS_FORMAT_PROMETHEUS)
+                ret = write_all(metrics_fd, snapshot + "# EOF\n", true);
+            else
+                ret = write_all(metrics_fd, snapshot, true);
+            if (ret < 0)
+            {
+                // Reconnect for the next snapshot rather than send half of one
+                close(metrics_fd);
+                metrics_fd = -1;
+            }
+        }
+    }
+    else if (metrics_format == METRICS_FORMAT_JSON_LINES)
+    {
+        ret = write_all(metrics_fd, snapshot, false);
+    }
+    else
+    {
+        // Readers of the file never see a partial snapshot
+        string tmp_path = metrics_destination + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+
+        ret = -1;
+        if (fd >= 0)
+        {
+            ret = write_all(fd, snapshot, false);
+            close(fd);
+            if (ret == 0)
+                ret = rename(tmp_path.c_str(), destination);
+        }
+    }
+
+    if (ret < 0 && !metrics_error)
+    {
+        cerr << "Could not export metrics to " << metrics_destination << ": " <<
+            strerror(errno) << endl;
+    }
+    metrics_error = ret < 0;
+    return ret;
+}
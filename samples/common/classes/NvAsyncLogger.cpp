@@ -0,0 +1,964 @@
+#include "NvAsyncLogger.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <new>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MASK (ASYNC_LOGGER_RING_SIZE - 1)
+#define ALIGN8(x) (((x) + 7) & ~(size_t) 7)
+
+using namespace std;
+
+/**
+ * Kinds of records in a ring.
+ */
+enum
+{
+    RECORD_PAD,         /**< Skips to the end of the ring. */
+    RECORD_FORMAT,      /**< printf format and its arguments. */
+    RECORD_TEXT,        /**< Formatted text. */
+};
+
+/**
+ * Kinds of arguments of a RECORD_FORMAT record.
+ */
+enum
+{
+    ARG_INT = 'i',      /**< int64_t */
+    ARG_UINT = 'u',     /**< uint64_t */
+    ARG_DOUBLE = 'd',   /**< double */
+    ARG_POINTER = 'p',  /**< void * */
+    ARG_STRING = 's',   /**< uint32_t length, then the characters */
+};
+
+/**
+ * Starts every record, followed by the arguments or the text.
+ */
+struct RecordHeader
+{
+    uint32_t size;          /**< Bytes including the header, multiple of 8. */
+    uint8_t type;
+    uint8_t stream;
+    uint16_t flags;
+    uint32_t suppressed;    /**< Messages of the site suppressed before. */
+    uint32_t length;        /**< Bytes after the header. */
+    uint64_t nsec;
+    const char *prefix;
+    const char *suffix;
+    const char *fmt;        /**< The site of RECORD_TEXT. */
+};
+
+/**
+ * One conversion of a printf format.
+ */
+struct FormatSpec
+{
+    const char *start;      /**< The '%'. */
+    const char *end;        /**< Past the conversion character. */
+    bool width_star;
+    bool precision_star;
+    char length[3];
+    char conversion;
+};
+
+/**
+ * Where a drained record is in drain_records.
+ */
+struct DrainedRecord
+{
+    uint64_t nsec;
+    size_t offset;
+
+    bool operator<(const DrainedRecord &o) const
+    {
+        return nsec < o.nsec;
+    }
+};
+
+static uint64_t
+monotonic_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Parses the conversion at @a p, a '%' other than "%%".
+ *
+ * @return false if the conversion is not supported, the rest of the format
+ *         is then written as is.
+ */
+static bool
+parse_spec(const char *p, FormatSpec *spec)
+{
+    int n = 0;
+
+    spec->start = p++;
+    spec->width_star = false;
+    spec->precision_star = false;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*')
+    {
+        spec->width_star = true;
+        p++;
+    }
+    else
+        while (*p >= '0' && *p <= '9')
+            p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            spec->precision_star = true;
+            p++;
+        }
+        else
+            while (*p >= '0' && *p <= '9')
+                p++;
+    }
+    while (*p && strchr("hljztL", *p) && n < 2)
+        spec->length[n++] = *p++;
+    spec->length[n] = 0;
+    if (!*p || !strchr("diouxXceEfFgGaAspn", *p))
+        return false;
+    spec->conversion = *p;
+    spec->end = p + 1;
+    return true;
+}
+
+/**
+ * Appends an argument to a record, returns false if it does not fit.
+ */
+static bool
+put_arg(char *&pos, char *limit, char kind, const void *value, size_t size)
+{
+    if (pos + 1 + size > limit)
+        return false;
+    *pos++ = kind;
+    memcpy(pos, value, size);
+    pos += size;
+    return true;
+}
+
+static bool
+put_int(char *&pos, char *limit, int64_t value)
+{
+    return put_arg(pos, limit, ARG_INT, &value, sizeof(value));
+}
+
+/**
+ * Copies the arguments of @a fmt into a record.
+ *
+ * Only the types are taken from the format, the formatting is left to the
+ * writer thread.
+ */
+static char *
+capture_args(const char *fmt, va_list *ap, char *pos, char *limit)
+{
+    const char *p = fmt;
+
+    while ((p = strchr(p, '%')))
+    {
+        FormatSpec spec;
+        int precision = -1;
+        bool fits = true;
+
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+        if (!parse_spec(p, &spec))
+            break;
+        p = spec.end;
+
+        if (spec.width_star)
+            fits = put_int(pos, limit, va_arg(*ap, int));
+        if (fits && spec.precision_star)
+        {
+            precision = va_arg(*ap, int);
+            fits = put_int(pos, limit, precision);
+        }
+        else if (!spec.precision_star)
+        {
+            const char *dot = (const char *) memchr(spec.start, '.',
+                    spec.end - spec.start);
+            if (dot)
+                precision = atoi(dot + 1);
+        }
+        if (!fits)
+            break;
+
+        const char *length = spec.length;
+        switch (spec.conversion)
+        {
+            case 'd':
+            case 'i':
+            {
+                int64_t value;
+
+                if (!strcmp(length, "hh"))
+                    value = (signed char) va_arg(*ap, int);
+                else if (!strcmp(length, "h"))
+                    value = (short) va_arg(*ap, int);
+                else if (!strcmp(length, "l"))
+                    value = va_arg(*ap, long);
+                else if (!strcmp(length, "ll"))
+                    value = va_arg(*ap, long long);
+                else if (!strcmp(length, "j"))
+                    value = va_arg(*ap, intmax_t);
+                else if (!strcmp(length, "z"))
+                    value = va_arg(*ap, ssize_t);
+                else if (!strcmp(length, "t"))
+                    value = va_arg(*ap, ptrdiff_t);
+                else
+                    value = va_arg(*ap, int);
+                fits = put_int(pos, limit, value);
+                break;
+            }
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t value;
+
+                if (!strcmp(length, "hh"))
+                    value = (unsigned char) va_arg(*ap, unsigned int);
+                else if (!strcmp(length, "h"))
+                    value = (unsigned short) va_arg(*ap, unsigned int);
+                else if (!strcmp(length, "l"))
+                    value = va_arg(*ap, unsigned long);
+                else if (!strcmp(length, "ll"))
+                    value = va_arg(*ap, unsigned long long);
+                else if (!strcmp(length, "j"))
+                    value = va_arg(*ap, uintmax_t);
+                else if (!strcmp(length, "z"))
+                    value = va_arg(*ap, size_t);
+                else if (!strcmp(length, "t"))
+                    value = va_arg(*ap, ptrdiff_t);
+                else
+                    value = va_arg(*ap, unsigned int);
+                fits = put_arg(pos, limit, ARG_UINT, &value, sizeof(value));
+                break;
+            }
+            case 'c':
+                fits = put_int(pos, limit, va_arg(*ap, int));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                double value;
+
+                if (!strcmp(length, "L"))
+                    value = (double) va_arg(*ap, long double);
+                else
+                    value = va_arg(*ap, double);
+                fits = put_arg(pos, limit, ARG_DOUBLE, &value, sizeof(value));
+                break;
+            }
+            case 's':
+            {
+                const char *str = va_arg(*ap, const char *);
+                uint32_t len;
+
+                // The string may not be terminated within the precision
+                if (!str)
+                    str = "(null)";
+                len = precision >= 0 ? strnlen(str, precision) : strlen(str);
+                if (pos + 1 + sizeof(len) > limit)
+                {
+                    fits = false;
+                    break;
+                }
+                len = min((size_t) len, (size_t) (limit - pos) - 1 - sizeof(len));
+                *pos++ = ARG_STRING;
+                memcpy(pos, &len, sizeof(len));
+                memcpy(pos + sizeof(len), str, len);
+                pos += sizeof(len) + len;
+                break;
+            }
+            case 'p':
+            {
+                void *value = va_arg(*ap, void *);
+
+                fits = put_arg(pos, limit, ARG_POINTER, &value, sizeof(value));
+                break;
+            }
+            case 'n':
+                // Nothing is written back
+                (void) va_arg(*ap, void *);
+                break;
+            default:
+                fits = false;
+                break;
+        }
+        if (!fits)
+            break;
+    }
+    return pos;
+}
+
+/**
+ * Reads an argument of a record, returns false if there is none left.
+ */
+static bool
+get_arg(const char *&pos, const char *limit, void *value, size_t size)
+{
+    if (pos + 1 + size > limit)
+        return false;
+    memcpy(value, pos + 1, size);
+    pos += 1 + size;
+    return true;
+}
+
+template <typename T> static int
+format_one(char *buf, size_t size, const char *spec, const FormatSpec &fs,
+        int width, int precision, T value)
+{
+    if (fs.width_star && fs.precision_star)
+        return snprintf(buf, size, spec, width, precision, value);
+    if (fs.width_star)
+        return snprintf(buf, size, spec, width, value);
+    if (fs.precision_star)
+        return snprintf(buf, size, spec, precision, value);
+    return snprintf(buf, size, spec, value);
+}
+
+template <typename T> static void
+append_one(vector<char> &out, const char *spec, const FormatSpec &fs,
+        int width, int precision, T value)
+{
+    char buf[256];
+    int n = format_one(buf, sizeof(buf), spec, fs, width, precision, value);
+
+    if (n < 0)
+        return;
+    if ((size_t) n < sizeof(buf))
+    {
+        out.insert(out.end(), buf, buf + n);
+        return;
+    }
+    vector<char> big(n + 1);
+    format_one(&big[0], big.size(), spec, fs, width, precision, value);
+    out.insert(out.end(), big.begin(), big.begin() + n);
+}
+
+static void
+append(vector<char> &out, const char *str)
+{
+    if (str)
+        out.insert(out.end(), str, str + strlen(str));
+}
+
+/**
+ * Formats the arguments of a record with its format.
+ */
+static void
+format_args(vector<char> &out, const char *fmt, const char *pos,
+        const char *limit)
+{
+    const char *p = fmt;
+
+    for (;;)
+    {
+        const char *percent = strchr(p, '%');
+        FormatSpec fs;
+        int width = 0;
+        int precision = 0;
+        int64_t ivalue;
+
+        if (!percent)
+        {
+            append(out, p);
+            return;
+        }
+        out.insert(out.end(), p, percent);
+        if (percent[1] == '%')
+        {
+            out.push_back('%');
+            p = percent + 2;
+            continue;
+        }
+        if (!parse_spec(percent, &fs))
+        {
+            append(out, percent);
+            return;
+        }
+        p = fs.end;
+
+        if (fs.width_star)
+        {
+            if (!get_arg(pos, limit, &ivalue, sizeof(ivalue)))
+                break;
+            width = ivalue;
+        }
+        if (fs.precision_star)
+        {
+            if (!get_arg(pos, limit, &ivalue, sizeof(ivalue)))
+                break;
+            precision = ivalue;
+        }
+
+        // The conversion without its length, integers are 64-bit now
+        char spec[64];
+        size_t spec_len = min((size_t) (fs.end - fs.start - 1 - strlen(fs.length)),
+                sizeof(spec) - 4);
+        memcpy(spec, fs.start, spec_len);
+        spec[spec_len] = 0;
+
+        if (fs.conversion == 'n')
+            continue;
+        if (pos >= limit)
+            break;
+        switch (*pos)
+        {
+            case ARG_INT:
+            {
+                if (!get_arg(pos, limit, &ivalue, sizeof(ivalue)))
+                    break;
+                if (fs.conversion == 'c')
+                {
+                    strcat(spec, "c");
+                    append_one(out, spec, fs, width, precision, (int) ivalue);
+                }
+                else
+                {
+                    strcat(spec, "ll");
+                    strncat(spec, &fs.conversion, 1);
+                    append_one(out, spec, fs, width, precision, (long long) ivalue);
+                }
+                continue;
+            }
+            case ARG_UINT:
+            {
+                uint64_t value;
+
+                if (!get_arg(pos, limit, &value, sizeof(value)))
+                    break;
+                strcat(spec, "ll");
+                strncat(spec, &fs.conversion, 1);
+                append_one(out, spec, fs, width, precision,
+                        (unsigned long long) value);
+                continue;
+            }
+            case ARG_DOUBLE:
+            {
+                double value;
+
+                if (!get_arg(pos, limit, &value, sizeof(value)))
+                    break;
+                strncat(spec, &fs.conversion, 1);
+                append_one(out, spec, fs, width, precision, value);
+                continue;
+            }
+            case ARG_POINTER:
+            {
+                void *value;
+
+                if (!get_arg(pos, limit, &value, sizeof(value)))
+                    break;
+                strcat(spec, "p");
+                append_one(out, spec, fs, width, precision, value);
+                continue;
+            }
+            case ARG_STRING:
+            {
+                uint32_t len;
+
+                if (pos + 1 + sizeof(len) > limit)
+                    break;
+                memcpy(&len, pos + 1, sizeof(len));
+                pos += 1 + sizeof(len);
+                len = min((size_t) len, (size_t) (limit - pos));
+                string value(pos, len);
+                pos += len;
+                strcat(spec, "s");
+                append_one(out, spec, fs, width, precision, value.c_str());
+                continue;
+            }
+        }
+        break;
+    }
+
+    // The arguments did not fit into the record
+    append(out, "...");
+}
+
+static void
+write_all(int fd, const vector<char> &buf)
+{
+    size_t done = 0;
+
+    while (done < buf.size())
+    {
+        ssize_t n = ::write(fd, &buf[done], buf.size() - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        done += n;
+    }
+}
+
+NvAsyncLogger::NvAsyncLogger()
+{
+    const char *sync = getenv("NV_LOG_SYNC");
+
+    async.store(!(sync && strcmp(sync, "0")));
+    rate_burst.store(ASYNC_LOGGER_DEFAULT_BURST);
+    rate_interval_nsec.store(ASYNC_LOGGER_DEFAULT_INTERVAL_MS * 1000000ULL);
+    flush_interval_ms.store(ASYNC_LOGGER_DEFAULT_FLUSH_MS);
+    start_nsec.store(0);
+    dropped_total.store(0);
+    suppressed_total.store(0);
+
+    pthread_key_create(&ring_key, releaseThreadRing);
+    pthread_mutex_init(&rings_lock, NULL);
+    pthread_mutex_init(&drain_lock, NULL);
+    pthread_once_t once = PTHREAD_ONCE_INIT;
+    writer_once = once;
+    pthread_mutex_init(&writer_lock, NULL);
+    pthread_cond_init(&writer_cond, NULL);
+}
+
+NvAsyncLogger&
+NvAsyncLogger::getLoggerInstance()
+{
+    // Never destroyed, static destructors and exiting threads may log
+    static NvAsyncLogger *logger = new NvAsyncLogger;
+    return *logger;
+}
+
+void
+NvAsyncLogger::startWriter()
+{
+    NvAsyncLogger &logger = getLoggerInstance();
+
+    if (pthread_create(&logger.writer_thread, NULL, writerThread, &logger))
+    {
+        logger.async.store(false);
+        return;
+    }
+    pthread_setname_np(logger.writer_thread, "NvAsyncLogger");
+    atexit(flushAtExit);
+}
+
+void
+NvAsyncLogger::flushAtExit()
+{
+    NvAsyncLogger &logger = getLoggerInstance();
+
+    // Messages of static destructors are written right away
+    logger.async.store(false);
+    logger.flush();
+}
+
+void
+NvAsyncLogger::releaseThreadRing(void *arg)
+{
+    ThreadRing *ring = (ThreadRing *) arg;
+
+    ring->orphaned.store(true, memory_order_release);
+}
+
+void *
+NvAsyncLogger::writerThread(void *arg)
+{
+    NvAsyncLogger *logger = (NvAsyncLogger *) arg;
+
+    for (;;)
+    {
+        struct timespec ts;
+        uint32_t interval_ms = logger->flush_interval_ms.load(memory_order_relaxed);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (interval_ms % 1000) * 1000000L;
+        ts.tv_sec += interval_ms / 1000 + ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_mutex_lock(&logger->writer_lock);
+        pthread_cond_timedwait(&logger->writer_cond, &logger->writer_lock, &ts);
+        pthread_mutex_unlock(&logger->writer_lock);
+
+        logger->flush();
+    }
+    return NULL;
+}
+
+NvAsyncLogger::ThreadRing *
+NvAsyncLogger::getThreadRing()
+{
+    ThreadRing *ring = (ThreadRing *) pthread_getspecific(ring_key);
+
+    if (ring)
+        return ring;
+
+    pthread_mutex_lock(&rings_lock);
+    if (!free_rings.empty())
+    {
+        ring = free_rings.back();
+        free_rings.pop_back();
+    }
+    else
+    {
+        ring = new (nothrow) ThreadRing;
+        if (ring)
+        {
+            ring->data = new (nothrow) char[ASYNC_LOGGER_RING_SIZE];
+            if (!ring->data)
+            {
+                delete ring;
+                ring = NULL;
+            }
+        }
+        if (ring)
+        {
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->dropped.store(0);
+            ring->orphaned.store(false);
+            memset(ring->rate, 0, sizeof(ring->rate));
+        }
+    }
+    if (ring)
+        rings.push_back(ring);
+    pthread_mutex_unlock(&rings_lock);
+
+    if (ring)
+        pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+bool
+NvAsyncLogger::admit(RateSlot *rate, const void *site, uint64_t nsec,
+        uint32_t *suppressed)
+{
+    uint32_t burst = rate_burst.load(memory_order_relaxed);
+    uint64_t interval = rate_interval_nsec.load(memory_order_relaxed);
+    RateSlot &slot = rate[((uintptr_t) site >> 3) & (ASYNC_LOGGER_RATE_SLOTS - 1)];
+
+    *suppressed = 0;
+    if (!burst || !site)
+        return true;
+
+    // A site mapping to the same slot takes it over
+    if (slot.site != site)
+    {
+        slot.site = site;
+        slot.window_start = nsec;
+        slot.count = 0;
+        slot.suppressed = 0;
+    }
+    else if (nsec - slot.window_start >= interval)
+    {
+        *suppressed = slot.suppressed;
+        slot.window_start = nsec;
+        slot.count = 0;
+        slot.suppressed = 0;
+    }
+
+    if (slot.count < burst)
+    {
+        slot.count++;
+        return true;
+    }
+    slot.suppressed++;
+    suppressed_total.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+size_t
+NvAsyncLogger::buildRecord(char *buffer, LogStream stream, uint32_t flags,
+        uint32_t suppressed, const char *prefix, const char *suffix,
+        const char *fmt, va_list *args, const char *text, size_t length,
+        uint64_t nsec)
+{
+    RecordHeader *header = (RecordHeader *) buffer;
+    char *pos = buffer + sizeof(RecordHeader);
+    char *limit = buffer + ASYNC_LOGGER_MAX_RECORD;
+    uint64_t start = 0;
+
+    // The first message with a time stamp is at 0:00:00:000
+    if ((flags & LOG_FLAG_ELAPSED_TIME) &&
+            !start_nsec.load(memory_order_relaxed))
+        start_nsec.compare_exchange_strong(start, nsec);
+
+    if (text)
+    {
+        length = min(length, (size_t) (limit - pos));
+        memcpy(pos, text, length);
+        pos += length;
+    }
+    else
+        pos = capture_args(fmt, args, pos, limit);
+
+    header->type = text ? RECORD_TEXT : RECORD_FORMAT;
+    header->stream = stream;
+    header->flags = flags;
+    header->suppressed = suppressed;
+    header->length = pos - buffer - sizeof(RecordHeader);
+    header->nsec = nsec;
+    header->prefix = prefix;
+    header->suffix = suffix;
+    header->fmt = fmt;
+    header->size = ALIGN8(pos - buffer);
+    return header->size;
+}
+
+void
+NvAsyncLogger::vlog(LogStream stream, uint32_t flags, const char *prefix,
+        const char *suffix, const char *fmt, va_list args)
+{
+    uint64_t record[ASYNC_LOGGER_MAX_RECORD / sizeof(uint64_t)];
+    uint64_t nsec = monotonic_nsec();
+    ThreadRing *ring = getThreadRing();
+    uint32_t suppressed = 0;
+    va_list ap;
+
+    if (ring && !admit(ring->rate, fmt, nsec, &suppressed))
+        return;
+
+    va_copy(ap, args);
+    size_t size = buildRecord((char *) record, stream, flags, suppressed,
+            prefix, suffix, fmt, &ap, NULL, 0, nsec);
+    va_end(ap);
+    submit((const char *) record, size, flags);
+}
+
+void
+NvAsyncLogger::write(LogStream stream, uint32_t flags, const char *site,
+        const char *text, size_t length)
+{
+    uint64_t record[ASYNC_LOGGER_MAX_RECORD / sizeof(uint64_t)];
+    uint64_t nsec = monotonic_nsec();
+    ThreadRing *ring = getThreadRing();
+    uint32_t suppressed = 0;
+
+    if (ring && !admit(ring->rate, site, nsec, &suppressed))
+        return;
+
+    size_t size = buildRecord((char *) record, stream, flags, suppressed,
+            NULL, NULL, site, NULL, text, length, nsec);
+    submit((const char *) record, size, flags);
+}
+
+void
+NvAsyncLogger::submit(const char *record, size_t size, uint32_t flags)
+{
+    ThreadRing *ring = NULL;
+
+    if (async.load(memory_order_relaxed))
+    {
+        pthread_once(&writer_once, startWriter);
+        ring = getThreadRing();
+    }
+    if (!ring || !async.load(memory_order_relaxed))
+    {
+        vector<char> out;
+        RecordHeader *header = (RecordHeader *) record;
+
+        pthread_mutex_lock(&drain_lock);
+        formatRecord(record, out);
+        write_all(header->stream == LOG_STREAM_STDOUT ? 1 : 2, out);
+        pthread_mutex_unlock(&drain_lock);
+        return;
+    }
+
+    // Only this thread moves head, the drain moves tail
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    uint64_t tail = ring->tail.load(memory_order_acquire);
+    size_t room = ASYNC_LOGGER_RING_SIZE - (head & RING_MASK);
+    size_t needed = size <= room ? size : room + size;
+
+    if (head + needed - tail > ASYNC_LOGGER_RING_SIZE)
+    {
+        ring->dropped.fetch_add(1, memory_order_relaxed);
+        dropped_total.fetch_add(1, memory_order_relaxed);
+        pthread_cond_signal(&writer_cond);
+        return;
+    }
+    if (size > room)
+    {
+        RecordHeader *pad = (RecordHeader *) (ring->data + (head & RING_MASK));
+
+        pad->size = room;
+        pad->type = RECORD_PAD;
+        head += room;
+    }
+    memcpy(ring->data + (head & RING_MASK), record, size);
+    ring->head.store(head + size, memory_order_release);
+
+    if ((flags & LOG_FLAG_URGENT) ||
+            head + size - tail > ASYNC_LOGGER_RING_SIZE / 2)
+        pthread_cond_signal(&writer_cond);
+}
+
+void
+NvAsyncLogger::formatRecord(const char *record, vector<char> &out)
+{
+    const RecordHeader *header = (const RecordHeader *) record;
+    const char *payload = record + sizeof(RecordHeader);
+    char stamp[32] = "";
+
+    if (header->flags & LOG_FLAG_ELAPSED_TIME)
+    {
+        uint64_t start = start_nsec.load(memory_order_relaxed);
+        int64_t elapsed_ms = header->nsec > start ?
+            (header->nsec - start) / 1000000 : 0;
+        snprintf(stamp, sizeof(stamp), "[%d:%02d:%02d:%03d] ",
+                (int) (elapsed_ms / 3600000LL), (int) ((elapsed_ms / 60000LL) % 60LL),
+                (int) ((elapsed_ms / 1000LL) % 60LL), (int) (elapsed_ms % 1000LL));
+    }
+
+    if (header->suppressed)
+    {
+        char note[64];
+
+        snprintf(note, sizeof(note), "%u similar messages suppressed",
+                header->suppressed);
+        append(out, stamp);
+        if (header->type == RECORD_TEXT)
+        {
+            append(out, "[NvAsyncLogger] (");
+            append(out, header->fmt);
+            append(out, ") ");
+            append(out, note);
+            out.push_back('\n');
+        }
+        else
+        {
+            append(out, header->prefix);
+            append(out, note);
+            append(out, header->suffix);
+        }
+    }
+
+    append(out, stamp);
+    append(out, header->prefix);
+    if (header->type == RECORD_TEXT)
+        out.insert(out.end(), payload, payload + header->length);
+    else
+        format_args(out, header->fmt, payload, payload + header->length);
+    append(out, header->suffix);
+}
+
+void
+NvAsyncLogger::drain()
+{
+    vector<ThreadRing *> snapshot;
+    vector<DrainedRecord> records;
+    vector<char> out[2];
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    snapshot = rings;
+    pthread_mutex_unlock(&rings_lock);
+
+    drain_records.clear();
+    for (size_t r = 0; r < snapshot.size(); r++)
+    {
+        ThreadRing *ring = snapshot[r];
+        bool orphaned = ring->orphaned.load(memory_order_acquire);
+        uint64_t head = ring->head.load(memory_order_acquire);
+        uint64_t tail = ring->tail.load(memory_order_relaxed);
+
+        while (tail < head)
+        {
+            const RecordHeader *header =
+                (const RecordHeader *) (ring->data + (tail & RING_MASK));
+
+            if (header->type != RECORD_PAD)
+            {
+                DrainedRecord drained = { header->nsec, drain_records.size() };
+
+                drain_records.insert(drain_records.end(), (const char *) header,
+                        (const char *) header + header->size);
+                records.push_back(drained);
+            }
+            tail += header->size;
+        }
+        ring->tail.store(tail, memory_order_release);
+        dropped += ring->dropped.exchange(0, memory_order_relaxed);
+
+        // The thread is gone and its ring empty, the next new thread gets it
+        if (orphaned)
+        {
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->orphaned.store(false);
+            memset(ring->rate, 0, sizeof(ring->rate));
+            pthread_mutex_lock(&rings_lock);
+            rings.erase(find(rings.begin(), rings.end(), ring));
+            free_rings.push_back(ring);
+            pthread_mutex_unlock(&rings_lock);
+        }
+    }
+
+    stable_sort(records.begin(), records.end());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const char *record = &drain_records[records[i].offset];
+        const RecordHeader *header = (const RecordHeader *) record;
+
+        formatRecord(record, out[header->stream == LOG_STREAM_STDOUT ? 0 : 1]);
+    }
+    if (dropped)
+    {
+        char note[96];
+
+        snprintf(note, sizeof(note),
+                "[NvAsyncLogger] %llu messages dropped, ring full\n",
+                (unsigned long long) dropped);
+        append(out[1], note);
+    }
+
+    write_all(1, out[0]);
+    write_all(2, out[1]);
+}
+
+void
+NvAsyncLogger::flush()
+{
+    pthread_mutex_lock(&drain_lock);
+    drain();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void
+NvAsyncLogger::setAsync(bool enable)
+{
+    async.store(enable);
+    if (!enable)
+        flush();
+}
+
+void
+NvAsyncLogger::setRateLimit(uint32_t burst, uint32_t interval_ms)
+{
+    rate_burst.store(burst);
+    rate_interval_nsec.store(interval_ms * 1000000ULL);
+}
+
+void
+NvAsyncLogger::setFlushInterval(uint32_t interval_ms)
+{
+    flush_interval_ms.store(interval_ms ? interval_ms : 1);
+}
@@ -0,0 +1,216 @@
+#include "NvBitstreamSource.h"
+#include "NvLogging.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define H264_NAL_SEI 6
+#define H264_NAL_AUD 9
+#define H265_NAL_VPS 32
+#define H265_NAL_AUD 35
+#define H265_NAL_SEI_PREFIX 39
+
+using namespace std;
+
+static const char *comp_name = "NvBitstreamSource";
+
+static bool
+is_vcl(NvNalCodec codec, uint32_t type)
+{
+    if (codec == NV_NAL_CODEC_H265)
+        return type < H265_NAL_VPS;
+    return type >= 1 && type <= 5;
+}
+
+/**
+ * Checks whether a NAL unit starts a new access unit, following the rules
+ * for the first NAL unit of an access unit of H.264 7.4.1.2.3 and H.265
+ * 7.4.2.4.4.
+ *
+ * @param[in] header The NAL unit header.
+ * @param[in] len Bytes from @a header to the end of the unit.
+ * @param[in] vcl_seen Whether the current access unit has a coded slice.
+ */
+static bool
+starts_access_unit(NvNalCodec codec, uint32_t type, const uint8_t *header,
+        size_t len, bool vcl_seen)
+{
+    if (!vcl_seen)
+        return false;
+
+    if (codec == NV_NAL_CODEC_H265)
+    {
+        // first_slice_segment_in_pic_flag follows the 2-byte header
+        if (is_vcl(codec, type))
+            return len > 2 && (header[2] & 0x80);
+        return (type >= H265_NAL_VPS && type <= H265_NAL_AUD) ||
+            type == H265_NAL_SEI_PREFIX || (type >= 41 && type <= 44) ||
+            (type >= 48 && type <= 55);
+    }
+
+    // first_mb_in_slice is ue(v), 0 is coded as a single 1 bit
+    if (is_vcl(codec, type))
+        return len > 1 && (header[1] & 0x80);
+    return (type >= H264_NAL_SEI && type <= H264_NAL_AUD) ||
+        (type >= 14 && type <= 18);
+}
+
+NvBitstreamSource *
+NvBitstreamSource::createBitstreamSource(const char *path, size_t prefetch_size)
+{
+    struct stat st;
+    void *data = NULL;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not open " << path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        COMP_ERROR_MSG(path << " is not a regular file");
+        close(fd);
+        return NULL;
+    }
+
+    // An empty file cannot be mapped, it is at its end right away
+    if (st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            COMP_SYS_ERROR_MSG("Could not map " << path);
+            close(fd);
+            return NULL;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+    // The mapping keeps the file
+    close(fd);
+
+    return new NvBitstreamSource((const uint8_t *) data, st.st_size,
+            prefetch_size);
+}
+
+NvBitstreamSource::NvBitstreamSource(const uint8_t *data, size_t size,
+        size_t prefetch_size)
+    : data(data), size(size), position(0), prefetch_size(prefetch_size),
+      prefetched_end(0), released_end(0)
+{
+    page_size = sysconf(_SC_PAGESIZE);
+    advance(0);
+}
+
+NvBitstreamSource::~NvBitstreamSource()
+{
+    if (data)
+        munmap((void *) data, size);
+}
+
+void
+NvBitstreamSource::advance(size_t new_position)
+{
+    position = new_position;
+    if (!data || !prefetch_size)
+        return;
+
+    // Prefetch another window once half of the last one is read
+    if (prefetched_end < size && position + prefetch_size / 2 >= prefetched_end)
+    {
+        size_t start = max(prefetched_end, position) & ~(page_size - 1);
+        size_t end = min(position + prefetch_size, size);
+
+        madvise((void *) (data + start), end - start, MADV_WILLNEED);
+        prefetched_end = end;
+    }
+
+    // Pages far behind are read again from the page cache if needed
+    if (position > released_end + 2 * prefetch_size)
+    {
+        size_t end = (position - prefetch_size) & ~(page_size - 1);
+
+        madvise((void *) (data + released_end), end - released_end,
+                MADV_DONTNEED);
+        released_end = end;
+    }
+}
+
+void
+NvBitstreamSource::seek(size_t new_position)
+{
+    new_position = min(new_position, size);
+    released_end = min(released_end, new_position & ~(page_size - 1));
+    prefetched_end = min(prefetched_end, new_position);
+    advance(new_position);
+}
+
+bool
+NvBitstreamSource::findNalu(NvNalCodec codec, size_t from, NvNalUnit *unit)
+{
+    if (from >= size ||
+            nv_nal_scan_units(data + from, size - from, codec, unit, 1) != 1)
+        return false;
+    unit->offset += from;
+    return true;
+}
+
+const uint8_t *
+NvBitstreamSource::nextNalu(NvNalCodec codec, NvNalUnit *unit)
+{
+    if (!findNalu(codec, position, unit))
+    {
+        advance(size);
+        return NULL;
+    }
+    advance(unit->offset + unit->size);
+    return data + unit->offset;
+}
+
+const uint8_t *
+NvBitstreamSource::nextAccessUnit(NvNalCodec codec, NvNalUnit *unit)
+{
+    NvNalUnit nalu;
+    bool vcl_seen;
+
+    if (!findNalu(codec, position, unit))
+    {
+        advance(size);
+        return NULL;
+    }
+    vcl_seen = is_vcl(codec, unit->type);
+
+    while (findNalu(codec, unit->offset + unit->size, &nalu))
+    {
+        const uint8_t *header = data + nalu.offset + nalu.start_code_len;
+        size_t len = nalu.size - nalu.start_code_len;
+
+        if (starts_access_unit(codec, nalu.type, header, len, vcl_seen))
+            break;
+        if (!vcl_seen && is_vcl(codec, nalu.type))
+        {
+            unit->type = nalu.type;
+            vcl_seen = true;
+        }
+        unit->size = nalu.offset + nalu.size - unit->offset;
+    }
+
+    advance(unit->offset + unit->size);
+    return data + unit->offset;
+}
+
+size_t
+NvBitstreamSource::read(void *dst, size_t len)
+{
+    len = min(len, size - position);
+    if (len)
+        memcpy(dst, data + position, len);
+    advance(position + len);
+    return len;
+}
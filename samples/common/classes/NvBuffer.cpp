@@ -27,6 +27,7 @@
  */
 
 #include "NvBuffer.h"
+#include "NvBufferPool.h"
 #include "NvLogging.h"
 
 #include <cstring>
@@ -49,6 +50,7 @@ NvBuffer::NvBuffer(enum v4l2_buf_type buf_type, enum v4l2_memory memory_type,
 
     mapped = false;
     allocated = false;
+    memory_pool = NULL;
 
     memset(planes, 0, sizeof(planes));
     for (i = 0; i < n_planes; i++)
@@ -73,6 +75,7 @@ NvBuffer::NvBuffer(uint32_t pixfmt, uint32_t width, uint32_t height,
 
     mapped = false;
     allocated = false;
+    memory_pool = NULL;
 
     fill_buffer_plane_format(&n_planes, fmt, width, height, pixfmt);
 
@@ -103,6 +106,7 @@ NvBuffer::NvBuffer(uint32_t size, uint32_t index)
 
     mapped = false;
     allocated = false;
+    memory_pool = NULL;
 
     n_planes = 1;
     for (i = 0; i < n_planes; i++)
@@ -203,6 +207,12 @@ NvBuffer::unmap()
 
 int
 NvBuffer::allocateMemory()
+{
+    return allocateMemory(NULL);
+}
+
+int
+NvBuffer::allocateMemory(NvBufferPool *pool)
 {
     uint32_t j;
 
@@ -231,9 +241,21 @@ NvBuffer::allocateMemory()
                                planes[j].fmt.width *
                                planes[j].fmt.bytesperpixel *
                                planes[j].fmt.height);
-        planes[j].data = new unsigned char [planes[j].length];
+        if (pool)
+        {
+            if (pool->acquireMemory(planes[j].fmt.width,
+                        planes[j].fmt.height, planes[j].fmt.bytesperpixel,
+                        planes[j].length, &planes[j].data) < 0)
+            {
+                planes[j].data = NULL;
+            }
+        }
+        else
+        {
+            planes[j].data = new unsigned char [planes[j].length];
+        }
 
-        if (planes[j].data == MAP_FAILED)
+        if (planes[j].data == MAP_FAILED || planes[j].data == NULL)
         {
             SYS_ERROR_MSG("Error while allocating buffer " << index <<
                     " plane " << j);
@@ -246,6 +268,7 @@ NvBuffer::allocateMemory()
         }
     }
     allocated = true;
+    memory_pool = pool;
     return 0;
 }
 
@@ -268,10 +291,14 @@ NvBuffer::deallocateMemory()
                     " not allocated");
             continue;
         }
-        delete[] planes[j].data;
+        if (memory_pool)
+            memory_pool->releaseMemory(planes[j].data);
+        else
+            delete[] planes[j].data;
         planes[j].data = NULL;
     }
     allocated = false;
+    memory_pool = NULL;
     DEBUG_MSG("Buffer " << index << " deallocated");
 }
 
@@ -0,0 +1,390 @@
+#include "NvBufferPool.h"
+#include "NvLogging.h"
+
+#include <new>
+
+using namespace std;
+
+static pthread_once_t process_pool_once = PTHREAD_ONCE_INIT;
+static NvBufferPool *process_pool;
+
+static void
+create_process_pool()
+{
+    process_pool = NvBufferPool::createBufferPool("ProcessBufferPool");
+}
+
+bool
+NvBufferPool::Key::operator<(const Key &o) const
+{
+    if (dmabuf != o.dmabuf)
+        return dmabuf < o.dmabuf;
+    if (width != o.width)
+        return width < o.width;
+    if (height != o.height)
+        return height < o.height;
+    if (format != o.format)
+        return format < o.format;
+    if (layout != o.layout)
+        return layout < o.layout;
+    if (payload != o.payload)
+        return payload < o.payload;
+    return size < o.size;
+}
+
+NvBufferPool::NvBufferPool(const char *name)
+    :comp_name(name)
+{
+    idle_limit = UINT32_MAX;
+    pthread_mutex_init(&pool_lock, NULL);
+}
+
+NvBufferPool *
+NvBufferPool::createBufferPool(const char *name)
+{
+    return new NvBufferPool(name);
+}
+
+NvBufferPool *
+NvBufferPool::getProcessPool()
+{
+    pthread_once(&process_pool_once, create_process_pool);
+    return process_pool;
+}
+
+NvBufferPool::~NvBufferPool()
+{
+    if (!busy_memory.empty() || !busy_dmabufs.empty())
+    {
+        COMP_WARN_MSG(busy_memory.size() + busy_dmabufs.size() <<
+                " buffers still in use, freed anyway");
+        for (map<uintptr_t, Key>::iterator it = busy_memory.begin();
+                it != busy_memory.end(); ++it)
+        {
+            freeBuffer(it->second, it->first);
+        }
+        for (map<int, Key>::iterator it = busy_dmabufs.begin();
+                it != busy_dmabufs.end(); ++it)
+        {
+            freeBuffer(it->second, it->first);
+        }
+    }
+    trim();
+    pthread_mutex_destroy(&pool_lock);
+}
+
+bool
+NvBufferPool::takeIdle(const Key &key, uintptr_t *handle)
+{
+    map<Key, Entry>::iterator it = entries.find(key);
+
+    if (it == entries.end() || it->second.idle.empty())
+        return false;
+
+    *handle = it->second.idle.back();
+    it->second.idle.pop_back();
+    it->second.reuses++;
+    markInUse(key);
+    return true;
+}
+
+NvBufferPool::Entry &
+NvBufferPool::markInUse(const Key &key)
+{
+    map<Key, Entry>::iterator it = entries.find(key);
+
+    if (it == entries.end())
+    {
+        Entry entry;
+
+        entry.in_use = 0;
+        entry.high_water = 0;
+        entry.allocations = 0;
+        entry.reuses = 0;
+        entry.buffer_size = key.size;
+        it = entries.insert(make_pair(key, entry)).first;
+    }
+
+    Entry &entry = it->second;
+    entry.in_use++;
+    if (entry.in_use > entry.high_water)
+        entry.high_water = entry.in_use;
+    return entry;
+}
+
+bool
+NvBufferPool::putIdle(const Key &key, uintptr_t handle)
+{
+    Entry &entry = entries[key];
+
+    entry.in_use--;
+    if (entry.idle.size() >= idle_limit)
+        return true;
+    entry.idle.push_back(handle);
+    return false;
+}
+
+void
+NvBufferPool::freeBuffer(const Key &key, uintptr_t handle)
+{
+    if (!key.dmabuf)
+    {
+        delete[] (unsigned char *) handle;
+        return;
+    }
+#ifndef NVBUFFERPOOL_CPU_ONLY
+    NvBufferDestroy((int) handle);
+#endif
+}
+
+int
+NvBufferPool::acquireMemory(uint32_t width, uint32_t height,
+        uint32_t bytesperpixel, uint32_t size, unsigned char **data)
+{
+    Key key;
+    uintptr_t handle;
+    unsigned char *mem;
+
+    key.dmabuf = false;
+    key.width = width;
+    key.height = height;
+    key.format = bytesperpixel;
+    key.layout = 0;
+    key.payload = 0;
+    key.size = size;
+
+    pthread_mutex_lock(&pool_lock);
+    if (takeIdle(key, &handle))
+    {
+        busy_memory[handle] = key;
+        pthread_mutex_unlock(&pool_lock);
+        *data = (unsigned char *) handle;
+        return 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    mem = new (nothrow) unsigned char[size];
+    if (!mem)
+    {
+        COMP_ERROR_MSG("Could not allocate " << size << " bytes");
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    markInUse(key).allocations++;
+    busy_memory[(uintptr_t) mem] = key;
+    pthread_mutex_unlock(&pool_lock);
+
+    COMP_DEBUG_MSG("Allocated " << size << " bytes for " << width << "x" <<
+            height);
+    *data = mem;
+    return 0;
+}
+
+int
+NvBufferPool::releaseMemory(unsigned char *data)
+{
+    bool free_it;
+    Key key;
+
+    pthread_mutex_lock(&pool_lock);
+    map<uintptr_t, Key>::iterator it = busy_memory.find((uintptr_t) data);
+    if (it == busy_memory.end())
+    {
+        pthread_mutex_unlock(&pool_lock);
+        COMP_ERROR_MSG("Memory " << (void *) data << " is not from this pool");
+        return -1;
+    }
+    key = it->second;
+    busy_memory.erase(it);
+    free_it = putIdle(key, (uintptr_t) data);
+    pthread_mutex_unlock(&pool_lock);
+
+    if (free_it)
+        freeBuffer(key, (uintptr_t) data);
+    return 0;
+}
+
+int
+NvBufferPool::acquireDmabuf(NvBufferCreateParams *params, int *fd)
+{
+#ifdef NVBUFFERPOOL_CPU_ONLY
+    COMP_ERROR_MSG("DMABUFs are not supported by this build");
+    return -1;
+#else
+    Key key;
+    uintptr_t handle;
+    NvBufferParams buf_params;
+    uint64_t size = 0;
+    int new_fd;
+
+    key.dmabuf = true;
+    key.width = params->width;
+    key.height = params->height;
+    key.format = params->colorFormat;
+    key.layout = params->layout;
+    key.payload = params->payloadType;
+    /* memsize is only read for MemHandle payloads, left over garbage must
+     * not split the key of surfaces */
+    key.size = (params->payloadType == NvBufferPayload_MemHandle) ?
+            (uint32_t) params->memsize : 0;
+
+    pthread_mutex_lock(&pool_lock);
+    if (takeIdle(key, &handle))
+    {
+        busy_dmabufs[(int) handle] = key;
+        pthread_mutex_unlock(&pool_lock);
+        *fd = (int) handle;
+        return 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (NvBufferCreateEx(&new_fd, params) < 0)
+    {
+        COMP_ERROR_MSG("Could not create " << params->width << "x" <<
+                params->height << " buffer, colorFormat " <<
+                params->colorFormat << ", layout " << params->layout);
+        return -1;
+    }
+    if (NvBufferGetParams(new_fd, &buf_params) == 0)
+    {
+        for (uint32_t i = 0; i < buf_params.num_planes; i++)
+            size += buf_params.psize[i];
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    Entry &entry = markInUse(key);
+    entry.allocations++;
+    entry.buffer_size = size;
+    busy_dmabufs[new_fd] = key;
+    pthread_mutex_unlock(&pool_lock);
+
+    COMP_DEBUG_MSG("Created " << params->width << "x" << params->height <<
+            " buffer, fd " << new_fd);
+    *fd = new_fd;
+    return 0;
+#endif
+}
+
+int
+NvBufferPool::releaseDmabuf(int fd)
+{
+    bool free_it;
+    Key key;
+
+    pthread_mutex_lock(&pool_lock);
+    map<int, Key>::iterator it = busy_dmabufs.find(fd);
+    if (it == busy_dmabufs.end())
+    {
+        pthread_mutex_unlock(&pool_lock);
+        COMP_ERROR_MSG("fd " << fd << " is not from this pool");
+        return -1;
+    }
+    key = it->second;
+    busy_dmabufs.erase(it);
+    free_it = putIdle(key, fd);
+    pthread_mutex_unlock(&pool_lock);
+
+    if (free_it)
+        freeBuffer(key, fd);
+    return 0;
+}
+
+void
+NvBufferPool::setIdleLimit(uint32_t max_idle)
+{
+    vector<pair<Key, uintptr_t> > excess;
+
+    pthread_mutex_lock(&pool_lock);
+    idle_limit = max_idle;
+    for (map<Key, Entry>::iterator it = entries.begin(); it != entries.end();
+            ++it)
+    {
+        vector<uintptr_t> &idle = it->second.idle;
+
+        while (idle.size() > idle_limit)
+        {
+            excess.push_back(make_pair(it->first, idle.back()));
+            idle.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    for (uint32_t i = 0; i < excess.size(); i++)
+        freeBuffer(excess[i].first, excess[i].second);
+}
+
+void
+NvBufferPool::trim()
+{
+    vector<pair<Key, uintptr_t> > idle;
+
+    pthread_mutex_lock(&pool_lock);
+    for (map<Key, Entry>::iterator it = entries.begin(); it != entries.end();)
+    {
+        Entry &entry = it->second;
+
+        for (uint32_t i = 0; i < entry.idle.size(); i++)
+            idle.push_back(make_pair(it->first, entry.idle[i]));
+        entry.idle.clear();
+        entry.high_water = entry.in_use;
+        if (entry.in_use == 0)
+            entries.erase(it++);
+        else
+            ++it;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    // Freeing the buffers may take a while, the pool stays usable meanwhile
+    for (uint32_t i = 0; i < idle.size(); i++)
+        freeBuffer(idle[i].first, idle[i].second);
+    if (!idle.empty())
+        COMP_DEBUG_MSG("Freed " << idle.size() << " idle buffers");
+}
+
+uint32_t
+NvBufferPool::getStats(NvBufferPoolStats *stats, uint32_t max_stats)
+{
+    uint32_t n = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (map<Key, Entry>::iterator it = entries.begin(); it != entries.end();
+            ++it, n++)
+    {
+        if (n >= max_stats)
+            continue;
+
+        const Key &key = it->first;
+        const Entry &entry = it->second;
+
+        stats[n].dmabuf = key.dmabuf;
+        stats[n].width = key.width;
+        stats[n].height = key.height;
+        stats[n].format = key.format;
+        stats[n].layout = key.layout;
+        stats[n].size = entry.buffer_size;
+        stats[n].in_use = entry.in_use;
+        stats[n].idle = entry.idle.size();
+        stats[n].high_water = entry.high_water;
+        stats[n].allocations = entry.allocations;
+        stats[n].reuses = entry.reuses;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return n;
+}
+
+uint64_t
+NvBufferPool::getTotalBytes()
+{
+    uint64_t bytes = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (map<Key, Entry>::iterator it = entries.begin(); it != entries.end();
+            ++it)
+    {
+        bytes += it->second.buffer_size *
+            (it->second.in_use + it->second.idle.size());
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return bytes;
+}
@@ -0,0 +1,527 @@
+#include "NvDQWorkerPool.h"
+#include "NvV4l2ElementPlane.h"
+#include "NvLogging.h"
+
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EPOLL_EVENTS 16
+
+/* epoll data of the eventfd, plane slots use generation << 32 | index */
+#define WAKE_ID UINT64_MAX
+
+#define SLOT_ID(index, generation) (((uint64_t) (generation) << 32) | (index))
+
+using namespace std;
+
+NvDQWorkerPool::NvDQWorkerPool(const char *name, uint32_t num_workers,
+        const NvThreadPolicy *policy)
+    :comp_name(name),
+     slots(MAX_DQ_POOL_PLANES)
+{
+    struct epoll_event ev;
+
+    is_in_error = 0;
+    stopping = false;
+    num_planes = 0;
+    epoll_fd = -1;
+    wake_fd = -1;
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&pool_cond, NULL);
+
+    for (uint32_t i = 0; i < slots.size(); i++)
+    {
+        memset(&slots[i], 0, sizeof(Slot));
+        slots[i].fd = -1;
+        slots[i].state = SLOT_FREE;
+    }
+
+    if (policy)
+        worker_policy = *policy;
+    else
+        nv_thread_policy_init(&worker_policy);
+    if (!worker_policy.name[0])
+        strncpy(worker_policy.name, name, sizeof(worker_policy.name) - 1);
+
+    if (num_workers == 0)
+    {
+        COMP_ERROR_MSG("At least one worker is needed");
+        is_in_error = 1;
+        return;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not create epoll instance");
+        is_in_error = 1;
+        return;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not create eventfd");
+        is_in_error = 1;
+        return;
+    }
+
+    // Level triggered, so that every worker sees it once the pool stops
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_ID;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not add eventfd to epoll instance");
+        is_in_error = 1;
+        return;
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++)
+    {
+        pthread_t worker;
+
+        if (pthread_create(&worker, NULL, workerThread, this))
+        {
+            COMP_ERROR_MSG("Could not create worker " << i);
+            is_in_error = 1;
+            return;
+        }
+        workers.push_back(worker);
+    }
+    COMP_DEBUG_MSG("Started " << num_workers << " DQ workers");
+}
+
+NvDQWorkerPool *
+NvDQWorkerPool::createDQWorkerPool(const char *name, uint32_t num_workers,
+        const NvThreadPolicy *policy)
+{
+    NvDQWorkerPool *pool = new NvDQWorkerPool(name, num_workers, policy);
+    if (pool->isInError())
+    {
+        delete pool;
+        return NULL;
+    }
+    return pool;
+}
+
+NvDQWorkerPool::~NvDQWorkerPool()
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&pool_lock);
+    stopping = true;
+    pthread_mutex_unlock(&pool_lock);
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not wake the workers");
+    }
+    for (uint32_t i = 0; i < workers.size(); i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    if (num_planes)
+    {
+        COMP_WARN_MSG(num_planes << " planes still attached");
+    }
+    for (uint32_t i = 0; i < slots.size(); i++)
+    {
+        if (slots[i].state != SLOT_FREE)
+        {
+            NvV4l2ElementPlane *plane = slots[i].plane;
+
+            plane->dq_pool_slot = -1;
+            plane->dq_pool = NULL;
+            close(slots[i].fd);
+            finishPlane(plane);
+        }
+    }
+
+    if (wake_fd >= 0)
+        close(wake_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    pthread_mutex_destroy(&pool_lock);
+    pthread_cond_destroy(&pool_cond);
+}
+
+uint32_t
+NvDQWorkerPool::getNumPlanes()
+{
+    uint32_t ret;
+
+    pthread_mutex_lock(&pool_lock);
+    ret = num_planes;
+    pthread_mutex_unlock(&pool_lock);
+    return ret;
+}
+
+int
+NvDQWorkerPool::addPlane(NvV4l2ElementPlane *plane)
+{
+    struct epoll_event ev;
+    uint32_t index;
+    int fd;
+
+    pthread_mutex_lock(&pool_lock);
+    for (index = 0; index < slots.size(); index++)
+    {
+        if (slots[index].state == SLOT_FREE)
+            break;
+    }
+    if (index == slots.size())
+    {
+        pthread_mutex_unlock(&pool_lock);
+        COMP_ERROR_MSG("No free slot for " << plane->comp_name << " " <<
+                plane->plane_name);
+        return -1;
+    }
+
+    // Both planes share the element FD. epoll keys its entries on the FD,
+    // so each plane registers a duplicate with its own events.
+    fd = dup(plane->fd);
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&pool_lock);
+        COMP_SYS_ERROR_MSG("Could not duplicate FD of " << plane->comp_name);
+        return -1;
+    }
+
+    Slot &slot = slots[index];
+    slot.plane = plane;
+    slot.fd = fd;
+    slot.events = (plane->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ?
+        EPOLLIN : EPOLLOUT;
+    slot.kicked = false;
+    slot.remove = false;
+    slot.streamoff = false;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = slot.events | EPOLLONESHOT;
+    ev.data.u64 = SLOT_ID(index, slot.generation);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        pthread_mutex_unlock(&pool_lock);
+        COMP_SYS_ERROR_MSG("Could not poll " << plane->comp_name << " " <<
+                plane->plane_name);
+        close(fd);
+        slot.fd = -1;
+        slot.plane = NULL;
+        return -1;
+    }
+    slot.state = SLOT_ARMED;
+    plane->dq_pool_slot = index;
+    num_planes++;
+    pthread_mutex_unlock(&pool_lock);
+
+    COMP_DEBUG_MSG("Attached " << plane->comp_name << " " << plane->plane_name);
+    return 0;
+}
+
+int
+NvDQWorkerPool::removePlane(NvV4l2ElementPlane *plane)
+{
+    int index;
+
+    pthread_mutex_lock(&pool_lock);
+    index = plane->dq_pool_slot;
+    if (index < 0 || slots[index].plane != plane)
+    {
+        pthread_mutex_unlock(&pool_lock);
+        return 0;
+    }
+
+    Slot &slot = slots[index];
+    if (slot.state == SLOT_BUSY && pthread_equal(slot.worker, pthread_self()))
+    {
+        // Called from the plane's own callback, the worker finishes the job
+        slot.remove = true;
+        pthread_mutex_unlock(&pool_lock);
+        return 0;
+    }
+
+    uint32_t generation = slot.generation;
+    while (slot.state == SLOT_BUSY)
+    {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    if (slot.generation != generation)
+    {
+        // The worker released it while we waited
+        pthread_mutex_unlock(&pool_lock);
+        return 0;
+    }
+    releaseSlot(index);
+    pthread_mutex_unlock(&pool_lock);
+
+    finishPlane(plane);
+    return 0;
+}
+
+void
+NvDQWorkerPool::kickPlane(NvV4l2ElementPlane *plane, bool streamoff)
+{
+    int index;
+
+    pthread_mutex_lock(&pool_lock);
+    index = plane->dq_pool_slot;
+    if (index >= 0 && slots[index].plane == plane)
+    {
+        Slot &slot = slots[index];
+
+        if (streamoff)
+            slot.streamoff = true;
+        switch (slot.state)
+        {
+            case SLOT_ARMED:
+            case SLOT_PARKED:
+                // A stale FD event for an ARMED slot is dropped by service()
+                queuePending(index);
+                break;
+            case SLOT_BUSY:
+                slot.kicked = true;
+                break;
+            default:
+                break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void
+NvDQWorkerPool::releaseSlot(uint32_t index)
+{
+    Slot &slot = slots[index];
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, slot.fd, NULL);
+    close(slot.fd);
+    slot.plane->dq_pool_slot = -1;
+    slot.plane = NULL;
+    slot.fd = -1;
+    slot.generation++;
+    slot.state = SLOT_FREE;
+    num_planes--;
+}
+
+void
+NvDQWorkerPool::queuePending(uint32_t index)
+{
+    uint64_t one = 1;
+
+    slots[index].state = SLOT_PENDING;
+    pending.push_back(SLOT_ID(index, slots[index].generation));
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        COMP_SYS_ERROR_MSG("Could not wake the workers");
+    }
+}
+
+void
+NvDQWorkerPool::finishPlane(NvV4l2ElementPlane *plane)
+{
+    pthread_mutex_lock(&plane->plane_lock);
+    plane->dq_parked = false;
+    plane->dqthread_running = false;
+    pthread_cond_broadcast(&plane->plane_cond);
+    pthread_mutex_unlock(&plane->plane_lock);
+}
+
+bool
+NvDQWorkerPool::dispatch(NvV4l2ElementPlane *plane, uint32_t events)
+{
+    // Set up once per worker, the DQ ioctl fills in everything but the
+    // fields reset below
+    static __thread struct v4l2_buffer v4l2_bufs[MAX_DQ_BATCH];
+    static __thread struct v4l2_plane planes[MAX_DQ_BATCH][MAX_PLANES];
+    static __thread NvBuffer *buffers[MAX_DQ_BATCH];
+    static __thread NvBuffer *shared_buffers[MAX_DQ_BATCH];
+    uint32_t max_count = plane->batch_callback ? MAX_DQ_BATCH : 1;
+    int count;
+
+    // Only a ready FD guarantees that a blocking element does not block
+    if (!(events & (EPOLLIN | EPOLLOUT)))
+    {
+        bool idle;
+
+        if (!(events & (EPOLLERR | EPOLLHUP)))
+            return true;
+
+        // Expected while the plane is off or has nothing queued, the
+        // caller parks it. Otherwise the queue is in error.
+        pthread_mutex_lock(&plane->plane_lock);
+        idle = !plane->streamon || plane->num_queued_buffers == 0;
+        pthread_mutex_unlock(&plane->plane_lock);
+        if (idle)
+            return true;
+
+        plane->is_in_error = 1;
+        if (plane->batch_callback)
+            return plane->batch_callback(NULL, NULL, NULL, 0, plane->dqThread_data);
+        return plane->callback(NULL, NULL, NULL, plane->dqThread_data);
+    }
+
+    for (uint32_t i = 0; i < max_count; i++)
+    {
+        v4l2_bufs[i].m.planes = planes[i];
+        v4l2_bufs[i].length = plane->n_planes;
+        v4l2_bufs[i].flags = 0;
+        shared_buffers[i] = NULL;
+    }
+
+    // One retry keeps a spurious EAGAIN of a non-blocking element quiet
+    count = plane->dqBuffers(v4l2_bufs, buffers, shared_buffers, max_count, 1);
+    if (count < 0)
+    {
+        if (errno == EAGAIN)
+            return true;
+        plane->is_in_error = 1;
+        if (plane->batch_callback)
+            return plane->batch_callback(NULL, NULL, NULL, 0, plane->dqThread_data);
+        return plane->callback(NULL, NULL, NULL, plane->dqThread_data);
+    }
+
+    if (plane->batch_callback)
+        return plane->batch_callback(v4l2_bufs, buffers, shared_buffers, count,
+                plane->dqThread_data);
+    return plane->callback(&v4l2_bufs[0], buffers[0], shared_buffers[0],
+            plane->dqThread_data);
+}
+
+void
+NvDQWorkerPool::service(uint64_t id, uint32_t events)
+{
+    uint32_t index = (uint32_t) id;
+    uint32_t generation = (uint32_t) (id >> 32);
+    NvV4l2ElementPlane *plane;
+    bool keep;
+    bool park = false;
+
+    pthread_mutex_lock(&pool_lock);
+    Slot &slot = slots[index];
+    if (slot.generation != generation ||
+            slot.state != (events ? SLOT_ARMED : SLOT_PENDING))
+    {
+        pthread_mutex_unlock(&pool_lock);
+        return;
+    }
+    slot.state = SLOT_BUSY;
+    slot.worker = pthread_self();
+    slot.kicked = false;
+    plane = slot.plane;
+    pthread_mutex_unlock(&pool_lock);
+
+    keep = dispatch(plane, events);
+
+    // The plane lock is taken before the pool lock, as in kickPlane()
+    pthread_mutex_lock(&plane->plane_lock);
+    if (keep && (!plane->streamon || plane->num_queued_buffers == 0))
+    {
+        plane->dq_parked = true;
+        park = true;
+    }
+    pthread_mutex_unlock(&plane->plane_lock);
+
+    pthread_mutex_lock(&pool_lock);
+    if (!keep || slot.remove || slot.streamoff)
+    {
+        releaseSlot(index);
+        pthread_cond_broadcast(&pool_cond);
+        pthread_mutex_unlock(&pool_lock);
+        finishPlane(plane);
+        return;
+    }
+
+    if (slot.kicked)
+    {
+        queuePending(index);
+    }
+    else if (park)
+    {
+        slot.state = SLOT_PARKED;
+    }
+    else
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = slot.events | EPOLLONESHOT;
+        ev.data.u64 = SLOT_ID(index, slot.generation);
+        slot.state = SLOT_ARMED;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, slot.fd, &ev) < 0)
+        {
+            COMP_SYS_ERROR_MSG("Could not re-arm " << plane->comp_name << " " <<
+                    plane->plane_name);
+            plane->is_in_error = 1;
+            releaseSlot(index);
+            pthread_cond_broadcast(&pool_cond);
+            pthread_mutex_unlock(&pool_lock);
+            finishPlane(plane);
+            return;
+        }
+    }
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void *
+NvDQWorkerPool::workerThread(void *data)
+{
+    NvDQWorkerPool *pool = (NvDQWorkerPool *) data;
+    const char *comp_name = pool->comp_name;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    vector<uint64_t> pending;
+
+    if (!nv_thread_policy_is_default(&pool->worker_policy) &&
+            nv_thread_policy_apply(&pool->worker_policy) < 0)
+    {
+        COMP_WARN_MSG("Could not apply DQ worker policy: " << strerror(errno));
+    }
+
+    for (;;)
+    {
+        int n = epoll_wait(pool->epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            COMP_SYS_ERROR_MSG("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.u64 != WAKE_ID)
+            {
+                pool->service(events[i].data.u64, events[i].events);
+                continue;
+            }
+
+            uint64_t value;
+
+            pthread_mutex_lock(&pool->pool_lock);
+            if (pool->stopping)
+            {
+                // Leave the eventfd readable for the other workers
+                pthread_mutex_unlock(&pool->pool_lock);
+                return NULL;
+            }
+            if (read(pool->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            {
+                COMP_SYS_ERROR_MSG("Could not read eventfd");
+            }
+            pending.swap(pool->pending);
+            pthread_mutex_unlock(&pool->pool_lock);
+
+            for (uint32_t j = 0; j < pending.size(); j++)
+            {
+                pool->service(pending[j], 0);
+            }
+            pending.clear();
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,229 @@
+#include "NvDemuxer.h"
+#include "NvLogging.h"
+
+#include <string.h>
+
+#define MICROSECONDS 1000000ULL
+#define TS_SYNC_BYTE 0x47
+#define M2TS_HEADER_SIZE 4
+
+using namespace std;
+
+static const char *comp_name = "NvDemuxer";
+
+static void
+append_nalu(vector<uint8_t> &config, const uint8_t *data, size_t size)
+{
+    static const uint8_t start_code[] = { 0, 0, 0, 1 };
+
+    config.insert(config.end(), start_code, start_code + sizeof(start_code));
+    config.insert(config.end(), data, data + size);
+}
+
+/**
+ * Appends @a count NAL units that are each preceded by a 16-bit length.
+ *
+ * @return Bytes of @a data used, or 0 if the units overrun it.
+ */
+static size_t
+append_nalu_array(vector<uint8_t> &config, const uint8_t *data, size_t size,
+        uint32_t count)
+{
+    size_t pos = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t len;
+
+        if (size - pos < 2)
+            return 0;
+        len = (data[pos] << 8) | data[pos + 1];
+        pos += 2;
+        if (len > size - pos)
+            return 0;
+        append_nalu(config, data + pos, len);
+        pos += len;
+    }
+    return pos;
+}
+
+NvDemuxer *
+NvDemuxer::createDemuxer(const char *path)
+{
+    NvBitstreamSource *source = NvBitstreamSource::createBitstreamSource(path);
+    const uint8_t *head;
+
+    if (!source)
+        return NULL;
+
+    head = source->peek(8);
+    if (head && (!memcmp(head + 4, "ftyp", 4) || !memcmp(head + 4, "moov", 4)))
+        return createMp4Demuxer(source);
+    if (head && !memcmp(head, "\x1a\x45\xdf\xa3", 4))
+        return createMkvDemuxer(source);
+    // The TS demuxer checks more than the first sync byte
+    if (head && (head[0] == TS_SYNC_BYTE || head[M2TS_HEADER_SIZE] == TS_SYNC_BYTE))
+        return createTsDemuxer(source);
+
+    COMP_ERROR_MSG(path << " is not an MP4, Matroska or MPEG-TS file");
+    delete source;
+    return NULL;
+}
+
+NvDemuxer::NvDemuxer(NvBitstreamSource *source)
+    : source(source), codec(NV_DEMUXER_CODEC_UNKNOWN), width(0), height(0),
+      duration(0), config_pending(true), nal_length_size(0)
+{
+}
+
+NvDemuxer::~NvDemuxer()
+{
+    delete source;
+}
+
+bool
+NvDemuxer::parseAvcConfig(const uint8_t *data, size_t size)
+{
+    size_t pos = 6;
+    size_t used;
+
+    // configurationVersion, profile, compatibility, level, lengthSizeMinusOne
+    // and numOfSequenceParameterSets
+    if (size < 7 || data[0] != 1)
+        return false;
+    nal_length_size = (data[4] & 0x03) + 1;
+    if (nal_length_size == 3)
+        return false;
+
+    codec_config.clear();
+    used = append_nalu_array(codec_config, data + pos, size - pos,
+            data[5] & 0x1f);
+    if (!used && (data[5] & 0x1f))
+        return false;
+    pos += used;
+
+    if (pos >= size)
+        return false;
+    used = append_nalu_array(codec_config, data + pos + 1, size - pos - 1,
+            data[pos]);
+    return used || !data[pos];
+}
+
+bool
+NvDemuxer::parseHevcConfig(const uint8_t *data, size_t size)
+{
+    size_t pos = 23;
+    uint32_t num_arrays;
+
+    // The NAL unit arrays follow 22 bytes of profile, tier and format fields
+    // and numOfArrays
+    if (size < 23 || data[0] != 1)
+        return false;
+    nal_length_size = (data[21] & 0x03) + 1;
+    if (nal_length_size == 3)
+        return false;
+    num_arrays = data[22];
+
+    codec_config.clear();
+    for (uint32_t i = 0; i < num_arrays; i++)
+    {
+        uint32_t count;
+        size_t used;
+
+        // array_completeness and NAL_unit_type, then numNalus
+        if (size - pos < 3)
+            return false;
+        count = (data[pos + 1] << 8) | data[pos + 2];
+        pos += 3;
+        used = append_nalu_array(codec_config, data + pos, size - pos, count);
+        if (!used && count)
+            return false;
+        pos += used;
+    }
+    return true;
+}
+
+ssize_t
+NvDemuxer::writeSample(const uint8_t *data, size_t size, uint8_t *dst,
+        size_t dst_size)
+{
+    size_t written = 0;
+    size_t pos = 0;
+
+    if (config_pending && !codec_config.empty())
+    {
+        if (codec_config.size() > dst_size)
+        {
+            COMP_ERROR_MSG("Codec config of " << codec_config.size() <<
+                    " bytes does not fit the buffer");
+            return -1;
+        }
+        memcpy(dst, &codec_config[0], codec_config.size());
+        written = codec_config.size();
+    }
+
+    if (!nal_length_size)
+    {
+        if (size > dst_size - written)
+        {
+            COMP_ERROR_MSG("Frame of " << size << " bytes does not fit the buffer");
+            return -1;
+        }
+        memcpy(dst + written, data, size);
+        written += size;
+    }
+
+    // Length prefixed NAL units, each prefix becomes a 4-byte start code
+    while (nal_length_size && pos < size)
+    {
+        size_t len;
+
+        if (size - pos < nal_length_size)
+        {
+            COMP_ERROR_MSG("Truncated NAL unit length in frame");
+            return -1;
+        }
+        len = readBigEndian(data + pos, nal_length_size);
+        pos += nal_length_size;
+        if (len > size - pos)
+        {
+            COMP_ERROR_MSG("NAL unit of " << len << " bytes overruns its frame");
+            return -1;
+        }
+        if (len + 4 > dst_size - written)
+        {
+            COMP_ERROR_MSG("Frame does not fit the buffer");
+            return -1;
+        }
+        dst[written] = 0;
+        dst[written + 1] = 0;
+        dst[written + 2] = 0;
+        dst[written + 3] = 1;
+        memcpy(dst + written + 4, data + pos, len);
+        written += len + 4;
+        pos += len;
+    }
+
+    config_pending = false;
+    return written;
+}
+
+uint64_t
+NvDemuxer::toMicroseconds(uint64_t time, uint64_t timescale)
+{
+    if (!timescale)
+        return 0;
+    // Split so that long tracks with fine timescales do not overflow
+    return time / timescale * MICROSECONDS +
+        time % timescale * MICROSECONDS / timescale;
+}
+
+uint64_t
+NvDemuxer::readBigEndian(const uint8_t *data, size_t len)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < len; i++)
+        value = (value << 8) | data[i];
+    return value;
+}
@@ -50,6 +50,12 @@ bool NvElement::isProfilingEnabled()
     return profiler.enabled;
 }
 
+uint32_t NvElement::getLatencyHistogram(uint64_t *counts,
+        uint64_t *upper_bounds_usec, uint32_t max_buckets)
+{
+    return profiler.getLatencyHistogram(counts, upper_bounds_usec, max_buckets);
+}
+
 NvElement::NvElement(const char *name, NvElementProfiler::ProfilerField fields)
     :profiler(fields)
 {
@@ -28,8 +28,8 @@
 
 #include <iostream>
 #include <string.h>
-#include <map>
 #include <stdint.h>
+#include <time.h>
 #include "NvElementProfiler.h"
 
 #define LOCK() pthread_mutex_lock(&profiler_lock)
@@ -41,19 +41,92 @@
         return; \
     }
 
-#define GET_TIME(timeval) gettimeofday(timeval, NULL);
-
-#define TIMESPEC_DIFF_USEC(timespec1, timespec2) \
-    (((timespec1)->tv_sec - (timespec2)->tv_sec) * 1000000L + \
-        (timespec1)->tv_usec - (timespec2)->tv_usec)
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_EXPONENT 39
 
 using namespace std;
 
+static atomic<unsigned int> next_shard(0);
+static thread_local int thread_shard = -1;
+
+static inline uint64_t
+get_time_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Counter set of the calling thread, assigned round robin on first use */
+static inline int
+get_shard()
+{
+    if (thread_shard < 0)
+    {
+        thread_shard = next_shard.fetch_add(1, memory_order_relaxed) %
+            PROFILER_SHARDS;
+    }
+    return thread_shard;
+}
+
+static inline uint32_t
+histogram_bucket(uint64_t usec)
+{
+    uint32_t exponent;
+
+    if (usec < HISTOGRAM_SUB_BUCKETS)
+        return usec;
+
+    exponent = 63 - __builtin_clzll(usec);
+    if (exponent > HISTOGRAM_MAX_EXPONENT)
+        return PROFILER_HISTOGRAM_BUCKETS - 1;
+    return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS +
+        ((usec >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Largest latency counted in a bucket */
+static inline uint64_t
+histogram_upper_bound(uint32_t bucket)
+{
+    uint32_t shift;
+    uint64_t sub;
+
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static inline void
+store_min(atomic<uint64_t> &value, uint64_t sample)
+{
+    uint64_t current = value.load(memory_order_relaxed);
+
+    while (sample < current &&
+            !value.compare_exchange_weak(current, sample, memory_order_relaxed))
+        ;
+}
+
+static inline void
+store_max(atomic<uint64_t> &value, uint64_t sample)
+{
+    uint64_t current = value.load(memory_order_relaxed);
+
+    while (sample > current &&
+            !value.compare_exchange_weak(current, sample, memory_order_relaxed))
+        ;
+}
+
 NvElementProfiler::NvElementProfiler(ProfilerField fields)
     :valid_fields(fields)
 {
     enabled = false;
     unit_id_counter = 0;
+    finished_id = 0;
 
     reset();
 
@@ -62,11 +135,9 @@ NvElementProfiler::NvElementProfiler(ProfilerField fields)
 
 NvElementProfiler::~NvElementProfiler()
 {
-    LOCK();
-    reset();
-    UNLOCK();
     pthread_mutex_destroy(&profiler_lock);
 }
+
 void
 NvElementProfiler::enableProfiling(bool reset_data)
 {
@@ -89,42 +160,88 @@ NvElementProfiler::enableProfiling(bool reset_data)
 void
 NvElementProfiler::disableProfiling()
 {
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+
     LOCK();
     RETURN_IF_DISABLED();
 
-    data_int.accumulated_time.tv_sec +=
-        (data_int.stop_time.tv_sec - data_int.start_time.tv_sec);
-    data_int.accumulated_time.tv_usec +=
-        (data_int.stop_time.tv_usec - data_int.start_time.tv_usec);
-    data_int.start_time.tv_sec = 0;
-    data_int.start_time.tv_usec = 0;
-    data_int.stop_time.tv_sec = 0;
-    data_int.stop_time.tv_usec = 0;
     enabled = false;
+    for (int i = 0; i < PROFILER_SHARDS; i++)
+    {
+        uint64_t shard_first = shards[i].first_nsec.exchange(0);
+        uint64_t shard_last = shards[i].last_nsec.exchange(0);
+
+        if (shard_first && shard_first < first)
+            first = shard_first;
+        if (shard_last > last)
+            last = shard_last;
+    }
+    if (last)
+        accumulated_nsec += last - first;
     UNLOCK();
 }
 
 void NvElementProfiler::getProfilerData(NvElementProfiler::NvElementProfilerData &data)
 {
+    uint64_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+    uint64_t units = 0, late_units = 0, dropped = 0, samples = 0;
+    uint64_t total_latency = 0, min_latency = UINT64_MAX, max_latency = 0;
+    uint64_t first = UINT64_MAX, last = 0;
     uint64_t total_time;
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t *percentile_fields[] = { &data.p50_latency_usec,
+        &data.p90_latency_usec, &data.p99_latency_usec,
+        &data.p999_latency_usec };
+
+    memset(histogram, 0, sizeof(histogram));
 
     LOCK();
+    for (int i = 0; i < PROFILER_SHARDS; i++)
+    {
+        Shard &shard = shards[i];
+        uint64_t shard_first = shard.first_nsec.load(memory_order_relaxed);
+        uint64_t shard_last = shard.last_nsec.load(memory_order_relaxed);
+
+        units += shard.units.load(memory_order_relaxed);
+        late_units += shard.late_units.load(memory_order_relaxed);
+        dropped += shard.dropped_samples.load(memory_order_relaxed);
+        total_latency += shard.total_latency_usec.load(memory_order_relaxed);
+        if (shard.min_latency_usec.load(memory_order_relaxed) < min_latency)
+            min_latency = shard.min_latency_usec.load(memory_order_relaxed);
+        if (shard.max_latency_usec.load(memory_order_relaxed) > max_latency)
+            max_latency = shard.max_latency_usec.load(memory_order_relaxed);
+        if (shard_first && shard_first < first)
+            first = shard_first;
+        if (shard_last > last)
+            last = shard_last;
+        for (int j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++)
+        {
+            uint64_t count = shard.histogram[j].load(memory_order_relaxed);
 
-    total_time = data_int.accumulated_time.tv_sec * 1000000L +
-        data_int.accumulated_time.tv_usec +
-        TIMESPEC_DIFF_USEC(&data_int.stop_time, &data_int.start_time);
+            histogram[j] += count;
+            samples += count;
+        }
+    }
+    total_time = accumulated_nsec;
+    if (last && last > first)
+        total_time += last - first;
+    UNLOCK();
 
-    if (data_int.total_processed_units == 0 || total_time == 0)
+    total_time /= 1000;
+    if (units == 0 || total_time == 0)
     {
         data.average_fps = 0;
     }
     else
     {
-        data.average_fps = ((float) (data_int.total_processed_units - 1)) *
-            1000000 / total_time;
+        data.average_fps = ((float) (units - 1)) * 1000000 / total_time;
     }
 
-    if (data_int.total_processed_units == 0)
+    for (int i = 0; i < 4; i++)
+        *percentile_fields[i] = 0;
+
+    if (samples == 0)
     {
         data.max_latency_usec = 0;
         data.min_latency_usec = 0;
@@ -132,36 +249,60 @@ void NvElementProfiler::getProfilerData(NvElementProfiler::NvElementProfilerData
     }
     else
     {
-        data.max_latency_usec = data_int.max_latency_usec;
-        data.min_latency_usec = data_int.min_latency_usec;
-        data.average_latency_usec =
-            data_int.total_latency / data_int.total_processed_units;
+        data.max_latency_usec = max_latency;
+        data.min_latency_usec = min_latency;
+        data.average_latency_usec = total_latency / samples;
+
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t rank = (uint64_t) (percentiles[i] * samples + 0.999999);
+            uint64_t seen = 0;
+
+            for (int j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++)
+            {
+                seen += histogram[j];
+                if (seen >= rank)
+                {
+                    *percentile_fields[i] = histogram_upper_bound(j);
+                    break;
+                }
+            }
+            if (*percentile_fields[i] > max_latency)
+                *percentile_fields[i] = max_latency;
+        }
     }
 
-    data.profiling_time.tv_sec =
-        data_int.accumulated_time.tv_sec + data_int.stop_time.tv_sec -
-                data_int.start_time.tv_sec;
+    data.profiling_time.tv_sec = total_time / 1000000;
+    data.profiling_time.tv_usec = total_time % 1000000;
 
-    data.profiling_time.tv_usec =
-        data_int.accumulated_time.tv_usec + data_int.stop_time.tv_usec -
-                data_int.start_time.tv_usec;
+    data.total_processed_units = units;
+    data.num_late_units = late_units;
+    data.num_dropped_samples = dropped;
+    data.valid_fields = valid_fields;
+}
 
-    if (data.profiling_time.tv_usec < 0)
-    {
-        data.profiling_time.tv_usec += 1000000;
-        data.profiling_time.tv_sec--;
-    }
+uint32_t
+NvElementProfiler::getLatencyHistogram(uint64_t *counts,
+        uint64_t *upper_bounds_usec, uint32_t max_buckets)
+{
+    uint32_t used = 0;
 
-    if (data.profiling_time.tv_usec > 1000000)
+    if (max_buckets > PROFILER_HISTOGRAM_BUCKETS)
+        max_buckets = PROFILER_HISTOGRAM_BUCKETS;
+
+    LOCK();
+    for (uint32_t j = 0; j < max_buckets; j++)
     {
-        data.profiling_time.tv_usec -= 1000000;
-        data.profiling_time.tv_sec++;
+        counts[j] = 0;
+        for (int i = 0; i < PROFILER_SHARDS; i++)
+            counts[j] += shards[i].histogram[j].load(memory_order_relaxed);
+        if (upper_bounds_usec)
+            upper_bounds_usec[j] = histogram_upper_bound(j);
+        if (counts[j])
+            used = j + 1;
     }
-
-    data.total_processed_units = data_int.total_processed_units;
-    data.num_late_units = data_int.num_late_units;
-    data.valid_fields = valid_fields;
     UNLOCK();
+    return used;
 }
 
 void NvElementProfiler::printProfilerData(ostream &out_stream)
@@ -194,105 +335,151 @@ void NvElementProfiler::printProfilerData(ostream &out_stream)
             data.min_latency_usec << endl;
         out_stream << "Maximum latency(usec) = " <<
             data.max_latency_usec << endl;
+        out_stream << "Latency p50/p90/p99/p99.9(usec) = " <<
+            data.p50_latency_usec << "/" << data.p90_latency_usec << "/" <<
+            data.p99_latency_usec << "/" << data.p999_latency_usec << endl;
+        if (data.num_dropped_samples)
+        {
+            out_stream << "Units without latency sample = " <<
+                data.num_dropped_samples << endl;
+        }
     }
 }
 
 void
 NvElementProfiler::reset()
 {
-    memset(&data_int, 0, sizeof(data_int));
-    data_int.min_latency_usec = (uint64_t) -1;
+    for (int i = 0; i < PROFILER_SHARDS; i++)
+    {
+        Shard &shard = shards[i];
+
+        shard.units = 0;
+        shard.late_units = 0;
+        shard.dropped_samples = 0;
+        shard.total_latency_usec = 0;
+        shard.min_latency_usec = UINT64_MAX;
+        shard.max_latency_usec = 0;
+        shard.first_nsec = 0;
+        shard.last_nsec = 0;
+        for (int j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++)
+            shard.histogram[j] = 0;
+    }
+    for (int i = 0; i < PROFILER_RING_SIZE; i++)
+    {
+        unit_ring[i].id = 0;
+        unit_ring[i].start_nsec = 0;
+    }
+    finished_id = unit_id_counter.load();
+    accumulated_nsec = 0;
+}
+
+void
+NvElementProfiler::recordUnit(uint64_t now_nsec, int64_t latency_usec,
+        bool is_late)
+{
+    Shard &shard = shards[get_shard()];
 
-    unit_start_time_queue.clear();
+    if (latency_usec >= 0)
+    {
+        shard.total_latency_usec.fetch_add(latency_usec, memory_order_relaxed);
+        store_min(shard.min_latency_usec, latency_usec);
+        store_max(shard.max_latency_usec, latency_usec);
+        shard.histogram[histogram_bucket(latency_usec)].fetch_add(1,
+                memory_order_relaxed);
+    }
+    else if (valid_fields & PROFILER_FIELD_LATENCIES)
+    {
+        shard.dropped_samples.fetch_add(1, memory_order_relaxed);
+    }
+
+    if (is_late)
+    {
+        shard.late_units.fetch_add(1, memory_order_relaxed);
+    }
+    shard.units.fetch_add(1, memory_order_relaxed);
+
+    if (shard.first_nsec.load(memory_order_relaxed) == 0)
+    {
+        uint64_t zero = 0;
+        shard.first_nsec.compare_exchange_strong(zero, now_nsec,
+                memory_order_relaxed);
+    }
+    // Only read under the lock, a racing store may keep a slightly older time
+    if (now_nsec > shard.last_nsec.load(memory_order_relaxed))
+        shard.last_nsec.store(now_nsec, memory_order_relaxed);
 }
 
 uint64_t
 NvElementProfiler::startProcessing()
 {
-    struct timeval time;
-    uint64_t ret = 0;
-    LOCK();
-    if (enabled)
+    uint64_t id;
+
+    if (!enabled.load(memory_order_relaxed))
     {
-        std::map<uint64_t,struct timeval>::iterator it =
-            unit_start_time_queue.end();
+        return 0;
+    }
 
-        unit_id_counter++;
-        GET_TIME(&time);
+    id = unit_id_counter.fetch_add(1, memory_order_relaxed) + 1;
 
-        unit_start_time_queue.insert(it,
-                std::pair<uint64_t,struct timeval>(unit_id_counter, time));
+    // Invalidate the slot before the new start time lands, so that a
+    // finishProcessing() reading it concurrently fails to claim it
+    UnitSlot &slot = unit_ring[id % PROFILER_RING_SIZE];
+    slot.id.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.start_nsec.store(get_time_nsec(), memory_order_relaxed);
+    slot.id.store(id, memory_order_release);
 
-        ret = unit_id_counter;
-    }
-    UNLOCK();
-    return ret;
+    return id;
 }
 
 void
 NvElementProfiler::finishProcessing(uint64_t id, bool is_late)
 {
-    struct timeval unit_start_time;
-    struct timeval stop_time;
-    uint64_t latency;
+    uint64_t stop_time;
+    int64_t latency = -1;
 
-    LOCK();
-    RETURN_IF_DISABLED();
-
-    if ((valid_fields & PROFILER_FIELD_LATENCIES) &&
-            unit_start_time_queue.empty())
+    if (!enabled.load(memory_order_relaxed))
     {
-        UNLOCK();
         return;
     }
 
-    GET_TIME(&stop_time);
-
     if (valid_fields & PROFILER_FIELD_LATENCIES)
     {
-        std::map<uint64_t, struct timeval>::iterator it;
-        if (id)
+        if (!id)
         {
-            it = unit_start_time_queue.find(id);
-        }
-        else
-        {
-            it = unit_start_time_queue.begin();
+            // Oldest unit not yet picked, nothing to do if none is in flight
+            uint64_t last = finished_id.load(memory_order_relaxed);
+            do
+            {
+                if (last >= unit_id_counter.load(memory_order_acquire))
+                {
+                    return;
+                }
+            } while (!finished_id.compare_exchange_weak(last, last + 1,
+                        memory_order_relaxed));
+            id = last + 1;
         }
 
-        if (it == unit_start_time_queue.end())
-        {
-            UNLOCK();
-            return;
-        }
-        unit_start_time = it->second;
-        unit_start_time_queue.erase(it);
-
-        latency = TIMESPEC_DIFF_USEC(&stop_time, &unit_start_time);
-        data_int.total_latency += latency;
+        stop_time = get_time_nsec();
 
-        if (latency < data_int.min_latency_usec)
-        {
-            data_int.min_latency_usec = latency;
-        }
-        if(latency > data_int.max_latency_usec)
+        UnitSlot &slot = unit_ring[id % PROFILER_RING_SIZE];
+        uint64_t slot_id = slot.id.load(memory_order_acquire);
+        if (slot_id == id)
         {
-            data_int.max_latency_usec = latency;
+            uint64_t start_time = slot.start_nsec.load(memory_order_relaxed);
+
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.id.compare_exchange_strong(slot_id, 0,
+                        memory_order_relaxed) && stop_time >= start_time)
+            {
+                latency = (stop_time - start_time) / 1000;
+            }
         }
     }
-
-    data_int.stop_time = stop_time;
-
-    if (!data_int.start_time.tv_sec && !data_int.start_time.tv_usec)
-    {
-        data_int.start_time = data_int.stop_time;
-    }
-
-    if (is_late)
+    else
     {
-        data_int.num_late_units++;
+        stop_time = get_time_nsec();
     }
-    data_int.total_processed_units++;
 
-    UNLOCK();
+    recordUnit(stop_time, latency, is_late);
 }
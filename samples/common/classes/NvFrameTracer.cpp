@@ -0,0 +1,287 @@
+#include "NvFrameTracer.h"
+#include "NvLogging.h"
+
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TIMESTAMP_MASK 0xffffffffffffULL
+#define STREAM_MASK 0x7fff
+/* Fibonacci hashing, the top bits of the product depend on all key bits */
+#define TABLE_SHIFT (64 - __builtin_ctz(FRAME_TRACER_TABLE_SIZE))
+
+using namespace std;
+
+static const char *comp_name = "NvFrameTracer";
+static const char phase_codes[] = { 'b', 'e', 'n' };
+
+static thread_local void *thread_buffer;
+
+/**
+ * Copy of an event, taken by the dump.
+ */
+struct DumpedEvent
+{
+    uint64_t nsec;
+    uint64_t frame_id;
+    int64_t timestamp;
+    const char *stage;
+    uint32_t stream_phase;
+    int tid;
+
+    bool operator<(const DumpedEvent &o) const
+    {
+        return nsec < o.nsec;
+    }
+};
+
+static uint64_t
+monotonic_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; str && *str; str++)
+    {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+NvFrameTracer::NvFrameTracer()
+{
+    events_per_thread.store(0);
+    frame_id_counter.store(0);
+    for (uint32_t i = 0; i < FRAME_TRACER_TABLE_SIZE; i++)
+    {
+        table[i].key.store(0);
+        table[i].frame_id.store(0);
+    }
+    pthread_mutex_init(&buffers_lock, NULL);
+}
+
+NvFrameTracer&
+NvFrameTracer::getTracerInstance()
+{
+    static NvFrameTracer tracer;
+    return tracer;
+}
+
+void
+NvFrameTracer::enable(uint32_t events)
+{
+    uint32_t size = 1;
+
+    // Rings are indexed with a mask
+    while (events && size < events)
+        size <<= 1;
+    events_per_thread.store(events ? size : 0, memory_order_relaxed);
+}
+
+uint64_t
+NvFrameTracer::getFrameId(uint32_t stream, int64_t timestamp)
+{
+    uint64_t key = (1ULL << 63) | ((uint64_t) (stream & STREAM_MASK) << 48) |
+        ((uint64_t) timestamp & TIMESTAMP_MASK);
+    uint64_t hash = key * 0x9e3779b97f4a7c15ULL;
+    FrameSlot &slot = table[hash >> TABLE_SHIFT];
+    uint64_t id;
+
+    if (slot.key.load(memory_order_acquire) == key)
+    {
+        id = slot.frame_id.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.key.load(memory_order_relaxed) == key)
+            return id;
+    }
+
+    // A later frame with the same key, or a collision, takes the slot over
+    id = frame_id_counter.fetch_add(1, memory_order_relaxed) + 1;
+    slot.key.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.frame_id.store(id, memory_order_relaxed);
+    slot.key.store(key, memory_order_release);
+    return id;
+}
+
+NvFrameTracer::ThreadBuffer *
+NvFrameTracer::getThreadBuffer()
+{
+    ThreadBuffer *buffer = (ThreadBuffer *) thread_buffer;
+    uint32_t size;
+
+    if (buffer)
+        return buffer;
+
+    size = events_per_thread.load(memory_order_relaxed);
+    if (!size)
+        return NULL;
+
+    buffer = new (nothrow) ThreadBuffer;
+    if (!buffer)
+        return NULL;
+    buffer->events = new (nothrow) Event[size]();
+    if (!buffer->events)
+    {
+        COMP_ERROR_MSG("Could not allocate " << size << " events");
+        delete buffer;
+        return NULL;
+    }
+    buffer->tid = syscall(SYS_gettid);
+    memset(buffer->name, 0, sizeof(buffer->name));
+    pthread_getname_np(pthread_self(), buffer->name, sizeof(buffer->name));
+    buffer->mask = size - 1;
+    buffer->claimed.store(0);
+    buffer->head.store(0);
+
+    pthread_mutex_lock(&buffers_lock);
+    buffers.push_back(buffer);
+    pthread_mutex_unlock(&buffers_lock);
+
+    thread_buffer = buffer;
+    return buffer;
+}
+
+void
+NvFrameTracer::trace(uint32_t stream, int64_t timestamp, const char *stage,
+        TracePhase phase)
+{
+    ThreadBuffer *buffer;
+    uint64_t index;
+
+    if (!isEnabled())
+        return;
+    buffer = getThreadBuffer();
+    if (!buffer)
+        return;
+
+    uint64_t frame_id = getFrameId(stream, timestamp);
+
+    // Only this thread writes the ring, a dump checks claimed for events
+    // overwritten while it copied them
+    index = buffer->head.load(memory_order_relaxed);
+    buffer->claimed.store(index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    Event &event = buffer->events[index & buffer->mask];
+    event.nsec.store(monotonic_nsec(), memory_order_relaxed);
+    event.frame_id.store(frame_id, memory_order_relaxed);
+    event.timestamp.store(timestamp, memory_order_relaxed);
+    event.stage.store(stage, memory_order_relaxed);
+    event.stream_phase.store(((stream & STREAM_MASK) << 8) | phase,
+            memory_order_relaxed);
+
+    buffer->head.store(index + 1, memory_order_release);
+}
+
+int
+NvFrameTracer::dumpChromeTrace(const char *path)
+{
+    vector<DumpedEvent> events;
+    vector<ThreadBuffer *> threads;
+    FILE *file;
+    int pid = getpid();
+
+    pthread_mutex_lock(&buffers_lock);
+    threads = buffers;
+    pthread_mutex_unlock(&buffers_lock);
+
+    for (uint32_t t = 0; t < threads.size(); t++)
+    {
+        ThreadBuffer *buffer = threads[t];
+        uint64_t size = buffer->mask + 1ULL;
+        uint64_t head = buffer->head.load(memory_order_acquire);
+        uint64_t first = head > size ? head - size : 0;
+        size_t copied = events.size();
+
+        for (uint64_t i = first; i < head; i++)
+        {
+            Event &event = buffer->events[i & buffer->mask];
+            DumpedEvent dumped;
+
+            dumped.nsec = event.nsec.load(memory_order_relaxed);
+            dumped.frame_id = event.frame_id.load(memory_order_relaxed);
+            dumped.timestamp = event.timestamp.load(memory_order_relaxed);
+            dumped.stage = event.stage.load(memory_order_relaxed);
+            dumped.stream_phase = event.stream_phase.load(memory_order_relaxed);
+            dumped.tid = buffer->tid;
+            events.push_back(dumped);
+        }
+
+        // Drop the events the thread overwrote while they were copied
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t claimed = buffer->claimed.load(memory_order_relaxed);
+        if (claimed > first + size)
+        {
+            uint64_t overwritten = min(claimed - first - size, head - first);
+            events.erase(events.begin() + copied,
+                    events.begin() + copied + overwritten);
+        }
+    }
+    sort(events.begin(), events.end());
+
+    file = fopen(path, "w");
+    if (!file)
+    {
+        COMP_ERROR_MSG("Could not open " << path);
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint32_t t = 0; t < threads.size(); t++)
+    {
+        fprintf(file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":", pid, threads[t]->tid);
+        write_json_string(file, threads[t]->name);
+        fprintf(file, "}},\n");
+    }
+    for (uint32_t i = 0; i < events.size(); i++)
+    {
+        const DumpedEvent &event = events[i];
+
+        // Async events pair by (cat, id): with the stage as category each
+        // stage of a frame is its own slice, even where stages overlap
+        fprintf(file, "{\"ph\":\"%c\",\"cat\":",
+                phase_codes[event.stream_phase & 0xff]);
+        write_json_string(file, event.stage);
+        fprintf(file, ",\"name\":");
+        write_json_string(file, event.stage);
+        fprintf(file, ",\"id\":\"0x%llx\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%llu.%03u,\"args\":{\"frame\":%llu,\"stream\":%u,"
+                "\"timestamp\":%lld}},\n",
+                (unsigned long long) event.frame_id, pid, event.tid,
+                (unsigned long long) (event.nsec / 1000),
+                (unsigned) (event.nsec % 1000),
+                (unsigned long long) event.frame_id, event.stream_phase >> 8,
+                (long long) event.timestamp);
+    }
+    // Closes the array without a trailing comma
+    fprintf(file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+            "\"args\":{\"name\":\"frames\"}}\n]}\n", pid);
+
+    if (fclose(file) != 0)
+    {
+        COMP_ERROR_MSG("Could not write " << path);
+        return -1;
+    }
+    COMP_INFO_MSG("Wrote " << events.size() << " events to " << path);
+    return events.size();
+}
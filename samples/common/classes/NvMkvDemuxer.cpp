@@ -0,0 +1,747 @@
+#include "NvDemuxer.h"
+#include "NvLogging.h"
+
+#include <algorithm>
+#include <string>
+#include <string.h>
+
+#define MKV_ID_EBML 0x1a45dfa3
+#define MKV_ID_SEGMENT 0x18538067
+#define MKV_ID_SEEK_HEAD 0x114d9b74
+#define MKV_ID_SEEK 0x4dbb
+#define MKV_ID_SEEK_ID 0x53ab
+#define MKV_ID_SEEK_POSITION 0x53ac
+#define MKV_ID_INFO 0x1549a966
+#define MKV_ID_TIMECODE_SCALE 0x2ad7b1
+#define MKV_ID_DURATION 0x4489
+#define MKV_ID_TRACKS 0x1654ae6b
+#define MKV_ID_TRACK_ENTRY 0xae
+#define MKV_ID_TRACK_NUMBER 0xd7
+#define MKV_ID_TRACK_TYPE 0x83
+#define MKV_ID_CODEC_ID 0x86
+#define MKV_ID_CODEC_PRIVATE 0x63a2
+#define MKV_ID_VIDEO 0xe0
+#define MKV_ID_PIXEL_WIDTH 0xb0
+#define MKV_ID_PIXEL_HEIGHT 0xba
+#define MKV_ID_CUES 0x1c53bb6b
+#define MKV_ID_CUE_POINT 0xbb
+#define MKV_ID_CUE_TIME 0xb3
+#define MKV_ID_CUE_TRACK_POSITIONS 0xb7
+#define MKV_ID_CUE_TRACK 0xf7
+#define MKV_ID_CUE_CLUSTER_POSITION 0xf1
+#define MKV_ID_CLUSTER 0x1f43b675
+#define MKV_ID_TIMECODE 0xe7
+#define MKV_ID_BLOCK_GROUP 0xa0
+#define MKV_ID_BLOCK 0xa1
+#define MKV_ID_REFERENCE_BLOCK 0xfb
+#define MKV_ID_SIMPLE_BLOCK 0xa3
+
+#define MKV_TRACK_TYPE_VIDEO 1
+#define MKV_DEFAULT_TIMECODE_SCALE 1000000
+#define MKV_MAX_HEADER_SIZE 12
+
+using namespace std;
+
+static const char *comp_name = "NvMkvDemuxer";
+
+/**
+ * An element inside the mapped file.
+ */
+typedef struct
+{
+    uint32_t id;
+    size_t header_size;
+    uint64_t size;              /**< Payload size, unless unknown_size. */
+    bool unknown_size;          /**< Extends to the end of its parent. */
+} MkvElement;
+
+/**
+ * A cue point or a cluster start, in segment timecode units.
+ */
+typedef struct
+{
+    uint64_t time;
+    uint64_t position;          /**< Offset of the cluster in the file. */
+} MkvIndexEntry;
+
+/**
+ * Reads an EBML variable-size integer.
+ *
+ * @param[in] keep_marker IDs keep the length marker bit, sizes do not.
+ * @param[out] all_ones Whether all value bits are set, which marks an
+ *                      unknown size.
+ * @return Length of the integer, or 0 if it is invalid or does not fit
+ *         @a len.
+ */
+static size_t
+read_vint(const uint8_t *data, size_t len, bool keep_marker, uint64_t *value,
+        bool *all_ones)
+{
+    size_t vint_len = 1;
+    uint64_t mask;
+
+    if (!len || !data[0])
+        return 0;
+    while (!(data[0] & (0x80 >> (vint_len - 1))))
+        vint_len++;
+    if (vint_len > len)
+        return 0;
+
+    *value = NvDemuxer::readBigEndian(data, vint_len);
+    mask = (1ULL << (7 * vint_len)) - 1;
+    if (all_ones)
+        *all_ones = (*value & mask) == mask;
+    if (!keep_marker)
+        *value &= mask;
+    return vint_len;
+}
+
+/**
+ * Reads the header of an element.
+ *
+ * @return false if the header is invalid or does not fit @a len.
+ */
+static bool
+read_element(const uint8_t *data, size_t len, MkvElement *element)
+{
+    uint64_t id;
+    size_t id_len = read_vint(data, len, true, &id, NULL);
+    size_t size_len;
+
+    if (!id_len || id_len > 4)
+        return false;
+    size_len = read_vint(data + id_len, len - id_len, false, &element->size,
+            &element->unknown_size);
+    if (!size_len)
+        return false;
+    element->id = id;
+    element->header_size = id_len + size_len;
+    return true;
+}
+
+/**
+ * Iterates the children of a master element held in memory.
+ */
+class MkvChildren
+{
+public:
+    MkvChildren(const uint8_t *data, size_t size)
+        : data(data), size(size), pos(0)
+    {
+    }
+
+    /**
+     * Gets the next child.
+     *
+     * @param[out] payload The payload of the child.
+     * @return false after the last child, or at a malformed one.
+     */
+    bool next(MkvElement *element, const uint8_t **payload)
+    {
+        if (pos >= size || !read_element(data + pos, size - pos, element) ||
+                element->unknown_size ||
+                element->size > size - pos - element->header_size)
+            return false;
+        *payload = data + pos + element->header_size;
+        pos += element->header_size + element->size;
+        return true;
+    }
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+static double
+read_float(const uint8_t *data, uint64_t size)
+{
+    uint64_t bits = NvDemuxer::readBigEndian(data, size);
+
+    if (size == 4)
+    {
+        uint32_t bits32 = bits;
+        float value;
+
+        memcpy(&value, &bits32, sizeof(value));
+        return value;
+    }
+    if (size == 8)
+    {
+        double value;
+
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    return 0;
+}
+
+static bool
+compare_time(uint64_t time, const MkvIndexEntry &entry)
+{
+    return time < entry.time;
+}
+
+static bool
+entry_before(const MkvIndexEntry &a, const MkvIndexEntry &b)
+{
+    return a.time < b.time;
+}
+
+class NvMkvDemuxer : public NvDemuxer
+{
+public:
+    NvMkvDemuxer(NvBitstreamSource *source)
+        : NvDemuxer(source), timecode_scale(MKV_DEFAULT_TIMECODE_SCALE),
+          track_number(0), segment_start(0), segment_end(0), first_cluster(0),
+          cues_position(0), index_built(false), cluster_time(0),
+          seeking(false), seek_time(0)
+    {
+    }
+
+    /**
+     * Reads the segment up to its first cluster and picks the first
+     * supported video track.
+     */
+    bool open();
+
+    int readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample);
+    int seek(uint64_t pts);
+
+    const char *getFormatName()
+    {
+        return "Matroska";
+    }
+
+private:
+    uint64_t timecode_scale;    /**< Nanoseconds per timecode unit. */
+    uint64_t track_number;
+    size_t segment_start;       /**< Offset of the segment payload. */
+    size_t segment_end;
+    size_t first_cluster;
+    size_t cues_position;       /**< From the seek head, 0 if unknown. */
+    vector<MkvIndexEntry> index;
+    bool index_built;
+    uint64_t cluster_time;      /**< Timecode of the current cluster. */
+    bool seeking;               /**< Skip frames until a key frame... */
+    uint64_t seek_time;         /**< ...at or after this timecode. */
+
+    /**
+     * Reads the element header at the read position.
+     *
+     * @return false at the end of the segment or at a malformed header.
+     */
+    bool readElement(MkvElement *element);
+
+    void parseSeekHead(const uint8_t *data, size_t size);
+    void parseInfo(const uint8_t *data, size_t size);
+    bool parseTracks(const uint8_t *data, size_t size);
+    bool parseTrackEntry(const uint8_t *data, size_t size);
+    void parseCues(const uint8_t *data, size_t size);
+
+    /**
+     * Fills the index from the cues, or from the cluster timecodes if the
+     * file has no cues.
+     */
+    void buildIndex();
+
+    uint64_t timecodeToMicroseconds(uint64_t time)
+    {
+        return time * timecode_scale / 1000;
+    }
+};
+
+bool
+NvMkvDemuxer::readElement(MkvElement *element)
+{
+    size_t left;
+    const uint8_t *header;
+
+    if (source->getPosition() >= segment_end)
+        return false;
+    left = segment_end - source->getPosition();
+    header = source->peek(min(left, (size_t) MKV_MAX_HEADER_SIZE));
+    return header && read_element(header, min(left, (size_t) MKV_MAX_HEADER_SIZE),
+            element);
+}
+
+bool
+NvMkvDemuxer::open()
+{
+    MkvElement element;
+    const uint8_t *header = source->peek(MKV_MAX_HEADER_SIZE);
+
+    // The EBML header, then the segment
+    segment_end = source->getSize();
+    if (!header || !read_element(header, MKV_MAX_HEADER_SIZE, &element) ||
+            element.id != MKV_ID_EBML || element.unknown_size)
+    {
+        COMP_ERROR_MSG("Invalid EBML header");
+        return false;
+    }
+    source->skip(element.header_size + element.size);
+    if (!readElement(&element) || element.id != MKV_ID_SEGMENT)
+    {
+        COMP_ERROR_MSG("No segment");
+        return false;
+    }
+    source->skip(element.header_size);
+    segment_start = source->getPosition();
+    if (!element.unknown_size && element.size < segment_end - segment_start)
+        segment_end = segment_start + element.size;
+
+    // The top-level elements in front of the first cluster
+    while (readElement(&element) && element.id != MKV_ID_CLUSTER)
+    {
+        const uint8_t *data = NULL;
+
+        if (element.unknown_size)
+            break;
+        if (element.id == MKV_ID_SEEK_HEAD || element.id == MKV_ID_INFO ||
+                element.id == MKV_ID_TRACKS || element.id == MKV_ID_CUES)
+        {
+            data = source->peek(element.header_size + element.size);
+            if (!data)
+                break;
+            data += element.header_size;
+        }
+        if (element.id == MKV_ID_SEEK_HEAD)
+            parseSeekHead(data, element.size);
+        else if (element.id == MKV_ID_INFO)
+            parseInfo(data, element.size);
+        else if (element.id == MKV_ID_TRACKS && !parseTracks(data, element.size))
+            return false;
+        else if (element.id == MKV_ID_CUES)
+        {
+            parseCues(data, element.size);
+            index_built = !index.empty();
+        }
+        source->skip(element.header_size + element.size);
+    }
+
+    if (!track_number)
+    {
+        COMP_ERROR_MSG("No H.264, H.265, VP8, VP9 or MPEG-2 video track");
+        return false;
+    }
+    first_cluster = source->getPosition();
+    return true;
+}
+
+void
+NvMkvDemuxer::parseSeekHead(const uint8_t *data, size_t size)
+{
+    MkvChildren seeks(data, size);
+    MkvElement seek;
+    const uint8_t *payload;
+
+    while (seeks.next(&seek, &payload))
+    {
+        MkvChildren fields(payload, seek.size);
+        MkvElement field;
+        const uint8_t *value;
+        uint64_t id = 0;
+        uint64_t position = 0;
+
+        if (seek.id != MKV_ID_SEEK)
+            continue;
+        while (fields.next(&field, &value))
+        {
+            if (field.id == MKV_ID_SEEK_ID && field.size <= 4)
+                id = readBigEndian(value, field.size);
+            else if (field.id == MKV_ID_SEEK_POSITION && field.size <= 8)
+                position = readBigEndian(value, field.size);
+        }
+        if (id == MKV_ID_CUES && position < segment_end - segment_start)
+            cues_position = segment_start + position;
+    }
+}
+
+void
+NvMkvDemuxer::parseInfo(const uint8_t *data, size_t size)
+{
+    MkvChildren fields(data, size);
+    MkvElement field;
+    const uint8_t *value;
+    double segment_duration = 0;
+
+    while (fields.next(&field, &value))
+    {
+        if (field.id == MKV_ID_TIMECODE_SCALE && field.size <= 8)
+            timecode_scale = readBigEndian(value, field.size);
+        else if (field.id == MKV_ID_DURATION)
+            segment_duration = read_float(value, field.size);
+    }
+    if (!timecode_scale)
+        timecode_scale = MKV_DEFAULT_TIMECODE_SCALE;
+    if (segment_duration > 0)
+        duration = segment_duration * timecode_scale / 1000;
+}
+
+bool
+NvMkvDemuxer::parseTracks(const uint8_t *data, size_t size)
+{
+    MkvChildren entries(data, size);
+    MkvElement entry;
+    const uint8_t *payload;
+
+    while (!track_number && entries.next(&entry, &payload))
+    {
+        if (entry.id == MKV_ID_TRACK_ENTRY && !parseTrackEntry(payload, entry.size))
+            return false;
+    }
+    return true;
+}
+
+bool
+NvMkvDemuxer::parseTrackEntry(const uint8_t *data, size_t size)
+{
+    MkvChildren fields(data, size);
+    MkvElement field;
+    const uint8_t *value;
+    const uint8_t *codec_private = NULL;
+    size_t codec_private_size = 0;
+    uint64_t number = 0;
+    uint64_t type = 0;
+    string codec_id;
+
+    while (fields.next(&field, &value))
+    {
+        if (field.id == MKV_ID_TRACK_NUMBER && field.size <= 8)
+            number = readBigEndian(value, field.size);
+        else if (field.id == MKV_ID_TRACK_TYPE && field.size <= 8)
+            type = readBigEndian(value, field.size);
+        else if (field.id == MKV_ID_CODEC_ID)
+            codec_id.assign((const char *) value, strnlen((const char *) value, field.size));
+        else if (field.id == MKV_ID_CODEC_PRIVATE)
+        {
+            codec_private = value;
+            codec_private_size = field.size;
+        }
+        else if (field.id == MKV_ID_VIDEO)
+        {
+            MkvChildren video(value, field.size);
+            MkvElement dimension;
+            const uint8_t *pixels;
+
+            while (video.next(&dimension, &pixels))
+            {
+                if (dimension.id == MKV_ID_PIXEL_WIDTH && dimension.size <= 4)
+                    width = readBigEndian(pixels, dimension.size);
+                else if (dimension.id == MKV_ID_PIXEL_HEIGHT && dimension.size <= 4)
+                    height = readBigEndian(pixels, dimension.size);
+            }
+        }
+    }
+    if (type != MKV_TRACK_TYPE_VIDEO || !number)
+        return true;
+
+    if (codec_id == "V_MPEG4/ISO/AVC")
+        codec = NV_DEMUXER_CODEC_H264;
+    else if (codec_id == "V_MPEGH/ISO/HEVC")
+        codec = NV_DEMUXER_CODEC_H265;
+    else if (codec_id == "V_VP8")
+        codec = NV_DEMUXER_CODEC_VP8;
+    else if (codec_id == "V_VP9")
+        codec = NV_DEMUXER_CODEC_VP9;
+    else if (codec_id == "V_MPEG2")
+        codec = NV_DEMUXER_CODEC_MPEG2;
+    else
+        return true;
+
+    // CodecPrivate is the avcC or hvcC record, or the MPEG-2 sequence header
+    if (codec == NV_DEMUXER_CODEC_H264 &&
+            !parseAvcConfig(codec_private, codec_private_size))
+    {
+        COMP_ERROR_MSG("Missing or invalid AVC CodecPrivate");
+        return false;
+    }
+    if (codec == NV_DEMUXER_CODEC_H265 &&
+            !parseHevcConfig(codec_private, codec_private_size))
+    {
+        COMP_ERROR_MSG("Missing or invalid HEVC CodecPrivate");
+        return false;
+    }
+    if (codec == NV_DEMUXER_CODEC_MPEG2 && codec_private)
+        codec_config.assign(codec_private, codec_private + codec_private_size);
+    track_number = number;
+    return true;
+}
+
+void
+NvMkvDemuxer::parseCues(const uint8_t *data, size_t size)
+{
+    MkvChildren points(data, size);
+    MkvElement point;
+    const uint8_t *payload;
+
+    index.clear();
+    while (points.next(&point, &payload))
+    {
+        MkvChildren fields(payload, point.size);
+        MkvElement field;
+        const uint8_t *value;
+        MkvIndexEntry entry = { 0, 0 };
+        bool found = false;
+
+        if (point.id != MKV_ID_CUE_POINT)
+            continue;
+        while (fields.next(&field, &value))
+        {
+            if (field.id == MKV_ID_CUE_TIME && field.size <= 8)
+            {
+                entry.time = readBigEndian(value, field.size);
+            }
+            else if (field.id == MKV_ID_CUE_TRACK_POSITIONS)
+            {
+                MkvChildren positions(value, field.size);
+                MkvElement position;
+                const uint8_t *number;
+                uint64_t track = 0;
+
+                while (positions.next(&position, &number))
+                {
+                    if (position.id == MKV_ID_CUE_TRACK && position.size <= 8)
+                        track = readBigEndian(number, position.size);
+                    else if (position.id == MKV_ID_CUE_CLUSTER_POSITION &&
+                            position.size <= 8)
+                        entry.position = segment_start +
+                            readBigEndian(number, position.size);
+                }
+                found = found || track == track_number;
+            }
+        }
+        if (found && entry.position < segment_end)
+            index.push_back(entry);
+    }
+}
+
+void
+NvMkvDemuxer::buildIndex()
+{
+    MkvElement element;
+    const uint8_t *data;
+    size_t position = source->getPosition();
+
+    index_built = true;
+    if (cues_position)
+    {
+        source->seek(cues_position);
+        if (readElement(&element) && element.id == MKV_ID_CUES &&
+                !element.unknown_size &&
+                (data = source->peek(element.header_size + element.size)))
+            parseCues(data + element.header_size, element.size);
+    }
+
+    // Without cues, the clusters are the index. Clusters of known size are
+    // skipped after their timecode, those of unknown size are entered
+    if (index.empty())
+    {
+        source->seek(first_cluster);
+        while (readElement(&element))
+        {
+            if (element.id == MKV_ID_CLUSTER)
+            {
+                MkvIndexEntry entry = { 0, source->getPosition() };
+
+                index.push_back(entry);
+                if (element.unknown_size ||
+                        !(data = source->peek(element.header_size + element.size)))
+                {
+                    source->skip(element.header_size);
+                    continue;
+                }
+
+                MkvChildren children(data + element.header_size, element.size);
+                MkvElement child;
+                const uint8_t *value;
+
+                while (children.next(&child, &value))
+                {
+                    if (child.id == MKV_ID_TIMECODE && child.size <= 8)
+                    {
+                        index.back().time = readBigEndian(value, child.size);
+                        break;
+                    }
+                }
+                source->skip(element.header_size + element.size);
+                continue;
+            }
+            if (element.id == MKV_ID_TIMECODE && !index.empty() &&
+                    element.size <= 8 &&
+                    (data = source->peek(element.header_size + element.size)))
+                index.back().time = readBigEndian(data + element.header_size,
+                        element.size);
+            if (element.unknown_size)
+                break;
+            // Cues after the clusters, not listed in a seek head
+            if (element.id == MKV_ID_CUES &&
+                    (data = source->peek(element.header_size + element.size)))
+            {
+                vector<MkvIndexEntry> clusters;
+
+                clusters.swap(index);
+                parseCues(data + element.header_size, element.size);
+                if (!index.empty())
+                    break;
+                index.swap(clusters);
+            }
+            source->skip(element.header_size + element.size);
+        }
+    }
+
+    stable_sort(index.begin(), index.end(), entry_before);
+    source->seek(position);
+}
+
+int
+NvMkvDemuxer::readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample)
+{
+    MkvElement element;
+
+    // Segment and clusters are entered, the other elements are skipped or
+    // read whole, so clusters of unknown size need no special care
+    while (readElement(&element))
+    {
+        const uint8_t *data = NULL;
+        const uint8_t *block = NULL;
+        size_t block_size = 0;
+        bool key_frame = false;
+        uint64_t track;
+        size_t track_len;
+        int64_t time;
+        ssize_t written;
+
+        if (element.id == MKV_ID_CLUSTER)
+        {
+            source->skip(element.header_size);
+            continue;
+        }
+        if (element.unknown_size)
+        {
+            COMP_ERROR_MSG("Element " << hex << element.id << dec <<
+                    " of unknown size");
+            return -1;
+        }
+        if (element.id == MKV_ID_TIMECODE || element.id == MKV_ID_SIMPLE_BLOCK ||
+                element.id == MKV_ID_BLOCK_GROUP)
+        {
+            data = source->peek(element.header_size + element.size);
+            if (!data)
+            {
+                COMP_ERROR_MSG("Truncated element at the end of the file");
+                return -1;
+            }
+            data += element.header_size;
+        }
+        source->skip(element.header_size + element.size);
+
+        if (element.id == MKV_ID_TIMECODE && element.size <= 8)
+        {
+            cluster_time = readBigEndian(data, element.size);
+        }
+        else if (element.id == MKV_ID_SIMPLE_BLOCK)
+        {
+            block = data;
+            block_size = element.size;
+            key_frame = block_size > 3 && (block[3] & 0x80);
+        }
+        else if (element.id == MKV_ID_BLOCK_GROUP)
+        {
+            // A block without references is a key frame
+            MkvChildren children(data, element.size);
+            MkvElement child;
+            const uint8_t *payload;
+
+            key_frame = true;
+            while (children.next(&child, &payload))
+            {
+                if (child.id == MKV_ID_BLOCK)
+                {
+                    block = payload;
+                    block_size = child.size;
+                }
+                else if (child.id == MKV_ID_REFERENCE_BLOCK)
+                {
+                    key_frame = false;
+                }
+            }
+        }
+        if (!block)
+            continue;
+
+        // Track number, 16-bit relative timecode and flags
+        track_len = read_vint(block, block_size, false, &track, NULL);
+        if (!track_len || block_size < track_len + 3 || track != track_number)
+            continue;
+        time = (int64_t) cluster_time +
+            (int16_t) readBigEndian(block + track_len, 2);
+        if (time < 0)
+            time = 0;
+        if (seeking && (!key_frame || (uint64_t) time < seek_time))
+            continue;
+        seeking = false;
+        if (block[track_len + 2] & 0x06)
+        {
+            COMP_ERROR_MSG("Laced video blocks are not supported");
+            return -1;
+        }
+
+        written = writeSample(block + track_len + 3, block_size - track_len - 3,
+                dst, dst_size);
+        if (written < 0)
+            return -1;
+        sample->size = written;
+        sample->pts = timecodeToMicroseconds(time);
+        sample->key_frame = key_frame;
+        return 1;
+    }
+    return 0;
+}
+
+int
+NvMkvDemuxer::seek(uint64_t pts)
+{
+    uint64_t target = pts * 1000 / timecode_scale;
+    vector<MkvIndexEntry>::iterator it;
+
+    cluster_time = 0;
+    config_pending = true;
+    if (!pts)
+    {
+        seeking = false;
+        source->seek(first_cluster);
+        return 0;
+    }
+
+    if (!index_built)
+        buildIndex();
+    it = upper_bound(index.begin(), index.end(), target, compare_time);
+    if (it == index.begin())
+    {
+        seeking = false;
+        source->seek(first_cluster);
+        return 0;
+    }
+    --it;
+
+    // A cue points at the cluster holding the key frame, a cluster start
+    // may be in front of it
+    seeking = true;
+    seek_time = it->time;
+    source->seek(it->position);
+    return 0;
+}
+
+NvDemuxer *
+NvDemuxer::createMkvDemuxer(NvBitstreamSource *source)
+{
+    NvMkvDemuxer *demuxer = new NvMkvDemuxer(source);
+
+    if (!demuxer->open())
+    {
+        delete demuxer;
+        return NULL;
+    }
+    return demuxer;
+}
@@ -0,0 +1,488 @@
+#include "NvDemuxer.h"
+#include "NvLogging.h"
+
+#include <algorithm>
+#include <string.h>
+
+#define MICROSECONDS 1000000ULL
+#define BOX_HEADER_SIZE 8
+#define FULL_BOX_HEADER_SIZE 4
+#define VISUAL_SAMPLE_ENTRY_SIZE 78
+
+#define MP4_TYPE(a, b, c, d) \
+    (((uint32_t) (a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+using namespace std;
+
+static const char *comp_name = "NvMp4Demuxer";
+
+/**
+ * A box inside the mapped file.
+ */
+typedef struct
+{
+    uint32_t type;
+    const uint8_t *data;        /**< Payload, after the header. */
+    size_t size;                /**< Payload size. */
+} Mp4Box;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t size;
+    uint64_t pts;               /**< In units of the media timescale. */
+    bool key_frame;
+} Mp4Sample;
+
+/**
+ * Boxes of the sample table of a track, the optional ones have no data if
+ * they are missing.
+ */
+typedef struct
+{
+    Mp4Box stsz;
+    Mp4Box stsc;
+    Mp4Box stco;
+    bool co64;                  /**< stco holds a co64 box. */
+    Mp4Box stts;
+    Mp4Box ctts;
+    Mp4Box stss;
+} Mp4SampleTables;
+
+/**
+ * Reads the box at @a pos of a buffer.
+ *
+ * @return Offset of the next box, or 0 if there is no complete box at
+ *         @a pos.
+ */
+static size_t
+read_box(const uint8_t *data, size_t size, size_t pos, Mp4Box *box)
+{
+    uint64_t box_size;
+    size_t header_size = BOX_HEADER_SIZE;
+
+    if (pos > size || size - pos < BOX_HEADER_SIZE)
+        return 0;
+    box_size = NvDemuxer::readBigEndian(data + pos, 4);
+    box->type = NvDemuxer::readBigEndian(data + pos + 4, 4);
+    if (box_size == 1)
+    {
+        if (size - pos < 16)
+            return 0;
+        box_size = NvDemuxer::readBigEndian(data + pos + 8, 8);
+        header_size = 16;
+    }
+    else if (box_size == 0)
+    {
+        // Extends to the end of the file
+        box_size = size - pos;
+    }
+    if (box_size < header_size || box_size > size - pos)
+        return 0;
+
+    box->data = data + pos + header_size;
+    box->size = box_size - header_size;
+    return pos + box_size;
+}
+
+/**
+ * Finds the first child box of a type.
+ *
+ * @return false, with @a box cleared, if there is none.
+ */
+static bool
+find_box(const Mp4Box &parent, uint32_t type, Mp4Box *box)
+{
+    size_t pos = 0;
+
+    while ((pos = read_box(parent.data, parent.size, pos, box)) != 0)
+    {
+        if (box->type == type)
+            return true;
+    }
+    memset(box, 0, sizeof(*box));
+    return false;
+}
+
+/**
+ * Gets the entry count of a full box whose entries of @a entry_size bytes
+ * follow the count, which follows @a skip bytes.
+ *
+ * @return Number of entries, or -1 if the box is too short for them.
+ */
+static int64_t
+get_entry_count(const Mp4Box &box, size_t skip, size_t entry_size)
+{
+    uint64_t count;
+
+    if (box.size < FULL_BOX_HEADER_SIZE + skip + 4)
+        return -1;
+    count = NvDemuxer::readBigEndian(box.data + FULL_BOX_HEADER_SIZE + skip, 4);
+    if (count > (box.size - FULL_BOX_HEADER_SIZE - skip - 4) / entry_size)
+        return -1;
+    return count;
+}
+
+static bool
+compare_pts(uint64_t pts, const Mp4Sample &sample)
+{
+    return pts < sample.pts;
+}
+
+class NvMp4Demuxer : public NvDemuxer
+{
+public:
+    NvMp4Demuxer(NvBitstreamSource *source)
+        : NvDemuxer(source), timescale(0), next_sample(0)
+    {
+    }
+
+    /**
+     * Finds the first supported video track and builds its sample table.
+     */
+    bool open();
+
+    int readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample);
+    int seek(uint64_t pts);
+
+    const char *getFormatName()
+    {
+        return "MP4";
+    }
+
+private:
+    uint32_t timescale;         /**< Units per second of the track times. */
+    vector<Mp4Sample> samples;  /**< In decode order. */
+    vector<Mp4Sample> key_frames; /**< offset is the index into samples. */
+    size_t next_sample;
+
+    bool openTrack(const Mp4Box &trak);
+    bool parseSampleEntry(const Mp4Box &stsd);
+    bool buildSampleTable(const Mp4SampleTables &tables);
+};
+
+bool
+NvMp4Demuxer::open()
+{
+    // Only the box headers are read to find the movie box, which may
+    // follow the media data
+    Mp4Box file = { 0, source->peek(source->getSize()), source->getSize() };
+    Mp4Box moov;
+    Mp4Box trak;
+    size_t pos = 0;
+
+    if (!file.data || !find_box(file, MP4_TYPE('m', 'o', 'o', 'v'), &moov))
+    {
+        COMP_ERROR_MSG("No movie box");
+        return false;
+    }
+
+    while ((pos = read_box(moov.data, moov.size, pos, &trak)) != 0)
+    {
+        if (trak.type == MP4_TYPE('t', 'r', 'a', 'k') && openTrack(trak))
+            return true;
+    }
+    COMP_ERROR_MSG("No H.264, H.265, VP8 or VP9 track with samples");
+    return false;
+}
+
+bool
+NvMp4Demuxer::openTrack(const Mp4Box &trak)
+{
+    Mp4Box mdia, hdlr, mdhd, minf, stbl, stsd;
+    Mp4SampleTables tables;
+    uint64_t track_duration;
+
+    // Left over from a track tried before
+    codec_config.clear();
+    nal_length_size = 0;
+    samples.clear();
+    key_frames.clear();
+
+    if (!find_box(trak, MP4_TYPE('m', 'd', 'i', 'a'), &mdia) ||
+            !find_box(mdia, MP4_TYPE('h', 'd', 'l', 'r'), &hdlr) ||
+            hdlr.size < 12 ||
+            readBigEndian(hdlr.data + 8, 4) != MP4_TYPE('v', 'i', 'd', 'e'))
+        return false;
+
+    // Version 1 has 64-bit creation and modification times and duration
+    if (!find_box(mdia, MP4_TYPE('m', 'd', 'h', 'd'), &mdhd) || mdhd.size < 20)
+        return false;
+    if (mdhd.data[0] == 1)
+    {
+        if (mdhd.size < 32)
+            return false;
+        timescale = readBigEndian(mdhd.data + 20, 4);
+        track_duration = readBigEndian(mdhd.data + 24, 8);
+    }
+    else
+    {
+        timescale = readBigEndian(mdhd.data + 12, 4);
+        track_duration = readBigEndian(mdhd.data + 16, 4);
+    }
+    if (!timescale)
+        return false;
+
+    if (!find_box(mdia, MP4_TYPE('m', 'i', 'n', 'f'), &minf) ||
+            !find_box(minf, MP4_TYPE('s', 't', 'b', 'l'), &stbl) ||
+            !find_box(stbl, MP4_TYPE('s', 't', 's', 'd'), &stsd) ||
+            !parseSampleEntry(stsd))
+        return false;
+
+    if (!find_box(stbl, MP4_TYPE('s', 't', 's', 'z'), &tables.stsz) ||
+            !find_box(stbl, MP4_TYPE('s', 't', 's', 'c'), &tables.stsc) ||
+            !find_box(stbl, MP4_TYPE('s', 't', 't', 's'), &tables.stts))
+        return false;
+    tables.co64 = find_box(stbl, MP4_TYPE('c', 'o', '6', '4'), &tables.stco);
+    if (!tables.co64 && !find_box(stbl, MP4_TYPE('s', 't', 'c', 'o'), &tables.stco))
+        return false;
+    find_box(stbl, MP4_TYPE('c', 't', 't', 's'), &tables.ctts);
+    find_box(stbl, MP4_TYPE('s', 't', 's', 's'), &tables.stss);
+
+    duration = toMicroseconds(track_duration, timescale);
+    return buildSampleTable(tables);
+}
+
+bool
+NvMp4Demuxer::parseSampleEntry(const Mp4Box &stsd)
+{
+    Mp4Box entry;
+    Mp4Box children;
+    Mp4Box config;
+
+    // The first entry follows the full box header and the entry count
+    if (!read_box(stsd.data, stsd.size, FULL_BOX_HEADER_SIZE + 4, &entry) ||
+            entry.size < VISUAL_SAMPLE_ENTRY_SIZE)
+        return false;
+
+    switch (entry.type)
+    {
+        case MP4_TYPE('a', 'v', 'c', '1'):
+        case MP4_TYPE('a', 'v', 'c', '3'):
+            codec = NV_DEMUXER_CODEC_H264;
+            break;
+        case MP4_TYPE('h', 'v', 'c', '1'):
+        case MP4_TYPE('h', 'e', 'v', '1'):
+            codec = NV_DEMUXER_CODEC_H265;
+            break;
+        case MP4_TYPE('v', 'p', '0', '8'):
+            codec = NV_DEMUXER_CODEC_VP8;
+            break;
+        case MP4_TYPE('v', 'p', '0', '9'):
+            codec = NV_DEMUXER_CODEC_VP9;
+            break;
+        default:
+            return false;
+    }
+    width = readBigEndian(entry.data + 24, 2);
+    height = readBigEndian(entry.data + 26, 2);
+
+    // avc3 and hev1 may carry the parameter sets in band as well
+    children.data = entry.data + VISUAL_SAMPLE_ENTRY_SIZE;
+    children.size = entry.size - VISUAL_SAMPLE_ENTRY_SIZE;
+    if (codec == NV_DEMUXER_CODEC_H264 &&
+            (!find_box(children, MP4_TYPE('a', 'v', 'c', 'C'), &config) ||
+             !parseAvcConfig(config.data, config.size)))
+    {
+        COMP_ERROR_MSG("Missing or invalid avcC box");
+        return false;
+    }
+    if (codec == NV_DEMUXER_CODEC_H265 &&
+            (!find_box(children, MP4_TYPE('h', 'v', 'c', 'C'), &config) ||
+             !parseHevcConfig(config.data, config.size)))
+    {
+        COMP_ERROR_MSG("Missing or invalid hvcC box");
+        return false;
+    }
+    return true;
+}
+
+bool
+NvMp4Demuxer::buildSampleTable(const Mp4SampleTables &tables)
+{
+    const Mp4Box &stsz = tables.stsz;
+    const Mp4Box &stco = tables.stco;
+    size_t chunk_entry_size = tables.co64 ? 8 : 4;
+    int64_t sample_count;
+    int64_t chunk_count = get_entry_count(stco, 0, chunk_entry_size);
+    int64_t stsc_count = get_entry_count(tables.stsc, 0, 12);
+    int64_t stts_count = get_entry_count(tables.stts, 0, 8);
+    int64_t ctts_count = 0;
+    int64_t stss_count = 0;
+    uint32_t fixed_size;
+    uint64_t dts = 0;
+    size_t sample = 0;
+
+    // stsz has the size of all samples, or an entry for each sample
+    if (stsz.size < FULL_BOX_HEADER_SIZE + 8)
+        return false;
+    fixed_size = readBigEndian(stsz.data + FULL_BOX_HEADER_SIZE, 4);
+    if (fixed_size)
+        sample_count = readBigEndian(stsz.data + FULL_BOX_HEADER_SIZE + 4, 4);
+    else
+        sample_count = get_entry_count(stsz, 4, 4);
+    if (tables.ctts.data)
+        ctts_count = get_entry_count(tables.ctts, 0, 8);
+    if (tables.stss.data)
+        stss_count = get_entry_count(tables.stss, 0, 4);
+    if (sample_count < 0 || (uint64_t) sample_count > source->getSize() ||
+            chunk_count < 0 || stsc_count < 0 || stts_count < 0 ||
+            ctts_count < 0 || stss_count < 0)
+    {
+        COMP_ERROR_MSG("Malformed sample table");
+        return false;
+    }
+    if (!sample_count)
+        return false;
+    samples.resize(sample_count);
+
+    // Each stsc entry gives the samples per chunk of a run of chunks, the
+    // samples of a chunk follow each other in the file
+    for (int64_t i = 0; i < stsc_count && sample < samples.size(); i++)
+    {
+        const uint8_t *entry = tables.stsc.data + FULL_BOX_HEADER_SIZE + 4 + i * 12;
+        uint64_t first_chunk = readBigEndian(entry, 4);
+        uint64_t samples_per_chunk = readBigEndian(entry + 4, 4);
+        uint64_t last_chunk = i + 1 < stsc_count ?
+            readBigEndian(entry + 12, 4) - 1 : chunk_count;
+
+        for (uint64_t chunk = max(first_chunk, (uint64_t) 1);
+                chunk <= min(last_chunk, (uint64_t) chunk_count) &&
+                sample < samples.size(); chunk++)
+        {
+            uint64_t offset = readBigEndian(stco.data + FULL_BOX_HEADER_SIZE +
+                    4 + (chunk - 1) * chunk_entry_size, chunk_entry_size);
+
+            for (uint64_t j = 0; j < samples_per_chunk && sample < samples.size(); j++)
+            {
+                samples[sample].offset = offset;
+                samples[sample].size = fixed_size ? fixed_size :
+                    readBigEndian(stsz.data + FULL_BOX_HEADER_SIZE + 8 + sample * 4, 4);
+                offset += samples[sample].size;
+                sample++;
+            }
+        }
+    }
+    if (sample < samples.size())
+    {
+        COMP_WARN_MSG("Chunk table covers " << sample << " of " <<
+                samples.size() << " samples");
+        samples.resize(sample);
+    }
+
+    // Decode times from stts, composition offsets from ctts. Negative
+    // offsets of version 1 are read as such for version 0 as well
+    sample = 0;
+    for (int64_t i = 0; i < stts_count; i++)
+    {
+        const uint8_t *entry = tables.stts.data + FULL_BOX_HEADER_SIZE + 4 + i * 8;
+        uint64_t count = readBigEndian(entry, 4);
+        uint64_t delta = readBigEndian(entry + 4, 4);
+
+        for (uint64_t j = 0; j < count && sample < samples.size(); j++)
+        {
+            samples[sample++].pts = dts;
+            dts += delta;
+        }
+    }
+    for (; sample < samples.size(); sample++)
+        samples[sample].pts = dts;
+
+    sample = 0;
+    for (int64_t i = 0; i < ctts_count; i++)
+    {
+        const uint8_t *entry = tables.ctts.data + FULL_BOX_HEADER_SIZE + 4 + i * 8;
+        uint64_t count = readBigEndian(entry, 4);
+        int32_t offset = (int32_t) readBigEndian(entry + 4, 4);
+
+        for (uint64_t j = 0; j < count && sample < samples.size(); j++, sample++)
+        {
+            if (offset < 0 && (uint64_t) -(int64_t) offset > samples[sample].pts)
+                samples[sample].pts = 0;
+            else
+                samples[sample].pts += offset;
+        }
+    }
+
+    // Without stss every sample is a sync sample
+    for (sample = 0; sample < samples.size(); sample++)
+        samples[sample].key_frame = !tables.stss.data;
+    for (int64_t i = 0; i < stss_count; i++)
+    {
+        uint64_t number = readBigEndian(tables.stss.data +
+                FULL_BOX_HEADER_SIZE + 4 + i * 4, 4);
+
+        if (number >= 1 && number <= samples.size())
+            samples[number - 1].key_frame = true;
+    }
+    for (sample = 0; sample < samples.size(); sample++)
+    {
+        if (samples[sample].key_frame)
+        {
+            Mp4Sample key = samples[sample];
+
+            key.offset = sample;
+            key_frames.push_back(key);
+        }
+    }
+    return !samples.empty();
+}
+
+int
+NvMp4Demuxer::readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample)
+{
+    const Mp4Sample *current;
+    const uint8_t *data;
+    ssize_t written;
+
+    if (next_sample >= samples.size())
+        return 0;
+    current = &samples[next_sample++];
+
+    // Samples of other tracks in between are skipped without reading them
+    source->seek(current->offset);
+    data = source->peek(current->size);
+    if (!data)
+    {
+        COMP_ERROR_MSG("Sample " << next_sample - 1 << " is past the end of the file");
+        return -1;
+    }
+    written = writeSample(data, current->size, dst, dst_size);
+    source->skip(current->size);
+    if (written < 0)
+        return -1;
+
+    sample->size = written;
+    sample->pts = toMicroseconds(current->pts, timescale);
+    sample->key_frame = current->key_frame;
+    return 1;
+}
+
+int
+NvMp4Demuxer::seek(uint64_t pts)
+{
+    uint64_t target = pts / MICROSECONDS * timescale +
+        pts % MICROSECONDS * timescale / MICROSECONDS;
+    vector<Mp4Sample>::iterator it;
+
+    // Key frames are in decode order, which is presentation order for them
+    it = upper_bound(key_frames.begin(), key_frames.end(), target, compare_pts);
+    if (it != key_frames.begin())
+        --it;
+    next_sample = it != key_frames.end() ? it->offset : 0;
+    config_pending = true;
+    return 0;
+}
+
+NvDemuxer *
+NvDemuxer::createMp4Demuxer(NvBitstreamSource *source)
+{
+    NvMp4Demuxer *demuxer = new NvMp4Demuxer(source);
+
+    if (!demuxer->open())
+    {
+        delete demuxer;
+        return NULL;
+    }
+    return demuxer;
+}
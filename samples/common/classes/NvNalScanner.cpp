@@ -0,0 +1,288 @@
+#include <string.h>
+#include "NvNalScanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NV_NAL_SCANNER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define NV_NAL_SCANNER_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define H264_NAL_TYPE(header) ((header) & 0x1F)
+#define H265_NAL_TYPE(header) (((header) & 0x7E) >> 1)
+
+/* All scanners return the offset of the first 00 00 01 in buf, or len. */
+typedef size_t (*find_00_00_01_fn)(const uint8_t *buf, size_t len);
+
+static size_t
+find_00_00_01_scalar(const uint8_t *buf, size_t len)
+{
+    size_t i = 0;
+
+    while (i + 2 < len)
+    {
+        /* buf[i + 2] decides whether i, i + 1 or i + 2 can start a match */
+        if (buf[i + 2] > 1)
+        {
+            i += 3;
+        }
+        else if (buf[i + 2] == 1)
+        {
+            if (buf[i] == 0 && buf[i + 1] == 0)
+                return i;
+            i += 3;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return len;
+}
+
+#ifdef NV_NAL_SCANNER_X86
+static size_t
+find_00_00_01_sse2(const uint8_t *buf, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = 0;
+
+    for (; i + 16 + 2 <= len; i += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *) (buf + i + 2));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(c, one));
+        if (!mask)
+            continue;
+
+        __m128i a = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (buf + i + 1));
+        mask &= _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                    _mm_cmpeq_epi8(b, zero)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    size_t pos = find_00_00_01_scalar(buf + i, len - i);
+    return i + pos;
+}
+
+__attribute__((target("avx2")))
+static size_t
+find_00_00_01_avx2(const uint8_t *buf, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = 0;
+
+    for (; i + 32 + 2 <= len; i += 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (buf + i + 2));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, one));
+        if (!mask)
+            continue;
+
+        __m256i a = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (buf + i + 1));
+        mask &= _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                    _mm256_cmpeq_epi8(b, zero)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    size_t pos = find_00_00_01_scalar(buf + i, len - i);
+    return i + pos;
+}
+#endif
+
+#ifdef NV_NAL_SCANNER_NEON
+static size_t
+find_00_00_01_neon(const uint8_t *buf, size_t len)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    size_t i = 0;
+
+    for (; i + 16 + 2 <= len; i += 16)
+    {
+        uint8x16_t a = vld1q_u8(buf + i);
+        uint8x16_t b = vld1q_u8(buf + i + 1);
+        uint8x16_t c = vld1q_u8(buf + i + 2);
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)),
+                vceqq_u8(c, one));
+        uint64x2_t m64 = vreinterpretq_u64_u8(m);
+        uint64_t lo = vgetq_lane_u64(m64, 0);
+        uint64_t hi = vgetq_lane_u64(m64, 1);
+
+        /* each matching lane is 0xFF, little endian byte order */
+        if (lo)
+            return i + (__builtin_ctzll(lo) >> 3);
+        if (hi)
+            return i + 8 + (__builtin_ctzll(hi) >> 3);
+    }
+
+    size_t pos = find_00_00_01_scalar(buf + i, len - i);
+    return i + pos;
+}
+#endif
+
+static bool
+isa_supported(NvNalScannerIsa isa)
+{
+#ifdef NV_NAL_SCANNER_X86
+    /* may run from a static initializer, before the runtime did it */
+    __builtin_cpu_init();
+#endif
+    switch (isa)
+    {
+        case NV_NAL_SCANNER_ISA_SCALAR:
+            return true;
+#ifdef NV_NAL_SCANNER_X86
+        case NV_NAL_SCANNER_ISA_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case NV_NAL_SCANNER_ISA_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef NV_NAL_SCANNER_NEON
+        case NV_NAL_SCANNER_ISA_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+static find_00_00_01_fn
+isa_function(NvNalScannerIsa isa)
+{
+    switch (isa)
+    {
+#ifdef NV_NAL_SCANNER_X86
+        case NV_NAL_SCANNER_ISA_SSE2:
+            return find_00_00_01_sse2;
+        case NV_NAL_SCANNER_ISA_AVX2:
+            return find_00_00_01_avx2;
+#endif
+#ifdef NV_NAL_SCANNER_NEON
+        case NV_NAL_SCANNER_ISA_NEON:
+            return find_00_00_01_neon;
+#endif
+        default:
+            return find_00_00_01_scalar;
+    }
+}
+
+static NvNalScannerIsa
+best_isa()
+{
+    static const NvNalScannerIsa order[] = {
+        NV_NAL_SCANNER_ISA_AVX2,
+        NV_NAL_SCANNER_ISA_SSE2,
+        NV_NAL_SCANNER_ISA_NEON,
+    };
+
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+    {
+        if (isa_supported(order[i]))
+            return order[i];
+    }
+    return NV_NAL_SCANNER_ISA_SCALAR;
+}
+
+static NvNalScannerIsa scanner_isa = best_isa();
+static find_00_00_01_fn scanner_find = isa_function(scanner_isa);
+
+size_t
+nv_nal_find_start_code(const uint8_t *buf, size_t len, uint32_t *start_code_len)
+{
+    size_t pos = scanner_find(buf, len);
+    uint32_t sc_len = 3;
+
+    if (pos < len && pos > 0 && buf[pos - 1] == 0)
+    {
+        pos--;
+        sc_len = 4;
+    }
+
+    if (start_code_len)
+        *start_code_len = sc_len;
+    return pos;
+}
+
+int
+nv_nal_scan_units(const uint8_t *buf, size_t len, NvNalCodec codec,
+        NvNalUnit *units, int max_units)
+{
+    uint32_t sc_len;
+    size_t pos = nv_nal_find_start_code(buf, len, &sc_len);
+    int count = 0;
+
+    while (pos < len && count < max_units)
+    {
+        NvNalUnit &unit = units[count++];
+        size_t header = pos + sc_len;
+        size_t next = len;
+        uint32_t next_sc_len = 0;
+
+        if (header < len)
+        {
+            next = header + nv_nal_find_start_code(buf + header, len - header,
+                    &next_sc_len);
+        }
+
+        unit.offset = pos;
+        unit.size = next - pos;
+        unit.start_code_len = sc_len;
+        if (header >= len)
+            unit.type = 0;
+        else if (codec == NV_NAL_CODEC_H265)
+            unit.type = H265_NAL_TYPE(buf[header]);
+        else
+            unit.type = H264_NAL_TYPE(buf[header]);
+
+        pos = next;
+        sc_len = next_sc_len;
+    }
+
+    return count;
+}
+
+int
+nv_nal_scanner_set_isa(NvNalScannerIsa isa)
+{
+    if (isa < 0 || isa >= NV_NAL_SCANNER_ISA_COUNT || !isa_supported(isa))
+        return -1;
+
+    scanner_isa = isa;
+    scanner_find = isa_function(isa);
+    return 0;
+}
+
+NvNalScannerIsa
+nv_nal_scanner_get_isa()
+{
+    return scanner_isa;
+}
+
+const char *
+nv_nal_scanner_isa_name(NvNalScannerIsa isa)
+{
+    switch (isa)
+    {
+        case NV_NAL_SCANNER_ISA_SCALAR:
+            return "scalar";
+        case NV_NAL_SCANNER_ISA_SSE2:
+            return "sse2";
+        case NV_NAL_SCANNER_ISA_AVX2:
+            return "avx2";
+        case NV_NAL_SCANNER_ISA_NEON:
+            return "neon";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "NvThreadPolicy.h"
+
+#define NV_THREAD_MAX_CPUS 64
+
+void
+nv_thread_policy_init(NvThreadPolicy *policy)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->sched_policy = -1;
+    policy->nice = NV_THREAD_NICE_KEEP;
+}
+
+bool
+nv_thread_policy_is_default(const NvThreadPolicy *policy)
+{
+    return policy->cpu_mask == 0 && policy->sched_policy == -1 &&
+        policy->nice == NV_THREAD_NICE_KEEP && policy->name[0] == '\0';
+}
+
+int
+nv_thread_policy_apply(const NvThreadPolicy *policy)
+{
+    int err = 0;
+    int ret;
+
+    if (policy->name[0])
+    {
+        if (prctl(PR_SET_NAME, policy->name, 0, 0, 0) < 0 && !err)
+            err = errno;
+    }
+
+    if (policy->cpu_mask)
+    {
+        cpu_set_t cpuset;
+
+        CPU_ZERO(&cpuset);
+        for (int cpu = 0; cpu < NV_THREAD_MAX_CPUS; cpu++)
+        {
+            if (policy->cpu_mask & (1ULL << cpu))
+                CPU_SET(cpu, &cpuset);
+        }
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (ret && !err)
+            err = ret;
+    }
+
+    if (policy->sched_policy != -1)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        if (policy->sched_policy == SCHED_FIFO)
+            param.sched_priority = policy->sched_priority;
+        ret = pthread_setschedparam(pthread_self(), policy->sched_policy, &param);
+        if (ret && !err)
+            err = ret;
+    }
+
+    if (policy->nice != NV_THREAD_NICE_KEEP)
+    {
+        /* Linux keeps the nice value per thread, addressed by its tid */
+        if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), policy->nice) < 0 && !err)
+            err = errno;
+    }
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int
+nv_thread_policy_parse_cpus(const char *list, uint64_t *cpu_mask)
+{
+    uint64_t mask = 0;
+    const char *p = list;
+
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0 || first >= NV_THREAD_MAX_CPUS)
+            return -1;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= NV_THREAD_MAX_CPUS)
+                return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+            mask |= 1ULL << cpu;
+
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+
+    if (!mask)
+        return -1;
+    *cpu_mask = mask;
+    return 0;
+}
+
+int
+nv_thread_policy_parse_sched(const char *str, NvThreadPolicy *policy)
+{
+    if (!strcmp(str, "other"))
+    {
+        policy->sched_policy = SCHED_OTHER;
+        policy->sched_priority = 0;
+        return 0;
+    }
+
+    if (!strncmp(str, "fifo:", 5))
+    {
+        char *end;
+        long prio = strtol(str + 5, &end, 10);
+
+        if (end == str + 5 || *end || prio < sched_get_priority_min(SCHED_FIFO) ||
+                prio > sched_get_priority_max(SCHED_FIFO))
+            return -1;
+        policy->sched_policy = SCHED_FIFO;
+        policy->sched_priority = prio;
+        return 0;
+    }
+
+    return -1;
+}
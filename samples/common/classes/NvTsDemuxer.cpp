@@ -0,0 +1,480 @@
+#include "NvDemuxer.h"
+#include "NvLogging.h"
+#include "NvNalScanner.h"
+
+#include <algorithm>
+#include <string.h>
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_PAT 0x0000
+#define TS_PID_NULL 0x1fff
+#define M2TS_HEADER_SIZE 4
+#define TS_SYNC_CHECK_PACKETS 4
+/** The program tables are looked for in this many bytes. */
+#define TS_PROBE_SIZE (16 * 1024 * 1024)
+
+#define TS_STREAM_TYPE_MPEG1_VIDEO 0x01
+#define TS_STREAM_TYPE_MPEG2_VIDEO 0x02
+#define TS_STREAM_TYPE_H264 0x1b
+#define TS_STREAM_TYPE_H265 0x24
+
+#define PTS_CLOCK 90000
+#define PTS_MASK ((1ULL << 33) - 1)
+#define NO_PTS (~0ULL)
+
+using namespace std;
+
+static const char *comp_name = "NvTsDemuxer";
+
+/**
+ * The parts of a transport packet the demuxer uses.
+ */
+typedef struct
+{
+    uint32_t pid;
+    bool unit_start;            /**< payload_unit_start_indicator */
+    bool random_access;         /**< random_access_indicator */
+    const uint8_t *payload;     /**< NULL if the packet has none. */
+    size_t payload_size;
+} TsPacket;
+
+/**
+ * A random access point, the start of a PES packet with a key frame.
+ */
+typedef struct
+{
+    uint64_t pts;               /**< Relative to the first PTS, 90 kHz. */
+    size_t position;            /**< Offset of its first transport packet. */
+} TsIndexEntry;
+
+static bool
+parse_packet(const uint8_t *data, TsPacket *packet)
+{
+    uint32_t adaptation_control;
+    size_t pos = 4;
+
+    if (data[0] != TS_SYNC_BYTE)
+        return false;
+    packet->pid = ((data[1] & 0x1f) << 8) | data[2];
+    packet->unit_start = data[1] & 0x40;
+    packet->random_access = false;
+    packet->payload = NULL;
+    packet->payload_size = 0;
+
+    adaptation_control = (data[3] >> 4) & 0x03;
+    if (adaptation_control & 0x02)
+    {
+        size_t length = data[4];
+
+        if (length > TS_PACKET_SIZE - 5)
+            return false;
+        packet->random_access = length && (data[5] & 0x40);
+        pos += 1 + length;
+    }
+    if ((adaptation_control & 0x01) && pos < TS_PACKET_SIZE)
+    {
+        packet->payload = data + pos;
+        packet->payload_size = TS_PACKET_SIZE - pos;
+    }
+    return true;
+}
+
+/**
+ * Gets the PTS of the PES packet header at the start of a payload.
+ *
+ * @param[out] header_size Size of the PES header.
+ * @return The PTS, or NO_PTS if the header has none.
+ */
+static uint64_t
+parse_pes_header(const uint8_t *data, size_t size, size_t *header_size)
+{
+    const uint8_t *pts = data + 9;
+
+    // packet_start_code_prefix, stream_id, PES_packet_length, flags and
+    // PES_header_data_length
+    if (size < 9 || data[0] || data[1] || data[2] != 1 ||
+            (size_t) 9 + data[8] > size)
+    {
+        *header_size = size;
+        return NO_PTS;
+    }
+    *header_size = 9 + data[8];
+    if (!(data[7] & 0x80) || data[8] < 5)
+        return NO_PTS;
+    return ((uint64_t) (pts[0] & 0x0e) << 29) | (pts[1] << 22) |
+        ((pts[2] & 0xfe) << 14) | (pts[3] << 7) | (pts[4] >> 1);
+}
+
+/**
+ * Gets a PSI section from the payload of the packet that starts it.
+ *
+ * @return Pointer to the table_id, or NULL if the section does not fit
+ *         the packet.
+ */
+static const uint8_t *
+get_section(const TsPacket &packet, size_t *section_size)
+{
+    size_t pointer;
+
+    if (!packet.payload || !packet.unit_start || !packet.payload_size)
+        return NULL;
+    pointer = packet.payload[0];
+    if (1 + pointer + 3 > packet.payload_size)
+        return NULL;
+    const uint8_t *section = packet.payload + 1 + pointer;
+    *section_size = 3 + (((section[1] & 0x0f) << 8) | section[2]);
+    if (*section_size > packet.payload_size - 1 - pointer || *section_size < 12)
+        return NULL;
+    return section;
+}
+
+static bool
+compare_pts(uint64_t pts, const TsIndexEntry &entry)
+{
+    return pts < entry.pts;
+}
+
+class NvTsDemuxer : public NvDemuxer
+{
+public:
+    NvTsDemuxer(NvBitstreamSource *source)
+        : NvDemuxer(source), packet_size(TS_PACKET_SIZE), header_size(0),
+          video_pid(TS_PID_NULL), first_pts(NO_PTS), last_pts(0),
+          index_built(false)
+    {
+    }
+
+    /**
+     * Checks the packet size and finds the video stream in the program
+     * tables.
+     */
+    bool open();
+
+    int readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample);
+    int seek(uint64_t pts);
+
+    const char *getFormatName()
+    {
+        return "MPEG-TS";
+    }
+
+private:
+    size_t packet_size;         /**< 188, or 192 for M2TS. */
+    size_t header_size;         /**< Bytes in front of the sync byte. */
+    uint32_t video_pid;
+    uint64_t first_pts;         /**< Times are relative to this one. */
+    uint64_t last_pts;          /**< Relative, for PES packets without PTS. */
+    vector<TsIndexEntry> index;
+    bool index_built;
+
+    /**
+     * Reads the packet at the read position, moving the position to the
+     * next one.
+     *
+     * @param[out] position Offset of the packet.
+     * @return false at the end of the file. Bytes that are not a packet
+     *         are skipped up to the next sync byte.
+     */
+    bool nextPacket(TsPacket *packet, size_t *position);
+
+    /**
+     * Checks whether the frame starting in a payload is a key frame, for
+     * streams whose muxer does not set random_access_indicator.
+     */
+    bool startsKeyFrame(const uint8_t *data, size_t size);
+
+    /**
+     * Records the random access points of the video stream.
+     */
+    void buildIndex();
+
+    /**
+     * Gets a PTS relative to the first one, across a wrap of the 33-bit
+     * counter. Earlier ones, of frames reordered in front of the first
+     * frame, become 0.
+     */
+    uint64_t relativePts(uint64_t pts)
+    {
+        uint64_t relative = (pts - first_pts) & PTS_MASK;
+
+        return relative > PTS_MASK / 2 ? 0 : relative;
+    }
+};
+
+bool
+NvTsDemuxer::nextPacket(TsPacket *packet, size_t *position)
+{
+    const uint8_t *data;
+    const uint8_t *sync;
+
+    while ((data = source->peek(packet_size)) != NULL)
+    {
+        *position = source->getPosition();
+        if (parse_packet(data + header_size, packet))
+        {
+            source->skip(packet_size);
+            return true;
+        }
+        // Resynchronize on the next sync byte
+        sync = (const uint8_t *) memchr(data + header_size + 1, TS_SYNC_BYTE,
+                packet_size - header_size - 1);
+        source->skip(sync ? sync - data - header_size : packet_size);
+    }
+    return false;
+}
+
+bool
+NvTsDemuxer::open()
+{
+    TsPacket packet;
+    size_t position;
+    uint32_t pmt_pid = TS_PID_NULL;
+
+    // 188-byte packets, or 192-byte M2TS packets with a timecode in front
+    for (int i = 0; i < 2; i++)
+    {
+        size_t size = i ? TS_PACKET_SIZE + M2TS_HEADER_SIZE : TS_PACKET_SIZE;
+        size_t offset = i ? M2TS_HEADER_SIZE : 0;
+        size_t packets = min((size_t) TS_SYNC_CHECK_PACKETS,
+                source->getSize() / size);
+        const uint8_t *data = source->peek(packets * size);
+        size_t checked = 0;
+
+        while (data && checked < packets && data[checked * size + offset] == TS_SYNC_BYTE)
+            checked++;
+        if (packets && checked == packets)
+        {
+            packet_size = size;
+            header_size = offset;
+            break;
+        }
+        if (i)
+        {
+            COMP_ERROR_MSG("No transport stream sync bytes");
+            return false;
+        }
+    }
+
+    // PAT, then the PMT of the first program, then the first video PES
+    // packet for the first PTS
+    while (first_pts == NO_PTS && source->getPosition() < TS_PROBE_SIZE &&
+            nextPacket(&packet, &position))
+    {
+        size_t section_size;
+        const uint8_t *section;
+
+        if (packet.pid == TS_PID_PAT && pmt_pid == TS_PID_NULL &&
+                (section = get_section(packet, &section_size)) && section[0] == 0x00)
+        {
+            // Program loop between the 8-byte header and the CRC
+            for (size_t pos = 8; pos + 4 <= section_size - 4; pos += 4)
+            {
+                if (readBigEndian(section + pos, 2))
+                {
+                    pmt_pid = readBigEndian(section + pos + 2, 2) & 0x1fff;
+                    break;
+                }
+            }
+        }
+        else if (pmt_pid != TS_PID_NULL && packet.pid == pmt_pid &&
+                video_pid == TS_PID_NULL &&
+                (section = get_section(packet, &section_size)) && section[0] == 0x02)
+        {
+            size_t pos = 12 + (readBigEndian(section + 10, 2) & 0x0fff);
+
+            while (pos + 5 <= section_size - 4 && video_pid == TS_PID_NULL)
+            {
+                uint32_t stream_type = section[pos];
+                uint32_t pid = readBigEndian(section + pos + 1, 2) & 0x1fff;
+
+                if (stream_type == TS_STREAM_TYPE_H264)
+                    codec = NV_DEMUXER_CODEC_H264;
+                else if (stream_type == TS_STREAM_TYPE_H265)
+                    codec = NV_DEMUXER_CODEC_H265;
+                else if (stream_type == TS_STREAM_TYPE_MPEG2_VIDEO ||
+                        stream_type == TS_STREAM_TYPE_MPEG1_VIDEO)
+                    codec = NV_DEMUXER_CODEC_MPEG2;
+                if (codec != NV_DEMUXER_CODEC_UNKNOWN)
+                    video_pid = pid;
+                pos += 5 + (readBigEndian(section + pos + 3, 2) & 0x0fff);
+            }
+        }
+        else if (video_pid != TS_PID_NULL && packet.pid == video_pid &&
+                packet.unit_start && packet.payload)
+        {
+            size_t pes_header_size;
+
+            first_pts = parse_pes_header(packet.payload, packet.payload_size,
+                    &pes_header_size);
+        }
+    }
+    if (video_pid == TS_PID_NULL)
+    {
+        COMP_ERROR_MSG("No H.264, H.265 or MPEG-2 video stream");
+        return false;
+    }
+    if (first_pts == NO_PTS)
+        first_pts = 0;
+
+    // The duration from the last PTS, looked for near the end of the file
+    source->seek(source->getSize() > TS_PROBE_SIZE / 16 ?
+            source->getSize() - TS_PROBE_SIZE / 16 : 0);
+    while (nextPacket(&packet, &position))
+    {
+        size_t pes_header_size;
+        uint64_t pts;
+
+        if (packet.pid == video_pid && packet.unit_start && packet.payload &&
+                (pts = parse_pes_header(packet.payload, packet.payload_size,
+                    &pes_header_size)) != NO_PTS)
+            duration = toMicroseconds(relativePts(pts), PTS_CLOCK);
+    }
+    source->rewind();
+    return true;
+}
+
+bool
+NvTsDemuxer::startsKeyFrame(const uint8_t *data, size_t size)
+{
+    NvNalUnit units[8];
+    NvNalCodec nal_codec = codec == NV_DEMUXER_CODEC_H265 ?
+        NV_NAL_CODEC_H265 : NV_NAL_CODEC_H264;
+    size_t count;
+
+    if (codec != NV_DEMUXER_CODEC_H264 && codec != NV_DEMUXER_CODEC_H265)
+        return false;
+
+    // An IDR or IRAP slice, or a sequence parameter set in front of one
+    count = nv_nal_scan_units(data, size, nal_codec, units, 8);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (codec == NV_DEMUXER_CODEC_H264 && (units[i].type == 5 || units[i].type == 7))
+            return true;
+        if (codec == NV_DEMUXER_CODEC_H265 &&
+                ((units[i].type >= 16 && units[i].type <= 21) || units[i].type == 33))
+            return true;
+    }
+    return false;
+}
+
+int
+NvTsDemuxer::readSample(uint8_t *dst, size_t dst_size, NvDemuxerSample *sample)
+{
+    TsPacket packet;
+    size_t position;
+    size_t written = 0;
+    bool started = false;
+
+    // A frame is a PES packet, which ends where the next one starts
+    while (nextPacket(&packet, &position))
+    {
+        const uint8_t *payload = packet.payload;
+        size_t payload_size = packet.payload_size;
+
+        if (packet.pid != video_pid || !payload)
+            continue;
+        if (packet.unit_start)
+        {
+            size_t pes_header_size;
+            uint64_t pts;
+
+            if (started)
+            {
+                source->seek(position);
+                break;
+            }
+            pts = parse_pes_header(payload, payload_size, &pes_header_size);
+            if (pts != NO_PTS)
+                last_pts = relativePts(pts);
+            payload += pes_header_size;
+            payload_size -= pes_header_size;
+            started = true;
+            sample->pts = toMicroseconds(last_pts, PTS_CLOCK);
+            sample->key_frame = packet.random_access ||
+                startsKeyFrame(payload, payload_size);
+        }
+        else if (!started)
+        {
+            // The rest of a PES packet whose start was not read
+            continue;
+        }
+
+        if (payload_size > dst_size - written)
+        {
+            COMP_ERROR_MSG("Frame does not fit the buffer");
+            return -1;
+        }
+        memcpy(dst + written, payload, payload_size);
+        written += payload_size;
+    }
+
+    if (!started)
+        return 0;
+    sample->size = written;
+    return 1;
+}
+
+void
+NvTsDemuxer::buildIndex()
+{
+    TsPacket packet;
+    size_t position;
+
+    index_built = true;
+    source->rewind();
+    while (nextPacket(&packet, &position))
+    {
+        size_t pes_header_size;
+        uint64_t pts;
+
+        if (packet.pid != video_pid || !packet.unit_start || !packet.payload)
+            continue;
+        pts = parse_pes_header(packet.payload, packet.payload_size,
+                &pes_header_size);
+        if (pts != NO_PTS && (packet.random_access ||
+                    startsKeyFrame(packet.payload + pes_header_size,
+                        packet.payload_size - pes_header_size)))
+        {
+            TsIndexEntry entry = { relativePts(pts), position };
+
+            index.push_back(entry);
+        }
+    }
+}
+
+int
+NvTsDemuxer::seek(uint64_t pts)
+{
+    uint64_t target = pts * PTS_CLOCK / 1000000;
+    vector<TsIndexEntry>::iterator it;
+
+    if (!pts)
+    {
+        source->rewind();
+        return 0;
+    }
+
+    // Transport streams have no index, the file is read once for it
+    if (!index_built)
+        buildIndex();
+    it = upper_bound(index.begin(), index.end(), target, compare_pts);
+    if (it == index.begin())
+        source->rewind();
+    else
+        source->seek((--it)->position);
+    return 0;
+}
+
+NvDemuxer *
+NvDemuxer::createTsDemuxer(NvBitstreamSource *source)
+{
+    NvTsDemuxer *demuxer = new NvTsDemuxer(source);
+
+    if (!demuxer->open())
+    {
+        delete demuxer;
+        return NULL;
+    }
+    return demuxer;
+}
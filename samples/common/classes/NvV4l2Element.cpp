@@ -254,6 +254,39 @@ NvV4l2Element::waitForIdle(uint32_t max_wait_ms)
     return 0;
 }
 
+int
+NvV4l2Element::setDQThreadPolicy(const NvThreadPolicy &policy)
+{
+    int ret = 0;
+
+    ret |= output_plane.setDQThreadPolicy(policy);
+    ret |= capture_plane.setDQThreadPolicy(policy);
+
+    return ret;
+}
+
+int
+NvV4l2Element::setDQWorkerPool(NvDQWorkerPool *pool)
+{
+    int ret = 0;
+
+    ret |= output_plane.setDQWorkerPool(pool);
+    ret |= capture_plane.setDQWorkerPool(pool);
+
+    return ret;
+}
+
+int
+NvV4l2Element::setBufferPool(NvBufferPool *pool)
+{
+    int ret = 0;
+
+    ret |= output_plane.setBufferPool(pool);
+    ret |= capture_plane.setBufferPool(pool);
+
+    return ret;
+}
+
 int
 NvV4l2Element::isInError()
 {
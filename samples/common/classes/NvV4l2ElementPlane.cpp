@@ -89,6 +89,12 @@ NvV4l2ElementPlane::NvV4l2ElementPlane(enum v4l2_buf_type buf_type,
     stop_dqthread = false;
     dq_thread = 0;
     callback = NULL;
+    batch_callback = NULL;
+    nv_thread_policy_init(&dq_policy);
+    buffer_pool = NULL;
+    dq_pool = NULL;
+    dq_pool_slot = -1;
+    dq_parked = false;
 
     memory_type = V4L2_MEMORY_MMAP;
 
@@ -97,6 +103,8 @@ NvV4l2ElementPlane::NvV4l2ElementPlane(enum v4l2_buf_type buf_type,
 
 NvV4l2ElementPlane::~NvV4l2ElementPlane()
 {
+    if (dq_pool && dq_pool_slot >= 0)
+        dq_pool->removePlane(this);
     pthread_mutex_destroy(&plane_lock);
     pthread_cond_destroy(&plane_cond);
 }
@@ -114,8 +122,7 @@ NvV4l2ElementPlane::getNthBuffer(uint32_t n)
 }
 
 int
-NvV4l2ElementPlane::dqBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer ** buffer,
-        NvBuffer ** shared_buffer, uint32_t num_retries)
+NvV4l2ElementPlane::dqBufferIoctl(struct v4l2_buffer &v4l2_buf, uint32_t num_retries)
 {
     int ret;
 
@@ -127,30 +134,7 @@ NvV4l2ElementPlane::dqBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer ** buffer,
 
         if (ret == 0)
         {
-            pthread_mutex_lock(&plane_lock);
-            if (buffer)
-                *buffer = buffers[v4l2_buf.index];
-            if (shared_buffer && memory_type == V4L2_MEMORY_DMABUF)
-            {
-                *shared_buffer =
-                    (NvBuffer *) buffers[v4l2_buf.index]->shared_buffer;
-            }
-            for (uint32_t i = 0; i < buffers[v4l2_buf.index]->n_planes; i++)
-            {
-                buffers[v4l2_buf.index]->planes[i].bytesused =
-                    v4l2_buf.m.planes[i].bytesused;
-            }
-
-            if (buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
-            {
-                v4l2elem_profiler.finishProcessing(0, false);
-            }
-
-            total_dequeued_buffers++;
-            num_queued_buffers--;
-            pthread_cond_broadcast(&plane_cond);
-            PLANE_DEBUG_MSG("DQed buffer " << v4l2_buf.index);
-            pthread_mutex_unlock(&plane_lock);
+            break;
         }
         else if (errno == EAGAIN)
         {
@@ -184,14 +168,105 @@ NvV4l2ElementPlane::dqBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer ** buffer,
     return ret;
 }
 
+void
+NvV4l2ElementPlane::completeDqBuffer(struct v4l2_buffer &v4l2_buf,
+        NvBuffer ** buffer, NvBuffer ** shared_buffer)
+{
+    if (buffer)
+        *buffer = buffers[v4l2_buf.index];
+    if (shared_buffer && memory_type == V4L2_MEMORY_DMABUF)
+    {
+        *shared_buffer =
+            (NvBuffer *) buffers[v4l2_buf.index]->shared_buffer;
+    }
+    for (uint32_t i = 0; i < buffers[v4l2_buf.index]->n_planes; i++)
+    {
+        buffers[v4l2_buf.index]->planes[i].bytesused =
+            v4l2_buf.m.planes[i].bytesused;
+    }
+
+    if (buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        v4l2elem_profiler.finishProcessing(0, false);
+    }
+
+    total_dequeued_buffers++;
+    num_queued_buffers--;
+    PLANE_DEBUG_MSG("DQed buffer " << v4l2_buf.index);
+}
+
 int
-NvV4l2ElementPlane::qBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buffer)
+NvV4l2ElementPlane::dqBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer ** buffer,
+        NvBuffer ** shared_buffer, uint32_t num_retries)
 {
     int ret;
+
+    ret = dqBufferIoctl(v4l2_buf, num_retries);
+    if (ret == 0)
+    {
+        pthread_mutex_lock(&plane_lock);
+        completeDqBuffer(v4l2_buf, buffer, shared_buffer);
+        pthread_cond_broadcast(&plane_cond);
+        pthread_mutex_unlock(&plane_lock);
+    }
+
+    return ret;
+}
+
+int
+NvV4l2ElementPlane::dqBuffers(struct v4l2_buffer *v4l2_bufs, NvBuffer ** nvbuffers,
+        NvBuffer ** shared_buffers, uint32_t max_count, uint32_t num_retries)
+{
+    uint32_t count;
     uint32_t i;
-    NvBuffer *buffer;
+
+    if (max_count == 0)
+        return 0;
+
+    if (dqBufferIoctl(v4l2_bufs[0], num_retries) < 0)
+        return -1;
+
+    // Only a non-blocking device tells us without waiting that nothing is left
+    for (count = 1; !blocking && count < max_count; count++)
+    {
+        struct v4l2_buffer &prev = v4l2_bufs[count - 1];
+        struct v4l2_buffer &v4l2_buf = v4l2_bufs[count];
+
+        if (prev.flags & V4L2_BUF_FLAG_LAST)
+            break;
+
+        v4l2_buf.type = buf_type;
+        v4l2_buf.memory = memory_type;
+        if (v4l2_ioctl(fd, VIDIOC_DQBUF, &v4l2_buf) < 0)
+        {
+            if (errno != EAGAIN)
+            {
+                is_in_error = 1;
+                PLANE_SYS_ERROR_MSG("Error while DQing buffer");
+            }
+            break;
+        }
+    }
 
     pthread_mutex_lock(&plane_lock);
+    for (i = 0; i < count; i++)
+    {
+        completeDqBuffer(v4l2_bufs[i], nvbuffers ? &nvbuffers[i] : NULL,
+                shared_buffers ? &shared_buffers[i] : NULL);
+    }
+    pthread_cond_broadcast(&plane_cond);
+    pthread_mutex_unlock(&plane_lock);
+
+    return count;
+}
+
+int
+NvV4l2ElementPlane::qBufferLocked(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buffer)
+{
+    int ret;
+    uint32_t i;
+    NvBuffer *buffer;
+
     buffer = buffers[v4l2_buf.index];
 
     v4l2_buf.type = buf_type;
@@ -239,8 +314,6 @@ NvV4l2ElementPlane::qBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buff
             }
             break;
         default:
-            pthread_cond_broadcast(&plane_cond);
-            pthread_mutex_unlock(&plane_lock);
             return -1;
     }
 
@@ -258,15 +331,51 @@ NvV4l2ElementPlane::qBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buff
     else
     {
         PLANE_DEBUG_MSG("Qed buffer " << v4l2_buf.index);
-        pthread_cond_broadcast(&plane_cond);
         total_queued_buffers++;
         num_queued_buffers++;
+        if (dq_parked)
+        {
+            dq_parked = false;
+            dq_pool->kickPlane(this, false);
+        }
     }
+
+    return ret;
+}
+
+int
+NvV4l2ElementPlane::qBuffer(struct v4l2_buffer &v4l2_buf, NvBuffer * shared_buffer)
+{
+    int ret;
+
+    pthread_mutex_lock(&plane_lock);
+    ret = qBufferLocked(v4l2_buf, shared_buffer);
+    pthread_cond_broadcast(&plane_cond);
     pthread_mutex_unlock(&plane_lock);
 
     return ret;
 }
 
+int
+NvV4l2ElementPlane::qBuffers(struct v4l2_buffer *v4l2_bufs, NvBuffer ** shared_buffers,
+        uint32_t count)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&plane_lock);
+    for (i = 0; i < count; i++)
+    {
+        if (qBufferLocked(v4l2_bufs[i], shared_buffers ? shared_buffers[i] : NULL) < 0)
+            break;
+    }
+    pthread_cond_broadcast(&plane_cond);
+    pthread_mutex_unlock(&plane_lock);
+
+    if (i == 0 && count > 0)
+        return -1;
+    return i;
+}
+
 int
 NvV4l2ElementPlane::mapOutputBuffers(struct v4l2_buffer &v4l2_buf, int dmabuff_fd)
 {
@@ -559,6 +668,13 @@ NvV4l2ElementPlane::setStreamStatus(bool status)
         {
             num_queued_buffers = 0;
             pthread_cond_broadcast(&plane_cond);
+            if (dq_pool && dqthread_running)
+                dq_pool->kickPlane(this, true);
+        }
+        else if (dq_parked)
+        {
+            dq_parked = false;
+            dq_pool->kickPlane(this, false);
         }
 
         if (buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
@@ -687,7 +803,7 @@ NvV4l2ElementPlane::setupPlane(enum v4l2_memory mem_type, uint32_t num_buffers,
             case V4L2_MEMORY_USERPTR:
                 if (allocate)
                 {
-                    if (buffers[i]->allocateMemory())
+                    if (buffers[i]->allocateMemory(buffer_pool))
                     {
                         goto error;
                     }
@@ -791,6 +907,50 @@ bool NvV4l2ElementPlane::setDQThreadCallback(dqThreadCallback callback)
     return true;
 }
 
+bool NvV4l2ElementPlane::setDQThreadBatchCallback(dqThreadBatchCallback callback)
+{
+    if (dqthread_running)
+        return false;
+    this->batch_callback = callback;
+    return true;
+}
+
+int
+NvV4l2ElementPlane::setBufferPool(NvBufferPool *pool)
+{
+    if (num_buffers)
+    {
+        PLANE_ERROR_MSG("Buffer pool must be set before requesting buffers");
+        return -1;
+    }
+    buffer_pool = pool;
+    return 0;
+}
+
+int
+NvV4l2ElementPlane::setDQWorkerPool(NvDQWorkerPool *pool)
+{
+    if (dqthread_running)
+    {
+        PLANE_ERROR_MSG("DQ worker pool must be set before starting the DQ Thread");
+        return -1;
+    }
+    dq_pool = pool;
+    return 0;
+}
+
+int
+NvV4l2ElementPlane::setDQThreadPolicy(const NvThreadPolicy &policy)
+{
+    if (dqthread_running)
+    {
+        PLANE_ERROR_MSG("DQ Thread policy must be set before starting the DQ Thread");
+        return -1;
+    }
+    dq_policy = policy;
+    return 0;
+}
+
 void *
 NvV4l2ElementPlane::dqThread(void *data)
 {
@@ -800,21 +960,36 @@ NvV4l2ElementPlane::dqThread(void *data)
 
     PLANE_DEBUG_MSG("Starting DQthread");
     prctl (PR_SET_NAME, plane_name, 0, 0, 0);
+    if (nv_thread_policy_apply(&plane->dq_policy) < 0)
+    {
+        PLANE_WARN_MSG("Could not apply DQ Thread policy: " << strerror(errno));
+    }
+    // Set up once, the DQ ioctl fills in everything but the fields reset below
+    struct v4l2_buffer v4l2_bufs[MAX_DQ_BATCH];
+    struct v4l2_plane planes[MAX_DQ_BATCH][MAX_PLANES];
+    NvBuffer *buffers[MAX_DQ_BATCH];
+    NvBuffer *shared_buffers[MAX_DQ_BATCH];
+    uint32_t max_count = plane->batch_callback ? MAX_DQ_BATCH : 1;
+
+    memset(v4l2_bufs, 0, sizeof(v4l2_bufs));
+    memset(planes, 0, sizeof(planes));
+    memset(shared_buffers, 0, sizeof(shared_buffers));
+
     plane->stop_dqthread = false;
     while (!plane->stop_dqthread)
     {
-        struct v4l2_buffer v4l2_buf;
-        struct v4l2_plane planes[MAX_PLANES];
-        NvBuffer *buffer;
-        NvBuffer *shared_buffer;
         bool ret;
+        int count;
 
-        memset(&v4l2_buf, 0, sizeof(v4l2_buf));
-        memset(planes, 0, sizeof(planes));
-        v4l2_buf.m.planes = planes;
-        v4l2_buf.length = plane->n_planes;
+        for (uint32_t i = 0; i < max_count; i++)
+        {
+            v4l2_bufs[i].m.planes = planes[i];
+            v4l2_bufs[i].length = plane->n_planes;
+            v4l2_bufs[i].flags = 0;
+        }
 
-        if (plane->dqBuffer(v4l2_buf, &buffer, &shared_buffer, -1) < 0)
+        count = plane->dqBuffers(v4l2_bufs, buffers, shared_buffers, max_count, -1);
+        if (count < 0)
         {
             if (errno != EAGAIN)
             {
@@ -822,16 +997,24 @@ NvV4l2ElementPlane::dqThread(void *data)
             }
             if (errno != EAGAIN || plane->streamon)
             {
-                ret = plane->callback(NULL, NULL, NULL, plane->dqThread_data);
+                if (plane->batch_callback)
+                    ret = plane->batch_callback(NULL, NULL, NULL, 0, plane->dqThread_data);
+                else
+                    ret = plane->callback(NULL, NULL, NULL, plane->dqThread_data);
             }
             if (!plane->streamon)
             {
                 break;
             }
         }
+        else if (plane->batch_callback)
+        {
+            ret = plane->batch_callback(v4l2_bufs, buffers, shared_buffers, count,
+                    plane->dqThread_data);
+        }
         else
         {
-            ret = plane->callback(&v4l2_buf, buffer, shared_buffer,
+            ret = plane->callback(&v4l2_bufs[0], buffers[0], shared_buffers[0],
                     plane->dqThread_data);
         }
         if (!ret)
@@ -860,8 +1043,18 @@ NvV4l2ElementPlane::startDQThread(void *data)
         return 0;
     }
     dqThread_data = data;
-    pthread_create(&dq_thread, NULL, dqThread, this);
     dqthread_running = true;
+    if (dq_pool)
+    {
+        if (dq_pool->addPlane(this) == 0)
+        {
+            pthread_mutex_unlock(&plane_lock);
+            PLANE_DEBUG_MSG("Started DQ on worker pool");
+            return 0;
+        }
+        PLANE_WARN_MSG("Could not attach to DQ worker pool, starting a DQ Thread");
+    }
+    pthread_create(&dq_thread, NULL, dqThread, this);
     pthread_mutex_unlock(&plane_lock);
     PLANE_DEBUG_MSG("Started DQ Thread");
     return 0;
@@ -870,6 +1063,12 @@ NvV4l2ElementPlane::startDQThread(void *data)
 int
 NvV4l2ElementPlane::stopDQThread()
 {
+    if (dq_pool && !dq_thread)
+    {
+        dq_pool->removePlane(this);
+        PLANE_DEBUG_MSG("Stopped DQ on worker pool");
+        return 0;
+    }
     if (blocking)
     {
         PLANE_WARN_MSG("Should not be called in blocking mode");
@@ -911,8 +1110,12 @@ NvV4l2ElementPlane::waitForDQThread(uint32_t max_wait_ms)
 
     if (ret == 0)
     {
-        pthread_join(dq_thread, NULL);
-        dq_thread = 0;
+        // Planes on a worker pool have no thread to join
+        if (dq_thread)
+        {
+            pthread_join(dq_thread, NULL);
+            dq_thread = 0;
+        }
         PLANE_DEBUG_MSG("Stopped DQ Thread");
     }
     else
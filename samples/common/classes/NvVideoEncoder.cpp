@@ -273,20 +273,29 @@ NvVideoEncoder::setLevel(enum v4l2_mpeg_video_h264_level level)
     RETURN_ERROR_IF_FORMATS_NOT_SET();
     RETURN_ERROR_IF_BUFFERS_REQUESTED();
 
-    if (capture_plane_pixfmt != V4L2_PIX_FMT_H264)
+    memset(&control, 0, sizeof(control));
+    memset(&ctrls, 0, sizeof(ctrls));
+
+    if (capture_plane_pixfmt == V4L2_PIX_FMT_H264)
+    {
+        control.id = V4L2_CID_MPEG_VIDEO_H264_LEVEL;
+    }
+#ifdef V4L2_CID_MPEG_VIDEO_HEVC_LEVEL
+    else if (capture_plane_pixfmt == V4L2_PIX_FMT_H265)
     {
-        COMP_WARN_MSG("Currently only supported for H.264");
+        control.id = V4L2_CID_MPEG_VIDEO_HEVC_LEVEL;
+    }
+#endif
+    else
+    {
+        COMP_WARN_MSG("Currently only supported for H.264 and H.265");
         return 0;
     }
 
-    memset(&control, 0, sizeof(control));
-    memset(&ctrls, 0, sizeof(ctrls));
-
     ctrls.count = 1;
     ctrls.controls = &control;
     ctrls.ctrl_class = V4L2_CTRL_CLASS_MPEG;
 
-    control.id = V4L2_CID_MPEG_VIDEO_H264_LEVEL;
     control.value = level;
 
     CHECK_V4L2_RETURN(setExtControls(ctrls),
@@ -1,85 +0,0 @@
-/*
- * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- *  * Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- *  * Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- *  * Neither the name of NVIDIA CORPORATION nor the names of its
- *    contributors may be used to endorse or promote products derived
- *    from this software without specific prior written permission.
- *
- * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
- * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
- * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
- * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
- * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
- * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
- * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
- * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
- * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#ifndef __QUEUE_H__
-#define __QUEUE_H__
-
-// This is an implementation of thread-safe blocking queue using pthread
-// and std::queue
-
-#include <pthread.h>
-#include <queue>
-
-template<typename T>
-class Queue
-{
-public:
-    Queue()
-    {
-        pthread_mutex_init(&m_mutex, NULL);
-        pthread_cond_init(&m_cond, NULL);
-    }
-
-    ~Queue()
-    {
-        pthread_mutex_destroy(&m_mutex);
-        pthread_cond_destroy(&m_cond);
-    }
-
-    void push(const T& obj)
-    {
-        pthread_mutex_lock(&m_mutex);
-        m_queue.push(obj);
-        pthread_cond_signal(&m_cond);
-        pthread_mutex_unlock(&m_mutex);
-    }
-
-    T& pop()
-    {
-        pthread_mutex_lock(&m_mutex);
-        while(m_queue.empty())
-            pthread_cond_wait(&m_cond, &m_mutex);
-        T& obj = m_queue.front();
-        m_queue.pop();
-        pthread_mutex_unlock(&m_mutex);
-        return obj;
-    }
-
-    size_t size()
-    {
-        return m_queue.size();
-    }
-
-private:
-    std::queue<T> m_queue;
-    pthread_mutex_t m_mutex;
-    pthread_cond_t m_cond;
-};
-
-
-#endif  // __QUEUE_H__
@@ -41,10 +41,13 @@
         (timespec1)->tv_usec - (timespec2)->tv_usec)
 
 #define IS_EOS_BUFFER(buf)  (buf.fd < 0)
-#define MAX_QUEUE_SIZE      (10)
-#define MAX_TRT_BUFFER      (10)
 #define TRT_INTERVAL        (1)
 
+static_assert(FRAME_RING_SIZE > MAX_QUEUE_SIZE && FRAME_RING_SIZE > MAX_TRT_BUFFER,
+        "frame rings must hold all buffers and the EOS marker");
+static_assert(BBOX_RING_SIZE >= MAX_QUEUE_SIZE,
+        "bbox ring must hold a result for every frame in flight");
+
 #define TRT_MODEL    GOOGLENET_THREE_CLASS
 
 extern bool g_bVerbose;
@@ -147,7 +150,7 @@ bool TRTStreamConsumer::processFrame(Frame *frame)
     }
 
     BufferInfo buf;
-    buf.fd = m_emptyBufferQueue.pop();
+    m_emptyBufferQueue.pop(buf.fd);
     buf.number = iFrame->getNumber();
 
     // Get the IImageNativeBuffer extension interface and create the fd.
@@ -162,7 +165,7 @@ bool TRTStreamConsumer::processFrame(Frame *frame)
     if (iFrame->getNumber() % TRT_INTERVAL == 0)
     {
         BufferInfo trtBuf;
-        trtBuf.fd = m_emptyTRTBufferQueue.pop();
+        m_emptyTRTBufferQueue.pop(trtBuf.fd);
         trtBuf.number = iFrame->getNumber();
         iNativeBuffer->copyToNvBuffer(trtBuf.fd);
         m_trtBufferQueue.push(trtBuf);
@@ -187,11 +190,12 @@ bool TRTStreamConsumer::threadShutdown()
     m_TRTContext.destroyTrtContext();
 
     // Destroy all buffers
-    while (m_emptyBufferQueue.size())
-        NvBufferDestroy(m_emptyBufferQueue.pop());
+    int fd;
+    while (m_emptyBufferQueue.try_pop(fd))
+        NvBufferDestroy(fd);
 
-    while (m_emptyTRTBufferQueue.size())
-        NvBufferDestroy(m_emptyTRTBufferQueue.pop());
+    while (m_emptyTRTBufferQueue.try_pop(fd))
+        NvBufferDestroy(fd);
 
     return StreamConsumer::threadShutdown();
 }
@@ -206,7 +210,8 @@ bool TRTStreamConsumer::RenderThreadProc()
 
     while (true)
     {
-        BufferInfo buf = m_renderBufferQueue.pop();
+        BufferInfo buf;
+        m_renderBufferQueue.pop(buf);
 
         if (!IS_EOS_BUFFER(buf))
         {
@@ -217,7 +222,8 @@ bool TRTStreamConsumer::RenderThreadProc()
                 // Get bound box info from TRT thread
                 for (int class_num = 0; class_num < m_TRTContext.getModelClassCnt(); class_num++)
                 {
-                    vector<Rect2f> *bbox = m_bboxesQueue[class_num].pop();
+                    vector<Rect2f> *bbox;
+                    m_bboxesQueue[class_num].pop(bbox);
 
                     if (bbox)   // bbox = NULL means TRT thread has exited
                     {
@@ -301,7 +307,8 @@ bool TRTStreamConsumer::TRTThreadProc()
 
     while (true)
     {
-        BufferInfo buf = m_trtBufferQueue.pop();
+        BufferInfo buf;
+        m_trtBufferQueue.pop(buf);
         if (IS_EOS_BUFFER(buf))
             break;
 
@@ -363,11 +370,12 @@ bool TRTStreamConsumer::TRTThreadProc()
         bufNumInBatch = 0;  // Reset counter for next batch
     }
 
-    // Tell render thread we are exiting.
+    // Tell render thread we are exiting. A full ring already holds a result
+    // for every frame the render thread still has, so the marker can go.
     for (class_num = 0; class_num < classCnt; class_num++)
     {
         for (uint32_t i = 0; i < m_TRTContext.getBatchSize(); i++)
-            m_bboxesQueue[class_num].push(NULL);
+            m_bboxesQueue[class_num].try_push(NULL);
     }
 
     Log("TRT thread exited.\n");
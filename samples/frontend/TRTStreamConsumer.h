@@ -30,7 +30,7 @@
 #define __TRTSTREAMCONSUMER_H__
 
 #include <vector>
-#include "Queue.h"
+#include "NvRingBuffer.h"
 #include "StreamConsumer.h"
 #include "VideoEncoder.h"
 #include "trt_inference.h"
@@ -44,6 +44,13 @@ struct BufferInfo
 
 #define CLASS_NUM 3
 
+#define MAX_QUEUE_SIZE      (10)
+#define MAX_TRT_BUFFER      (10)
+// Ring capacities, powers of two. Frame rings hold every buffer plus the EOS
+// marker, the bbox ring holds one result per frame the render thread owns.
+#define FRAME_RING_SIZE     (16)
+#define BBOX_RING_SIZE      (16)
+
 typedef cv::Rect_<float> Rect2f;
 
 class NvEglRenderer;
@@ -88,15 +95,18 @@ private:
     pthread_t m_renderThread;
     pthread_t m_trtThread;
 
-    Queue<vector<Rect2f>*> m_bboxesQueue[CLASS_NUM];  // Inference result
+    NvSpscRing<vector<Rect2f>*, BBOX_RING_SIZE> m_bboxesQueue[CLASS_NUM];  // Inference result
 
     std::string m_deployFile;
     std::string m_modelFile;
     bool m_mode;
-    Queue<int> m_emptyBufferQueue;
-    Queue<int> m_emptyTRTBufferQueue;
-    Queue<BufferInfo> m_renderBufferQueue;
-    Queue<BufferInfo> m_trtBufferQueue;
+    // Each ring has one producer and one consumer thread at a time. Empty
+    // buffers come back from the render thread (directly or through the
+    // encoder) and are handed to the shutdown path only after the join.
+    NvSpscRing<int, FRAME_RING_SIZE> m_emptyBufferQueue;
+    NvSpscRing<int, FRAME_RING_SIZE> m_emptyTRTBufferQueue;
+    NvSpscRing<BufferInfo, FRAME_RING_SIZE> m_renderBufferQueue;
+    NvSpscRing<BufferInfo, FRAME_RING_SIZE> m_trtBufferQueue;
     vector<NvOSD_RectParams> m_rectParams;
 
     // Encoder support
@@ -33,6 +33,8 @@
 
 #define MAX_QUEUE_SIZE (10)
 
+static_assert(MAX_QUEUE_SIZE <= 16, "empty buffer ring is too small");
+
 extern bool g_bVerbose;
 
 VideoEncodeStreamConsumer::VideoEncodeStreamConsumer(const char *name,
@@ -90,7 +92,8 @@ bool VideoEncodeStreamConsumer::processFrame(Frame *frame)
     if (g_bVerbose)
         Log("%s: frame %d\n", __func__, iFrame->getNumber());
 
-    int dmabuf_fd = m_emptyBufferQueue.pop();
+    int dmabuf_fd;
+    m_emptyBufferQueue.pop(dmabuf_fd);
 
     // Get the IImageNativeBuffer extension interface and copy to NvBuffer.
     NV::IImageNativeBuffer *iNativeBuffer =
@@ -113,8 +116,9 @@ bool VideoEncodeStreamConsumer::threadShutdown()
     assert(m_emptyBufferQueue.size() == MAX_QUEUE_SIZE);
 
     // Destroy all buffers
-    while (m_emptyBufferQueue.size() > 0)
-        NvBufferDestroy(m_emptyBufferQueue.pop());
+    int dmabuf_fd;
+    while (m_emptyBufferQueue.try_pop(dmabuf_fd))
+        NvBufferDestroy(dmabuf_fd);
 
     return StreamConsumer::threadShutdown();
 }
@@ -31,7 +31,7 @@
 
 #include "StreamConsumer.h"
 #include "VideoEncoder.h"
-#include "Queue.h"
+#include "NvRingBuffer.h"
 
 class VideoEncodeStreamConsumer : public StreamConsumer
 {
@@ -56,7 +56,9 @@ private:
     void bufferDoneCallback(int dmabuf_fd);
 
     VideoEncoder m_VideoEncoder;
-    Queue<int> m_emptyBufferQueue;
+    // Filled and drained by the consumer thread, the encoder returns
+    // buffers from inside encodeFromFd() and shutdown().
+    NvSpscRing<int, 16> m_emptyBufferQueue;
 };
 
 #endif  // __VIDEOENCODESTREAMCONSUMER_H__